@@ -0,0 +1,279 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * admin_socket_bench: throughput and latency of the admin socket under
+ * many clients at once.  A CephContext in this process serves the socket;
+ * --clients threads each send a mix of cheap commands (version, help) and
+ * expensive ones (perf dump, config show), one after another, over a
+ * connection they keep or, with --reconnect, a new one per command, which
+ * is what the ceph CLI and most scrapers do.  That covers accepting,
+ * reading requests, finding the hook and sending the reply, and how the
+ * admin_socket_threads workers share the load.
+ */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "common/admin_socket.h"
+#include "common/ceph_context.h"
+#include "common/hdr_histogram.h"
+#include "common/utils/types.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: admin_socket_bench [options]\n"
+    "  --clients <n>    concurrent clients (default 16)\n"
+    "  --seconds <n>    how long to run (default 5)\n"
+    "  --mix <list>     weighted commands, e.g. 'version=8,help=1,\n"
+    "                   perf dump=1,config show=1' (the default)\n"
+    "  --reconnect      connect for every command rather than once\n"
+    "  --path <path>    socket to serve on (default a temporary one)\n";
+}
+
+struct command_t {
+  std::string prefix;
+  unsigned weight;
+  std::string request;  ///< as sent
+  ceph::hdr_histogram lat;
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> errors{0};
+};
+
+static int connect_to(const std::string& path)
+{
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -errno;
+  }
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+  if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    int r = -errno;
+    ::close(fd);
+    return r;
+  }
+  return fd;
+}
+
+static bool read_all(int fd, char *buf, size_t len)
+{
+  while (len) {
+    ssize_t n = ::read(fd, buf, len);
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool write_all(int fd, const std::string& s)
+{
+  for (size_t off = 0; off < s.size(); ) {
+    ssize_t n = ::write(fd, s.data() + off, s.size() - off);
+    if (n <= 0) {
+      return false;
+    }
+    off += n;
+  }
+  return true;
+}
+
+/// send request and read its reply; the reply's length, or -1
+static int64_t roundtrip(int fd, const std::string& request,
+			 std::string *reply)
+{
+  if (!write_all(fd, request)) {
+    return -1;
+  }
+  uint32_t len;
+  if (!read_all(fd, reinterpret_cast<char*>(&len), sizeof(len))) {
+    return -1;
+  }
+  reply->resize(ntohl(len));
+  if (!read_all(fd, reply->data(), reply->size())) {
+    return -1;
+  }
+  return reply->size();
+}
+
+int main(int argc, char **argv)
+{
+  unsigned clients = 16;
+  double seconds = 5;
+  std::string mix = "version=8,help=1,perf dump=1,config show=1";
+  bool reconnect = false;
+  std::string path;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--clients") {
+      clients = std::max(atoi(next()), 1);
+    } else if (arg == "--seconds") {
+      seconds = std::max(atof(next()), 0.1);
+    } else if (arg == "--mix") {
+      mix = next();
+    } else if (arg == "--reconnect") {
+      reconnect = true;
+    } else if (arg == "--path") {
+      path = next();
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  std::vector<std::unique_ptr<command_t>> commands;
+  std::vector<command_t*> deck;  ///< each command weight times
+  {
+    std::istringstream in(mix);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+      auto c = std::make_unique<command_t>();
+      const auto eq = item.rfind('=');
+      c->prefix = item.substr(0, eq);
+      c->weight = eq == std::string::npos ? 1 : atoi(item.c_str() + eq + 1);
+      c->request = "{\"prefix\": \"" + c->prefix + "\"}\n";
+      for (unsigned w = 0; w < c->weight; ++w) {
+	deck.push_back(c.get());
+      }
+      commands.push_back(std::move(c));
+    }
+  }
+  if (deck.empty()) {
+    std::cerr << "no commands in --mix" << std::endl;
+    return 1;
+  }
+
+  if (path.empty()) {
+    path = "/tmp/admin_socket_bench." + std::to_string(getpid()) + ".asok";
+  }
+  CephContext *cct = new CephContext(CEPH_ENTITY_TYPE_CLIENT);
+  cct->_log->set_stderr_level(-2, -2);
+  cct->_log->set_syslog_level(-2, -2);
+  cct->_conf.set_val("admin_socket", path);
+  if (!cct->get_admin_socket()->init(path)) {
+    std::cerr << "can't serve an admin socket on " << path << std::endl;
+    return 1;
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> connects{0};
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < clients; ++t) {
+    threads.emplace_back([&, t] {
+      std::string reply;
+      int fd = -1;
+      // each client starts at a different place in the deck, so that the
+      // expensive commands don't all arrive together
+      for (size_t i = t * 7919; !stop.load(std::memory_order_relaxed); ++i) {
+	command_t& c = *deck[i % deck.size()];
+	const auto start = bench_clock::now();
+	if (fd < 0) {
+	  fd = connect_to(path);
+	  connects++;
+	  if (fd < 0) {
+	    c.errors++;
+	    continue;
+	  }
+	}
+	const int64_t n = roundtrip(fd, c.request, &reply);
+	if (n < 0) {
+	  c.errors++;
+	  ::close(fd);
+	  fd = -1;
+	  continue;
+	}
+	c.lat.record(bench_clock::now() - start);
+	c.bytes += n;
+	if (reconnect) {
+	  ::close(fd);
+	  fd = -1;
+	}
+      }
+      if (fd >= 0) {
+	::close(fd);
+      }
+    });
+  }
+  const auto start = bench_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  const double elapsed = std::chrono::duration<double>(
+    bench_clock::now() - start).count();
+
+  printf("%u clients, %s, %.2fs, %" PRIu64 " connects\n", clients,
+	 reconnect ? "a connection per command" : "one connection each",
+	 elapsed, connects.load());
+  printf("%-16s %10s %10s %9s %9s %9s %9s %9s %7s\n", "command", "per sec",
+	 "KiB/reply", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us",
+	 "errors");
+  ceph::hdr_histogram all;
+  uint64_t errors = 0;
+  for (auto& c : commands) {
+    const uint64_t n = c->lat.count();
+    printf("%-16s %10.0f %10.1f %9.1f %9.1f %9.1f %9.1f %9.1f %7" PRIu64
+	   "\n", c->prefix.c_str(), n / elapsed,
+	   n ? c->bytes / 1024.0 / n : 0.0, c->lat.quantile(.5) / 1e3,
+	   c->lat.quantile(.9) / 1e3, c->lat.quantile(.99) / 1e3,
+	   c->lat.quantile(.999) / 1e3, c->lat.max() / 1e3,
+	   c->errors.load());
+    all.merge(c->lat);
+    errors += c->errors;
+  }
+  printf("%-16s %10.0f %10s %9.1f %9.1f %9.1f %9.1f %9.1f %7" PRIu64 "\n",
+	 "all", all.count() / elapsed, "", all.quantile(.5) / 1e3,
+	 all.quantile(.9) / 1e3, all.quantile(.99) / 1e3,
+	 all.quantile(.999) / 1e3, all.max() / 1e3, errors);
+  const auto& served = cct->get_admin_socket()->get_command_latency();
+  printf("server side: %" PRIu64 " commands, p50 %.1f us, p99 %.1f us\n",
+	 served.count(), served.quantile(.5) / 1e3, served.quantile(.99) / 1e3);
+
+  cct->put();
+  ::unlink(path.c_str());
+  return 0;
+}
@@ -0,0 +1,65 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_BENCH_ALLOC_COUNTER_H
+#define CEPH_BENCH_ALLOC_COUNTER_H
+
+/*
+ * Counting replacements for the global operator new and delete, for the
+ * benches that report how much a step allocates: while counting is set,
+ * every operator new adds to allocs and alloc_bytes.  They replace the
+ * program's, so include this from the one file with main() in it.
+ */
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+static std::atomic<bool> counting{false};
+static std::atomic<uint64_t> allocs{0};
+static std::atomic<uint64_t> alloc_bytes{0};
+
+void* operator new(std::size_t n)
+{
+  if (counting.load(std::memory_order_relaxed)) {
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(n, std::memory_order_relaxed);
+  }
+  if (void *p = malloc(n ? n : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t n)
+{
+  return operator new(n);
+}
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+void operator delete(void *p, std::size_t) noexcept
+{
+  free(p);
+}
+void operator delete[](void *p, std::size_t) noexcept
+{
+  free(p);
+}
+
+#endif
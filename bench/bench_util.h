@@ -0,0 +1,51 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_BENCH_UTIL_H
+#define CEPH_BENCH_UTIL_H
+
+// helpers more than one bench measures with
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// ns per call of run(calls), the fastest of rounds
+template<typename F>
+inline double time_per_call(uint64_t calls, unsigned rounds, F&& run)
+{
+  double best = 0;
+  for (unsigned r = 0; r < rounds; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    run(calls);
+    const double ns = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count() / calls;
+    if (r == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+/// the p'th (0..1) of sorted, or 0 if it is empty
+inline uint64_t percentile(const std::vector<uint64_t>& sorted, double p)
+{
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto i = std::min<std::size_t>(sorted.size() * p, sorted.size() - 1);
+  return sorted[i];
+}
+
+#endif
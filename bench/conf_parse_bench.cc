@@ -0,0 +1,273 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * conf_parse_bench: ConfFile's parsing speed, in MB/s and lines/s, over
+ * generated files that each lean on one part of the grammar (sections,
+ * continued lines, quoting, comments, UTF-8) and over real config files
+ * given with --corpus.  Each file is parsed both with parse_file(), which
+ * maps it, and with parse_bufferlist(), from memory; the fastest of
+ * --rounds is reported.  A file that parses with errors is reported as
+ * such, since a parser that stops early looks fast.
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/ConfUtils.h"
+#include "include/buffer.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: conf_parse_bench [options]\n"
+    "  --size <MiB>     size of each generated file (default 4)\n"
+    "  --rounds <n>     parses per file; the fastest is reported (default 5)\n"
+    "  --corpus <path>  also parse this file, or every file in this\n"
+    "                   directory; may be repeated\n"
+    "  --keep <dir>     write the generated files here and keep them\n";
+}
+
+/// a generator appends one unit (a section, or a few lines) to out, and
+/// returns the lines it added
+struct workload_t {
+  const char *name;
+  std::function<unsigned(unsigned i, std::string *out)> gen;
+};
+
+static const std::vector<workload_t> workloads = {
+  {"plain", [](unsigned i, std::string *out) {
+    if (i % 64 == 0) {
+      *out += "[client." + std::to_string(i / 64) + "]\n";
+    }
+    *out += "\tsome_option_" + std::to_string(i % 64) + " = " +
+      std::to_string(i * 7919) + "\n";
+    return i % 64 == 0 ? 2 : 1;
+  }},
+  {"sections", [](unsigned i, std::string *out) {
+    *out += "[osd." + std::to_string(i) + "]\n"
+      "\thost = node" + std::to_string(i / 12) + "\n"
+      "\tosd_memory_target = 4G\n";
+    return 3;
+  }},
+  {"continued", [](unsigned i, std::string *out) {
+    *out += "long_value_" + std::to_string(i) + " = ";
+    for (unsigned j = 0; j < 8; ++j) {
+      *out += "part" + std::to_string(j) + " of a value split over lines \\\n";
+    }
+    *out += "end\n";
+    return 9;
+  }},
+  {"quoted", [](unsigned i, std::string *out) {
+    *out += "quoted_" + std::to_string(i) +
+      " = \"a value with spaces, \\\"escaped quotes\\\", a # and a ; "
+      "that aren't comments, and a \\\\ backslash\"\n";
+    return 1;
+  }},
+  {"comments", [](unsigned i, std::string *out) {
+    *out += "# a comment line, as config management writes them above\n"
+      "; every option, explaining what it is for\n"
+      "option_" + std::to_string(i) + " = " + std::to_string(i) +
+      "   # and a trailing one\n";
+    return 3;
+  }},
+  {"utf8", [](unsigned i, std::string *out) {
+    *out += "# réglage n°" + std::to_string(i) + " — 設定 ✓\n"
+      "name_" + std::to_string(i) + " = \"Zürich–Köln ☃ 東京\"\n";
+    return 2;
+  }},
+};
+
+struct input_t {
+  std::string name;
+  std::string path;
+  std::string data;
+  uint64_t lines = 0;
+};
+
+static bool read_file(const std::string& path, std::string *out)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  *out = ss.str();
+  return true;
+}
+
+static void add_corpus(const std::string& path, std::vector<input_t> *inputs)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) < 0) {
+    std::cerr << "can't stat " << path << std::endl;
+    exit(1);
+  }
+  std::vector<std::string> files;
+  if (S_ISDIR(st.st_mode)) {
+    DIR *d = ::opendir(path.c_str());
+    while (struct dirent *e = d ? ::readdir(d) : nullptr) {
+      const std::string f = path + "/" + e->d_name;
+      if (e->d_name[0] != '.' && ::stat(f.c_str(), &st) == 0 &&
+	  S_ISREG(st.st_mode)) {
+	files.push_back(f);
+      }
+    }
+    if (d) {
+      ::closedir(d);
+    }
+    std::sort(files.begin(), files.end());
+  } else {
+    files.push_back(path);
+  }
+  for (auto& f : files) {
+    input_t in;
+    in.name = f.substr(f.rfind('/') + 1);
+    in.path = f;
+    if (!read_file(f, &in.data)) {
+      std::cerr << "can't read " << f << std::endl;
+      exit(1);
+    }
+    in.lines = std::count(in.data.begin(), in.data.end(), '\n');
+    inputs->push_back(std::move(in));
+  }
+}
+
+/// seconds per parse of run(), the fastest of rounds
+template<typename F>
+static double best_of(unsigned rounds, F&& run)
+{
+  double best = 0;
+  for (unsigned r = 0; r < rounds; ++r) {
+    auto start = bench_clock::now();
+    run();
+    const double s = std::chrono::duration<double>(
+      bench_clock::now() - start).count();
+    if (r == 0 || s < best) {
+      best = s;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char **argv)
+{
+  double size_mib = 4;
+  unsigned rounds = 5;
+  std::vector<std::string> corpus;
+  std::string keep;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--size") {
+      size_mib = std::max(atof(next()), 0.001);
+    } else if (arg == "--rounds") {
+      rounds = std::max(atoi(next()), 1);
+    } else if (arg == "--corpus") {
+      corpus.push_back(next());
+    } else if (arg == "--keep") {
+      keep = next();
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  const std::size_t size = size_mib * (1 << 20);
+  const std::string dir = keep.empty() ? "/tmp" : keep;
+  std::vector<input_t> inputs;
+  for (auto& w : workloads) {
+    input_t in;
+    in.name = w.name;
+    in.path = dir + "/conf_parse_bench." + w.name + ".conf";
+    in.data = "[global]\n";
+    in.lines = 1;
+    for (unsigned i = 0; in.data.size() < size; ++i) {
+      in.lines += w.gen(i, &in.data);
+    }
+    std::ofstream out(in.path, std::ios::binary | std::ios::trunc);
+    out << in.data;
+    if (!out) {
+      std::cerr << "can't write " << in.path << std::endl;
+      return 1;
+    }
+    inputs.push_back(std::move(in));
+  }
+  for (auto& c : corpus) {
+    add_corpus(c, &inputs);
+  }
+
+  printf("%-24s %9s %9s | %-28s | %-28s\n", "", "", "", "parse_file()",
+	 "parse_bufferlist()");
+  printf("%-24s %9s %9s | %8s %8s %10s | %8s %8s %10s\n", "input", "KiB",
+	 "lines", "ms", "MB/s", "Mlines/s", "ms", "MB/s", "Mlines/s");
+  for (auto& in : inputs) {
+    std::size_t errors = 0;
+    const double file_s = best_of(rounds, [&] {
+      ConfFile cf;
+      std::deque<std::string> errs;
+      cf.parse_file(in.path, &errs, nullptr);
+      errors = errs.size();
+    });
+    ceph::bufferlist bl;
+    bl.append(in.data.data(), in.data.size());
+    const double buf_s = best_of(rounds, [&] {
+      ConfFile cf;
+      std::deque<std::string> errs;
+      cf.parse_bufferlist(&bl, &errs, nullptr);
+    });
+    const double mb = in.data.size() / 1e6;
+    const double mlines = in.lines / 1e6;
+    printf("%-24s %9zu %9lu | %8.2f %8.1f %10.2f | %8.2f %8.1f %10.2f",
+	   in.name.c_str(), in.data.size() / 1024, (unsigned long)in.lines,
+	   file_s * 1e3, mb / file_s, mlines / file_s,
+	   buf_s * 1e3, mb / buf_s, mlines / buf_s);
+    if (errors) {
+      printf(" (%zu errors)", errors);
+    }
+    printf("\n");
+  }
+
+  if (keep.empty()) {
+    for (size_t i = 0; i < workloads.size(); ++i) {
+      ::unlink(inputs[i].path.c_str());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,195 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * config_bench: the cost of reading an option, by each of the ways code
+ * reads one: the legacy member, get_val<T>(key), get_val<T>(OptionId),
+ * with_val(), get_snapshot() and md_config_cacher_t.  Each is timed on its
+ * own, then with 1 to --max-readers threads reading at once while another
+ * calls set_val() and apply_changes() --writes times a second, which is
+ * where a shared lock or a refcount on the read path shows.
+ *
+ * The option read is log_max_recent, which has a legacy member; the
+ * writer flips it between two values, so LogObs's cost is in the writes.
+ */
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "common/ceph_context.h"
+#include "common/config_cacher.h"
+#include "common/utils/types.h"
+
+#include "bench_util.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: config_bench [options]\n"
+    "  --reads <n>        reads per measurement by one thread (default 10000000)\n"
+    "  --rounds <n>       measurements per case; the fastest is reported\n"
+    "                     (default 5)\n"
+    "  --max-readers <n>  the most concurrent readers, doubling from 1\n"
+    "                     (default 128)\n"
+    "  --writes <n>       set_val+apply_changes per second while readers run,\n"
+    "                     0 for none (default 1000)\n"
+    "  --seconds <n>      how long each concurrent case runs (default 1)\n";
+}
+
+static const char *const KEY = "log_max_recent";
+
+/// keeps the compiler from dropping a read whose value goes unused
+template<typename T>
+static inline void use(const T& v)
+{
+  asm volatile("" :: "g"(&v) : "memory");
+}
+
+struct access_t {
+  const char *name;
+  /// read the option once
+  std::function<void()> read;
+};
+
+int main(int argc, char **argv)
+{
+  uint64_t reads = 10000000;
+  unsigned rounds = 5;
+  unsigned max_readers = 128;
+  unsigned writes = 1000;
+  double seconds = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--reads") {
+      reads = std::max<uint64_t>(strtoull(next(), nullptr, 10), 1);
+    } else if (arg == "--rounds") {
+      rounds = std::max(atoi(next()), 1);
+    } else if (arg == "--max-readers") {
+      max_readers = std::max(atoi(next()), 1);
+    } else if (arg == "--writes") {
+      writes = std::max(atoi(next()), 0);
+    } else if (arg == "--seconds") {
+      seconds = std::max(atof(next()), 0.01);
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  CephContext *cct = new CephContext(CEPH_ENTITY_TYPE_CLIENT);
+  cct->_log->set_stderr_level(-2, -2);
+  cct->_log->set_syslog_level(-2, -2);
+  auto& conf = cct->_conf;
+  conf.set_safe_to_start_threads();
+  const OptionId id = conf.get_option_id(KEY);
+  md_config_cacher_t<int64_t> cached(conf, KEY);
+
+  // each of these is called in a loop, so the std::function's call is in
+  // every case alike; what differs is the read
+  const std::vector<access_t> accesses = {
+    {"legacy member", [&conf] { use(conf->log_max_recent); }},
+    {"get_val(key)", [&conf] { use(conf.get_val<int64_t>(KEY)); }},
+    {"get_val(id)", [&conf, id] { use(conf.get_val<int64_t>(id)); }},
+    {"with_val", [&conf] {
+      use(conf.with_val<int64_t>(KEY, [](const int64_t& v) { return v; }));
+    }},
+    {"get_snapshot", [&conf, id] {
+      auto s = conf.get_snapshot();
+      use(boost::get<int64_t>(s->at(static_cast<size_t>(id))));
+    }},
+    {"md_config_cacher_t", [&cached] { use(int64_t(cached)); }},
+  };
+
+  printf("reads %" PRIu64 " rounds %u, one thread, no writer\n", reads,
+	 rounds);
+  for (auto& a : accesses) {
+    const double ns = time_per_call(reads, rounds, [&a](uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i) {
+	a.read();
+      }
+    });
+    printf("  %-20s %8.2f ns/read\n", a.name, ns);
+  }
+
+  printf("concurrent readers for %.2fs each, writer at %u/s\n", seconds,
+	 writes);
+  printf("  %-20s %7s %12s %10s %8s\n", "access", "readers", "Mreads/s",
+	 "ns/read", "writes");
+  for (auto& a : accesses) {
+    for (unsigned readers = 1; readers <= max_readers; readers *= 2) {
+      std::atomic<bool> stop{false};
+      std::atomic<uint64_t> total{0};
+      uint64_t written = 0;
+      std::vector<std::thread> threads;
+      for (unsigned t = 0; t < readers; ++t) {
+	threads.emplace_back([&a, &stop, &total] {
+	  uint64_t n = 0;
+	  while (!stop.load(std::memory_order_relaxed)) {
+	    for (unsigned i = 0; i < 256; ++i) {
+	      a.read();
+	    }
+	    n += 256;
+	  }
+	  total += n;
+	});
+      }
+      const auto start = bench_clock::now();
+      const auto end = start + std::chrono::duration_cast<bench_clock::duration>(
+	std::chrono::duration<double>(seconds));
+      if (writes) {
+	const auto period = std::chrono::nanoseconds(1000000000 / writes);
+	for (auto t = start; t < end; t += period) {
+	  std::this_thread::sleep_until(t);
+	  conf.set_val(KEY, written++ % 2 ? "10000" : "10001");
+	  conf.apply_changes(nullptr);
+	}
+      }
+      std::this_thread::sleep_until(end);
+      stop = true;
+      for (auto& t : threads) {
+	t.join();
+      }
+      const double elapsed = std::chrono::duration<double>(
+	bench_clock::now() - start).count();
+      const double rate = total / elapsed;
+      printf("  %-20s %7u %12.2f %10.2f %8" PRIu64 "\n", a.name, readers,
+	     rate / 1e6, 1e9 * readers / rate, written);
+    }
+  }
+
+  cct->put();
+  return 0;
+}
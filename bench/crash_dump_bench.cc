@@ -0,0 +1,347 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * crash_dump_bench: how long dumping the recent entries takes, which is
+ * most of the time from a crash to the process being gone and restartable.
+ *
+ * For each --entries count the recent ring is filled with entries of
+ * typical sizes (mostly short, a few long), then timed are dump_recent(),
+ * with the allocations it makes, and dump_recent_crash(), the signal
+ * handler's variant.  With --crash, a child process (this binary re-exec'd)
+ * starts up with global_init(), fills its ring the same way and raises
+ * SIGSEGV, and what is timed is from the raise to the parent reaping it,
+ * with the crash_dir entry written; that includes walking the threads for
+ * backtraces and the dump to the log file.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/ceph_context.h"
+#include "common/dout.h"
+#include "common/logging/Entry.h"
+#include "common/logging/Log.h"
+#include "common/logging/SubsystemMap.h"
+#include "global/global_init.h"
+#include "common/utils/types.h"
+
+#include "alloc_counter.h"
+
+#define dout_subsys ceph_subsys_
+
+using namespace ceph::logging;
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: crash_dump_bench [options]\n"
+    "  --entries <list>  recent entries to dump (default 10000,100000,1000000)\n"
+    "  --sink <sink>     where the dump goes: file:<path> or null\n"
+    "                    (default null)\n"
+    "  --crash           also time a real crash of a child process\n"
+    "  --runs <n>        crashes per count, the median reported (default 3)\n";
+}
+
+// entries are gathered at GATHER_LEVEL but only logged at LOG_LEVEL, so
+// they go to the recent ring and nowhere else until the dump
+static constexpr int LOG_LEVEL = 0;
+static constexpr int GATHER_LEVEL = 20;
+
+/// a message length as a daemon's debug output has them: mostly a line,
+/// now and then a dump of some structure
+static std::size_t entry_size(std::mt19937& rng)
+{
+  std::uniform_int_distribution<unsigned> pct(0, 99);
+  const unsigned p = pct(rng);
+  if (p < 70) {
+    return std::uniform_int_distribution<std::size_t>(40, 160)(rng);
+  } else if (p < 97) {
+    return std::uniform_int_distribution<std::size_t>(160, 600)(rng);
+  }
+  return std::uniform_int_distribution<std::size_t>(600, 4096)(rng);
+}
+
+/// fill(n) fills a ring with n entries through submit(size, i)
+template<typename F>
+static uint64_t fill(uint64_t n, F&& submit)
+{
+  std::mt19937 rng(42);
+  uint64_t bytes = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    const std::size_t size = entry_size(rng);
+    submit(size, i);
+    bytes += size;
+  }
+  return bytes;
+}
+
+static const std::string payload(4096, 'x');
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* The child: argv is --crash-child <entries> <dir> <fd>.  Fills the ring,
+ * writes the CLOCK_MONOTONIC time it raises SIGSEGV at to fd, and
+ * raises it.
+ */
+static int run_crash_child(char **argv)
+{
+  const uint64_t n = strtoull(argv[2], nullptr, 10);
+  const std::string dir = argv[3];
+  const int fd = atoi(argv[4]);
+  const std::string max_recent = std::to_string(n);
+  const std::string crash_dir = dir + "/crash";
+  const std::string log_file = dir + "/log";
+  std::vector<const char*> args = {
+    "--log_max_recent", max_recent.c_str(),
+    "--log_max_recent_bytes", "4G",
+    "--crash_dir", crash_dir.c_str(),
+    "--log_file", log_file.c_str(),
+    "--log_to_stderr", "false",
+    "--err_to_stderr", "false",
+  };
+  auto cct = global_init(nullptr, args, CEPH_ENTITY_TYPE_CLIENT,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DAEMON_ACTIONS |
+			 CINIT_FLAG_NO_MON_CONFIG);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->subsys.set_log_level(dout_subsys, LOG_LEVEL);
+  g_ceph_context->_conf->subsys.set_gather_level(dout_subsys, GATHER_LEVEL);
+  fill(n, [](std::size_t size, uint64_t i) {
+    ldout(g_ceph_context, GATHER_LEVEL) << "op " << i << " "
+					<< std::string_view(payload.data(), size)
+					<< dendl;
+  });
+  g_ceph_context->_log->flush();
+
+  // no core file: it would be most of the time, and isn't ours
+  struct rlimit rl = {0, 0};
+  ::setrlimit(RLIMIT_CORE, &rl);
+  const uint64_t t = now_ns();
+  if (::write(fd, &t, sizeof(t)) != sizeof(t)) {
+    return 1;
+  }
+  ::close(fd);
+  ::raise(SIGSEGV);
+  return 1;
+}
+
+/// ns from the child raising SIGSEGV to being reaped, or 0
+static uint64_t crash_once(uint64_t n, const std::string& dir)
+{
+  int fds[2];
+  if (::pipe(fds) < 0) {
+    perror("pipe");
+    return 0;
+  }
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    ::close(fds[0]);
+    const std::string entries = std::to_string(n);
+    const std::string fd = std::to_string(fds[1]);
+    int null = ::open("/dev/null", O_WRONLY);
+    ::dup2(null, STDOUT_FILENO);
+    ::dup2(null, STDERR_FILENO);
+    ::execl("/proc/self/exe", "crash_dump_bench", "--crash-child",
+	    entries.c_str(), dir.c_str(), fd.c_str(), (char*)nullptr);
+    _exit(127);
+  }
+  ::close(fds[1]);
+  uint64_t raised = 0;
+  const bool got = ::read(fds[0], &raised, sizeof(raised)) == sizeof(raised);
+  ::close(fds[0]);
+  int status;
+  ::waitpid(pid, &status, 0);
+  const uint64_t reaped = now_ns();
+  if (!got || !WIFSIGNALED(status)) {
+    std::cerr << "child didn't crash as expected, status " << status
+	      << std::endl;
+    return 0;
+  }
+  return reaped - raised;
+}
+
+static uint64_t dir_bytes(const std::string& dir)
+{
+  uint64_t bytes = 0;
+  std::error_code ec;
+  for (auto& e : std::filesystem::recursive_directory_iterator(dir, ec)) {
+    if (e.is_regular_file(ec)) {
+      bytes += e.file_size(ec);
+    }
+  }
+  return bytes;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 5 && std::string_view(argv[1]) == "--crash-child") {
+    return run_crash_child(argv);
+  }
+
+  std::vector<uint64_t> counts = {10000, 100000, 1000000};
+  std::string sink = "null";
+  bool crash = false;
+  unsigned runs = 3;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--entries") {
+      counts.clear();
+      std::istringstream in(next());
+      std::string item;
+      while (std::getline(in, item, ',')) {
+	counts.push_back(std::max<uint64_t>(strtoull(item.c_str(), nullptr, 10),
+					    1));
+      }
+    } else if (arg == "--sink") {
+      sink = next();
+    } else if (arg == "--crash") {
+      crash = true;
+    } else if (arg == "--runs") {
+      runs = std::max(atoi(next()), 1);
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+  std::string path;
+  if (sink == "null") {
+    path = "/dev/null";
+  } else if (sink.compare(0, 5, "file:") == 0) {
+    path = sink.substr(5);
+  } else {
+    std::cerr << "unknown sink " << sink << std::endl;
+    return 1;
+  }
+
+  // the crashes first, while this process has no threads to fork away from
+  std::vector<std::vector<uint64_t>> crash_ns(counts.size());
+  std::vector<uint64_t> crash_bytes(counts.size());
+  if (crash) {
+    for (size_t c = 0; c < counts.size(); ++c) {
+      for (unsigned r = 0; r < runs; ++r) {
+	char tmpl[] = "/tmp/crash_dump_bench.XXXXXX";
+	if (!::mkdtemp(tmpl)) {
+	  perror("mkdtemp");
+	  return 1;
+	}
+	const std::string dir = tmpl;
+	::mkdir((dir + "/crash").c_str(), 0700);
+	if (uint64_t ns = crash_once(counts[c], dir); ns) {
+	  crash_ns[c].push_back(ns);
+	}
+	crash_bytes[c] = dir_bytes(dir + "/crash");
+	std::error_code ec;
+	std::filesystem::remove_all(dir, ec);
+      }
+    }
+  }
+
+  printf("%10s %10s %12s %12s %10s %12s", "entries", "MiB", "dump ms",
+	 "allocs", "alloc KiB", "crash dump ms");
+  if (crash) {
+    printf(" %12s %12s", "to exit ms", "crash KiB");
+  }
+  printf("\n");
+  for (size_t c = 0; c < counts.size(); ++c) {
+    const uint64_t n = counts[c];
+    SubsystemMap subs;
+    subs.set_log_level(0, LOG_LEVEL);
+    subs.set_gather_level(0, GATHER_LEVEL);
+    Log log(&subs);
+    log.set_max_recent(n);
+    log.set_max_recent_bytes(uint64_t(n) * 8192);
+    log.set_stderr_level(-2, -2);
+    log.set_syslog_level(-2, -2);
+    log.set_log_file(path);
+    log.reopen_log_file();
+    log.start();
+    const uint64_t bytes = fill(n, [&log](std::size_t size, uint64_t i) {
+      MutableEntry e(GATHER_LEVEL, 0);
+      e.get_ostream() << "op " << i << " "
+		      << std::string_view(payload.data(), size);
+      log.submit_entry(std::move(e));
+    });
+    log.flush();
+
+    const int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    auto start = bench_clock::now();
+    log.dump_recent_crash(fd);
+    const double crash_ms = std::chrono::duration<double, std::milli>(
+      bench_clock::now() - start).count();
+    if (fd >= 0) {
+      ::close(fd);
+    }
+
+    // after the crash variant, which leaves the ring as it is
+    const uint64_t a0 = allocs, b0 = alloc_bytes;
+    counting = true;
+    start = bench_clock::now();
+    log.dump_recent();
+    const double dump_ms = std::chrono::duration<double, std::milli>(
+      bench_clock::now() - start).count();
+    counting = false;
+    log.stop();
+
+    printf("%10" PRIu64 " %10.1f %12.2f %12" PRIu64 " %10" PRIu64 " %12.2f",
+	   n, bytes / 1048576.0, dump_ms, allocs - a0,
+	   (alloc_bytes - b0) / 1024, crash_ms);
+    if (crash) {
+      auto& v = crash_ns[c];
+      double median = 0;
+      if (!v.empty()) {
+	std::sort(v.begin(), v.end());
+	median = v[v.size() / 2] / 1e6;
+      }
+      printf(" %12.2f %12" PRIu64, median, crash_bytes[c] / 1024);
+    }
+    printf("\n");
+  }
+  return 0;
+}
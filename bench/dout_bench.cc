@@ -0,0 +1,165 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * dout_bench: time a dout site per call, through the real macros and a
+ * CephContext.  A site that is not gathered should cost a load and a
+ * branch; a gathered one is broken down into constructing the entry,
+ * formatting into it and submitting it to the log.  Build it without a
+ * CEPH_LOG_MAX_LEVEL ceiling below 20, or the disabled sites are compiled
+ * out and measure an empty loop.
+ */
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "common/ceph_context.h"
+#include "common/dout.h"
+#include "common/utils/types.h"
+
+#include "bench_util.h"
+
+#define dout_subsys ceph_subsys_
+
+static void usage()
+{
+  std::cout <<
+    "usage: dout_bench [options]\n"
+    "  --calls <n>    calls per measurement (default 10000000)\n"
+    "  --rounds <n>   measurements per case; the fastest is reported\n"
+    "                 (default 5)\n"
+    "  --sink <sink>  where gathered lines go: file:<path> or null\n"
+    "                 (default null)\n";
+}
+
+// sites at ENABLED_LEVEL are logged, those at DISABLED_LEVEL are not even
+// gathered
+static constexpr int ENABLED_LEVEL = 1;
+static constexpr int DISABLED_LEVEL = 20;
+
+/// keeps the compiler from folding the loop around a site that does nothing
+static inline void clobber()
+{
+  asm volatile("" ::: "memory");
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t calls = 10000000;
+  unsigned rounds = 5;
+  std::string sink = "null";
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--calls") {
+      calls = std::max<uint64_t>(strtoull(next(), nullptr, 10), 1);
+    } else if (arg == "--rounds") {
+      rounds = std::max(atoi(next()), 1);
+    } else if (arg == "--sink") {
+      sink = next();
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  CephContext *cct = new CephContext(CEPH_ENTITY_TYPE_CLIENT);
+  cct->_conf->subsys.set_log_level(dout_subsys, ENABLED_LEVEL);
+  cct->_conf->subsys.set_gather_level(dout_subsys, ENABLED_LEVEL);
+  auto log = cct->_log;
+  log->set_stderr_level(-2, -2);
+  log->set_syslog_level(-2, -2);
+  if (sink == "null") {
+    log->set_log_file("/dev/null");
+  } else if (sink.compare(0, 5, "file:") == 0) {
+    log->set_log_file(sink.substr(5));
+  } else {
+    std::cerr << "unknown sink " << sink << std::endl;
+    return 1;
+  }
+  log->reopen_log_file();
+
+  const NoDoutPrefix dpp(cct, dout_subsys);
+  const uint64_t value = 0x1234;
+
+  const double disabled_static = time_per_call(calls, rounds, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      ldout(cct, DISABLED_LEVEL) << "op " << i << " value " << value << dendl;
+      clobber();
+    }
+  });
+  const double disabled_dynamic = time_per_call(calls, rounds, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      ldpp_dout(&dpp, DISABLED_LEVEL) << "op " << i << " value " << value
+				      << dendl;
+      clobber();
+    }
+  });
+
+  // the gathered path, a step at a time
+  const double construct = time_per_call(calls, rounds, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      ceph::logging::MutableEntry e(ENABLED_LEVEL, dout_subsys);
+      clobber();
+    }
+  });
+  const double format = time_per_call(calls, rounds, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      ceph::logging::MutableEntry e(ENABLED_LEVEL, dout_subsys);
+      e.get_ostream() << "op " << i << " value " << value;
+      clobber();
+    }
+  });
+  const double enabled_static = time_per_call(calls, rounds, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      ldout(cct, ENABLED_LEVEL) << "op " << i << " value " << value << dendl;
+    }
+    log->flush();
+  });
+  const double enabled_dynamic = time_per_call(calls, rounds, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      ldpp_dout(&dpp, ENABLED_LEVEL) << "op " << i << " value " << value
+				     << dendl;
+    }
+    log->flush();
+  });
+
+  printf("calls %" PRIu64 " rounds %u sink %s\n", calls, rounds, sink.c_str());
+  printf("disabled ldout        %8.2f ns/call\n", disabled_static);
+  printf("disabled ldpp_dout    %8.2f ns/call\n", disabled_dynamic);
+  printf("enabled ldout         %8.2f ns/call\n", enabled_static);
+  printf("  construct entry     %8.2f ns\n", construct);
+  printf("  format              %8.2f ns\n", std::max(format - construct, 0.0));
+  printf("  submit and flush    %8.2f ns\n",
+	 std::max(enabled_static - format, 0.0));
+  printf("enabled ldpp_dout     %8.2f ns/call\n", enabled_dynamic);
+
+  cct->put();
+  return 0;
+}
@@ -0,0 +1,118 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * inline_memcpy_bench: time maybe_inline_memcpy() against memcpy() for
+ * copies of sizes drawn from a range, as StackStringBuf::xsputn() sees them,
+ * and report the time per copy.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "common/utils/inline_memory.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: inline_memcpy_bench [options]\n"
+    "  --min <bytes>      smallest copy (default 1)\n"
+    "  --max <bytes>      largest copy, at most 64 (default 64)\n"
+    "  --copies <n>       copies per variant (default 100000000)\n";
+}
+
+static constexpr std::size_t SIZES = 4096;
+static constexpr std::size_t SPAN = 4096;
+
+// both walk the same sizes and offsets; the offsets keep the copies
+// unaligned and the buffers in L1
+template<typename Copy>
+static void run(const char *name, Copy copy, const std::vector<uint8_t>& sizes,
+		uint64_t copies)
+{
+  static char src[SPAN + 64], dst[SPAN + 64];
+  memset(src, 'x', sizeof(src));
+  auto start = bench_clock::now();
+  std::size_t off = 0;
+  for (uint64_t i = 0; i < copies; ++i) {
+    const std::size_t l = sizes[i % SIZES];
+    copy(dst + off, src + (off ^ 7), l);
+    off = (off + l + 3) % SPAN;
+  }
+  const double secs = std::chrono::duration<double>(
+    bench_clock::now() - start).count();
+  // keep the copies from being thrown away
+  volatile char sink = dst[sizes[0]];
+  (void)sink;
+  printf("%-20s %6.2f ns/copy\n", name, secs * 1e9 / copies);
+}
+
+int main(int argc, char **argv)
+{
+  std::size_t min = 1, max = 64;
+  uint64_t copies = 100000000;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--min") {
+      min = strtoull(next(), nullptr, 10);
+    } else if (arg == "--max") {
+      max = std::min<std::size_t>(strtoull(next(), nullptr, 10), 64);
+    } else if (arg == "--copies") {
+      copies = strtoull(next(), nullptr, 10);
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+  if (min > max) {
+    std::cerr << "--min is over --max" << std::endl;
+    return 1;
+  }
+
+  std::minstd_rand rng(1);
+  std::vector<uint8_t> sizes(SIZES);
+  for (auto& s : sizes) {
+    s = min + rng() % (max - min + 1);
+  }
+  // called through a pointer, as a copy the compiler can't size is
+  void *(*volatile libc_memcpy)(void*, const void*, size_t) = memcpy;
+
+  printf("sizes %zu-%zu\n", min, max);
+  run("maybe_inline_memcpy", [](char *d, const char *s, std::size_t l) {
+    maybe_inline_memcpy(d, s, l, 64);
+  }, sizes, copies);
+  run("memcpy", [&](char *d, const char *s, std::size_t l) {
+    libc_memcpy(d, s, l);
+  }, sizes, copies);
+  return 0;
+}
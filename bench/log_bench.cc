@@ -0,0 +1,266 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * log_bench: drive Log::submit_entry() from several threads and report
+ * submission throughput, per-entry submit latency and the time submitters
+ * spent blocked waiting for the flusher.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "common/logging/Entry.h"
+#include "common/logging/Log.h"
+#include "common/logging/SubsystemMap.h"
+
+#include "bench_util.h"
+
+using namespace ceph::logging;
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: log_bench [options]\n"
+    "  --threads <n>        submitting threads (default 4)\n"
+    "  --entries <n>        entries per thread (default 100000)\n"
+    "  --size <bytes>       message size (default 100)\n"
+    "  --mixed              format a typical message of integers, hex,\n"
+    "                       pointers and floats instead of a fixed payload\n"
+    "  --ostream            with --mixed, format through std::ostream rather\n"
+    "                       than the stream's direct inserters\n"
+    "  --gather-only <pct>  share of entries gathered but not logged, i.e.\n"
+    "                       only kept for dump_recent() (default 0)\n"
+    "  --sink <sink>        file:<path>, stderr or null (default null)\n"
+    "  --max-new <n>        log_max_new (default 100)\n"
+    "  --thread-ring <n>    log_thread_ring_size (default 0)\n"
+    "  --queue-shards <n>   log_queue_shards (default 0)\n"
+    "  --flush-batch <n>    log_flush_batch (default 1)\n"
+    "  --flush-delay <us>   log_flush_max_delay (default 0)\n"
+    "  --reorder-window <us> log_reorder_window (default 0)\n"
+    "  --async              log_async_write = true\n"
+    "  --mmap               log_mmap_write = true\n"
+    "  --binary             log_format = binary\n"
+    "  --suppress-repeats   log_suppress_repeats = true\n"
+    "  --compression <type> log_compression: none, zstd or lz4 (default none)\n"
+    "  --format-threads <n> log_format_threads (default 0)\n";
+}
+
+struct Options {
+  unsigned threads = 4;
+  uint64_t entries = 100000;
+  std::size_t size = 100;
+  bool mixed = false;
+  bool ostream = false;
+  unsigned gather_only = 0;
+  std::string sink = "null";
+  std::size_t max_new = 100;
+  std::size_t thread_ring = 0;
+  std::size_t queue_shards = 0;
+  std::size_t flush_batch = 1;
+  uint64_t flush_delay = 0;
+  uint64_t reorder_window = 0;
+  bool async = false;
+  bool mmap = false;
+  bool binary = false;
+  bool suppress_repeats = false;
+  std::string compression = "none";
+  unsigned format_threads = 0;
+};
+
+// entries at LOG_LEVEL are written, entries at GATHER_LEVEL only gathered
+static constexpr int LOG_LEVEL = 1;
+static constexpr int GATHER_LEVEL = 5;
+
+template<typename Stream>
+static void format_mixed(Stream& out, unsigned id, uint64_t i,
+			 const void *obj)
+{
+  out << "osd." << id << " pg 3." << std::hex << (i % 4096) << std::dec
+      << " epoch " << (i / 16) << " obj " << obj << " op " << (i * 7919)
+      << " lat " << (i % 1000) * 0.000137 << " len " << (i % 64) * 4096
+      << " flags " << std::hex << (i & 0xffff) << std::dec << ' '
+      << (i % 3 == 0);
+}
+
+static void run_thread(Log& log, const Options& opts, unsigned id,
+		       std::vector<uint64_t>& latencies)
+{
+  const std::string payload(opts.size, 'a' + id % 26);
+  std::minstd_rand rng(id);
+  latencies.reserve(opts.entries);
+  for (uint64_t i = 0; i < opts.entries; ++i) {
+    const int prio = rng() % 100 < opts.gather_only ? GATHER_LEVEL : LOG_LEVEL;
+    auto start = bench_clock::now();
+    {
+      MutableEntry e(prio, 0);
+      if (!opts.mixed) {
+	e.get_ostream() << payload;
+      } else if (opts.ostream) {
+	format_mixed(static_cast<std::ostream&>(e.get_ostream()), id, i,
+		     &payload);
+      } else {
+	format_mixed(e.get_ostream(), id, i, &payload);
+      }
+      log.submit_entry(std::move(e));
+    }
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      bench_clock::now() - start).count());
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--threads") {
+      opts.threads = std::max(atoi(next()), 1);
+    } else if (arg == "--entries") {
+      opts.entries = strtoull(next(), nullptr, 10);
+    } else if (arg == "--size") {
+      opts.size = strtoull(next(), nullptr, 10);
+    } else if (arg == "--mixed") {
+      opts.mixed = true;
+    } else if (arg == "--ostream") {
+      opts.ostream = true;
+    } else if (arg == "--gather-only") {
+      opts.gather_only = std::min(atoi(next()), 100);
+    } else if (arg == "--sink") {
+      opts.sink = next();
+    } else if (arg == "--max-new") {
+      opts.max_new = strtoull(next(), nullptr, 10);
+    } else if (arg == "--thread-ring") {
+      opts.thread_ring = strtoull(next(), nullptr, 10);
+    } else if (arg == "--queue-shards") {
+      opts.queue_shards = strtoull(next(), nullptr, 10);
+    } else if (arg == "--flush-batch") {
+      opts.flush_batch = strtoull(next(), nullptr, 10);
+    } else if (arg == "--flush-delay") {
+      opts.flush_delay = strtoull(next(), nullptr, 10);
+    } else if (arg == "--reorder-window") {
+      opts.reorder_window = strtoull(next(), nullptr, 10);
+    } else if (arg == "--async") {
+      opts.async = true;
+    } else if (arg == "--mmap") {
+      opts.mmap = true;
+    } else if (arg == "--binary") {
+      opts.binary = true;
+    } else if (arg == "--suppress-repeats") {
+      opts.suppress_repeats = true;
+    } else if (arg == "--compression") {
+      opts.compression = next();
+    } else if (arg == "--format-threads") {
+      opts.format_threads = atoi(next());
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  SubsystemMap subs;
+  subs.set_log_level(0, LOG_LEVEL);
+  subs.set_gather_level(0, GATHER_LEVEL);
+
+  Log log(&subs);
+  if (opts.sink == "stderr") {
+    log.set_stderr_level(LOG_LEVEL, LOG_LEVEL);
+  } else if (opts.sink == "null") {
+    log.set_log_file("/dev/null");
+  } else if (opts.sink.compare(0, 5, "file:") == 0) {
+    log.set_log_file(opts.sink.substr(5));
+  } else {
+    std::cerr << "unknown sink " << opts.sink << std::endl;
+    return 1;
+  }
+  log.set_max_new(opts.max_new);
+  log.set_thread_ring_size(opts.thread_ring);
+  log.set_queue_shards(opts.queue_shards);
+  log.set_flush_batch(opts.flush_batch,
+		      std::chrono::microseconds(opts.flush_delay));
+  log.set_reorder_window(std::chrono::microseconds(opts.reorder_window),
+			 1 << 20);
+  log.set_async_write(opts.async);
+  log.set_mmap_write(opts.mmap);
+  log.set_log_format(opts.binary ? LogFormat::BINARY : LogFormat::TEXT);
+  log.set_suppress_repeats(opts.suppress_repeats);
+  log.set_format_threads(opts.format_threads);
+  if (log.set_compression(opts.compression, 1) < 0) {
+    return 1;
+  }
+  log.start();
+
+  std::vector<std::vector<uint64_t>> latencies(opts.threads);
+  std::vector<std::thread> threads;
+  auto start = bench_clock::now();
+  for (unsigned i = 0; i < opts.threads; ++i) {
+    threads.emplace_back(run_thread, std::ref(log), std::cref(opts), i,
+			 std::ref(latencies[i]));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  auto submitted = bench_clock::now();
+  log.flush();
+  auto flushed = bench_clock::now();
+  log.stop();
+
+  std::vector<uint64_t> all;
+  all.reserve(opts.threads * opts.entries);
+  for (auto& l : latencies) {
+    all.insert(all.end(), l.begin(), l.end());
+  }
+  std::sort(all.begin(), all.end());
+
+  using fsec = std::chrono::duration<double>;
+  const double submit_secs = fsec(submitted - start).count();
+  const double total_secs = fsec(flushed - start).count();
+  const uint64_t total = all.size();
+
+  printf("threads %u entries %" PRIu64 " size %zu gather_only %u%% sink %s\n",
+	 opts.threads, total, opts.size, opts.gather_only, opts.sink.c_str());
+  printf("submit     %10.0f entries/s (%.3f s)\n",
+	 submit_secs > 0 ? total / submit_secs : 0.0, submit_secs);
+  printf("end to end %10.0f entries/s (%.3f s)\n",
+	 total_secs > 0 ? total / total_secs : 0.0, total_secs);
+  printf("latency ns p50 %" PRIu64 " p99 %" PRIu64 " p999 %" PRIu64
+	 " max %" PRIu64 "\n",
+	 percentile(all, 0.5), percentile(all, 0.99), percentile(all, 0.999),
+	 all.empty() ? 0 : all.back());
+  printf("blocked    %10.3f ms total\n",
+	 std::chrono::duration<double, std::milli>(log.get_blocked_time()).count());
+  printf("dropped    %10" PRIu64 "\n", log.get_dropped());
+  return 0;
+}
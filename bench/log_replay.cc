@@ -0,0 +1,343 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * log_replay: replay a log_traffic_trace against Log::submit_entry().
+ * Each thread of the trace gets a thread here, which submits entries of
+ * the recorded subsystem, priority and length when the trace says they
+ * were stamped, relative to the first, so the bursts of a real daemon are
+ * reproduced.  Subsystem levels are set so that what was written is
+ * written and what was only gathered is only gathered.  Reports how far
+ * submissions fell behind the trace, besides what log_bench does.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "common/logging/BinaryLog.h"
+#include "common/logging/Entry.h"
+#include "common/logging/Log.h"
+#include "common/logging/SubsystemMap.h"
+
+#include "bench_util.h"
+
+using namespace ceph::logging;
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: log_replay [options] <trace>\n"
+    "  --speed <x>          replay x times as fast (default 1); 0 submits\n"
+    "                       as fast as possible, in the trace's order\n"
+    "  --sink <sink>        file:<path>, stderr or null (default null)\n"
+    "  --max-new <n>        log_max_new (default 100)\n"
+    "  --flush-batch <n>    log_flush_batch (default 1)\n"
+    "  --flush-delay <us>   log_flush_max_delay (default 0)\n"
+    "  --async              log_async_write = true\n"
+    "  --mmap               log_mmap_write = true\n"
+    "  --binary             log_format = binary\n"
+    "  --compression <type> log_compression: none, zstd or lz4 (default none)\n"
+    "  --format-threads <n> log_format_threads (default 0)\n"
+    "record a trace with log_traffic_trace = <path>\n";
+}
+
+struct Options {
+  double speed = 1;
+  std::string sink = "null";
+  std::size_t max_new = 100;
+  std::size_t flush_batch = 1;
+  uint64_t flush_delay = 0;
+  bool async = false;
+  bool mmap = false;
+  bool binary = false;
+  std::string compression = "none";
+  unsigned format_threads = 0;
+};
+
+/// a traced entry, due this long after the first
+struct Shot {
+  uint64_t due;
+  uint16_t subsys;
+  int16_t prio;
+  uint32_t len;
+};
+
+struct Trace {
+  std::vector<std::vector<Shot>> threads;
+  uint64_t entries = 0;
+  uint64_t span = 0;         ///< ns from the first entry to the last
+  int log_level[ceph_subsys_get_num()] = {};
+  int gather_level[ceph_subsys_get_num()] = {};
+};
+
+static bool read_trace(const char *fn, Trace *trace)
+{
+  int fd = ::open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "log_replay: " << fn << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  std::vector<char> buf;
+  std::size_t have = 0;
+  while (true) {
+    buf.resize(have + (1 << 20));
+    ssize_t r = ::read(fd, buf.data() + have, buf.size() - have);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      break;
+    }
+    have += r;
+  }
+  ::close(fd);
+
+  binary::trace_header h;
+  if (have < sizeof(h)) {
+    std::cerr << "log_replay: " << fn << ": too short" << std::endl;
+    return false;
+  }
+  memcpy(&h, buf.data(), sizeof(h));
+  if (h.magic != binary::TRACE_MAGIC || h.version != binary::TRACE_VERSION ||
+      h.header_size < sizeof(h) || h.header_size > have) {
+    std::cerr << "log_replay: " << fn << ": not a traffic trace" << std::endl;
+    return false;
+  }
+  std::vector<binary::trace_record> records;
+  const char *p = buf.data() + h.header_size;
+  const char *end = buf.data() + have;
+  uint64_t stamp = h.start;
+  uint64_t first = UINT64_MAX, last = 0;
+  while (p < end) {
+    binary::trace_record r;
+    p = binary::decode_trace(p, end, stamp, &r);
+    if (!p) {
+      // the last buffer was cut short, e.g. by the process dying
+      break;
+    }
+    stamp = r.stamp;
+    first = std::min(first, r.stamp);
+    last = std::max(last, r.stamp);
+    records.push_back(r);
+  }
+  for (const auto& r : records) {
+    const unsigned sub = r.subsys < ceph_subsys_get_num() ? r.subsys : 0;
+    if (r.thread >= trace->threads.size()) {
+      trace->threads.resize(r.thread + 1);
+    }
+    trace->threads[r.thread].push_back(Shot{r.stamp - first, (uint16_t)sub,
+					    r.prio, r.len});
+    if (r.written) {
+      trace->log_level[sub] = std::max<int>(trace->log_level[sub], r.prio);
+    }
+    trace->gather_level[sub] = std::max<int>(trace->gather_level[sub],
+					     r.prio);
+  }
+  for (auto& t : trace->threads) {
+    // the log thread may have seen a thread's entries out of order
+    std::stable_sort(t.begin(), t.end(), [](const Shot& a, const Shot& b) {
+      return a.due < b.due;
+    });
+  }
+  trace->entries = records.size();
+  trace->span = records.empty() ? 0 : last - first;
+  return true;
+}
+
+struct Result {
+  std::vector<uint64_t> latencies; ///< of each submit_entry()
+  std::vector<uint64_t> lags;      ///< how late each was submitted
+};
+
+static void run_thread(Log& log, const Options& opts,
+		       const std::vector<Shot>& shots, unsigned id,
+		       bench_clock::time_point start, Result& result)
+{
+  uint32_t longest = 0;
+  for (const auto& s : shots) {
+    longest = std::max(longest, s.len);
+  }
+  const std::string payload(longest, 'a' + id % 26);
+  result.latencies.reserve(shots.size());
+  result.lags.reserve(shots.size());
+  for (const auto& s : shots) {
+    auto now = bench_clock::now();
+    if (opts.speed > 0) {
+      const auto due = start + std::chrono::nanoseconds(
+	(uint64_t)(s.due / opts.speed));
+      if (due > now) {
+	std::this_thread::sleep_until(due);
+	now = bench_clock::now();
+      }
+      result.lags.push_back(std::chrono::duration_cast<
+			    std::chrono::nanoseconds>(now - due).count());
+    }
+    {
+      MutableEntry e(s.prio, s.subsys);
+      e.get_ostream() << std::string_view(payload.data(), s.len);
+      log.submit_entry(std::move(e));
+    }
+    result.latencies.push_back(std::chrono::duration_cast<
+			       std::chrono::nanoseconds>(
+				 bench_clock::now() - now).count());
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Options opts;
+  const char *fn = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--speed") {
+      opts.speed = std::max(atof(next()), 0.0);
+    } else if (arg == "--sink") {
+      opts.sink = next();
+    } else if (arg == "--max-new") {
+      opts.max_new = strtoull(next(), nullptr, 10);
+    } else if (arg == "--flush-batch") {
+      opts.flush_batch = strtoull(next(), nullptr, 10);
+    } else if (arg == "--flush-delay") {
+      opts.flush_delay = strtoull(next(), nullptr, 10);
+    } else if (arg == "--async") {
+      opts.async = true;
+    } else if (arg == "--mmap") {
+      opts.mmap = true;
+    } else if (arg == "--binary") {
+      opts.binary = true;
+    } else if (arg == "--compression") {
+      opts.compression = next();
+    } else if (arg == "--format-threads") {
+      opts.format_threads = atoi(next());
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else if (!fn && arg[0] != '-') {
+      fn = argv[i];
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+  if (!fn) {
+    usage();
+    return 1;
+  }
+  Trace trace;
+  if (!read_trace(fn, &trace)) {
+    return 1;
+  }
+
+  SubsystemMap subs;
+  for (unsigned sub = 0; sub < ceph_subsys_get_num(); ++sub) {
+    subs.set_log_level(sub, trace.log_level[sub]);
+    subs.set_gather_level(sub, std::max(trace.gather_level[sub],
+					trace.log_level[sub]));
+  }
+
+  Log log(&subs);
+  if (opts.sink == "stderr") {
+    log.set_stderr_level(99, 99);
+  } else if (opts.sink == "null") {
+    log.set_log_file("/dev/null");
+  } else if (opts.sink.compare(0, 5, "file:") == 0) {
+    log.set_log_file(opts.sink.substr(5));
+  } else {
+    std::cerr << "unknown sink " << opts.sink << std::endl;
+    return 1;
+  }
+  log.set_max_new(opts.max_new);
+  log.set_flush_batch(opts.flush_batch,
+		      std::chrono::microseconds(opts.flush_delay));
+  log.set_async_write(opts.async);
+  log.set_mmap_write(opts.mmap);
+  log.set_log_format(opts.binary ? LogFormat::BINARY : LogFormat::TEXT);
+  log.set_format_threads(opts.format_threads);
+  if (log.set_compression(opts.compression, 1) < 0) {
+    return 1;
+  }
+  log.start();
+
+  std::vector<Result> results(trace.threads.size());
+  std::vector<std::thread> threads;
+  // time for the threads to start before the first entry is due
+  auto start = bench_clock::now() + std::chrono::milliseconds(10);
+  for (unsigned i = 0; i < trace.threads.size(); ++i) {
+    threads.emplace_back(run_thread, std::ref(log), std::cref(opts),
+			 std::cref(trace.threads[i]), i, start,
+			 std::ref(results[i]));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  auto submitted = bench_clock::now();
+  log.flush();
+  auto flushed = bench_clock::now();
+  log.stop();
+
+  std::vector<uint64_t> latencies, lags;
+  for (auto& r : results) {
+    latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+    lags.insert(lags.end(), r.lags.begin(), r.lags.end());
+  }
+  std::sort(latencies.begin(), latencies.end());
+  std::sort(lags.begin(), lags.end());
+
+  using fsec = std::chrono::duration<double>;
+  const double trace_secs = trace.span / 1e9;
+  const double submit_secs = fsec(submitted - start).count();
+  const double total_secs = fsec(flushed - start).count();
+
+  printf("threads %zu entries %" PRIu64 " over %.3f s speed %g sink %s\n",
+	 trace.threads.size(), trace.entries, trace_secs, opts.speed,
+	 opts.sink.c_str());
+  printf("submit     %10.0f entries/s (%.3f s)\n",
+	 submit_secs > 0 ? trace.entries / submit_secs : 0.0, submit_secs);
+  printf("end to end %10.0f entries/s (%.3f s)\n",
+	 total_secs > 0 ? trace.entries / total_secs : 0.0, total_secs);
+  printf("latency ns p50 %" PRIu64 " p99 %" PRIu64 " p999 %" PRIu64
+	 " max %" PRIu64 "\n",
+	 percentile(latencies, 0.5), percentile(latencies, 0.99),
+	 percentile(latencies, 0.999),
+	 latencies.empty() ? 0 : latencies.back());
+  if (!lags.empty()) {
+    printf("lag us     p50 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64 "\n",
+	   percentile(lags, 0.5) / 1000, percentile(lags, 0.99) / 1000,
+	   lags.back() / 1000);
+  }
+  printf("blocked    %10.3f ms total\n",
+	 std::chrono::duration<double, std::milli>(log.get_blocked_time()).count());
+  printf("dropped    %10" PRIu64 "\n", log.get_dropped());
+  return 0;
+}
@@ -0,0 +1,113 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * mem_is_zero_bench: time mem_is_zero() over zeroed buffers of a given size
+ * and misalignment against a plain byte loop, and report bytes per second.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/utils/cpu_features.h"
+#include "common/utils/inline_memory.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: mem_is_zero_bench [options]\n"
+    "  --size <bytes>     buffer size (default 4096)\n"
+    "  --offset <bytes>   misalign the buffer start by this much (default 0)\n"
+    "  --bytes <n>        total bytes to scan per variant (default 16G)\n"
+    "set CEPH_CPU_DISABLE (e.g. avx512f,avx2) to time the narrower variants\n";
+}
+
+// keeps the compiler from hoisting the scan out of the loop
+static bool __attribute__((noinline)) bytewise(const char *data, size_t len)
+{
+  for (size_t i = 0; i < len; ++i) {
+    if (data[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool __attribute__((noinline)) dispatched(const char *data, size_t len)
+{
+  return mem_is_zero(data, len);
+}
+
+static void run(const char *name, bool (*fn)(const char*, size_t),
+		const char *data, size_t len, uint64_t total)
+{
+  const uint64_t iters = std::max<uint64_t>(total / std::max<size_t>(len, 1), 1);
+  uint64_t zero = 0;
+  auto start = bench_clock::now();
+  for (uint64_t i = 0; i < iters; ++i) {
+    zero += fn(data, len);
+  }
+  const double secs = std::chrono::duration<double>(
+    bench_clock::now() - start).count();
+  printf("%-10s %10.2f GB/s %8.1f ns/call%s\n", name,
+	 secs > 0 ? iters * len / secs / 1e9 : 0.0, secs * 1e9 / iters,
+	 zero == iters ? "" : " (wrong answer)");
+}
+
+int main(int argc, char **argv)
+{
+  size_t size = 4096;
+  size_t offset = 0;
+  uint64_t total = 16ull << 30;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--size") {
+      size = strtoull(next(), nullptr, 10);
+    } else if (arg == "--offset") {
+      offset = strtoull(next(), nullptr, 10);
+    } else if (arg == "--bytes") {
+      total = strtoull(next(), nullptr, 10);
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  std::vector<char> buf(size + offset + 64, 0);
+  const char *data = buf.data() + offset;
+  printf("size %zu offset %zu cpu %s vector %s\n", size, offset,
+	 ceph::cpu_features_str().c_str(), ceph::mem_is_zero_vector_name());
+  run("mem_is_zero", dispatched, data, size, total);
+  run("bytewise", bytewise, data, size, total);
+  return 0;
+}
@@ -0,0 +1,376 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * startup_bench: what global_init() and common_init_finish() cost a short
+ * lived command, as the config file, the command line and CEPH_ARGS grow.
+ *
+ * Startup happens once per process, so each run is a fresh exec of this
+ * binary in child mode, which starts up as a utility does (test/main.cc)
+ * and reports, over a pipe, the wall time, allocations and peak RSS of
+ * each of the two steps and the time of every startup_trace phase within
+ * them.  The parent varies one input at a time, with generated options
+ * set to their defaults so that what is measured is parsing and applying
+ * them rather than what they do, and prints the median of --runs runs.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <new>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/ceph_context.h"
+#include "global/global_init.h"
+#include "common/options.h"
+#include "common/startup_trace.h"
+#include "common/utils/types.h"
+
+// allocations, counted in the child only; malloc itself would also count
+// what libc and the loader allocate, which is the same for every run
+#include "alloc_counter.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: startup_bench [options]\n"
+    "  --runs <n>          runs per case; medians are reported (default 10)\n"
+    "  --conf-sizes <list> options in the generated config file\n"
+    "                      (default 0,100,1000)\n"
+    "  --argv-sizes <list> options on the command line (default 0,16,128)\n"
+    "  --env-sizes <list>  options in CEPH_ARGS (default 0,16,128)\n"
+    "  --phases            also report every startup_trace phase\n";
+}
+
+/// peak RSS so far, in KiB
+static long peak_rss_kb()
+{
+  struct rusage ru;
+  ::getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+/* The child: argv is --child <fd> followed by global_init()'s arguments.
+ * Reports lines of
+ *   step <name> <ns> <allocs> <bytes> <peak rss KiB>
+ *   phase <name> <ns>
+ */
+static int run_child(int argc, char **argv)
+{
+  const int fd = atoi(argv[2]);
+  std::vector<const char*> args(argv + 3, argv + argc);
+  std::ostringstream report;
+  auto step = [&report](const char *name, bench_clock::time_point start,
+			uint64_t a0, uint64_t b0) {
+    report << "step " << name << " "
+	   << std::chrono::duration_cast<std::chrono::nanoseconds>(
+		bench_clock::now() - start).count()
+	   << " " << allocs - a0 << " " << alloc_bytes - b0 << " "
+	   << peak_rss_kb() << "\n";
+  };
+
+  counting = true;
+  auto start = bench_clock::now();
+  uint64_t a0 = allocs, b0 = alloc_bytes;
+  auto cct = global_init(nullptr, args, CEPH_ENTITY_TYPE_CLIENT,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DAEMON_ACTIONS |
+			 CINIT_FLAG_NO_MON_CONFIG);
+  step("global_init", start, a0, b0);
+  start = bench_clock::now();
+  a0 = allocs;
+  b0 = alloc_bytes;
+  common_init_finish(g_ceph_context);
+  step("common_init_finish", start, a0, b0);
+  counting = false;
+
+  for (auto& p : ceph::startup_trace::get()) {
+    report << "phase " << std::string(p.depth * 2, '.') << p.name << " "
+	   << std::chrono::duration_cast<std::chrono::nanoseconds>(
+		p.took).count() << "\n";
+  }
+  const std::string s = report.str();
+  for (std::size_t off = 0; off < s.size(); ) {
+    ssize_t n = ::write(fd, s.data() + off, s.size() - off);
+    if (n <= 0) {
+      return 1;
+    }
+    off += n;
+  }
+  ::close(fd);
+  // skip the teardown, which no short lived command waits for
+  _exit(0);
+}
+
+/// options that can be set to their default without changing what
+/// startup does; those whose defaults are metavariables, or that read or
+/// create files, are left out
+static std::vector<const Option*> pick_options()
+{
+  static const std::set<std::string_view> skip = {
+    "daemonize", "setuser", "setgroup", "setuser_match_path", "chdir",
+    "pid_file", "keyring", "key", "keyfile", "log_file", "admin_socket",
+    "run_dir", "startup_trace_file", "conf_cache_file", "host",
+  };
+  std::vector<const Option*> opts;
+  for (auto& o : get_ceph_options()) {
+    const std::string v = Option::to_str(o.value);
+    if (!skip.count(o.name) && !v.empty() &&
+	v.find_first_of("$ \t\n#;") == std::string::npos) {
+      opts.push_back(&o);
+    }
+  }
+  return opts;
+}
+
+struct sample {
+  std::map<std::string, std::vector<uint64_t>> values;
+  std::vector<std::string> order;  ///< of first appearance
+  void add(const std::string& key, uint64_t v) {
+    auto [p, added] = values.try_emplace(key);
+    if (added) {
+      order.push_back(key);
+    }
+    p->second.push_back(v);
+  }
+  uint64_t median(const std::string& key) {
+    auto& v = values[key];
+    if (v.empty()) {
+      return 0;
+    }
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+  }
+};
+
+/// run the child once, adding what it reports to s
+static bool run_once(const std::vector<std::string>& args,
+		     const std::string& env_args, sample *s)
+{
+  int fds[2];
+  if (::pipe(fds) < 0) {
+    perror("pipe");
+    return false;
+  }
+  pid_t pid = ::fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    ::close(fds[0]);
+    std::vector<std::string> a = {"startup_bench", "--child",
+				  std::to_string(fds[1])};
+    a.insert(a.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (auto& x : a) {
+      argv.push_back(x.data());
+    }
+    argv.push_back(nullptr);
+    if (env_args.empty()) {
+      ::unsetenv("CEPH_ARGS");
+    } else {
+      ::setenv("CEPH_ARGS", env_args.c_str(), 1);
+    }
+    // the child's own log output isn't what is being measured
+    int null = ::open("/dev/null", O_WRONLY);
+    ::dup2(null, STDOUT_FILENO);
+    ::dup2(null, STDERR_FILENO);
+    ::execv("/proc/self/exe", argv.data());
+    _exit(127);
+  }
+  ::close(fds[1]);
+  std::string out;
+  char buf[4096];
+  ssize_t n;
+  while ((n = ::read(fds[0], buf, sizeof(buf))) > 0) {
+    out.append(buf, n);
+  }
+  ::close(fds[0]);
+  int status;
+  ::waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || out.empty()) {
+    std::cerr << "child failed, status " << status << std::endl;
+    return false;
+  }
+  std::istringstream in(out);
+  std::string kind, name;
+  while (in >> kind >> name) {
+    if (kind == "step") {
+      uint64_t ns, a, b, rss;
+      in >> ns >> a >> b >> rss;
+      s->add("step " + name + " ns", ns);
+      s->add("step " + name + " allocs", a);
+      s->add("step " + name + " bytes", b);
+      s->add("step " + name + " rss", rss);
+    } else {
+      uint64_t ns;
+      in >> ns;
+      s->add("phase " + name, ns);
+    }
+  }
+  return true;
+}
+
+static std::vector<unsigned> parse_list(const char *s)
+{
+  std::vector<unsigned> v;
+  std::istringstream in(s);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    v.push_back(atoi(item.c_str()));
+  }
+  return v;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 3 && std::string_view(argv[1]) == "--child") {
+    return run_child(argc, argv);
+  }
+
+  unsigned runs = 10;
+  std::vector<unsigned> conf_sizes = {0, 100, 1000};
+  std::vector<unsigned> argv_sizes = {0, 16, 128};
+  std::vector<unsigned> env_sizes = {0, 16, 128};
+  bool phases = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--runs") {
+      runs = std::max(atoi(next()), 1);
+    } else if (arg == "--conf-sizes") {
+      conf_sizes = parse_list(next());
+    } else if (arg == "--argv-sizes") {
+      argv_sizes = parse_list(next());
+    } else if (arg == "--env-sizes") {
+      env_sizes = parse_list(next());
+    } else if (arg == "--phases") {
+      phases = true;
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  const auto opts = pick_options();
+  char conf_path[] = "/tmp/startup_bench.XXXXXX";
+  int conf_fd = ::mkstemp(conf_path);
+  if (conf_fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  ::close(conf_fd);
+  auto write_conf = [&](unsigned n) {
+    FILE *f = fopen(conf_path, "w");
+    fprintf(f, "[global]\n");
+    for (unsigned i = 0; i < n && i < opts.size(); ++i) {
+      fprintf(f, "\t%s = %s\n", opts[i]->name.c_str(),
+	      Option::to_str(opts[i]->value).c_str());
+    }
+    fclose(f);
+  };
+  // the command line and CEPH_ARGS take options from the other end of the
+  // list, so that they don't merely repeat the file's
+  auto cmdline = [&opts](unsigned n) {
+    std::vector<std::string> a;
+    for (unsigned i = 0; i < n && i < opts.size(); ++i) {
+      const Option *o = opts[opts.size() - 1 - i];
+      a.push_back("--" + o->name);
+      a.push_back(Option::to_str(o->value));
+    }
+    return a;
+  };
+  auto env = [&cmdline](unsigned n) {
+    std::string s;
+    for (auto& a : cmdline(n)) {
+      if (!s.empty()) {
+	s += ' ';
+      }
+      s += a;
+    }
+    return s;
+  };
+
+  printf("%u runs per case, medians; %zu options to pick from\n", runs,
+	 opts.size());
+  printf("%-6s %-6s %-6s %-20s %10s %9s %11s %9s\n", "conf", "argv", "env",
+	 "step", "ms", "allocs", "alloc KiB", "peak KiB");
+  auto run_case = [&](unsigned c, unsigned a, unsigned e) {
+    write_conf(c);
+    std::vector<std::string> args = {"-c", conf_path};
+    auto more = cmdline(a);
+    args.insert(args.end(), more.begin(), more.end());
+    const std::string env_args = env(e);
+    sample s;
+    for (unsigned r = 0; r < runs; ++r) {
+      if (!run_once(args, env_args, &s)) {
+	return false;
+      }
+    }
+    for (const char *step : {"global_init", "common_init_finish"}) {
+      const std::string k = std::string("step ") + step;
+      printf("%-6u %-6u %-6u %-20s %10.3f %9" PRIu64 " %11" PRIu64
+	     " %9" PRIu64 "\n", c, a, e, step, s.median(k + " ns") / 1e6,
+	     s.median(k + " allocs"), s.median(k + " bytes") / 1024,
+	     s.median(k + " rss"));
+    }
+    if (phases) {
+      for (auto& k : s.order) {
+	if (k.compare(0, 6, "phase ") == 0) {
+	  printf("%27s %-40s %10.3f\n", "", k.c_str() + 6,
+		 s.median(k) / 1e6);
+	}
+      }
+    }
+    return true;
+  };
+
+  bool ok = true;
+  for (unsigned c : conf_sizes) {
+    ok = ok && run_case(c, 0, 0);
+  }
+  for (unsigned a : argv_sizes) {
+    ok = ok && (a == 0 || run_case(0, a, 0));
+  }
+  for (unsigned e : env_sizes) {
+    ok = ok && (e == 0 || run_case(0, 0, e));
+  }
+  ::unlink(conf_path);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * str_escape_bench: time json_escape() and hex_encode() against byte at a
+ * time loops like the ones they replaced, over strings of a given size
+ * with an escape every --every bytes, and report bytes per second.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/utils/cpu_features.h"
+#include "common/utils/str_escape.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static void usage()
+{
+  std::cout <<
+    "usage: str_escape_bench [options]\n"
+    "  --size <bytes>     string size (default 4096)\n"
+    "  --every <bytes>    a character to escape every this many, 0 for\n"
+    "                     none (default 64)\n"
+    "  --bytes <n>        total bytes to encode per variant (default 4G)\n"
+    "set CEPH_CPU_DISABLE (e.g. avx2) to time the narrower variants\n";
+}
+
+static std::size_t __attribute__((noinline))
+escape_bytewise(std::string_view s, char *out)
+{
+  static const char hex[] = "0123456789abcdef";
+  char *o = out;
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      *o++ = '\\';
+      *o++ = c;
+    } else if (c == '\n') {
+      *o++ = '\\';
+      *o++ = 'n';
+    } else if (c == '\t') {
+      *o++ = '\\';
+      *o++ = 't';
+    } else if (c < 0x20) {
+      const char esc[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+      memcpy(o, esc, sizeof(esc));
+      o += sizeof(esc);
+    } else {
+      *o++ = c;
+    }
+  }
+  return o - out;
+}
+
+static std::size_t __attribute__((noinline))
+escape_dispatched(std::string_view s, char *out)
+{
+  char *o = out;
+  ceph::json_escape(s, [&o](const char *p, std::size_t n) {
+    memcpy(o, p, n);
+    o += n;
+  });
+  return o - out;
+}
+
+static std::size_t __attribute__((noinline))
+hex_bytewise(std::string_view s, char *out)
+{
+  for (std::size_t i = 0; i < s.size(); ++i) {
+    snprintf(out + 2 * i, 3, "%02x", (unsigned char)s[i]);
+  }
+  return 2 * s.size();
+}
+
+static std::size_t __attribute__((noinline))
+hex_dispatched(std::string_view s, char *out)
+{
+  return ceph::hex_encode(out, s.data(), s.size()) - out;
+}
+
+static void run(const char *name, std::size_t (*fn)(std::string_view, char*),
+		std::string_view s, char *out, uint64_t total)
+{
+  const uint64_t iters = std::max<uint64_t>(total / std::max<size_t>(s.size(), 1), 1);
+  uint64_t produced = 0;
+  auto start = bench_clock::now();
+  for (uint64_t i = 0; i < iters; ++i) {
+    produced += fn(s, out);
+  }
+  const double secs = std::chrono::duration<double>(
+    bench_clock::now() - start).count();
+  printf("%-16s %10.2f GB/s %8.1f ns/call %10.2f out/in\n", name,
+	 secs > 0 ? iters * s.size() / secs / 1e9 : 0.0, secs * 1e9 / iters,
+	 s.empty() ? 0.0 : double(produced) / iters / s.size());
+}
+
+int main(int argc, char **argv)
+{
+  size_t size = 4096;
+  size_t every = 64;
+  uint64_t total = 4ull << 30;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--size") {
+      size = strtoull(next(), nullptr, 10);
+    } else if (arg == "--every") {
+      every = strtoull(next(), nullptr, 10);
+    } else if (arg == "--bytes") {
+      total = strtoull(next(), nullptr, 10);
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+
+  std::string s(size, 0);
+  for (size_t i = 0; i < size; ++i) {
+    s[i] = every && i % every == every - 1 ? "\"\\\n\x01"[i / every % 4] :
+      'a' + i % 26;
+  }
+  std::vector<char> out(6 * size + 64);
+  printf("size %zu every %zu cpu %s json %s hex %s\n", size, every,
+	 ceph::cpu_features_str().c_str(), ceph::json_plain_prefix_name(),
+	 ceph::hex_encode_name());
+  run("json_escape", escape_dispatched, s, out.data(), total);
+  run("json bytewise", escape_bytewise, s, out.data(), total);
+  run("hex_encode", hex_dispatched, s, out.data(), total);
+  run("hex snprintf", hex_bytewise, s, out.data(), total / 16);
+  return 0;
+}
@@ -14,6 +14,7 @@
  */
 
 #include "ceph_context.h"
+#include <algorithm>
 #include <mutex>
 #include <iostream>
 #include <pthread.h>
@@ -25,15 +26,20 @@
 #include "common/debug.h"
 #include "config.h"
 #include "common/HeartbeatMap.h"
+#include "common/perf_export.h"
+#include "common/cpu_profiler.h"
+#include "common/work_pool.h"
+#include "common/file_watcher.h"
 #include "common/errno.h"
-#include "common/Graylog.h"
 #include "log/Log.h"
 #include "auth/Crypto.h"
 #include "include/str_list.h"
 #include "common/config.h"
 #include "common/config_obs.h"
 #include "common/PluginRegistry.h"
+#include "common/startup_trace.h"
 #include "include/spinlock.h"
+#include "common/Thread.h"
 #include "mon/MonMap.h"
 
 using ceph::bufferlist;
@@ -79,6 +85,94 @@ private:
   ceph::mutex lock;
 };
 
+class ThreadPolicyObs : public md_config_obs_t {
+  CephContext *cct;
+
+public:
+  explicit ThreadPolicyObs(CephContext *cct) : cct(cct) {
+    // re-placing every thread of the process can take a while
+    cct->_conf.add_observer(this, true);
+  }
+  ~ThreadPolicyObs() override {
+    cct->_conf.remove_observer(this);
+  }
+
+  const char** get_tracked_conf_keys() const override {
+    static const char *KEYS[] = {"thread_placement", "thread_stack", NULL};
+    return KEYS;
+  }
+
+  void handle_conf_change(const ConfigProxy& conf,
+                          const std::set <std::string> &changed) override {
+    std::string err;
+    // the policies are per process, the last context to set them wins
+    if (changed.count("thread_placement") &&
+	set_thread_placement(conf.get_val<std::string>("thread_placement"),
+			     &err) < 0) {
+      lgeneric_derr(cct) << "thread_placement: " << err << dendl;
+    }
+    if (changed.count("thread_stack") &&
+	set_thread_stack(conf.get_val<std::string>("thread_stack"),
+			 &err) < 0) {
+      lgeneric_derr(cct) << "thread_stack: " << err << dendl;
+    }
+  }
+};
+
+class CoarseClockObs : public md_config_obs_t {
+  CephContext *cct;
+
+public:
+  explicit CoarseClockObs(CephContext *cct) : cct(cct) {
+    cct->_conf.add_observer(this);
+    if (cct->_conf.get_val<bool>("coarse_clock_page")) {
+      ceph::start_coarse_clock_page();
+    }
+  }
+  ~CoarseClockObs() override {
+    cct->_conf.remove_observer(this);
+  }
+
+  const char** get_tracked_conf_keys() const override {
+    static const char *KEYS[] = {"coarse_clock_page", NULL};
+    return KEYS;
+  }
+
+  void handle_conf_change(const ConfigProxy& conf,
+                          const std::set <std::string> &changed) override {
+    if (!conf.get_val<bool>("coarse_clock_page")) {
+      ceph::stop_coarse_clock_page();
+    } else if (int r = ceph::start_coarse_clock_page(); r < 0) {
+      lgeneric_derr(cct) << "coarse_clock_page: " << cpp_strerror(r) << dendl;
+    }
+  }
+};
+
+class ConfigProfileObs : public md_config_obs_t {
+  CephContext *cct;
+
+public:
+  explicit ConfigProfileObs(CephContext *cct) : cct(cct) {
+    cct->_conf.add_observer(this);
+    cct->_conf.get_profiler().set_every(
+      cct->_conf.get_val<uint64_t>("config_profile_every"));
+  }
+  ~ConfigProfileObs() override {
+    cct->_conf.remove_observer(this);
+  }
+
+  const char** get_tracked_conf_keys() const override {
+    static const char *KEYS[] = {"config_profile_every", NULL};
+    return KEYS;
+  }
+
+  void handle_conf_change(const ConfigProxy& conf,
+                          const std::set <std::string> &changed) override {
+    conf.get_profiler().set_every(
+      conf.get_val<uint64_t>("config_profile_every"));
+  }
+};
+
 class MempoolObs : public md_config_obs_t, public AdminSocketHook {
   CephContext *cct;
   ceph::mutex lock;
@@ -131,68 +225,123 @@ public:
   }
 };
 
+/// for "log recent": a stamp as the log prints it, in local time, with
+/// optional fractional seconds and a 'T' or a space in the middle, or a
+/// timespan ("30s", "5m") meaning that long ago
+bool parse_log_stamp(std::string s, uint64_t *ns)
+{
+  if (s.size() > 10 && s[10] == 'T') {
+    s[10] = ' ';
+  }
+  struct tm tm = {};
+  const char *p = strptime(s.c_str(), "%Y-%m-%d %H:%M:%S", &tm);
+  if (p) {
+    tm.tm_isdst = -1;
+    const time_t sec = mktime(&tm);
+    if (sec == (time_t)-1) {
+      return false;
+    }
+    uint64_t frac = 0;
+    if (*p == '.') {
+      uint64_t scale = 1000000000;
+      for (++p; isdigit(*p); ++p) {
+	scale /= 10;
+	frac += (*p - '0') * scale;
+      }
+    }
+    if (*p) {
+      return false;
+    }
+    *ns = sec * 1000000000ull + frac;
+    return true;
+  }
+  try {
+    const auto ago = ceph::parse_timespan(s);
+    *ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      ceph::real_clock::now().time_since_epoch() - ago).count();
+    return true;
+  } catch (const std::invalid_argument&) {
+    return false;
+  }
+}
+
 } // anonymous namespace
 
 class CephContextServiceThread : public Thread
 {
 public:
   explicit CephContextServiceThread(CephContext *cct)
-    : _reopen_logs(false), _exit_thread(false), _cct(cct) {}
+    : _exit_thread(false), _cct(cct) {}
 
   ~CephContextServiceThread() override {}
 
   void *entry() override
   {
-    while (1) {
-      std::unique_lock l(_lock);
-      if (_exit_thread) {
-        break;
+    std::unique_lock l(_cct->_service_lock);
+    std::vector<uint64_t> due;
+    while (!_exit_thread) {
+      // sleep until the first tick anything is due in, however far away
+      if (auto next = _cct->_service_wheel.next(); !next) {
+	_cct->_service_cond.wait(l);
+      } else if (auto now = ceph::mono_clock::now(); *next > now) {
+	_cct->_service_cond.wait_for(l, *next - now);
       }
-
-      if (_cct->_conf->heartbeat_interval) {
-        auto interval = ceph::make_timespan(_cct->_conf->heartbeat_interval);
-        _cond.wait_for(l, interval);
-      } else
-        _cond.wait(l);
-
       if (_exit_thread) {
-        break;
+	break;
       }
-
-      if (_reopen_logs) {
-        _cct->_log->reopen_log_file();
-        _reopen_logs = false;
+      _cct->_service_wheel.advance(ceph::mono_clock::now(), [&due](uint64_t id) {
+	due.push_back(id);
+      });
+      for (auto id : due) {
+	auto t = _cct->_service_tasks.find(id);
+	if (t == _cct->_service_tasks.end()) {
+	  continue; // cancelled
+	}
+	auto fn = t->second.fn;
+	lgeneric_dout(_cct, 20) << "running service task " << t->second.name
+				<< dendl;
+	l.unlock();
+	const ceph::timespan delay = (*fn)();
+	l.lock();
+	// it may have been cancelled while it ran
+	t = _cct->_service_tasks.find(id);
+	if (t == _cct->_service_tasks.end()) {
+	  continue;
+	}
+	if (delay == ceph::timespan::zero()) {
+	  _cct->_service_tasks.erase(t);
+	} else {
+	  _cct->_service_wheel.add(ceph::mono_clock::now() + delay, id);
+	}
       }
-      _cct->_heartbeat_map->check_touch_file();
-
-      // refresh the perf coutners
-      _cct->_refresh_perf_values();
+      due.clear();
     }
     return NULL;
   }
 
-  void reopen_logs()
-  {
-    std::lock_guard l(_lock);
-    _reopen_logs = true;
-    _cond.notify_all();
-  }
-
   void exit_thread()
   {
-    std::lock_guard l(_lock);
+    std::lock_guard l(_cct->_service_lock);
     _exit_thread = true;
-    _cond.notify_all();
+    _cct->_service_cond.notify_all();
   }
 
 private:
-  ceph::mutex _lock = ceph::make_mutex("CephContextServiceThread::_lock");
-  ceph::condition_variable _cond;
-  bool _reopen_logs;
   bool _exit_thread;
   CephContext *_cct;
 };
 
+/// how long the heartbeat tasks wait to run again; with no
+/// heartbeat_interval they do nothing, and look again now and then in case
+/// it is set
+static ceph::timespan heartbeat_delay(CephContext *cct)
+{
+  if (auto interval = cct->_conf->heartbeat_interval; interval) {
+    return ceph::make_timespan(interval);
+  }
+  return std::chrono::seconds(60);
+}
+
 
 /**
  * observe logging config changes
@@ -213,19 +362,72 @@ public:
   const char** get_tracked_conf_keys() const override {
     static const char *KEYS[] = {
       "log_file",
+      "log_subsys_files",
       "log_max_new",
+      "log_governor_level",
+      "log_max_new_bytes",
+      "log_overflow_policy",
+      "log_error_lane",
+      "log_error_sync",
+      "log_flush_batch",
+      "log_flush_max_delay",
+      "log_stop_timeout",
+      "log_thread_ring_size",
+      "log_queue_shards",
+      "log_reorder_window",
+      "log_reorder_max_bytes",
       "log_max_recent",
+      "log_max_recent_bytes",
+      "log_subsys_recent",
+      "log_thread_recent_bytes",
+      "log_max_container_elements",
+      "log_max_container_bytes",
       "log_to_file",
+      "log_format",
+      "log_async_write",
+      "log_mmap_write",
+      "log_drop_page_cache",
+      "log_index_interval",
+      "log_traffic_trace",
+      "log_sync",
+      "log_sync_interval",
+      "log_preallocate",
+      "log_format_threads",
+      "log_compression",
+      "log_compression_level",
+      "log_compression_dict_size",
       "log_to_syslog",
       "err_to_syslog",
+      "log_to_journald",
+      "err_to_journald",
       "log_stderr_prefix",
+      "log_stderr_splice",
+      "log_sink_max_pending",
+      "log_buffer_size",
+      "log_stream_cache_size",
       "log_to_stderr",
       "err_to_stderr",
       "log_to_graylog",
       "err_to_graylog",
       "log_graylog_host",
       "log_graylog_port",
+      "log_graylog_protocol",
+      "log_graylog_format",
       "log_coarse_timestamps",
+      "log_clock",
+      "log_suppress_repeats",
+      "log_thread_names",
+      "log_trace",
+      "log_trace_sample_rate",
+      "log_trace_sample_level",
+      "log_trace_sample_seed",
+      "log_recent_file",
+      "log_huge_pages",
+      "log_shm_ring",
+      "log_shm_ring_size",
+      "log_rotate_size",
+      "log_rotate_interval",
+      "log_rotate_keep",
       "fsid",
       "host",
       NULL
@@ -248,8 +450,48 @@ public:
       log->set_syslog_level(l, l);
     }
 
+    // journald
+    if (changed.count("log_to_journald") || changed.count("err_to_journald")) {
+      int l = conf.get_val<bool>("log_to_journald") ? 99 :
+	(conf.get_val<bool>("err_to_journald") ? -1 : -2);
+      log->set_journald_level(l, l);
+      // the entity name is set, if at all, before the config is read
+      log->journald().set_entity(conf->name.to_str());
+    }
+
     // file
-    if (changed.count("log_file") || changed.count("log_to_file")) {
+    if (changed.count("log_mmap_write")) {
+      log->set_mmap_write(conf.get_val<bool>("log_mmap_write"));
+    }
+    if (changed.count("log_drop_page_cache")) {
+      log->set_drop_page_cache(conf.get_val<bool>("log_drop_page_cache"));
+    }
+    if (changed.count("log_index_interval")) {
+      log->set_index_interval(
+	conf.get_val<Option::size_t>("log_index_interval"));
+    }
+    if (changed.count("log_traffic_trace")) {
+      log->set_traffic_trace(conf.get_val<string>("log_traffic_trace"));
+    }
+    if (changed.count("log_sync") || changed.count("log_sync_interval")) {
+      static const std::map<std::string, ceph::logging::SyncPolicy> policies = {
+	{"none", ceph::logging::SyncPolicy::NONE},
+	{"periodic", ceph::logging::SyncPolicy::PERIODIC},
+	{"errors", ceph::logging::SyncPolicy::ERRORS},
+      };
+      auto p = policies.find(conf.get_val<std::string>("log_sync"));
+      auto interval = std::chrono::duration<double>(
+	conf.get_val<double>("log_sync_interval"));
+      if (p != policies.end()) {
+	log->set_sync_policy(p->second,
+	  std::chrono::duration_cast<std::chrono::milliseconds>(interval));
+      }
+    }
+    if (changed.count("log_preallocate")) {
+      log->set_preallocate(conf.get_val<Option::size_t>("log_preallocate"));
+    }
+    if (changed.count("log_file") || changed.count("log_to_file") ||
+	changed.count("log_mmap_write")) {
       if (conf->log_to_file) {
 	log->set_log_file(conf->log_file);
       } else {
@@ -258,8 +500,75 @@ public:
       log->reopen_log_file();
     }
 
+    if (changed.count("log_subsys_files")) {
+      auto spec = conf.get_val<std::string>("log_subsys_files");
+      if (log->set_subsys_files(spec) < 0) {
+	std::cerr << "log_subsys_files: failed to parse '" << spec << "'"
+		  << std::endl;
+      }
+    }
+
+    if (changed.count("log_format")) {
+      const auto format = conf.get_val<std::string>("log_format");
+      log->set_log_format(format == "binary" ?
+			  ceph::logging::LogFormat::BINARY :
+			  format == "json" ?
+			  ceph::logging::LogFormat::JSON :
+			  ceph::logging::LogFormat::TEXT);
+    }
+
+    if (changed.count("log_format_threads")) {
+      log->set_format_threads(conf.get_val<uint64_t>("log_format_threads"));
+    }
+
+    if (changed.count("log_compression") ||
+	changed.count("log_compression_level")) {
+      log->set_compression(conf.get_val<std::string>("log_compression"),
+			   conf.get_val<int64_t>("log_compression_level"));
+    }
+    if (changed.count("log_compression_dict_size")) {
+      log->set_compression_dict_size(
+	conf.get_val<Option::size_t>("log_compression_dict_size"));
+    }
+
+    if (changed.count("log_async_write")) {
+      log->set_async_write(conf.get_val<bool>("log_async_write"));
+    }
+
+    if (changed.count("log_buffer_size")) {
+      log->set_log_buffer_size(conf.get_val<Option::size_t>("log_buffer_size"));
+    }
+
+    if (changed.count("log_stream_cache_size")) {
+      CachedStackStringStream::set_depot_size(
+	conf.get_val<uint64_t>("log_stream_cache_size"));
+    }
+
+    if (changed.count("log_sink_max_pending")) {
+      log->set_sink_max_pending(conf.get_val<uint64_t>("log_sink_max_pending"));
+    }
+
+    if (changed.count("log_stderr_splice")) {
+      log->set_stderr_splice(conf.get_val<bool>("log_stderr_splice"));
+    }
+
     if (changed.count("log_stderr_prefix")) {
-      log->set_log_stderr_prefix(conf.get_val<string>("log_stderr_prefix"));
+      auto vals = conf.get_snapshot();
+      log->set_log_stderr_prefix(
+	conf.get_val_view(vals, "log_stderr_prefix"));
+    }
+
+    if (changed.count("log_max_container_elements") ||
+	changed.count("log_max_container_bytes")) {
+      log->set_container_budget(
+	std::min<uint64_t>(conf.get_val<uint64_t>("log_max_container_elements"),
+			   UINT32_MAX),
+	std::min<uint64_t>(conf.get_val<Option::size_t>("log_max_container_bytes"),
+			   UINT32_MAX));
+    }
+
+    if (changed.count("log_governor_level")) {
+      log->set_governor_level(conf.get_val<int64_t>("log_governor_level"));
     }
 
     if (changed.count("log_max_new")) {
@@ -267,37 +576,161 @@ public:
       log->set_max_new(conf->log_max_new);
     }
 
+    if (changed.count("log_max_new_bytes")) {
+      log->set_max_new_bytes(conf.get_val<Option::size_t>("log_max_new_bytes"));
+    }
+
+    if (changed.count("log_error_lane") || changed.count("log_error_sync")) {
+      log->set_error_lane(conf.get_val<bool>("log_error_lane"),
+			  conf.get_val<bool>("log_error_sync"));
+    }
+
+    if (changed.count("log_overflow_policy")) {
+      static const std::map<std::string, ceph::logging::OverflowPolicy> policies = {
+	{"block", ceph::logging::OverflowPolicy::BLOCK},
+	{"drop_newest", ceph::logging::OverflowPolicy::DROP_NEWEST},
+	{"drop_lowest_priority", ceph::logging::OverflowPolicy::DROP_LOWEST_PRIORITY},
+	{"recent_only", ceph::logging::OverflowPolicy::RECENT_ONLY},
+      };
+      auto p = policies.find(conf.get_val<std::string>("log_overflow_policy"));
+      if (p != policies.end()) {
+	log->set_overflow_policy(p->second);
+      }
+    }
+
+    if (changed.count("log_flush_batch") ||
+	changed.count("log_flush_max_delay")) {
+      auto delay = std::chrono::duration<double>(
+	conf.get_val<double>("log_flush_max_delay"));
+      log->set_flush_batch(
+	conf.get_val<uint64_t>("log_flush_batch"),
+	std::chrono::duration_cast<std::chrono::microseconds>(delay));
+    }
+
+    if (changed.count("log_stop_timeout")) {
+      auto timeout = std::chrono::duration<double>(
+	conf.get_val<double>("log_stop_timeout"));
+      log->set_stop_timeout(
+	std::chrono::duration_cast<std::chrono::milliseconds>(timeout));
+    }
+
+    if (changed.count("log_thread_ring_size")) {
+      log->set_thread_ring_size(conf.get_val<uint64_t>("log_thread_ring_size"));
+    }
+
+    if (changed.count("log_queue_shards")) {
+      log->set_queue_shards(conf.get_val<uint64_t>("log_queue_shards"));
+    }
+
+    if (changed.count("log_reorder_window") ||
+	changed.count("log_reorder_max_bytes")) {
+      auto window = std::chrono::duration<double>(
+	conf.get_val<double>("log_reorder_window"));
+      log->set_reorder_window(
+	std::chrono::duration_cast<std::chrono::microseconds>(window),
+	conf.get_val<Option::size_t>("log_reorder_max_bytes"));
+    }
+
     if (changed.count("log_max_recent")) {
       log->set_max_recent(conf->log_max_recent);
     }
 
+    if (changed.count("log_max_recent_bytes")) {
+      log->set_max_recent_bytes(conf.get_val<Option::size_t>("log_max_recent_bytes"));
+    }
+
+    if (changed.count("log_subsys_recent")) {
+      auto spec = conf.get_val<std::string>("log_subsys_recent");
+      if (log->set_subsys_recent(spec) < 0) {
+	std::cerr << "log_subsys_recent: failed to parse '" << spec << "'"
+		  << std::endl;
+      }
+    }
+
+    if (changed.count("log_thread_recent_bytes")) {
+      log->set_thread_recent_bytes(conf.get_val<Option::size_t>("log_thread_recent_bytes"));
+    }
+
+    if (changed.count("log_huge_pages")) {
+      const auto mode = conf.get_val<string>("log_huge_pages");
+      log->set_huge_pages(mode == "hugetlb" ? ceph::logging::HugePages::HUGETLB :
+			  mode == "thp" ? ceph::logging::HugePages::THP :
+			  ceph::logging::HugePages::NONE);
+    }
+    if (changed.count("log_recent_file")) {
+      log->set_recent_file(conf.get_val<string>("log_recent_file"));
+    }
+
+    if (changed.count("log_shm_ring") || changed.count("log_shm_ring_size")) {
+      log->set_shm_ring(conf.get_val<string>("log_shm_ring"),
+			conf.get_val<Option::size_t>("log_shm_ring_size"));
+    }
+
     // graylog
     if (changed.count("log_to_graylog") || changed.count("err_to_graylog")) {
       int l = conf->log_to_graylog ? 99 : (conf->err_to_graylog ? -1 : -2);
       log->set_graylog_level(l, l);
+    }
 
-      if (conf->log_to_graylog || conf->err_to_graylog) {
-	      log->start_graylog();
-      } else if (! (conf->log_to_graylog && conf->err_to_graylog)) {
-	      log->stop_graylog();
-      }
+    if (changed.count("log_graylog_host") || changed.count("log_graylog_port")) {
+      log->graylog().set_destination(conf->log_graylog_host, conf->log_graylog_port);
     }
 
-    if (log->graylog() && (changed.count("log_graylog_host") || changed.count("log_graylog_port"))) {
-      log->graylog()->set_destination(conf->log_graylog_host, conf->log_graylog_port);
+    if (changed.count("log_graylog_protocol") ||
+	changed.count("log_graylog_format")) {
+      using ceph::logging::NetworkSink;
+      log->graylog().set_transport(
+	conf.get_val<std::string>("log_graylog_protocol") == "tcp" ?
+	  NetworkSink::Protocol::TCP : NetworkSink::Protocol::UDP,
+	conf.get_val<std::string>("log_graylog_format") == "binary" ?
+	  NetworkSink::Format::BINARY : NetworkSink::Format::GELF);
     }
 
     if (changed.find("log_coarse_timestamps") != changed.end()) {
       log->set_coarse_timestamps(conf.get_val<bool>("log_coarse_timestamps"));
     }
 
+    if (changed.count("log_clock")) {
+      log->set_tsc_timestamps(conf.get_val<std::string>("log_clock") == "tsc");
+    }
+
+    if (changed.count("log_suppress_repeats")) {
+      log->set_suppress_repeats(conf.get_val<bool>("log_suppress_repeats"));
+    }
+
+    if (changed.count("log_thread_names")) {
+      log->set_thread_names(conf.get_val<bool>("log_thread_names"));
+    }
+
+    if (changed.count("log_rotate_size") ||
+	changed.count("log_rotate_interval") ||
+	changed.count("log_rotate_keep")) {
+      log->set_rotation(
+	conf.get_val<Option::size_t>("log_rotate_size"),
+	conf.get_val<std::chrono::seconds>("log_rotate_interval"),
+	conf.get_val<uint64_t>("log_rotate_keep"));
+    }
+
+    if (changed.count("log_trace")) {
+      auto vals = conf.get_snapshot();
+      log->set_traces(conf.get_val_view(vals, "log_trace"));
+    }
+    if (changed.count("log_trace_sample_rate") ||
+	changed.count("log_trace_sample_level") ||
+	changed.count("log_trace_sample_seed")) {
+      log->set_trace_sampling(
+	conf.get_val<double>("log_trace_sample_rate"),
+	conf.get_val<int64_t>("log_trace_sample_level"),
+	conf.get_val<uint64_t>("log_trace_sample_seed"));
+    }
+
     // metadata
-    if (log->graylog() && changed.count("host")) {
-      log->graylog()->set_hostname(conf->host);
+    if (changed.count("host")) {
+      log->graylog().set_hostname(conf->host);
     }
 
-    if (log->graylog() && changed.count("fsid")) {
-      log->graylog()->set_fsid(conf.get_val<uuid_d>("fsid"));
+    if (changed.count("fsid")) {
+      log->graylog().set_fsid(conf.get_val<uuid_d>("fsid").to_string());
     }
   }
 };
@@ -317,11 +750,79 @@ public:
     }
     return true;
   }
+  bool call_stream(std::string_view command, const cmdmap_t& cmdmap,
+		   std::string_view format, bufferlist& out,
+		   AdminSocketStream& s) override {
+    try {
+      m_cct->do_command(command, cmdmap, format, &out, &s);
+    } catch (const bad_cmd_get& e) {
+      return false;
+    }
+    return true;
+  }
 };
 
 void CephContext::do_command(std::string_view command, const cmdmap_t& cmdmap,
-			     std::string_view format, bufferlist *out)
+			     std::string_view format, bufferlist *out,
+			     AdminSocketStream *stream)
 {
+  if (command == "perf openmetrics") {
+    // straight from the counters; no Formatter
+    std::string text;
+    _refresh_latency_perf();
+    ceph::perf_openmetrics(*_perf_counters_collection, _conf->name.to_str(),
+			   &text);
+    out->append(text);
+    return;
+  }
+  if (command == "perf dump delta") {
+    // polled every few seconds by collectors, so neither a Formatter nor
+    // the log line below
+    std::string cursor;
+    cmd_getval(this, cmdmap, "cursor", cursor);
+    std::string text;
+    _refresh_latency_perf();
+    _perf_delta->dump(cursor, &text);
+    out->append(text);
+    return;
+  }
+  if (command == "profile cpu") {
+    // folded stacks, as flamegraph.pl takes them
+    double seconds = 10;
+    int64_t hz = 99;
+    cmd_getval(this, cmdmap, "seconds", seconds);
+    cmd_getval(this, cmdmap, "hz", hz);
+    seconds = std::clamp(seconds, 0.01, 300.0);
+    std::string folded;
+    ceph::cpu_profile_stats stats;
+    int r = ceph::cpu_profiler::profile(
+      std::chrono::milliseconds(int64_t(seconds * 1000)),
+      std::clamp<int64_t>(hz, 0, ceph::cpu_profiler::MAX_HZ), &folded, &stats);
+    if (r < 0) {
+      out->append("profile cpu failed: " + cpp_strerror(r) + "\n");
+      return;
+    }
+    lgeneric_dout(this, 1) << "profile cpu: " << stats.samples << " samples, "
+			   << stats.dropped << " dropped" << dendl;
+    out->append(folded);
+    return;
+  }
+  // dashboards poll these, and they read the same until the config
+  // changes, so a reply is rendered once per format and version
+  const bool rendered = command == "config show" || command == "config diff";
+  std::string rendered_key;
+  uint64_t rendered_version = 0;
+  if (rendered) {
+    rendered_key.append(command).append(1, '\0').append(format);
+    // before rendering, so a change made meanwhile renders it again
+    rendered_version = _conf.get_version();
+    std::lock_guard l{_rendered_lock};
+    if (auto p = _rendered.find(rendered_key);
+	p != _rendered.end() && p->second.version == rendered_version) {
+      out->append(p->second.out);
+      return;
+    }
+  }
   Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
   stringstream ss;
   for (auto it = cmdmap.begin(); it != cmdmap.end(); ++it) {
@@ -341,6 +842,7 @@ void CephContext::do_command(std::string_view command, const cmdmap_t& cmdmap,
     std::string counter;
     cmd_getval(this, cmdmap, "logger", logger);
     cmd_getval(this, cmdmap, "counter", counter);
+    _refresh_latency_perf();
     _perf_counters_collection->dump_formatted(f, false, logger, counter);
   }
   else if (command == "perfcounters_schema" || command == "2" ||
@@ -358,6 +860,15 @@ void CephContext::do_command(std::string_view command, const cmdmap_t& cmdmap,
   else if (command == "perf histogram schema") {
     _perf_counters_collection->dump_formatted_histograms(f, true);
   }
+  else if (command == "perf latency dump") {
+    f->open_object_section("latency");
+    for (auto& [name, h] : latency_histograms()) {
+      f->open_object_section(name);
+      h->dump(f);
+      f->close_section();
+    }
+    f->close_section();
+  }
   else if (command == "perf reset") {
     std::string var;
     std::string section(command);
@@ -437,6 +948,15 @@ void CephContext::do_command(std::string_view command, const cmdmap_t& cmdmap,
         // Output a single one
         std::string key = ConfFile::normalize_key_name(var);
 	auto schema = _conf.get_schema(key);
+	if (!schema) {
+	  // one of the groups the config leaves out
+	  for (const auto &option : get_ceph_options()) {
+	    if (option.name == key) {
+	      schema = &option;
+	      break;
+	    }
+	  }
+	}
         if (!schema) {
           std::ostringstream msg;
           msg << "Setting not found: '" << key << "'";
@@ -447,8 +967,15 @@ void CephContext::do_command(std::string_view command, const cmdmap_t& cmdmap,
       } else {
         // Output all
         f->open_array_section("options");
-        for (const auto &option : ceph_options) {
+        unsigned n = 0;
+        for (const auto &option : get_ceph_options()) {
           f->dump_object("option", option);
+	  if (stream && ++n % 64 == 0) {
+	    f->flush(*out);
+	    if (!stream->flush(*out)) {
+	      break;
+	    }
+	  }
         }
         f->close_section();
       }
@@ -461,6 +988,34 @@ void CephContext::do_command(std::string_view command, const cmdmap_t& cmdmap,
       f->open_object_section("diff");
       _conf.diff(f, setting);
       f->close_section(); // unknown
+    } else if (command == "config profile") {
+      int64_t count = 20;
+      cmd_getval(this, cmdmap, "count", count);
+      const auto r = _conf.get_profiler().report();
+      auto dump = [f, &r](const char *key, std::string_view name,
+			  uint64_t reads) {
+	f->open_object_section("entry");
+	f->dump_string(key, name);
+	f->dump_unsigned("reads", reads);
+	f->dump_float("reads_per_second", r.seconds > 0 ? reads / r.seconds : 0);
+	f->close_section();
+      };
+      f->dump_unsigned("every", r.every);
+      f->dump_float("seconds", r.seconds);
+      f->open_array_section("options");
+      for (std::size_t i = 0; i < r.options.size() && (int64_t)i < count; ++i) {
+	dump("name", _conf.get_option_name(r.options[i].first),
+	     r.options[i].second);
+      }
+      f->close_section();
+      // legacy member reads can't be told apart by option
+      f->open_array_section("legacy");
+      for (std::size_t i = 0; i < r.legacy.size() && (int64_t)i < count; ++i) {
+	dump("function", r.legacy[i].first, r.legacy[i].second);
+      }
+      f->close_section();
+    } else if (command == "config profile reset") {
+      _conf.get_profiler().reset();
     } else if (command == "log flush") {
       _log->flush();
     }
@@ -470,6 +1025,283 @@ void CephContext::do_command(std::string_view command, const cmdmap_t& cmdmap,
     else if (command == "log reopen") {
       _log->reopen_log_file();
     }
+    else if (command == "log site enable" || command == "log site disable" ||
+	     command == "log site reset") {
+      using ceph::logging::DoutSite;
+      auto& sites = ceph::logging::DoutSiteRegistry::instance();
+      std::string site;
+      if (!cmd_getval(this, cmdmap, "site", site)) {
+	if (command == "log site reset") {
+	  sites.reset();
+	} else {
+	  f->dump_string("error", "syntax error: '" + std::string(command) +
+			 " <file>[:<line>]'");
+	}
+      } else {
+	uint8_t state = DoutSite::DEFAULT;
+	if (command == "log site enable") {
+	  state = DoutSite::ENABLED;
+	} else if (command == "log site disable") {
+	  state = DoutSite::DISABLED;
+	}
+	int r = sites.set(site, state);
+	if (r < 0) {
+	  f->dump_string("error", "invalid site '" + site +
+			 "', expected <file>[:<line>]");
+	} else {
+	  f->dump_int("matched", r);
+	}
+      }
+    }
+    else if (command == "log site ls") {
+      using ceph::logging::DoutSite;
+      f->open_array_section("sites");
+      ceph::logging::DoutSiteRegistry::instance().for_each_set(
+	[f](const DoutSite& s, uint8_t state) {
+	  f->open_object_section("site");
+	  f->dump_string("file", s.file);
+	  f->dump_int("line", s.line);
+	  f->dump_string("state",
+			 state == DoutSite::ENABLED ? "enabled" : "disabled");
+	  f->close_section();
+	});
+      f->close_section();
+    }
+    else if (command == "log top") {
+      using ceph::logging::Log;
+      std::string by = "subsys";
+      int64_t count = 20;
+      cmd_getval(this, cmdmap, "by", by);
+      cmd_getval(this, cmdmap, "count", count);
+      // the costliest first: by bytes gathered, which every gathered
+      // entry pays for whether or not it's written
+      std::vector<std::pair<std::string, Log::Volume>> top;
+      if (by == "site") {
+	ceph::logging::DoutSiteRegistry::instance().for_each(
+	  [&top](const ceph::logging::DoutSite& s) {
+	    Log::Volume v;
+	    v.gathered = s.gathered.load(std::memory_order_relaxed);
+	    v.gathered_bytes = s.gathered_bytes.load(std::memory_order_relaxed);
+	    v.written = s.written.load(std::memory_order_relaxed);
+	    v.written_bytes = s.written_bytes.load(std::memory_order_relaxed);
+	    if (v.gathered) {
+	      top.emplace_back(std::string(s.file) + ":" +
+			       std::to_string(s.line), v);
+	    }
+	  });
+      } else {
+	const auto& subs = _conf->subsys;
+	for (unsigned i = 0; i < subs.get_num(); ++i) {
+	  if (auto v = _log->get_subsys_volume(i); v.gathered) {
+	    top.emplace_back(subs.get_name(i), v);
+	  }
+	}
+      }
+      std::sort(top.begin(), top.end(), [](const auto& a, const auto& b) {
+	return a.second.gathered_bytes > b.second.gathered_bytes;
+      });
+      f->open_array_section(by == "site" ? "sites" : "subsystems");
+      for (const auto& [name, v] : top) {
+	if (count-- <= 0) {
+	  break;
+	}
+	f->open_object_section("entry");
+	f->dump_string(by == "site" ? "site" : "subsys", name);
+	f->dump_unsigned("gathered", v.gathered);
+	f->dump_unsigned("gathered_bytes", v.gathered_bytes);
+	f->dump_unsigned("written", v.written);
+	f->dump_unsigned("written_bytes", v.written_bytes);
+	f->close_section();
+      }
+      f->close_section();
+    }
+    else if (command == "log top reset") {
+      _log->reset_volume();
+    }
+    else if (command == "log recent") {
+      ceph::logging::RecentFilter filter;
+      std::string val;
+      int64_t level;
+      bool ok = true;
+      if (cmd_getval(this, cmdmap, "subsys", val)) {
+	const auto& subs = _conf->subsys;
+	for (unsigned i = 0; i < subs.get_num(); ++i) {
+	  if (val == subs.get_name(i)) {
+	    filter.subsys = i;
+	  }
+	}
+	if (filter.subsys < 0) {
+	  f->dump_string("error", "unknown subsystem '" + val + "'");
+	  ok = false;
+	}
+      }
+      if (cmd_getval(this, cmdmap, "level", level)) {
+	filter.max_prio = level;
+      }
+      if (cmd_getval(this, cmdmap, "thread", val)) {
+	// as the log prints it, in hex
+	char *end;
+	filter.thread = strtoull(val.c_str(), &end, 16);
+	if (val.empty() || *end) {
+	  f->dump_string("error", "invalid thread '" + val + "'");
+	  ok = false;
+	}
+      }
+      if (cmd_getval(this, cmdmap, "from", val) &&
+	  !parse_log_stamp(val, &filter.from)) {
+	f->dump_string("error", "invalid time '" + val + "'");
+	ok = false;
+      }
+      if (cmd_getval(this, cmdmap, "to", val) &&
+	  !parse_log_stamp(val, &filter.to)) {
+	f->dump_string("error", "invalid time '" + val + "'");
+	ok = false;
+      }
+      if (ok) {
+	f->open_array_section("entries");
+	unsigned n = 0;
+	_log->for_each_recent(filter, [&](const ceph::logging::Entry& e) {
+	  char stamp[64];
+	  ceph::logging::append_time(e.stamp(), stamp, sizeof(stamp));
+	  f->open_object_section("entry");
+	  f->dump_string("stamp", stamp);
+	  f->dump_format("thread", "%llx", (unsigned long long)e.m_thread);
+	  f->dump_int("level", e.m_prio);
+	  f->dump_string("subsys", _conf->subsys.get_name(e.m_subsys));
+	  f->dump_string("message", e.strv());
+	  f->close_section();
+	  if (stream && ++n % 64 == 0) {
+	    f->flush(*out);
+	    return stream->flush(*out);
+	  }
+	  return true;
+	});
+	f->close_section();
+      }
+    }
+    else if (command == "thread ls") {
+      // rates are since the last sample, usually a heartbeat_interval ago
+      sample_threads();
+      f->open_array_section("threads");
+      for (const auto& t : get_threads()) {
+	f->open_object_section("thread");
+	f->dump_string("name", t.name);
+	f->dump_int("tid", t.tid);
+	f->dump_stream("started") << ceph::real_clock::time_point(
+	  std::chrono::duration_cast<ceph::timespan>(
+	    t.started.time_since_epoch()));
+	f->dump_float("cpu_seconds",
+		      std::chrono::duration<double>(t.cpu).count());
+	f->dump_float("wait_seconds",
+		      std::chrono::duration<double>(t.wait).count());
+	f->dump_float("cpu_util", t.cpu_util);
+	f->dump_float("wait_util", t.wait_util);
+	f->close_section();
+      }
+      f->close_section();
+    }
+    else if (command == "memory usage") {
+      using ceph::logging::Log;
+      const auto m = _log->get_memory_usage();
+      auto dump_queue = [f](const char *name, const Log::QueueMemory& q) {
+	f->open_object_section(name);
+	f->dump_unsigned("entries", q.entries);
+	f->dump_unsigned("payload_bytes", q.payload_bytes);
+	f->dump_unsigned("slot_bytes", q.slot_bytes);
+	f->dump_unsigned("heap_bytes", q.heap_bytes);
+	f->close_section();
+      };
+      auto dump_ring = [f](const char *name, const Log::RingMemory& r) {
+	f->open_object_section(name);
+	f->dump_unsigned("rings", r.rings);
+	f->dump_unsigned("entries", r.entries);
+	f->dump_unsigned("used_bytes", r.used_bytes);
+	f->dump_unsigned("capacity_bytes", r.capacity_bytes);
+	f->close_section();
+      };
+      f->open_object_section("log");
+      dump_queue("new", m.new_entries);
+      dump_queue("errors", m.errors);
+      dump_queue("flush", m.flush);
+      dump_queue("reorder", m.reorder);
+      dump_ring("recent", m.recent);
+      dump_ring("subsys_recent", m.subsys_recent);
+      dump_ring("thread_recent", m.thread_recent);
+      f->open_object_section("submit_rings");
+      f->dump_unsigned("rings", m.submit_rings);
+      f->dump_unsigned("bytes", m.submit_ring_bytes);
+      f->close_section();
+      f->open_object_section("log_buf");
+      f->dump_unsigned("bytes", m.log_buf_bytes);
+      f->dump_unsigned("capacity_bytes", m.log_buf_capacity);
+      f->close_section();
+      f->dump_unsigned("recycled_streams", m.recycled_streams);
+      f->close_section();
+
+      // the thread caches are counted as streams enter and leave them, so
+      // this doesn't stop any thread
+      const auto s = CachedStackStringStream::get_memory();
+      f->open_object_section("stream_cache");
+      f->dump_unsigned("threads", s.threads);
+      f->dump_unsigned("thread_streams", s.thread_streams);
+      f->dump_unsigned("thread_bytes", s.thread_bytes);
+      f->dump_unsigned("depot_streams", s.depot_streams);
+      f->dump_unsigned("depot_bytes", s.depot_bytes);
+      f->close_section();
+
+      f->open_object_section("config");
+      _conf.dump_memory_usage(f);
+      f->close_section();
+    }
+    else if (command == "startup trace") {
+      const auto phases = ceph::startup_trace::get();
+      const auto origin = phases.empty() ? ceph::mono_time() : phases[0].begin;
+      f->open_array_section("phases");
+      for (const auto& p : phases) {
+	f->open_object_section("phase");
+	f->dump_string("name", p.name);
+	f->dump_int("tid", p.tid);
+	f->dump_unsigned("depth", p.depth);
+	f->dump_float("start_seconds",
+		      std::chrono::duration<double>(p.begin - origin).count());
+	f->dump_float("seconds",
+		      std::chrono::duration<double>(p.took).count());
+	f->close_section();
+      }
+      f->close_section();
+    }
+#ifdef CEPH_PROFILE_MUTEX
+    else if (command == "mutex contention") {
+      int64_t count = 20;
+      cmd_getval(this, cmdmap, "count", count);
+      std::map<pid_t, std::string> names;
+      for (auto& t : get_threads()) {
+	names[t.tid] = std::move(t.name);
+      }
+      f->open_array_section("mutexes");
+      for (const auto& c : ceph::get_mutex_contention()) {
+	if (count-- <= 0) {
+	  break;
+	}
+	f->open_object_section("mutex");
+	f->dump_string("name", c.name);
+	f->dump_unsigned("contended", c.contended);
+	f->dump_float("wait_seconds",
+		      std::chrono::duration<double>(c.wait).count());
+	f->dump_float("max_wait_seconds",
+		      std::chrono::duration<double>(c.max_wait).count());
+	f->dump_int("last_holder", c.last_holder);
+	if (auto i = names.find(c.last_holder); i != names.end()) {
+	  f->dump_string("last_holder_name", i->second);
+	}
+	f->close_section();
+      }
+      f->close_section();
+    }
+    else if (command == "mutex contention reset") {
+      ceph::reset_mutex_contention();
+    }
+#endif
     else {
       ceph_abort_msg("registered under wrong command?");    
     }
@@ -477,6 +1309,17 @@ void CephContext::do_command(std::string_view command, const cmdmap_t& cmdmap,
   }
   f->flush(*out);
   delete f;
+  if (rendered) {
+    // one a format; there are few, but the format string is the client's
+    constexpr std::size_t max_rendered = 16;
+    std::lock_guard l{_rendered_lock};
+    if (_rendered.size() >= max_rendered && !_rendered.count(rendered_key)) {
+      _rendered.clear();
+    }
+    auto& r = _rendered[rendered_key];
+    r.version = rendered_version;
+    r.out = *out;
+  }
   lgeneric_dout(this, 1) << "do_command '" << command << "' '" << ss.str()
 		         << "result is " << out->length() << " bytes" << dendl;
 }
@@ -485,7 +1328,7 @@ CephContext::CephContext(uint32_t module_type_,
                          enum code_environment_t code_env,
                          int init_flags_)
   : nref(1),
-    _conf{code_env == CODE_ENVIRONMENT_DAEMON},
+    _conf{code_env == CODE_ENVIRONMENT_DAEMON, get_option_groups(module_type_)},
     _log(NULL),
     _module_type(module_type_),
     _init_flags(init_flags_),
@@ -499,10 +1342,15 @@ CephContext::CephContext(uint32_t module_type_,
     _perf_counters_conf_obs(NULL),
     _lockdep_obs(NULL)
 {
-  _log = new ceph::logging::Log(&_conf->subsys);
+  // _conf, made above, is timed as md_config_t
+  ceph::startup_trace::phase trace("CephContext");
+  {
+    ceph::startup_trace::phase trace("cct_log");
+    _log = new ceph::logging::Log(&_conf->subsys);
 
-  _log_obs = new LogObs(_log);
-  _conf.add_observer(_log_obs);
+    _log_obs = new LogObs(_log);
+    _conf.add_observer(_log_obs);
+  }
 
   _cct_obs = new CephContextObs(this);
   _conf.add_observer(_cct_obs);
@@ -510,41 +1358,134 @@ CephContext::CephContext(uint32_t module_type_,
   _lockdep_obs = new LockdepObs(this);
   _conf.add_observer(_lockdep_obs);
 
-  _admin_socket = new AdminSocket(this);
-  _heartbeat_map = new HeartbeatMap(this);
+  {
+    ceph::startup_trace::phase trace("cct_admin_socket");
+    _admin_socket = new AdminSocket(this);
+  }
+  {
+    ceph::startup_trace::phase trace("cct_heartbeat_map");
+    _heartbeat_map = new HeartbeatMap(this);
+  }
 
   _plugin_registry = new PluginRegistry(this);
 
+  // the heartbeat work, as separate tasks that share their wakeups
+  auto on_heartbeat = [this](std::string name, std::function<void()> f) {
+    add_service_task(std::move(name), heartbeat_delay(this),
+		     [this, f = std::move(f)] {
+		       if (_conf->heartbeat_interval) {
+			 f();
+		       }
+		       return heartbeat_delay(this);
+		     });
+  };
+  on_heartbeat("touch heartbeat file", [this] {
+    _heartbeat_map->check_touch_file();
+  });
+  on_heartbeat("log file utilization", [this] {
+    _log->update_file_utilization(_conf->log_stop_at_utilization);
+  });
+  on_heartbeat("refresh perf counters", [this] {
+    _refresh_perf_values();
+    _update_perf_export();
+    sample_threads();
+  });
+
+  _perf_delta = std::make_unique<ceph::PerfDelta>(_perf_counters_collection);
+
+  ceph::startup_trace::phase commands_trace("cct_admin_commands");
   _admin_hook = new CephContextHook(this);
   _admin_socket->register_command("assert", "assert", _admin_hook, "");
   _admin_socket->register_command("abort", "abort", _admin_hook, "");
-  _admin_socket->register_command("perfcounters_dump", "perfcounters_dump", _admin_hook, "");
-  _admin_socket->register_command("1", "1", _admin_hook, "");
-  _admin_socket->register_command("perf dump", "perf dump name=logger,type=CephString,req=false name=counter,type=CephString,req=false", _admin_hook, "dump perfcounters value");
-  _admin_socket->register_command("perfcounters_schema", "perfcounters_schema", _admin_hook, "");
-  _admin_socket->register_command("perf histogram dump", "perf histogram dump name=logger,type=CephString,req=false name=counter,type=CephString,req=false", _admin_hook, "dump perf histogram values");
-  _admin_socket->register_command("2", "2", _admin_hook, "");
-  _admin_socket->register_command("perf schema", "perf schema", _admin_hook, "dump perfcounters schema");
-  _admin_socket->register_command("perf histogram schema", "perf histogram schema", _admin_hook, "dump perf histogram schema");
+  _admin_socket->register_command("perfcounters_dump", "perfcounters_dump", _admin_hook, "",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("1", "1", _admin_hook, "",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("perf dump", "perf dump name=logger,type=CephString,req=false name=counter,type=CephString,req=false", _admin_hook, "dump perfcounters value",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("perfcounters_schema", "perfcounters_schema", _admin_hook, "",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("perf dump delta", "perf dump delta name=cursor,type=CephString,req=false", _admin_hook, "dump the perfcounters changed since cursor, one per line",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("perf histogram dump", "perf histogram dump name=logger,type=CephString,req=false name=counter,type=CephString,req=false", _admin_hook, "dump perf histogram values",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("perf latency dump", "perf latency dump", _admin_hook, "dump the latency histograms, with every bucket, for merging across daemons",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("2", "2", _admin_hook, "",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("perf schema", "perf schema", _admin_hook, "dump perfcounters schema",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("perf histogram schema", "perf histogram schema", _admin_hook, "dump perf histogram schema",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("perf openmetrics", "perf openmetrics", _admin_hook, "dump perf counter values as OpenMetrics text",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("profile cpu", "profile cpu name=seconds,type=CephFloat,req=false name=hz,type=CephInt,req=false", _admin_hook, "profile cpu [<seconds>] [<hz>]: sample every thread's stacks for seconds (default 10) at hz (default 99) per CPU second and dump them folded, for flamegraph.pl",
+				   AdminSocket::FLAG_CONCURRENT);
   _admin_socket->register_command("perf reset", "perf reset name=var,type=CephString", _admin_hook, "perf reset <name>: perf reset all or one perfcounter name");
-  _admin_socket->register_command("config show", "config show", _admin_hook, "dump current config settings");
-  _admin_socket->register_command("config help", "config help name=var,type=CephString,req=false", _admin_hook, "get config setting schema and descriptions");
+  _admin_socket->register_command("config show", "config show", _admin_hook, "dump current config settings",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("config help", "config help name=var,type=CephString,req=false", _admin_hook, "get config setting schema and descriptions",
+				   AdminSocket::FLAG_CONCURRENT);
   _admin_socket->register_command("config set", "config set name=var,type=CephString name=val,type=CephString,n=N",  _admin_hook, "config set <field> <val> [<val> ...]: set a config variable");
   _admin_socket->register_command("config unset", "config unset name=var,type=CephString",  _admin_hook, "config unset <field>: unset a config variable");
-  _admin_socket->register_command("config get", "config get name=var,type=CephString", _admin_hook, "config get <field>: get the config value");
-  _admin_socket->register_command("config diff", "config diff", _admin_hook, "dump diff of current config and default config");
-  _admin_socket->register_command("config diff get", "config diff get name=var,type=CephString", _admin_hook, "dump diff get <field>: dump diff of current and default config setting <field>");
+  _admin_socket->register_command("config get", "config get name=var,type=CephString", _admin_hook, "config get <field>: get the config value",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("config diff", "config diff", _admin_hook, "dump diff of current config and default config",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("config diff get", "config diff get name=var,type=CephString", _admin_hook, "dump diff get <field>: dump diff of current and default config setting <field>",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("config profile", "config profile name=count,type=CephInt,req=false", _admin_hook, "config profile [<count>]: the most read options, and the functions most reading legacy members, as counted while config_profile_every is set",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("config profile reset", "config profile reset", _admin_hook, "start config profile's counts afresh",
+				   AdminSocket::FLAG_CONCURRENT);
   _admin_socket->register_command("log flush", "log flush", _admin_hook, "flush log entries to log file");
   _admin_socket->register_command("log dump", "log dump", _admin_hook, "dump recent log entries to log file");
   _admin_socket->register_command("log reopen", "log reopen", _admin_hook, "reopen log file");
+  _admin_socket->register_command("log site enable", "log site enable name=site,type=CephString", _admin_hook, "log site enable <file>[:<line>]: always gather and write the dout statements there");
+  _admin_socket->register_command("log site disable", "log site disable name=site,type=CephString", _admin_hook, "log site disable <file>[:<line>]: never gather the dout statements there");
+  _admin_socket->register_command("log site reset", "log site reset name=site,type=CephString,req=false", _admin_hook, "log site reset [<file>[:<line>]]: return dout statements to the debug levels");
+  _admin_socket->register_command("log site ls", "log site ls", _admin_hook, "list dout statements that are enabled or disabled");
+  _admin_socket->register_command("log top", "log top name=by,type=CephChoices,strings=subsys|site,req=false name=count,type=CephInt,req=false", _admin_hook, "log top [subsys|site] [<count>]: the subsystems or dout statements whose entries cost the most, by bytes gathered",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("log top reset", "log top reset", _admin_hook, "start log top's counts afresh");
+  _admin_socket->register_command("log recent", "log recent name=subsys,type=CephString,req=false name=level,type=CephInt,req=false name=thread,type=CephString,req=false name=from,type=CephString,req=false name=to,type=CephString,req=false", _admin_hook, "log recent [subsys=<name>] [level=<max>] [thread=<hex id>] [from=<time>] [to=<time>]: stream recent log entries, as dump_recent() keeps them, that match; times are as logged or a span ago, e.g. 10m",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("thread ls", "thread ls", _admin_hook, "list named threads with their cpu time and time spent waiting for a cpu",
+				   AdminSocket::FLAG_CONCURRENT);
+#ifdef CEPH_PROFILE_MUTEX
+  _admin_socket->register_command("mutex contention", "mutex contention name=count,type=CephInt,req=false", _admin_hook, "mutex contention [<count>]: the most waited for mutexes, by the name they were made with",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("mutex contention reset", "mutex contention reset", _admin_hook, "start counting mutex contention afresh",
+				   AdminSocket::FLAG_CONCURRENT);
+#endif
+  _admin_socket->register_command("memory usage", "memory usage", _admin_hook, "the memory held by the log's queues, rings and buffers, the cached log streams, and the config schema, values and observers",
+				   AdminSocket::FLAG_CONCURRENT);
+  _admin_socket->register_command("startup trace", "startup trace", _admin_hook, "how long each phase of startup took",
+				   AdminSocket::FLAG_CONCURRENT);
 
   lookup_or_create_singleton_object<MempoolObs>("mempool_obs", false, this);
+  lookup_or_create_singleton_object<ThreadPolicyObs>(
+    "thread_policy_obs", false, this);
+  lookup_or_create_singleton_object<ConfigProfileObs>(
+    "config_profile_obs", false, this);
+  lookup_or_create_singleton_object<CoarseClockObs>(
+    "coarse_clock_obs", false, this);
 }
 
 CephContext::~CephContext()
 {
   associated_objs.clear();
   join_service_thread();
+  if (_work_pool) {
+    _work_pool->stop();
+    _work_pool.reset();
+  }
+  if (_work_pool_perf) {
+    _perf_counters_collection->remove(_work_pool_perf);
+    delete _work_pool_perf;
+    _work_pool_perf = nullptr;
+  }
+  _perf_export.reset();
 
   if (_cct_perf) {
     _perf_counters_collection->remove(_cct_perf);
@@ -556,6 +1497,7 @@ CephContext::~CephContext()
 
   _admin_socket->unregister_commands(_admin_hook);
   delete _admin_hook;
+  _perf_delta.reset();
   delete _admin_socket;
 
   delete _heartbeat_map;
@@ -612,8 +1554,11 @@ void CephContext::start_service_thread()
     _service_thread->create("service");
   }
 
-  if (!(get_init_flags() & CINIT_FLAG_NO_CCT_PERF_COUNTERS))
+  if (!(get_init_flags() & CINIT_FLAG_NO_CCT_PERF_COUNTERS)) {
     _enable_perf_counter();
+    _enable_log_perf_counter();
+    _enable_latency_perf_counter();
+  }
 
   // make logs flush on_exit()
   if (_conf->log_flush_on_exit)
@@ -627,13 +1572,113 @@ void CephContext::start_service_thread()
   // start admin socket
   if (_conf->admin_socket.length())
     _admin_socket->init(_conf->admin_socket);
+
+  _start_conf_file_watch();
+}
+
+void CephContext::_start_conf_file_watch()
+{
+  const auto interval =
+    _conf.get_val<std::chrono::seconds>("conf_file_watch_interval");
+  const std::string path = _conf.get_conf_file_path();
+  if (interval == std::chrono::seconds::zero() || path.empty()) {
+    return;
+  }
+  auto watcher = std::make_shared<ceph::file_watcher>();
+  if (int r = watcher->watch(path); r < 0) {
+    lgeneric_derr(this) << "not watching " << path << " for changes: "
+		<< cpp_strerror(r) << dendl;
+    return;
+  }
+  const ceph::timespan delay = interval;
+  // a change is only read once the interval after it has passed without
+  // another, so as not to catch the file half written
+  add_service_task(
+    "watch conf file", delay,
+    [this, watcher, path, delay, pending = false]() mutable {
+      if (watcher->changed()) {
+	pending = true;
+	return delay;
+      }
+      if (!pending) {
+	return delay;
+      }
+      pending = false;
+      std::ostringstream warnings;
+      int r = _conf.reload_config_file(&warnings);
+      if (r < 0) {
+	lgeneric_derr(this) << "reloading " << path << ": " << cpp_strerror(r)
+		    << dendl;
+      } else {
+	lgeneric_dout(this, 1) << "reloaded " << path << ", " << r
+		       << " options changed" << dendl;
+      }
+      if (!warnings.str().empty()) {
+	lgeneric_derr(this) << warnings.str() << dendl;
+      }
+      return delay;
+    });
 }
 
 void CephContext::reopen_logs()
 {
   std::lock_guard lg(_service_thread_lock);
-  if (_service_thread)
-    _service_thread->reopen_logs();
+  if (_service_thread) {
+    add_service_task("reopen logs", ceph::timespan::zero(), [this] {
+      _log->reopen_log_file();
+      return ceph::timespan::zero();
+    });
+  }
+}
+
+uint64_t CephContext::add_service_task(std::string name, ceph::timespan delay,
+				       std::function<ceph::timespan()> f)
+{
+  std::lock_guard l(_service_lock);
+  const uint64_t id = ++_last_service_task;
+  _service_tasks[id] = service_task{
+    std::move(name),
+    std::make_shared<std::function<ceph::timespan()>>(std::move(f))};
+  _service_wheel.add(ceph::mono_clock::now() + delay, id);
+  // it may be due before the service thread would wake
+  _service_cond.notify_all();
+  return id;
+}
+
+void CephContext::cancel_service_task(uint64_t id)
+{
+  // left in the wheel; the service thread passes over it
+  std::lock_guard l(_service_lock);
+  _service_tasks.erase(id);
+}
+
+ceph::work_pool *CephContext::get_work_pool()
+{
+  std::lock_guard l(_work_pool_lock);
+  if (_work_pool) {
+    return _work_pool.get();
+  }
+  unsigned n = _conf.get_val<uint64_t>("work_pool_threads");
+  if (n == 0) {
+    n = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+  }
+  _work_pool = std::make_unique<ceph::work_pool>("work_pool", n);
+  if (!(get_init_flags() & CINIT_FLAG_NO_CCT_PERF_COUNTERS)) {
+    PerfCountersBuilder plb(this, "work_pool", l_work_pool_first,
+			    l_work_pool_last);
+    plb.add_u64_counter(l_work_pool_submitted, "submitted",
+			"Tasks submitted to the shared work pool");
+    plb.add_u64_counter(l_work_pool_run, "run", "Tasks run");
+    plb.add_u64_counter(l_work_pool_stolen, "stolen",
+			"Tasks run by another worker than the one they were queued on");
+    plb.add_u64_counter(l_work_pool_idle, "idle",
+			"Times a worker found nothing to run and slept");
+    _work_pool_perf = plb.create_perf_counters();
+    _perf_counters_collection->add(_work_pool_perf);
+    _work_pool->set_perf_counters(_work_pool_perf);
+  }
+  _work_pool->start();
+  return _work_pool.get();
 }
 
 void CephContext::join_service_thread()
@@ -652,8 +1697,11 @@ void CephContext::join_service_thread()
   thread->join();
   delete thread;
 
-  if (!(get_init_flags() & CINIT_FLAG_NO_CCT_PERF_COUNTERS))
+  if (!(get_init_flags() & CINIT_FLAG_NO_CCT_PERF_COUNTERS)) {
+    _disable_latency_perf_counter();
+    _disable_log_perf_counter();
     _disable_perf_counter();
+  }
 }
 
 uint32_t CephContext::get_module_type() const
@@ -671,6 +1719,135 @@ int CephContext::get_init_flags() const
   return _init_flags;
 }
 
+void CephContext::_enable_log_perf_counter()
+{
+  using namespace ceph::logging;
+  PerfCountersBuilder plb(this, "log", l_log_first, l_log_last);
+  plb.add_u64_counter(l_log_submitted, "submitted",
+		      "Entries handed to the log thread");
+  plb.add_u64_counter(l_log_written, "written",
+		      "Entries written to the log file");
+  plb.add_u64_counter(l_log_bytes, "bytes", "Bytes written to the log file",
+		      NULL, 0, unit_t(UNIT_BYTES));
+  plb.add_u64_counter(l_log_dropped, "dropped",
+		      "Entries discarded by log_overflow_policy");
+
+  PerfHistogramCommon::axis_config_d batch_entries{
+    "Entries",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,  ///< Start at 0
+    1,  ///< Quantization unit is 1
+    14, ///< Up to 4k entries per flush
+  };
+  PerfHistogramCommon::axis_config_d batch_bytes{
+    "Bytes",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,    ///< Start at 0
+    512,  ///< Quantization unit is 512 bytes
+    14,   ///< Up to 2 MiB per flush
+  };
+  plb.add_u64_counter_histogram(
+    l_log_flush_batch, "flush_batch", batch_entries, batch_bytes,
+    "Histogram of entries and bytes per log flush");
+
+  plb.add_time(l_log_blocked, "blocked",
+	       "Time submitters waited for the log thread to catch up");
+  plb.add_time_avg(l_log_write_lat, "write_lat",
+		   "Latency of synchronous writes to the log file");
+  plb.add_u64(l_log_new, "new", "Entries picked up by the last flush");
+  plb.add_u64(l_log_recent, "recent", "Entries in the recent ring");
+  plb.add_u64(l_log_recent_bytes, "recent_bytes",
+	      "Memory held by the recent ring", NULL, 0, unit_t(UNIT_BYTES));
+  plb.add_u64_counter(l_log_rotated, "rotated",
+		      "Log files rotated by log_rotate_size or log_rotate_interval");
+  plb.add_u64_counter(l_log_stream_spills, "stream_spills",
+		      "Messages that outgrew their formatting buffer");
+  plb.add_u64_counter(l_log_stream_discards, "stream_discards",
+		      "Formatting streams freed rather than cached for holding too much buffer");
+  plb.add_u64_counter(l_log_pool_misses, "pool_misses",
+		      "Blocks for long entries allocated because none was cached");
+
+  _log_perf = plb.create_perf_counters();
+  _perf_counters_collection->add(_log_perf);
+  _log->set_perf_counters(_log_perf);
+}
+
+void CephContext::_disable_log_perf_counter()
+{
+  if (!_log_perf) {
+    return;
+  }
+  _log->set_perf_counters(nullptr);
+  _perf_counters_collection->remove(_log_perf);
+  delete _log_perf;
+  _log_perf = nullptr;
+}
+
+std::vector<std::pair<const char*, const ceph::hdr_histogram*>>
+CephContext::latency_histograms() const
+{
+  return {
+    {"log_entry", &_log->get_entry_latency()},
+    {"asok_command", &_admin_socket->get_command_latency()},
+    {"config_apply", &_conf.get_apply_latency()},
+  };
+}
+
+void CephContext::_enable_latency_perf_counter()
+{
+  PerfCountersBuilder plb(this, "latency", l_latency_first, l_latency_last);
+  plb.add_u64(l_latency_log_entry_p50, "log_entry_p50_ns",
+	      "Median time from a log entry's stamp to its write");
+  plb.add_u64(l_latency_log_entry_p99, "log_entry_p99_ns",
+	      "99th percentile time from a log entry's stamp to its write");
+  plb.add_u64(l_latency_log_entry_p999, "log_entry_p999_ns",
+	      "99.9th percentile time from a log entry's stamp to its write");
+  plb.add_u64(l_latency_log_entry_max, "log_entry_max_ns",
+	      "Longest time from a log entry's stamp to its write");
+  plb.add_u64(l_latency_asok_command_p50, "asok_command_p50_ns",
+	      "Median admin socket command latency");
+  plb.add_u64(l_latency_asok_command_p99, "asok_command_p99_ns",
+	      "99th percentile admin socket command latency");
+  plb.add_u64(l_latency_asok_command_p999, "asok_command_p999_ns",
+	      "99.9th percentile admin socket command latency");
+  plb.add_u64(l_latency_asok_command_max, "asok_command_max_ns",
+	      "Longest admin socket command");
+  plb.add_u64(l_latency_config_apply_p50, "config_apply_p50_ns",
+	      "Median time config observers took to apply a change");
+  plb.add_u64(l_latency_config_apply_p99, "config_apply_p99_ns",
+	      "99th percentile time config observers took to apply a change");
+  plb.add_u64(l_latency_config_apply_p999, "config_apply_p999_ns",
+	      "99.9th percentile time config observers took to apply a change");
+  plb.add_u64(l_latency_config_apply_max, "config_apply_max_ns",
+	      "Longest time config observers took to apply a change");
+  _latency_perf = plb.create_perf_counters();
+  _perf_counters_collection->add(_latency_perf);
+}
+
+void CephContext::_disable_latency_perf_counter()
+{
+  if (!_latency_perf) {
+    return;
+  }
+  _perf_counters_collection->remove(_latency_perf);
+  delete _latency_perf;
+  _latency_perf = nullptr;
+}
+
+void CephContext::_refresh_latency_perf()
+{
+  if (!_latency_perf) {
+    return;
+  }
+  unsigned l = l_latency_first + 1;
+  for (auto& [name, h] : latency_histograms()) {
+    _latency_perf->set(l++, h->quantile(0.5));
+    _latency_perf->set(l++, h->quantile(0.99));
+    _latency_perf->set(l++, h->quantile(0.999));
+    _latency_perf->set(l++, h->max());
+  }
+}
+
 void CephContext::_refresh_perf_values()
 {
   if (_cct_perf) {
@@ -683,6 +1860,29 @@ void CephContext::_refresh_perf_values()
     _mempool_perf->set(l++, p.allocated_bytes());
     _mempool_perf->set(l++, p.allocated_items());
   }
+  _refresh_latency_perf();
+}
+
+void CephContext::_update_perf_export()
+{
+  const auto path = _conf.get_val<std::string>("perf_export_file");
+  if (path.empty() && !_perf_export) {
+    return;
+  }
+  if (!_perf_export) {
+    _perf_export = std::make_unique<ceph::PerfExport>(
+      _perf_counters_collection);
+  }
+  // set_path() only tries, and fails, when the path changes; update()
+  // retries every heartbeat until the new counters fit
+  if (int r = _perf_export->set_path(path); r < 0) {
+    lgeneric_derr(this) << "failed to export perf counters to " << path
+			<< ": " << cpp_strerror(r) << dendl;
+  } else if (r = _perf_export->update(); r < 0) {
+    lgeneric_dout(this, 1) << "failed to lay out " << path
+			   << " for new perf counters: " << cpp_strerror(r)
+			   << dendl;
+  }
 }
 
 AdminSocket *CephContext::get_admin_socket()
@@ -16,6 +16,7 @@
 #define CEPH_CEPHCONTEXT_H
 
 #include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -24,6 +25,8 @@
 #include <string_view>
 #include <typeinfo>
 #include <typeindex>
+#include <utility>
+#include <vector>
 
 #include "include/any.h"
 #include "common/cmdparse.h"
@@ -31,9 +34,12 @@
 #include "msg/msg_types.h"
 #include "common/config_proxy.h"
 #include "include/spinlock.h"
+#include "common/ceph_mutex.h"
 #include "common/perf_counters_collection.h"
+#include "common/timer_wheel.h"
 
 class AdminSocket;
+class AdminSocketStream;
 class CephContextServiceThread;
 class CephContextHook;
 class CephContextObs;
@@ -42,6 +48,9 @@ class MonMap;
 namespace ceph {
   class PluginRegistry;
   class HeartbeatMap;
+  class PerfExport;
+  class PerfDelta;
+  class work_pool;
   namespace logging {
     class Log;
   }
@@ -92,6 +101,30 @@ public:
   /* Reopen the log files */
   void reopen_logs();
 
+  /// service task deadlines are rounded up to this, so that tasks due at
+  /// about the same time share a wakeup
+  static constexpr ceph::timespan SERVICE_TICK = std::chrono::milliseconds(250);
+
+  /**
+   * run a task on the service thread
+   *
+   * f first runs delay from now, then again after whatever delay it
+   * returns, until it returns zero or is cancelled.  Tasks wait for the
+   * service thread if it hasn't started, and run one at a time, so a slow
+   * one holds up the rest.
+   *
+   * @return an id for cancel_service_task()
+   */
+  uint64_t add_service_task(std::string name, ceph::timespan delay,
+			    std::function<ceph::timespan()> f);
+  /// stop a task from running again; if it is running, that run finishes
+  void cancel_service_task(uint64_t id);
+
+  /// the pool of work_pool_threads workers the process's common code
+  /// shares, started on first use; its threads don't survive a fork, so
+  /// not before global_init_daemonize()
+  ceph::work_pool *get_work_pool();
+
   /* Get the module type (client, mon, osd, mds, etc.) */
   uint32_t get_module_type() const;
 
@@ -116,9 +149,12 @@ public:
 
   /**
    * process an admin socket command
+   *
+   * With a stream, long replies are flushed to it as they are built.
    */
   void do_command(std::string_view command, const cmdmap_t& cmdmap,
-		  std::string_view format, ceph::bufferlist *out);
+		  std::string_view format, ceph::bufferlist *out,
+		  AdminSocketStream *stream = nullptr);
 
   static constexpr std::size_t largest_singleton = 8 * 72;
 
@@ -209,6 +245,10 @@ private:
   /* Stop and join the Ceph Context's service thread */
   void join_service_thread();
 
+  /// with conf_file_watch_interval, a service task that reloads the config
+  /// file when it changes
+  void _start_conf_file_watch();
+
   uint32_t _module_type;
 
   int _init_flags;
@@ -225,6 +265,20 @@ private:
   friend class CephContextServiceThread;
   CephContextServiceThread *_service_thread;
 
+  struct service_task {
+    std::string name;
+    /// shared with the service thread while it runs
+    std::shared_ptr<std::function<ceph::timespan()>> fn;
+  };
+  /// protects the service tasks and wakes the service thread
+  ceph::mutex _service_lock = ceph::make_mutex("CephContext::_service_lock");
+  ceph::condition_variable _service_cond;
+  /// the ids of _service_tasks, by when they next run
+  ceph::timer_wheel<uint64_t> _service_wheel{SERVICE_TICK,
+					      ceph::mono_clock::now()};
+  std::map<uint64_t, service_task> _service_tasks;
+  uint64_t _last_service_task = 0;
+
   using md_config_obs_t = ceph::md_config_obs_impl<ConfigProxy>;
 
   md_config_obs_t *_log_obs;
@@ -238,6 +292,27 @@ private:
 
   md_config_obs_t *_perf_counters_conf_obs;
 
+  PerfCounters *_log_perf = nullptr; ///< Log's own counters, see log/Log.h
+  PerfCounters *_latency_perf = nullptr; ///< percentiles of the histograms
+  /// perf_export_file; only used by the service thread
+  std::unique_ptr<ceph::PerfExport> _perf_export;
+  /// what perf dump delta has told its clients
+  std::unique_ptr<ceph::PerfDelta> _perf_delta;
+
+  /// protects creating _work_pool
+  ceph::mutex _work_pool_lock = ceph::make_mutex("CephContext::_work_pool_lock");
+  std::unique_ptr<ceph::work_pool> _work_pool;
+  PerfCounters *_work_pool_perf = nullptr; ///< see common/work_pool.h
+
+  /// 'config show' and 'config diff' replies as last rendered, by command
+  /// and format, with the config version they show
+  struct rendered_reply {
+    uint64_t version = 0;
+    ceph::bufferlist out;
+  };
+  ceph::mutex _rendered_lock = ceph::make_mutex("CephContext::_rendered_lock");
+  std::map<std::string, rendered_reply, std::less<>> _rendered;
+
   CephContextHook *_admin_hook;
 
   ceph::spinlock associated_objs_lock;
@@ -280,11 +355,41 @@ private:
     l_mempool_items,
     l_mempool_last
   };
+  /// p50, p99, p999 and max of each of latency_histograms(), in ns
+  enum {
+    l_latency_first = 873300,
+    l_latency_log_entry_p50,
+    l_latency_log_entry_p99,
+    l_latency_log_entry_p999,
+    l_latency_log_entry_max,
+    l_latency_asok_command_p50,
+    l_latency_asok_command_p99,
+    l_latency_asok_command_p999,
+    l_latency_asok_command_max,
+    l_latency_config_apply_p50,
+    l_latency_config_apply_p99,
+    l_latency_config_apply_p999,
+    l_latency_config_apply_max,
+    l_latency_last
+  };
 
   /**
    * Refresh perf counter values.
    */
   void _refresh_perf_values();
+  /// follow perf_export_file and publish the counters there
+  void _update_perf_export();
+
+  void _enable_log_perf_counter();
+  void _disable_log_perf_counter();
+  void _enable_latency_perf_counter();
+  void _disable_latency_perf_counter();
+  /// set the "latency" counters from the histograms they summarize
+  void _refresh_latency_perf();
+  /// the latency histograms, by the name perf dump and perf latency dump
+  /// show them under, in l_latency_* order
+  std::vector<std::pair<const char*, const ceph::hdr_histogram*>>
+  latency_histograms() const;
 
   friend class CephContextObs;
 };
@@ -12,14 +12,21 @@
  *
  */
 
+#include <atomic>
+#include <optional>
+#include <sstream>
+
 #include "comon/utils/compat.h"
 #include "common_init.h"
 #include "common/utils/admin_socket.h"
 #include "common/utils/ceph_argparse.h"
+#include "common/utils/Thread.h"
 #include "ceph_context.h"
 #include "config.h"
 #include "common/logging/dout.h"
 #include "common/strtol.h"
+#include "common/errno.h"
+#include "common/startup_trace.h"
 #include "common/zipkin_trace.h"
 
 #define dout_subsys ceph_subsys_
@@ -46,6 +53,12 @@ CephContext *common_preinit(const CephInitParameters &iparams, enum code_environ
     conf.set_val_default("admin_socket", "$run_dir/$cluster-$name.$pid.$cctid.asok");
   }
 
+  if (code_env == CODE_ENVIRONMENT_UTILITY ||
+      code_env == CODE_ENVIRONMENT_UTILITY_NODOUT) {
+    // not worth a log thread
+    conf.set_val_default("log_inline", "sync");
+  }
+
   if (code_env == CODE_ENVIRONMENT_LIBRARY || code_env == CODE_ENVIRONMENT_UTILITY_NODOUT) {
     conf.set_val_default("log_to_stderr", "false");
     conf.set_val_default("err_to_stderr", "false");
@@ -74,6 +87,42 @@ void complain_about_parse_errors(CephContext *cct, std::deque<std::string> *pars
 }
 
 
+void common_start_log(CephContext *cct)
+{
+  if (cct->_log->is_started()) {
+    return;
+  }
+  const auto& conf = cct->_conf;
+  const auto mode = conf.get_val<std::string>("log_inline");
+  cct->_log->set_inline(mode != "off", mode == "buffered");
+  cct->_log->set_shared_flusher(conf.get_val<bool>("log_shared_flusher"));
+  cct->_log->start();
+}
+
+/// what the startup phases took, to the log and startup_trace_file; for
+/// the first CephContext to finish, as a library may make many
+static void report_startup(CephContext *cct)
+{
+  static std::atomic<bool> reported = false;
+  if (reported.exchange(true)) {
+    return;
+  }
+  std::ostringstream ss;
+  for (const auto& p : ceph::startup_trace::get()) {
+    ss << " " << p.name << " " << p.took;
+  }
+  ldout(cct, 1) << "startup phases:" << ss.str() << dendl;
+
+  const auto path = cct->_conf.get_val<std::string>("startup_trace_file");
+  if (!path.empty()) {
+    int r = ceph::startup_trace::write_chrome_trace(path);
+    if (r < 0) {
+      lderr(cct) << "unable to write startup_trace_file " << path << ": "
+		 << cpp_strerror(r) << dendl;
+    }
+  }
+}
+
 /* Please be sure that this can safely be called multiple times by the
  * same application. */
 void common_init_finish(CephContext *cct)
@@ -83,16 +132,32 @@ void common_init_finish(CephContext *cct)
     return;
   }
   cct->_finished = true;
-  cct->init_crypto();
-  ZTracer::ztrace_init();
+  std::optional<ceph::startup_trace::phase> finish_trace;
+  finish_trace.emplace("common_init_finish");
+
+  // Loading and seeding the crypto and tracing libraries doesn't depend on
+  // anything below, which is starting threads and binding the admin
+  // socket, so let the two go on at once.
+  std::thread crypto = make_named_thread("init_crypto", [cct] {
+    ceph::startup_trace::phase trace("init_crypto");
+    cct->init_crypto();
+    ZTracer::ztrace_init();
+  });
 
   if (!cct->_log->is_started()) {
-    cct->_log->start();
+    ceph::startup_trace::phase trace("log_start");
+    common_start_log(cct);
   }
 
   int flags = cct->get_init_flags();
-  if (!(flags & CINIT_FLAG_NO_DAEMON_ACTIONS))
+  if (!(flags & CINIT_FLAG_NO_DAEMON_ACTIONS)) {
+    ceph::startup_trace::phase trace("service_thread");
     cct->start_service_thread();
+  }
+
+  crypto.join();
+  finish_trace.reset();
+  report_startup(cct);
 
   if ((flags & CINIT_FLAG_DEFER_DROP_PRIVILEGES) && (cct->get_set_uid() || cct->get_set_gid())) {
     cct->get_admin_socket()->chown(cct->get_set_uid(), cct->get_set_gid());
@@ -62,6 +62,10 @@ class CephInitParameters;
 CephContext *common_preinit(const CephInitParameters &iparams, 
                             enum code_environment_t code_env, int flags);
 
+/* Start cct's log, unless it is already, with its startup options
+ * (log_inline, log_shared_flusher) as configured so far. */
+void common_start_log(CephContext *cct);
+
 /* Print out some parse errors. */
 void complain_about_parse_errors(CephContext *cct, std::deque<std::string> *parse_errors);
 
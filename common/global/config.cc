@@ -12,6 +12,10 @@
  *
  */
 
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
 #include <boost/type_traits.hpp>
 #include "common/ceph_argparse.h"
 #include "common/common_init.h"
@@ -22,6 +26,8 @@
 #include "osd/osd_types.h"
 #include "common/errno.h"
 #include "common/hostname.h"
+#include "common/startup_trace.h"
+#include "common/resource_limits.h"
 #include "common/dout.h"
 
 /* Don't use standard Ceph logging in this file.
@@ -65,19 +71,17 @@ const char *ceph_conf_level_name(int level)
 
 int ceph_resolve_file_search(const std::string& filename_list, std::string& result)
 {
-  list<string> ls;
-  get_str_list(filename_list, ls);
-
   int ret = -ENOENT;
-  list<string>::iterator iter;
-  for (iter = ls.begin(); iter != ls.end(); ++iter) {
-    int fd = ::open(iter->c_str(), O_RDONLY|O_CLOEXEC);
+  std::string path;
+  for (std::string_view name : ceph::split(filename_list)) {
+    path.assign(name);
+    int fd = ::open(path.c_str(), O_RDONLY|O_CLOEXEC);
     if (fd < 0) {
       ret = -errno;
       continue;
     }
     close(fd);
-    result = *iter;
+    result = std::move(path);
     return 0;
   }
 
@@ -93,62 +97,126 @@ static int conf_stringify(const Option::value_t& v, string *out)
   return 0;
 }
 
-md_config_t::md_config_t(ConfigValues& values, const ConfigTracker& tracker, bool is_daemon)
-  : is_daemon(is_daemon)
+static int validate_log_rate_limit(std::string *value, std::string *error_message)
 {
-  // Load the compile-time list of Option into
-  // a map so that we can resolve keys quickly.
-  for (const auto &i : ceph_options) {
-    if (schema.count(i.name)) {
-      // We may be instantiated pre-logging so send 
-      std::cerr << "Duplicate config key in schema: '" << i.name << "'" << std::endl;
-      ceph_abort();
-    }
-    schema.emplace(std::piecewise_construct,
-		   std::forward_as_tuple(i.name),
-		   std::forward_as_tuple(i));
+  unsigned r, b;
+  // %n: nothing may follow the numbers, e.g. "10/sfoo"
+  int end = 0;
+  const char *s = value->c_str();
+  if (sscanf(s, "%u%n/%u%n", &r, &end, &b, &end) < 1 || s[end] != '\0' ||
+      value->find('-') != std::string::npos) {
+    *error_message = "value must take the form R or R/B, where R and B are non-negative integers";
+    return -EINVAL;
+  }
+  return 0;
+}
+
+static int validate_log_sample(std::string *value, std::string *error_message)
+{
+  unsigned n, l;
+  int r = sscanf(value->c_str(), "%u/%u", &n, &l);
+  if (r < 1 || value->find('-') != std::string::npos ||
+      (r == 2 && l > 200)) {
+    *error_message = "value must take the form N or N/L, where N is a non-negative integer and L a debug level";
+    return -EINVAL;
   }
+  return 0;
+}
 
-  // Define the debug_* options as well.
-  subsys_options.reserve(values.subsys.get_num());
+md_config_t::md_config_t(ConfigValues& values, const ConfigTracker& tracker,
+			 bool is_daemon, unsigned option_groups)
+  : is_daemon(is_daemon),
+    option_groups(option_groups),
+    compiled_options(get_ceph_options(option_groups))
+{
+  ceph::startup_trace::phase trace("md_config_t");
+  // Load the compile-time list of Option into a sorted vector so that
+  // we can resolve keys quickly.
+  const auto& options = compiled_options;
+  schema_t::sequence_type entries;
+  entries.reserve(options.size() + 2 * values.subsys.get_num());
+  for (const auto &i : options) {
+    entries.emplace_back(i.name, std::cref(i));
+  }
+  auto by_name = [](const schema_t::value_type& a,
+		    const schema_t::value_type& b) {
+    return a.first < b.first;
+  };
+  std::sort(entries.begin(), entries.end(), by_name);
+  auto dup = std::adjacent_find(entries.begin(), entries.end(),
+				[](const auto& a, const auto& b) {
+				  return a.first == b.first;
+				});
+  if (dup != entries.end()) {
+    // We may be instantiated pre-logging so send 
+    std::cerr << "Duplicate config key in schema: '" << dup->first << "'" << std::endl;
+    ceph_abort();
+  }
+  const auto num_compiled = entries.size();
+
+  // Define the debug_*, log_rate_limit_* and log_sample_* options as well.
+  // The descriptions point into subsys_descs, which must not reallocate.
+  subsys_options.reserve(3 * values.subsys.get_num());
+  subsys_descs.reserve(3 * values.subsys.get_num());
   for (unsigned i = 0; i < values.subsys.get_num(); ++i) {
     string name = string("debug_") + values.subsys.get_name(i);
-    subsys_options.push_back(Option(name, Option::TYPE_STR, Option::LEVEL_ADVANCED));
+    subsys_options.push_back(Option(name, Option::TYPE_LOGLEVEL, Option::LEVEL_ADVANCED));
     Option& opt = subsys_options.back();
-    opt.set_default(stringify(values.subsys.get_log_level(i)) + "/" + stringify(values.subsys.get_gather_level(i)));
-    string desc = string("Debug level for ") + values.subsys.get_name(i);
-    opt.set_description(desc.c_str());
+    opt.set_default(Option::log_level_t{values.subsys.get_log_level(i),
+					values.subsys.get_gather_level(i)});
+    subsys_descs.push_back(string("Debug level for ") + values.subsys.get_name(i));
+    opt.set_description(subsys_descs.back().c_str());
     opt.set_flag(Option::FLAG_RUNTIME);
     opt.set_long_description("The value takes the form 'N' or 'N/M' where N and M are values between 0 and 99.  N is the debug level to log (all values below this are included), and M is the level to gather and buffer in memory.  In the event of a crash, the most recent items <= M are dumped to the log file.");
     opt.set_subsys(i);
-    opt.set_validator([](std::string *value, std::string *error_message) {
-      int m, n;
-      int r = sscanf(value->c_str(), "%d/%d", &m, &n);
-      if (r >= 1) {
-        if (m < 0 || m > 99) {
-          *error_message = "value must be in range [0, 99]";
-          return -ERANGE;
-        }
-        if (r == 2) {
-          if (n < 0 || n > 99) {
-            *error_message = "value must be in range [0, 99]";
-            return -ERANGE;
-          }
-        } else {
-          // normalize to M/N
-          n = m;
-          *value = stringify(m) + "/" + stringify(n);
-        }
-      } else {
-        *error_message = "value must take the form N or N/M, where N and M are integers";
-        return -EINVAL;
-      }
-      return 0;
-    });
+
+    name = string("log_rate_limit_") + values.subsys.get_name(i);
+    subsys_options.push_back(Option(name, Option::TYPE_STR, Option::LEVEL_ADVANCED));
+    Option& rate_opt = subsys_options.back();
+    rate_opt.set_default("0");
+    subsys_descs.push_back(string("Rate limit for gathered log entries from ") + values.subsys.get_name(i));
+    rate_opt.set_description(subsys_descs.back().c_str());
+    rate_opt.set_flag(Option::FLAG_RUNTIME);
+    rate_opt.set_long_description("The value takes the form 'R' or 'R/B' where R is the sustained number of entries per second and B the number that may be logged in a burst (default R).  Entries over the limit are dropped and counted, and a summary line is logged once the subsystem may log again.  0 disables the limit.  Errors (level -1) are never limited.");
+    rate_opt.set_subsys_rate(i);
+    rate_opt.set_typed_validator<std::string, validate_log_rate_limit>();
+
+    name = string("log_sample_") + values.subsys.get_name(i);
+    subsys_options.push_back(Option(name, Option::TYPE_STR, Option::LEVEL_ADVANCED));
+    Option& sample_opt = subsys_options.back();
+    sample_opt.set_default("0");
+    subsys_descs.push_back(string("Log only one in every N gathered entries from ") + values.subsys.get_name(i));
+    sample_opt.set_description(subsys_descs.back().c_str());
+    sample_opt.set_flag(Option::FLAG_RUNTIME);
+    sample_opt.set_long_description("The value takes the form 'N' or 'N/L': of the entries gathered at debug level L (default 1) and above, one in N, picked at random, is kept, and the others are dropped before they are formatted.  Meant for high levels in hot paths, e.g. '100/20'.  0 and 1 disable sampling.  Levels 0 and -1 are never sampled, and neither are entries enabled for a single site or by log_trace.");
+    sample_opt.set_subsys_sample(i);
+    sample_opt.set_typed_validator<std::string, validate_log_sample>();
   }
   for (auto& opt : subsys_options) {
-    schema.emplace(opt.name, opt);
+    entries.emplace_back(opt.name, std::cref(opt));
+  }
+  // a compiled-in option wins over a generated one of the same name
+  std::sort(entries.begin() + num_compiled, entries.end(), by_name);
+  std::inplace_merge(entries.begin(), entries.begin() + num_compiled,
+		     entries.end(), by_name);
+  entries.erase(std::unique(entries.begin(), entries.end(),
+			    [](const auto& a, const auto& b) {
+			      return a.first == b.first;
+			    }),
+		entries.end());
+  schema.adopt_sequence(boost::container::ordered_unique_range,
+			std::move(entries));
+  compiled_ids.assign(options.size(), OptionId::NONE);
+  subsys_ids.assign(subsys_options.size(), OptionId::NONE);
+  for (std::size_t id = 0; id < schema.size(); ++id) {
+    const Option *o = &schema.nth(id)->second.get();
+    if (o >= options.data() && o < options.data() + options.size()) {
+      compiled_ids[o - options.data()] = static_cast<OptionId>(id);
+    } else {
+      subsys_ids[o - subsys_options.data()] = static_cast<OptionId>(id);
+    }
   }
+  values.set_schema(&schema);
 
   // Populate list of legacy_values according to the OPTION() definitions
   // Note that this is just setting up our map of name->member ptr.  The
@@ -156,29 +224,51 @@ md_config_t::md_config_t(ConfigValues& values, const ConfigTracker& tracker, boo
   // as all loads write to both the values map, and the legacy
   // members if present.
   legacy_values = {
-#define OPTION(name, type) {std::string(STRINGIFY(name)), &ConfigValues::name},
+#define OPTION(name, type) {std::string_view(STRINGIFY(name)), &ConfigValues::name},
 #define SAFE_OPTION(name, type) OPTION(name, type)
+#define HOT_OPTION(name, type) OPTION(name, type)
 #include "legacy_config_opts.h"
 #undef OPTION
 #undef SAFE_OPTION
+#undef HOT_OPTION
   };
+  if (option_groups != OPTION_GROUPS_ALL) {
+    // the members of options left out keep their zero values
+    for (auto i = legacy_values.begin(); i != legacy_values.end(); ) {
+      if (schema.count(i->first)) {
+	++i;
+      } else {
+	i = legacy_values.erase(i);
+      }
+    }
+  }
 
+#ifdef CEPH_DEBUG_SCHEMA
   validate_schema();
+#endif
+  validate_default_settings(values, tracker);
+
+  // Copy out values (defaults) into any legacy (C struct member) fields
+  update_legacy_vals(values);
+}
 
-  // Validate default values from the schema
+md_config_t::~md_config_t() {}
+
+/**
+ * Run the validators over the defaults of the options that have one, and
+ * take whatever they normalize a default to.  Only a validator can reject
+ * or change a default, so the rest need no look.
+ */
+void md_config_t::validate_default_settings(ConfigValues& values,
+					    const ConfigTracker& tracker)
+{
   for (const auto &i : schema) {
     const Option &opt = i.second;
-    if (opt.type == Option::TYPE_STR) {
-      bool has_daemon_default = !boost::get<boost::blank>(&opt.daemon_value);
-      Option::value_t default_val;
-      if (is_daemon && has_daemon_default) {
-	      default_val = opt.daemon_value;
-      } else {
-	      default_val = opt.value;
-      }
+    if (opt.type == Option::TYPE_STR && opt.validator) {
       // We call pre_validate as a sanity check, but also to get any
       // side effect (value modification) from the validator.
-      std::string *def_str = boost::get<std::string>(&default_val);
+      const std::string *def_str =
+	boost::get<std::string>(&_get_val_default(opt));
       std::string val = *def_str;
       std::string err;
       if (opt.pre_validate(&val, &err) != 0) {
@@ -195,22 +285,30 @@ md_config_t::md_config_t(ConfigValues& values, const ConfigTracker& tracker, boo
         set_val_default(values, tracker, opt.name, val);
       }
     }
+    if (opt.typed_validator) {
+      Option::value_t def = _get_val_default(opt);
+      std::string err;
+      if (opt.typed_validate(&def, &err) != 0) {
+        std::cerr << "Default value " << opt.name << "=" << def << " is invalid: " << err << std::endl;
+        ceph_abort();
+      }
+      if (def != _get_val_default(opt)) {
+        set_val_default(values, tracker, opt.name, Option::to_str(def));
+      }
+    }
   }
-
-  // Copy out values (defaults) into any legacy (C struct member) fields
-  update_legacy_vals(values);
 }
 
-md_config_t::~md_config_t() {}
-
 /**
  * Sanity check schema.  Assert out on failures, to ensure any bad changes
- * cannot possibly pass any testing and make it into a release.
+ * cannot possibly pass any testing and make it into a release.  The schema
+ * is fixed at build time, so only builds with CEPH_DEBUG_SCHEMA (and the
+ * tests, which call this directly) pay for it at startup.
  */
-void md_config_t::validate_schema()
+void md_config_t::validate_schema() const
 {
   for (const auto &i : schema) {
-    const auto &opt = i.second;
+    const Option &opt = i.second;
     for (const auto &see_also_key : opt.see_also) {
       if (schema.count(see_also_key) == 0) {
         std::cerr << "Non-existent see-also key '" << see_also_key 
@@ -233,11 +331,29 @@ const Option *md_config_t::find_option(const string& name) const
 {
   auto p = schema.find(name);
   if (p != schema.end()) {
-    return &p->second;
+    return &p->second.get();
   }
   return nullptr;
 }
 
+const group_option_t *md_config_t::find_other_option(std::string_view name) const
+{
+  if (option_groups == OPTION_GROUPS_ALL) {
+    return nullptr;
+  }
+  auto o = find_group_option(name);
+  return o && !(o->group & option_groups) ? o : nullptr;
+}
+
+OptionId md_config_t::get_option_id(std::string_view name) const
+{
+  auto p = schema.find(name);
+  if (p == schema.end()) {
+    return OptionId::NONE;
+  }
+  return static_cast<OptionId>(schema.index_of(p));
+}
+
 void md_config_t::set_val_default(ConfigValues& values,
 				  const ConfigTracker& tracker,
 				  const string& name, const std::string& val)
@@ -249,11 +365,72 @@ void md_config_t::set_val_default(ConfigValues& values,
   ceph_assert(r >= 0);
 }
 
+void md_config_t::_set_mon_val(CephContext *cct,
+			       ConfigValues& values,
+			       const ConfigTracker& tracker,
+			       const std::string& key,
+			       const std::string& val,
+			       const config_callback& config_cb)
+{
+  if (config_cb) {
+    if (config_cb(key, val)) {
+      ldout(cct, 4) << __func__ << " callback consumed " << key << dendl;
+      return;
+    }
+    ldout(cct, 4) << __func__ << " callback ignored " << key << dendl;
+  }
+  const Option *o = find_option(key);
+  if (!o) {
+    ldout(cct,10) << __func__ << " " << key << " = " << val
+		  << (find_other_option(key) ? " (not used by this daemon)" :
+		      " (unrecognized option)") << dendl;
+    return;
+  }
+  if (o->has_flag(Option::FLAG_NO_MON_UPDATE)) {
+    ignored_mon_values.emplace(key, val);
+    return;
+  }
+  std::string err;
+  int r = _set_val(values, tracker, val, *o, CONF_MON, &err);
+  if (r < 0) {
+    ldout(cct, 4) << __func__ << " failed to set " << key << " = "
+		  << val << ": " << err << dendl;
+    ignored_mon_values.emplace(key, val);
+  } else if (r == ConfigValues::SET_NO_CHANGE ||
+	     r == ConfigValues::SET_NO_EFFECT) {
+    ldout(cct,20) << __func__ << " " << key << " = " << val
+		  << " (no change)" << dendl;
+  } else if (r == ConfigValues::SET_HAVE_EFFECT) {
+    ldout(cct,10) << __func__ << " " << key << " = " << val << dendl;
+  } else {
+    ceph_abort();
+  }
+}
+
+void md_config_t::_rm_mon_val(CephContext *cct,
+			      ConfigValues& values,
+			      const std::string& key)
+{
+  auto [value, found] = values.get_value(key, CONF_MON);
+  if (!found) {
+    return;
+  }
+  ldout(cct,10) << __func__ << " " << key
+		<< " cleared (was " << Option::to_str(value) << ")"
+		<< dendl;
+  values.rm_val(key, CONF_MON);
+  // if this is a debug option, it needs to propagate to teh subsys;
+  // this isn't covered by update_legacy_vals() below.  similarly,
+  // we want to trigger a config notification for these items.
+  _refresh(values, *find_option(key));
+}
+
 int md_config_t::set_mon_vals(CephContext *cct,
     ConfigValues& values,
     const ConfigTracker& tracker,
     const map<string,string>& kv,
-    config_callback config_cb)
+    config_callback config_cb,
+    uint64_t epoch)
 {
   ignored_mon_values.clear();
 
@@ -262,57 +439,50 @@ int md_config_t::set_mon_vals(CephContext *cct,
   }
 
   for (auto& i : kv) {
-    if (config_cb) {
-      if (config_cb(i.first, i.second)) {
-	ldout(cct, 4) << __func__ << " callback consumed " << i.first << dendl;
-	continue;
-      }
-      ldout(cct, 4) << __func__ << " callback ignored " << i.first << dendl;
-    }
-    const Option *o = find_option(i.first);
-    if (!o) {
-      ldout(cct,10) << __func__ << " " << i.first << " = " << i.second
-		    << " (unrecognized option)" << dendl;
-      continue;
-    }
-    if (o->has_flag(Option::FLAG_NO_MON_UPDATE)) {
-      ignored_mon_values.emplace(i);
-      continue;
-    }
-    std::string err;
-    int r = _set_val(values, tracker, i.second, *o, CONF_MON, &err);
-    if (r < 0) {
-      ldout(cct, 4) << __func__ << " failed to set " << i.first << " = "
-		    << i.second << ": " << err << dendl;
-      ignored_mon_values.emplace(i);
-    } else if (r == ConfigValues::SET_NO_CHANGE ||
-	       r == ConfigValues::SET_NO_EFFECT) {
-      ldout(cct,20) << __func__ << " " << i.first << " = " << i.second
-		    << " (no change)" << dendl;
-    } else if (r == ConfigValues::SET_HAVE_EFFECT) {
-      ldout(cct,10) << __func__ << " " << i.first << " = " << i.second << dendl;
-    } else {
-      ceph_abort();
-    }
+    _set_mon_val(cct, values, tracker, i.first, i.second, config_cb);
   }
+  std::vector<std::string> stale;
   values.for_each([&] (auto name, auto configs) {
-    auto config = configs.find(CONF_MON);
-    if (config == configs.end()) {
-      return;
+    if (configs.count(CONF_MON) && kv.find(name) == kv.end()) {
+      stale.emplace_back(name);
     }
-    if (kv.find(name) != kv.end()) {
-      return;
-    }
-    ldout(cct,10) << __func__ << " " << name
-		  << " cleared (was " << Option::to_str(config->second) << ")"
-		  << dendl;
-    values.rm_val(name, CONF_MON);
-    // if this is a debug option, it needs to propagate to teh subsys;
-    // this isn't covered by update_legacy_vals() below.  similarly,
-    // we want to trigger a config notification for these items.
-    const Option *o = find_option(name);
-    _refresh(values, *o);
   });
+  for (auto& name : stale) {
+    _rm_mon_val(cct, values, name);
+  }
+  mon_vals_epoch = epoch;
+  values_bl.clear();
+  update_legacy_vals(values);
+  return 0;
+}
+
+int md_config_t::set_mon_vals_delta(CephContext *cct,
+    ConfigValues& values,
+    const ConfigTracker& tracker,
+    uint64_t prev_epoch,
+    uint64_t epoch,
+    const map<string,string>& changed,
+    const std::set<string>& removed,
+    config_callback config_cb)
+{
+  // 0 is no epoch at all: values set without one, or none yet, which a
+  // delta from 0 would otherwise be taken to apply to
+  if (prev_epoch == 0 || epoch == 0 || prev_epoch != mon_vals_epoch) {
+    ldout(cct, 4) << __func__ << " delta from " << prev_epoch
+		  << " but we have " << mon_vals_epoch << dendl;
+    return -ESTALE;
+  }
+  for (auto& key : removed) {
+    ignored_mon_values.erase(key);
+    if (find_option(key)) {
+      _rm_mon_val(cct, values, key);
+    }
+  }
+  for (auto& i : changed) {
+    ignored_mon_values.erase(i.first);
+    _set_mon_val(cct, values, tracker, i.first, i.second, config_cb);
+  }
+  mon_vals_epoch = epoch;
   values_bl.clear();
   update_legacy_vals(values);
   return 0;
@@ -322,6 +492,7 @@ int md_config_t::parse_config_files(ConfigValues& values, const ConfigTracker& t
                                     const char *conf_files_str, 
                                     std::ostream *warnings, int flags)
 {
+  ceph::startup_trace::phase trace("parse_config_files");
 
   if (safe_to_start_threads)
     return -ENOSYS;
@@ -360,21 +531,21 @@ int md_config_t::parse_config_files(ConfigValues& values, const ConfigTracker& t
     }
   }
 
-  // open new conf
+  // find the first that is there; it is parsed once we know whether the
+  // conf cache can stand in for it
+  cf.clear();
+  cf_deferred.clear();
+  conf_file_path.clear();
+  struct stat st;
   list<string>::const_iterator c;
   for (c = conf_files.begin(); c != conf_files.end(); ++c) {
-    cf.clear();
-    string fn = *c;
-
-    int ret = cf.parse_file(fn.c_str(), &parse_errors, warnings);
-    if (ret == 0)
+    if (::stat(c->c_str(), &st) == 0 || errno != ENOENT)
       break;
-    else if (ret != -ENOENT)
-      return ret;
   }
   // it must have been all ENOENTs, that's the only way we got here
   if (c == conf_files.end())
     return -ENOENT;
+  conf_file_path = *c;
 
   if (values.cluster.size() == 0) {
     /*
@@ -397,32 +568,53 @@ int md_config_t::parse_config_files(ConfigValues& values, const ConfigTracker& t
 
   std::vector <std::string> my_sections;
   _get_my_sections(values, my_sections);
-  for (const auto &i : schema) {
-    const auto &opt = i.second;
-    std::string val;
-    int ret = _get_val_from_conf_file(my_sections, opt.name, val);
-    if (ret == 0) {
-      std::string error_message;
-      int r = _set_val(values, tracker, val, opt, CONF_FILE, &error_message);
-      if (warnings != nullptr && (r < 0 || !error_message.empty())) {
-        *warnings << "parse error setting '" << opt.name << "' to '" << val
-                  << "'";
-        if (!error_message.empty()) {
-          *warnings << " (" << error_message << ")";
-        }
-        *warnings << std::endl;
+  std::deque < std::string > old_style_section_names;
+  const std::string cache_path = _get_conf_cache_path(values);
+  if (!cache_path.empty() &&
+      _load_conf_cache(values, tracker, cache_path, *c, st, my_sections,
+		       warnings, &old_style_section_names)) {
+    cf_deferred = *c;
+  } else {
+    // kept for the conf cache, which repeats them when it is used
+    ostringstream w;
+    int ret = cf.parse_file(c->c_str(), &parse_errors, &w);
+    if (ret < 0) {
+      if (warnings)
+	*warnings << w.str();
+      return ret;
+    }
+    for (const auto &i : schema) {
+      const Option &opt = i.second;
+      std::string val;
+      ret = _get_val_from_conf_file(my_sections, opt.name, val);
+      if (ret == 0) {
+	std::string error_message;
+	int r = _set_val(values, tracker, val, opt, CONF_FILE, &error_message);
+	if (r < 0 || !error_message.empty()) {
+	  w << "parse error setting '" << opt.name << "' to '" << val
+	    << "'";
+	  if (!error_message.empty()) {
+	    w << " (" << error_message << ")";
+	  }
+	  w << std::endl;
+	}
       }
     }
-  }
 
-  // Warn about section names that look like old-style section names
-  std::deque < std::string > old_style_section_names;
-  for (ConfFile::const_section_iter_t s = cf.sections_begin();
-       s != cf.sections_end(); ++s) {
-    const string &str(s->first);
-    if (((str.find("mds") == 0) || (str.find("mon") == 0) ||
-	       (str.find("osd") == 0)) && (str.size() > 3) && (str[3] != '.')) {
-      old_style_section_names.push_back(str);
+    // Warn about section names that look like old-style section names
+    for (ConfFile::const_section_iter_t s = cf.sections_begin();
+	 s != cf.sections_end(); ++s) {
+      const string &str(s->first);
+      if (((str.find("mds") == 0) || (str.find("mon") == 0) ||
+	   (str.find("osd") == 0)) && (str.size() > 3) && (str[3] != '.')) {
+	old_style_section_names.push_back(str);
+      }
+    }
+    if (warnings)
+      *warnings << w.str();
+    if (!cache_path.empty()) {
+      _save_conf_cache(values, cache_path, *c, st, my_sections, w.str(),
+		       old_style_section_names);
     }
   }
   if (!old_style_section_names.empty()) {
@@ -442,6 +634,364 @@ int md_config_t::parse_config_files(ConfigValues& values, const ConfigTracker& t
   return 0;
 }
 
+int md_config_t::reload_config_file(ConfigValues& values,
+				    const ConfigTracker& tracker,
+				    std::ostream *warnings)
+{
+  if (conf_file_path.empty()) {
+    return -ENOENT;
+  }
+  ConfFile newcf;
+  std::deque<std::string> errors;
+  ostringstream w;
+  int ret = newcf.parse_file(conf_file_path, &errors, &w);
+  if (ret < 0) {
+    if (warnings) {
+      *warnings << w.str();
+    }
+    return ret;
+  }
+  for (auto& e : errors) {
+    w << e << std::endl;
+  }
+
+  std::vector<std::string> my_sections;
+  _get_my_sections(values, my_sections);
+  auto read = [&my_sections, &newcf](const std::string& key,
+				     std::string *out) {
+    for (auto& s : my_sections) {
+      if (int r = newcf.read(s, key, *out); r != -ENOENT) {
+	return r == 0;
+      }
+    }
+    return false;
+  };
+  int changed = 0;
+  for (const auto &i : schema) {
+    const Option &opt = i.second;
+    const OptionId id = _id_of(opt);
+    auto [cur, in_use] = values.get_value(id, CONF_FILE);
+    std::string val;
+    const bool in_file = read(opt.name, &val);
+    if (!in_file && !in_use) {
+      continue;
+    }
+    Option::value_t new_value;
+    if (in_file) {
+      std::string error_message;
+      if (opt.parse_value(val, &new_value, &error_message) < 0) {
+	w << "parse error setting '" << opt.name << "' to '" << val << "'"
+	  << " (" << error_message << ")" << std::endl;
+	continue;
+      }
+      if (in_use && new_value == cur) {
+	continue;
+      }
+    }
+    if (!opt.can_update_at_runtime() && !tracker.is_tracking(opt.name)) {
+      w << "'" << opt.name << "' changed in " << conf_file_path
+	<< ", which takes a restart" << std::endl;
+      continue;
+    }
+    std::string error_message;
+    int r = in_file ?
+      _set_parsed_val(values, tracker, std::move(new_value), opt, CONF_FILE,
+		      &error_message) :
+      _rm_val(values, opt.name, CONF_FILE);
+    if (r < 0) {
+      w << "error setting '" << opt.name << "' to '" << val << "'";
+      if (!error_message.empty()) {
+	w << " (" << error_message << ")";
+      }
+      w << std::endl;
+      continue;
+    }
+    ++changed;
+  }
+  {
+    // for get_val_from_conf_file()
+    std::lock_guard l{cache_lock};
+    cf.swap(newcf);
+    cf_deferred.clear();
+  }
+  parse_errors = std::move(errors);
+  if (changed) {
+    update_legacy_vals(values);
+  }
+  if (warnings) {
+    *warnings << w.str();
+  }
+  return changed;
+}
+
+namespace {
+// bump when the layout below changes
+constexpr uint32_t CONF_CACHE_VERSION = 1;
+
+/// v, of opt's type, in the conf cache; the types without a plain
+/// encoding go as strings and are parsed back
+void encode_conf_value(const Option& opt, const Option::value_t& v,
+		       bufferlist& bl)
+{
+  switch (opt.type) {
+  case Option::TYPE_STR:
+    encode(boost::get<std::string>(v), bl); break;
+  case Option::TYPE_UINT:
+    encode(boost::get<uint64_t>(v), bl); break;
+  case Option::TYPE_INT:
+    encode(boost::get<int64_t>(v), bl); break;
+  case Option::TYPE_FLOAT:
+    encode(boost::get<double>(v), bl); break;
+  case Option::TYPE_BOOL:
+    encode(boost::get<bool>(v), bl); break;
+  case Option::TYPE_SIZE:
+    encode((uint64_t)boost::get<Option::size_t>(v).value, bl); break;
+  case Option::TYPE_SECS:
+    encode((int64_t)boost::get<std::chrono::seconds>(v).count(), bl); break;
+  case Option::TYPE_LOGLEVEL:
+    {
+      auto& l = boost::get<Option::log_level_t>(v);
+      encode((int32_t)l.log, bl);
+      encode((int32_t)l.gather, bl);
+    }
+    break;
+  default:
+    encode(Option::to_str(v), bl); break;
+  }
+}
+
+/// false if what was encoded doesn't parse as opt's type any more
+bool decode_conf_value(const Option& opt, Option::value_t *v,
+		       bufferlist::const_iterator& p)
+{
+  switch (opt.type) {
+  case Option::TYPE_STR:
+    {
+      std::string s;
+      decode(s, p);
+      *v = std::move(s);
+    }
+    return true;
+  case Option::TYPE_UINT:
+    {
+      uint64_t n;
+      decode(n, p);
+      *v = n;
+    }
+    return true;
+  case Option::TYPE_INT:
+    {
+      int64_t n;
+      decode(n, p);
+      *v = n;
+    }
+    return true;
+  case Option::TYPE_FLOAT:
+    {
+      double d;
+      decode(d, p);
+      *v = d;
+    }
+    return true;
+  case Option::TYPE_BOOL:
+    {
+      bool b;
+      decode(b, p);
+      *v = b;
+    }
+    return true;
+  case Option::TYPE_SIZE:
+    {
+      uint64_t n;
+      decode(n, p);
+      *v = Option::size_t{static_cast<std::size_t>(n)};
+    }
+    return true;
+  case Option::TYPE_SECS:
+    {
+      int64_t n;
+      decode(n, p);
+      *v = std::chrono::seconds{n};
+    }
+    return true;
+  case Option::TYPE_LOGLEVEL:
+    {
+      int32_t log, gather;
+      decode(log, p);
+      decode(gather, p);
+      *v = Option::log_level_t{log, gather};
+    }
+    return true;
+  default:
+    {
+      std::string s, err;
+      decode(s, p);
+      return opt.parse_value(s, v, &err) == 0;
+    }
+  }
+}
+
+/// what the conf cache is only good for
+void encode_conf_cache_key(uint64_t schema_fingerprint,
+			   bool is_daemon,
+			   const ConfigValues& values,
+			   const std::string& conf_file,
+			   const struct stat& st,
+			   const std::vector<std::string>& my_sections,
+			   bufferlist& bl)
+{
+  encode(CONF_CACHE_VERSION, bl);
+  encode(schema_fingerprint, bl);
+  encode(is_daemon, bl);
+  encode(values.name.to_str(), bl);
+  encode(values.cluster, bl);
+  encode(my_sections, bl);
+  encode(conf_file, bl);
+  encode((uint64_t)st.st_dev, bl);
+  encode((uint64_t)st.st_ino, bl);
+  encode((uint64_t)st.st_size, bl);
+  encode((int64_t)st.st_mtim.tv_sec, bl);
+  encode((int64_t)st.st_mtim.tv_nsec, bl);
+}
+} // anonymous namespace
+
+std::string md_config_t::_get_conf_cache_path(const ConfigValues& values) const
+{
+  std::string path;
+  conf_stringify(_get_val(values, "conf_cache_file"), &path);
+  return path;
+}
+
+uint64_t md_config_t::_schema_fingerprint() const
+{
+  // enough to tell a cache from another build, whose options (and so
+  // OptionIds and types) may differ
+  uint64_t h = schema.size();
+  for (const auto &i : schema) {
+    const Option &opt = i.second;
+    h = h * 31 + std::hash<std::string_view>{}(i.first) + opt.type;
+  }
+  return h;
+}
+
+bool md_config_t::_load_conf_cache(ConfigValues& values,
+				   const ConfigTracker& tracker,
+				   const std::string& cache_path,
+				   const std::string& conf_file,
+				   const struct stat& st,
+				   const std::vector<std::string>& my_sections,
+				   std::ostream *warnings,
+				   std::deque<std::string> *old_style_section_names)
+{
+  bufferlist bl;
+  std::string err;
+  if (bl.read_file(cache_path.c_str(), &err) < 0) {
+    return false;
+  }
+  bufferlist key;
+  encode_conf_cache_key(_schema_fingerprint(), is_daemon, values, conf_file,
+			st, my_sections, key);
+  if (bl.length() < key.length()) {
+    return false;
+  }
+  bufferlist cached_key;
+  cached_key.substr_of(bl, 0, key.length());
+  if (!cached_key.contents_equal(key)) {
+    return false;
+  }
+
+  // decode all of it before applying any
+  std::vector<std::pair<const Option*, Option::value_t>> file_values;
+  std::vector<std::string> errors, old_style;
+  std::string cached_warnings;
+  try {
+    auto p = bl.cbegin();
+    p += key.length();
+    decode(errors, p);
+    decode(cached_warnings, p);
+    decode(old_style, p);
+    uint32_t n;
+    decode(n, p);
+    file_values.reserve(n);
+    while (n--) {
+      std::string name;
+      decode(name, p);
+      const Option *o = find_option(name);
+      if (!o) {
+	return false;
+      }
+      Option::value_t v;
+      if (!decode_conf_value(*o, &v, p)) {
+	return false;
+      }
+      file_values.emplace_back(o, std::move(v));
+    }
+  } catch (const buffer::error&) {
+    return false;
+  }
+
+  parse_errors.assign(errors.begin(), errors.end());
+  if (warnings) {
+    *warnings << cached_warnings;
+  }
+  old_style_section_names->assign(old_style.begin(), old_style.end());
+  for (auto& [o, v] : file_values) {
+    _set_parsed_val(values, tracker, std::move(v), *o, CONF_FILE, &err);
+  }
+  return true;
+}
+
+void md_config_t::_save_conf_cache(
+  const ConfigValues& values,
+  const std::string& cache_path,
+  const std::string& conf_file,
+  const struct stat& st,
+  const std::vector<std::string>& my_sections,
+  const std::string& warnings,
+  const std::deque<std::string>& old_style_section_names) const
+{
+  bufferlist bl;
+  encode_conf_cache_key(_schema_fingerprint(), is_daemon, values, conf_file,
+			st, my_sections, bl);
+  encode(std::vector<std::string>(parse_errors.begin(), parse_errors.end()), bl);
+  encode(warnings, bl);
+  encode(std::vector<std::string>(old_style_section_names.begin(),
+				  old_style_section_names.end()), bl);
+  bufferlist vals;
+  uint32_t n = 0;
+  for (std::size_t id = 0; id < schema.size(); ++id) {
+    const Option &opt = schema.nth(id)->second;
+    auto [value, found] = values.get_value(static_cast<OptionId>(id), CONF_FILE);
+    if (found) {
+      encode(opt.name, vals);
+      encode_conf_value(opt, value, vals);
+      ++n;
+    }
+  }
+  encode(n, bl);
+  bl.claim_append(vals);
+
+  // so that no one reads half of it
+  const std::string tmp = cache_path + ".tmp";
+  if (bl.write_file(tmp.c_str(), 0600) < 0 ||
+      ::rename(tmp.c_str(), cache_path.c_str()) < 0) {
+    ::unlink(tmp.c_str());
+  }
+}
+
+const ConfFile& md_config_t::_get_cf() const
+{
+  std::lock_guard l{cache_lock};
+  if (!cf_deferred.empty()) {
+    // already parsed once, when the cache was made; these errors and
+    // warnings were reported then, and again when it was read
+    std::deque<std::string> errors;
+    cf.parse_file(cf_deferred, &errors, nullptr);
+    cf_deferred.clear();
+  }
+  return cf;
+}
+
 void md_config_t::parse_env(unsigned entity_type,
 			    ConfigValues& values,
 			    const ConfigTracker& tracker,
@@ -558,6 +1108,46 @@ void md_config_t::parse_env(unsigned entity_type,
   }
 }
 
+void md_config_t::set_resource_defaults(ConfigValues& values,
+					const ConfigTracker& tracker)
+{
+  if (safe_to_start_threads || !get_val<bool>(values, "log_auto_size")) {
+    return;
+  }
+  const auto limits = ceph::get_resource_limits();
+  // the defaults suit a host with 8G and 8 cpus
+  auto ratio = [](double have, double ref) {
+    return have > 0 ? std::clamp(have / ref, 1.0 / 16, 4.0) : 1.0;
+  };
+  const double mem = ratio(limits.memory, 8ull << 30);
+  const double cpu = ratio(limits.cpus, 8);
+  auto scale = [&](const char *name, double f, uint64_t min) {
+    const Option *o = find_option(name);
+    ceph_assert(o);
+    // the caller's (or common_preinit's) default wins
+    if (values.get_value(name, CONF_DEFAULT).second) {
+      return;
+    }
+    const Option::value_t& def = _get_val_default(*o);
+    uint64_t v;
+    if (auto p = boost::get<int64_t>(&def)) {
+      v = *p;
+    } else if (auto p = boost::get<uint64_t>(&def)) {
+      v = *p;
+    } else {
+      v = boost::get<Option::size_t>(def).value;
+    }
+    set_val_default(values, tracker, name,
+		    stringify(std::max<uint64_t>(v * f, min)));
+  };
+  scale("log_max_recent", mem, 100);
+  scale("log_max_recent_bytes", mem, 1 << 20);
+  scale("log_max_new_bytes", mem, 512 << 10);
+  scale("log_stream_cache_size", std::min(mem, 1.0), 64);
+  scale("log_max_new", cpu, 100);
+  scale("log_buffer_size", std::min(cpu, mem), 16 << 10);
+}
+
 void md_config_t::show_config(const ConfigValues& values, std::ostream& out) const
 {
   _show_config(values, &out, nullptr);
@@ -572,7 +1162,7 @@ void md_config_t::config_options(Formatter *f) const
 {
   f->open_array_section("options");
   for (const auto& i: schema) {
-    f->dump_object("option", i.second);
+    f->dump_object("option", i.second.get());
   }
   f->close_section();
 }
@@ -603,6 +1193,7 @@ void md_config_t::_show_config(const ConfigValues& values, std::ostream *out, Fo
 int md_config_t::parse_argv(ConfigValues& values, const ConfigTracker& tracker,
 			                      std::vector<const char*>& args, int level)
 {
+  ceph::startup_trace::phase trace("parse_argv");
   if (safe_to_start_threads) {
     return -ENOSYS;
   }
@@ -610,7 +1201,30 @@ int md_config_t::parse_argv(ConfigValues& values, const ConfigTracker& tracker,
   // In this function, don't change any parts of the configuration directly.
   // Instead, use set_val to set them. This will allow us to send the proper
   // observer notifications later.
-  std::string val;
+  enum {
+    ARG_SHOW_CONF, ARG_SHOW_CONFIG, ARG_SHOW_CONFIG_VALUE, ARG_NO_MON_CONFIG,
+    ARG_MON_CONFIG, ARG_FOREGROUND, ARG_DEBUG, ARG_MONMAP, ARG_MON_HOST,
+    ARG_BIND, ARG_KEYFILE, ARG_KEYRING, ARG_CLIENT_MOUNTPOINT,
+  };
+  static const ceph::arg_table argv_args{
+    {ARG_SHOW_CONF, ceph::arg_table::FLAG, {"--show_conf"}},
+    {ARG_SHOW_CONFIG, ceph::arg_table::FLAG, {"--show_config"}},
+    {ARG_SHOW_CONFIG_VALUE, ceph::arg_table::WITHARG, {"--show_config_value"}},
+    {ARG_NO_MON_CONFIG, ceph::arg_table::FLAG, {"--no-mon-config"}},
+    {ARG_MON_CONFIG, ceph::arg_table::FLAG, {"--mon-config"}},
+    {ARG_FOREGROUND, ceph::arg_table::FLAG, {"--foreground", "-f"}},
+    {ARG_DEBUG, ceph::arg_table::FLAG, {"-d"}},
+    // Some stuff that we wanted to give universal single-character options
+    // for.  Careful: you can burn through the alphabet pretty quickly by
+    // adding to this list.
+    {ARG_MONMAP, ceph::arg_table::WITHARG, {"--monmap", "-M"}},
+    {ARG_MON_HOST, ceph::arg_table::WITHARG, {"--mon_host", "-m"}},
+    {ARG_BIND, ceph::arg_table::WITHARG, {"--bind"}},
+    {ARG_KEYFILE, ceph::arg_table::WITHARG, {"--keyfile", "-K"}},
+    {ARG_KEYRING, ceph::arg_table::WITHARG, {"--keyring", "-k"}},
+    {ARG_CLIENT_MOUNTPOINT, ceph::arg_table::WITHARG,
+     {"--client_mountpoint", "-r"}},
+  };
   for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
     if (strcmp(*i, "--") == 0) {
       /* Normally we would use ceph_argparse_double_dash. However, in this
@@ -618,69 +1232,75 @@ int md_config_t::parse_argv(ConfigValues& values, const ConfigTracker& tracker,
        * argument parses will still need to see it. */
       break;
     }
-    else if (ceph_argparse_flag(args, i, "--show_conf", (char*)NULL)) {
+    auto m = argv_args.parse(args, i, cerr);
+    if (m.r < 0) {
+      _exit(1);
+    }
+    const std::string& val = m.val;
+    switch (m.id) {
+    case ARG_SHOW_CONF:
       cerr << cf << std::endl;
       _exit(0);
-    }
-    else if (ceph_argparse_flag(args, i, "--show_config", (char*)NULL)) {
+    case ARG_SHOW_CONFIG:
       do_show_config = true;
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--show_config_value", (char*)NULL)) {
+      break;
+    case ARG_SHOW_CONFIG_VALUE:
       do_show_config_value = val;
-    }
-    else if (ceph_argparse_flag(args, i, "--no-mon-config", (char*)NULL)) {
+      break;
+    case ARG_NO_MON_CONFIG:
       values.no_mon_config = true;
-    }
-    else if (ceph_argparse_flag(args, i, "--mon-config", (char*)NULL)) {
+      break;
+    case ARG_MON_CONFIG:
       values.no_mon_config = false;
-    }
-    else if (ceph_argparse_flag(args, i, "--foreground", "-f", (char*)NULL)) {
+      break;
+    case ARG_FOREGROUND:
       set_val_or_die(values, tracker, "daemonize", "false");
-    }
-    else if (ceph_argparse_flag(args, i, "-d", (char*)NULL)) {
+      break;
+    case ARG_DEBUG:
       set_val_or_die(values, tracker, "fuse_debug", "true");
       set_val_or_die(values, tracker, "daemonize", "false");
       set_val_or_die(values, tracker, "log_file", "");
       set_val_or_die(values, tracker, "log_to_stderr", "true");
       set_val_or_die(values, tracker, "err_to_stderr", "true");
       set_val_or_die(values, tracker, "log_to_syslog", "false");
-    }
-    // Some stuff that we wanted to give universal single-character options for
-    // Careful: you can burn through the alphabet pretty quickly by adding
-    // to this list.
-    else if (ceph_argparse_witharg(args, i, &val, "--monmap", "-M", (char*)NULL)) {
+      break;
+    case ARG_MONMAP:
       set_val_or_die(values, tracker, "monmap", val.c_str());
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--mon_host", "-m", (char*)NULL)) {
+      break;
+    case ARG_MON_HOST:
       set_val_or_die(values, tracker, "mon_host", val.c_str());
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--bind", (char*)NULL)) {
+      break;
+    case ARG_BIND:
       set_val_or_die(values, tracker, "public_addr", val.c_str());
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--keyfile", "-K", (char*)NULL)) {
-      bufferlist bl;
-      string err;
-      int r;
-      if (val == "-") {
-	r = bl.read_fd(STDIN_FILENO, 1024);
-      } else {
-	r = bl.read_file(val.c_str(), &err);
-      }
-      if (r >= 0) {
-	string k(bl.c_str(), bl.length());
-	set_val_or_die(values, tracker, "key", k.c_str());
+      break;
+    case ARG_KEYFILE:
+      {
+	bufferlist bl;
+	string err;
+	int r;
+	if (val == "-") {
+	  r = bl.read_fd(STDIN_FILENO, 1024);
+	} else {
+	  r = bl.read_file(val.c_str(), &err);
+	}
+	if (r >= 0) {
+	  string k(bl.c_str(), bl.length());
+	  set_val_or_die(values, tracker, "key", k.c_str());
+	}
       }
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--keyring", "-k", (char*)NULL)) {
+      break;
+    case ARG_KEYRING:
       set_val_or_die(values, tracker, "keyring", val.c_str());
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--client_mountpoint", "-r", (char*)NULL)) {
+      break;
+    case ARG_CLIENT_MOUNTPOINT:
       set_val_or_die(values, tracker, "client_mountpoint", val.c_str());
-    }
-    else {
-      int r = parse_option(values, tracker, args, i, NULL, level);
-      if (r < 0) {
-        return r;
+      break;
+    default:
+      {
+	int r = parse_option(values, tracker, args, i, NULL, level);
+	if (r < 0) {
+	  return r;
+	}
       }
     }
   }
@@ -724,58 +1344,88 @@ int md_config_t::parse_option(ConfigValues& values,
 			      int level)
 {
   int ret = 0;
-  size_t o = 0;
+  bool matched = false;
   std::string val;
 
   std::string option_name;
   std::string error_message;
-  o = 0;
-  for (const auto& opt_iter: schema) {
-    const Option &opt = opt_iter.second;
+
+  // Normalize the token once ("--osd-foo=1" -> "osd_foo") and look that up
+  // rather than trying every option in the schema against it.  The
+  // ceph_argparse helpers still do the matching and consume the args.
+  std::string name;
+  if (strncmp(*i, "--", 2) == 0) {
+    name = *i + 2;
+    name.resize(std::min(name.find('='), name.size()));
+    std::replace(name.begin(), name.end(), '-', '_');
+  }
+  auto witharg = [&](const Option& opt, const std::string& as_option,
+		     int set_level) {
     ostringstream err;
-    std::string as_option("--");
-    as_option += opt.name;
-    option_name = opt.name;
-    if (ceph_argparse_witharg(
-	  args, i, &val, err,
-	  string(string("--default-") + opt.name).c_str(), (char*)NULL)) {
-      if (!err.str().empty()) {
-        error_message = err.str();
-	ret = -EINVAL;
-	break;
-      }
-      ret = _set_val(values, tracker,  val, opt, CONF_DEFAULT, &error_message);
-      break;
-    } else if (opt.type == Option::TYPE_BOOL) {
+    if (!ceph_argparse_witharg(args, i, &val, err, as_option.c_str(),
+			       (char*)NULL)) {
+      return false;
+    }
+    if (!err.str().empty()) {
+      error_message = err.str();
+      ret = -EINVAL;
+    } else {
+      ret = _set_val(values, tracker, val, opt, set_level, &error_message);
+    }
+    return true;
+  };
+
+  const Option *opt = nullptr;
+  if (name.compare(0, 8, "default_") == 0 &&
+      (opt = find_option(name.substr(8)))) {
+    option_name = opt->name;
+    matched = witharg(*opt, "--default-" + opt->name, CONF_DEFAULT);
+  }
+  if (!matched && (opt = find_option(name))) {
+    option_name = opt->name;
+    if (opt->type == Option::TYPE_BOOL) {
       int res;
+      std::string as_option("--");
+      as_option += opt->name;
       if (ceph_argparse_binary_flag(args, i, &res, oss, as_option.c_str(),
 				    (char*)NULL)) {
+	matched = true;
 	if (res == 0)
-	  ret = _set_val(values, tracker, "false", opt, level, &error_message);
+	  ret = _set_val(values, tracker, "false", *opt, level, &error_message);
 	else if (res == 1)
-	  ret = _set_val(values, tracker, "true", opt, level, &error_message);
+	  ret = _set_val(values, tracker, "true", *opt, level, &error_message);
 	else
 	  ret = res;
-	break;
-      } else {
-	std::string no("--no-");
-	no += opt.name;
-	if (ceph_argparse_flag(args, i, no.c_str(), (char*)NULL)) {
-	  ret = _set_val(values, tracker, "false", opt, level, &error_message);
-	  break;
-	}
-      }
-    } else if (ceph_argparse_witharg(args, i, &val, err,
-                                     as_option.c_str(), (char*)NULL)) {
-      if (!err.str().empty()) {
-        error_message = err.str();
-	ret = -EINVAL;
-	break;
       }
-      ret = _set_val(values, tracker,  val, opt, level, &error_message);
-      break;
+    } else {
+      matched = witharg(*opt, "--" + opt->name, level);
+    }
+  }
+  if (!matched && name.compare(0, 3, "no_") == 0 &&
+      (opt = find_option(name.substr(3))) &&
+      opt->type == Option::TYPE_BOOL) {
+    option_name = opt->name;
+    std::string no("--no-");
+    no += opt->name;
+    if (ceph_argparse_flag(args, i, no.c_str(), (char*)NULL)) {
+      matched = true;
+      ret = _set_val(values, tracker, "false", *opt, level, &error_message);
+    }
+  }
+  if (const group_option_t *other;
+      !matched && !name.empty() && (other = find_other_option(name))) {
+    // take it, and its argument, as if it were set
+    std::string as_option("--");
+    as_option += other->name;
+    if (other->type == Option::TYPE_BOOL) {
+      int res;
+      matched = ceph_argparse_binary_flag(args, i, &res, oss,
+					  as_option.c_str(), (char*)NULL);
+    } else {
+      ostringstream err;
+      matched = ceph_argparse_witharg(args, i, &val, err, as_option.c_str(),
+				      (char*)NULL);
     }
-    ++o;
   }
 
   if (ret < 0 || !error_message.empty()) {
@@ -797,7 +1447,7 @@ int md_config_t::parse_option(ConfigValues& values,
     }
   }
 
-  if (o == schema.size()) {
+  if (!matched) {
     // ignore
     ++i;
   }
@@ -905,6 +1555,11 @@ int md_config_t::set_val(ConfigValues& values,
     return r;
   }
 
+  if (find_other_option(k)) {
+    if (err_ss) *err_ss << "Ignored " << k << ", which this daemon does not use";
+    return 0;
+  }
+
   if (err_ss) *err_ss << "Configuration option not found: '" << key << "'";
   return -ENOENT;
 }
@@ -922,8 +1577,9 @@ void md_config_t::get_defaults_bl(const ConfigValues& values,
     bufferlist bl;
     for (const auto &i : schema) {
       ++n;
-      encode(i.second.name, bl);
-      auto [value, found] = values.get_value(i.second.name, CONF_DEFAULT);
+      const Option& opt = i.second;
+      encode(opt.name, bl);
+      auto [value, found] = values.get_value(_id_of(opt), CONF_DEFAULT);
       if (found) {
 	encode(Option::to_str(value), bl);
       } else {
@@ -945,21 +1601,26 @@ void md_config_t::get_config_bl(
   uint64_t *got_version)
 {
   if (values_bl.length() == 0) {
+    // the journal says which options changed, unless it was too long ago
+    if (values_frags.empty() ||
+	!values.for_each_changed_since(values_frags_version, [&](OptionId id) {
+	  _encode_values_frag(values, id);
+	})) {
+      values_frags.assign(schema.size(), bufferlist());
+      for (size_t id = 0; id < schema.size(); ++id) {
+	_encode_values_frag(values, static_cast<OptionId>(id));
+      }
+    }
+    values_frags_version = values.get_version();
+
     uint32_t n = 0;
     bufferlist bl;
-    values.for_each([&](auto& name, auto& configs) {
-      if (name == "fsid" ||
-	  name == "host") {
-	return;
+    for (auto& frag : values_frags) {
+      if (frag.length()) {
+	++n;
+	bl.append(frag);
       }
-      ++n;
-      encode(name, bl);
-      encode((uint32_t)configs.size(), bl);
-      for (auto& j : configs) {
-	encode(j.first, bl);
-	encode(Option::to_str(j.second), bl);
-      }
-    });
+    }
     // make sure overridden items appear, and include the default value
     for (auto& i : ignored_mon_values) {
       if (values.contains(i.first)) {
@@ -992,6 +1653,26 @@ void md_config_t::get_config_bl(
   }
 }
 
+void md_config_t::_encode_values_frag(const ConfigValues& values, OptionId id)
+{
+  const size_t i = static_cast<size_t>(id);
+  auto& frag = values_frags[i];
+  frag.clear();
+  const Option& opt = schema.nth(i)->second;
+  auto& configs = values._levels(i);
+  if (configs.empty() ||
+      opt.name == "fsid" ||
+      opt.name == "host") {
+    return;
+  }
+  encode(opt.name, frag);
+  encode((uint32_t)configs.size(), frag);
+  for (auto& j : configs) {
+    encode(j.first, frag);
+    encode(Option::to_str(j.second.get()), frag);
+  }
+}
+
 int md_config_t::get_val(const ConfigValues& values,
 			 const std::string &key, char **buf, int len) const
 {
@@ -1015,6 +1696,29 @@ Option::value_t md_config_t::get_val_generic(
   return _get_val(values, k);
 }
 
+OptionId md_config_t::_id_of(const Option& o) const
+{
+  const auto& options = compiled_options;
+  if (&o >= options.data() && &o < options.data() + options.size()) {
+    return compiled_ids[&o - options.data()];
+  }
+  if (&o >= subsys_options.data() &&
+      &o < subsys_options.data() + subsys_options.size()) {
+    return subsys_ids[&o - subsys_options.data()];
+  }
+  return get_option_id(o.name);
+}
+
+void md_config_t::get_vals_by_id(const ConfigValues& values,
+				 std::vector<Option::value_t> *out) const
+{
+  out->clear();
+  out->reserve(schema.size());
+  for (const auto& i : schema) {
+    out->push_back(_get_val(values, i.second.get()));
+  }
+}
+
 Option::value_t md_config_t::_get_val(
   const ConfigValues& values,
   const std::string &key,
@@ -1044,18 +1748,50 @@ Option::value_t md_config_t::_get_val(
   std::ostream *err) const
 {
   expand_stack_t a_stack;
-  if (!stack) {
-    stack = &a_stack;
+  if (stack) {
+    // part of expanding another option; the result depends on the stack
+    return _expand_meta(values, _get_val_nometa(values, o), &o, stack, err);
+  }
+  const OptionId id = o.type == Option::TYPE_STR && !err ? _id_of(o)
+							  : OptionId::NONE;
+  if (id == OptionId::NONE) {
+    return _expand_meta(values, _get_val_nometa(values, o), &o, &a_stack, err);
+  }
+
+  const uint64_t version = values.get_version();
+  {
+    std::lock_guard l{cache_lock};
+    if (values.name != expand_name || values.cluster != expand_cluster ||
+	data_dir_option != expand_data_dir) {
+      expand_cache.clear();
+      expand_name = values.name;
+      expand_cluster = values.cluster;
+      expand_data_dir = data_dir_option;
+    }
+    if (expand_cache.empty()) {
+      expand_cache.resize(schema.size());
+    }
+    auto& e = expand_cache[static_cast<size_t>(id)];
+    if (e.version == version) {
+      return e.value;
+    }
+  }
+  // expanding reads other options, so not under cache_lock
+  Option::value_t value = _expand_meta(values, _get_val_nometa(values, o),
+				       &o, &a_stack, nullptr);
+  std::lock_guard l{cache_lock};
+  if (!expand_cache.empty()) {
+    auto& e = expand_cache[static_cast<size_t>(id)];
+    e.value = value;
+    e.version = version;
   }
-  return _expand_meta(values,
-		      _get_val_nometa(values, o),
-		      &o, stack, err);
+  return value;
 }
 
 Option::value_t md_config_t::_get_val_nometa(const ConfigValues& values,
 					     const Option& o) const
 {
-  if (auto [value, found] = values.get_value(o.name, -1); found) {
+  if (auto [value, found] = values.get_value(_id_of(o), -1); found) {
     return value;
   } else {
     return _get_val_default(o);
@@ -1085,6 +1821,8 @@ bool md_config_t::finalize_reexpand_meta(ConfigValues& values,
 {
   std::vector<std::string> reexpands;
   reexpands.swap(may_reexpand_meta);
+  // e.g. $pid may be different now
+  expand_cache.clear();
   for (auto& name : reexpands) {
     // always refresh the options if they are in the may_reexpand_meta
     // map, because the options may have already been expanded with old
@@ -1129,7 +1867,7 @@ Option::value_t md_config_t::_expand_meta(
   while (pos != std::string::npos) {
     ceph_assert((*str)[pos] == '$');
     if (pos > last_pos) {
-      out += str->substr(last_pos, pos - last_pos);
+      out.append(*str, last_pos, pos - last_pos);
     }
 
     // try to parse the variable name into var, either \$\{(.+)\} or
@@ -1164,7 +1902,7 @@ Option::value_t md_config_t::_expand_meta(
       } else if (var == "cluster") {
 	      out += values.cluster;
       } else if (var == "name") {
-	      out += values.name.to_cstr();
+	      out += values.name.to_str();
       } else if (var == "host") {
 	      if (values.host == "") {
 	        out += ceph_get_short_hostname();
@@ -1172,12 +1910,13 @@ Option::value_t md_config_t::_expand_meta(
 	      out += values.host;
 	    }
       } else if (var == "num") {
-	      out += values.name.get_id().c_str();
+	      out += values.name.get_id();
       } else if (var == "id") {
 	      out += values.name.get_id();
       } else if (var == "pid") {
 	      out += stringify(getpid());
         if (o) {
+          std::lock_guard l{cache_lock};
           may_reexpand_meta.push_back(o->name);
         }
       } else if (var == "cctid") {
@@ -1191,7 +1930,7 @@ Option::value_t md_config_t::_expand_meta(
 	      }
 	      const Option *o = find_option(var);
 	      if (!o) {
-          out += str->substr(pos, endpos - pos);
+          out.append(*str, pos, endpos - pos);
         } else {
           auto match = std::find_if(stack->begin(), stack->end(),
             [o](pair<const Option *,const Option::value_t*>& item) {
@@ -1219,13 +1958,13 @@ Option::value_t md_config_t::_expand_meta(
     pos = str->find('$', last_pos);
   }
   if (last_pos != std::string::npos) {
-    out += str->substr(last_pos);
+    out.append(*str, last_pos);
   }
   if (o) {
     stack->pop_back();
   }
 
-  return Option::value_t(out);
+  return Option::value_t(std::move(out));
 }
 
 int md_config_t::_get_val_cstr(
@@ -1293,7 +2032,8 @@ void md_config_t::_get_my_sections(const ConfigValues& values,
 // Return a list of all sections
 int md_config_t::get_all_sections(std::vector <std::string> &sections) const
 {
-  for (ConfFile::const_section_iter_t s = cf.sections_begin(); s != cf.sections_end(); ++s) {
+  const ConfFile& conf = _get_cf();
+  for (ConfFile::const_section_iter_t s = conf.sections_begin(); s != conf.sections_end(); ++s) {
     sections.push_back(s->first);
   }
   return 0;
@@ -1323,10 +2063,11 @@ int md_config_t::_get_val_from_conf_file(
   const std::string &key,
   std::string &out) const
 {
+  const ConfFile& conf = _get_cf();
   std::vector <std::string>::const_iterator s = sections.begin();
   std::vector <std::string>::const_iterator s_end = sections.end();
   for (; s != s_end; ++s) {
-    int ret = cf.read(s->c_str(), key, out);
+    int ret = conf.read(*s, key, out);
     if (ret == 0) {
       return 0;
     } else if (ret != -ENOENT) {
@@ -1350,7 +2091,18 @@ int md_config_t::_set_val(
   if (r < 0) {
     return r;
   }
+  return _set_parsed_val(values, observers, std::move(new_value), opt, level,
+			 error_message);
+}
 
+int md_config_t::_set_parsed_val(
+  ConfigValues& values,
+  const ConfigTracker& observers,
+  Option::value_t&& new_value,
+  const Option &opt,
+  int level,
+  std::string *error_message)
+{
   // unsafe runtime change?
   if (!opt.can_update_at_runtime() &&
       safe_to_start_threads &&
@@ -1364,7 +2116,7 @@ int md_config_t::_set_val(
   }
 
   // Apply the value to its entry in the `values` map
-  auto result = values.set_value(opt.name, std::move(new_value), level);
+  auto result = values.set_value(_id_of(opt), std::move(new_value), level);
   switch (result) {
   case ConfigValues::SET_NO_CHANGE:
     break;
@@ -1382,18 +2134,25 @@ int md_config_t::_set_val(
 void md_config_t::_refresh(ConfigValues& values, const Option& opt)
 {
   // Apply the value to its legacy field, if it has one
-  auto legacy_ptr_iter = legacy_values.find(std::string(opt.name));
+  auto legacy_ptr_iter = legacy_values.find(opt.name);
   if (legacy_ptr_iter != legacy_values.end()) {
     update_legacy_val(values, opt, legacy_ptr_iter->second);
   }
   // Was this a debug_* option update?
   if (opt.subsys >= 0) {
+    values.set_logging(opt.subsys,
+		       boost::get<Option::log_level_t>(_get_val_nometa(values, opt)));
+  } else if (opt.subsys_rate >= 0) {
+    string actual_val;
+    conf_stringify(_get_val(values, opt), &actual_val);
+    values.set_log_rate(opt.subsys_rate, actual_val.c_str());
+  } else if (opt.subsys_sample >= 0) {
     string actual_val;
     conf_stringify(_get_val(values, opt), &actual_val);
-    values.set_logging(opt.subsys, actual_val.c_str());
+    values.set_log_sample(opt.subsys_sample, actual_val.c_str());
   } else {
     // normal option, advertise the change.
-    values.changed.insert(opt.name);
+    values.changed.insert(_id_of(opt));
   }
 }
 
@@ -1471,11 +2230,40 @@ class assign_visitor : public boost::static_visitor<>
 
 void md_config_t::update_legacy_vals(ConfigValues& values)
 {
-  for (const auto &i : legacy_values) {
-    const auto &name = i.first;
-    const auto &option = schema.at(name);
-    auto ptr = i.second;
-    update_legacy_val(values, option, ptr);
+  // copy out only what changed since last time, unless the journal has
+  // lost track of that, and then whatever has a metavariable in it
+  bool tracked = legacy_version &&
+    values.for_each_changed_since(legacy_version, [&](OptionId id) {
+      const auto name = schema.nth(static_cast<size_t>(id))->first;
+      if (auto p = legacy_values.find(name); p != legacy_values.end()) {
+	_legacy_changed(values, name, p->second);
+      }
+    });
+  if (!tracked) {
+    legacy_meta.clear();
+    for (const auto &i : legacy_values) {
+      _legacy_changed(values, i.first, i.second);
+    }
+  }
+  for (const auto &i : legacy_meta) {
+    update_legacy_val(values, schema.at(i.first), i.second);
+  }
+  legacy_version = values.get_version();
+}
+
+void md_config_t::_legacy_changed(ConfigValues& values,
+				  std::string_view name,
+				  md_config_t::member_ptr_t member_ptr)
+{
+  const Option &opt = schema.at(name);
+  Option::value_t v = _get_val_nometa(values, opt);
+  if (auto s = boost::get<std::string>(&v);
+      s && s->find('$') != std::string::npos) {
+    // copied out with the rest of legacy_meta
+    legacy_meta.emplace(name, member_ptr);
+  } else {
+    legacy_meta.erase(name);
+    update_legacy_val(values, opt, member_ptr);
   }
 }
 
@@ -1525,6 +2313,84 @@ void md_config_t::diff(
   });
 }
 
+/// an Option's own memory; its lists of literals are shared
+static std::size_t option_bytes(const Option& o)
+{
+  const std::size_t sso = std::string().capacity();
+  std::size_t n = sizeof(Option);
+  if (o.name.capacity() > sso) {
+    n += o.name.capacity() + 1;
+  }
+  for (auto v : {&o.value, &o.daemon_value}) {
+    if (auto s = boost::get<std::string>(v); s && s->capacity() > sso) {
+      n += s->capacity() + 1;
+    }
+  }
+  return n;
+}
+
+void md_config_t::dump_memory_usage(const ConfigValues& values,
+				    Formatter *f) const
+{
+  f->open_object_section("schema");
+  f->dump_unsigned("options", schema.size());
+  f->dump_unsigned("bytes", schema.capacity() * sizeof(schema_t::value_type) +
+		   compiled_ids.capacity() * sizeof(OptionId) +
+		   subsys_ids.capacity() * sizeof(OptionId));
+  f->close_section();
+
+  std::size_t n = 0;
+  for (auto& o : compiled_options) {
+    n += option_bytes(o);
+  }
+  f->open_object_section("compiled_options");
+  f->dump_unsigned("options", compiled_options.size());
+  f->dump_unsigned("bytes", n);
+  f->close_section();
+
+  n = subsys_descs.capacity() * sizeof(string);
+  for (auto& o : subsys_options) {
+    n += option_bytes(o);
+  }
+  for (auto& d : subsys_descs) {
+    n += d.capacity() + 1;
+  }
+  f->open_object_section("subsys_options");
+  f->dump_unsigned("options", subsys_options.size());
+  f->dump_unsigned("bytes", n);
+  f->close_section();
+
+  std::size_t set;
+  n = values.memory_bytes(&set);
+  f->open_object_section("values");
+  f->dump_unsigned("set", set);
+  f->dump_unsigned("bytes", n);
+  f->close_section();
+
+  f->dump_unsigned("legacy_bytes",
+		   (legacy_values.capacity() + legacy_meta.capacity()) *
+		   sizeof(decltype(legacy_values)::value_type));
+  n = values_bl.length();
+  for (auto& bl : values_frags) {
+    n += sizeof(bufferlist) + bl.length();
+  }
+  f->dump_unsigned("encoded_values_bytes", n);
+  {
+    std::lock_guard l{cache_lock};
+    n = expand_cache.capacity() * sizeof(expanded_t);
+    for (auto& e : expand_cache) {
+      if (auto s = boost::get<std::string>(&e.value);
+	  s && s->capacity() > std::string().capacity()) {
+	n += s->capacity() + 1;
+      }
+    }
+    for (auto& m : may_reexpand_meta) {
+      n += sizeof(m) + m.capacity() + 1;
+    }
+  }
+  f->dump_unsigned("expand_cache_bytes", n);
+}
+
 void md_config_t::complain_about_parse_errors(CephContext *cct)
 {
   ::complain_about_parse_errors(cct, &parse_errors);
@@ -16,8 +16,13 @@
 #define CEPH_CONFIG_H
 
 #include <map>
+#include <set>
+#include <sys/stat.h>
+#include <string_view>
+#include <boost/container/flat_map.hpp>
 #include <boost/container/small_vector.hpp>
 #include "common/ConfUtils.h"
+#include "common/ceph_mutex.h"
 #include "common/code_environment.h"
 #include "log/SubsystemMap.h"
 #include "common/options.h"
@@ -87,26 +92,44 @@ public:
   /// true if we are a daemon (as per CephContext::code_env)
   const bool is_daemon;
 
+  /// the OPTION_GROUP_*s in the schema (see get_option_groups())
+  const unsigned option_groups;
+  /// the compiled-in options of those groups
+  const std::vector<Option>& compiled_options;
+
   /*
    * Mapping from legacy config option names to class members
    */
-  std::map<std::string, member_ptr_t> legacy_values;
+  boost::container::flat_map<std::string_view, member_ptr_t> legacy_values;
 
   /**
    * The configuration schema, in the form of Option objects describing
-   * possible settings.
+   * possible settings.  Keys point at the names of the Options.  It is
+   * a sorted vector, filled once by the constructor, so lookups are a
+   * binary search over contiguous memory and an option's position is its
+   * OptionId.
    */
-  std::map<std::string, const Option&> schema;
+  using schema_t = option_index_t;
+  schema_t schema;
 
   /// values from mon that we failed to set
   std::map<std::string,std::string> ignored_mon_values;
 
+  /// epoch of the mon values last applied; 0 if unknown
+  uint64_t mon_vals_epoch = 0;
+
   /// original raw values saved that may need to re-expand at certain time
   mutable std::vector<std::string> may_reexpand_meta;
 
   /// encoded, cached copy of of values + ignored_mon_values
   bufferlist values_bl;
 
+  /// each set option's part of values_bl, by OptionId, as of
+  /// values_frags_version; values_bl is rebuilt by re-encoding just the
+  /// options that changed since and concatenating the lot
+  std::vector<bufferlist> values_frags;
+  uint64_t values_frags_version = 0;
+
   /// version for values_bl; increments each time there is a change
   uint64_t values_bl_version = 0;
 
@@ -119,18 +142,43 @@ public:
   } opt_type_t;
 
   // Create a new md_config_t structure.
-  explicit md_config_t(ConfigValues& values, const ConfigTracker& tracker, bool is_daemon=false);
+  explicit md_config_t(ConfigValues& values, const ConfigTracker& tracker, bool is_daemon=false,
+		       unsigned option_groups=OPTION_GROUPS_ALL);
   ~md_config_t();
 
   // Parse a config file
   int parse_config_files(ConfigValues& values, const ConfigTracker& tracker,
 			                   const char *conf_files, std::ostream *warnings, int flags);
 
+  /// the config file parse_config_files() read; empty if none
+  const std::string& get_conf_file_path() const {
+    return conf_file_path;
+  }
+
+  /**
+   * parse the config file again and apply what changed in it
+   *
+   * Only options whose CONF_FILE value is now different, or gone, are set
+   * or removed, so observers hear of nothing else.  Changes to options
+   * that can't be changed at runtime are left for a restart, and noted in
+   * warnings, as are the file's parse errors.
+   *
+   * @return the number of options set or removed, or a negative error if
+   *         the file couldn't be read, in which case nothing changed
+   */
+  int reload_config_file(ConfigValues& values, const ConfigTracker& tracker,
+			 std::ostream *warnings);
+
   // Absorb config settings from the environment
   void parse_env(unsigned entity_type,
 		 ConfigValues& values, const ConfigTracker& tracker,
 		 const char *env_var = "CEPH_ARGS");
 
+  /// with log_auto_size, scale the defaults of the log's queues and
+  /// buffers to the memory and cpus the process may use
+  void set_resource_defaults(ConfigValues& values,
+			     const ConfigTracker& tracker);
+
   // Absorb config settings from argv
   int parse_argv(ConfigValues& values, const ConfigTracker& tracker,
 		 std::vector<const char*>& args, int level=CONF_CMDLINE);
@@ -145,18 +193,39 @@ public:
 
   /// Look up an option in the schema
   const Option *find_option(const string& name) const;
+  /// an option of a group left out of the schema, which is accepted (and
+  /// ignored) where a setting is given, or nullptr
+  const group_option_t *find_other_option(std::string_view name) const;
+  /// OptionId::NONE if there is no such option
+  OptionId get_option_id(std::string_view name) const;
 
   /// Set a default value
   void set_val_default(ConfigValues& values,
 		       const ConfigTracker& tracker,
 		       const std::string& key, const std::string &val);
 
-  /// Set a values from mon
+  /// Set a values from mon; epoch identifies kv for set_mon_vals_delta()
   int set_mon_vals(CephContext *cct,
       ConfigValues& values,
       const ConfigTracker& tracker,
       const map<std::string,std::string>& kv,
+      config_callback config_cb,
+      uint64_t epoch = 0);
+  /// Apply what changed between the mon values of prev_epoch and those of
+  /// epoch; -ESTALE if prev_epoch isn't what we have, or either is 0, in
+  /// which case the caller should fall back to set_mon_vals() with all of
+  /// them
+  int set_mon_vals_delta(CephContext *cct,
+      ConfigValues& values,
+      const ConfigTracker& tracker,
+      uint64_t prev_epoch,
+      uint64_t epoch,
+      const map<std::string,std::string>& changed,
+      const std::set<std::string>& removed,
       config_callback config_cb);
+  uint64_t get_mon_vals_epoch() const {
+    return mon_vals_epoch;
+  }
 
   // Called by the Ceph daemons to make configuration changes at runtime
   int injectargs(ConfigValues& values,
@@ -197,6 +266,11 @@ public:
   int get_val(const ConfigValues& values, const std::string &key, std::string *val) const;
   Option::value_t get_val_generic(const ConfigValues& values, const std::string &key) const;
   template<typename T> const T get_val(const ConfigValues& values, const std::string &key) const;
+  /// get_val() without looking the option up by name
+  template<typename T> const T get_val(const ConfigValues& values, OptionId id) const;
+  /// the value of every option, indexed by OptionId
+  void get_vals_by_id(const ConfigValues& values,
+		      std::vector<Option::value_t> *out) const;
   template<typename T, typename Callback, typename...Args>
   auto with_val(const ConfigValues& values, const string& key,
 		Callback&& cb, Args&&... args) const ->
@@ -232,15 +306,21 @@ public:
   /// dump config diff from default, conf, mon, etc.
   void diff(const ConfigValues& values, Formatter *f, std::string name=string{}) const;
 
+  /// dump the memory the schema, the values and their caches take
+  void dump_memory_usage(const ConfigValues& values, Formatter *f) const;
+
   /// print/log warnings/errors from parsing the config
   void complain_about_parse_errors(CephContext *cct);
 
+  /// abort if the compiled-in schema is inconsistent
+  void validate_schema() const;
+
 private:
   // we use this to avoid variable expansion loops
   typedef small_vector<pair<const Option*, const Option::value_t*>, 4> expand_stack_t;
 
-  void validate_schema();
-  void validate_default_settings();
+  void validate_default_settings(ConfigValues& values,
+				 const ConfigTracker& tracker);
 
   int _get_val_cstr(const ConfigValues& values,
 		    const std::string &key, char **buf, int len) const;
@@ -250,12 +330,15 @@ private:
 			                     expand_stack_t *stack=0,std::ostream *err=0) const;
 
   const Option::value_t& _get_val_default(const Option& o) const;
+  OptionId _id_of(const Option& o) const;
   Option::value_t _get_val_nometa(const ConfigValues& values, const Option& o) const;
 
   int _rm_val(ConfigValues& values, const std::string& key, int level);
 
   void _refresh(ConfigValues& values, const Option& opt);
 
+  void _encode_values_frag(const ConfigValues& values, OptionId id);
+
   void _show_config(const ConfigValues& values, std::ostream *out, Formatter *f) const;
 
   void _get_my_sections(const ConfigValues& values, std::vector<std::string> &sections) const;
@@ -283,15 +366,58 @@ private:
     const Option &opt,
     int level,  // CONF_*
     std::string *error_message);
+  /// as _set_val(), for a value that is already parsed and validated
+  int _set_parsed_val(
+    ConfigValues& values,
+    const ConfigTracker& tracker,
+    Option::value_t&& new_value,
+    const Option &opt,
+    int level,  // CONF_*
+    std::string *error_message);
+
+  /// conf_cache_file, expanded; empty if there is none
+  std::string _get_conf_cache_path(const ConfigValues& values) const;
+  uint64_t _schema_fingerprint() const;
+  /// apply what conf_cache_file has for conf_file, if it is still current
+  bool _load_conf_cache(ConfigValues& values,
+			const ConfigTracker& tracker,
+			const std::string& cache_path,
+			const std::string& conf_file,
+			const struct stat& st,
+			const std::vector<std::string>& my_sections,
+			std::ostream *warnings,
+			std::deque<std::string> *old_style_section_names);
+  void _save_conf_cache(const ConfigValues& values,
+			const std::string& cache_path,
+			const std::string& conf_file,
+			const struct stat& st,
+			const std::vector<std::string>& my_sections,
+			const std::string& warnings,
+			const std::deque<std::string>& old_style_section_names) const;
+  /// cf, parsed now if a conf cache stood in for it
+  const ConfFile& _get_cf() const;
 
   template <typename T>
   void assign_member(member_ptr_t ptr, const Option::value_t &val);
 
 
+  void _set_mon_val(CephContext *cct,
+		    ConfigValues& values,
+		    const ConfigTracker& tracker,
+		    const std::string& key,
+		    const std::string& val,
+		    const config_callback& config_cb);
+  void _rm_mon_val(CephContext *cct,
+		   ConfigValues& values,
+		   const std::string& key);
+
   void update_legacy_vals(ConfigValues& values);
   void update_legacy_val(ConfigValues& values,
 			 const Option &opt,
 			 member_ptr_t member);
+  void _legacy_changed(ConfigValues& values,
+		       std::string_view name,
+		       member_ptr_t member);
 
   Option::value_t _expand_meta(
     const ConfigValues& values,
@@ -311,7 +437,11 @@ private:
   void expand_all_meta();
 
   // The configuration file we read, or NULL if we haven't read one.
-  ConfFile cf;
+  mutable ConfFile cf;
+  std::string conf_file_path;
+  /// the file cf is to be parsed from on first use, when its values came
+  /// from conf_cache_file instead
+  mutable std::string cf_deferred;
 public:
   std::deque<std::string> parse_errors;
 private:
@@ -324,6 +454,34 @@ private:
   string do_show_config_value;
 
   vector<Option> subsys_options;
+  vector<string> subsys_descs; ///< backs subsys_options' descriptions
+  /// expanded string values, by OptionId, so that reading e.g. log_file
+  /// doesn't scan and rebuild it every time
+  struct expanded_t {
+    uint64_t version = 0; ///< of the ConfigValues it came from; 0 if unset
+    Option::value_t value;
+  };
+  mutable vector<expanded_t> expand_cache;
+  /// what expansion depends on besides the values themselves; the cache
+  /// is dropped when any of it changes
+  mutable EntityName expand_name;
+  mutable string expand_cluster;
+  mutable string expand_data_dir;
+  /// guards what const methods fill in lazily (cf from cf_deferred,
+  /// may_reexpand_meta, expand_*), as ConfigProxy lets readers run them
+  /// concurrently; whoever holds ConfigProxy's lock exclusively needn't
+  mutable ceph::mutex cache_lock = ceph::make_mutex("md_config_t::cache_lock");
+
+  /// the version of the ConfigValues the legacy members were last copied
+  /// out at; 0 if never
+  uint64_t legacy_version = 0;
+  /// legacy options whose values have metavariables, which may expand
+  /// differently after a change to anything else
+  boost::container::flat_map<std::string_view, member_ptr_t> legacy_meta;
+
+  /// the OptionId of each compiled-in option and of each of
+  /// subsys_options, by position, so that _id_of() needs no lookup
+  vector<OptionId> compiled_ids, subsys_ids;
 
 public:
   string data_dir_option;  ///< data_dir config option, if any
@@ -342,6 +500,12 @@ const T md_config_t::get_val(const ConfigValues& values, const std::string &key)
   return boost::get<T>(this->get_val_generic(values, key));
 }
 
+template<typename T>
+const T md_config_t::get_val(const ConfigValues& values, OptionId id) const {
+  ceph_assert(static_cast<size_t>(id) < schema.size());
+  return boost::get<T>(_get_val(values, schema.nth(static_cast<size_t>(id))->second));
+}
+
 inline std::ostream& operator<<(std::ostream& o, const boost::blank& ) {
       return o << "INVALID_CONFIG_VALUE";
 }
@@ -15,8 +15,15 @@
 #ifndef CEPH_CONFIG_CACHER_H
 #define CEPH_CONFIG_CACHER_H
 
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "common/config_obs.h"
 #include "common/config.h"
+#include "common/rcu_ptr.h"
 
 template <typename ValueT>
 class md_config_cacher_t : public md_config_obs_t {
@@ -53,5 +60,89 @@ public:
   }
 };
 
+/* Caches several options in one struct, kept up to date by a single
+ * observer.  Readers get all of them from the same update, without a lock:
+ *
+ *   struct OpLimits { uint64_t max_ops; double timeout; };
+ *   md_config_cacher_set<OpLimits> limits(conf, {
+ *     {"osd_max_ops", &OpLimits::max_ops},
+ *     {"osd_op_timeout", &OpLimits::timeout}});
+ *   auto l = limits.read();  // l->max_ops, l->timeout
+ */
+template <typename Values>
+class md_config_cacher_set : public md_config_obs_t {
+public:
+  struct field {
+    template <typename T>
+    field(const char* name, T Values::* member)
+      : name(name),
+	load([name, member](const ConfigProxy& conf, Values* v) {
+	  v->*member = conf.get_val<T>(name);
+	}) {}
+
+    const char* name;
+    std::function<void(const ConfigProxy&, Values*)> load;
+  };
+
+private:
+  ConfigProxy& conf;
+  const std::vector<field> fields;
+  std::vector<const char*> keys;
+  ceph::rcu_ptr<Values> values;
+  std::mutex update_lock; ///< serializes updates of values
+
+  const char** get_tracked_conf_keys() const override {
+    return const_cast<const char**>(keys.data());
+  }
+
+  void handle_conf_change(const ConfigProxy& conf,
+                          const std::set<std::string>& changed) override {
+    std::lock_guard l{update_lock};
+    std::unique_ptr<Values> v;
+    for (auto& f : fields) {
+      if (changed.count(f.name)) {
+	if (!v) {
+	  v = std::make_unique<Values>(get());
+	}
+	f.load(conf, v.get());
+      }
+    }
+    if (v) {
+      values.update(std::move(v));
+    }
+  }
+
+public:
+  md_config_cacher_set(ConfigProxy& conf, std::initializer_list<field> fields)
+    : conf(conf),
+      fields(fields) {
+    for (auto& f : this->fields) {
+      keys.push_back(f.name);
+    }
+    keys.push_back(nullptr);
+    std::lock_guard l{update_lock};
+    conf.add_observer(this);
+    auto v = std::make_unique<Values>();
+    for (auto& f : this->fields) {
+      f.load(conf, v.get());
+    }
+    values.update(std::move(v));
+  }
+
+  ~md_config_cacher_set() {
+    conf.remove_observer(this);
+  }
+
+  /// the cached values, consistent with each other, for as long as the
+  /// returned reader is held
+  typename ceph::rcu_ptr<Values>::reader read() const {
+    return typename ceph::rcu_ptr<Values>::reader(values);
+  }
+  /// a copy of the cached values
+  Values get() const {
+    return *read();
+  }
+};
+
 #endif // CEPH_CONFIG_CACHER_H
 
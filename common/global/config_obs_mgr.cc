@@ -2,7 +2,10 @@
 
 #pragma once
 
+#include <algorithm>
+
 #include "config_obs_mgr.h"
+#include "config_values.h"
 
 // we could put the implementations in a .cc file, and only instantiate the
 // used template specializations explicitly, but that forces us to involve
@@ -16,52 +19,71 @@ template<class ConfigObs>
 void ObserverMgr<ConfigObs>::add_observer(ConfigObs* observer)
 {
   const char **keys = observer->get_tracked_conf_keys();
-  for (const char ** k = keys; *k; ++k) {
-    observers.emplace(*k, observer);
+  for (unsigned k = 0; keys[k]; ++k) {
+    observers[keys[k]].push_back({observer, keys, k});
   }
+  obs_keys.emplace_back(observer, keys);
 }
 
 template<class ConfigObs>
 void ObserverMgr<ConfigObs>::remove_observer(ConfigObs* observer)
 {
-  [[maybe_unused]] bool found_obs = false;
-  for (auto o = observers.begin(); o != observers.end(); ) {
-    if (o->second == observer) {
-      observers.erase(o++);
-      found_obs = true;
-    } else {
-      ++o;
+  auto o = std::find_if(obs_keys.begin(), obs_keys.end(),
+			[observer](const auto& i) { return i.first == observer; });
+  ceph_assert(o != obs_keys.end());
+  for (const char **k = o->second; *k; ++k) {
+    auto p = observers.find(*k);
+    if (p == observers.end()) {
+      continue;
+    }
+    auto& v = p->second;
+    v.erase(std::remove_if(v.begin(), v.end(),
+			   [observer](const auto& t) { return t.obs == observer; }),
+	    v.end());
+    if (v.empty()) {
+      observers.erase(p);
     }
   }
-  ceph_assert(found_obs);
+  obs_keys.erase(o);
 }
 
 template<class ConfigObs>
-void ObserverMgr<ConfigObs>::for_each_observer(config_gather_cb callback)
+void ObserverMgr<ConfigObs>::for_each_observer(rev_obs_map *rev_obs,
+					       config_gather_cb callback)
 {
-  for (const auto& [key, obs] : observers) {
-    callback(obs, key);
+  for (const auto& [obs, keys] : obs_keys) {
+    for (unsigned k = 0; keys[k]; ++k) {
+      if (rev_obs->add(obs, keys, k)) {
+	callback(obs);
+      }
+    }
   }
 }
 
 template<class ConfigObs>
 template<class ConfigProxyT>
-void ObserverMgr<ConfigObs>::for_each_change(const std::set<std::string>& changes,
-               ConfigProxyT& proxy, config_gather_cb callback, std::ostream *oss)
+void ObserverMgr<ConfigObs>::for_each_change(const changed_set_t& changes,
+               ConfigProxyT& proxy, rev_obs_map *rev_obs,
+               config_gather_cb callback, std::ostream *oss)
 {
   // create the reverse observer mapping, mapping observers to the set of
   // changed keys that they'll get.
   string val;
   for (auto& key : changes) {
-    auto [first, last] = observers.equal_range(key);
-    if ((oss) && !proxy.get_val(key, &val)) {
+    auto p = observers.find(key);
+    if ((oss) && !proxy._get_val(key, &val)) {
       (*oss) << key << " = '" << val << "' ";
-      if (first == last) {
+      if (p == observers.end()) {
         (*oss) << "(not observed, change may require restart) ";
       }
     }
-    for (auto r = first; r != last; ++r) {
-      callback(r->second, key);
+    if (p == observers.end()) {
+      continue;
+    }
+    for (auto& t : p->second) {
+      if (rev_obs->add(t.obs, t.keys, t.key)) {
+	callback(t.obs);
+      }
     }
   }
 }
@@ -71,3 +93,22 @@ bool ObserverMgr<ConfigObs>::is_tracking(const std::string& name) const
 {
   return observers.count(name) > 0;
 }
+
+template<class ConfigObs>
+std::size_t ObserverMgr<ConfigObs>::memory_bytes(std::size_t *num_observers,
+						 std::size_t *num_keys) const
+{
+  *num_observers = obs_keys.size();
+  *num_keys = observers.size();
+  // a node per key, holding its name and the vector of trackers
+  std::size_t n = observers.bucket_count() * sizeof(void*);
+  for (auto& [key, trackers] : observers) {
+    n += sizeof(typename obs_map_t::value_type) + 2 * sizeof(void*);
+    if (key.capacity() > std::string().capacity()) {
+      n += key.capacity() + 1;
+    }
+    n += trackers.capacity() * sizeof(tracker_t);
+  }
+  n += obs_keys.capacity() * sizeof(typename decltype(obs_keys)::value_type);
+  return n;
+}
@@ -2,25 +2,91 @@
 
 #pragma once
 
-#include <map>
+#include <cstdint>
+#include <functional>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/container/small_vector.hpp>
 
 #include "common/config_tracker.h"
 
 class ConfigValues;
+class changed_set_t;
 
 // @c ObserverMgr manages a set of config observers which are interested in
 // the changes of settings at runtime.
 template<class ConfigObs>
 class ObserverMgr : public ConfigTracker {
-  // Maps configuration options to the observer listening for them.
-  using obs_map_t = std::multimap<std::string, ConfigObs*>;
+  // An observer listening for an option, with its table of tracked keys
+  // and the position of the option in it.
+  struct tracker_t {
+    ConfigObs *obs;
+    const char **keys;
+    unsigned key;
+  };
+  // Maps configuration options to the observers listening for them.
+  using obs_map_t = std::unordered_map<std::string, std::vector<tracker_t>>;
   obs_map_t observers;
+  // every observer and its table of tracked keys, in the order added
+  std::vector<std::pair<ConfigObs*, const char**>> obs_keys;
 
 public:
-  typedef std::map<ConfigObs*, std::set<std::string>> rev_obs_map;
-  typedef std::function<void(ConfigObs*, const std::string&)> config_gather_cb;
+  // The keys changed in one batch, per observer: a bit for each key in the
+  // observer's table, so gathering a change is a couple of lookups and a
+  // bit set.  The key names are only put in a std::set for the call to
+  // handle_conf_change().
+  class rev_obs_map {
+    struct changes_t {
+      ConfigObs *obs;
+      const char **keys;
+      boost::container::small_vector<uint64_t, 1> bits;
+    };
+    std::vector<changes_t> changes;
+    std::unordered_map<ConfigObs*, std::size_t> index;
+
+  public:
+    // returns true if this is the first change for obs
+    bool add(ConfigObs *obs, const char **keys, unsigned key) {
+      auto [i, added] = index.emplace(obs, changes.size());
+      if (added) {
+	changes.push_back({obs, keys, {}});
+      }
+      auto& bits = changes[i->second].bits;
+      if (bits.size() <= key / 64) {
+	bits.resize(key / 64 + 1);
+      }
+      bits[key / 64] |= uint64_t(1) << (key % 64);
+      return added;
+    }
+    // f(obs, changed keys) for every observer with changes
+    template<typename F>
+    void for_each(F&& f) const {
+      for (auto& c : changes) {
+	std::set<std::string> keys;
+	for (std::size_t w = 0; w < c.bits.size(); ++w) {
+	  for (uint64_t b = c.bits[w]; b; b &= b - 1) {
+	    keys.emplace(c.keys[w * 64 + __builtin_ctzll(b)]);
+	  }
+	}
+	f(c.obs, keys);
+      }
+    }
+    // f(obs) for every observer with changes
+    template<typename F>
+    void for_each_observer(F&& f) const {
+      for (auto& c : changes) {
+	f(c.obs);
+      }
+    }
+    bool empty() const {
+      return changes.empty();
+    }
+  };
+  // called for each observer the first time it is added to a rev_obs_map
+  typedef std::function<void(ConfigObs*)> config_gather_cb;
 
   // Adds a new observer to this configuration. You can do this at any time,
   // but it will only receive notifications for the changes that happen after
@@ -38,11 +104,16 @@ public:
   // This function will assert if you try to delete an observer that isn't
   // there.
   void remove_observer(ConfigObs* observer);
-  // invoke callback for every observers tracking keys
-  void for_each_observer(config_gather_cb callback);
-  // invoke callback for observers keys tracking the provided change set
+  // add every observer with all of its tracked keys to rev_obs
+  void for_each_observer(rev_obs_map *rev_obs, config_gather_cb callback);
+  // add the observers tracking the provided change set to rev_obs
   template<class ConfigProxyT>
-  void for_each_change(const std::set<std::string>& changes,
-                       ConfigProxyT& proxy, config_gather_cb callback, std::ostream *oss);
+  void for_each_change(const changed_set_t& changes,
+                       ConfigProxyT& proxy, rev_obs_map *rev_obs,
+                       config_gather_cb callback, std::ostream *oss);
   bool is_tracking(const std::string& name) const override;
+  // the observers, the keys they track, and roughly the memory the maps
+  // of them take
+  std::size_t memory_bytes(std::size_t *num_observers,
+			   std::size_t *num_keys) const;
 };
@@ -0,0 +1,177 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "config_profiler.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+std::atomic<uint64_t> next_serial{1};
+
+/// the calling thread's table in the profiler it last recorded for
+struct cached_table {
+  uint64_t serial = 0;
+  void *table = nullptr;
+};
+thread_local cached_table cached;
+
+/// the function addr is in, as well as the binary lets us tell
+std::string site_name(const void *addr)
+{
+  Dl_info info;
+  if (!dladdr(addr, &info) || !info.dli_fname) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%p", addr);
+    return buf;
+  }
+  if (info.dli_sname) {
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr,
+					  &status);
+    std::string name = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+    return name;
+  }
+  const char *base = strrchr(info.dli_fname, '/');
+  char buf[32];
+  snprintf(buf, sizeof(buf), "+0x%lx",
+	   (unsigned long)((const char*)addr - (const char*)info.dli_fbase));
+  return std::string(base ? base + 1 : info.dli_fname) + buf;
+}
+
+}
+
+config_profiler::config_profiler(std::size_t num_options)
+  : m_num_options(num_options),
+    m_serial(next_serial.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+void config_profiler::set_every(uint64_t every)
+{
+  std::lock_guard l{m_lock};
+  const uint64_t was = m_every.load(std::memory_order_relaxed);
+  const auto now = std::chrono::steady_clock::now();
+  if (!was && every) {
+    m_on_since = now;
+  } else if (was && !every) {
+    m_counted += now - m_on_since;
+  }
+  m_every.store(every, std::memory_order_relaxed);
+}
+
+config_profiler::thread_table *config_profiler::_table()
+{
+  if (likely(cached.serial == m_serial)) {
+    return static_cast<thread_table*>(cached.table);
+  }
+  std::lock_guard l{m_lock};
+  auto& t = m_tables[std::this_thread::get_id()];
+  if (!t) {
+    t = std::make_unique<thread_table>(m_num_options);
+    // threads start at different points of the count, so that ones which
+    // read less than every times still show, and in proportion
+    const uint64_t every = std::max<uint64_t>(
+      m_every.load(std::memory_order_relaxed), 1);
+    t->every = every;
+    t->countdown = 1 + std::hash<std::thread::id>()(
+      std::this_thread::get_id()) % every;
+  }
+  cached.serial = m_serial;
+  cached.table = t.get();
+  return t.get();
+}
+
+config_profiler::thread_table *config_profiler::_sample()
+{
+  thread_table *t = _table();
+  if (--t->countdown > 0) {
+    return nullptr;
+  }
+  t->every = m_every.load(std::memory_order_relaxed);
+  t->countdown = std::max<uint64_t>(t->every, 1);
+  return t->every ? t : nullptr;
+}
+
+void config_profiler::_record(thread_table *t, OptionId id)
+{
+  const auto i = static_cast<std::size_t>(id);
+  if (i < m_num_options) {
+    auto& n = t->ids[i];
+    n.store(n.load(std::memory_order_relaxed) + t->every,
+	    std::memory_order_relaxed);
+  }
+}
+
+void config_profiler::note_legacy()
+{
+  if (auto t = _sample(); t) {
+    const void *site = __builtin_return_address(0);
+    std::lock_guard l{t->sites_lock};
+    t->sites[site] += t->every;
+  }
+}
+
+config_profiler::report_t config_profiler::report() const
+{
+  report_t r;
+  std::vector<uint64_t> ids(m_num_options);
+  std::map<const void*, uint64_t> sites;
+  {
+    std::lock_guard l{m_lock};
+    r.every = m_every.load(std::memory_order_relaxed);
+    auto counted = m_counted;
+    if (r.every) {
+      counted += std::chrono::steady_clock::now() - m_on_since;
+    }
+    r.seconds = std::chrono::duration<double>(counted).count();
+    for (auto& [thread, t] : m_tables) {
+      for (std::size_t i = 0; i < m_num_options; ++i) {
+	ids[i] += t->ids[i].load(std::memory_order_relaxed);
+      }
+      std::lock_guard sl{t->sites_lock};
+      for (auto& [site, n] : t->sites) {
+	sites[site] += n;
+      }
+    }
+  }
+  for (std::size_t i = 0; i < m_num_options; ++i) {
+    if (ids[i]) {
+      r.options.emplace_back(static_cast<OptionId>(i), ids[i]);
+    }
+  }
+  // sites in one function are counted together
+  std::map<std::string, uint64_t> by_name;
+  for (auto& [site, n] : sites) {
+    by_name[site_name(site)] += n;
+  }
+  r.legacy.assign(by_name.begin(), by_name.end());
+  auto most = [](const auto& a, const auto& b) {
+    return a.second > b.second;
+  };
+  std::stable_sort(r.options.begin(), r.options.end(), most);
+  std::stable_sort(r.legacy.begin(), r.legacy.end(), most);
+  return r;
+}
+
+void config_profiler::reset()
+{
+  std::lock_guard l{m_lock};
+  for (auto& [thread, t] : m_tables) {
+    for (std::size_t i = 0; i < m_num_options; ++i) {
+      t->ids[i].store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard sl{t->sites_lock};
+    t->sites.clear();
+  }
+  m_counted = std::chrono::steady_clock::duration::zero();
+  m_on_since = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,107 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "options.h"
+#include "common/utils/likely.h"
+
+/* Which options are read, and how often, for deciding which are worth a
+ * md_config_cacher_t or a place among the hot values rather than guessing.
+ *
+ * Off (config_profile_every = 0) a read costs ConfigProxy a relaxed load
+ * and a branch.  On, each thread counts its reads down from every, and the
+ * one that reaches zero is recorded, as every reads, in a table of the
+ * thread's own, so threads reading at once don't share a line.  report()
+ * sums the tables.  A table has a slot per option and, once made, is kept
+ * (reset() zeroes it) for as long as the profiler, so a thread's counts
+ * outlive it and no read ever records into freed memory.
+ *
+ * A legacy member read (conf->x) can't tell which member it is after, so
+ * it is recorded by the function it was made from, which report() names
+ * as well as it can: by symbol if the binary exports it, otherwise as
+ * object+offset, for addr2line.
+ */
+class config_profiler {
+public:
+  struct report_t {
+    uint64_t every = 0;
+    double seconds = 0;  ///< counted for, since it was turned on or reset
+    /// options (by OptionId) and their estimated reads, most read first
+    std::vector<std::pair<OptionId, uint64_t>> options;
+    /// legacy member reads by calling function, most first
+    std::vector<std::pair<std::string, uint64_t>> legacy;
+  };
+
+  explicit config_profiler(std::size_t num_options);
+  config_profiler(const config_profiler&) = delete;
+  config_profiler& operator=(const config_profiler&) = delete;
+
+  /// record one in every reads; 0 stops counting, but keeps the counts
+  void set_every(uint64_t every);
+  bool on() const {
+    return unlikely(m_every.load(std::memory_order_relaxed) != 0);
+  }
+
+  /// a read of id; call only if on()
+  void note(OptionId id) {
+    if (auto t = _sample(); t) {
+      _record(t, id);
+    }
+  }
+  /// a read of the option named key, which id_of(key) looks up only if
+  /// this read is recorded; call only if on()
+  template<typename IdOf>
+  void note_key(std::string_view key, IdOf&& id_of) {
+    if (auto t = _sample(); t) {
+      _record(t, id_of(key));
+    }
+  }
+  /// a read through a legacy member, from the function calling whatever
+  /// inlined this; call only if on()
+  void note_legacy() __attribute__((noinline));
+
+  report_t report() const;
+  /// start counting afresh
+  void reset();
+
+private:
+  struct thread_table {
+    explicit thread_table(std::size_t n)
+      : ids(new std::atomic<uint64_t>[n]()) {}
+    /// only the owning thread writes these; report() reads them
+    std::unique_ptr<std::atomic<uint64_t>[]> ids;
+    uint64_t countdown = 0;
+    uint64_t every = 0;  ///< what each read recorded here stands for
+    std::mutex sites_lock;
+    std::map<const void*, uint64_t> sites;
+  };
+
+  /// the calling thread's table if this read is the one to record
+  thread_table *_sample();
+  thread_table *_table();
+  void _record(thread_table *t, OptionId id);
+
+  const std::size_t m_num_options;
+  const uint64_t m_serial;  ///< tells the thread local cache whose table
+  std::atomic<uint64_t> m_every{0};
+
+  mutable std::mutex m_lock;
+  /// by the thread that made it; never freed before the profiler
+  std::map<std::thread::id, std::unique_ptr<thread_table>> m_tables;
+  /// counted for before the latest time it was turned on
+  std::chrono::steady_clock::duration m_counted{0};
+  std::chrono::steady_clock::time_point m_on_since;
+};
@@ -2,18 +2,32 @@
 
 #pragma once
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
 #include <type_traits>
+#include <utility>
+#include <vector>
+#include "common/Thread.h"
 #include "common/config.h"
 #include "common/config_obs.h"
 #include "common/config_obs_mgr.h"
+#include "common/config_profiler.h"
 #include "common/ceph_mutex.h"
+#include "common/ceph_time.h"
+#include "common/hdr_histogram.h"
+#include "common/rcu_ptr.h"
 
 // @c ConfigProxy is a facade of multiple config related classes. it exposes
 // the legacy settings with arrow operator, and the new-style config with its
 // member methods.
 class ConfigProxy {
   static ConfigValues get_config_values(const ConfigProxy &config_proxy) {
-    std::lock_guard locker(config_proxy.lock);
+    std::shared_lock locker(config_proxy.lock);
     return config_proxy.values;
   }
 
@@ -24,35 +38,87 @@ class ConfigProxy {
   using md_config_obs_t = ceph::md_config_obs_impl<ConfigProxy>;
   ObserverMgr<md_config_obs_t> obs_mgr;
   md_config_t config;
-  /** A lock that protects the md_config_t internals. It is
-   * recursive, for simplicity.
+  /// which options are read how often, when config_profile_every says to
+  /// count them
+  mutable config_profiler profiler;
+  /** A lock that protects the md_config_t internals.  Reads share it;
+   * anything that changes a value, or gathers the observers of a change,
+   * holds it exclusively, and so must not call back into a method that
+   * takes it (see _get_val()).
    * It is best if this lock comes first in the lock hierarchy. We will
    * hold this lock when calling configuration observers.  */
-  mutable ceph::recursive_mutex lock =
-    ceph::make_recursive_mutex("ConfigProxy::lock");
+  mutable ceph::shared_mutex lock =
+    ceph::make_shared_mutex("ConfigProxy::lock");
+
+public:
+  using snapshot_t = std::vector<Option::value_t>;
+  using snapshot_ref = std::shared_ptr<const snapshot_t>;
+private:
+  /**
+   * Every option's value by OptionId, for get_val(OptionId) to read
+   * without the lock.  Anything that may change a value marks it stale
+   * (under the lock); the next such read rebuilds and publishes it.
+   * get_snapshot() hands out a reference to it, so holding one never
+   * holds up update().
+   */
+  mutable ceph::rcu_ptr<snapshot_ref> snapshot;
+  mutable std::atomic<bool> snapshot_stale{true};
+  /// serializes _publish() among the readers sharing lock
+  mutable ceph::mutex publish_lock =
+    ceph::make_mutex("ConfigProxy::publish_lock");
+
+  void _changed() {
+    snapshot_stale = true;
+  }
+  void _profile(OptionId id) const {
+    if (profiler.on()) {
+      profiler.note(id);
+    }
+  }
+  void _profile(std::string_view key) const {
+    // the name is only looked up for the reads that are recorded
+    if (profiler.on()) {
+      profiler.note_key(key, [this](std::string_view k) {
+	return config.get_option_id(k);
+      });
+    }
+  }
+  void _publish() const {
+    std::lock_guard l{publish_lock};
+    if (!snapshot_stale) {
+      return;
+    }
+    auto s = std::make_shared<snapshot_t>();
+    config.get_vals_by_id(values, s.get());
+    snapshot.update(std::make_unique<snapshot_ref>(std::move(s)));
+    snapshot_stale = false;
+  }
 
   class CallGate {
   private:
     uint32_t call_count = 0;
-    ceph::mutex lock;
-    ceph::condition_variable cond;
+    ceph::adaptive_mutex lock;
+    ceph::adaptive_condition_variable cond;
   public:
-    CallGate(): lock(ceph::make_mutex("call::gate::lock")) {
+    explicit CallGate(bool async)
+      : lock(ceph::make_adaptive_mutex("call::gate::lock")), async(async) {
     }
+    /// the observer is told of changes on the dispatch thread
+    const bool async;
 
     void enter() {
-      std::lock_guard<ceph::mutex> locker(lock);
+      std::lock_guard<ceph::adaptive_mutex> locker(lock);
       ++call_count;
     }
     void leave() {
-      std::lock_guard<ceph::mutex> locker(lock);
+      std::lock_guard<ceph::adaptive_mutex> locker(lock);
       ceph_assert(call_count > 0);
       if (--call_count == 0) {
         cond.notify_all();
       }
     }
     void close() {
-      std::unique_lock<ceph::mutex> locker(lock);
+      std::unique_lock<ceph::adaptive_mutex> locker(lock);
       while (call_count != 0) {
         cond.wait(locker);
       }
@@ -80,66 +146,235 @@ class ConfigProxy {
 
   std::map<md_config_obs_t*, CallGateRef> obs_call_gate;
 
-  void call_observers(std::unique_lock<ceph::recursive_mutex>& locker,
+  /// how long observers took to handle each batch of changes
+  ceph::hdr_histogram apply_lat;
+
+  /* Observers added with async are told of changes by a thread of their
+   * own rather than by whoever made them.  What an observer hasn't been
+   * told of yet waits here, the keys of later changes merged in, holding
+   * the observer's call gate until the dispatch thread has called it.
+   */
+  struct pending_change {
+    CallGate *gate;
+    std::set<std::string> keys;
+  };
+  ceph::mutex dispatch_lock = ceph::make_mutex("ConfigProxy::dispatch_lock");
+  ceph::condition_variable dispatch_cond;
+  std::map<md_config_obs_t*, pending_change> dispatch_pending;
+  md_config_obs_t *dispatching = nullptr; ///< being called; dispatch_lock
+  /// being removed, and not to be queued again
+  std::set<md_config_obs_t*> dispatch_removing;
+  bool dispatch_stop = false;
+  std::thread dispatch_thread;
+  /// set_safe_to_start_threads() was called: until then async observers
+  /// are called like the rest, so nothing is left to a thread a fork loses
+  bool dispatch_threads_ok = false;
+
+  /// queue keys for obs, whose call gate the caller has entered
+  void _queue_change(md_config_obs_t *obs, CallGate *gate,
+		     const std::set<std::string>& keys) {
+    std::lock_guard l{dispatch_lock};
+    if (dispatch_removing.count(obs)) {
+      return;
+    }
+    auto [p, added] = dispatch_pending.try_emplace(obs);
+    if (added) {
+      // held until the dispatch thread is done with it
+      gate->enter();
+      p->second.gate = gate;
+    }
+    p->second.keys.insert(keys.begin(), keys.end());
+    if (!dispatch_thread.joinable()) {
+      dispatch_thread = make_named_thread("config_obs", &ConfigProxy::_dispatch,
+					  this);
+    }
+    dispatch_cond.notify_all();
+  }
+
+  void _dispatch() {
+    std::unique_lock l{dispatch_lock};
+    while (true) {
+      if (dispatch_pending.empty()) {
+	if (dispatch_stop) {
+	  break;
+	}
+	dispatch_cond.wait(l);
+	continue;
+      }
+      auto p = dispatch_pending.begin();
+      md_config_obs_t *obs = p->first;
+      pending_change change = std::move(p->second);
+      dispatch_pending.erase(p);
+      dispatching = obs;
+      l.unlock();
+      const auto start = ceph::mono_clock::now();
+      obs->handle_conf_change(*this, change.keys);
+      apply_lat.record(ceph::mono_clock::now() - start);
+      change.gate->leave();
+      l.lock();
+      dispatching = nullptr;
+      dispatch_cond.notify_all();
+    }
+  }
+
+  void call_observers(std::unique_lock<ceph::shared_mutex>& locker,
                       rev_obs_map_t& rev_obs) {
+    // which are async, while obs_call_gate can't change under us
+    std::map<md_config_obs_t*, CallGate*> async;
+    if (dispatch_threads_ok) {
+      rev_obs.for_each_observer([this, &async](md_config_obs_t *obs) {
+	auto& gate = obs_call_gate.at(obs);
+	if (gate->async) {
+	  async.emplace(obs, gate.get());
+	}
+      });
+    }
     // observers are notified outside of lock
     locker.unlock();
-    for (auto& [obs, keys] : rev_obs) {
+    const auto start = ceph::mono_clock::now();
+    bool called = false;
+    rev_obs.for_each([this, &async, &called](md_config_obs_t *obs,
+					     const std::set<std::string>& keys) {
+      if (auto p = async.find(obs); p != async.end()) {
+	_queue_change(obs, p->second, keys);
+	return;
+      }
       obs->handle_conf_change(*this, keys);
+      called = true;
+    });
+    if (called) {
+      apply_lat.record(ceph::mono_clock::now() - start);
     }
     locker.lock();
 
-    for (auto& rev_ob : rev_obs) {
-      call_gate_leave(rev_ob.first);
-    }
+    rev_obs.for_each_observer([this](md_config_obs_t *obs) {
+      call_gate_leave(obs);
+    });
   }
 
-  void map_observer_changes(md_config_obs_t *obs, const std::string &key, rev_obs_map_t *rev_obs) {
-    ceph_assert(ceph_mutex_is_locked(lock));
-
-    auto [it, new_entry] = rev_obs->emplace(obs, std::set<std::string>{});
-    it->second.emplace(key);
-    if (new_entry) {
-      // this needs to be done under lock as once this lock is
-      // dropped (before calling observers) a remove_observer()
-      // can sneak in and cause havoc.
-      call_gate_enter(obs);
-    }
+  // called for each observer as it is first added to a rev_obs_map_t
+  void enter_observer(md_config_obs_t *obs) {
+    ceph_assert(ceph_mutex_is_wlocked(lock));
+    // this needs to be done under lock as once this lock is
+    // dropped (before calling observers) a remove_observer()
+    // can sneak in and cause havoc.
+    call_gate_enter(obs);
   }
 
 public:
-  explicit ConfigProxy(bool is_daemon): config{values, obs_mgr, is_daemon} {}
+  explicit ConfigProxy(bool is_daemon,
+		       unsigned option_groups = OPTION_GROUPS_ALL)
+    : config{values, obs_mgr, is_daemon, option_groups},
+      profiler(config.schema.size()) {}
   explicit ConfigProxy(const ConfigProxy &config_proxy)
     : values(get_config_values(config_proxy)),
-      config{values, obs_mgr, config_proxy.config.is_daemon} {}
+      config{values, obs_mgr, config_proxy.config.is_daemon,
+	     config_proxy.config.option_groups},
+      profiler(config.schema.size()) {}
+  ~ConfigProxy() {
+    {
+      std::lock_guard l{dispatch_lock};
+      dispatch_stop = true;
+      dispatch_cond.notify_all();
+    }
+    if (dispatch_thread.joinable()) {
+      dispatch_thread.join();
+    }
+  }
   const ConfigValues* operator->() const noexcept {
+    if (profiler.on()) {
+      profiler.note_legacy();
+    }
     return &values;
   }
   ConfigValues* operator->() noexcept {
+    if (profiler.on()) {
+      profiler.note_legacy();
+    }
     return &values;
   }
   int get_val(const std::string& key, char** buf, int len) const {
-    std::lock_guard l{lock};
+    _profile(key);
+    std::shared_lock l{lock};
     return config.get_val(values, key, buf, len);
   }
   int get_val(const std::string &key, std::string *val) const {
-    std::lock_guard l{lock};
+    _profile(key);
+    std::shared_lock l{lock};
     return config.get_val(values, key, val);
   }
   template<typename T>
   const T get_val(const std::string& key) const {
-    std::lock_guard l{lock};
+    _profile(key);
+    std::shared_lock l{lock};
     return config.template get_val<T>(values, key);
   }
+  /// doesn't take the lock unless a value changed since the last call
+  template<typename T>
+  const T get_val(OptionId id) const {
+    _profile(id);
+    if (!snapshot_stale) {
+      ceph::rcu_ptr<snapshot_ref>::reader r(snapshot);
+      return boost::get<T>((*r)->at(static_cast<size_t>(id)));
+    }
+    std::shared_lock l{lock};
+    if (snapshot_stale) {
+      _publish();
+    }
+    return config.template get_val<T>(values, id);
+  }
+  /// every value as of now, for reading several consistently or for
+  /// get_val_view(); like get_val(OptionId) it rarely takes the lock
+  snapshot_ref get_snapshot() const {
+    if (snapshot_stale) {
+      std::shared_lock l{lock};
+      if (snapshot_stale) {
+	_publish();
+      }
+    }
+    ceph::rcu_ptr<snapshot_ref>::reader r(snapshot);
+    return *r;
+  }
+  /// a string option's value, without copying it; valid for as long as
+  /// s is held.  empty if id is not a string option
+  static std::string_view get_val_view(const snapshot_ref& s, OptionId id) {
+    if (id == OptionId::NONE) {
+      return {};
+    }
+    auto str = boost::get<std::string>(&s->at(static_cast<size_t>(id)));
+    return str ? std::string_view(*str) : std::string_view();
+  }
+  std::string_view get_val_view(const snapshot_ref& s,
+				std::string_view key) const {
+    return get_val_view(s, get_option_id(key));
+  }
+  const ceph::hdr_histogram& get_apply_latency() const {
+    return apply_lat;
+  }
+  /// see config_profile_every
+  config_profiler& get_profiler() const {
+    return profiler;
+  }
+  OptionId get_option_id(std::string_view key) const {
+    return config.get_option_id(key);
+  }
+  std::string_view get_option_name(OptionId id) const {
+    return config.schema.nth(static_cast<size_t>(id))->first;
+  }
   template<typename T, typename Callback, typename...Args>
   auto with_val(const string& key, Callback&& cb, Args&&... args) const {
-    std::lock_guard l{lock};
+    _profile(key);
+    std::shared_lock l{lock};
     return config.template with_val<T>(
       values, key, std::forward<Callback>(cb), std::forward<Args>(args)...);
   }
   void config_options(Formatter *f) const {
     config.config_options(f);
   }
+  uint64_t get_mon_vals_epoch() const {
+    std::shared_lock l{lock};
+    return config.get_mon_vals_epoch();
+  }
   const decltype(md_config_t::schema)& get_schema() const {
     return config.schema;
   }
@@ -148,39 +383,69 @@ public:
     if (found == config.schema.end()) {
       return nullptr;
     } else {
-      return &found->second;
+      return &found->second.get();
     }
   }
   const Option *find_option(const string& name) const {
     return config.find_option(name);
   }
+  /// bumped whenever any value is set or removed
+  uint64_t get_version() const {
+    std::shared_lock l{lock};
+    return values.get_version();
+  }
+  /// f(name) for every option set or removed since get_version() returned
+  /// seq, possibly more than once; false, calling nothing, if that was too
+  /// long ago to tell, and anything may have changed
+  template<typename Func>
+  bool for_each_change_since(uint64_t seq, Func&& f) const {
+    std::shared_lock l{lock};
+    return values.for_each_changed_since(seq, [&](OptionId id) {
+      f(config.schema.nth(static_cast<size_t>(id))->first);
+    });
+  }
   void diff(Formatter *f, const std::string& name=string{}) const {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     return config.diff(values, f, name);
   }
+  /// "memory usage": the schema, the values and the observers
+  void dump_memory_usage(Formatter *f) const {
+    std::shared_lock l{lock};
+    config.dump_memory_usage(values, f);
+    std::size_t observers, keys;
+    const std::size_t n = obs_mgr.memory_bytes(&observers, &keys);
+    f->open_object_section("observers");
+    f->dump_unsigned("observers", observers);
+    f->dump_unsigned("keys", keys);
+    f->dump_unsigned("bytes", n + obs_call_gate.size() *
+		     (sizeof(decltype(obs_call_gate)::value_type) +
+		      sizeof(CallGate) + 4 * sizeof(void*)));
+    f->close_section();
+  }
   void get_my_sections(std::vector <std::string> &sections) const {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     config.get_my_sections(values, sections);
   }
   int get_all_sections(std::vector<std::string>& sections) const {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     return config.get_all_sections(sections);
   }
   int get_val_from_conf_file(const std::vector<std::string>& sections,
 			     const std::string& key, std::string& out, bool emeta) const {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     return config.get_val_from_conf_file(values, sections, key, out, emeta);
   }
   unsigned get_osd_pool_default_min_size(uint8_t size) const {
     return config.get_osd_pool_default_min_size(values, size);
   }
   void early_expand_meta(std::string &val, std::ostream *oss) const {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     return config.early_expand_meta(values, val, oss);
   }
   // for those want to reexpand special meta, e.g, $pid
   void finalize_reexpand_meta() {
     std::unique_lock locker(lock);
+    _changed();
     rev_obs_map_t rev_obs;
     if (config.finalize_reexpand_meta(values, obs_mgr)) {
       _gather_changes(values.changed, &rev_obs, nullptr);
@@ -188,52 +453,92 @@ public:
 
     call_observers(locker, rev_obs);
   }
-  void add_observer(md_config_obs_t* obs) {
+  /**
+   * have obs told of changes to the keys it tracks
+   *
+   * With async, once threads may be started, obs is called on a dispatch
+   * thread instead of by whoever applied the change, so a slow observer
+   * holds up only the other async ones.  Changes it hasn't been told of
+   * yet are merged: it is called once with all of their keys.  It must
+   * then cope with values that have changed again since, and anyone
+   * counting on it having seen a change must wait_for_observers().
+   */
+  void add_observer(md_config_obs_t* obs, bool async = false) {
     std::lock_guard l(lock);
     obs_mgr.add_observer(obs);
-    obs_call_gate.emplace(obs, std::make_unique<CallGate>());
+    obs_call_gate.emplace(obs, std::make_unique<CallGate>(async));
   }
+  /// an async observer's changes not yet dispatched are dropped; if it is
+  /// being called, this waits for that to return
   void remove_observer(md_config_obs_t* obs) {
-    std::lock_guard l(lock);
-    call_gate_close(obs);
-    obs_call_gate.erase(obs);
-    obs_mgr.remove_observer(obs);
+    {
+      // before taking lock, which the observer may want
+      std::unique_lock dl{dispatch_lock};
+      dispatch_removing.insert(obs);
+      if (auto p = dispatch_pending.find(obs); p != dispatch_pending.end()) {
+	p->second.gate->leave();
+	dispatch_pending.erase(p);
+      }
+      dispatch_cond.wait(dl, [this, obs] { return dispatching != obs; });
+    }
+    {
+      std::lock_guard l(lock);
+      call_gate_close(obs);
+      obs_call_gate.erase(obs);
+      obs_mgr.remove_observer(obs);
+    }
+    std::lock_guard dl{dispatch_lock};
+    dispatch_removing.erase(obs);
   }
   void call_all_observers() {
     std::unique_lock locker(lock);
     rev_obs_map_t rev_obs;
     obs_mgr.for_each_observer(
-      [this, &rev_obs](md_config_obs_t *obs, const std::string &key) {
-        map_observer_changes(obs, key, &rev_obs);
-      });
+      &rev_obs, [this](md_config_obs_t *obs) { enter_observer(obs); });
 
     call_observers(locker, rev_obs);
   }
+  /// wait until the async observers have been told of every change made
+  /// so far; not from an observer
+  void wait_for_observers() {
+    std::unique_lock l{dispatch_lock};
+    dispatch_cond.wait(l, [this] {
+      return dispatch_pending.empty() && !dispatching;
+    });
+  }
   void set_safe_to_start_threads() {
     config.set_safe_to_start_threads();
+    std::lock_guard l{lock};
+    dispatch_threads_ok = true;
   }
   void _clear_safe_to_start_threads() {
     config._clear_safe_to_start_threads();
+    std::lock_guard l{lock};
+    dispatch_threads_ok = false;
   }
   void show_config(std::ostream& out) {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     config.show_config(values, out);
   }
   void show_config(Formatter *f) {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     config.show_config(values, f);
   }
   void config_options(Formatter *f) {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     config.config_options(f);
   }
   int rm_val(const std::string& key) {
     std::lock_guard l{lock};
+    _changed();
     return config.rm_val(values, key);
   }
   // Expand all metavariables. Make any pending observer callbacks.
   void apply_changes(std::ostream* oss) {
     std::unique_lock locker(lock);
+    // the legacy fields, e.g. the name used by meta expansion, may have
+    // been changed directly through operator->
+    _changed();
     rev_obs_map_t rev_obs;
 
     // apply changes until the cluster name is assigned
@@ -244,30 +549,53 @@ public:
 
     call_observers(locker, rev_obs);
   }
-  void _gather_changes(std::set<std::string> &changes, rev_obs_map_t *rev_obs, std::ostream* oss) {
+  /// get_val() for whoever already holds lock, e.g. while gathering changes
+  int _get_val(const std::string &key, std::string *val) const {
+    return config.get_val(values, key, val);
+  }
+  void _gather_changes(changed_set_t &changes, rev_obs_map_t *rev_obs, std::ostream* oss) {
     obs_mgr.for_each_change(
-      changes, *this,
-      [this, rev_obs](md_config_obs_t *obs, const std::string &key) {
-        map_observer_changes(obs, key, rev_obs);
-      }, oss);
+      changes, *this, rev_obs,
+      [this](md_config_obs_t *obs) { enter_observer(obs); }, oss);
       changes.clear();
   }
   int set_val(const std::string& key, const std::string& s, std::stringstream* err_ss=nullptr) {
     std::lock_guard l{lock};
+    _changed();
     return config.set_val(values, obs_mgr, key, s, err_ss);
   }
   void set_val_default(const std::string& key, const std::string& val) {
     std::lock_guard l{lock};
+    _changed();
     config.set_val_default(values, obs_mgr, key, val);
   }
   void set_val_or_die(const std::string& key, const std::string& val) {
     std::lock_guard l{lock};
+    _changed();
     config.set_val_or_die(values, obs_mgr, key, val);
   }
   int set_mon_vals(CephContext *cct, const map<std::string,std::string>& kv,
-		   md_config_t::config_callback config_cb) {
+		   md_config_t::config_callback config_cb,
+		   uint64_t epoch = 0) {
+    std::unique_lock locker(lock);
+    _changed();
+    int ret = config.set_mon_vals(cct, values, obs_mgr, kv, config_cb, epoch);
+
+    rev_obs_map_t rev_obs;
+    _gather_changes(values.changed, &rev_obs, nullptr);
+
+    call_observers(locker, rev_obs);
+    return ret;
+  }
+  int set_mon_vals_delta(CephContext *cct, uint64_t prev_epoch,
+			 uint64_t epoch,
+			 const map<std::string,std::string>& changed,
+			 const std::set<std::string>& removed,
+			 md_config_t::config_callback config_cb) {
     std::unique_lock locker(lock);
-    int ret = config.set_mon_vals(cct, values, obs_mgr, kv, config_cb);
+    _changed();
+    int ret = config.set_mon_vals_delta(cct, values, obs_mgr, prev_epoch,
+					epoch, changed, removed, config_cb);
 
     rev_obs_map_t rev_obs;
     _gather_changes(values.changed, &rev_obs, nullptr);
@@ -277,6 +605,7 @@ public:
   }
   int injectargs(const std::string &s, std::ostream *oss) {
     std::unique_lock locker(lock);
+    _changed();
     int ret = config.injectargs(values, obs_mgr, s, oss);
 
     rev_obs_map_t rev_obs;
@@ -287,16 +616,41 @@ public:
   }
   void parse_env(unsigned entity_type, const char *env_var = "CEPH_ARGS") {
     std::lock_guard l{lock};
+    _changed();
     config.parse_env(entity_type, values, obs_mgr, env_var);
   }
+  void set_resource_defaults() {
+    std::lock_guard l{lock};
+    _changed();
+    config.set_resource_defaults(values, obs_mgr);
+  }
   int parse_argv(std::vector<const char*>& args, int level=CONF_CMDLINE) {
     std::lock_guard l{lock};
+    _changed();
     return config.parse_argv(values, obs_mgr, args, level);
   }
   int parse_config_files(const char *conf_files, std::ostream *warnings, int flags) {
     std::lock_guard l{lock};
+    _changed();
     return config.parse_config_files(values, obs_mgr, conf_files, warnings, flags);
   }
+  /// see md_config_t::reload_config_file(); observers are told of what
+  /// changed
+  int reload_config_file(std::ostream *warnings) {
+    std::unique_lock locker(lock);
+    _changed();
+    int ret = config.reload_config_file(values, obs_mgr, warnings);
+
+    rev_obs_map_t rev_obs;
+    _gather_changes(values.changed, &rev_obs, nullptr);
+
+    call_observers(locker, rev_obs);
+    return ret;
+  }
+  std::string get_conf_file_path() const {
+    std::shared_lock l{lock};
+    return config.get_conf_file_path();
+  }
   size_t num_parse_errors() const {
     return config.parse_errors.size();
   }
@@ -304,7 +658,7 @@ public:
     return config.complain_about_parse_errors(cct);
   }
   void do_argv_commands() const {
-    std::lock_guard l{lock};
+    std::shared_lock l{lock};
     config.do_argv_commands(values);
   }
   void get_config_bl(uint64_t have_version,
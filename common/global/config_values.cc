@@ -2,43 +2,230 @@
 #include "config_values.h"
 #include "config.h"
 
-ConfigValues::set_value_result_t
-ConfigValues::set_value(const std::string& key, Option::value_t&& new_value, int level)
-{  
-  if (auto p = values.find(key); p != values.end()) {
-    auto q = p->second.find(level);
-    if (q != p->second.end()) {
-      if (new_value == q->second) {
-        return SET_NO_CHANGE;
-      }
-      q->second = std::move(new_value);
-    } else {
-      p->second[level] = std::move(new_value);
+ConfigValue::ConfigValue(Option::value_t&& v)
+  : m_which(static_cast<which_t>(v.which()))
+{
+  switch (m_which) {
+  case BLANK:
+    break;
+  case UINT:
+    m_u.u = boost::get<uint64_t>(v);
+    break;
+  case INT:
+    m_u.i = boost::get<int64_t>(v);
+    break;
+  case FLOAT:
+    m_u.d = boost::get<double>(v);
+    break;
+  case BOOL:
+    m_u.b = boost::get<bool>(v);
+    break;
+  case SECS:
+    m_u.i = boost::get<std::chrono::seconds>(v).count();
+    break;
+  case SIZE:
+    m_u.u = boost::get<Option::size_t>(v).value;
+    break;
+  case LOGLEVEL:
+    m_u.level = boost::get<Option::log_level_t>(v);
+    break;
+  default:
+    m_u.boxed = new Boxed(std::move(v));
+    break;
+  }
+}
+
+Option::value_t ConfigValue::get() const
+{
+  switch (m_which) {
+  case BLANK:
+    return {};
+  case UINT:
+    return m_u.u;
+  case INT:
+    return m_u.i;
+  case FLOAT:
+    return m_u.d;
+  case BOOL:
+    return m_u.b;
+  case SECS:
+    return std::chrono::seconds(m_u.i);
+  case SIZE:
+    return Option::size_t{m_u.u};
+  case LOGLEVEL:
+    return m_u.level;
+  default:
+    return m_u.boxed->v;
+  }
+}
+
+bool ConfigValue::operator==(const Option::value_t& v) const
+{
+  if (static_cast<int>(m_which) != v.which()) {
+    return false;
+  }
+  switch (m_which) {
+  case BLANK:
+    return true;
+  case UINT:
+    return m_u.u == boost::get<uint64_t>(v);
+  case INT:
+    return m_u.i == boost::get<int64_t>(v);
+  case FLOAT:
+    return m_u.d == boost::get<double>(v);
+  case BOOL:
+    return m_u.b == boost::get<bool>(v);
+  case SECS:
+    return m_u.i == boost::get<std::chrono::seconds>(v).count();
+  case SIZE:
+    return m_u.u == boost::get<Option::size_t>(v).value;
+  case LOGLEVEL:
+    return m_u.level == boost::get<Option::log_level_t>(v);
+  default:
+    return m_u.boxed->v == v;
+  }
+}
+
+std::size_t ConfigValue::heap_bytes() const
+{
+  if (!_boxed()) {
+    return 0;
+  }
+  std::size_t n = sizeof(Boxed);
+  // a short string's text is in the string itself
+  if (auto s = boost::get<std::string>(&m_u.boxed->v);
+      s && s->capacity() > std::string().capacity()) {
+    n += s->capacity() + 1;
+  }
+  return n;
+}
+
+std::size_t ConfigValues::memory_bytes(std::size_t *set) const
+{
+  std::size_t n = values->capacity() * sizeof(values_t::value_type);
+  *set = 0;
+  for (auto& p : *values) {
+    if (!p) {
+      continue;
+    }
+    ++*set;
+    n += sizeof(levels_t) + p->capacity() * sizeof(levels_t::value_type);
+    for (auto& [level, v] : *p) {
+      n += v.heap_bytes();
     }
-    if (p->second.rbegin()->first > level) {
-      // there was a higher priority value; no effect
-      return SET_NO_EFFECT;
-    } else {
-      return SET_HAVE_EFFECT;
+  }
+  n += journal.size() * sizeof(decltype(journal)::value_type);
+  n += changed.bits.capacity() * sizeof(uint64_t);
+  return n;
+}
+
+void ConfigValues::set_schema(const option_index_t *s)
+{
+  if (s == schema) {
+    return;
+  }
+  // a copy of another ConfigProxy's values already has this layout
+  if (!schema || values->size() != s->size()) {
+    auto old = std::move(values);
+    values = std::make_shared<values_t>(s->size());
+    auto was_changed = std::move(changed.bits);
+    changed.bits.assign((s->size() + 63) / 64, 0);
+    changed.n = 0;
+    if (schema) {
+      for (std::size_t id = 0; id < old->size(); ++id) {
+	if (auto p = s->find(schema->nth(id)->first); p != s->end()) {
+	  (*values)[s->index_of(p)] = (*old)[id];
+	  if (was_changed[id / 64] & (uint64_t(1) << (id % 64))) {
+	    changed.insert(static_cast<OptionId>(s->index_of(p)));
+	  }
+	}
+      }
     }
+  }
+  schema = s;
+  changed.schema = s;
+  // the ids in the journal mean nothing now
+  ++version;
+  journal.clear();
+  journal_start = version;
+}
+
+void ConfigValues::_changed(OptionId id)
+{
+  journal.emplace_back(++version, id);
+  if (journal.size() > MAX_JOURNAL) {
+    journal_start = journal.front().first;
+    journal.pop_front();
+  }
+}
+
+ConfigValues::levels_t& ConfigValues::_mutable_levels(std::size_t id)
+{
+  if (values.use_count() > 1) {
+    values = std::make_shared<values_t>(*values);
+  }
+  auto& p = (*values)[id];
+  if (!p) {
+    p = std::make_shared<levels_t>();
+  } else if (p.use_count() > 1) {
+    p = std::make_shared<levels_t>(*p);
+  }
+  return *p;
+}
+
+OptionId ConfigValues::find_id(const std::string& key) const
+{
+  if (!schema) {
+    return OptionId::NONE;
+  }
+  auto p = schema->find(key);
+  if (p == schema->end()) {
+    return OptionId::NONE;
+  }
+  return static_cast<OptionId>(schema->index_of(p));
+}
+
+ConfigValues::set_value_result_t
+ConfigValues::set_value(const std::string& key, Option::value_t&& new_value, int level)
+{
+  return set_value(find_id(key), std::move(new_value), level);
+}
+
+ConfigValues::set_value_result_t
+ConfigValues::set_value(OptionId id, Option::value_t&& new_value, int level)
+{
+  if (id == OptionId::NONE) {
+    return SET_NO_CHANGE;
+  }
+  if (auto& levels = _levels(static_cast<std::size_t>(id));
+      levels.count(level) && levels.at(level) == new_value) {
+    return SET_NO_CHANGE;
+  }
+  auto& levels = _mutable_levels(static_cast<std::size_t>(id));
+  levels[level] = ConfigValue(std::move(new_value));
+  _changed(id);
+  if (levels.rbegin()->first > level) {
+    // there was a higher priority value; no effect
+    return SET_NO_EFFECT;
   } else {
-    values[key][level] = std::move(new_value);
     return SET_HAVE_EFFECT;
   }
 }
 
 int ConfigValues::rm_val(const std::string& key, int level)
 {
-  auto i = values.find(key);
-  if (i == values.end()) {
+  auto id = find_id(key);
+  if (id == OptionId::NONE) {
     return -ENOENT;
   }
-  auto j = i->second.find(level);
-  if (j == i->second.end()) {
+  if (!_levels(static_cast<std::size_t>(id)).count(level)) {
     return -ENOENT;
   }
-  bool matters = (j->first == i->second.rbegin()->first);
-  i->second.erase(j);
+  auto& levels = _mutable_levels(static_cast<std::size_t>(id));
+  auto j = levels.find(level);
+  bool matters = (j->first == levels.rbegin()->first);
+  levels.erase(j);
+  _changed(id);
   if (matters) {
     return SET_HAVE_EFFECT;
   } else {
@@ -49,33 +236,58 @@ int ConfigValues::rm_val(const std::string& key, int level)
 std::pair<Option::value_t, bool>
 ConfigValues::get_value(const std::string& name, int level) const
 {
-  auto p = values.find(name);
-  if (p != values.end() && !p->second.empty()) {
-    // use highest-priority value available (see CONF_*)
-    if (level < 0) {
-      return {p->second.rbegin()->second, true};
-    } else if (auto found = p->second.find(level);
-               found != p->second.end()) {
-      return {found->second, true};
+  return get_value(find_id(name), level);
+}
+
+std::pair<Option::value_t, bool>
+ConfigValues::get_value(OptionId id, int level) const
+{
+  if (id != OptionId::NONE) {
+    auto& levels = _levels(static_cast<std::size_t>(id));
+    if (!levels.empty()) {
+      // use highest-priority value available (see CONF_*)
+      if (level < 0) {
+	return {levels.rbegin()->second.get(), true};
+      } else if (auto found = levels.find(level); found != levels.end()) {
+	return {found->second.get(), true};
+      }
     }
   }
   return {Option::value_t{}, false};
 }
 
-void ConfigValues::set_logging(int which, const char* val)
+void ConfigValues::set_logging(int which, const Option::log_level_t& l)
+{
+  subsys.set_log_level(which, l.log);
+  subsys.set_gather_level(which, l.gather);
+}
+
+void ConfigValues::set_log_rate(int which, const char* val)
+{
+  unsigned rate, burst;
+  int r = sscanf(val, "%u/%u", &rate, &burst);
+  if (r >= 1) {
+    if (r < 2) {
+      burst = 0;
+    }
+    subsys.set_log_rate(which, rate, burst);
+  }
+}
+
+void ConfigValues::set_log_sample(int which, const char* val)
 {
-  int log, gather;
-  int r = sscanf(val, "%d/%d", &log, &gather);
+  unsigned every, level;
+  int r = sscanf(val, "%u/%u", &every, &level);
   if (r >= 1) {
     if (r < 2) {
-      gather = log;
+      level = 1;
     }
-    subsys.set_log_level(which, log);
-    subsys.set_gather_level(which, gather);
+    subsys.set_log_sample(which, every, level);
   }
 }
 
 bool ConfigValues::contains(const std::string& key) const
 {
-  return values.count(key);
+  auto id = find_id(key);
+  return id != OptionId::NONE && !_levels(static_cast<std::size_t>(id)).empty();
 }
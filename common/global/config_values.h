@@ -2,26 +2,236 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
+#include <boost/container/flat_map.hpp>
 
 #include "entity_name.h"
 #include "options.h"
 #include "common/logging/SubsystemMap.h"
 #include "common/uitls/msg_types.h"
 
+/// What ConfigValues stores for one setting: an Option::value_t in 16
+/// bytes.  Numbers, bools, durations and log levels are kept inline;
+/// strings, addresses and uuids in an immutable shared box, so that
+/// copying levels (as ConfigValues does when shared values change) only
+/// takes a reference.  Option::value_t is still what comes in and goes
+/// out.
+class ConfigValue {
+public:
+  ConfigValue() = default;
+  explicit ConfigValue(Option::value_t&& v);
+  ConfigValue(const ConfigValue& o) : m_which(o.m_which), m_u(o.m_u) {
+    if (_boxed()) {
+      m_u.boxed->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  ConfigValue(ConfigValue&& o) noexcept : m_which(o.m_which), m_u(o.m_u) {
+    o.m_which = BLANK;
+  }
+  ConfigValue& operator=(const ConfigValue& o) {
+    ConfigValue(o).swap(*this);
+    return *this;
+  }
+  ConfigValue& operator=(ConfigValue&& o) noexcept {
+    ConfigValue(std::move(o)).swap(*this);
+    return *this;
+  }
+  ~ConfigValue() {
+    if (_boxed() &&
+	m_u.boxed->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete m_u.boxed;
+    }
+  }
+
+  void swap(ConfigValue& o) noexcept {
+    std::swap(m_which, o.m_which);
+    std::swap(m_u, o.m_u);
+  }
+
+  Option::value_t get() const;
+  operator Option::value_t() const {
+    return get();
+  }
+
+  /// what the value keeps off the object: its box, and a string's text
+  std::size_t heap_bytes() const;
+
+  /// as Option::value_t compares, without making a ConfigValue of v
+  bool operator==(const Option::value_t& v) const;
+  bool operator!=(const Option::value_t& v) const {
+    return !(*this == v);
+  }
+
+private:
+  // Option::value_t::which() of what is held
+  enum which_t : uint8_t {
+    BLANK = 0, STRING, UINT, INT, FLOAT, BOOL, ADDR, ADDRVEC, SECS, SIZE,
+    UUID, LOGLEVEL,
+  };
+  struct Boxed {
+    explicit Boxed(Option::value_t&& v) : v(std::move(v)) {}
+    std::atomic<uint32_t> refs{1};
+    const Option::value_t v;
+  };
+  union value_u {
+    uint64_t u;
+    int64_t i;
+    double d;
+    bool b;
+    Option::log_level_t level;
+    Boxed *boxed;
+  };
+
+  bool _boxed() const {
+    return m_which == STRING || m_which == ADDR || m_which == ADDRVEC ||
+      m_which == UUID;
+  }
+
+  which_t m_which = BLANK;
+  value_u m_u{0};
+};
+static_assert(sizeof(ConfigValue) == 16);
+
+/// A set of options as a bit per OptionId, so that marking one changed
+/// allocates nothing; iterating it yields their names in schema order
+class changed_set_t {
+public:
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+    reference operator*() const {
+      return set->schema->nth(id)->second.get().name;
+    }
+    pointer operator->() const {
+      return &**this;
+    }
+    const_iterator& operator++() {
+      id = set->_next(id + 1);
+      return *this;
+    }
+    const_iterator operator++(int) {
+      auto i = *this;
+      ++*this;
+      return i;
+    }
+    OptionId get_id() const {
+      return static_cast<OptionId>(id);
+    }
+    bool operator==(const const_iterator& o) const {
+      return id == o.id;
+    }
+    bool operator!=(const const_iterator& o) const {
+      return id != o.id;
+    }
+  private:
+    friend class changed_set_t;
+    const_iterator(const changed_set_t *set, std::size_t id)
+      : set(set), id(id) {}
+    const changed_set_t *set;
+    std::size_t id;
+  };
+
+  void insert(OptionId id) {
+    const auto i = static_cast<std::size_t>(id);
+    auto& w = bits[i / 64];
+    const uint64_t b = uint64_t(1) << (i % 64);
+    n += !(w & b);
+    w |= b;
+  }
+  bool count(OptionId id) const {
+    const auto i = static_cast<std::size_t>(id);
+    return i / 64 < bits.size() && bits[i / 64] & (uint64_t(1) << (i % 64));
+  }
+  bool empty() const {
+    return n == 0;
+  }
+  std::size_t size() const {
+    return n;
+  }
+  void clear() {
+    if (n) {
+      std::fill(bits.begin(), bits.end(), 0);
+      n = 0;
+    }
+  }
+  const_iterator begin() const {
+    return {this, _next(0)};
+  }
+  const_iterator end() const {
+    return {this, _end()};
+  }
+
+private:
+  friend class ConfigValues;
+  std::size_t _end() const {
+    return bits.size() * 64;
+  }
+  /// the first id from i on that is set, or _end()
+  std::size_t _next(std::size_t i) const {
+    for (std::size_t w = i / 64; w < bits.size(); ++w) {
+      uint64_t b = bits[w];
+      if (w == i / 64) {
+	b &= ~uint64_t(0) << (i % 64);
+      }
+      if (b) {
+	return w * 64 + __builtin_ctzll(b);
+      }
+    }
+    return _end();
+  }
+
+  const option_index_t *schema = nullptr;
+  std::vector<uint64_t> bits;
+  std::size_t n = 0;
+};
+
 // @c ConfigValues keeps track of mappings from the config names to their values,
 // debug logging settings, and some other "unnamed" settings, like entity name of
 // the daemon.
 class ConfigValues {
-  using values_t = std::map<std::string, map<int32_t,Option::value_t>>;
-  values_t values;
+  // the values set for one option, by level (CONF_*)
+  using levels_t = boost::container::flat_map<int32_t, ConfigValue>;
+  using values_t = std::vector<std::shared_ptr<levels_t>>;
+  // by OptionId, so that once an option's id is known finding its values
+  // is indexing a vector; options nothing was set for are null.  Copies
+  // of a ConfigValues share all of it, and whichever changes an option
+  // first copies the vector and just that option's levels
+  std::shared_ptr<values_t> values = std::make_shared<values_t>();
+  const option_index_t *schema = nullptr;
+  uint64_t version = 1; ///< bumped whenever a value is set or removed
+  /// (version, id) of each value set or removed after journal_start,
+  /// oldest first, so that what changed since some version can be found
+  /// without looking at every option; bounded, by dropping the oldest
+  std::deque<std::pair<uint64_t, OptionId>> journal;
+  uint64_t journal_start = 1;
+  static constexpr std::size_t MAX_JOURNAL = 1024;
   // for populating md_config_impl::legacy_values in ctor
   friend struct md_config_t;
 
+  OptionId find_id(const std::string& key) const;
+  void _changed(OptionId id);
+  const levels_t& _levels(std::size_t id) const {
+    static const levels_t none;
+    auto& p = (*values)[id];
+    return p ? *p : none;
+  }
+  levels_t& _mutable_levels(std::size_t id);
+
 public:
   EntityName name;
   /// cluster name
@@ -30,7 +240,6 @@ public:
   bool no_mon_config = false;
   // Set of configuration options that have changed since the last
   // apply_changes
-  using changed_set_t = std::set<std::string>;
   changed_set_t changed;
 
 // This macro block defines C members of the md_config_t struct
@@ -50,12 +259,47 @@ public:
 #define OPTION_OPT_U64(name) uint64_t name;
 #define OPTION_OPT_UUID(name) uuid_d name;
 #define OPTION_OPT_SIZE(name) size_t name;
+
+// The HOT_OPTION ones first, from the start of a cache line: the eight
+// byte ones and then the bools, so that they take a few lines between
+// them rather than each sharing one with colder members.
+#define HOT_OPTION_WIDE_OPT_INT(name) int64_t name;
+#define HOT_OPTION_WIDE_OPT_LONGLONG(name) int64_t name;
+#define HOT_OPTION_WIDE_OPT_DOUBLE(name) double name;
+#define HOT_OPTION_WIDE_OPT_FLOAT(name) double name;
+#define HOT_OPTION_WIDE_OPT_BOOL(name)
+#define HOT_OPTION_WIDE_OPT_U32(name) uint64_t name;
+#define HOT_OPTION_WIDE_OPT_U64(name) uint64_t name;
+#define HOT_OPTION_WIDE_OPT_SIZE(name) size_t name;
+#define OPTION(name, ty)
+#define SAFE_OPTION(name, ty)
+#define HOT_OPTION(name, ty) HOT_OPTION_WIDE_##ty(name)
+public:
+  alignas(64) bool _hot_options_begin = false;
+#include "common/legacy_config_opts.h"
+#undef HOT_OPTION
+#define HOT_OPTION(name, ty) HOT_OPTION_NARROW_##ty(name)
+#define HOT_OPTION_NARROW_OPT_INT(name)
+#define HOT_OPTION_NARROW_OPT_LONGLONG(name)
+#define HOT_OPTION_NARROW_OPT_DOUBLE(name)
+#define HOT_OPTION_NARROW_OPT_FLOAT(name)
+#define HOT_OPTION_NARROW_OPT_BOOL(name) bool name;
+#define HOT_OPTION_NARROW_OPT_U32(name)
+#define HOT_OPTION_NARROW_OPT_U64(name)
+#define HOT_OPTION_NARROW_OPT_SIZE(name)
+#include "common/legacy_config_opts.h"
+#undef OPTION
+#undef SAFE_OPTION
+#undef HOT_OPTION
+
+// and the rest, in the order they are declared
 #define OPTION(name, ty)       \
   public:                      \
     OPTION_##ty(name)          
 #define SAFE_OPTION(name, ty)       \
   protected:                        \
     OPTION_##ty(name)               
+#define HOT_OPTION(name, ty)
 #include "common/legacy_config_opts.h"
 #undef OPTION_OPT_INT
 #undef OPTION_OPT_LONGLONG
@@ -70,6 +314,23 @@ public:
 #undef OPTION_OPT_UUID
 #undef OPTION
 #undef SAFE_OPTION
+#undef HOT_OPTION
+#undef HOT_OPTION_WIDE_OPT_INT
+#undef HOT_OPTION_WIDE_OPT_LONGLONG
+#undef HOT_OPTION_WIDE_OPT_DOUBLE
+#undef HOT_OPTION_WIDE_OPT_FLOAT
+#undef HOT_OPTION_WIDE_OPT_BOOL
+#undef HOT_OPTION_WIDE_OPT_U32
+#undef HOT_OPTION_WIDE_OPT_U64
+#undef HOT_OPTION_WIDE_OPT_SIZE
+#undef HOT_OPTION_NARROW_OPT_INT
+#undef HOT_OPTION_NARROW_OPT_LONGLONG
+#undef HOT_OPTION_NARROW_OPT_DOUBLE
+#undef HOT_OPTION_NARROW_OPT_FLOAT
+#undef HOT_OPTION_NARROW_OPT_BOOL
+#undef HOT_OPTION_NARROW_OPT_U32
+#undef HOT_OPTION_NARROW_OPT_U64
+#undef HOT_OPTION_NARROW_OPT_SIZE
 
 public:
   enum set_value_result_t {
@@ -77,23 +338,56 @@ public:
     SET_NO_EFFECT,
     SET_HAVE_EFFECT,
   };
+  /// lay the values out by the OptionIds of schema; md_config_t calls this
+  /// before setting anything
+  void set_schema(const option_index_t *schema);
+
   /**
    * @return true if changed, false otherwise
    */
   set_value_result_t set_value(const std::string& key, Option::value_t&& value, int level);
+  set_value_result_t set_value(OptionId id, Option::value_t&& value, int level);
   
   int rm_val(const std::string& key, int level);
-  void set_logging(int which, const char* val);
+  void set_logging(int which, const Option::log_level_t& l);
+  void set_log_rate(int which, const char* val);
+  void set_log_sample(int which, const char* val);
   /**
    * @param level the level of the setting, -1 for the one with the 
    *              highest-priority
    */
   std::pair<Option::value_t, bool> get_value(const std::string& name, int level) const;
+  std::pair<Option::value_t, bool> get_value(OptionId id, int level) const;
 
+  /// func(name, levels) for every option any value is set for
   template<typename Func> void for_each(Func&& func) const {
-    for (const auto& [name,configs] : values) {
-      func(name, configs);
+    for (std::size_t id = 0; id < values->size(); ++id) {
+      if (auto& p = (*values)[id]; p && !p->empty()) {
+	func(schema->nth(id)->second.get().name, std::as_const(*p));
+      }
     }
   }
   bool contains(const std::string& key) const;
+  /// the memory the values take, what copies share counted as this one's;
+  /// set is the options any value is set for
+  std::size_t memory_bytes(std::size_t *set) const;
+  uint64_t get_version() const {
+    return version;
+  }
+  /// func(id) for every option set or removed since get_version() returned
+  /// seq, possibly more than once; false, calling nothing, if the journal
+  /// no longer reaches back that far
+  template<typename Func> bool for_each_changed_since(uint64_t seq,
+						      Func&& func) const {
+    if (seq < journal_start) {
+      return false;
+    }
+    auto p = std::upper_bound(
+      journal.begin(), journal.end(), seq,
+      [](uint64_t s, const auto& e) { return s < e.first; });
+    for (; p != journal.end(); ++p) {
+      func(p->second);
+    }
+    return true;
+  }
 };
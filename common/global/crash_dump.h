@@ -0,0 +1,65 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_GLOBAL_CRASH_DUMP_H
+#define CEPH_GLOBAL_CRASH_DUMP_H
+
+#include <cstdint>
+
+/* Layout of the raw dump a fatal signal handler leaves in a crash_dir entry
+ * when crash_dump_raw is set, for ceph-crash-symbolize to turn into the
+ * usual meta file later.
+ *
+ * A header, then sections, each a section header and len bytes of payload
+ * padded to a multiple of 8.  Fields are in host byte order; the dump is
+ * only meant to be read on the host (or at least the architecture) that
+ * wrote it.  A reader skips sections it doesn't know.
+ */
+namespace ceph::crash_dump {
+
+constexpr uint64_t MAGIC = 0x504d554448535243; // "CRSHDUMP"
+constexpr uint32_t VERSION = 1;
+
+struct header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  int64_t pid;
+  int64_t tid;          ///< the thread that took the signal
+  int32_t signum;
+  int32_t si_code;
+  uint64_t fault_addr;  ///< si_addr
+  uint64_t stamp;       ///< nanoseconds since the epoch
+  char machine[32];     ///< utsname machine, for REGISTERS
+  uint8_t reserved[40];
+};
+static_assert(sizeof(header) == 128, "on-disk layout must not change");
+
+enum section_type : uint32_t {
+  /// the members of the meta file's crash object, as JSON text without the
+  /// braces or the backtrace
+  SECTION_META = 1,
+  /// uint64_t return addresses, innermost first
+  SECTION_FRAMES = 2,
+  /// the mcontext_t of the signal frame
+  SECTION_REGISTERS = 3,
+  /// a uint64_t start address, then the raw stack from there up
+  SECTION_STACK = 4,
+  /// int32_t thread ids
+  SECTION_THREADS = 5,
+  /// /proc/self/maps
+  SECTION_MAPS = 6,
+  /// the log_recent_file holding the recent log ring
+  SECTION_RECENT_FILE = 7,
+};
+
+struct section {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t len;
+};
+static_assert(sizeof(section) == 16, "on-disk layout must not change");
+
+}
+
+#endif
@@ -13,6 +13,7 @@
  */
 
 #include "common/entity_name.h"
+#include <string.h>
 #include <sstream>
 
 using std::string;
@@ -38,37 +39,41 @@ const char* EntityName::to_cstr() const
   return type_id.c_str();
 }
 
-bool EntityName::from_str(const string& s)
+bool EntityName::from_str(std::string_view s)
 {
   size_t pos = s.find('.');
 
-  if (pos == string::npos)
+  if (pos == std::string_view::npos)
     return false;
- 
-  string type_ = s.substr(0, pos);
-  string id_ = s.substr(pos + 1);
-  if (set(type_, id_))
+
+  if (set(s.substr(0, pos), s.substr(pos + 1)))
     return false;
   return true;
 }
 
-void EntityName::set(uint32_t type_, const std::string &id_)
+void EntityName::update_type_id()
 {
-  type = type_;
-  id = id_;
-
   if (type) {
-    std::ostringstream oss;
-    oss << ceph_entity_type_name(type_) << "." << id_;
-    type_id = oss.str();
+    const char *t = ceph_entity_type_name(type);
+    const size_t tlen = strlen(t);
+    type_id.clear();
+    type_id.reserve(tlen + 1 + id.size());
+    type_id.append(t, tlen).append(1, '.').append(id);
   } else {
     type_id.clear();
   }
 }
 
-int EntityName::set(const std::string &type_, const std::string &id_)
+void EntityName::set(uint32_t type_, std::string_view id_)
+{
+  type = type_;
+  id.assign(id_);
+  update_type_id();
+}
+
+int EntityName::set(std::string_view type_, std::string_view id_)
 {
-  uint32_t t = str_to_ceph_entity_type(type_.c_str());
+  uint32_t t = str_to_ceph_entity_type(type_);
   if (t == CEPH_ENTITY_TYPE_ANY)
     return -EINVAL;
   set(t, id_);
@@ -77,24 +82,30 @@ int EntityName::set(const std::string &type_, const std::string &id_)
 
 void EntityName::set_type(uint32_t type_)
 {
-  set(type_, id);
+  type = type_;
+  update_type_id();
 }
 
 int EntityName::set_type(const char *type_)
 {
-  return set(type_, id);
+  uint32_t t = str_to_ceph_entity_type(type_);
+  if (t == CEPH_ENTITY_TYPE_ANY)
+    return -EINVAL;
+  set_type(t);
+  return 0;
 }
 
-void EntityName::set_id(const std::string &id_)
+void EntityName::set_id(std::string_view id_)
 {
-  set(type, id_);
+  id.assign(id_);
+  update_type_id();
 }
 
 void EntityName::set_name(entity_name_t n)
 {
   char s[40];
-  sprintf(s, "%lld", (long long)n.num());
-  set(n.type(), s);
+  int len = snprintf(s, sizeof(s), "%lld", (long long)n.num());
+  set(n.type(), std::string_view(s, len));
 }
 
 const char* EntityName::get_type_str() const
@@ -16,6 +16,7 @@
 #define CEPH_COMMON_ENTITY_NAME_H
 
 #include <ifaddrs.h>
+#include <string_view>
 #include "common/utils/types.h"
 
 /* Represents a Ceph entity name.
@@ -36,17 +37,20 @@ struct EntityName
     std::string id_;
     decode(type_, bl);
     decode(id_, bl);
-    set(type_, id_);
+    type = type_;
+    id = std::move(id_);
+    update_type_id();
   }
 
+  /// "type.id", made when the name is set rather than on each call
   const std::string& to_str() const;
   const char *to_cstr() const;
-  bool from_str(const std::string& s);
-  void set(uint32_t type_, const std::string &id_);
-  int set(const std::string &type_, const std::string &id_);
+  bool from_str(std::string_view s);
+  void set(uint32_t type_, std::string_view id_);
+  int set(std::string_view type_, std::string_view id_);
   void set_type(uint32_t type_);
   int set_type(const char *type);
-  void set_id(const std::string &id_);
+  void set_id(std::string_view id_);
   void set_name(entity_name_t n);
 
   const char* get_type_str() const;
@@ -75,6 +79,8 @@ private:
   };
   static const std::array<str_to_entity_type_t, 6> STR_TO_ENTITY_TYPE;
 
+  void update_type_id();
+
   uint32_t type = 0;
   std::string id;
   std::string type_id;
@@ -13,11 +13,15 @@
  */
 
 #include "common/ceph_argparse.h"
+#include "common/ceph_time.h"
 #include "common/code_environment.h"
 #include "common/config.h"
+#include "common/config_proxy.h"
 #include "common/debug.h"
 #include "common/errno.h"
+#include "common/safe_io.h"
 #include "common/signal.h"
+#include "common/startup_trace.h"
 #include "common/version.h"
 #include "global_context.h"
 #include "global_init.h"
@@ -30,6 +34,13 @@
 #include <pwd.h>
 #include <grp.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #ifdef HAVE_SYS_PRCTL_H
 #include <sys/prctl.h>
@@ -38,6 +49,15 @@
 #define dout_context g_ceph_context
 #define dout_subsys ceph_subsys_
 
+/// global_init()'s steps, which are recorded from one mark to the next
+static ceph::mono_time startup_last;
+static void startup_mark(const char *phase)
+{
+  auto now = ceph::mono_clock::now();
+  ceph::startup_trace::add(phase, startup_last, now);
+  startup_last = now;
+}
+
 static void global_init_set_globals(CephContext *cct)
 {
   g_ceph_context = cct;
@@ -87,6 +107,8 @@ void global_pre_init(const std::map<std::string,std::string> *defaults,
   std::string conf_file_list;
   std::string cluster = "";
 
+  ceph::startup_trace::phase trace("global_pre_init");
+
   // ensure environment arguments are included in early processing
   env_to_vec(args);
 
@@ -139,9 +161,11 @@ void global_pre_init(const std::map<std::string,std::string> *defaults,
   // command line (as passed by caller)
   conf.parse_argv(args);
 
-  if (!cct->_log->is_started()) {
-    cct->_log->start();
-  }
+  // defaults to suit the size of the host or container, now that
+  // log_auto_size can have been turned off
+  conf.set_resource_defaults();
+
+  common_start_log(cct);
 
   // do the --show-config[-val], if present in argv
   conf.do_argv_commands();
@@ -155,6 +179,7 @@ global_init(const std::map<std::string,std::string> *defaults,
 	    std::vector < const char* >& args,
 	    uint32_t module_type, code_environment_t code_env, int flags, bool run_pre_init)
 {
+  ceph::startup_trace::phase trace("global_init");
   // Ensure we're not calling the global init functions multiple times.
   static bool first_run = true;
   if (run_pre_init) {
@@ -166,6 +191,7 @@ global_init(const std::map<std::string,std::string> *defaults,
     ceph_assert(g_ceph_context && first_run);
   }
   first_run = false;
+  startup_last = ceph::mono_clock::now();
 
   // Verify flags have not changed if global_pre_init() has been called
   // manually. If they have, update them.
@@ -181,6 +207,7 @@ global_init(const std::map<std::string,std::string> *defaults,
     install_standard_sighandlers();
   }
   register_assert_context(g_ceph_context);
+  startup_mark("signal_handlers");
 
   if (g_conf()->log_flush_on_exit)
     g_ceph_context->_log->set_flush_on_exit();
@@ -314,6 +341,7 @@ global_init(const std::map<std::string,std::string> *defaults,
   // fork() syscall also matters, so daemonization won't work in case
   // of rdma.
   //
+  startup_mark("privileges");
   if (!g_conf()->no_mon_config) {
     // make sure our mini-session gets legacy values
     g_conf().apply_changes(nullptr);
@@ -325,6 +353,7 @@ global_init(const std::map<std::string,std::string> *defaults,
 	   << std::endl;
       _exit(1);
     }
+    startup_mark("mon_config");
   }
 
   // Expand metavariables. Invoke configuration observers. Open log file.
@@ -342,6 +371,7 @@ global_init(const std::map<std::string,std::string> *defaults,
   // call all observers now.  this has the side-effect of configuring
   // and opening the log file immediately.
   g_conf().call_all_observers();
+  startup_mark("observers");
 
   if (priv_ss.str().length()) {
     dout(0) << priv_ss.str() << dendl;
@@ -378,6 +408,7 @@ global_init(const std::map<std::string,std::string> *defaults,
     cerr << " failed to init_on_startup : " << cpp_strerror(errno) << std::endl;
     exit(1);
   }
+  startup_mark("crush_location");
 
   return boost::intrusive_ptr<CephContext>{g_ceph_context, false};
 }
@@ -418,7 +449,9 @@ int global_init_prefork(CephContext *cct)
   }
 
   cct->notify_pre_fork();
-  // stop log thread
+  // stop log thread.  The parent exits straight from daemon(), so what is
+  // queued from here on is left for the child to write once it starts again
+  // (see Log::prepare_fork()).
   cct->_log->flush();
   cct->_log->stop();
   return 0;
@@ -475,6 +508,10 @@ void global_init_postfork_start(CephContext *cct)
 
   // restart log thread
   cct->_log->start();
+  // and the coarse clock page's, which the fork left behind
+  if (cct->_conf.get_val<bool>("coarse_clock_page")) {
+    ceph::start_coarse_clock_page();
+  }
   cct->notify_post_fork();
 
   /* This is the old trick where we make file descriptors 0, 1, and possibly 2
@@ -542,3 +579,304 @@ int global_init_shutdown_stderr(CephContext *cct)
   cct->_log->set_stderr_level(l, l);
   return 0;
 }
+
+/// the most a zygote request may carry, its args NUL-terminated end to end
+static constexpr uint32_t ZYGOTE_MAX_REQUEST = 1 << 20;
+
+/// in a zygote's child, the args it was asked to run with
+static std::vector<std::string> zygote_args;
+
+static int zygote_address(const char *path, struct sockaddr_un *sa)
+{
+  memset(sa, 0, sizeof(*sa));
+  if (strlen(path) >= sizeof(sa->sun_path)) {
+    return -ENAMETOOLONG;
+  }
+  sa->sun_family = AF_UNIX;
+  strcpy(sa->sun_path, path);
+  return 0;
+}
+
+/// listen on path, a socket only our own uid may connect to (and the
+/// connections are checked for it too, see zygote_peer_ok())
+static int zygote_listen(const char *path)
+{
+  struct sockaddr_un sa;
+  int r = zygote_address(path, &sa);
+  if (r < 0) {
+    return r;
+  }
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -errno;
+  }
+  ::unlink(path);
+  // made 0600 from the start, so there is no moment anyone else may
+  // connect, and chmod() to leave no doubt about it
+  const mode_t old_umask = ::umask(0077);
+  r = ::bind(fd, (struct sockaddr*)&sa, sizeof(sa));
+  ::umask(old_umask);
+  if (r < 0 || ::chmod(path, 0600) < 0 || ::listen(fd, 128) < 0) {
+    r = -errno;
+    VOID_TEMP_FAILURE_RETRY(close(fd));
+    return r;
+  }
+  return fd;
+}
+
+/// the process at the other end of conn runs as our uid; anyone else could
+/// have us fork a daemon with the args and fds they choose
+static bool zygote_peer_ok(int conn)
+{
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (::getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+      len != sizeof(cred)) {
+    return false;
+  }
+  return cred.uid == ::geteuid();
+}
+
+/// read a request from conn: the args, and the fds for the child's stdin,
+/// stdout and stderr, sent along with the length that leads them
+static int zygote_read_request(int conn, std::vector<std::string> *args,
+			       int fds[3])
+{
+  uint32_t len = 0;
+  char control[CMSG_SPACE(sizeof(int) * 3)];
+  struct iovec iov = {&len, sizeof(len)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n = ::recvmsg(conn, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  if (n < 0) {
+    return -errno;
+  }
+  std::vector<int> received;
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+      const int *p = (const int*)CMSG_DATA(c);
+      received.insert(received.end(), p,
+		      p + (c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    }
+  }
+  int r = 0;
+  if (n != sizeof(len) || received.size() != 3 ||
+      (msg.msg_flags & MSG_CTRUNC) || len > ZYGOTE_MAX_REQUEST) {
+    r = -EINVAL;
+  } else {
+    std::string buf(len, '\0');
+    r = safe_read_exact(conn, buf.data(), len);
+    for (std::size_t p = 0; r == 0 && p < len; ) {
+      std::size_t end = buf.find('\0', p);
+      if (end == std::string::npos) {
+	r = -EINVAL;
+	break;
+      }
+      args->emplace_back(buf, p, end - p);
+      p = end + 1;
+    }
+  }
+  if (r < 0) {
+    for (int fd : received) {
+      VOID_TEMP_FAILURE_RETRY(close(fd));
+    }
+    return r;
+  }
+  std::copy(received.begin(), received.end(), fds);
+  return 0;
+}
+
+void global_init_zygote(const char *socket_path,
+			std::vector<const char*>& args)
+{
+  {
+    // what every child would otherwise build for itself: the option
+    // table, which the config makes its schema from, and the allocator and
+    // lazily made statics the config warms on its way
+    ceph::startup_trace::phase trace("zygote_warm");
+    get_ceph_options();
+    ConfigProxy warm{true};
+  }
+
+  int listen_fd = zygote_listen(socket_path);
+  if (listen_fd < 0) {
+    cerr << "global_init_zygote: unable to listen on " << socket_path
+	 << ": " << cpp_strerror(listen_fd) << std::endl;
+    exit(1);
+  }
+  // children are reaped, and their status sent on, from the poll loop
+  sigset_t chld, old;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &old);
+  int sig_fd = signalfd(-1, &chld, SFD_CLOEXEC);
+  if (sig_fd < 0) {
+    cerr << "global_init_zygote: signalfd failed: " << cpp_strerror(errno)
+	 << std::endl;
+    exit(1);
+  }
+  std::map<pid_t, int> children;  ///< to the socket of who asked for it
+
+  while (true) {
+    struct pollfd pfd[2] = {{listen_fd, POLLIN, 0}, {sig_fd, POLLIN, 0}};
+    if (poll(pfd, 2, -1) < 0) {
+      continue;
+    }
+    if (pfd[1].revents & POLLIN) {
+      struct signalfd_siginfo si;
+      (void)!::read(sig_fd, &si, sizeof(si));
+      int status;
+      pid_t pid;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+	auto p = children.find(pid);
+	if (p != children.end()) {
+	  int32_t s = status;
+	  (void)!::send(p->second, &s, sizeof(s), MSG_NOSIGNAL);
+	  VOID_TEMP_FAILURE_RETRY(close(p->second));
+	  children.erase(p);
+	}
+      }
+    }
+    if (!(pfd[0].revents & POLLIN)) {
+      continue;
+    }
+    int conn = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0) {
+      continue;
+    }
+    if (!zygote_peer_ok(conn)) {
+      int32_t reply = -EPERM;
+      (void)!::send(conn, &reply, sizeof(reply), MSG_NOSIGNAL);
+      VOID_TEMP_FAILURE_RETRY(close(conn));
+      continue;
+    }
+    // a launcher that stalls mid-request holds up the others only so long
+    struct timeval tv = {5, 0};
+    ::setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::vector<std::string> request;
+    int fds[3];
+    int r = zygote_read_request(conn, &request, fds);
+    if (r < 0) {
+      int32_t reply = r;
+      (void)!::send(conn, &reply, sizeof(reply), MSG_NOSIGNAL);
+      VOID_TEMP_FAILURE_RETRY(close(conn));
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      // the launcher's daemon from here on
+      VOID_TEMP_FAILURE_RETRY(close(listen_fd));
+      VOID_TEMP_FAILURE_RETRY(close(sig_fd));
+      VOID_TEMP_FAILURE_RETRY(close(conn));
+      for (const auto& [child, c] : children) {
+	VOID_TEMP_FAILURE_RETRY(close(c));
+      }
+      sigprocmask(SIG_SETMASK, &old, nullptr);
+      // out of the way of 0-2 first, in case any of them is one
+      for (int& fd : fds) {
+	int high = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+	VOID_TEMP_FAILURE_RETRY(close(fd));
+	fd = high;
+      }
+      for (int i = 0; i < 3; ++i) {
+	if (fds[i] < 0 || dup2(fds[i], i) < 0) {
+	  _exit(1);
+	}
+	VOID_TEMP_FAILURE_RETRY(close(fds[i]));
+      }
+      zygote_args = std::move(request);
+      args.clear();
+      for (const auto& a : zygote_args) {
+	args.push_back(a.c_str());
+      }
+      return;
+    }
+
+    for (int fd : fds) {
+      VOID_TEMP_FAILURE_RETRY(close(fd));
+    }
+    int32_t reply = pid < 0 ? -errno : pid;
+    (void)!::send(conn, &reply, sizeof(reply), MSG_NOSIGNAL);
+    if (pid < 0) {
+      VOID_TEMP_FAILURE_RETRY(close(conn));
+    } else {
+      children[pid] = conn;
+    }
+  }
+}
+
+int global_zygote_spawn(const char *socket_path,
+			const std::vector<const char*>& args, pid_t *pid)
+{
+  struct sockaddr_un sa;
+  int r = zygote_address(socket_path, &sa);
+  if (r < 0) {
+    return r;
+  }
+  std::string payload;
+  for (const char *a : args) {
+    payload.append(a);
+    payload.push_back('\0');
+  }
+  if (payload.size() > ZYGOTE_MAX_REQUEST) {
+    return -E2BIG;
+  }
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -errno;
+  }
+  if (::connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+    r = -errno;
+    VOID_TEMP_FAILURE_RETRY(close(fd));
+    return r;
+  }
+
+  uint32_t len = payload.size();
+  const int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  struct iovec iov = {&len, sizeof(len)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+  int32_t reply = 0;
+  ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+  if (n < 0) {
+    r = -errno;
+  } else if (n != sizeof(len)) {
+    r = -EIO;
+  }
+  // send(), not safe_write(): a zygote gone away is an error, not SIGPIPE
+  for (std::size_t off = 0; r == 0 && off < payload.size(); ) {
+    n = ::send(fd, payload.data() + off, payload.size() - off, MSG_NOSIGNAL);
+    if (n < 0 && errno != EINTR) {
+      r = -errno;
+    } else if (n > 0) {
+      off += n;
+    }
+  }
+  if (r == 0 && (r = safe_read_exact(fd, &reply, sizeof(reply))) == 0 &&
+      reply < 0) {
+    r = reply;
+  }
+  if (r < 0) {
+    VOID_TEMP_FAILURE_RETRY(close(fd));
+    return r;
+  }
+  *pid = reply;
+  return fd;
+}
@@ -16,6 +16,7 @@
 #define CEPH_COMMON_GLOBAL_INIT_H
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <vector>
 #include <map>
 #include <boost/intrusive_ptr.hpp>
@@ -92,6 +93,37 @@ void global_init_chdir(const CephContext *cct);
 int global_init_shutdown_stderr(CephContext *cct);
 
 
+/*
+ * global_init_zygote makes this process a template for daemons started
+ * later.  It does the startup work that doesn't depend on a daemon's name
+ * or arguments, so every child shares it: the dynamic linking and static
+ * constructors an exec would repeat, and building the option table and a
+ * config with it.  Then it serves socket_path, forking a child for each
+ * global_zygote_spawn() from a launcher.  The socket is mode 0600, and a
+ * launcher running as any uid other than the template's is refused
+ * (-EPERM), since a child runs with the launcher's args and the
+ * template's uid.
+ *
+ * It returns only in a child, with args replaced by the request's and
+ * stdin, stdout and stderr by the launcher's; the child goes on to
+ * global_init() as if it had been exec'd with those args, but with the
+ * template's environment and working directory.  The template serves until
+ * it is killed; its children outlive it.
+ *
+ * Call it first thing in main(), while the process has one thread.
+ */
+void global_init_zygote(const char *socket_path,
+			std::vector<const char*>& args);
+
+/*
+ * ask the template at socket_path for a daemon run with args (without
+ * argv[0]) and this process' stdin, stdout and stderr.  Returns a socket
+ * to read the child's wait status from, an int, once it exits, and sets
+ * *pid; or -errno.
+ */
+int global_zygote_spawn(const char *socket_path,
+			const std::vector<const char*>& args, pid_t *pid);
+
 /**
  * print daemon startup banner/warning
  */
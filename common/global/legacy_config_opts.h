@@ -13,13 +13,17 @@
  */
 
 /* note: no header guard */
+
+/* HOT_OPTION marks the options read on every message or op; ConfigValues
+ * packs those members together ahead of the rest.  Only numbers and bools
+ * can be hot. */
 OPTION(host, OPT_STR) // "" means that ceph will use short hostname
 OPTION(public_addr, OPT_ADDR)
 OPTION(public_bind_addr, OPT_ADDR)
 OPTION(cluster_addr, OPT_ADDR)
 OPTION(public_network, OPT_STR)
 OPTION(cluster_network, OPT_STR)
-OPTION(lockdep, OPT_BOOL)
+HOT_OPTION(lockdep, OPT_BOOL)
 OPTION(lockdep_force_backtrace, OPT_BOOL) // always gather current backtrace at every lock
 OPTION(run_dir, OPT_STR)       // the "/var/run/ceph" dir, created on daemon startup
 OPTION(admin_socket, OPT_STR) // default changed by common_preinit()
@@ -123,13 +127,13 @@ OPTION(ms_tcp_rcvbuf, OPT_INT)
 OPTION(ms_tcp_prefetch_max_size, OPT_U32) // max prefetch size, we limit this to avoid extra memcpy
 OPTION(ms_initial_backoff, OPT_DOUBLE)
 OPTION(ms_max_backoff, OPT_DOUBLE)
-OPTION(ms_crc_data, OPT_BOOL)
-OPTION(ms_crc_header, OPT_BOOL)
-OPTION(ms_die_on_bad_msg, OPT_BOOL)
-OPTION(ms_die_on_unhandled_msg, OPT_BOOL)
-OPTION(ms_die_on_old_message, OPT_BOOL)     // assert if we get a dup incoming message and shouldn't have (may be triggered by pre-541cd3c64be0dfa04e8a2df39422e0eb9541a428 code)
-OPTION(ms_die_on_skipped_message, OPT_BOOL)  // assert if we skip a seq (kernel client does this intentionally)
-OPTION(ms_die_on_bug, OPT_BOOL)
+HOT_OPTION(ms_crc_data, OPT_BOOL)
+HOT_OPTION(ms_crc_header, OPT_BOOL)
+HOT_OPTION(ms_die_on_bad_msg, OPT_BOOL)
+HOT_OPTION(ms_die_on_unhandled_msg, OPT_BOOL)
+HOT_OPTION(ms_die_on_old_message, OPT_BOOL)     // assert if we get a dup incoming message and shouldn't have (may be triggered by pre-541cd3c64be0dfa04e8a2df39422e0eb9541a428 code)
+HOT_OPTION(ms_die_on_skipped_message, OPT_BOOL)  // assert if we skip a seq (kernel client does this intentionally)
+HOT_OPTION(ms_die_on_bug, OPT_BOOL)
 OPTION(ms_dispatch_throttle_bytes, OPT_U64)
 OPTION(ms_bind_ipv6, OPT_BOOL)
 OPTION(ms_bind_port_min, OPT_INT)
@@ -143,13 +147,13 @@ OPTION(ms_connection_ready_timeout, OPT_U64)
 OPTION(ms_connection_idle_timeout, OPT_U64)
 OPTION(ms_pq_max_tokens_per_priority, OPT_U64)
 OPTION(ms_pq_min_cost, OPT_U64)
-OPTION(ms_inject_socket_failures, OPT_U64)
+HOT_OPTION(ms_inject_socket_failures, OPT_U64)
 SAFE_OPTION(ms_inject_delay_type, OPT_STR)          // "osd mds mon client" allowed
 OPTION(ms_inject_delay_msg_type, OPT_STR)      // the type of message to delay). This is an additional restriction on the general type filter ms_inject_delay_type.
-OPTION(ms_inject_delay_max, OPT_DOUBLE)         // seconds
-OPTION(ms_inject_delay_probability, OPT_DOUBLE) // range [0, 1]
-OPTION(ms_inject_internal_delays, OPT_DOUBLE)   // seconds
-OPTION(ms_dump_on_send, OPT_BOOL)           // hexdump msg to log on send
+HOT_OPTION(ms_inject_delay_max, OPT_DOUBLE)         // seconds
+HOT_OPTION(ms_inject_delay_probability, OPT_DOUBLE) // range [0, 1]
+HOT_OPTION(ms_inject_internal_delays, OPT_DOUBLE)   // seconds
+HOT_OPTION(ms_dump_on_send, OPT_BOOL)           // hexdump msg to log on send
 OPTION(ms_dump_corrupt_message_level, OPT_INT)  // debug level to hexdump undecodeable messages at
 OPTION(ms_async_op_threads, OPT_U64)            // number of worker processing threads for async messenger created on init
 OPTION(ms_async_max_op_threads, OPT_U64)        // max number of worker processing threads for async messenger
@@ -332,13 +336,13 @@ OPTION(auth_service_required, OPT_STR)   // required by daemons of clients
 OPTION(auth_client_required, OPT_STR)     // what clients require of daemons
 OPTION(auth_supported, OPT_STR)               // deprecated; default value for above if they are not defined.
 OPTION(max_rotating_auth_attempts, OPT_INT)
-OPTION(cephx_require_signatures, OPT_BOOL)
+HOT_OPTION(cephx_require_signatures, OPT_BOOL)
 OPTION(cephx_cluster_require_signatures, OPT_BOOL)
 OPTION(cephx_service_require_signatures, OPT_BOOL)
 OPTION(cephx_require_version, OPT_INT)
 OPTION(cephx_cluster_require_version, OPT_INT)
 OPTION(cephx_service_require_version, OPT_INT)
-OPTION(cephx_sign_messages, OPT_BOOL)  // Default to signing session messages if supported
+HOT_OPTION(cephx_sign_messages, OPT_BOOL)  // Default to signing session messages if supported
 OPTION(auth_mon_ticket_ttl, OPT_DOUBLE)
 OPTION(auth_service_ticket_ttl, OPT_DOUBLE)
 OPTION(auth_allow_insecure_global_id_reclaim, OPT_BOOL)
@@ -396,8 +400,8 @@ OPTION(crush_location_hook_timeout, OPT_INT)
 
 OPTION(objecter_tick_interval, OPT_DOUBLE)
 OPTION(objecter_timeout, OPT_DOUBLE)    // before we ask for a map
-OPTION(objecter_inflight_op_bytes, OPT_U64) // max in-flight data (both directions)
-OPTION(objecter_inflight_ops, OPT_U64)               // max in-flight ios
+HOT_OPTION(objecter_inflight_op_bytes, OPT_U64) // max in-flight data (both directions)
+HOT_OPTION(objecter_inflight_ops, OPT_U64)               // max in-flight ios
 OPTION(objecter_completion_locks_per_session, OPT_U64) // num of completion locks per each session, for serializing same object responses
 OPTION(objecter_inject_no_watch_ping, OPT_BOOL)   // suppress watch pings
 OPTION(objecter_retry_writes_after_first_reply, OPT_BOOL)   // ignore the first reply for each write, and resend the osd op instead
@@ -570,7 +574,7 @@ OPTION(osd_os_flags, OPT_U32)
 OPTION(osd_max_write_size, OPT_INT)
 OPTION(osd_max_pgls, OPT_U64) // max number of pgls entries to return
 OPTION(osd_client_message_size_cap, OPT_U64) // client data allowed in-memory (in bytes)
-OPTION(osd_client_message_cap, OPT_U64)              // num client messages allowed in-memory
+HOT_OPTION(osd_client_message_cap, OPT_U64)              // num client messages allowed in-memory
 OPTION(osd_crush_update_weight_set, OPT_BOOL) // update weight set while updating weights
 OPTION(osd_crush_chooseleaf_type, OPT_INT) // 1 = host
 OPTION(osd_pool_use_gmt_hitset, OPT_BOOL) // try to use gmt for hitset archive names if all osds in cluster support it.
@@ -774,18 +778,18 @@ OPTION(osd_backoff_on_unfound, OPT_BOOL)   // object unfound
 OPTION(osd_backoff_on_degraded, OPT_BOOL) // [mainly for debug?] object unreadable/writeable
 OPTION(osd_backoff_on_peering, OPT_BOOL)  // [debug] pg peering
 OPTION(osd_debug_crash_on_ignored_backoff, OPT_BOOL) // crash osd if client ignores a backoff; useful for debugging
-OPTION(osd_debug_inject_dispatch_delay_probability, OPT_DOUBLE)
-OPTION(osd_debug_inject_dispatch_delay_duration, OPT_DOUBLE)
+HOT_OPTION(osd_debug_inject_dispatch_delay_probability, OPT_DOUBLE)
+HOT_OPTION(osd_debug_inject_dispatch_delay_duration, OPT_DOUBLE)
 OPTION(osd_debug_drop_ping_probability, OPT_DOUBLE)
 OPTION(osd_debug_drop_ping_duration, OPT_INT)
-OPTION(osd_debug_op_order, OPT_BOOL)
+HOT_OPTION(osd_debug_op_order, OPT_BOOL)
 OPTION(osd_debug_verify_missing_on_start, OPT_BOOL)
 OPTION(osd_debug_verify_snaps, OPT_BOOL)
 OPTION(osd_debug_verify_stray_on_activate, OPT_BOOL)
 OPTION(osd_debug_skip_full_check_in_backfill_reservation, OPT_BOOL)
 OPTION(osd_debug_reject_backfill_probability, OPT_DOUBLE)
 OPTION(osd_debug_inject_copyfrom_error, OPT_BOOL)  // inject failure during copyfrom completion
-OPTION(osd_debug_misdirected_ops, OPT_BOOL)
+HOT_OPTION(osd_debug_misdirected_ops, OPT_BOOL)
 OPTION(osd_debug_skip_full_check_in_recovery, OPT_BOOL)
 OPTION(osd_debug_random_push_read_error, OPT_DOUBLE)
 OPTION(osd_debug_verify_cached_snaps, OPT_BOOL)
@@ -1554,7 +1558,7 @@ OPTION(rgw_list_bucket_min_readahead, OPT_INT) // minimum number of entries to r
 
 OPTION(rgw_rest_getusage_op_compat, OPT_BOOL) // dump description of total stats for s3 GetUsage API
 
-OPTION(throttler_perf_counter, OPT_BOOL) // enable/disable throttler perf counter
+HOT_OPTION(throttler_perf_counter, OPT_BOOL) // enable/disable throttler perf counter
 
 /* The following are tunables for torrent data */
 OPTION(rgw_torrent_flag, OPT_BOOL)    // produce torrent function flag
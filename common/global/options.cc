@@ -9,10 +9,13 @@
 #include "common/utils/stringify.h"
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
+#include <memory>
+#include <mutex>
 #include <regex>
 
 // Definitions for enums
 #include "common/perf_counters.h"
+#include "common/Thread.h"
 
 // rbd feature validation
 #include "librbd/Features.h"
@@ -42,6 +45,9 @@ public:
   void operator()(const std::chrono::seconds v) const {
     out << v.count();
   }
+  void operator()(const Option::log_level_t& v) const {
+    out << v.log << "/" << v.gather;
+  }
 };
 }
 
@@ -51,6 +57,53 @@ ostream& operator<<(ostream& os, const Option::value_t& v) {
   return os;
 }
 
+// as the vectors these used to be print
+static ostream& operator<<(ostream& os, const Option::literals_t& l) {
+  os << "[";
+  for (auto i = l.begin(); i != l.end(); ++i) {
+    if (i != l.begin()) {
+      os << ",";
+    }
+    os << *i;
+  }
+  return os << "]";
+}
+
+Option::literals_t Option::literals_t::append(
+  std::initializer_list<const char*> ts) const
+{
+  // Blocks of list storage, handed out front to back.  Options are built
+  // once per process, so this only ever grows; a list that outgrows its
+  // place is copied and the old copy is left behind.
+  static constexpr std::size_t BLOCK = 4096;
+  static std::mutex lock;
+  // never destroyed, for options that outlive static destruction
+  static auto& blocks = *new std::vector<std::unique_ptr<const char*[]>>;
+  static std::size_t used = BLOCK;
+
+  if (ts.size() == 0) {
+    return *this;
+  }
+  const std::size_t n = m_size + ts.size();
+  std::scoped_lock l(lock);
+  const char** next = blocks.empty() ? nullptr : blocks.back().get() + used;
+  if (m_size && m_first + m_size == next && used + ts.size() <= BLOCK) {
+    std::copy(ts.begin(), ts.end(), next);
+    used += ts.size();
+    return literals_t(m_first, n);
+  }
+  if (used + n > BLOCK) {
+    blocks.emplace_back(new const char*[std::max(BLOCK, n)]);
+    used = 0;
+  }
+  const char** first = blocks.back().get() + used;
+  std::copy(m_first, m_first + m_size, first);
+  std::copy(ts.begin(), ts.end(), first + m_size);
+  // a list bigger than a block gets one of its own, which is then full
+  used = std::min(used + n, BLOCK);
+  return literals_t(first, n);
+}
+
 void Option::dump_value(const char *field_name,
     const Option::value_t &v, Formatter *f) const
 {
@@ -124,27 +177,62 @@ int Option::validate(const Option::value_t &new_value, std::string *err) const
   return 0;
 }
 
+bool Option::parse_log_level(std::string_view s, log_level_t *out,
+			     std::string *err)
+{
+  auto level = [&s](int *l) {
+    if (s.empty() || s[0] < '0' || s[0] > '9') {
+      return false;
+    }
+    *l = 0;
+    for (; !s.empty() && s[0] >= '0' && s[0] <= '9'; s.remove_prefix(1)) {
+      *l = *l * 10 + (s[0] - '0');
+      if (*l > 99) {
+	return false;
+      }
+    }
+    return true;
+  };
+  bool ok = level(&out->log);
+  if (ok && s.empty()) {
+    out->gather = out->log;
+  } else if (ok && s[0] == '/') {
+    s.remove_prefix(1);
+    ok = level(&out->gather) && s.empty();
+  } else {
+    ok = false;
+  }
+  if (!ok) {
+    *err = "value must take the form N or N/M, where N and M are integers in range [0, 99]";
+  }
+  return ok;
+}
+
 int Option::parse_value(
   const std::string& raw_val,
   value_t *out,
   std::string *error_message,
   std::string *normalized_value) const
 {
-  std::string val = raw_val;
-
-  int r = pre_validate(&val, error_message);
-  if (r != 0) {
-    return r;
+  // only a string validator may rewrite the input, so only it needs a copy
+  std::string validated;
+  if (validator) {
+    validated = raw_val;
+    int r = pre_validate(&validated, error_message);
+    if (r != 0) {
+      return r;
+    }
   }
+  const std::string& val = validator ? validated : raw_val;
 
   if (type == Option::TYPE_INT) {
-    int64_t f = strict_si_cast<int64_t>(val.c_str(), error_message);
+    int64_t f = strict_si_cast<int64_t>(val, error_message);
     if (!error_message->empty()) {
       return -EINVAL;
     }
     *out = f;
   } else if (type == Option::TYPE_UINT) {
-    uint64_t f = strict_si_cast<uint64_t>(val.c_str(), error_message);
+    uint64_t f = strict_si_cast<uint64_t>(val, error_message);
     if (!error_message->empty()) {
       return -EINVAL;
     }
@@ -152,7 +240,7 @@ int Option::parse_value(
   } else if (type == Option::TYPE_STR) {
     *out = val;
   } else if (type == Option::TYPE_FLOAT) {
-    double f = strict_strtod(val.c_str(), error_message);
+    double f = strict_strtod(val, error_message);
     if (!error_message->empty()) {
       return -EINVAL;
     } else {
@@ -164,7 +252,7 @@ int Option::parse_value(
     } else if (strcasecmp(val.c_str(), "true") == 0) {
       *out = true;
     } else {
-      int b = strict_strtol(val.c_str(), 10, error_message);
+      int b = strict_strtol(val, 10, error_message);
       if (!error_message->empty()) {
 	return -EINVAL;
       }
@@ -189,7 +277,7 @@ int Option::parse_value(
     }
     *out = uuid;
   } else if (type == Option::TYPE_SIZE) {
-    Option::size_t sz{strict_iecstrtoll(val.c_str(), error_message)};
+    Option::size_t sz{strict_iecstrtoll(val, error_message)};
     if (!error_message->empty()) {
       return -EINVAL;
     }
@@ -201,10 +289,20 @@ int Option::parse_value(
       *error_message = e.what();
       return -EINVAL;
     }
+  } else if (type == Option::TYPE_LOGLEVEL) {
+    Option::log_level_t l;
+    if (!parse_log_level(val, &l, error_message)) {
+      return -EINVAL;
+    }
+    *out = l;
   } else {
     ceph_abort();
   }
 
+  int r = typed_validate(out, error_message);
+  if (r != 0) {
+    return r;
+  }
   r = validate(*out, error_message);
   if (r != 0) {
     return r;
@@ -342,6 +440,29 @@ constexpr unsigned long long operator"" _G (unsigned long long n) {
   return n << 30;
 }
 
+static int validate_thread_placement(std::string *value,
+				     std::string *error_message)
+{
+  ThreadPlacementPolicy policy;
+  return parse_thread_placement(*value, &policy, error_message);
+}
+
+static int validate_thread_stack(std::string *value,
+				 std::string *error_message)
+{
+  ThreadStackPolicy policy;
+  return parse_thread_stack(*value, &policy, error_message);
+}
+
+static int validate_power_of_two(uint64_t *value, std::string *error_message)
+{
+  if (!isp2(*value)) {
+    *error_message = "value must be a power of two";
+    return -EINVAL;
+  }
+  return 0;
+}
+
 std::vector<Option> get_global_options() {
   return std::vector<Option>({
     Option("host", Option::TYPE_STR, Option::LEVEL_BASIC)
@@ -453,6 +574,29 @@ std::vector<Option> get_global_options() {
     .add_service("common")
     .add_see_also("admin_socket"),
 
+    Option("thread_placement", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("cpus and NUMA nodes to run named threads on")
+    .set_long_description("Whitespace or ';' separated <thread name>=[<cpu list>][@<node>[!]] entries; a name ending in '*' matches every thread whose name starts with the rest, and the first matching entry applies.  The cpu list is as in /sys (0-3,8).  @<node> has the thread prefer that NUMA node's memory, and run on its cpus if none are listed; with a '!' the memory is bound to the node.  E.g. 'log*=0-1 admin_socket*=0-1' keeps housekeeping threads on cpus 0 and 1, away from the ones serving I/O.  A change moves the cpus of running threads; memory policy only applies to threads started after it.")
+    .set_typed_validator<std::string, validate_thread_placement>()
+    .add_service("common"),
+
+    Option("thread_stack", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("stack size, guard and huge page backing of named threads")
+    .set_long_description("Whitespace or ';' separated <thread name>=[<size>][,guard=<size>][,huge] entries; a name ending in '*' matches every thread whose name starts with the rest, and the first matching entry applies.  Sizes take IEC suffixes and are rounded up to whole pages; the size replaces the default (RLIMIT_STACK, usually 8M) and the guard the default page.  'huge' asks for transparent huge pages behind the stack, which only pays for a hot thread with a deep stack of at least 4M.  E.g. '*=512K' bounds the address space and page tables of every thread; a thread created with an explicit stack size keeps it.  A change applies to threads created after it.")
+    .set_typed_validator<std::string, validate_thread_stack>()
+    .add_service("common")
+    .add_see_also("thread_placement"),
+
+    Option("work_pool_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("workers in the process's shared work pool (0 for one per cpu, up to 8)")
+    .set_long_description("Common code that has short tasks to run in parallel hands them to a single pool of work_pool<n> threads, started the first time anything uses it, rather than starting threads of its own.  Idle workers steal queued tasks from busy ones.  Place the workers with thread_placement, e.g. 'work_pool*=0-3'.")
+    .add_service("common")
+    .add_see_also("thread_placement"),
+
     Option("admin_socket", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("")
     .set_daemon_default("$run_dir/$cluster-$name.asok")
@@ -466,6 +610,58 @@ std::vector<Option> get_global_options() {
     .add_service("common")
     .add_see_also("admin_socket"),
 
+    Option("admin_socket_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .set_min(1)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("number of threads running admin socket commands")
+    .set_long_description("Connections are accepted by one thread and handed to these, so a slow command only holds up the connection that sent it.  A hook still runs one command at a time unless it registered the command as safe to run concurrently, as the perf counter dumps are.")
+    .add_service("common")
+    .add_see_also({"admin_socket", "admin_socket_timeout"}),
+
+    Option("admin_socket_timeout", Option::TYPE_SECS, Option::LEVEL_ADVANCED)
+    .set_default(10)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("give up on an admin socket client that takes longer than this to send its request or read a reply (0 for never)")
+    .add_service("common")
+    .add_see_also({"admin_socket_threads", "admin_socket_idle_timeout"}),
+
+    Option("admin_socket_idle_timeout", Option::TYPE_SECS, Option::LEVEL_ADVANCED)
+    .set_default(300)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("close an admin socket connection that sends no further request for this long (0 for never)")
+    .set_long_description("A client may keep its connection open and send one request after another, each NUL or newline terminated or a complete JSON object, and read the replies in order.  Scrapers that poll often can do so without reconnecting each time; ceph-asok-scrape keeps a connection to every daemon on the host this way.")
+    .add_service("common")
+    .add_see_also("admin_socket_timeout"),
+
+    Option("startup_trace_file", Option::TYPE_STR, Option::LEVEL_DEV)
+    .set_default("")
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("write how long each phase of startup took to this file, as Chrome trace events")
+    .set_long_description("Written once common_init_finish() is done, in the trace event format chrome://tracing and Perfetto load; phases run on other threads show on their own tracks.  The same phases are listed by the 'startup trace' admin socket command, and at debug level 1 in the log.")
+    .add_service("common"),
+
+    Option("conf_cache_file", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_flag(Option::FLAG_STARTUP)
+    .set_flag(Option::FLAG_NO_MON_UPDATE)
+    .set_description("cache of what the config file sets for this entity, e.g. '$run_dir/$cluster-$name.conf.cache'")
+    .set_long_description("If set, the values the config file sets for this entity are saved here, already parsed and validated, and a later start reads them back instead of parsing the config file as long as the file (its size, mtime and inode), the entity name and the build are the same.  The config file itself is then only parsed if something asks for a section or key of it directly.  Being read before the config file, this can only be set on the command line or in CEPH_ARGS.")
+    .add_service("common"),
+
+    Option("conf_file_watch_interval", Option::TYPE_SECS, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("how often to look for changes to the config file, and apply them (0 for never)")
+    .set_long_description("The config file's directory is watched with inotify, and once the file has changed and then been left alone for an interval it is parsed again.  Options whose values in it changed, or that were dropped from it, are set or revert as if by 'config set' and 'config rm', and their observers are told; the rest are left alone.  Changes to options that can't be changed at runtime are logged and wait for a restart.  Replace the file (write a new one and rename it over the old) rather than rewriting it in place.")
+    .add_service("common"),
+
+    Option("config_profile_every", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(0)
+    .set_description("count one in every this many option reads, for 'config profile' (0 for none)")
+    .set_long_description("Reads through get_val() and with_val() are counted by option.  Reads of the legacy members (conf->name) can't be told apart by option, so they are counted by the function making them, which 'config profile' names if the binary exports its symbols and otherwise gives as object+offset, for addr2line.  Each thread records one read in every this many in counts of its own, so a value of 1000 or so costs little; at 0 a read costs a load and a branch.  The options read most are the ones worth a md_config_cacher_t.")
+    .add_service("common"),
+
     // daemon
     Option("daemonize", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
@@ -528,6 +724,13 @@ std::vector<Option> get_global_options() {
     .set_default("/var/lib/ceph/crash")
     .set_description("Directory where crash reports are archived"),
 
+    Option("crash_dump_raw", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("leave a raw dump in crash_dir for ceph-crash-symbolize instead of symbolizing the backtrace in the signal handler")
+    .set_long_description("Resolving the backtrace of a fatal signal is most of the time it takes a process to get out of the way of its restart.  If this is set, the handler instead writes the unresolved frames, registers, raw stack, thread list and /proc/self/maps to a 'dump' file in the crash_dir entry and exits.  'ceph-crash-symbolize <entry>' later writes the usual meta file from it and marks it done; until then the crash is not reported.")
+    .add_see_also("crash_dir"),
+
     // restapi
     Option("restapi_log_level", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_description("default set by python code"),
@@ -552,10 +755,199 @@ std::vector<Option> get_global_options() {
                    "log_to_syslog",
                    "err_to_syslog"}),
 
+    Option("log_subsys_files", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("write some subsystems' debug output to files of their own")
+    .set_long_description("A semicolon separated list of subsys[,subsys...]=path, e.g. 'ms=/var/log/ceph/$cluster-$name.ms.log;osd,bluestore=/var/log/ceph/$cluster-$name.osd.log'.  Lines of the listed subsystems (as in debug_<subsys>) are written to that path instead of log_file; subsystems listed with the same path share it.  Each file is written by a thread of its own, so a noisy subsystem on a slow device does not hold up the rest of the log.  They are reopened along with log_file, but are not rotated by log_rotate_size and are always written as text.  Crash dumps go to log_file whole.")
+    .add_see_also({"log_file", "log_format"}),
+
+    Option("log_format", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("text")
+    .set_enum_allowed({"text", "binary", "json"})
+    .set_description("format of the log file")
+    .set_long_description("'binary' writes each entry as a fixed header with the timestamp, thread, priority and subsystem followed by the raw message, which avoids formatting on the log thread.  Use ceph-log-decode to render such a file as text.  'json' writes each entry as a JSON object on a line of its own, with stamp, thread, prio, subsys and msg members, and a member for each field of an entry logged with ldout_kv, so that a log collector need not parse the text.  A crash dump written from a signal handler is still text.  syslog and stderr output is always text.")
+    .add_see_also("log_file"),
+
+    Option("log_mmap_write", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("write the log file through a shared memory mapping")
+    .set_long_description("The log file is preallocated and mapped in large chunks, and log lines are copied into the mapping instead of being written with write(2).  Lines copied into the mapping survive a crash of the process.  Takes precedence over log_async_write.")
+    .add_see_also({"log_file", "log_async_write"}),
+
+    Option("log_drop_page_cache", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("keep the log file out of the page cache")
+    .set_long_description("Every 1 MiB or so of log written, the log thread starts writeback of it with sync_file_range(2) and drops the previous MiB, written back by then, with posix_fadvise(POSIX_FADV_DONTNEED).  On a host whose log shares a device with OSD data this keeps the log from crowding hot data out of the cache and from piling up dirty pages that stall writeback.  Not used with log_mmap_write.")
+    .add_see_also({"log_file", "log_mmap_write"}),
+
+    Option("log_sync", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("none")
+    .set_enum_allowed({"none", "periodic", "errors"})
+    .set_description("when the log file is flushed to stable storage")
+    .set_long_description("'none' leaves it to the kernel's writeback, so a crash or power loss of the host can lose the last lines written, often the ones that explain it.  'periodic' has the log thread fdatasync(2) the file at most log_sync_interval after each write.  'errors' syncs after every flush that wrote an error (an entry at debug level 0 or below) along with whatever else was written, so the lines leading up to an error survive with it.  Either way the file is also synced before it is rotated or closed.  Unlike log_error_sync the logging thread does not wait for it.")
+    .add_see_also({"log_sync_interval", "log_error_sync", "log_preallocate"}),
+
+    Option("log_sync_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(1.0)
+    .set_min(0.0)
+    .set_description("most seconds written log lines wait to be synced with log_sync=periodic")
+    .add_see_also("log_sync"),
+
+    Option("log_preallocate", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("keep the log file allocated this many bytes ahead of its end (0 to disable)")
+    .set_long_description("The log thread fallocate(2)s the file a chunk at a time, without changing its size, so that appends land in blocks that are already allocated instead of each allocating its own, which on ext4 and xfs is a metadata update per append and makes log_sync cheaper.  What is left of the chunk is given back when the file is rotated or closed.  Not used with log_mmap_write, which preallocates its own chunks.")
+    .add_see_also({"log_sync", "log_mmap_write"}),
+
+    Option("log_index_interval", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("keep a time index of the log file in log_file.idx, a record per this many bytes (0 to disable)")
+    .set_long_description("Each record gives the file offset and length of a stretch of the log file, the earliest and latest timestamps in it and which subsystems have lines in it.  ceph-log-query uses it to read only the parts of a large log that can match a time range and subsystems.  The index follows the file through log_rotate_size rotation, but not through an external logrotate.  It is not kept while the file is compressed or formatted by log_format_threads.")
+    .add_see_also({"log_file", "log_rotate_size", "log_compression"}),
+
+    Option("log_traffic_trace", Option::TYPE_STR, Option::LEVEL_DEV)
+    .set_default("")
+    .set_description("record the shape of the log traffic to this file, for log_replay")
+    .set_long_description("For every entry the log thread flushes, only its timestamp, thread, subsystem, priority, length and whether it was written or only gathered are recorded, in a few bytes; the text is not.  The log_replay benchmark reads the file and submits entries of the same sizes from as many threads at the same times, so that a change to the log can be measured against the bursts of a real daemon rather than a steady synthetic load.  The file is truncated when this is set and written a buffer at a time; a child after fork() does not record into it.")
+    .add_see_also("log_index_interval"),
+
+    Option("log_async_write", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("write the log file from a separate thread")
+    .set_long_description("When enabled, the log thread hands each full buffer to a writer thread and continues formatting the next one while the previous one is written with writev().  Crash dumps are always written synchronously.")
+    .add_see_also("log_file"),
+
+    Option("log_format_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("threads that format (and compress) log file output (0 to format on the log thread)")
+    .set_long_description("The log thread drains queued entries and hands each batch bound for the log file to one of these threads, which renders (and, with log_compression, compresses) it.  Batches are written in order by a single writer thread, as with log_async_write.  Use this when a single log thread cannot keep up with formatting.  Not used with log_mmap_write; syslog, stderr and crash dumps are still written by the log thread.")
+    .add_see_also({"log_async_write", "log_compression"}),
+
+    Option("log_compression", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("none")
+    .set_enum_allowed({"none", "zstd", "lz4"})
+    .set_description("compress the log file")
+    .set_long_description("Each buffer written to the log file becomes a self-contained zstd or lz4 frame, so the file can be read with zstdcat or lz4cat at any time, including while it is being written, after a crash or after rotation.  Changing this does not rewrite what is already in the file; rotate the log when turning compression on or off.  syslog and stderr output is never compressed.")
+    .add_see_also({"log_file", "log_compression_level"}),
+
+    Option("log_compression_level", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_description("compression level for log_compression (0 for the library default)")
+    .set_long_description("Lower levels are faster; the log thread compresses every buffer before it is written.")
+    .add_see_also("log_compression"),
+
+    Option("log_compression_dict_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("train a zstd dictionary of this size for log_compression (0 to not)")
+    .set_long_description("Each frame of a compressed log starts with no history, so small frames (a small log_buffer_size, or frequent flushes) compress log text poorly.  With this set and log_compression=zstd, once the recent entries kept in memory number log_max_recent or 1000, whichever is less, the log thread trains a dictionary from them, writes it next to the log file as <log_file>.<id>.dict and compresses every following frame against it.  Such frames carry the dictionary's ID and decode only along with it: zstdcat -D <log_file>.<id>.dict, or ceph-log-query, which finds it by itself.  Training is done once per log_compression setting and holds up the log thread for a moment.  Keep the .dict files as long as the logs; 16K to 112K is typical.")
+    .add_see_also({"log_compression", "log_max_recent"}),
+
     Option("log_max_new", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(1000)
     .set_description("max unwritten log entries to allow before waiting to flush to the log")
-    .add_see_also("log_max_recent"),
+    .add_see_also({"log_max_new_bytes", "log_max_recent"}),
+
+    Option("log_max_new_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(8_M)
+    .set_description("max memory held by unwritten log entries before waiting to flush to the log (0 for no limit)")
+    .set_long_description("log_max_new counts entries whatever their size, so a burst of long lines (hexdumps, say) can queue far more memory than short ones.  The queue is also considered full once its entries take this many bytes, counting each entry's own size plus any text beyond its inline buffer, and log_overflow_policy applies as it does for log_max_new.  Each of log_queue_shards holds up to its share of this too.")
+    .add_see_also({"log_max_new", "log_overflow_policy", "log_queue_shards"}),
+
+    Option("log_overflow_policy", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("block")
+    .set_enum_allowed({"block", "drop_newest", "drop_lowest_priority", "recent_only"})
+    .set_description("what to do with new log entries when log_max_new or log_max_new_bytes is exceeded")
+    .set_long_description("'block' makes the logging thread wait for the log thread to catch up.  'drop_newest' discards the new entry.  'drop_lowest_priority' discards the most verbose entry among the queued ones and the new one.  'recent_only' keeps the new entry in the in-memory recent log for crash dumps without writing it.  Discarded entries are counted and reported in the log.")
+    .add_see_also({"log_max_new", "log_max_recent"}),
+
+    Option("log_governor_level", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(-1)
+    .set_min(-1)
+    .set_description("debug level to hold the noisiest subsystems to while the log thread can't keep up (-1 to never)")
+    .set_long_description("When logging threads find log_max_new full (so they block, or with log_overflow_policy lose entries), the subsystem that submitted the most entries in the last second and gathers above this level is held to it, and another one each second the overload persists.  Once the log thread has kept up for ten seconds all of them get their debug_* levels back.  Each step is noted in the log.  This keeps a debug_ms=20 left on in production from taking a daemon down through logging backpressure, at the price of the detail it asked for.  The configured levels are not changed; levels 0 and -1 are never held.")
+    .add_see_also({"log_max_new", "log_overflow_policy"}),
+
+    Option("log_max_container_elements", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1000)
+    .set_description("most elements of a container printed into a log entry (0 for no limit)")
+    .set_long_description("Vectors, maps, sets, lists and the like are printed element by element.  In a log entry the rest of one past this many elements, or past log_max_container_bytes of its output, is left out and summed up as '... N more', so that an accidental << of a huge container doesn't make a megabyte line that holds up the log thread and fills the recent log.  Only the generic container printers honor it, and only in debug output.")
+    .add_see_also("log_max_container_bytes"),
+
+    Option("log_max_container_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_description("most bytes a container printed into a log entry may take (0 for no limit)")
+    .add_see_also("log_max_container_elements"),
+
+    Option("log_inline", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("off")
+    .set_enum_allowed({"off", "sync", "buffered"})
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("write log entries from the thread that logs them, with no log thread or queue")
+    .set_long_description("Meant for short-lived command line tools, where starting the log thread costs more than the logging: 'sync' writes each entry as it is logged.  'buffered' only writes the log file (and stderr, syslog, graylog) once 64 KiB has collected, when the log is flushed and at exit, but for errors, which go out at once.  Tools (CODE_ENVIRONMENT_UTILITY) default to 'sync'.  log_async_write, log_format_threads and the queueing options do nothing inline.")
+    .add_see_also({"log_flush_on_exit", "log_shared_flusher"}),
+
+    Option("log_shared_flusher", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("flush this context's log from a thread shared by the whole process")
+    .set_long_description("Every CephContext's log normally has a thread of its own writing it out.  A client process with many contexts (librados users, rbd-mirror, gateways) can instead have all the logs with this set flushed by a single thread; each keeps its own file, levels and queues.  A log that is slow to write (to a slow disk, say) then delays the others."),
+
+    Option("log_error_lane", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_description("queue error log entries (level 0 and below) on their own lane, written ahead of other entries")
+    .set_long_description("Errors (lderr and the like) would otherwise wait behind every debug line queued before them.  They are written as soon as the log thread wakes, ahead of the queued entries, so they can appear in the log slightly out of timestamp order.  They are not subject to log_overflow_policy unless log_max_new of them are already waiting.")
+    .add_see_also({"log_error_sync", "log_max_new"}),
+
+    Option("log_error_sync", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("write error log entries from the submitting thread and fdatasync the log before returning")
+    .set_long_description("With log_error_lane, the thread logging an error writes out the error lane itself and waits for it to reach the log file (with fdatasync) and the stderr, syslog and graylog sinks, so an error is never lost to a crash right after it.  This makes every error cost a disk flush.")
+    .add_see_also("log_error_lane"),
+
+    Option("log_flush_batch", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_min(1)
+    .set_description("number of queued log entries that wakes the log thread")
+    .set_long_description("The log thread is woken once per batch rather than once per entry.  With the default of 1 it is woken when the queue goes from empty to non-empty.  Larger values trade up to log_flush_max_delay of latency for fewer context switches.")
+    .add_see_also({"log_max_new", "log_flush_max_delay"}),
+
+    Option("log_flush_max_delay", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.1)
+    .set_min(0.0)
+    .set_description("maximum seconds a partial log_flush_batch may wait before being written")
+    .add_see_also("log_flush_batch"),
+
+    Option("log_stop_timeout", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_min(0.0)
+    .set_description("maximum seconds shutting down the log may spend writing out queued entries (0 for no limit)")
+    .set_long_description("When a daemon exits with a large backlog of queued log entries and a slow log device, writing all of them can hold up its exit for a long time.  With a timeout, errors and entries at debug level 1 and below are written ahead of the rest of the backlog, and whatever else is still waiting for the log file or for the syslog, stderr, graylog and journald sinks when the time is up is dropped.  The number of entries dropped is noted in the log.  Errors are always written.")
+    .add_see_also({"log_max_new", "log_error_lane"}),
+
+    Option("log_thread_ring_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("per-thread log submission ring size (0 to disable)")
+    .set_long_description("When non-zero, each thread submitting log entries gets its own lock-free ring of this many entries which the log thread drains, so that producers do not contend on the shared log queue.  Entries go to the shared queue when a thread's ring is full.")
+    .add_see_also("log_max_new"),
+
+    Option("log_queue_shards", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("split the log submission queue into this many per-cpu shards (0 to disable)")
+    .set_long_description("Threads queue log entries on the shard of the cpu they are running on, so that submitters on different cpus (or sockets) do not bounce the same lock and queue.  Each shard holds up to log_max_new divided by the number of shards; beyond that entries go to the shared queue.  The log thread merges the shards in timestamp order.")
+    .add_see_also({"log_max_new", "log_thread_ring_size"}),
+
+    Option("log_reorder_window", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_min(0.0)
+    .set_description("seconds the log thread holds back new entries to write them in timestamp order (0 to disable)")
+    .set_long_description("Entries submitted through log_queue_shards or log_thread_ring_size are merged in timestamp order each time the log thread drains them, but an entry that reaches the log thread late can still end up behind newer ones written by an earlier flush.  With a reorder window the newest entries are held for this long so they can be merged with late arrivals, at the cost of that much extra latency.")
+    .add_see_also({"log_reorder_max_bytes", "log_queue_shards", "log_thread_ring_size"}),
+
+    Option("log_reorder_max_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(1_M)
+    .set_description("maximum size of the entries held back by log_reorder_window")
+    .set_long_description("When more than this is held, the oldest held entries are written even if they are still inside the window.")
+    .add_see_also("log_reorder_window"),
 
     Option("log_max_recent", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(500)
@@ -563,6 +955,50 @@ std::vector<Option> get_global_options() {
     .set_description("recent log entries to keep in memory to dump in the event of a crash")
     .set_long_description("The purpose of this option is to log at a higher debug level only to the in-memory buffer, and write out the detailed log messages only if there is a crash.  Only log entries below the lower log level will be written unconditionally to the log.  For example, debug_osd=1/5 will write everything <= 1 to the log unconditionally but keep entries at levels 2-5 in memory.  If there is a seg fault or assertion failure, all entries will be dumped to the log."),
 
+    Option("log_max_recent_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(16_M)
+    .set_description("memory budget for the in-memory recent log entries")
+    .set_long_description("Recent entries are stored packed, using only as much memory as their text needs, so log_max_recent can be raised freely.  The buffer grows with log volume up to this many bytes, after which the oldest entries are discarded.")
+    .add_see_also("log_max_recent"),
+
+    Option("log_subsys_recent", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("keep some subsystems' recent log entries in rings of their own")
+    .set_long_description("A semicolon separated list of subsys[,subsys...]=<bytes>, e.g. 'ms=4M;objecter,monc=1M'.  The recent entries of the listed subsystems are kept in a ring of that many bytes (and up to log_max_recent entries) per group instead of the shared one, so that a subsystem gathering at a high level, like debug_ms=0/20, cannot evict everyone else's entries; the shared ring can then be smaller for the same value in a crash dump.  A dump merges all the rings by time; log_max_recent bounds each group's ring, and the shared ring (with any per-thread ones) on its own.  Changing this empties the subsystems' rings.  Not used for entries kept in per-thread rings (log_thread_recent_bytes), nor kept in log_recent_file.")
+    .add_see_also({"log_max_recent", "log_max_recent_bytes"}),
+
+    Option("log_huge_pages", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("none")
+    .set_enum_allowed({"none", "thp", "hugetlb"})
+    .set_description("back the recent log ring and large log buffers with huge pages")
+    .set_long_description("With a large log_max_recent_bytes the recent ring spans thousands of pages, and walking it (or a large log_buffer_size buffer) costs TLB misses.  'thp' maps such buffers, once they reach 2 MiB, in whole huge pages and asks for transparent huge pages with madvise(MADV_HUGEPAGE), which only helps where /sys/kernel/mm/transparent_hugepage/enabled allows madvise.  'hugetlb' takes them from the reserved huge page pool (vm.nr_hugepages) with MAP_HUGETLB, falling back to 'thp' when the pool has no room.  Buffers already allocated keep their pages until they are next reallocated.  The recent ring's backing is shown with the log levels in a dump.  Not used for a log_recent_file.")
+    .add_see_also({"log_max_recent_bytes", "log_buffer_size"}),
+
+    Option("log_recent_file", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("keep the recent log entries in this file so they survive the process being killed")
+    .set_long_description("The in-memory ring of recent entries (log_max_recent, log_max_recent_bytes) is placed in a shared mapping of this file instead of on the heap, so when the process dies without getting to dump it, e.g. to the OOM killer's SIGKILL, 'ceph-log-decode --recent <file>' can still recover the last entries.  Nothing is written to it explicitly; put it on tmpfs (e.g. /dev/shm/$cluster-$name.recent) to keep the kernel from writing it back at all.  A file left by an earlier run is renamed to <file>.prev first.  Deferred log entries have to be formatted as they are added.")
+    .add_see_also({"log_max_recent", "log_max_recent_bytes", "crash_dir"}),
+
+    Option("log_shm_ring", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("also hand every logged entry to ceph-log-agent through a shared ring at this path")
+    .set_long_description("Each entry that is logged (up to the first debug_* level) is appended as a log_format=binary record to a ring in a shared mapping of this file, which ceph-log-agent drains, compresses and writes out or ships for every daemon on the host.  Put it on tmpfs, e.g. /dev/shm/$cluster-$name.logring.  Appending is a copy; the log thread never waits for the agent, and entries that don't fit while it falls behind are dropped and counted, which the agent reports.  Turn log_to_file off to leave the log file to the agent entirely.")
+    .add_see_also({"log_shm_ring_size", "log_to_file"}),
+
+    Option("log_shm_ring_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(8_M)
+    .set_min(64_K)
+    .set_description("bytes of the log_shm_ring, rounded up to a power of two")
+    .set_long_description("How far the log agent may fall behind before entries are dropped.  A single entry takes at most a quarter of the ring and is cut short beyond that.  Changing it starts a new ring; the agent drains the old one first.")
+    .add_see_also("log_shm_ring"),
+
+    Option("log_thread_recent_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("keep recent log entries in a ring per submitting thread, of this many bytes each")
+    .set_long_description("Normally the log thread copies every entry it flushes into the recent ring.  If this is set, each thread that logs keeps its own ring of up to this many bytes (and log_max_recent entries) instead, filled as it submits, so the log thread no longer pays for that copy; a dump merges the rings by timestamp and still writes only the last log_max_recent entries.  Rings of a few exited threads are kept for the next dump.  0 keeps the single shared ring.  log_recent_file only covers the shared ring, not these.  With these rings, entries that are gathered but not logged (above the first debug_* level, up to the second) go no further than their thread's ring: they are never queued for the log thread, and deferred ones (ldout_deferred) are only formatted if they are dumped.  This makes a high gather level, e.g. debug_osd=1/30, a cheap flight recorder.")
+    .add_see_also({"log_max_recent", "log_max_recent_bytes", "log_recent_file"}),
+
     Option("log_to_file", Option::TYPE_BOOL, Option::LEVEL_BASIC)
     .set_default(true)
     .set_description("send log lines to a file")
@@ -583,6 +1019,12 @@ std::vector<Option> get_global_options() {
     .set_long_description("This is useful in container environments when combined with mon_cluster_log_to_stderr.  The mon log prefixes each line with the channel name (e.g., 'default', 'audit'), while log_stderr_prefix can be set to 'debug '.")
     .add_see_also("mon_cluster_log_to_stderr"),
 
+    Option("log_stderr_splice", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("vmsplice log lines into stderr when it is a pipe, instead of copying them")
+    .set_long_description("In containers stderr is usually a pipe to the container runtime.  With this on, each batch of lines for stderr is handed to the pipe by reference with vmsplice(2) rather than copied into it, and kept in memory until the runtime has read it, which the pipe's capacity bounds.  Ignored when stderr is not a pipe.  Batches that need log_stderr_prefix on only some lines, and crash dumps, are still copied.  A pipe holds a spliced batch in a slot per page rather than packed, so while the reader stalls it holds fewer lines, and log_sink_max_pending is reached sooner.")
+    .add_see_also({"log_to_stderr", "log_stderr_prefix", "log_sink_max_pending"}),
+
     Option("log_to_syslog", Option::TYPE_BOOL, Option::LEVEL_BASIC)
     .set_default(false)
     .set_description("send log lines to syslog facility"),
@@ -591,6 +1033,45 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description("send critical error log lines to syslog facility"),
 
+    Option("log_to_journald", Option::TYPE_BOOL, Option::LEVEL_BASIC)
+    .set_default(false)
+    .set_description("send log lines to systemd-journald")
+    .set_long_description("Lines are sent over journald's native protocol, with the subsystem, priority, thread and entity name (e.g. osd.3) as journal fields of their own (CEPH_SUBSYS, CEPH_PRIO, THREAD, CEPH_ENTITY) that journalctl can match on, and PRIORITY from the log priority.  The message itself is MESSAGE, without the stamp and thread that the log file has.  Like syslog this is written by a thread of its own; lines are dropped while journald is unreachable.")
+    .add_see_also({"err_to_journald", "log_to_syslog"}),
+
+    Option("err_to_journald", Option::TYPE_BOOL, Option::LEVEL_BASIC)
+    .set_default(false)
+    .set_description("send critical error log lines to systemd-journald")
+    .add_see_also("log_to_journald"),
+
+    Option("log_buffer_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_min(4_K)
+    .set_description("bytes of formatted log lines buffered before they are written")
+    .set_long_description("The log thread formats lines into a buffer and writes it out once it holds this much, or the queue has been emptied.  A larger buffer means fewer, larger writes when logging heavily; with log_async_write it is also the unit handed to the writer thread.  A buffer that a burst or a single huge entry grew past four times this size is freed once written rather than kept.")
+    .add_see_also("log_async_write"),
+
+    Option("log_stream_cache_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1024)
+    .set_min_max(1, 1024)
+    .set_description("formatting streams kept for reuse once the threads that logged with them are done")
+    .set_long_description("Streams a log message was formatted in go back to the thread that made it, or, when freed elsewhere (by the log thread, say), to a shared pool of up to this many.  Each can hold up to 64K of buffer.")
+    .add_see_also("log_auto_size"),
+
+    Option("log_auto_size", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("size the log's queues and buffers from the memory and cpus the process has")
+    .set_long_description("At startup, the defaults of log_max_recent, log_max_recent_bytes, log_max_new_bytes and log_stream_cache_size are scaled by the memory the process may use (its cgroup's memory.max or memory.high, else physical memory) relative to 8G, and those of log_max_new and log_buffer_size by the cpus it may use (its cgroup's cpu.max quota, else its cpu affinity) relative to 8, within 1/16 and 4 times the default.  Values set in the config file, environment, command line or by the daemon itself are left as they are.")
+    .add_see_also({"log_max_recent", "log_max_new", "log_buffer_size"}),
+
+    Option("log_sink_max_pending", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64)
+    .set_min(1)
+    .set_description("batches of log lines that may wait for the stderr, syslog, graylog or journald thread")
+    .set_long_description("stderr, syslog, graylog and journald are each written by their own thread so that a slow reader cannot hold up the log file.  When a sink falls this many batches behind, further lines for it are dropped and the number dropped is noted in the log file.  Crash dumps are always written synchronously.")
+    .add_see_also({"log_to_stderr", "log_to_syslog"}),
+
     Option("log_flush_on_exit", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_description("set a process exit handler to ensure the log is flushed on exit"),
@@ -599,7 +1080,8 @@ std::vector<Option> get_global_options() {
     .set_default(.97)
     .set_min_max(0.0, 1.0)
     .set_description("stop writing to the log file when device utilization reaches this ratio")
-    .add_see_also("log_file"),
+    .set_long_description("The device is checked every heartbeat_interval by the service thread, not as the log is written.  Writes resume once utilization drops below this again; in between, entries still go to syslog, stderr and graylog and are kept for a crash dump.")
+    .add_see_also({"log_file", "heartbeat_interval"}),
 
     Option("log_to_graylog", Option::TYPE_BOOL, Option::LEVEL_BASIC)
     .set_default(false)
@@ -627,6 +1109,72 @@ std::vector<Option> get_global_options() {
     .set_description("port number for the remote graylog server")
     .add_see_also("log_graylog_host"),
 
+    Option("log_graylog_protocol", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("udp")
+    .set_enum_allowed({"udp", "tcp"})
+    .set_description("transport used to ship log lines to the graylog server")
+    .set_long_description("'udp' sends one datagram per log line, messages longer than a datagram are truncated.  'tcp' keeps a connection open and reconnects at most once a second while the server is unreachable.  Either way lines that cannot be sent are dropped and counted rather than delaying the log.")
+    .add_see_also({"log_graylog_host", "log_graylog_port", "log_graylog_format"}),
+
+    Option("log_graylog_format", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("gelf")
+    .set_enum_allowed({"gelf", "binary"})
+    .set_description("record format for log lines shipped to the graylog server")
+    .set_long_description("'gelf' sends GELF 1.1 JSON messages.  'binary' sends the records of log_format=binary, which is cheaper to produce but needs a collector that understands it.")
+    .add_see_also({"log_graylog_protocol", "log_format"}),
+
+    Option("log_rotate_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("rotate the log file once it reaches this size (0 to disable)")
+    .set_long_description("The log file is renamed to log_file.1 (shifting older ones up to log_rotate_keep) and a new one put in its place without stopping the log thread, so there is no need for logrotate and SIGHUP.  Don't combine this with an external logrotate of the same file.  The size is checked after each flush, and writes still in flight when the file is rotated land in the new file.")
+    .add_see_also({"log_rotate_interval", "log_rotate_keep", "log_file"}),
+
+    Option("log_rotate_interval", Option::TYPE_SECS, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("rotate the log file after this many seconds (0 to disable)")
+    .set_long_description("Counted from when the file was opened or last rotated.  An empty log file is not rotated.")
+    .add_see_also({"log_rotate_size", "log_rotate_keep"}),
+
+    Option("log_rotate_keep", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(7)
+    .set_min(1)
+    .set_description("number of rotated log files to keep")
+    .add_see_also({"log_rotate_size", "log_rotate_interval"}),
+
+    Option("log_suppress_repeats", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("collapse repeated log lines into 'last message repeated N times'")
+    .set_long_description("When a line from a subsystem is identical (ignoring the timestamp and thread) to the line written just before it, it is not formatted or written; instead a summary with the number of repeats is written when a different line follows, or every second while the repeats continue.  The in-memory recent entries and crash dumps are not affected."),
+
+    Option("log_thread_names", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("identify threads in log lines by name and tid instead of pthread_t")
+    .set_long_description("Lines from a registered thread (one started with Thread::create() or make_named_thread(), or that called register_thread()) give '<name>/<tid>' in place of the thread's pthread_t in hex; other threads stay in hex.  The tid is the one top, perf and gdb show.  Each thread's name is looked up once, not per line.  Crash dumps keep the hex form, as they cannot look names up safely."),
+
+    Option("log_trace", Option::TYPE_STR, Option::LEVEL_DEV)
+    .set_default("")
+    .set_description("log everything up to a debug level for the named requests or connections")
+    .set_long_description("A comma separated list of tag=level (level defaults to 20).  Code handling a unit of work that is known by a tag, such as 'client.4123', opens a trace scope for it; while the tag is listed here every log line in that scope up to the given level is written, regardless of the debug_* levels, which stay in effect for everything else.  Traced lines also bypass log_rate_limit_*."),
+
+    Option("log_trace_sample_rate", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(0)
+    .set_min_max(0.0, 1.0)
+    .set_description("log everything up to log_trace_sample_level for this fraction of requests")
+    .set_long_description("Code handling a request that carries a trace ID opens a trace scope for it; if the ID is among this fraction of all IDs (0.001 for one request in a thousand), every log line in that scope up to log_trace_sample_level is written, regardless of the debug_* levels, and bypasses log_rate_limit_*.  The choice is a hash of the ID and log_trace_sample_seed alone, so daemons configured alike pick the same requests, and a picked request is logged in detail at every daemon it passes through rather than at random ones.  Set it cluster-wide (ceph config set global) to follow requests end to end.  0 disables it.")
+    .add_see_also({"log_trace_sample_level", "log_trace_sample_seed", "log_trace"}),
+
+    Option("log_trace_sample_level", Option::TYPE_INT, Option::LEVEL_DEV)
+    .set_default(20)
+    .set_min_max(0, 30)
+    .set_description("the debug level requests picked by log_trace_sample_rate are logged at")
+    .add_see_also("log_trace_sample_rate"),
+
+    Option("log_trace_sample_seed", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(0)
+    .set_description("mixed into the hash that log_trace_sample_rate picks requests by")
+    .set_long_description("Changing it picks a different set of requests at the same rate.  Daemons only agree on which requests to log when it is the same for all of them.")
+    .add_see_also("log_trace_sample_rate"),
+
     Option("log_coarse_timestamps", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(true)
     .set_description("timestamp log entries from coarse system clock "
@@ -635,6 +1183,24 @@ std::vector<Option> get_global_options() {
     .add_tag("performance")
     .add_tag("service"),
 
+    Option("log_clock", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("system")
+    .set_enum_allowed({"system", "tsc"})
+    .set_description("where log entry timestamps come from")
+    .set_long_description("'system' reads the system clock, coarse or fine as log_coarse_timestamps has it.  'tsc' reads the cpu's cycle counter (the TSC, or the generic timer on arm64) and converts it to wall time, recalibrating against the system clock about once a second from the log thread; it is for hosts, typically VMs without a TSC clocksource, where reading the system clock is a system call.  Timestamps are then fine grained and may be off by up to a millisecond.  Falls back to 'system' where the counter doesn't tick at a constant rate.")
+    .add_service("common")
+    .add_tag("performance")
+    .add_see_also("log_coarse_timestamps")
+    .add_see_also("coarse_clock_page"),
+
+    Option("coarse_clock_page", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("read the coarse clocks from memory a thread refreshes every millisecond")
+    .set_long_description("The coarse clocks, which coarse log timestamps and most timeouts read, are then a load from memory rather than a clock_gettime() call, and are good to a millisecond rather than to the kernel's tick, at the cost of a thread waking every millisecond.  It is for the whole process: with more than one context the last to change it wins.")
+    .add_service("common")
+    .add_tag("performance")
+    .add_see_also("log_coarse_timestamps"),
+
 
     // unmodified
     Option("clog_to_monitors", Option::TYPE_STR, Option::LEVEL_ADVANCED)
@@ -895,6 +1461,12 @@ std::vector<Option> get_global_options() {
     .set_description("Enable internal performance metrics")
     .set_long_description("If enabled, collect and expose internal health metrics"),
 
+    Option("perf_export_file", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("file to publish perf counter values in, e.g. '$run_dir/$cluster-$name.perf'")
+    .set_long_description("If set, the counters 'perf dump' reports (all but histograms) are kept in a shared mapping of this file, updated every heartbeat_interval, for a metrics exporter to read directly instead of asking the admin socket.  The file has a fixed schema of counter names and types, and values guarded by a sequence count; see common/global/perf_export.h for the layout.  When counters are added or removed, a new file replaces it and the old one is marked retired.  It is removed when the daemon exits.")
+    .add_see_also({"heartbeat_interval", "admin_socket"}),
+
     Option("ms_type", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_flag(Option::FLAG_STARTUP)
     .set_default("async+posix")
@@ -7486,16 +8058,7 @@ static std::vector<Option> get_rbd_options() {
            Option::LEVEL_ADVANCED)
     .set_default(64_K)
     .set_min_max(4_K, 32_M)
-    .set_validator([](std::string *value, std::string *error_message){
-        uint64_t f = strict_si_cast<uint64_t>(value->c_str(), error_message);
-        if (!error_message->empty()) {
-          return -EINVAL;
-        } else if (!isp2(f)) {
-          *error_message = "value must be a power of two";
-          return -EINVAL;
-        }
-        return 0;
-      })
+    .set_typed_validator<uint64_t, validate_power_of_two>()
     .set_description("minimum aligned size of discard operations"),
 
     Option("rbd_enable_alloc_hint", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
@@ -8618,24 +9181,91 @@ std::vector<Option> get_mds_client_options() {
 }
 
 
-static std::vector<Option> build_options()
+namespace {
+struct option_group_def_t {
+  std::vector<Option> (*get)();
+  const char *service;
+  unsigned group;
+};
+const option_group_def_t option_groups[] = {
+  {get_rgw_options, "rgw", OPTION_GROUP_RGW},
+  {get_rbd_options, "rbd", OPTION_GROUP_RBD},
+  {get_rbd_mirror_options, "rbd-mirror", OPTION_GROUP_RBD_MIRROR},
+  {get_mds_options, "mds", OPTION_GROUP_MDS},
+  {get_mds_client_options, "mds_client", OPTION_GROUP_MDS_CLIENT},
+};
+}
+
+static std::vector<Option> build_options(unsigned groups)
 {
+  std::vector<std::pair<std::vector<Option>, const char*>> services;
+  for (auto& g : option_groups) {
+    if (groups & g.group) {
+      services.emplace_back(g.get(), g.service);
+    }
+  }
   std::vector<Option> result = get_global_options();
 
-  auto ingest = [&result](std::vector<Option>&& options, const char* svc) {
+  // Option can't be moved (its name is const), so grow the table only once
+  std::size_t total = result.size();
+  for (auto& [options, svc] : services) {
+    total += options.size();
+  }
+  result.reserve(total);
+  for (auto& [options, svc] : services) {
     for (auto &o : options) {
       o.add_service(svc);
       result.push_back(std::move(o));
     }
-  };
-
-  ingest(get_rgw_options(), "rgw");
-  ingest(get_rbd_options(), "rbd");
-  ingest(get_rbd_mirror_options(), "rbd-mirror");
-  ingest(get_mds_options(), "mds");
-  ingest(get_mds_client_options(), "mds_client");
+  }
 
   return result;
 }
 
-const std::vector<Option> ceph_options = build_options();
+unsigned get_option_groups(uint32_t module_type)
+{
+  switch (module_type) {
+  case CEPH_ENTITY_TYPE_OSD:
+    // osd_client_watch_timeout is in with the cephfs client's
+    return OPTION_GROUP_MDS_CLIENT;
+  case CEPH_ENTITY_TYPE_MDS:
+    return OPTION_GROUP_MDS | OPTION_GROUP_MDS_CLIENT;
+  default:
+    return OPTION_GROUPS_ALL;
+  }
+}
+
+const std::vector<Option>& get_ceph_options(unsigned groups)
+{
+  static std::mutex lock;
+  // never destroyed, like the function local table they replace, and for
+  // the same reason: a config may still be looking at them
+  static const std::vector<Option> *tables[OPTION_GROUPS_ALL + 1];
+  groups &= OPTION_GROUPS_ALL;
+  std::scoped_lock l(lock);
+  if (!tables[groups]) {
+    tables[groups] = new std::vector<Option>(build_options(groups));
+  }
+  return *tables[groups];
+}
+
+const group_option_t *find_group_option(std::string_view name)
+{
+  // built, and the options themselves dropped, when first needed
+  static const std::vector<group_option_t> names = [] {
+    std::vector<group_option_t> names;
+    for (auto& g : option_groups) {
+      for (auto& o : g.get()) {
+	names.push_back({o.name, o.type, g.group});
+      }
+    }
+    std::sort(names.begin(), names.end(),
+	      [](const auto& a, const auto& b) { return a.name < b.name; });
+    return names;
+  }();
+  auto p = std::lower_bound(names.begin(), names.end(), name,
+			    [](const auto& a, std::string_view n) {
+			      return a.name < n;
+			    });
+  return p != names.end() && p->name == name ? &*p : nullptr;
+}
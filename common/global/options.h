@@ -4,8 +4,12 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
+#include <initializer_list>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <boost/container/flat_map.hpp>
 #include <boost/variant.hpp>
 #include "include/str_list.h"
 #include "msg/msg_types.h"
@@ -23,6 +27,7 @@ struct Option {
     TYPE_UUID = 7,
     TYPE_SIZE = 8,
     TYPE_SECS = 9,
+    TYPE_LOGLEVEL = 10,
   };
 
   static const char *type_to_c_type_str(type_t t) {
@@ -37,6 +42,7 @@ struct Option {
     case TYPE_UUID: return "uuid_d";
     case TYPE_SIZE: return "size_t";
     case TYPE_SECS: return "secs";
+    case TYPE_LOGLEVEL: return "log_level_t";
     default: return "unknown";
     }
   }
@@ -52,6 +58,7 @@ struct Option {
     case TYPE_UUID: return "uuid";
     case TYPE_SIZE: return "size";
     case TYPE_SECS: return "secs";
+    case TYPE_LOGLEVEL: return "loglevel";
     default: return "unknown";
     }
   }
@@ -86,6 +93,9 @@ struct Option {
     if (s == "secs") {
       return TYPE_SECS;
     }
+    if (s == "loglevel") {
+      return TYPE_LOGLEVEL;
+    }
     return -1;
   }
 
@@ -130,6 +140,23 @@ struct Option {
     }
   };
 
+  /// a debug_* setting, "N" or "N/M": the level to log at and the level
+  /// to gather at, each 0-99
+  struct log_level_t {
+    int log;
+    int gather;
+    bool operator==(const log_level_t& rhs) const {
+      return log == rhs.log && gather == rhs.gather;
+    }
+    bool operator<(const log_level_t& rhs) const {
+      return log < rhs.log || (log == rhs.log && gather < rhs.gather);
+    }
+  };
+  /// parse "N" or "N/M" without allocating; false, with *err set, if the
+  /// levels are malformed or out of range
+  static bool parse_log_level(std::string_view s, log_level_t *out,
+			      std::string *err);
+
   using value_t = boost::variant<boost::blank,
                                  std::string,
                                  uint64_t,
@@ -140,42 +167,80 @@ struct Option {
                                  entity_addrvec_t,
                                  std::chrono::seconds,
                                  size_t,
-                                 uuid_d>;
+                                 uuid_d,
+                                 log_level_t>;
   const std::string name;
   const type_t type;
   const level_t level;
 
-  std::string desc;
-  std::string long_desc;
+  // these point at string literals (or at storage the creator of the
+  // Option keeps) so that building the option table copies no text
+  std::string_view desc;
+  std::string_view long_desc;
 
   unsigned flags = 0;
 
   int subsys = -1; // if >= 0, we are a subsys debug level
+  int subsys_rate = -1; // if >= 0, we are a subsys log rate limit
+  int subsys_sample = -1; // if >= 0, we are a subsys log sampling rate
 
   value_t value;
   value_t daemon_value;
 
   static std::string to_str(const value_t& v);
 
+  /// a list of string literals for the metadata below.  The lists of all
+  /// options live together in blocks that are never freed (see
+  /// literals_t::append()), so an option holds only a pointer and a count
+  /// and building the option table makes no allocation per list.
+  class literals_t {
+  public:
+    literals_t() = default;
+
+    const char* const* begin() const {
+      return m_first;
+    }
+    const char* const* end() const {
+      return m_first + m_size;
+    }
+    std::size_t size() const {
+      return m_size;
+    }
+    bool empty() const {
+      return m_size == 0;
+    }
+
+    /// this list followed by ts; extends this one in place when it is the
+    /// last one made and there is room
+    literals_t append(std::initializer_list<const char*> ts) const;
+
+  private:
+    literals_t(const char* const* first, uint32_t size)
+      : m_first(first), m_size(size) {}
+
+    const char* const* m_first = nullptr;
+    uint32_t m_size = 0;
+  };
+
   // Items like mon, osd, rgw, rbd, ceph-fuse.  This is advisory metadata
   // for presentation layers (like web dashboards, or generated docs), so that
   // they know which options to display where.
   // Additionally: "common" for settings that exist in any Ceph code.  Do
   // not use common for settings that are just shared some places: for those
   // places, list them.
-  std::vector<const char*> services;
+  literals_t services;
 
   // Topics like:
   // "service": a catchall for the boring stuff like log/asok paths.
   // "network"
   // "performance": a setting that may need adjustment depending on
   //                environment/workload to get best performance.
-  std::vector<const char*> tags;
+  literals_t tags;
 
-  std::vector<const char*> see_also;
+  literals_t see_also;
 
   value_t min, max;
-  std::vector<const char*> enum_allowed;
+  literals_t enum_allowed;
 
   /**
    * Return nonzero and set second argument to error string if the
@@ -187,6 +252,16 @@ struct Option {
   typedef std::function<int(std::string *, std::string *)> validator_fn_t;
   validator_fn_t validator;
 
+  /**
+   * A validator of the parsed value, which it may also adjust, run before
+   * the min/max/enum checks.  Unlike the string validator above it costs
+   * no copy or reparse of the value, and being a plain function it costs
+   * nothing to register; see set_typed_validator().
+   */
+  template<typename T>
+  using typed_validator_fn_t = int (*)(T *, std::string *);
+  int (*typed_validator)(const Option&, value_t *, std::string *) = nullptr;
+
   Option(std::string const &name, type_t t, level_t l)
     : name(name), type(t), level(l)
   {
@@ -214,6 +289,8 @@ struct Option {
       value = size_t{0}; break;
     case TYPE_SECS:
       value = std::chrono::seconds{0}; break;
+    case TYPE_LOGLEVEL:
+      value = log_level_t{0, 0}; break;
     default:
       ceph_abort();
     }
@@ -224,6 +301,11 @@ struct Option {
   // Validate and potentially modify incoming string value
   int pre_validate(std::string *new_value, std::string *err) const;
 
+  // Run the typed validator, if any, over a parsed value
+  int typed_validate(Option::value_t *new_value, std::string *err) const {
+    return typed_validator ? typed_validator(*this, new_value, err) : 0;
+  }
+
   // Validate properly typed value against bounds
   int validate(const Option::value_t &new_value, std::string *err) const;
 
@@ -289,27 +371,27 @@ struct Option {
     return set_value(daemon_value, v);
   }
   Option& add_tag(const char* tag) {
-    tags.push_back(tag);
+    tags = tags.append({tag});
     return *this;
   }
   Option& add_tag(const std::initializer_list<const char*>& ts) {
-    tags.insert(tags.end(), ts);
+    tags = tags.append(ts);
     return *this;
   }
   Option& add_service(const char* service) {
-    services.push_back(service);
+    services = services.append({service});
     return *this;
   }
   Option& add_service(const std::initializer_list<const char*>& ss) {
-    services.insert(services.end(), ss);
+    services = services.append(ss);
     return *this;
   }
   Option& add_see_also(const char* t) {
-    see_also.push_back(t);
+    see_also = see_also.append({t});
     return *this;
   }
   Option& add_see_also(const std::initializer_list<const char*>& ts) {
-    see_also.insert(see_also.end(), ts);
+    see_also = see_also.append(ts);
     return *this;
   }
   Option& set_description(const char* new_desc) {
@@ -334,9 +416,9 @@ struct Option {
     return *this;
   }
 
-  Option& set_enum_allowed(const std::vector<const char*>& allowed)
+  Option& set_enum_allowed(const std::initializer_list<const char*>& allowed)
   {
-    enum_allowed = allowed;
+    enum_allowed = literals_t().append(allowed);
     return *this;
   }
 
@@ -355,11 +437,38 @@ struct Option {
     return *this;
   }
 
+  /// F checks values of this option's type T, e.g. uint64_t for a
+  /// TYPE_UINT option or std::string for a TYPE_STR one
+  template<typename T, typed_validator_fn_t<T> F>
+  Option &set_typed_validator()
+  {
+    typed_validator = [](const Option& opt, value_t *v, std::string *err) {
+      T *t = boost::get<T>(v);
+      if (!t) {
+	std::cerr << "Bad type for typed validator: " << opt.name << ": "
+		  << typeid(T).name() << std::endl;
+	ceph_abort();
+      }
+      return F(t, err);
+    };
+    return *this;
+  }
+
   Option &set_subsys(int s) {
     subsys = s;
     return *this;
   }
 
+  Option &set_subsys_rate(int s) {
+    subsys_rate = s;
+    return *this;
+  }
+
+  Option &set_subsys_sample(int s) {
+    subsys_sample = s;
+    return *this;
+  }
+
   void dump(Formatter *f) const;
   void print(ostream *out) const;
 
@@ -386,5 +495,45 @@ struct Option {
   }
 };
 
-extern const std::vector<Option> ceph_options;
+/// the position of an option in md_config_t::schema; hot paths look it up
+/// once with get_option_id() and read the option by id from then on
+enum class OptionId : uint32_t {
+  NONE = UINT32_MAX,
+};
+
+/// options by name, sorted; the position of an option is its OptionId
+using option_index_t = boost::container::flat_map<
+  std::string_view, std::reference_wrapper<const Option>>;
+
+/// groups of options only some modules use; the rest are global
+enum option_group_t : unsigned {
+  OPTION_GROUP_RGW = 1 << 0,
+  OPTION_GROUP_RBD = 1 << 1,
+  OPTION_GROUP_RBD_MIRROR = 1 << 2,
+  OPTION_GROUP_MDS = 1 << 3,
+  OPTION_GROUP_MDS_CLIENT = 1 << 4,
+  OPTION_GROUPS_ALL = (1 << 5) - 1,
+};
+
+/// the option groups a module (CEPH_ENTITY_TYPE_*) uses: all of them for
+/// the mons and mgrs, which keep and check everybody's settings, and for
+/// clients, which may be any of rgw, rbd or a cephfs client
+unsigned get_option_groups(uint32_t module_type);
+
+/// the global options along with those of groups, by default every
+/// compiled-in Option; each such table is built on first use rather than
+/// at static initialization, so programs that never read their config (or
+/// never ask for the rest) don't pay for it
+const std::vector<Option>& get_ceph_options(
+  unsigned groups = OPTION_GROUPS_ALL);
+
+/// what is known about every option in a group without building it
+struct group_option_t {
+  std::string name;
+  Option::type_t type;
+  unsigned group; ///< OPTION_GROUP_*
+};
+/// the option of some group called name, or nullptr if there is none; for
+/// telling a setting meant for another module from a misspelt one
+const group_option_t *find_group_option(std::string_view name);
 
@@ -0,0 +1,405 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "perf_export.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <tuple>
+#include <unistd.h>
+
+#include "common/ceph_time.h"
+#include "include/compat.h"
+
+namespace ceph {
+
+namespace {
+
+constexpr std::size_t align8(std::size_t n) {
+  return (n + 7) & ~std::size_t(7);
+}
+
+bool exported(const PerfCounters::perf_counter_data_any_d& d) {
+  // a histogram is not a value
+  return !(d.type & PERFCOUNTER_HISTOGRAM);
+}
+
+/// v, or if it is a time in ns, in seconds
+void append_value(std::string *out, uint64_t v, bool time) {
+  char buf[32];
+  int n;
+  if (time) {
+    n = snprintf(buf, sizeof(buf), "%" PRIu64 ".%09" PRIu64,
+		 v / 1000000000, v % 1000000000);
+  } else {
+    n = snprintf(buf, sizeof(buf), "%" PRIu64, v);
+  }
+  out->append(buf, n);
+}
+
+/// d, escaped as a label value or HELP text
+void append_escaped(std::string *out, std::string_view d) {
+  for (char c : d) {
+    switch (c) {
+    case '\\':
+      out->append("\\\\");
+      break;
+    case '\n':
+      out->append("\\n");
+      break;
+    case '"':
+      out->append("\\\"");
+      break;
+    default:
+      out->push_back(c);
+    }
+  }
+}
+
+}
+
+void perf_openmetrics(const PerfCountersCollection& coll,
+		      std::string_view daemon, std::string *out)
+{
+  std::string labels = "{ceph_daemon=\"";
+  append_escaped(&labels, daemon);
+  labels += "\"} ";
+  std::string name;
+  coll.with_counters([&](const PerfCountersCollectionImpl::CounterMap& by_path) {
+    for (const auto& [path, ref] : by_path) {
+      const auto& d = *ref.data;
+      if (!exported(d)) {
+	continue;
+      }
+      name = "ceph_";
+      for (char c : path) {
+	name.push_back(isalnum((unsigned char)c) ? c : '_');
+      }
+      const bool time = d.type & PERFCOUNTER_TIME;
+      const char *type = "gauge";
+      if (d.type & PERFCOUNTER_LONGRUNAVG) {
+	type = "summary";
+      } else if (d.type & PERFCOUNTER_COUNTER) {
+	type = "counter";
+      }
+      *out += "# TYPE ";
+      *out += name;
+      out->push_back(' ');
+      *out += type;
+      out->push_back('\n');
+      if (d.description && *d.description) {
+	*out += "# HELP ";
+	*out += name;
+	out->push_back(' ');
+	append_escaped(out, d.description);
+	out->push_back('\n');
+      }
+      if (d.type & PERFCOUNTER_LONGRUNAVG) {
+	auto [sum, count] = d.read_avg();
+	*out += name;
+	*out += "_sum";
+	*out += labels;
+	append_value(out, sum, time);
+	out->push_back('\n');
+	*out += name;
+	*out += "_count";
+	*out += labels;
+	append_value(out, count, false);
+      } else {
+	*out += name;
+	if (d.type & PERFCOUNTER_COUNTER) {
+	  *out += "_total";
+	}
+	*out += labels;
+	append_value(out, d.u64, time);
+      }
+      out->push_back('\n');
+    }
+  });
+  *out += "# EOF\n";
+}
+
+PerfDelta::PerfDelta(PerfCountersCollection *coll)
+  : m_coll(coll),
+    m_instance(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		 real_clock::now().time_since_epoch()).count())
+{
+}
+
+void PerfDelta::dump(std::string_view cursor, std::string *out)
+{
+  // a cursor is <instance>-<gen>
+  uint64_t since = 0;
+  bool valid = false;
+  if (!cursor.empty()) {
+    const std::string c(cursor);
+    uint64_t instance;
+    int n = 0;
+    valid = sscanf(c.c_str(), "%" SCNx64 "-%" SCNu64 "%n",
+		   &instance, &since, &n) == 2 &&
+      std::size_t(n) == c.size() && instance == m_instance;
+  }
+  std::lock_guard l{m_lock};
+  _update();
+  const bool full = !valid || since < m_reset_gen || since > m_gen;
+  char buf[64];
+  int n = snprintf(buf, sizeof(buf), "cursor %" PRIx64 "-%" PRIu64 "%s\n",
+		   m_instance, m_gen, full ? " full" : "");
+  out->append(buf, n);
+  for (const auto& e : m_entries) {
+    if (!full && e.gen <= since) {
+      continue;
+    }
+    *out += e.path;
+    out->push_back(' ');
+    append_value(out, e.value, false);
+    if (e.data->type & PERFCOUNTER_LONGRUNAVG) {
+      out->push_back(' ');
+      append_value(out, e.avgcount, false);
+    }
+    out->push_back('\n');
+  }
+}
+
+bool PerfDelta::_same_counters(const CounterMap& by_path) const
+{
+  auto i = m_entries.begin();
+  for (const auto& [path, ref] : by_path) {
+    if (!exported(*ref.data)) {
+      continue;
+    }
+    if (i == m_entries.end() || i->data != ref.data || i->path != path) {
+      return false;
+    }
+    ++i;
+  }
+  return i == m_entries.end();
+}
+
+void PerfDelta::_reset(const CounterMap& by_path)
+{
+  m_entries.clear();
+  for (const auto& [path, ref] : by_path) {
+    if (exported(*ref.data)) {
+      m_entries.push_back({path, ref.data});
+    }
+  }
+  // every cursor from before now gets a full dump
+  m_reset_gen = ++m_gen;
+}
+
+void PerfDelta::_update()
+{
+  m_coll->with_counters([this](const CounterMap& by_path) {
+    if (!_same_counters(by_path)) {
+      _reset(by_path);
+    }
+    // everything that changed since the last dump shares one generation
+    const uint64_t gen = m_gen + 1;
+    bool changed = false;
+    for (auto& e : m_entries) {
+      uint64_t value, avgcount = 0;
+      if (e.data->type & PERFCOUNTER_LONGRUNAVG) {
+	std::tie(value, avgcount) = e.data->read_avg();
+      } else {
+	value = e.data->u64;
+      }
+      if (value != e.value || avgcount != e.avgcount || e.gen == 0) {
+	e.value = value;
+	e.avgcount = avgcount;
+	e.gen = gen;
+	changed = true;
+      }
+    }
+    if (changed) {
+      m_gen = gen;
+    }
+  });
+}
+
+PerfExport::~PerfExport()
+{
+  set_path("");
+}
+
+int PerfExport::set_path(const std::string& path)
+{
+  if (path == m_path) {
+    return 0;
+  }
+  if (m_header) {
+    _retire();
+    ::unlink(m_path.c_str());
+  }
+  m_path = path;
+  if (path.empty()) {
+    return 0;
+  }
+  // if this fails, nothing is exported until the path changes
+  int r = 0;
+  m_coll->with_counters([this, &r](const CounterMap& by_path) {
+    r = _create(by_path);
+    if (r == 0) {
+      _write_values();
+    }
+  });
+  return r;
+}
+
+int PerfExport::update()
+{
+  if (!m_header) {
+    return 0;
+  }
+  int r = 0;
+  m_coll->with_counters([this, &r](const CounterMap& by_path) {
+    if (!_same_counters(by_path)) {
+      // keeps the old file if it can't lay out a new one
+      r = _create(by_path);
+      if (r < 0) {
+	return;
+      }
+    }
+    _write_values();
+  });
+  return r;
+}
+
+bool PerfExport::_same_counters(const CounterMap& by_path) const
+{
+  auto i = m_counters.begin();
+  for (const auto& [path, ref] : by_path) {
+    if (!exported(*ref.data)) {
+      continue;
+    }
+    // a removed counter's memory may be reused by a new one
+    if (i == m_counters.end() || i->second != ref.data || i->first != path) {
+      return false;
+    }
+    ++i;
+  }
+  return i == m_counters.end();
+}
+
+/// lay out a file for by_path, rename it over m_path and retire the old one
+int PerfExport::_create(const CounterMap& by_path)
+{
+  decltype(m_counters) counters;
+  std::size_t names_size = 0;
+  for (const auto& [path, ref] : by_path) {
+    if (exported(*ref.data)) {
+      counters.emplace_back(path, ref.data);
+      names_size += path.size();
+    }
+  }
+  const std::size_t counters_offset = sizeof(perf_export::header);
+  const std::size_t names_offset = counters_offset +
+    counters.size() * sizeof(perf_export::counter);
+  const std::size_t values_offset = align8(names_offset + names_size);
+  const std::size_t len = values_offset +
+    counters.size() * sizeof(perf_export::value);
+
+  const std::string tmp = m_path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -errno;
+  }
+  void *p = MAP_FAILED;
+  int r = 0;
+  if (::ftruncate(fd, len) < 0) {
+    r = -errno;
+  } else {
+    p = ::mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      r = -errno;
+    }
+  }
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  if (r < 0) {
+    ::unlink(tmp.c_str());
+    return r;
+  }
+
+  char *base = static_cast<char*>(p);
+  auto h = reinterpret_cast<perf_export::header*>(base);
+  h->version = perf_export::VERSION;
+  h->header_size = sizeof(*h);
+  h->pid = getpid();
+  h->num_counters = counters.size();
+  h->counter_size = sizeof(perf_export::counter);
+  h->counters_offset = counters_offset;
+  h->names_offset = names_offset;
+  h->names_size = names_size;
+  h->values_offset = values_offset;
+  auto c = reinterpret_cast<perf_export::counter*>(base + counters_offset);
+  std::size_t name_offset = 0;
+  for (const auto& [path, data] : counters) {
+    memcpy(base + names_offset + name_offset, path.data(), path.size());
+    c->name_offset = name_offset;
+    c->name_len = path.size();
+    c->type = data->type;
+    c->unit = data->unit;
+    c->prio = data->prio;
+    name_offset += path.size();
+    ++c;
+  }
+  // a reader that sees the magic sees a complete schema
+  std::atomic_thread_fence(std::memory_order_release);
+  h->magic = perf_export::MAGIC;
+
+  if (::rename(tmp.c_str(), m_path.c_str()) < 0) {
+    r = -errno;
+    ::munmap(p, len);
+    ::unlink(tmp.c_str());
+    return r;
+  }
+  _retire();
+  m_header = h;
+  m_map_len = len;
+  m_counters = std::move(counters);
+  return 0;
+}
+
+void PerfExport::_retire()
+{
+  if (!m_header) {
+    return;
+  }
+  m_header->retired.store(1, std::memory_order_release);
+  ::munmap(m_header, m_map_len);
+  m_header = nullptr;
+  m_map_len = 0;
+  m_counters.clear();
+}
+
+void PerfExport::_write_values()
+{
+  auto v = reinterpret_cast<perf_export::value*>(
+    reinterpret_cast<char*>(m_header) + m_header->values_offset);
+  const uint64_t seq = m_header->seq.load(std::memory_order_relaxed);
+  m_header->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (const auto& [path, data] : m_counters) {
+    (void)path;
+    if (data->type & PERFCOUNTER_LONGRUNAVG) {
+      auto [sum, count] = data->read_avg();
+      v->value.store(sum, std::memory_order_relaxed);
+      v->avgcount.store(count, std::memory_order_relaxed);
+    } else {
+      v->value.store(data->u64, std::memory_order_relaxed);
+    }
+    ++v;
+  }
+  m_header->stamp.store(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      real_clock::now().time_since_epoch()).count(),
+    std::memory_order_relaxed);
+  m_header->seq.store(seq + 2, std::memory_order_release);
+}
+
+}
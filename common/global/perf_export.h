@@ -0,0 +1,171 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_COMMON_PERF_EXPORT_H
+#define CEPH_COMMON_PERF_EXPORT_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/ceph_mutex.h"
+#include "common/perf_counters_collection.h"
+
+namespace ceph {
+
+/* Layout of a perf_export_file.
+ *
+ * A header, then num_counters fixed size counter entries (the schema),
+ * the names they point into, and num_counters values.  Fields are in host
+ * byte order.  Only the values and the header's seq and stamp change once
+ * the file is in place; whenever the set of counters changes a new file
+ * is renamed over the path and the old one marked retired, so a reader
+ * that sees retired reopens the path.
+ *
+ * The values are a seqlock: seq is odd while they are written.  A reader
+ * loads seq, copies what it needs, loads seq again, and retries if the two
+ * differ or the first was odd.
+ */
+namespace perf_export {
+
+constexpr uint64_t MAGIC = 0x5452505846524550; // "PERFXPRT"
+constexpr uint32_t VERSION = 1;
+
+struct header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  int64_t pid;
+  uint32_t num_counters;
+  uint32_t counter_size;    ///< sizeof(counter)
+  uint64_t counters_offset;
+  uint64_t names_offset;
+  uint64_t names_size;
+  uint64_t values_offset;
+  std::atomic<uint64_t> seq;
+  std::atomic<uint64_t> stamp;  ///< nanoseconds since the epoch
+  std::atomic<uint8_t> retired;
+  uint8_t reserved[47];
+};
+static_assert(sizeof(header) == 128, "on-disk layout must not change");
+
+struct counter {
+  uint64_t name_offset;  ///< "logger.counter", from names_offset
+  uint32_t name_len;
+  uint8_t type;          ///< perfcounter_type_d
+  uint8_t unit;          ///< unit_t
+  uint8_t prio;
+  uint8_t reserved;
+};
+static_assert(sizeof(counter) == 16, "on-disk layout must not change");
+
+struct value {
+  std::atomic<uint64_t> value;     ///< time in ns; the sum for averages
+  std::atomic<uint64_t> avgcount;  ///< for PERFCOUNTER_LONGRUNAVG
+};
+static_assert(sizeof(value) == 16, "on-disk layout must not change");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+	      "shared with other processes");
+
+} // namespace perf_export
+
+/**
+ * append coll's counters to out as OpenMetrics text
+ *
+ * Each counter is a family named ceph_<logger>_<counter>, with a
+ * ceph_daemon label.  Counters are counters, averages are summaries and
+ * the rest gauges; times are in seconds.  The two dimensional histograms
+ * have no OpenMetrics equivalent and are left out.
+ */
+void perf_openmetrics(const PerfCountersCollection& coll,
+		      std::string_view daemon, std::string *out);
+
+/* Answers "perf dump delta": the counters that changed since a client's
+ * cursor, as text with one counter per line, so a collector that polls
+ * every few seconds gets a few lines instead of every counter.
+ *
+ *   cursor <cursor>[ full]
+ *   <logger>.<counter> <value>
+ *   <logger>.<counter> <sum> <avgcount>   (averages)
+ *
+ * Times are in ns.  A client sends back the cursor of its last answer;
+ * with none, a cursor from another instance (a restarted daemon), or one
+ * older than the last time counters were added or removed, the answer is
+ * every counter and its first line says full, after which the client
+ * drops what it had.
+ *
+ * No per client state is kept: each counter remembers the generation it
+ * last changed in, and a cursor is a generation, so any number of clients
+ * can poll at their own pace.
+ */
+class PerfDelta {
+public:
+  explicit PerfDelta(PerfCountersCollection *coll);
+  PerfDelta(const PerfDelta&) = delete;
+  PerfDelta& operator=(const PerfDelta&) = delete;
+
+  /// append the counters changed since cursor to out
+  void dump(std::string_view cursor, std::string *out);
+
+private:
+  using CounterMap = PerfCountersCollectionImpl::CounterMap;
+
+  struct entry {
+    std::string path;
+    const PerfCounters::perf_counter_data_any_d *data;
+    uint64_t value = 0;
+    uint64_t avgcount = 0;
+    uint64_t gen = 0;   ///< when value or avgcount last changed
+  };
+
+  bool _same_counters(const CounterMap& by_path) const;
+  void _reset(const CounterMap& by_path);
+  /// read every counter, moving those that changed to a new generation
+  void _update();
+
+  PerfCountersCollection *const m_coll;
+  /// tells this instance's cursors from those of an earlier one
+  const uint64_t m_instance;
+  ceph::mutex m_lock = ceph::make_mutex("PerfDelta::m_lock");
+  std::vector<entry> m_entries;
+  uint64_t m_gen = 0;
+  uint64_t m_reset_gen = 0;  ///< m_entries last laid out
+};
+
+/// publishes a PerfCountersCollection through a perf_export_file
+class PerfExport {
+public:
+  explicit PerfExport(PerfCountersCollection *coll) : m_coll(coll) {}
+  PerfExport(const PerfExport&) = delete;
+  PerfExport& operator=(const PerfExport&) = delete;
+  /// retires and removes the file
+  ~PerfExport();
+
+  /// export to path from now on ("" for nowhere); a no-op if unchanged
+  int set_path(const std::string& path);
+  /// copy the current values into the file, first laying out a new one
+  /// if counters were added or removed
+  int update();
+
+private:
+  using CounterMap = PerfCountersCollectionImpl::CounterMap;
+
+  bool _same_counters(const CounterMap& by_path) const;
+  int _create(const CounterMap& by_path);
+  void _retire();
+  void _write_values();
+
+  PerfCountersCollection *const m_coll;
+  std::string m_path;
+  perf_export::header *m_header = nullptr;  ///< the mapping, if any
+  std::size_t m_map_len = 0;
+  /// the exported counters, in file order
+  std::vector<std::pair<std::string,
+			const PerfCounters::perf_counter_data_any_d*>> m_counters;
+};
+
+}
+
+#endif
@@ -60,6 +60,7 @@ struct pidfh {
   }
   int verify();
   int remove();
+  void remove_crash();
   int open(const ConfigProxy& conf);
   int write();
 };
@@ -128,6 +129,26 @@ int pidfh::remove()
   return 0;
 }
 
+void pidfh::remove_crash()
+{
+  if (!pf_path[0] || verify() < 0) {
+    return;
+  }
+  char buf[32];
+  ssize_t res = ::pread(pf_fd, buf, sizeof(buf), 0);
+  if (res <= 0) {
+    return;
+  }
+  // no atoi(); it isn't async-signal-safe
+  long a = 0;
+  for (ssize_t i = 0; i < res && buf[i] >= '0' && buf[i] <= '9'; ++i) {
+    a = a * 10 + (buf[i] - '0');
+  }
+  if (a == getpid()) {
+    ::unlink(pf_path);
+  }
+}
+
 int pidfh::open(const ConfigProxy& conf)
 {
   int len = snprintf(pf_path, sizeof(pf_path),
@@ -211,6 +232,13 @@ void pidfile_remove()
   pfh = nullptr;
 }
 
+void pidfile_remove_crash()
+{
+  // dying; leave pfh be, nothing frees it after this
+  if (pfh != nullptr)
+    pfh->remove_crash();
+}
+
 int pidfile_write(const ConfigProxy& conf)
 {
   if (conf->pid_file.empty()) {
@@ -22,7 +22,11 @@
 int pidfile_write(const ConfigProxy& conf);
 
 // Remove the pid file that was previously written by pidfile_write.
-// This is safe to call in a signal handler context.
 void pidfile_remove();
 
+// pidfile_remove() for a fatal signal handler: async-signal-safe, allocation
+// free and silent.  The pid file is left to pidfile_remove() if it doesn't
+// look like ours.
+void pidfile_remove_crash();
+
 #endif
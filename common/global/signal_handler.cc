@@ -18,21 +18,37 @@
 #include "pthread.h"
 
 #include "common/ceph_mutex.h"
-#include "common/BackTrace.h"
 #include "common/debug.h"
+#include "common/rcu_ptr.h"
 #include "common/safe_io.h"
+#include "common/str_escape.h"
 #include "common/version.h"
 
 #include "include/uuid.h"
+#include "common/Thread.h"
+#include "global/crash_dump.h"
 #include "global/pidfile.h"
 #include "global/signal_handler.h"
 
+#include <execinfo.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <signal.h>
 #include <sstream>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
+#include <ucontext.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <string_view>
 #include "common/errno.h"
 #if defined(_AIX)
 extern char *sys_siglist[]; 
@@ -138,159 +154,605 @@ static int parse_from_os_release(
   return 0;
 }
 
-static void handle_fatal_signal(int signum)
+namespace {
+
+constexpr int CRASH_MAX_FRAMES = 100;
+constexpr std::size_t CRASH_STACK_BYTES = 64 * 1024;
+constexpr int crash_signals[] = {
+  SIGSEGV, SIGABRT, SIGBUS, SIGILL, SIGFPE, SIGXCPU, SIGXFSZ, SIGSYS
+};
+
+/// appends to a fixed buffer, writing it out to fd whenever it fills up, or
+/// if fd is -1 dropping what doesn't fit.  Async-signal-safe.
+class crash_writer {
+public:
+  crash_writer(int fd, char *buf, std::size_t size)
+    : m_fd(fd), m_buf(buf), m_size(size) {}
+  ~crash_writer() {
+    flush();
+  }
+
+  crash_writer& str(std::string_view s) {
+    while (!s.empty()) {
+      if (m_len == m_size) {
+	if (m_fd < 0) {
+	  return *this;
+	}
+	flush();
+      }
+      std::size_t n = std::min(s.size(), m_size - m_len);
+      memcpy(m_buf + m_len, s.data(), n);
+      m_len += n;
+      s.remove_prefix(n);
+    }
+    return *this;
+  }
+  crash_writer& num(int64_t v, int width = 0) {
+    if (v < 0) {
+      str("-");
+      return num(-(uint64_t)v, width);
+    }
+    return num((uint64_t)v, width);
+  }
+  crash_writer& num(uint64_t v, int width = 0, unsigned base = 10) {
+    char d[32];
+    int n = 0;
+    do {
+      d[n++] = "0123456789abcdef"[v % base];
+      v /= base;
+    } while (v || n < width);
+    while (n) {
+      char c = d[--n];
+      str(std::string_view(&c, 1));
+    }
+    return *this;
+  }
+  /// s as a JSON string, quotes and all
+  crash_writer& json(std::string_view s) {
+    str("\"");
+    ceph::json_escape(s, [this](const char *p, std::size_t n) {
+      str(std::string_view(p, n));
+    });
+    return str("\"");
+  }
+  /// a member of the crash object in the meta file
+  crash_writer& field(std::string_view key) {
+    return str(",\n    ").json(key).str(": ");
+  }
+
+  void flush() {
+    if (m_fd >= 0 && m_len) {
+      (void)safe_write(m_fd, m_buf, m_len);
+      m_len = 0;
+    }
+  }
+  std::string_view view() const {
+    return std::string_view(m_buf, m_len);
+  }
+
+private:
+  const int m_fd;
+  char *const m_buf;
+  const std::size_t m_size;
+  std::size_t m_len = 0;
+};
+
+/// everything handle_fatal_signal() can't safely look up or format itself,
+/// gathered by install_standard_sighandlers() while allocating is still fine
+struct crash_state {
+  char crash_dir[PATH_MAX];
+  char uuid[37];
+  /// the members of the meta file that are known up front
+  char static_meta[16384];
+  std::size_t static_meta_len;
+  char signal_name[std::size(crash_signals)][64];
+  /// crash_dump_raw: leave a raw dump for ceph-crash-symbolize instead
+  bool raw_dump;
+  char machine[32];
+  char recent_file[PATH_MAX];
+  std::size_t page_size;
+
+  void *frames[CRASH_MAX_FRAMES];
+  /// backtrace_symbols_fd()'s output, a line per frame
+  char symbols[CRASH_MAX_FRAMES * 512];
+  char note[CRASH_MAX_FRAMES * 512 + 1024];  ///< what goes to the log
+  char buf[4096];
+};
+crash_state crash;
+
+#if defined(__linux__)
+/// what getdents64(2) returns; glibc doesn't declare it
+struct crash_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+const char *crash_signal_name(int signum)
 {
-  // This code may itself trigger a SIGSEGV if the heap is corrupt. In that
-  // case, SA_RESETHAND specifies that the default signal handler--
-  // presumably dump core-- will handle it.
-  char buf[1024];
-  char pthread_name[16] = {0}; //limited by 16B include terminating null byte.
-  int r = ceph_pthread_getname(pthread_self(), pthread_name, sizeof(pthread_name));
-  (void)r;
+  for (std::size_t i = 0; i < std::size(crash_signals); ++i) {
+    if (crash_signals[i] == signum) {
+      return crash.signal_name[i];
+    }
+  }
+  return "unknown signal";
+}
+
+/// "YYYY-MM-DDTHH:MM:SS.ffffffZ", as utime_t::gmtime() has it, without
+/// gmtime_r(), which may take locks
+void crash_time(crash_writer& w, const struct timespec& ts)
+{
+  // days since the epoch to a civil date, after Howard Hinnant
+  int64_t days = ts.tv_sec / 86400;
+  int64_t secs = ts.tv_sec % 86400;
+  if (secs < 0) {
+    secs += 86400;
+    --days;
+  }
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const int64_t doe = days - era * 146097;
+  const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const int64_t mp = (5 * doy + 2) / 153;
+  const int64_t d = doy - (153 * mp + 2) / 5 + 1;
+  const int64_t m = mp < 10 ? mp + 3 : mp - 9;
+  const int64_t y = yoe + era * 400 + (m <= 2);
+  w.num(y, 4).str("-").num(m, 2).str("-").num(d, 2).str("T")
+    .num(secs / 3600, 2).str(":").num(secs / 60 % 60, 2).str(":")
+    .num(secs % 60, 2).str(".").num(int64_t(ts.tv_nsec / 1000), 6).str("Z");
+}
+
+/// call f with each frame's line, as backtrace_symbols_fd() put it
+template<typename F>
+void for_each_frame(std::string_view symbols, int frames, F&& f)
+{
+  for (int i = 0; i < frames; ++i) {
+    if (symbols.empty()) {
+      // no symbols at all; the address will have to do
+      char addr[24];
+      crash_writer w(-1, addr, sizeof(addr));
+      w.str("[0x").num((uint64_t)(uintptr_t)crash.frames[i + 1], 0, 16)
+	.str("]");
+      f(i, w.view());
+      continue;
+    }
+    auto eol = symbols.find('\n');
+    f(i, symbols.substr(0, eol));
+    symbols.remove_prefix(eol == symbols.npos ? symbols.size() : eol + 1);
+  }
+}
+
+void prepare_crash_state()
+{
+  for (std::size_t i = 0; i < std::size(crash_signals); ++i) {
 #if defined(__sun)
-  char message[SIG2STR_MAX];
-  sig2str(signum,message);
-  snprintf(buf, sizeof(buf), "*** Caught signal (%s) **\n "
-	    "in thread %llx thread_name:%s\n", message, (unsigned long long)pthread_self(),
-	    pthread_name);
+    char message[SIG2STR_MAX];
+    sig2str(crash_signals[i], message);
+    snprintf(crash.signal_name[i], sizeof(crash.signal_name[i]), "%s",
+	     message);
+#else
+    snprintf(crash.signal_name[i], sizeof(crash.signal_name[i]), "%s",
+	     sig_str(crash_signals[i]));
+#endif
+  }
+  // the first call may load libgcc, which is no thing to do in a handler
+  (void)backtrace(crash.frames, CRASH_MAX_FRAMES);
+  // and the first long string escaped picks the vector variant, behind a
+  // static's guard
+  (void)ceph::json_plain_prefix_name();
+
+  if (!g_ceph_context ||
+      g_ceph_context->_conf->crash_dir.empty() ||
+      g_ceph_context->_conf->crash_dir.size() >= sizeof(crash.crash_dir) - 128) {
+    return;
+  }
+  snprintf(crash.crash_dir, sizeof(crash.crash_dir), "%s",
+	   g_ceph_context->_conf->crash_dir.c_str());
+  crash.raw_dump = g_ceph_context->_conf.get_val<bool>("crash_dump_raw");
+  // it may change later, but a crash this early is not the usual case
+  snprintf(crash.recent_file, sizeof(crash.recent_file), "%s",
+	   g_ceph_context->_conf.get_val<std::string>("log_recent_file").c_str());
+  crash.page_size = sysconf(_SC_PAGESIZE);
+  uuid_d uuid;
+  uuid.generate_random();
+  uuid.print(crash.uuid);
+
+  crash_writer w(-1, crash.static_meta, sizeof(crash.static_meta));
+  w.field("process_name").json(g_process_name);
+  w.field("entity_name").json(g_ceph_context->_conf->name.to_str());
+  w.field("ceph_version").json(ceph_version_to_str());
+
+  struct utsname u;
+  if (uname(&u) >= 0) {
+    w.field("utsname_hostname").json(u.nodename);
+    w.field("utsname_sysname").json(u.sysname);
+    w.field("utsname_release").json(u.release);
+    w.field("utsname_version").json(u.version);
+    w.field("utsname_machine").json(u.machine);
+    snprintf(crash.machine, sizeof(crash.machine), "%s", u.machine);
+  }
+#if defined(__linux__)
+  // os-release
+  int in = ::open("/etc/os-release", O_RDONLY|O_CLOEXEC);
+  if (in >= 0) {
+    char buf[4096];
+    int r = safe_read(in, buf, sizeof(buf)-1);
+    if (r >= 0) {
+      buf[r] = 0;
+      char v[4096];
+      if (parse_from_os_release(buf, "NAME=", v) >= 0) {
+	w.field("os_name").json(v);
+      }
+      if (parse_from_os_release(buf, "ID=", v) >= 0) {
+	w.field("os_id").json(v);
+      }
+      if (parse_from_os_release(buf, "VERSION_ID=", v) >= 0) {
+	w.field("os_version_id").json(v);
+      }
+      if (parse_from_os_release(buf, "VERSION=", v) >= 0) {
+	w.field("os_version").json(v);
+      }
+    }
+    ::close(in);
+  }
+#endif
+  crash.static_meta_len = w.view().size();
+}
+
+/// the members of the meta file's crash object but for the backtrace: what
+/// was known up front, then what the crash adds
+void write_crash_members(crash_writer& w, std::string_view id,
+			 const struct timespec& now)
+{
+  w.str("\n    ").json("crash_id").str(": ").json(id);
+  w.field("timestamp").str("\"");
+  crash_time(w, now);
+  w.str("\"");
+  w.str(std::string_view(crash.static_meta, crash.static_meta_len));
+
+  // assert?
+  if (g_assert_condition) {
+    w.field("assert_condition").json(g_assert_condition);
+  }
+  if (g_assert_func) {
+    w.field("assert_func").json(g_assert_func);
+  }
+  if (g_assert_file) {
+    w.field("assert_file").json(g_assert_file);
+  }
+  if (g_assert_line) {
+    w.field("assert_line").num(uint64_t(g_assert_line));
+  }
+  if (g_assert_thread_name[0]) {
+    w.field("assert_thread_name").json(g_assert_thread_name);
+  }
+  if (g_assert_msg[0]) {
+    w.field("assert_msg").json(g_assert_msg);
+  }
+
+  // eio?
+  if (g_eio) {
+    w.field("io_error").str("true");
+    if (g_eio_devname[0]) {
+      w.field("io_error_devname").json(g_eio_devname);
+    }
+    if (g_eio_path[0]) {
+      w.field("io_error_path").json(g_eio_path);
+    }
+    if (g_eio_error) {
+      w.field("io_error_code").num(int64_t(g_eio_error));
+    }
+    if (g_eio_iotype) {
+      w.field("io_error_optype").num(int64_t(g_eio_iotype));
+    }
+    if (g_eio_offset) {
+      w.field("io_error_offset").num(uint64_t(g_eio_offset));
+    }
+    if (g_eio_length) {
+      w.field("io_error_length").num(uint64_t(g_eio_length));
+    }
+  }
+}
+
+/// the meta file
+void write_crash_meta(int fd, std::string_view id, const struct timespec& now,
+		      std::string_view symbols, int frames)
+{
+  crash_writer w(fd, crash.buf, sizeof(crash.buf));
+  w.str("{");
+  write_crash_members(w, id, now);
+
+  // backtrace
+  w.field("backtrace").str("[");
+  for_each_frame(symbols, frames, [&w](int i, std::string_view line) {
+    w.str(i ? ",\n        " : "\n        ").json(line);
+  });
+  w.str("\n    ]\n}\n");
+}
+
+/// start a section of the raw dump at fd's offset; returns where it starts,
+/// for end_section()
+off_t begin_section(int fd, uint32_t type)
+{
+  const off_t start = ::lseek(fd, 0, SEEK_CUR);
+  const ceph::crash_dump::section s = {type, 0, 0};
+  (void)safe_write(fd, &s, sizeof(s));
+  return start;
+}
+
+/// fill in the length of the section begun at start, and pad it
+void end_section(int fd, off_t start)
+{
+  const off_t end = ::lseek(fd, 0, SEEK_CUR);
+  if (start < 0 || end < 0) {
+    return;
+  }
+  const uint64_t len = end - start - sizeof(ceph::crash_dump::section);
+  (void)::pwrite(fd, &len, sizeof(len),
+		 start + offsetof(ceph::crash_dump::section, len));
+  static const char zeros[8] = {};
+  (void)safe_write(fd, zeros, (8 - len % 8) % 8);
+}
+
+uintptr_t crash_sp(const ucontext_t *uc)
+{
+#if defined(__linux__) && defined(__x86_64__)
+  return uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__linux__) && defined(__aarch64__)
+  return uc->uc_mcontext.sp;
 #else
-  snprintf(buf, sizeof(buf), "*** Caught signal (%s) **\n "
-	    "in thread %llx thread_name:%s\n", sig_str(signum), (unsigned long long)pthread_self(),
-	    pthread_name);
+  return 0;
+#endif
+}
+
+/// as much of the stack from sp up as there is, to CRASH_STACK_BYTES.
+/// Where the mapping ends write(2) fails with EFAULT instead of faulting.
+void write_stack(int fd, uintptr_t sp)
+{
+  sp &= ~uintptr_t(7);
+  const uint64_t start = sp;
+  (void)safe_write(fd, &start, sizeof(start));
+  const uintptr_t end = sp + CRASH_STACK_BYTES;
+  for (uintptr_t p = sp; p < end; ) {
+    const std::size_t n = std::min<std::size_t>(
+      end - p, crash.page_size - p % crash.page_size);
+    ssize_t r = ::write(fd, reinterpret_cast<const void*>(p), n);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      break;
+    }
+    p += r;
+  }
+}
+
+void write_threads(int fd)
+{
+#if defined(__linux__)
+  // readdir() may allocate
+  int dir = ::open("/proc/self/task", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (dir < 0) {
+    return;
+  }
+  long n;
+  while ((n = syscall(SYS_getdents64, dir, crash.buf, sizeof(crash.buf))) > 0) {
+    int32_t tids[sizeof(crash.buf) / sizeof(crash_dirent64)];
+    std::size_t num = 0;
+    for (long off = 0; off < n; ) {
+      auto d = reinterpret_cast<const crash_dirent64*>(crash.buf + off);
+      off += d->d_reclen;
+      int32_t tid = 0;
+      const char *c = d->d_name;
+      for (; *c >= '0' && *c <= '9'; ++c) {
+	tid = tid * 10 + (*c - '0');
+      }
+      if (!*c && c != d->d_name) {
+	tids[num++] = tid;
+      }
+    }
+    (void)safe_write(fd, tids, num * sizeof(tids[0]));
+  }
+  ::close(dir);
 #endif
-  dout_emergency(buf);
-  pidfile_remove();
+}
 
-  // TODO: don't use an ostringstream here. It could call malloc(), which we
-  // don't want inside a signal handler.
-  // Also fix the backtrace code not to allocate memory.
-  BackTrace bt(1);
-  ostringstream oss;
-  bt.print(oss);
-  dout_emergency(oss.str());
+/// copy the file at path, e.g. in /proc, which has no size to go by
+void write_file(int fd, const char *path)
+{
+  int in = ::open(path, O_RDONLY|O_CLOEXEC);
+  if (in < 0) {
+    return;
+  }
+  ssize_t r;
+  while ((r = safe_read(in, crash.buf, sizeof(crash.buf))) > 0) {
+    (void)safe_write(fd, crash.buf, r);
+  }
+  ::close(in);
+}
+
+/// the raw dump: everything ceph-crash-symbolize needs to write the meta
+/// file, and a little more for whoever reads it
+void write_crash_dump(int fd, std::string_view id, const struct timespec& now,
+		      int signum, const siginfo_t *info, const ucontext_t *uc,
+		      int frames)
+{
+  using namespace ceph::crash_dump;
+  header h = {};
+  h.magic = MAGIC;
+  h.version = VERSION;
+  h.header_size = sizeof(h);
+  h.pid = getpid();
+  h.tid = ceph_gettid();
+  h.signum = signum;
+  h.si_code = info ? info->si_code : 0;
+  h.fault_addr = info ? (uint64_t)(uintptr_t)info->si_addr : 0;
+  h.stamp = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+  memcpy(h.machine, crash.machine, sizeof(h.machine));
+  (void)safe_write(fd, &h, sizeof(h));
+
+  off_t start = begin_section(fd, SECTION_META);
+  {
+    crash_writer w(fd, crash.buf, sizeof(crash.buf));
+    write_crash_members(w, id, now);
+  }
+  end_section(fd, start);
+
+  start = begin_section(fd, SECTION_FRAMES);
+  for (int i = 0; i < frames; ++i) {
+    const uint64_t addr = (uintptr_t)crash.frames[i + 1];
+    (void)safe_write(fd, &addr, sizeof(addr));
+  }
+  end_section(fd, start);
+
+  uintptr_t sp = 0;
+  if (uc) {
+    start = begin_section(fd, SECTION_REGISTERS);
+    (void)safe_write(fd, &uc->uc_mcontext, sizeof(uc->uc_mcontext));
+    end_section(fd, start);
+    sp = crash_sp(uc);
+  }
+  if (!sp) {
+    // near enough
+    sp = reinterpret_cast<uintptr_t>(&sp);
+  }
+  start = begin_section(fd, SECTION_STACK);
+  write_stack(fd, sp);
+  end_section(fd, start);
+
+  start = begin_section(fd, SECTION_THREADS);
+  write_threads(fd);
+  end_section(fd, start);
+
+  start = begin_section(fd, SECTION_MAPS);
+  write_file(fd, "/proc/self/maps");
+  end_section(fd, start);
+
+  if (crash.recent_file[0]) {
+    start = begin_section(fd, SECTION_RECENT_FILE);
+    (void)safe_write(fd, crash.recent_file, strlen(crash.recent_file));
+    end_section(fd, start);
+  }
+}
+
+/// backtrace_symbols_fd() into crash.symbols, through a pipe; empty if
+/// that fails
+std::string_view crash_symbols(int frames)
+{
+  int fds[2];
+  if (pipe_cloexec(fds) < 0) {
+    return {};
+  }
+  ::fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  // the pipe holds more than CRASH_MAX_FRAMES lines, and if it didn't,
+  // being non-blocking the rest would be dropped rather than hang
+  backtrace_symbols_fd(crash.frames + 1, frames, fds[1]);
+  ::close(fds[1]);
+  ssize_t len = safe_read(fds[0], crash.symbols, sizeof(crash.symbols));
+  ::close(fds[0]);
+  return std::string_view(crash.symbols, len > 0 ? len : 0);
+}
+
+}
+
+// Everything here is async-signal-safe and allocation free: the heap may be
+// what is broken, and a handler that hangs on a lock only delays the
+// restart.  If it triggers a SIGSEGV itself, SA_RESETHAND specifies that
+// the default signal handler--presumably dump core--will handle it.
+static void handle_fatal_signal(int signum, siginfo_t *info, void *context)
+{
+  char buf[1024];
+  char pthread_name[16] = {0}; //limited by 16B include terminating null byte.
+  int r = ceph_pthread_getname(pthread_self(), pthread_name, sizeof(pthread_name));
+  (void)r;
+  std::string_view header;
+  {
+    crash_writer w(-1, buf, sizeof(buf));
+    w.str("*** Caught signal (").str(crash_signal_name(signum))
+      .str(") **\n in thread ").num((uint64_t)pthread_self(), 0, 16)
+      .str(" thread_name:").str(pthread_name).str("\n");
+    header = w.view();
+  }
+  (void)safe_write(STDERR_FILENO, header.data(), header.size());
+  pidfile_remove_crash();
+
+  // leave out this frame
+  const int frames = std::max(backtrace(crash.frames, CRASH_MAX_FRAMES) - 1, 0);
+  // symbolizing is what takes the time; ceph-crash-symbolize can do it later
+  const std::string_view symbols = crash.raw_dump ? std::string_view() :
+    crash_symbols(frames);
+  std::string_view note;
+  {
+    crash_writer w(-1, crash.note, sizeof(crash.note));
+    w.str(header);
+    for_each_frame(symbols, frames, [&w](int i, std::string_view line) {
+      w.str(" ").num(int64_t(i + 1)).str(": ").str(line).str("\n");
+    });
+    if (crash.raw_dump && crash.crash_dir[0]) {
+      w.str(" NOTE: ceph-crash-symbolize on its crash_dir entry symbolizes "
+	    "this.\n");
+    } else {
+      w.str(" NOTE: a copy of the executable, or `objdump -rdS <executable>` "
+	    "is needed to interpret this.\n");
+    }
+    note = w.view();
+  }
+  (void)safe_write(STDERR_FILENO, note.data() + header.size(),
+		   note.size() - header.size());
 
   char base[PATH_MAX] = { 0 };
-  if (g_ceph_context &&
-      g_ceph_context->_conf->crash_dir.size()) {
+  if (crash.crash_dir[0]) {
     // -- crash dump --
-    // id
-    ostringstream idss;
-    utime_t now = ceph_clock_now();
-    now.gmtime(idss);
-    uuid_d uuid;
-    uuid.generate_random();
-    idss << "_" << uuid;
-    string id = idss.str();
-    std::replace(id.begin(), id.end(), ' ', '_');
-
-    snprintf(base, sizeof(base), "%s/%s",
-	     g_ceph_context->_conf->crash_dir.c_str(),
-	     id.c_str());
-    int r = ::mkdir(base, 0700);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    // a daemonized child inherits its parent's uuid; tell them apart
+    char uuid[sizeof(crash.uuid)];
+    memcpy(uuid, crash.uuid, sizeof(uuid));
+    const uint32_t pid = getpid();
+    for (int i = 0; i < 8; ++i) {
+      char& c = uuid[i];
+      unsigned v = (c <= '9' ? c - '0' : c - 'a' + 10) ^
+	((pid >> (28 - 4 * i)) & 0xf);
+      c = "0123456789abcdef"[v];
+    }
+    std::string_view id;
+    {
+      crash_writer w(-1, base, sizeof(base) - 1);
+      w.str(crash.crash_dir).str("/");
+      std::size_t dir_len = w.view().size();
+      crash_time(w, now);
+      w.str("_").str(uuid);
+      id = w.view().substr(dir_len);
+    }
+    r = ::mkdir(base, 0700);
     if (r >= 0) {
       char fn[PATH_MAX*2];
-      snprintf(fn, sizeof(fn)-1, "%s/meta", base);
+      {
+	crash_writer w(-1, fn, sizeof(fn) - 1);
+	w.str(base).str(crash.raw_dump ? "/dump" : "/meta");
+	fn[w.view().size()] = 0;
+      }
       int fd = ::open(fn, O_CREAT|O_WRONLY|O_CLOEXEC, 0600);
       if (fd >= 0) {
-	JSONFormatter jf(true);
-	jf.open_object_section("crash");
-	jf.dump_string("crash_id", id);
-	now.gmtime(jf.dump_stream("timestamp"));
-	jf.dump_string("process_name", g_process_name);
-	jf.dump_string("entity_name", g_ceph_context->_conf->name.to_str());
-	jf.dump_string("ceph_version", ceph_version_to_str());
-
-	struct utsname u;
-	r = uname(&u);
-	if (r >= 0) {
-	  jf.dump_string("utsname_hostname", u.nodename);
-	  jf.dump_string("utsname_sysname", u.sysname);
-	  jf.dump_string("utsname_release", u.release);
-	  jf.dump_string("utsname_version", u.version);
-	  jf.dump_string("utsname_machine", u.machine);
-	}
-#if defined(__linux__)
-	// os-release
-	int in = ::open("/etc/os-release", O_RDONLY|O_CLOEXEC);
-	if (in >= 0) {
-	  char buf[4096];
-	  r = safe_read(in, buf, sizeof(buf)-1);
-	  if (r >= 0) {
-	    buf[r] = 0;
-	    char v[4096];
-	    if (parse_from_os_release(buf, "NAME=", v) >= 0) {
-	      jf.dump_string("os_name", v);
-	    }
-	    if (parse_from_os_release(buf, "ID=", v) >= 0) {
-	      jf.dump_string("os_id", v);
-	    }
-	    if (parse_from_os_release(buf, "VERSION_ID=", v) >= 0) {
-	      jf.dump_string("os_version_id", v);
-	    }
-	    if (parse_from_os_release(buf, "VERSION=", v) >= 0) {
-	      jf.dump_string("os_version", v);
-	    }
-	  }
-	  ::close(in);
-	}
-#endif
-
-	// assert?
-	if (g_assert_condition) {
-	  jf.dump_string("assert_condition", g_assert_condition);
-	}
-	if (g_assert_func) {
-	  jf.dump_string("assert_func", g_assert_func);
-	}
-	if (g_assert_file) {
-	  jf.dump_string("assert_file", g_assert_file);
-	}
-	if (g_assert_line) {
-	  jf.dump_unsigned("assert_line", g_assert_line);
+	if (crash.raw_dump) {
+	  write_crash_dump(fd, id, now, signum, info,
+			   static_cast<const ucontext_t*>(context), frames);
+	} else {
+	  write_crash_meta(fd, id, now, symbols, frames);
 	}
-	if (g_assert_thread_name[0]) {
-	  jf.dump_string("assert_thread_name", g_assert_thread_name);
-	}
-	if (g_assert_msg[0]) {
-	  jf.dump_string("assert_msg", g_assert_msg);
-	}
-
-	// eio?
-	if (g_eio) {
-	  jf.dump_bool("io_error", true);
-	  if (g_eio_devname[0]) {
-	    jf.dump_string("io_error_devname", g_eio_devname);
-	  }
-	  if (g_eio_path[0]) {
-	    jf.dump_string("io_error_path", g_eio_path);
-	  }
-	  if (g_eio_error) {
-	    jf.dump_int("io_error_code", g_eio_error);
-	  }
-	  if (g_eio_iotype) {
-	    jf.dump_int("io_error_optype", g_eio_iotype);
-	  }
-	  if (g_eio_offset) {
-	    jf.dump_unsigned("io_error_offset", g_eio_offset);
-	  }
-	  if (g_eio_length) {
-	    jf.dump_unsigned("io_error_length", g_eio_length);
-	  }
-	}
-
-	// backtrace
-	bt.dump(&jf);
-
-	jf.close_section();
-	ostringstream oss;
-	jf.flush(oss);
-	string s = oss.str();
-	r = safe_write(fd, s.c_str(), s.size());
-	(void)r;
 	::close(fd);
       }
-      snprintf(fn, sizeof(fn)-1, "%s/done", base);
-      ::creat(fn, 0444);
+      if (!crash.raw_dump) {
+	// ceph-crash-symbolize marks a raw one done once it has the meta
+	memcpy(fn + strlen(base), "/done", 6);
+	::creat(fn, 0444);
+      }
+    } else {
+      base[0] = 0;
     }
   }
 
@@ -299,22 +761,20 @@ static void handle_fatal_signal(int signum)
   if (g_ceph_context &&
       g_ceph_context->_log &&
       !g_ceph_context->_log->is_inside_log_lock()) {
-    // dump to log.  this uses the heap extensively, but we're better
-    // off trying than not.
-    derr << buf << std::endl;
-    bt.print(*_dout);
-    *_dout << " NOTE: a copy of the executable, or `objdump -rdS <executable>` "
-	   << "is needed to interpret this.\n"
-	   << dendl;
-
-    g_ceph_context->_log->dump_recent();
+    g_ceph_context->_log->dump_recent_crash(-1, note);
 
     if (base[0]) {
       char fn[PATH_MAX*2];
-      snprintf(fn, sizeof(fn)-1, "%s/log", base);
-      g_ceph_context->_log->set_log_file(fn);
-      g_ceph_context->_log->reopen_log_file();
-      g_ceph_context->_log->dump_recent();
+      {
+	crash_writer w(-1, fn, sizeof(fn) - 1);
+	w.str(base).str("/log");
+	fn[w.view().size()] = 0;
+      }
+      int fd = ::open(fn, O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0600);
+      if (fd >= 0) {
+	g_ceph_context->_log->dump_recent_crash(fd, note);
+	::close(fd);
+      }
     }
   }
 
@@ -329,14 +789,22 @@ static void handle_fatal_signal(int signum)
 
 void install_standard_sighandlers(void)
 {
-  install_sighandler(SIGSEGV, handle_fatal_signal, SA_RESETHAND | SA_NODEFER);
-  install_sighandler(SIGABRT, handle_fatal_signal, SA_RESETHAND | SA_NODEFER);
-  install_sighandler(SIGBUS, handle_fatal_signal, SA_RESETHAND | SA_NODEFER);
-  install_sighandler(SIGILL, handle_fatal_signal, SA_RESETHAND | SA_NODEFER);
-  install_sighandler(SIGFPE, handle_fatal_signal, SA_RESETHAND | SA_NODEFER);
-  install_sighandler(SIGXCPU, handle_fatal_signal, SA_RESETHAND | SA_NODEFER);
-  install_sighandler(SIGXFSZ, handle_fatal_signal, SA_RESETHAND | SA_NODEFER);
-  install_sighandler(SIGSYS, handle_fatal_signal, SA_RESETHAND | SA_NODEFER);
+  prepare_crash_state();
+  for (int signum : crash_signals) {
+    // install_sighandler(), but with the siginfo and context for the dump
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = handle_fatal_signal;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_SIGINFO | SA_RESETHAND | SA_NODEFER;
+    if (sigaction(signum, &act, nullptr) != 0) {
+      char buf[1024];
+      snprintf(buf, sizeof(buf), "install_standard_sighandlers: sigaction "
+	       "failed for %s\n", crash_signal_name(signum));
+      dout_emergency(buf);
+      exit(1);
+    }
+  }
 }
 
 
@@ -406,42 +874,63 @@ string get_name_by_pid(pid_t pid)
  * Features:
  *   - no unsafe work is done in the signal handler itself
  *   - callbacks are called from a regular thread
- *   - signals are not lost, unless multiple instances of the same signal
- *     are sent twice in quick succession.
+ *   - signals are not lost, but several of the same one arriving before
+ *     the thread gets to it are coalesced into one callback, and counted
+ *   - the dispatch thread and the signal hook take no lock; the handlers
+ *     are an immutable table, replaced whole when one is registered
  */
 struct SignalHandler : public Thread {
-  /// to kick the thread, for shutdown, new handlers, etc.
-  int pipefd[2];  // write to [1], read from [0]
+  /// to kick the thread, from the signal hook, for shutdown, etc.; an
+  /// eventfd where there is one, a pipe (write to wake_wr, read from
+  /// wake_rd) elsewhere.  Either way a burst of wakeups is drained at once.
+  int wake_rd = -1;
+  int wake_wr = -1;
 
   /// to signal shutdown
-  bool stop = false;
+  std::atomic<bool> stop{false};
 
-  /// for an individual signal
-  struct safe_handler {
+  /// signals received but not handled yet, a bit each, so however many of
+  /// one arrive before the thread gets to them its handler runs once
+  std::atomic<uint32_t> pending{0};
 
-    safe_handler() {
-      memset(pipefd, 0, sizeof(pipefd));
-      memset(&handler, 0, sizeof(handler));
-      memset(&info_t, 0, sizeof(info_t));    
-    }
+  /// the siginfo of the last of each signal received
+  siginfo_t info[32];
 
-    siginfo_t info_t;
-    int pipefd[2];  // write to [1], read from [0]
-    signal_handler_t handler;
-  };
+  /// of each signal, how many were received, and of those how many were
+  /// folded into a callback that ran for an earlier one
+  std::atomic<uint64_t> received[32] = {};
+  std::atomic<uint64_t> coalesced[32] = {};
+  /// received[], as of the last callback; only the thread touches it
+  uint64_t dispatched[32] = {};
 
-  /// all handlers
-  safe_handler *handlers[32] = {nullptr};
+  struct handler_table {
+    signal_handler_t handlers[32] = {nullptr};
+  };
+  /// all handlers; the thread holds a reader while it calls them, so once
+  /// unregister_handler() has replaced the table the old handler is not
+  /// running and won't be
+  ceph::rcu_ptr<handler_table> table{std::make_unique<handler_table>()};
 
-  /// to protect the handlers array
-  ceph::mutex lock = ceph::make_mutex("SignalHandler::lock");
+  /// serializes the writers of table
+  ceph::adaptive_mutex lock = ceph::make_adaptive_mutex("SignalHandler::lock");
 
   SignalHandler() {
-    // create signal pipe
+    memset(info, 0, sizeof(info));
+#if defined(__linux__)
+    wake_rd = wake_wr = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ceph_assert(wake_rd >= 0);
+#else
+    int pipefd[2];
     int r = pipe_cloexec(pipefd);
     ceph_assert(r == 0);
+    // a full pipe already has the thread's attention
     r = fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
     ceph_assert(r == 0);
+    r = fcntl(pipefd[1], F_SETFL, O_NONBLOCK);
+    ceph_assert(r == 0);
+    wake_rd = pipefd[0];
+    wake_wr = pipefd[1];
+#endif
 
     // create thread
     create("signal_handler");
@@ -449,11 +938,32 @@ struct SignalHandler : public Thread {
 
   ~SignalHandler() override {
     shutdown();
+    close(wake_rd);
+    if (wake_wr != wake_rd) {
+      close(wake_wr);
+    }
   }
 
+  /// async-signal-safe
   void signal_thread() {
-    int r = write(pipefd[1], "\0", 1);
-    ceph_assert(r == 1);
+#if defined(__linux__)
+    uint64_t one = 1;
+    int r = write(wake_wr, &one, sizeof(one));
+#else
+    int r = write(wake_wr, "\0", 1);
+#endif
+    (void)r;
+  }
+
+  void drain_wakeups() {
+#if defined(__linux__)
+    uint64_t count;
+    int r = TEMP_FAILURE_RETRY(read(wake_rd, &count, sizeof(count)));
+    (void)r;
+#else
+    char buf[256];
+    while (TEMP_FAILURE_RETRY(read(wake_rd, buf, sizeof(buf))) > 0);
+#endif
   }
 
   void shutdown() {
@@ -462,76 +972,72 @@ struct SignalHandler : public Thread {
     join();
   }
 
+  void log_signal(int signum, const siginfo_t *siginfo, uint64_t folded) {
+    ostringstream message;
+    message << "received  signal: " << sig_str(signum);
+    if (folded) {
+      message << " (and " << folded << " more since the last)";
+    }
+    switch (siginfo->si_code) {
+      case SI_USER:
+        message << " from " << get_name_by_pid(siginfo->si_pid);
+        // If PID is undefined, it doesn't have a meaning to be displayed
+        if (siginfo->si_pid) {
+          message << " (PID: " << siginfo->si_pid << ")";
+        } else {
+          message << " ( Could be generated by pthread_kill(), raise(), abort(), alarm() )";
+        }
+        message << " UID: " << siginfo->si_uid;
+        break;
+      default:
+        /* As we have a not expected signal, let's report the structure to help debugging */
+        message << ", si_code : " << siginfo->si_code;
+        message << ", si_value (int): " << siginfo->si_value.sival_int;
+        message << ", si_value (ptr): " << siginfo->si_value.sival_ptr;
+        message << ", si_errno: " << siginfo->si_errno;
+        message << ", si_pid : " << siginfo->si_pid;
+        message << ", si_uid : " << siginfo->si_uid;
+        message << ", si_addr" << siginfo->si_addr;
+        message << ", si_status" << siginfo->si_status;
+        break;
+    }
+    derr << message.str() << dendl;
+  }
+
   // thread entry point
   void *entry() override {
+    struct pollfd fd = {wake_rd, POLLIN | POLLERR, 0};
     while (!stop) {
-      // build fd list
-      struct pollfd fds[33];
-
-      lock.lock();
-      int num_fds = 0;
-      fds[num_fds].fd = pipefd[0];
-      fds[num_fds].events = POLLIN | POLLERR;
-      fds[num_fds].revents = 0;
-      ++num_fds;
-      for (unsigned i=0; i<32; i++) {
-	if (handlers[i]) {
-	  fds[num_fds].fd = handlers[i]->pipefd[0];
-	  fds[num_fds].events = POLLIN | POLLERR;
-	  fds[num_fds].revents = 0;
-	  ++num_fds;
-	}
-      }
-      lock.unlock();
-
-      // wait for data on any of those pipes
-      int r = poll(fds, num_fds, -1);
+      fd.revents = 0;
+      int r = poll(&fd, 1, -1);
       if (stop)
 	break;
-      if (r > 0) {
-	char v;
-
-	// consume byte from signal socket, if any.
-	TEMP_FAILURE_RETRY(read(pipefd[0], &v, 1));
-
-	lock.lock();
-	for (unsigned signum=0; signum<32; signum++) {
-	  if (handlers[signum]) {
-	    r = read(handlers[signum]->pipefd[0], &v, 1);
-	    if (r == 1) {
-	      siginfo_t * siginfo = &handlers[signum]->info_t;
-              ostringstream message;
-              message << "received  signal: " << sig_str(signum);
-              switch (siginfo->si_code) {
-                case SI_USER:
-                  message << " from " << get_name_by_pid(siginfo->si_pid);
-                  // If PID is undefined, it doesn't have a meaning to be displayed
-                  if (siginfo->si_pid) {
-                    message << " (PID: " << siginfo->si_pid << ")";
-                  } else {
-                    message << " ( Could be generated by pthread_kill(), raise(), abort(), alarm() )";
-                  }
-                  message << " UID: " << siginfo->si_uid;
-                  break;
-                default:
-                  /* As we have a not expected signal, let's report the structure to help debugging */
-                  message << ", si_code : " << siginfo->si_code;
-                  message << ", si_value (int): " << siginfo->si_value.sival_int;
-                  message << ", si_value (ptr): " << siginfo->si_value.sival_ptr;
-                  message << ", si_errno: " << siginfo->si_errno;
-                  message << ", si_pid : " << siginfo->si_pid;
-                  message << ", si_uid : " << siginfo->si_uid;
-                  message << ", si_addr" << siginfo->si_addr;
-                  message << ", si_status" << siginfo->si_status;
-                  break;
-              }
-              derr << message.str() << dendl;
-              handlers[signum]->handler(signum);
-	    }
-	  }
+      if (r <= 0)
+	continue;
+      drain_wakeups();
+
+      uint32_t fired = pending.exchange(0);
+      if (!fired) {
+	continue;
+      }
+      ceph::rcu_ptr<handler_table>::reader t(table);
+      while (fired) {
+	const unsigned signum = __builtin_ctz(fired);
+	fired &= fired - 1;
+	// one may have arrived since pending was taken; it is counted
+	// here and its bit makes for one more call, folding in nothing
+	const uint64_t n = received[signum].load(std::memory_order_relaxed);
+	const uint64_t folded = n - dispatched[signum] > 1 ?
+	  n - dispatched[signum] - 1 : 0;
+	dispatched[signum] = n;
+	coalesced[signum].fetch_add(folded, std::memory_order_relaxed);
+	if (t->handlers[signum]) {
+	  // a copy; the hook may be writing another one
+	  siginfo_t siginfo = info[signum];
+	  log_signal(signum, &siginfo, folded);
+	  t->handlers[signum](signum);
 	}
-	lock.unlock();
-      } 
+      }
     }
     return NULL;
   }
@@ -541,20 +1047,33 @@ struct SignalHandler : public Thread {
     // defined.  We can do this without the lock because we will never
     // have the signal handler defined without the handlers entry also
     // being filled in.
-    ceph_assert(handlers[signum]);
-    int r = write(handlers[signum]->pipefd[1], " ", 1);
-    ceph_assert(r == 1);
+    ceph_assert(get_handler(signum));
+    memset(&info[signum], 0, sizeof(info[signum]));
+    info[signum].si_code = SI_USER;
+    received[signum].fetch_add(1, std::memory_order_relaxed);
+    pending |= 1u << signum;
+    signal_thread();
   }
 
+  /// async-signal-safe
   void queue_signal_info(int signum, siginfo_t *siginfo, void * content) {
-    // If this signal handler is registered, the callback must be
-    // defined.  We can do this without the lock because we will never
-    // have the signal handler defined without the handlers entry also
-    // being filled in.
-    ceph_assert(handlers[signum]);
-    memcpy(&handlers[signum]->info_t, siginfo, sizeof(siginfo_t));
-    int r = write(handlers[signum]->pipefd[1], " ", 1);
-    ceph_assert(r == 1);
+    memcpy(&info[signum], siginfo, sizeof(siginfo_t));
+    received[signum].fetch_add(1, std::memory_order_relaxed);
+    pending |= 1u << signum;
+    signal_thread();
+  }
+
+  /// replace the handler of signum in a copy of the table, and publish it
+  void set_handler(int signum, signal_handler_t handler) {
+    std::lock_guard l(lock);
+    auto t = std::make_unique<handler_table>(
+      *ceph::rcu_ptr<handler_table>::reader(table));
+    t->handlers[signum] = handler;
+    table.update(std::move(t));
+  }
+
+  signal_handler_t get_handler(int signum) const {
+    return ceph::rcu_ptr<handler_table>::reader(table)->handlers[signum];
   }
 
   void register_handler(int signum, signal_handler_t handler, bool oneshot);
@@ -569,31 +1088,16 @@ static void handler_signal_hook(int signum, siginfo_t * siginfo, void * content)
 
 void SignalHandler::register_handler(int signum, signal_handler_t handler, bool oneshot)
 {
-  int r;
-
   ceph_assert(signum >= 0 && signum < 32);
 
-  safe_handler *h = new safe_handler;
-
-  r = pipe_cloexec(h->pipefd);
-  ceph_assert(r == 0);
-  r = fcntl(h->pipefd[0], F_SETFL, O_NONBLOCK);
-  ceph_assert(r == 0);
-
-  h->handler = handler;
-  lock.lock();
-  handlers[signum] = h;
-  lock.unlock();
+  set_handler(signum, handler);
 
-  // signal thread so that it sees our new handler
-  signal_thread();
-  
   // install our handler
   struct sigaction oldact;
   struct sigaction act;
   memset(&act, 0, sizeof(act));
 
-  act.sa_handler = (signal_handler_t)handler_signal_hook;
+  act.sa_sigaction = handler_signal_hook;
   sigfillset(&act.sa_mask);  // mask all signals in the handler
   act.sa_flags = SA_SIGINFO | (oneshot ? SA_RESETHAND : 0);
   int ret = sigaction(signum, &act, &oldact);
@@ -603,22 +1107,14 @@ void SignalHandler::register_handler(int signum, signal_handler_t handler, bool
 void SignalHandler::unregister_handler(int signum, signal_handler_t handler)
 {
   ceph_assert(signum >= 0 && signum < 32);
-  safe_handler *h = handlers[signum];
-  ceph_assert(h);
-  ceph_assert(h->handler == handler);
+  ceph_assert(get_handler(signum));
+  ceph_assert(get_handler(signum) == handler);
 
   // restore to default
   signal(signum, SIG_DFL);
 
-  // _then_ remove our handlers entry
-  lock.lock();
-  handlers[signum] = NULL;
-  lock.unlock();
-
-  // this will wake up select() so that worker thread sees our handler is gone
-  close(h->pipefd[0]);
-  close(h->pipefd[1]);
-  delete h;
+  // _then_ remove our handlers entry; one still pending is dropped
+  set_handler(signum, NULL);
 }
 
 
@@ -643,6 +1139,15 @@ void queue_async_signal(int signum)
   g_signal_handler->queue_signal(signum);
 }
 
+void get_async_signal_counts(int signum, uint64_t *received,
+			     uint64_t *coalesced)
+{
+  ceph_assert(g_signal_handler);
+  ceph_assert(signum >= 0 && signum < 32);
+  *received = g_signal_handler->received[signum].load();
+  *coalesced = g_signal_handler->coalesced[signum].load();
+}
+
 void register_async_signal_handler(int signum, signal_handler_t handler)
 {
   ceph_assert(g_signal_handler);
@@ -16,6 +16,7 @@
 #define CEPH_GLOBAL_SIGNAL_HANDLER_H
 
 #include <signal.h>
+#include <cstdint>
 #include "acconfig.h"
 
 typedef void (*signal_handler_t)(int);
@@ -46,6 +47,11 @@ void shutdown_async_signal_handler();
 /// queue an async signal
 void queue_async_signal(int signum);
 
+/// how many of signum were received, and how many of those ran no
+/// callback of their own, having arrived while one was still pending
+void get_async_signal_counts(int signum, uint64_t *received,
+			     uint64_t *coalesced);
+
 /// install a safe, async, callback for the given signal
 void register_async_signal_handler(int signum, signal_handler_t handler);
 void register_async_signal_handler_oneshot(int signum, signal_handler_t handler);
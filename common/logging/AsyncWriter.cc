@@ -0,0 +1,178 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "AsyncWriter.h"
+
+#include "common/errno.h"
+
+#include "include/ceph_assert.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+
+namespace ceph {
+namespace logging {
+
+AsyncWriter::AsyncWriter(std::size_t max_pending)
+  : m_max_pending(std::max<std::size_t>(max_pending, 1))
+{
+}
+
+AsyncWriter::~AsyncWriter()
+{
+  ceph_assert(!is_started());
+}
+
+void AsyncWriter::start()
+{
+  ceph_assert(!is_started());
+  {
+    std::scoped_lock lock(m_lock);
+    m_stop = false;
+  }
+  create("log_writer");
+}
+
+void AsyncWriter::stop()
+{
+  if (is_started()) {
+    {
+      std::scoped_lock lock(m_lock);
+      m_stop = true;
+      m_cond_writer.notify_one();
+    }
+    join();
+  }
+}
+
+void AsyncWriter::submit(int fd, LogBuffer& buf)
+{
+  std::unique_lock lock(m_lock);
+  while (m_pending.size() >= m_max_pending) {
+    m_cond_submitters.wait(lock);
+  }
+  const auto capacity = buf.capacity();
+  m_pending.push_back(Pending{fd, std::move(buf)});
+  if (!m_free.empty()) {
+    buf = std::move(m_free.back());
+    m_free.pop_back();
+  } else {
+    buf = LogBuffer();
+  }
+  buf.clear();
+  buf.reserve(capacity);
+  m_cond_writer.notify_one();
+}
+
+void AsyncWriter::drain()
+{
+  std::unique_lock lock(m_lock);
+  while (!m_pending.empty() || m_writing) {
+    m_cond_submitters.wait(lock);
+  }
+}
+
+void AsyncWriter::prepare_fork()
+{
+  m_lock.lock();
+}
+
+void AsyncWriter::after_fork(bool child)
+{
+  if (child) {
+    // the parent's writer thread writes these; it isn't here
+    m_pending.clear();
+    m_writing = false;
+    m_stop = false;
+    new (&m_cond_writer) std::condition_variable;
+    new (&m_cond_submitters) std::condition_variable;
+    forget_after_fork();
+  }
+  m_lock.unlock();
+}
+
+void AsyncWriter::_write(std::vector<Pending>& batch)
+{
+  std::vector<struct iovec> iov;
+  iov.reserve(batch.size());
+  for (auto i = batch.begin(); i != batch.end(); ) {
+    // one writev per run of buffers for the same fd
+    const int fd = i->fd;
+    iov.clear();
+    for (; i != batch.end() && i->fd == fd && iov.size() < IOV_MAX; ++i) {
+      iov.push_back({i->buf.data(), i->buf.size()});
+    }
+
+    int r = 0;
+    auto v = iov.begin();
+    while (v != iov.end()) {
+      ssize_t w = ::writev(fd, &*v, std::min<std::size_t>(iov.end() - v, IOV_MAX));
+      if (w < 0) {
+	if (errno == EINTR) {
+	  continue;
+	}
+	r = -errno;
+	break;
+      }
+      // skip what was written; a short write leaves a partial iovec
+      while (v != iov.end() && (std::size_t)w >= v->iov_len) {
+	w -= v->iov_len;
+	++v;
+      }
+      if (w > 0) {
+	v->iov_base = (char*)v->iov_base + w;
+	v->iov_len -= w;
+      }
+    }
+
+    if (r != m_last_error) {
+      if (r < 0)
+	std::cerr << "problem writing to log: " << cpp_strerror(r) << std::endl;
+      m_last_error = r;
+    }
+  }
+}
+
+void *AsyncWriter::entry()
+{
+  std::vector<Pending> batch;
+  std::unique_lock lock(m_lock);
+  while (true) {
+    if (m_pending.empty()) {
+      if (m_stop) {
+	break;
+      }
+      m_cond_writer.wait(lock);
+      continue;
+    }
+
+    batch.clear();
+    while (!m_pending.empty()) {
+      batch.push_back(std::move(m_pending.front()));
+      m_pending.pop_front();
+    }
+    m_writing = true;
+    m_cond_submitters.notify_all(); // queue has room again
+    lock.unlock();
+
+    _write(batch);
+
+    lock.lock();
+    for (auto& p : batch) {
+      if (m_free.size() < m_max_pending) {
+	m_free.push_back(std::move(p.buf));
+      }
+    }
+    m_writing = false;
+    m_cond_submitters.notify_all();
+  }
+  return NULL;
+}
+
+}
+}
@@ -0,0 +1,73 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_ASYNCWRITER_H
+#define __CEPH_LOG_ASYNCWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "common/utils/Thread.h"
+#include "LogBuffer.h"
+
+namespace ceph {
+namespace logging {
+
+/* Writes formatted log buffers to the log file on its own thread.
+ *
+ * The log thread hands over a full buffer with submit() and gets an empty
+ * one back, so it can format the next batch while the previous one is being
+ * written. Buffers queued for the same fd are written with a single
+ * writev(). At most max_pending buffers are in flight; submit() waits for
+ * the writer beyond that, which bounds memory the same way a synchronous
+ * write would.
+ */
+class AsyncWriter : private Thread
+{
+public:
+  explicit AsyncWriter(std::size_t max_pending = 2);
+  ~AsyncWriter() override;
+
+  void start();
+  /// write out everything queued, then exit the thread
+  void stop();
+
+  /// queue buf for fd and swap in an empty buffer with the same capacity
+  void submit(int fd, LogBuffer& buf);
+
+  /// wait until everything queued so far has been written
+  void drain();
+
+  /// hold m_lock across a fork(), outside of a write; the child comes out
+  /// of after_fork() as if never started, without the parent's buffers
+  void prepare_fork();
+  void after_fork(bool child);
+
+private:
+  struct Pending {
+    int fd;
+    LogBuffer buf;
+  };
+
+  void *entry() override;
+  void _write(std::vector<Pending>& batch);
+
+  const std::size_t m_max_pending;
+
+  std::mutex m_lock;
+  std::condition_variable m_cond_writer;
+  std::condition_variable m_cond_submitters;
+  std::deque<Pending> m_pending;
+  std::vector<LogBuffer> m_free; ///< written buffers, for reuse
+  bool m_writing = false;
+  bool m_stop = false;
+
+  int m_last_error = 0; ///< only touched by the writer thread
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,258 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_BINARYLOG_H
+#define __CEPH_LOG_BINARYLOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "Entry.h"
+#include "common/logging/subsys_types.h"
+
+namespace ceph {
+namespace logging {
+
+enum class LogFormat {
+  TEXT,
+  BINARY,
+  JSON, ///< one JSON object per line; see log_format
+};
+
+/* On-disk layout of log_format=binary files.
+ *
+ * The file is a sequence of records, each a fixed header followed by len
+ * bytes of message text. Fields are in host byte order; decode on a host of
+ * the same endianness. The magic lets a reader resynchronize after a torn
+ * write or skip preallocated zeroes.
+ */
+namespace binary {
+
+constexpr uint32_t RECORD_MAGIC = 0x474f4c43; // "CLOG"
+
+enum : uint8_t {
+  FLAG_COARSE = 1,  ///< stamp has millisecond precision
+  FLAG_CRASH = 2,   ///< part of a dump_recent(); index is its position
+  FLAG_MESSAGE = 4, ///< a bare line from the log itself, no stamp/thread/prio
+  FLAG_DEFERRED = 8, ///< in memory only: a render_fn and argument blob
+};
+
+struct record_header {
+  uint32_t magic;
+  uint32_t len;
+  uint64_t stamp;   ///< nanoseconds since the epoch
+  uint64_t thread;
+  int32_t index;
+  int16_t prio;
+  uint16_t subsys;
+  uint8_t flags;
+  uint8_t reserved[7];
+};
+static_assert(sizeof(record_header) == 40, "on-disk layout must not change");
+
+inline record_header make_header(const Entry& e, std::size_t len, bool crash,
+				 long index) {
+  auto count = e.stamp().time_since_epoch().count();
+  record_header h;
+  memset(&h, 0, sizeof(h));
+  h.magic = RECORD_MAGIC;
+  h.len = static_cast<uint32_t>(len);
+  h.stamp = count.count;
+  h.thread = (uint64_t)e.m_thread;
+  h.index = static_cast<int32_t>(index);
+  h.prio = e.m_prio;
+  h.subsys = e.m_subsys;
+  h.flags = (count.coarse ? FLAG_COARSE : 0) | (crash ? FLAG_CRASH : 0);
+  return h;
+}
+
+inline record_header make_message_header(std::string_view msg) {
+  record_header h;
+  memset(&h, 0, sizeof(h));
+  h.magic = RECORD_MAGIC;
+  h.len = static_cast<uint32_t>(msg.size());
+  h.flags = FLAG_MESSAGE;
+  return h;
+}
+
+/* A log_recent_file: this header, then ring_size bytes of records as above,
+ * each padded to a multiple of 8 bytes. The oldest record is at begin. A
+ * record that didn't fit at the end of the ring was written at offset 0
+ * instead; while wrapped, the records run from begin to wrap and then from
+ * 0 to end, otherwise from begin to end.
+ */
+constexpr uint64_t RECENT_MAGIC = 0x544e435253474f4c; // "LOGSRCNT"
+constexpr uint32_t RECENT_VERSION = 1;
+
+struct recent_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size; ///< the ring starts here
+  uint64_t ring_size;
+  int64_t pid;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t wrap;
+  uint64_t count;
+  uint8_t wrapped;
+  uint8_t reserved[63];
+};
+static_assert(sizeof(recent_header) == 128, "on-disk layout must not change");
+
+/* A log_shm_ring: this header, then ring_size (a power of two) bytes of
+ * records as above, each padded to a multiple of 8 bytes, written by the
+ * daemon and drained by ceph-log-agent.  head and tail count the bytes ever
+ * written and consumed; a record is at its count modulo ring_size.  A
+ * record that wouldn't fit before the end of the ring is written at offset
+ * 0, and SHM_WRAP_MAGIC is left where it would have started.  The writer
+ * publishes head with release semantics once the records are complete and
+ * the reader tail once it is done with them; the writer never overwrites
+ * what the reader hasn't consumed, but counts what didn't fit in dropped.
+ * The reader removes the file once it is drained and closed, or its writer
+ * is gone.
+ */
+constexpr uint64_t SHM_MAGIC = 0x474e495247474f4c; // "LOGGRING"
+constexpr uint32_t SHM_VERSION = 1;
+constexpr uint32_t SHM_WRAP_MAGIC = 0x50415257; // "WRAP"
+
+struct shm_ring_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size; ///< the ring starts here
+  uint64_t ring_size;
+  int64_t pid;          ///< of the writer
+  std::atomic<uint32_t> closed; ///< the writer is done with it
+  uint8_t reserved[28];
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) std::atomic<uint64_t> dropped; ///< records that didn't fit
+};
+static_assert(sizeof(shm_ring_header) == 256, "shared layout must not change");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+	      "the ring is shared between processes");
+
+inline std::size_t shm_record_size(std::size_t len) {
+  return (sizeof(record_header) + len + 7) & ~std::size_t(7);
+}
+
+/* A log file's sidecar index, log_file.idx (log_index_interval): a record
+ * for every log_index_interval or so bytes of the file, in file order. Each
+ * covers the entries starting in [offset, offset + len) of the log file,
+ * text or binary, so a reader can seek to the chunks that overlap a time
+ * range and subsystems instead of scanning the whole file. Offsets are of
+ * the uncompressed file; no index is kept while the file is compressed.
+ */
+constexpr uint32_t INDEX_MAGIC = 0x58444943; // "CIDX"
+
+struct index_record {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t len;
+  uint64_t first;     ///< earliest stamp covered, nanoseconds since the epoch
+  uint64_t last;      ///< latest stamp covered
+  uint64_t subsys[2]; ///< bit n set if subsystem n has entries in the chunk
+};
+static_assert(sizeof(index_record) == 56, "on-disk layout must not change");
+static_assert(ceph_subsys_get_num() <= 128, "index_record::subsys is full");
+
+/* A log_traffic_trace file: this header, then a record for every entry
+ * the log flushed, holding only its shape, for log_replay to reproduce.
+ * A record is five varints (seven bits a byte, low bits first, the top
+ * bit set on all but the last byte): the stamp as a zigzag-encoded delta
+ * from the record before (from start for the first; entries reach the
+ * log thread out of stamp order), the thread as the order in which it
+ * first appeared (so a record whose thread equals the number seen so far
+ * introduces one), the subsystem shifted left by one with the low bit set
+ * if the entry was written out rather than only gathered for the recent
+ * entries, the priority zigzag-encoded, and the length of the message.
+ */
+constexpr uint64_t TRACE_MAGIC = 0x4543415254474f4c; // "LOGTRACE"
+constexpr uint32_t TRACE_VERSION = 1;
+
+struct trace_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size; ///< the records start here
+  uint64_t start;       ///< nanoseconds since the epoch
+  int64_t pid;
+  uint8_t reserved[32];
+};
+static_assert(sizeof(trace_header) == 64, "on-disk layout must not change");
+
+struct trace_record {
+  uint64_t stamp;
+  uint32_t thread;
+  uint16_t subsys;
+  bool written;
+  int16_t prio;
+  uint32_t len;
+};
+
+/// the longest a trace record encodes to
+constexpr std::size_t TRACE_RECORD_MAX = 10 + 5 + 3 + 3 + 5;
+
+inline char *put_varint(char *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = static_cast<char>(v);
+  return p;
+}
+
+/// nullptr if the varint runs past end
+inline const char *get_varint(const char *p, const char *end, uint64_t *v) {
+  *v = 0;
+  for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+    const uint8_t b = *p++;
+    *v |= uint64_t(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+/// r after a record stamped prev, at p, which has TRACE_RECORD_MAX room
+inline char *encode_trace(char *p, const trace_record& r, uint64_t prev) {
+  auto zigzag = [](int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); };
+  p = put_varint(p, zigzag(r.stamp - prev));
+  p = put_varint(p, r.thread);
+  p = put_varint(p, (uint64_t(r.subsys) << 1) | r.written);
+  p = put_varint(p, zigzag(r.prio));
+  return put_varint(p, r.len);
+}
+
+/// the record at p, after one stamped prev; nullptr if it is cut off
+inline const char *decode_trace(const char *p, const char *end, uint64_t prev,
+				trace_record *r) {
+  uint64_t v[5];
+  for (auto& f : v) {
+    p = get_varint(p, end, &f);
+    if (!p) {
+      return nullptr;
+    }
+  }
+  r->stamp = prev + ((v[0] >> 1) ^ -(v[0] & 1));
+  r->thread = v[1];
+  r->subsys = v[2] >> 1;
+  r->written = v[2] & 1;
+  r->prio = static_cast<int16_t>((v[3] >> 1) ^ -(v[3] & 1));
+  r->len = v[4];
+  return p;
+}
+
+inline log_time header_stamp(const record_header& h) {
+  return log_time(log_clock::duration(
+    _logclock::taggedrep(h.stamp, h.flags & FLAG_COARSE)));
+}
+
+} // namespace binary
+
+}
+}
+
+#endif
@@ -0,0 +1,97 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_DEFERREDENTRY_H
+#define __CEPH_LOG_DEFERREDENTRY_H
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "Entry.h"
+
+namespace ceph {
+namespace logging {
+
+/* Encoding of log arguments whose formatting is deferred to the log thread.
+ *
+ * Each argument is copied into the entry as raw bytes; the matching render()
+ * reads them back and streams them with operator<<, the same way the
+ * argument would have been printed by ldout. Strings (std::string,
+ * std::string_view, const char*) are copied by value. Anything else must be
+ * trivially copyable -- integers, floats, enums, pointers, small structs --
+ * since it will be printed long after the caller has moved on.
+ */
+template<typename T, typename = void>
+struct deferred_arg {
+  static_assert(std::is_trivially_copyable_v<T>,
+		"deferred log arguments must be strings or trivially copyable");
+
+  static std::size_t size(const T&) {
+    return sizeof(T);
+  }
+  static char* encode(char* p, const T& v) {
+    memcpy(p, &v, sizeof(T));
+    return p + sizeof(T);
+  }
+  static const char* render(const char* p, std::ostream& out) {
+    alignas(T) char buf[sizeof(T)];
+    memcpy(buf, p, sizeof(T));
+    out << *std::launder(reinterpret_cast<const T*>(buf));
+    return p + sizeof(T);
+  }
+};
+
+struct deferred_string_arg {
+  static std::size_t size(std::string_view v) {
+    return sizeof(uint32_t) + v.size();
+  }
+  static char* encode(char* p, std::string_view v) {
+    uint32_t len = v.size();
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), v.data(), len);
+    return p + sizeof(len) + len;
+  }
+  static const char* render(const char* p, std::ostream& out) {
+    uint32_t len;
+    memcpy(&len, p, sizeof(len));
+    out << std::string_view(p + sizeof(len), len);
+    return p + sizeof(len) + len;
+  }
+};
+
+template<typename T>
+struct deferred_arg<T, std::enable_if_t<
+  std::is_same_v<T, std::string> ||
+  std::is_same_v<T, std::string_view> ||
+  std::is_same_v<T, const char*> ||
+  std::is_same_v<T, char*>>> : deferred_string_arg {};
+
+template<typename... Args>
+struct deferred_codec {
+  static void render(const char* blob, std::ostream& out) {
+    ((blob = deferred_arg<Args>::render(blob, out)), ...);
+  }
+};
+
+/// encode args into a deferred entry; nothing is formatted here
+template<typename... Args>
+ConcreteEntry make_deferred_entry(short prio, short sub, const Args&... args) {
+  // decay so that string literals are captured as strings, not char arrays
+  const std::size_t len =
+    (std::size_t{0} + ... + deferred_arg<std::decay_t<Args>>::size(args));
+  ConcreteEntry e(prio, sub,
+		  &deferred_codec<std::decay_t<Args>...>::render, len);
+  char* p = e.blob();
+  ((p = deferred_arg<std::decay_t<Args>>::encode(p, args)), ...);
+  return e;
+}
+
+}
+}
+
+#endif
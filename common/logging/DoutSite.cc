@@ -0,0 +1,145 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "DoutSite.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace ceph {
+namespace logging {
+
+DoutSiteRegistry& DoutSiteRegistry::instance()
+{
+  // never destroyed: douts may still run during static destruction
+  static DoutSiteRegistry *registry = new DoutSiteRegistry;
+  return *registry;
+}
+
+bool DoutSiteRegistry::parse(std::string_view pattern, Rule *r)
+{
+  r->line = 0;
+  if (auto colon = pattern.rfind(':'); colon != std::string_view::npos) {
+    std::string l(pattern.substr(colon + 1));
+    char *end;
+    long line = strtol(l.c_str(), &end, 10);
+    if (l.empty() || *end || line <= 0) {
+      return false;
+    }
+    r->line = line;
+    pattern = pattern.substr(0, colon);
+  }
+  if (pattern.empty()) {
+    return false;
+  }
+  r->file = pattern;
+  return true;
+}
+
+bool DoutSiteRegistry::matches(const Rule& r, const DoutSite& s)
+{
+  if (r.line && r.line != s.line) {
+    return false;
+  }
+  const std::size_t len = strlen(s.file);
+  if (len < r.file.size() ||
+      memcmp(s.file + len - r.file.size(), r.file.data(), r.file.size())) {
+    return false;
+  }
+  // "OSD.cc" should not match "PrimaryLogOSD.cc"
+  return len == r.file.size() || r.file[0] == '/' ||
+    s.file[len - r.file.size() - 1] == '/';
+}
+
+uint8_t DoutSiteRegistry::add(DoutSite *s)
+{
+  std::scoped_lock lock(m_lock);
+  auto state = s->state.load(std::memory_order_relaxed);
+  if (state != DoutSite::NEW) {
+    // another thread got here first
+    return state;
+  }
+  state = DoutSite::DEFAULT;
+  for (auto& r : m_rules) {
+    if (matches(r, *s)) {
+      state = r.state;
+    }
+  }
+  s->next = m_head;
+  m_head = s;
+  s->state.store(state, std::memory_order_relaxed);
+  return state;
+}
+
+int DoutSiteRegistry::set(std::string_view pattern, uint8_t state)
+{
+  Rule r;
+  if (!parse(pattern, &r)) {
+    return -EINVAL;
+  }
+  r.state = state;
+  std::scoped_lock lock(m_lock);
+  int n = 0;
+  for (auto s = m_head; s; s = s->next) {
+    if (matches(r, *s)) {
+      s->state.store(state, std::memory_order_relaxed);
+      ++n;
+    }
+  }
+  m_rules.erase(std::remove_if(m_rules.begin(), m_rules.end(),
+			       [&r](const Rule& o) {
+				 return o.file == r.file && o.line == r.line;
+			       }),
+		m_rules.end());
+  if (state != DoutSite::DEFAULT) {
+    m_rules.push_back(std::move(r));
+  }
+  return n;
+}
+
+void DoutSiteRegistry::reset()
+{
+  std::scoped_lock lock(m_lock);
+  m_rules.clear();
+  for (auto s = m_head; s; s = s->next) {
+    s->state.store(DoutSite::DEFAULT, std::memory_order_relaxed);
+  }
+}
+
+void DoutSiteRegistry::for_each_set(
+  const std::function<void(const DoutSite&, uint8_t)>& f) const
+{
+  std::scoped_lock lock(m_lock);
+  for (auto s = m_head; s; s = s->next) {
+    auto state = s->state.load(std::memory_order_relaxed);
+    if (state != DoutSite::DEFAULT) {
+      f(*s, state);
+    }
+  }
+}
+
+void DoutSiteRegistry::for_each(
+  const std::function<void(const DoutSite&)>& f) const
+{
+  std::scoped_lock lock(m_lock);
+  for (auto s = m_head; s; s = s->next) {
+    f(*s);
+  }
+}
+
+void DoutSiteRegistry::reset_volume()
+{
+  std::scoped_lock lock(m_lock);
+  for (auto s = m_head; s; s = s->next) {
+    s->gathered.store(0, std::memory_order_relaxed);
+    s->gathered_bytes.store(0, std::memory_order_relaxed);
+    s->written.store(0, std::memory_order_relaxed);
+    s->written_bytes.store(0, std::memory_order_relaxed);
+  }
+}
+
+}
+}
@@ -0,0 +1,102 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_DOUTSITE_H
+#define __CEPH_LOG_DOUTSITE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/utils/likely.h"
+
+namespace ceph {
+namespace logging {
+
+/* One dout statement, for enabling or disabling it on its own.
+ *
+ * Every dout expansion has a static DoutSite that is constant initialized
+ * (no guard) and registered with DoutSiteRegistry the first time it is
+ * reached. The dout gate loads its state byte: an ENABLED site is gathered
+ * and written whatever its subsystem's levels, a DISABLED one never is, and
+ * a DEFAULT one follows the levels as usual.
+ */
+struct DoutSite {
+  enum : uint8_t {
+    NEW = 0,  ///< not registered yet
+    DEFAULT,
+    ENABLED,
+    DISABLED,
+  };
+
+  constexpr DoutSite(const char *file, int line) : file(file), line(line) {}
+  DoutSite(const DoutSite&) = delete;
+  DoutSite& operator=(const DoutSite&) = delete;
+
+  const char *const file;
+  const int line;
+  std::atomic<uint8_t> state{NEW};
+  DoutSite *next = nullptr; ///< registry list; set once, under its lock
+
+  /// for "log top", by every Log, counted like Log::Volume
+  std::atomic<uint64_t> gathered{0};
+  std::atomic<uint64_t> gathered_bytes{0};
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> written_bytes{0};
+};
+
+/// every dout site reached so far, process wide
+class DoutSiteRegistry {
+public:
+  static DoutSiteRegistry& instance();
+
+  /// register s, applying any rule that matches it; returns its state
+  uint8_t add(DoutSite *s);
+
+  /// set the state of every site matching "file[:line]", where file
+  /// matches the end of the site's path, and of any matching site that is
+  /// reached later; returns the number of sites changed now, or -EINVAL
+  int set(std::string_view pattern, uint8_t state);
+  /// forget all rules and put every site back to DEFAULT
+  void reset();
+
+  /// sites that are not DEFAULT
+  void for_each_set(
+    const std::function<void(const DoutSite&, uint8_t)>& f) const;
+  /// every site reached so far
+  void for_each(const std::function<void(const DoutSite&)>& f) const;
+  /// zero every site's "log top" counts
+  void reset_volume();
+
+private:
+  struct Rule {
+    std::string file;
+    int line; ///< 0 for any
+    uint8_t state;
+  };
+
+  static bool parse(std::string_view pattern, Rule *r);
+  static bool matches(const Rule& r, const DoutSite& s);
+
+  mutable std::mutex m_lock;
+  DoutSite *m_head = nullptr;
+  std::vector<Rule> m_rules; ///< applied in order, later ones win
+};
+
+/// the state of s; a single relaxed load once s is registered
+inline uint8_t dout_site_state(DoutSite& s) {
+  auto state = s.state.load(std::memory_order_relaxed);
+  if (unlikely(state == DoutSite::NEW)) {
+    state = DoutSiteRegistry::instance().add(&s);
+  }
+  return state;
+}
+
+}
+}
+
+#endif
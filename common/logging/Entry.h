@@ -4,26 +4,38 @@
 #ifndef __CEPH_LOG_ENTRY_H
 #define __CEPH_LOG_ENTRY_H
 
+#include "EntryPool.h"
 #include "LogClock.h"
+#include "LogTask.h"
 #include "StackStringStream.h"
+#include "TraceTag.h"
+#include "common/utils/print_budget.h"
 #include "boost/container/small_vector.hpp"
 #include <pthread.h>
+#include <atomic>
+#include <ostream>
 #include <string_view>
+#include <vector>
 
 namespace ceph {
 namespace logging {
 
+struct DoutSite;
+
 class Entry {
 public:
   using time = log_time;
 
   Entry() = delete;
   Entry(short pr, short sub) :
-    m_stamp(clock().now()),
-    m_thread(pthread_self()),
+    m_thread(log_thread_id()),
     m_prio(pr),
-    m_subsys(sub)
-  {}
+    m_subsys(sub),
+    m_forced(pr > 0 && t_trace_level >= pr),
+    m_recorded(false)
+  {
+    m_stamp = clock().now_tick(&m_clock);
+  }
   Entry(const Entry &) = default;
   Entry& operator=(const Entry &) = default;
   Entry(Entry &&e) = default;
@@ -33,9 +45,25 @@ public:
   virtual std::string_view strv() const = 0;
   virtual std::size_t size() const = 0;
 
-  time m_stamp;
-  pthread_t m_thread;
+  /// when the entry was made
+  time stamp() const {
+    return clock().to_time(m_stamp, m_clock);
+  }
+  void set_stamp(time t) {
+    const auto rep = t.time_since_epoch().count();
+    m_stamp = rep.count;
+    m_clock = rep.coarse ? log_clock::source::real_coarse :
+			   log_clock::source::real_fine;
+  }
+
+  log_clock::tick m_stamp; ///< raw, read it through stamp()
+  pthread_t m_thread; ///< or the task it was made in; see LogTask.h
   short m_prio, m_subsys;
+  bool m_forced; ///< written regardless of the log level: gathered in a
+                 ///< TraceScope or at an enabled DoutSite
+  bool m_recorded; ///< already in its thread's recent ring
+  log_clock::source m_clock; ///< what m_stamp is a reading of
+  DoutSite *m_site = nullptr; ///< the dout statement that made it, if any
 
   static log_clock& clock() {
     static log_clock clock;
@@ -43,20 +71,40 @@ public:
   }
 };
 
+/// an ostream target over a caller's fixed buffer; output past its end is
+/// dropped rather than allocated for
+class FixedStreambuf final : public std::streambuf {
+public:
+  FixedStreambuf(char *buf, std::size_t len) {
+    setp(buf, buf + len);
+  }
+  std::string_view strv() const {
+    return std::string_view(pbase(), pptr() - pbase());
+  }
+};
+
 /* This should never be moved to the heap! Only allocate this on the stack. See
- * CachedStackStringStream for rationale.
+ * CachedStackStringStream for rationale. A fiber's or coroutine's stack is
+ * fine, even if the task moves to another thread before the entry is
+ * submitted: the stream goes back to the cache of whichever thread it ends
+ * on.  See LogTask.h.
  */
 class MutableEntry : public Entry {
 public:
   MutableEntry() = delete;
-  MutableEntry(short pr, short sub) : Entry(pr, sub) {}
+  MutableEntry(short pr, short sub) : Entry(pr, sub) {
+    const auto budget = container_budget().load(std::memory_order_relaxed);
+    ceph::set_print_budget(*cos, budget & UINT32_MAX, budget >> 32);
+  }
   MutableEntry(const MutableEntry&) = delete;
   MutableEntry& operator=(const MutableEntry&) = delete;
   MutableEntry(MutableEntry&&) = delete;
   MutableEntry& operator=(MutableEntry&&) = delete;
   ~MutableEntry() override = default;
 
-  std::ostream& get_ostream() {
+  /// the stream itself rather than an ostream, so that the common
+  /// insertions into it take the direct path
+  CachedStackStringStream::sss& get_ostream() {
     return *cos;
   }
 
@@ -64,16 +112,58 @@ public:
     return cos->strv();
   }
   std::size_t size() const override {
-    return cos->strv().size();
+    return cos->length();
+  }
+
+  /// hand the formatted stream over; the entry is unusable afterwards
+  CachedStackStringStream::osptr release_stream() {
+    return cos.release();
+  }
+
+  /// the ceph::set_print_budget() of every entry's stream, elements in the
+  /// low half and bytes in the high one; see log_max_container_elements
+  static std::atomic<uint64_t>& container_budget() {
+    static std::atomic<uint64_t> budget{0};
+    return budget;
   }
 
 private:
   CachedStackStringStream cos;
 };
 
-class ConcreteEntry : public Entry {
+/* The type every queue stores. It is final so that code holding a
+ * ConcreteEntry (the flush loop, the merge, the recent ring) gets strv() and
+ * size() resolved at compile time and inlined.
+ */
+class ConcreteEntry final : public Entry {
 public:
+  using stream_ptr = CachedStackStringStream::osptr;
+  /// renders an encoded argument blob as text; see DeferredEntry.h
+  using render_fn = void (*)(const char *blob, std::ostream& out);
+
+  static constexpr std::size_t INLINE_BYTES = 1024;
+  /// beyond INLINE_BYTES the text goes in a recycled EntryPool block
+  using buffer_t = boost::container::small_vector<char, INLINE_BYTES,
+						  EntryAllocator<char>>;
+  static_assert(INLINE_BYTES < EntryPool::MIN_BLOCK);
+
   ConcreteEntry() = delete;
+  /// an entry whose text is appended directly to buffer()
+  ConcreteEntry(short pr, short sub) : Entry(pr, sub) {}
+  /* An entry whose text has not been formatted yet: str holds blob_len bytes
+   * of encoded arguments (filled in by the caller through blob()) and render
+   * turns them into text the first time strv() is called, normally on the
+   * log thread and only if the entry is actually written out.
+   */
+  ConcreteEntry(short pr, short sub, render_fn render, std::size_t blob_len)
+    : Entry(pr, sub), render(render) {
+    str.resize(blob_len);
+  }
+  /* Adopt the entry's stream rather than copying out of it: the submitting
+   * thread pays only for a pointer move. The log thread gives the stream back
+   * with release_stream() once the entry has been written.
+   */
+  ConcreteEntry(MutableEntry&& e) : Entry(e), stream(e.release_stream()) {}
   ConcreteEntry(const Entry& e) : Entry(e) {
     auto strv = e.strv();
     str.reserve(strv.size());
@@ -84,25 +174,131 @@ public:
     auto strv = e.strv();
     str.reserve(strv.size());
     str.assign(strv.begin(), strv.end());
+    stream.reset();
+    render = nullptr;
+    structured = false;
     return *this;
   }
-  ConcreteEntry(ConcreteEntry&& e) : Entry(e), str(std::move(e.str)) {}
+  ConcreteEntry(ConcreteEntry&& e)
+    : Entry(e), str(std::move(e.str)), stream(std::move(e.stream)),
+      render(e.render), structured(e.structured) {}
   ConcreteEntry& operator=(ConcreteEntry&& e) {
     Entry::operator=(e);
     str = std::move(e.str);
+    stream = std::move(e.stream);
+    render = e.render;
+    structured = e.structured;
     return *this;
   }
   ~ConcreteEntry() override = default;
 
   std::string_view strv() const override {
+    if (render) {
+      _render();
+    }
+    if (stream) {
+      return stream->strv();
+    }
     return std::string_view(str.data(), str.size());
   }
   std::size_t size() const override {
-    return str.size();
+    if (render) {
+      _render();
+    }
+    return stream ? stream->length() : str.size();
+  }
+
+  /// roughly the memory the entry holds while queued, without rendering it:
+  /// itself, its text if that outgrew the inline buffer, and an adopted
+  /// stream's text
+  std::size_t footprint() const {
+    std::size_t n = sizeof(*this);
+    if (str.capacity() > INLINE_BYTES) {
+      n += str.capacity();
+    }
+    if (stream) {
+      n += stream->length();
+    }
+    return n;
+  }
+
+  /// the bytes of text the entry holds, or of a deferred entry's encoded
+  /// arguments, without rendering it
+  std::size_t payload_size() const {
+    return stream ? stream->length() : str.size();
+  }
+
+  /// whether the text is still in the pieces a large message was written
+  /// in; see StackStringBuf
+  bool segmented() const {
+    return stream && !render && stream->segmented();
+  }
+  /// f(std::string_view) for each piece of the text, in order, so that a
+  /// segmented one is copied out once rather than joined first
+  template<typename F>
+  void for_each_segment(F&& f) const {
+    if (segmented()) {
+      stream->for_each_segment(std::forward<F>(f));
+    } else {
+      f(strv());
+    }
+  }
+
+  /// queue an adopted stream for recycling; the entry's text is gone after
+  void release_stream(std::vector<stream_ptr>& recycled) {
+    if (stream) {
+      recycled.emplace_back(std::move(stream));
+    }
+  }
+
+  buffer_t& buffer() {
+    return str;
+  }
+  char* blob() {
+    return str.data();
+  }
+  /// the not yet rendered argument blob, if this entry is deferred
+  render_fn get_render() const {
+    return render;
+  }
+  std::string_view raw() const {
+    return std::string_view(str.data(), str.size());
+  }
+  /// raw() holds a message and fields (see StructuredEntry.h), whether or
+  /// not the text has been rendered yet
+  bool is_structured() const {
+    return structured;
+  }
+  void set_structured() {
+    structured = true;
+  }
+
+  /// the text without rendering (or allocating) anything: a deferred entry
+  /// is rendered into scratch, truncated to fit, and left unrendered
+  std::string_view strv_into(char *scratch, std::size_t len) const {
+    if (!render) {
+      return strv();
+    }
+    FixedStreambuf sb(scratch, len);
+    std::ostream out(&sb);
+    render(str.data(), out);
+    return sb.strv();
   }
 
 private:
-  boost::container::small_vector<char, 1024> str;
+  void _render() const {
+    CachedStackStringStream css;
+    render(str.data(), *css);
+    stream = css.release();
+    render = nullptr;
+  }
+
+  buffer_t str;
+  /// set while the text still lives in the submitter's stream, or once a
+  /// deferred entry has been rendered
+  mutable stream_ptr stream;
+  mutable render_fn render = nullptr;
+  bool structured = false;
 };
 
 }
@@ -0,0 +1,203 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_ENTRYPOOL_H
+#define __CEPH_LOG_ENTRYPOOL_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "common/utils/sharded_counter.h"
+
+namespace ceph {
+namespace logging {
+
+/* Heap blocks for the text of entries that outgrew their inline buffer.
+ *
+ * Such an entry is made on the submitting thread and destroyed on the log
+ * thread, so plain new/delete has the log thread free, block by block,
+ * what every other thread allocated.  Instead blocks come in power of two
+ * sizes from MIN_BLOCK to MAX_BLOCK and each thread keeps a few of each;
+ * what the log thread frees goes back in batches to a shared depot that
+ * the submitting threads' caches refill from, so once the depot holds
+ * enough blocks neither side calls malloc for entry text.  Larger blocks
+ * are plain new/delete.  Same destruction caveats as the stream cache in
+ * StackStringStream.h.
+ */
+class EntryPool {
+public:
+  static constexpr std::size_t MIN_BLOCK = 2 << 10;
+  static constexpr std::size_t MAX_BLOCK = 64 << 10;
+
+  static void* allocate(std::size_t n) {
+    const unsigned c = size_class(n);
+    if (c == CLASSES) {
+      return ::operator new(n);
+    }
+    if (!cache.destructed) {
+      auto& bin = cache.bins[c];
+      if (bin.empty()) {
+	depot.refill(c, bin);
+      }
+      if (!bin.empty()) {
+	void *p = bin.back();
+	bin.pop_back();
+	return p;
+      }
+    }
+    stats.misses.inc();
+    return ::operator new(MIN_BLOCK << c);
+  }
+
+  static void deallocate(void *p, std::size_t n) {
+    const unsigned c = size_class(n);
+    if (c == CLASSES) {
+      ::operator delete(p);
+      return;
+    }
+    if (cache.destructed) {
+      std::vector<void*> one{p};
+      depot.put(c, one);
+      return;
+    }
+    auto& bin = cache.bins[c];
+    bin.push_back(p);
+    if (bin.size() >= MAX_CACHED) {
+      // keep half for this thread to reuse
+      depot.put(c, bin, MAX_CACHED / 2);
+    }
+  }
+
+  /// blocks that had to be allocated because no cached one was left
+  static uint64_t get_misses() {
+    return stats.misses.get();
+  }
+
+private:
+  static constexpr unsigned CLASSES = 6; // MIN_BLOCK << (CLASSES - 1) == MAX_BLOCK
+  static_assert((MIN_BLOCK << (CLASSES - 1)) == MAX_BLOCK);
+  /// blocks a thread keeps per size
+  static constexpr std::size_t MAX_CACHED = 16;
+  /// bytes the depot keeps per size, but at least MAX_CACHED blocks
+  static constexpr std::size_t DEPOT_BYTES = 1 << 20;
+
+  /// CLASSES if n is beyond MAX_BLOCK
+  static unsigned size_class(std::size_t n) {
+    if (n <= MIN_BLOCK) {
+      return 0;
+    }
+    if (n > MAX_BLOCK) {
+      return CLASSES;
+    }
+    return 64 - __builtin_clzll((n - 1) / MIN_BLOCK);
+  }
+
+  struct Bins {
+    std::array<std::vector<void*>, CLASSES> bins;
+  };
+
+  struct Cache : Bins {
+    Cache() {}
+    ~Cache() {
+      for (unsigned c = 0; c < CLASSES; ++c) {
+	depot.put(c, bins[c]);
+      }
+      destructed = true;
+    }
+    bool destructed = false;
+  };
+
+  struct Depot : Bins {
+    Depot() {}
+    ~Depot() {
+      std::lock_guard l(lock);
+      for (auto& bin : bins) {
+	for (void *p : bin) {
+	  ::operator delete(p);
+	}
+	bin.clear();
+      }
+      destructed = true;
+    }
+
+    /// take all but keep of from's blocks; whatever doesn't fit is freed
+    void put(unsigned c, std::vector<void*>& from, std::size_t keep = 0) {
+      const std::size_t max = std::max(DEPOT_BYTES / (MIN_BLOCK << c),
+				       MAX_CACHED);
+      {
+	std::lock_guard l(lock);
+	if (!destructed) {
+	  auto& bin = bins[c];
+	  while (from.size() > keep && bin.size() < max) {
+	    bin.push_back(from.back());
+	    from.pop_back();
+	  }
+	}
+      }
+      while (from.size() > keep) {
+	::operator delete(from.back());
+	from.pop_back();
+      }
+    }
+    void refill(unsigned c, std::vector<void*>& to) {
+      std::lock_guard l(lock);
+      if (destructed) {
+	return;
+      }
+      auto& bin = bins[c];
+      while (!bin.empty() && to.size() < MAX_CACHED / 2) {
+	to.push_back(bin.back());
+	bin.pop_back();
+      }
+    }
+
+    std::mutex lock;
+    bool destructed = false;
+  };
+
+  struct Stats {
+    Stats() {}
+    ceph::sharded_counter misses;
+  };
+
+  inline static thread_local Cache cache;
+  inline static Depot depot;
+  inline static Stats stats;
+};
+
+/// the allocator of ConcreteEntry's text
+template<typename T>
+struct EntryAllocator {
+  using value_type = T;
+
+  EntryAllocator() = default;
+  template<typename U>
+  EntryAllocator(const EntryAllocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(EntryPool::allocate(n * sizeof(T)));
+  }
+  void deallocate(T *p, std::size_t n) {
+    EntryPool::deallocate(p, n * sizeof(T));
+  }
+
+  template<typename U>
+  bool operator==(const EntryAllocator<U>&) const {
+    return true;
+  }
+  template<typename U>
+  bool operator!=(const EntryAllocator<U>&) const {
+    return false;
+  }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,40 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_FMTENTRY_H
+#define __CEPH_LOG_FMTENTRY_H
+
+#include <iterator>
+#include <utility>
+
+#include <fmt/format.h>
+
+#include "Entry.h"
+
+// let fmt write straight into the entry's buffer rather than going through
+// a generic back_inserter one char at a time
+template<typename T, std::size_t N, typename A, typename O>
+struct fmt::is_contiguous<boost::container::small_vector<T, N, A, O>>
+  : std::true_type {};
+
+namespace ceph {
+namespace logging {
+
+/* Format a log line with fmt into a ConcreteEntry, bypassing iostreams.
+ *
+ * The format string is checked at compile time when it comes wrapped in
+ * FMT_STRING(), which is what the ldout_fmt family does.
+ */
+template<typename S, typename... Args>
+ConcreteEntry make_fmt_entry(short prio, short sub, const S& format,
+			     Args&&... args) {
+  ConcreteEntry e(prio, sub);
+  fmt::format_to(std::back_inserter(e.buffer()), format,
+		 std::forward<Args>(args)...);
+  return e;
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,184 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "FormatPipeline.h"
+
+#include "include/ceph_assert.h"
+
+#include <algorithm>
+#include <new>
+
+namespace ceph {
+namespace logging {
+
+FormatPipeline::FormatPipeline(unsigned workers, std::size_t max_pending,
+			       format_fn format, written_fn written)
+  : m_max_pending(std::max<std::size_t>(max_pending, 1)),
+    m_format(std::move(format)),
+    m_written(std::move(written)),
+    m_done(m_max_pending)
+{
+  workers = std::max(workers, 1u);
+  for (unsigned i = 0; i < workers; ++i) {
+    m_workers.push_back(std::make_unique<Worker>(this, i));
+  }
+}
+
+FormatPipeline::~FormatPipeline()
+{
+  for (auto& w : m_workers) {
+    ceph_assert(!w->is_started());
+  }
+}
+
+void FormatPipeline::start()
+{
+  {
+    std::scoped_lock lock(m_lock);
+    m_stop = false;
+  }
+  m_writer.start();
+  for (auto& w : m_workers) {
+    w->create("log_format");
+  }
+}
+
+void FormatPipeline::stop()
+{
+  {
+    std::scoped_lock lock(m_lock);
+    m_stop = true;
+    m_cond_workers.notify_all();
+  }
+  // workers only exit once m_todo is empty, and the last one to finish a
+  // batch hands it (and everything before it) to the writer
+  for (auto& w : m_workers) {
+    if (w->is_started()) {
+      w->join();
+    }
+  }
+  m_writer.stop();
+}
+
+void FormatPipeline::submit(int fd, LogFormat format, bool thread_names,
+			    std::vector<ConcreteEntry>& entries,
+			    LogBuffer& buf)
+{
+  std::unique_lock lock(m_lock);
+  while (m_in_flight >= m_max_pending) {
+    m_cond_submitters.wait(lock);
+  }
+  std::unique_ptr<Batch> b;
+  if (!m_free.empty()) {
+    b = std::move(m_free.back());
+    m_free.pop_back();
+  } else {
+    b = std::make_unique<Batch>();
+  }
+  b->fd = fd;
+  b->format = format;
+  b->thread_names = thread_names;
+  // the caller keeps the (empty) vectors this batch used last time
+  b->entries.swap(entries);
+  b->buf.swap(buf);
+  entries.clear();
+  buf.clear();
+  m_todo.emplace_back(m_next_seq++, std::move(b));
+  ++m_in_flight;
+  m_cond_workers.notify_one();
+}
+
+void FormatPipeline::drain()
+{
+  {
+    std::unique_lock lock(m_lock);
+    while (m_in_flight) {
+      m_cond_submitters.wait(lock);
+    }
+  }
+  m_writer.drain();
+}
+
+void FormatPipeline::prepare_fork()
+{
+  m_lock.lock();
+  m_writer.prepare_fork();
+}
+
+void FormatPipeline::after_fork(bool child)
+{
+  m_writer.after_fork(child);
+  if (child) {
+    // batches in flight are the parent's workers' to write
+    for (auto& [seq, b] : m_todo) {
+      m_free.push_back(std::move(b));
+    }
+    m_todo.clear();
+    for (auto& b : m_done) {
+      if (b) {
+	m_free.push_back(std::move(b));
+      }
+    }
+    m_next_write = m_next_seq;
+    m_in_flight = 0;
+    m_handing_off = false;
+    m_stop = false;
+    new (&m_cond_workers) std::condition_variable;
+    new (&m_cond_submitters) std::condition_variable;
+    for (auto& w : m_workers) {
+      w->forget_after_fork();
+    }
+  }
+  m_lock.unlock();
+}
+
+void FormatPipeline::_work(unsigned id)
+{
+  std::unique_lock lock(m_lock);
+  while (true) {
+    if (m_todo.empty()) {
+      if (m_stop) {
+	break;
+      }
+      m_cond_workers.wait(lock);
+      continue;
+    }
+    auto seq = m_todo.front().first;
+    auto b = std::move(m_todo.front().second);
+    m_todo.pop_front();
+    lock.unlock();
+
+    m_format(*b, id);
+    b->entries.clear();
+
+    lock.lock();
+    m_done[seq % m_max_pending] = std::move(b);
+    if (m_handing_off) {
+      // whoever is feeding the writer picks this one up when it is due
+      continue;
+    }
+    m_handing_off = true;
+    for (;;) {
+      auto& slot = m_done[m_next_write % m_max_pending];
+      if (!slot) {
+	break;
+      }
+      auto next = std::move(slot);
+      ++m_next_write;
+      lock.unlock();
+      if (!next->buf.empty()) {
+	m_written(next->buf.size());
+	m_writer.submit(next->fd, next->buf);
+      }
+      lock.lock();
+      next->buf.clear();
+      m_free.push_back(std::move(next));
+      --m_in_flight;
+      m_cond_submitters.notify_all();
+    }
+    m_handing_off = false;
+  }
+}
+
+}
+}
@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_FORMATPIPELINE_H
+#define __CEPH_LOG_FORMATPIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common/utils/Thread.h"
+#include "AsyncWriter.h"
+#include "BinaryLog.h"
+#include "Entry.h"
+
+namespace ceph {
+namespace logging {
+
+/* Formats batches of log entries on a pool of worker threads and writes
+ * the results in the order the batches were submitted.
+ *
+ * The log thread only drains the queues and decides what goes to the file;
+ * it hands each batch over with submit() and moves on. A worker renders the
+ * batch (and compresses it, if the log does) with the format function, and
+ * the output is passed to a single AsyncWriter strictly in submission
+ * order, whichever worker finishes first. At most max_pending batches are
+ * in flight; submit() waits beyond that.
+ */
+class FormatPipeline {
+public:
+  struct Batch {
+    int fd = -1;
+    LogFormat format = LogFormat::TEXT;
+    bool thread_names = false; ///< log_thread_names
+    std::vector<ConcreteEntry> entries; ///< to be formatted by a worker
+    LogBuffer buf; ///< bytes to write; formatted entries go after
+			   ///< whatever was already there
+  };
+  /// render b.entries into b.buf; called on worker thread `worker`
+  using format_fn = std::function<void(Batch& b, unsigned worker)>;
+  /// called in order with the size of each batch handed to the writer
+  using written_fn = std::function<void(std::size_t bytes)>;
+
+  FormatPipeline(unsigned workers, std::size_t max_pending,
+		 format_fn format, written_fn written);
+  FormatPipeline(const FormatPipeline&) = delete;
+  FormatPipeline& operator=(const FormatPipeline&) = delete;
+  ~FormatPipeline();
+
+  void start();
+  /// write out everything queued, then exit the threads
+  void stop();
+
+  /// queue entries and buf for fd; both are swapped for empty vectors
+  void submit(int fd, LogFormat format, bool thread_names,
+	      std::vector<ConcreteEntry>& entries, LogBuffer& buf);
+
+  /// wait until everything submitted so far has been written
+  void drain();
+
+  /// hold the locks across a fork(); the child comes out of after_fork()
+  /// with no worker started and nothing in flight
+  void prepare_fork();
+  void after_fork(bool child);
+
+  unsigned get_workers() const {
+    return m_workers.size();
+  }
+
+private:
+  class Worker final : public Thread {
+  public:
+    Worker(FormatPipeline *p, unsigned id) : m_pipeline(p), m_id(id) {}
+  private:
+    void *entry() override {
+      m_pipeline->_work(m_id);
+      return nullptr;
+    }
+    FormatPipeline *m_pipeline;
+    unsigned m_id;
+  };
+
+  void _work(unsigned id);
+
+  const std::size_t m_max_pending;
+  format_fn m_format;
+  written_fn m_written;
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  AsyncWriter m_writer;
+
+  std::mutex m_lock;
+  std::condition_variable m_cond_workers;
+  std::condition_variable m_cond_submitters;
+  std::deque<std::pair<uint64_t, std::unique_ptr<Batch>>> m_todo;
+  /// formatted batches waiting for their turn, indexed by seq % max_pending
+  std::vector<std::unique_ptr<Batch>> m_done;
+  std::vector<std::unique_ptr<Batch>> m_free; ///< for reuse
+  uint64_t m_next_seq = 0;    ///< assigned to the next submitted batch
+  uint64_t m_next_write = 0;  ///< the batch the writer needs next
+  std::size_t m_in_flight = 0;
+  bool m_handing_off = false; ///< a worker is feeding m_writer
+  bool m_stop = false;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,107 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "HugePages.h"
+
+#include <sys/mman.h>
+
+namespace ceph {
+namespace logging {
+
+static std::atomic<HugePages> huge_pages_mode{HugePages::NONE};
+
+void set_huge_pages(HugePages mode)
+{
+  huge_pages_mode.store(mode, std::memory_order_relaxed);
+}
+
+HugePages get_huge_pages()
+{
+  return huge_pages_mode.load(std::memory_order_relaxed);
+}
+
+const char *huge_pages_name(HugePages mode)
+{
+  switch (mode) {
+  case HugePages::THP: return "thp";
+  case HugePages::HUGETLB: return "hugetlb";
+  default: return "none";
+  }
+}
+
+/// whole huge pages, so that the mapping can always be freed the same way
+static std::size_t huge_round(std::size_t n)
+{
+  return (n + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+void *huge_alloc(std::size_t n, HugePages *backing)
+{
+  const std::size_t len = huge_round(n);
+  const HugePages mode = get_huge_pages();
+  void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (mode == HugePages::HUGETLB) {
+    p = ::mmap(nullptr, len, PROT_READ|PROT_WRITE,
+	       MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      if (backing) {
+	*backing = HugePages::HUGETLB;
+      }
+      return p;
+    }
+    // the pool is empty or was never reserved
+  }
+#endif
+  p = ::mmap(nullptr, len, PROT_READ|PROT_WRITE,
+	     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+  HugePages got = HugePages::NONE;
+#ifdef MADV_HUGEPAGE
+  // fails where THP is disabled; the pages are then plain ones
+  if (mode != HugePages::NONE && ::madvise(p, len, MADV_HUGEPAGE) == 0) {
+    got = HugePages::THP;
+  }
+#endif
+  if (backing) {
+    *backing = got;
+  }
+  return p;
+}
+
+void huge_free(void *p, std::size_t n)
+{
+  if (p) {
+    ::munmap(p, huge_round(n));
+  }
+}
+
+HugeBuffer::HugeBuffer(std::size_t n)
+  : m_len(n)
+{
+  if (n >= HUGE_PAGE_SIZE && get_huge_pages() != HugePages::NONE) {
+    m_data = static_cast<char*>(huge_alloc(n, &m_backing));
+    m_mapped = m_data != nullptr;
+  }
+  if (!m_data) {
+    m_data = new char[n];
+  }
+}
+
+void HugeBuffer::reset()
+{
+  if (m_mapped) {
+    huge_free(m_data, m_len);
+  } else {
+    delete[] m_data;
+  }
+  m_data = nullptr;
+  m_len = 0;
+  m_backing = HugePages::NONE;
+  m_mapped = false;
+}
+
+}
+}
@@ -0,0 +1,127 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_HUGEPAGES_H
+#define __CEPH_LOG_HUGEPAGES_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace ceph {
+namespace logging {
+
+/* Huge page backing for the log's large buffers (log_huge_pages): the
+ * recent ring and any LogBuffer that grows to HUGE_PAGE_SIZE or more.
+ *
+ * Such buffers are mapped anonymously in whole huge pages and, with THP,
+ * madvise(MADV_HUGEPAGE)d; with HUGETLB they are taken from the reserved
+ * hugetlbfs pool if it has room, or else fall back to THP and then to
+ * plain pages.  Smaller buffers are left to the heap.  The setting is
+ * process wide and applies to buffers allocated after it changes.
+ */
+enum class HugePages {
+  NONE,
+  THP,
+  HUGETLB,
+};
+
+constexpr std::size_t HUGE_PAGE_SIZE = 2 << 20;
+
+void set_huge_pages(HugePages mode);
+HugePages get_huge_pages();
+const char *huge_pages_name(HugePages mode);
+
+/// at least n bytes mapped with the current mode, or nullptr; *backing is
+/// what they got.  Free with huge_free(p, n).
+void *huge_alloc(std::size_t n, HugePages *backing = nullptr);
+void huge_free(void *p, std::size_t n);
+
+/// an uninitialized buffer of n bytes, from the heap or, n permitting,
+/// from huge_alloc()
+class HugeBuffer {
+public:
+  HugeBuffer() = default;
+  explicit HugeBuffer(std::size_t n);
+  HugeBuffer(const HugeBuffer&) = delete;
+  HugeBuffer& operator=(const HugeBuffer&) = delete;
+  HugeBuffer(HugeBuffer&& o) noexcept
+    : m_data(std::exchange(o.m_data, nullptr)),
+      m_len(std::exchange(o.m_len, 0)),
+      m_backing(o.m_backing), m_mapped(std::exchange(o.m_mapped, false)) {}
+  HugeBuffer& operator=(HugeBuffer&& o) noexcept {
+    if (this != &o) {
+      reset();
+      m_data = std::exchange(o.m_data, nullptr);
+      m_len = std::exchange(o.m_len, 0);
+      m_backing = o.m_backing;
+      m_mapped = std::exchange(o.m_mapped, false);
+    }
+    return *this;
+  }
+  ~HugeBuffer() {
+    reset();
+  }
+
+  void reset();
+
+  char *get() const {
+    return m_data;
+  }
+  explicit operator bool() const {
+    return m_data != nullptr;
+  }
+  HugePages backing() const {
+    return m_backing;
+  }
+
+private:
+  char *m_data = nullptr;
+  std::size_t m_len = 0;
+  HugePages m_backing = HugePages::NONE;
+  bool m_mapped = false;
+};
+
+/// LogBuffer's allocator: huge_alloc() from HUGE_PAGE_SIZE up
+template<typename T>
+struct HugePageAllocator {
+  using value_type = T;
+
+  HugePageAllocator() = default;
+  template<typename U>
+  HugePageAllocator(const HugePageAllocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    const std::size_t len = n * sizeof(T);
+    if (len >= HUGE_PAGE_SIZE) {
+      if (void *p = huge_alloc(len)) {
+	return static_cast<T*>(p);
+      }
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(::operator new(len));
+  }
+  void deallocate(T *p, std::size_t n) {
+    const std::size_t len = n * sizeof(T);
+    if (len >= HUGE_PAGE_SIZE) {
+      huge_free(p, len);
+    } else {
+      ::operator delete(p);
+    }
+  }
+
+  template<typename U>
+  bool operator==(const HugePageAllocator<U>&) const {
+    return true;
+  }
+  template<typename U>
+  bool operator!=(const HugePageAllocator<U>&) const {
+    return false;
+  }
+};
+
+}
+}
+
+#endif
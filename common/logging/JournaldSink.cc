@@ -0,0 +1,266 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "JournaldSink.h"
+
+#include "include/compat.h"
+
+#include "SubsystemMap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace ceph {
+namespace logging {
+
+static constexpr std::size_t MAX_BATCH = 64;
+static constexpr const char *JOURNAL_SOCKET = "/run/systemd/journal/socket";
+
+JournaldSink::JournaldSink(unsigned id, const SubsystemMap *subs)
+  : LogSink("log_journald", id), m_subs(subs)
+{
+#ifdef __GLIBC__
+  m_ident = program_invocation_short_name;
+#else
+  m_ident = getprogname();
+#endif
+}
+
+JournaldSink::~JournaldSink()
+{
+  _close();
+}
+
+void JournaldSink::set_entity(std::string_view entity)
+{
+  std::scoped_lock lock(m_config_lock);
+  m_entity = entity;
+}
+
+void JournaldSink::write(const SinkBatch& b)
+{
+  const uint64_t lines = count_lines(b);
+  if (m_fd < 0 && !_connect()) {
+    count_dropped(lines);
+    return;
+  }
+  std::string entity;
+  {
+    std::scoped_lock lock(m_config_lock);
+    entity = m_entity;
+  }
+
+  m_out.clear();
+  m_records.clear();
+  const auto mask = get_mask();
+  for (auto& l : b.lines) {
+    if (!(l.sinks & mask)) {
+      continue;
+    }
+    const std::size_t start = m_out.size();
+    _encode(b, l);
+    if (!entity.empty()) {
+      _append_field("CEPH_ENTITY", entity);
+    }
+    m_records.emplace_back(start, m_out.size() - start);
+  }
+
+  std::size_t sent = _send();
+  if (sent < m_records.size()) {
+    count_dropped(m_records.size() - sent);
+  }
+}
+
+bool JournaldSink::_connect()
+{
+  if (ceph::coarse_mono_clock::now() < m_retry_at) {
+    return false;
+  }
+  // retry at most once a second while journald is down
+  m_retry_at = ceph::coarse_mono_clock::now() + std::chrono::seconds(1);
+  m_fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (m_fd < 0) {
+    return false;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, JOURNAL_SOCKET, sizeof(addr.sun_path) - 1);
+  if (::connect(m_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    _close();
+    return false;
+  }
+  return true;
+}
+
+void JournaldSink::_close()
+{
+  if (m_fd >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+    m_fd = -1;
+  }
+}
+
+/// KEY=value, or for a value with a newline KEY, a little endian 64-bit
+/// length and the value
+void JournaldSink::_append_field(std::string_view key, std::string_view value)
+{
+  m_out.insert(m_out.end(), key.begin(), key.end());
+  if (value.find('\n') == std::string_view::npos) {
+    m_out.push_back('=');
+  } else {
+    m_out.push_back('\n');
+    uint64_t len = value.size();
+    for (int i = 0; i < 8; ++i, len >>= 8) {
+      m_out.push_back(static_cast<char>(len & 0xff));
+    }
+  }
+  m_out.insert(m_out.end(), value.begin(), value.end());
+  m_out.push_back('\n');
+}
+
+/// ceph priorities (lower is more important) to syslog severities
+static int journald_priority(short prio)
+{
+  if (prio < 0) {
+    return 3; // error
+  } else if (prio == 0) {
+    return 5; // notice
+  } else if (prio < 5) {
+    return 6; // info
+  }
+  return 7; // debug
+}
+
+void JournaldSink::_encode(const SinkBatch& b, const SinkBatch::Line& l)
+{
+  auto tv = log_clock::to_timeval(l.stamp);
+  char buf[64];
+
+  _append_field("MESSAGE", b.get_body(l));
+  _append_field("PRIORITY", std::string_view(
+    buf, snprintf(buf, sizeof(buf), "%d", journald_priority(l.prio))));
+  _append_field("SYSLOG_IDENTIFIER", m_ident);
+  _append_field("CEPH_PRIO", std::string_view(
+    buf, snprintf(buf, sizeof(buf), "%d", l.prio)));
+  _append_field("CEPH_SUBSYS", m_subs->get_name(l.subsys));
+  // when it was logged; journald stamps it with when it was received
+  _append_field("CEPH_TIMESTAMP", std::string_view(
+    buf, snprintf(buf, sizeof(buf), "%ld.%06ld",
+		  (long)tv.tv_sec, (long)tv.tv_usec)));
+  auto name = m_thread_names.get(l.thread);
+  if (name.empty()) {
+    name = std::string_view(
+      buf, snprintf(buf, sizeof(buf), "%lx", (unsigned long)l.thread));
+  }
+  _append_field("THREAD", name);
+}
+
+/// returns the number of records sent
+std::size_t JournaldSink::_send()
+{
+  struct iovec iov[MAX_BATCH];
+  struct mmsghdr msgs[MAX_BATCH];
+  std::size_t sent = 0;
+  while (sent < m_records.size()) {
+    if (m_records[sent].second > MAX_DATAGRAM) {
+      if (!_send_memfd(m_records[sent].first, m_records[sent].second)) {
+	break;
+      }
+      ++sent;
+      continue;
+    }
+    // the datagrams up to the next large record
+    std::size_t n = 0;
+    while (n < MAX_BATCH && sent + n < m_records.size() &&
+	   m_records[sent + n].second <= MAX_DATAGRAM) {
+      ++n;
+    }
+    memset(msgs, 0, sizeof(msgs[0]) * n);
+    for (std::size_t i = 0; i < n; ++i) {
+      iov[i].iov_base = m_out.data() + m_records[sent + i].first;
+      iov[i].iov_len = m_records[sent + i].second;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int r = sendmmsg(m_fd, msgs, n, MSG_NOSIGNAL);
+    if (r < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      // more than the socket's send buffer: the memfd takes any size
+      if (errno == EMSGSIZE &&
+	  _send_memfd(m_records[sent].first, m_records[sent].second)) {
+	++sent;
+	continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+	// journald was restarted or is gone; connect again later
+	_close();
+      }
+      break;
+    }
+    sent += r;
+  }
+  return sent;
+}
+
+/// pass the record at off in a sealed memfd, which journald insists on
+bool JournaldSink::_send_memfd(std::size_t off, std::size_t len)
+{
+  int fd = memfd_create("ceph-log", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    return false;
+  }
+  const char *p = m_out.data() + off;
+  std::size_t left = len;
+  while (left > 0) {
+    ssize_t r = ::write(fd, p, left);
+    if (r < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      break;
+    }
+    p += r;
+    left -= r;
+  }
+  bool ok = left == 0 &&
+    fcntl(fd, F_ADD_SEALS,
+	  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0;
+  if (ok) {
+    union {
+      struct cmsghdr hdr;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    ssize_t r;
+    do {
+      r = ::sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+    } while (r < 0 && errno == EINTR);
+    ok = r >= 0;
+  }
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  return ok;
+}
+
+}
+}
@@ -0,0 +1,70 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_JOURNALDSINK_H
+#define __CEPH_LOG_JOURNALDSINK_H
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/utils/ceph_time.h"
+#include "LogSink.h"
+#include "ThreadNames.h"
+
+namespace ceph {
+namespace logging {
+
+class SubsystemMap;
+
+/* Sends log lines to systemd-journald over its native protocol.
+ *
+ * Each line becomes one datagram to /run/systemd/journal/socket holding
+ * the message and its metadata as journal fields (PRIORITY, CEPH_SUBSYS,
+ * CEPH_PRIO, THREAD, CEPH_ENTITY, ...), so journalctl can filter on them
+ * without parsing the text.  The datagrams of a batch go out with as few
+ * sendmmsg() calls as possible; a record too large for a datagram is
+ * written to a sealed memfd and the descriptor is passed instead, as
+ * sd_journal_send() does.  If journald can't be reached the lines are
+ * counted as dropped.
+ */
+class JournaldSink final : public LogSink {
+public:
+  JournaldSink(unsigned id, const SubsystemMap *subs);
+  ~JournaldSink() override;
+
+  /// reported as CEPH_ENTITY, e.g. "osd.3"
+  void set_entity(std::string_view entity);
+
+private:
+  /// records larger than this skip the datagram and go in a memfd
+  static constexpr std::size_t MAX_DATAGRAM = 64 << 10;
+
+  void write(const SinkBatch& b) override;
+
+  bool _connect();
+  void _close();
+  void _append_field(std::string_view key, std::string_view value);
+  void _encode(const SinkBatch& b, const SinkBatch::Line& l);
+  std::size_t _send();
+  bool _send_memfd(std::size_t off, std::size_t len);
+
+  const SubsystemMap *m_subs;
+  std::string m_ident; ///< SYSLOG_IDENTIFIER
+
+  std::mutex m_config_lock;
+  std::string m_entity;
+
+  // only touched by the sink's thread
+  int m_fd = -1;
+  ceph::coarse_mono_time m_retry_at; ///< don't reconnect before this
+  ThreadNameCache m_thread_names;
+  std::vector<char> m_out;           ///< encoded records
+  std::vector<std::pair<std::size_t, std::size_t>> m_records; ///< off, len
+};
+
+}
+}
+
+#endif
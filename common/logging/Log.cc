@@ -4,31 +4,264 @@
 #include "Log.h"
 
 #include "common/errno.h"
+#include "common/perf_counters.h"
 #include "common/safe_io.h"
-#include "common/Graylog.h"
+#include "common/str_escape.h"
+#include "common/strtol.h"
 #include "common/valgrind.h"
 
 #include "include/ceph_assert.h"
 #include "include/compat.h"
 #include "include/on_exit.h"
 
+#include "DoutSite.h"
 #include "Entry.h"
 #include "LogClock.h"
+#include "LogProbes.h"
+#include "StructuredEntry.h"
 #include "SubsystemMap.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <inttypes.h>
+#include <sched.h>
 #include <syslog.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <type_traits>
 
-#define MAX_LOG_BUF 65536
+/// what _drop_page_cache() waits for to be written before it starts writeback
+#define WRITEBACK_CHUNK (1 << 20)
 
 namespace ceph {
 namespace logging {
 
 static OnExitManager exit_callbacks;
 
+static std::atomic<uint64_t> next_log_id{1};
+
+namespace {
+// The submission rings this thread owns, one per Log it has logged to.
+// Logs are keyed by id rather than address so that a Log allocated at the
+// address of a destroyed one never picks up a stale ring.
+struct ThreadRings {
+  std::vector<std::pair<uint64_t, std::shared_ptr<SubmitRing>>> rings;
+  std::vector<std::pair<uint64_t, std::shared_ptr<ThreadRecentRing>>> recent;
+
+  ~ThreadRings() {
+    for (auto& [id, ring] : rings) {
+      ring->detach();
+    }
+    for (auto& [id, ring] : recent) {
+      ring->detached = true;
+    }
+  }
+};
+thread_local ThreadRings thread_rings;
+
+// The Log whose m_queue_mutex (m_flush_mutex) this thread holds, for
+// is_inside_log_lock().  Per thread, so taking the locks writes nothing
+// other threads read.
+thread_local const Log *queue_mutex_holder = nullptr;
+thread_local const Log *flush_mutex_holder = nullptr;
+
+/// marks this thread as the holder of one of log's locks in its scope
+class lock_holder {
+  const Log *&m_holder;
+  const Log *m_prev;
+public:
+  lock_holder(const Log *&holder, const Log *log)
+    : m_holder(holder), m_prev(holder) {
+    holder = log;
+  }
+  ~lock_holder() {
+    m_holder = m_prev;
+  }
+};
+
+/// set on the SharedFlusher's thread
+thread_local bool on_shared_flusher = false;
+}
+
+/* One thread flushing every Log started with set_shared_flusher(), for
+ * processes with many CephContexts that would otherwise each have an
+ * idle log thread.  Each Log keeps its own queues, file and levels; the
+ * flusher makes a pass over them all whenever one wakes it, and sleeps
+ * until the earliest time one of them has asked to be looked at again.
+ */
+class SharedFlusher : private Thread {
+public:
+  /// leaked: Logs in static objects may still be stopped after exit()
+  static SharedFlusher& get() {
+    static SharedFlusher *f = new SharedFlusher;
+    return *f;
+  }
+
+  void add(Log *log) {
+    std::scoped_lock l(m_lock);
+    m_logs.push_back(log);
+    if (!m_started) {
+      create("log");
+      m_started = true;
+    }
+    m_woken = true;
+    m_cond.notify_one();
+  }
+
+  /// once this returns the flusher no longer touches log
+  void remove(Log *log) {
+    {
+      std::scoped_lock l(m_lock);
+      m_logs.erase(std::remove(m_logs.begin(), m_logs.end(), log),
+		   m_logs.end());
+    }
+    // a pass takes its list under m_pass_lock, so any pass that still
+    // has log in it is over once we get it
+    std::scoped_lock p(m_pass_lock);
+  }
+
+  void wake() {
+    std::scoped_lock l(m_lock);
+    m_woken = true;
+    m_cond.notify_one();
+  }
+
+  /// hold the locks across a fork, with prepare_logs() taking the Logs'
+  /// in between: m_pass_lock before them, as a pass does, and m_lock
+  /// after, as a Log waking the flusher under m_queue_mutex does
+  template <typename F>
+  void prepare_fork(F&& prepare_logs) {
+    // not from a pass, which holds m_pass_lock
+    m_fork_held = !on_shared_flusher;
+    if (m_fork_held) {
+      m_pass_lock.lock();
+    }
+    prepare_logs();
+    if (m_fork_held) {
+      m_lock.lock();
+    }
+  }
+  void after_fork(bool child) {
+    if (!m_fork_held) {
+      return;
+    }
+    if (child) {
+      // the thread is the parent's; the next add() starts one here
+      m_logs.clear();
+      m_woken = false;
+      m_started = false;
+      forget_after_fork();
+      // made anew over the old one, which would wait forever in its
+      // destructor for the parent's waiter
+      new (&m_cond) std::condition_variable;
+    }
+    m_lock.unlock();
+    m_pass_lock.unlock();
+  }
+
+private:
+  void *entry() override {
+    on_shared_flusher = true;
+    std::vector<Log*> logs;
+    for (;;) {
+      auto due = std::chrono::steady_clock::time_point::max();
+      bool flushed = false;
+      {
+	std::scoped_lock p(m_pass_lock);
+	{
+	  std::scoped_lock l(m_lock);
+	  logs = m_logs;
+	  m_woken = false;
+	}
+	for (auto log : logs) {
+	  flushed |= log->_shared_flush(due);
+	}
+      }
+      std::unique_lock l(m_lock);
+      if (flushed || m_woken) {
+	continue;
+      }
+      if (due == due.max()) {
+	m_cond.wait(l);
+      } else {
+	m_cond.wait_until(l, due);
+      }
+    }
+    return nullptr;
+  }
+
+  std::mutex m_pass_lock; ///< held for a pass; nests outside m_lock
+  std::mutex m_lock;
+  std::condition_variable m_cond;
+  std::vector<Log*> m_logs;
+  bool m_woken = false;
+  bool m_started = false;
+  bool m_fork_held = false; ///< prepare_fork() took the locks
+};
+
+namespace {
+
+// Every Log in the process, for the pthread_atfork() handlers, which are
+// installed along with the first.  Held from prepare to the end of the
+// fork, so that no Log comes or goes in between.
+std::mutex fork_lock;
+std::vector<Log*> fork_logs;
+
+void fork_prepare()
+{
+  fork_lock.lock();
+  SharedFlusher::get().prepare_fork([] {
+    for (auto log : fork_logs) {
+      log->prepare_fork();
+    }
+  });
+}
+
+void fork_after(bool child)
+{
+  SharedFlusher::get().after_fork(child);
+  for (auto log : fork_logs) {
+    log->after_fork(child);
+  }
+  fork_lock.unlock();
+}
+
+void add_fork_log(Log *log)
+{
+  static std::once_flag installed;
+  std::call_once(installed, [] {
+    pthread_atfork(fork_prepare, [] { fork_after(false); },
+		   [] { fork_after(true); });
+  });
+  std::scoped_lock l(fork_lock);
+  fork_logs.push_back(log);
+}
+
+void remove_fork_log(Log *log)
+{
+  std::scoped_lock l(fork_lock);
+  fork_logs.erase(std::remove(fork_logs.begin(), fork_logs.end(), log),
+		  fork_logs.end());
+}
+
+/// recent rings of exited threads kept around for the next dump
+constexpr std::size_t MAX_DETACHED_RECENT = 16;
+/// per-thread rings a crash dump can merge; it has no heap to grow into
+constexpr std::size_t MAX_RECENT_SOURCES = 64;
+/// rings of set_subsys_recent()
+constexpr std::size_t MAX_SUBSYS_RECENT = 16;
+/// the traffic trace is written once this much of it is buffered
+constexpr std::size_t TRACE_WRITE_SIZE = 64 << 10;
+}
+
 static void log_on_exit(void *p)
 {
   Log *l = *(Log **)p;
@@ -40,9 +273,22 @@ static void log_on_exit(void *p)
 Log::Log(const SubsystemMap *s)
   : m_indirect_this(nullptr),
     m_subs(s),
-    m_recent(DEFAULT_MAX_RECENT)
+    m_rate_limiter(SubsystemMap::get_num()),
+    m_recent(DEFAULT_MAX_RECENT, DEFAULT_MAX_RECENT_BYTES),
+    m_id(next_log_id++),
+    m_network_sink(2, s),
+    m_journald_sink(3, s)
 {
-  m_log_buf.reserve(MAX_LOG_BUF);
+  m_log_buf.reserve(m_log_buf_size);
+  for (auto& cap : m_level_caps) {
+    cap.store(UINT8_MAX, std::memory_order_relaxed);
+  }
+  // Shards are cheap (a cache line each) and allocating them all now means
+  // producers never race with a resize.
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  m_num_cpus = cpus > 0 ? cpus : 1;
+  m_shards = std::make_unique<QueueShard[]>(m_num_cpus);
+  add_fork_log(this);
 }
 
 Log::~Log()
@@ -50,22 +296,64 @@ Log::~Log()
   if (m_indirect_this) {
     *m_indirect_this = nullptr;
   }
+  remove_fork_log(this);
 
   ceph_assert(!is_started());
+#ifdef CEPH_LOG_LOCKFREE
+  ConcreteEntry *e;
+  while (m_lockfree.pop(e)) {
+    delete e;
+  }
+#endif
+  _maybe_sync(true);
+  _trim_preallocation();
+  m_mmap.close();
   if (m_fd >= 0)
     VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+  if (m_index_fd >= 0) {
+    _write_index(m_index_base + m_log_buf.size());
+    VOID_TEMP_FAILURE_RETRY(::close(m_index_fd));
+  }
+  _close_trace();
+  for (auto& f : m_subsys_files) {
+    if (f.fd >= 0)
+      VOID_TEMP_FAILURE_RETRY(::close(f.fd));
+  }
 }
 
 
 ///
 void Log::set_coarse_timestamps(bool coarse) {
   std::scoped_lock lock(m_flush_mutex);
+  m_coarse_timestamps = coarse;
+  if (m_tsc_timestamps)
+    return;
   if (coarse)
     Entry::clock().coarsen();
   else
     Entry::clock().refine();
 }
 
+int Log::set_tsc_timestamps(bool tsc) {
+  std::scoped_lock lock(m_flush_mutex);
+  int r = 0;
+  if (tsc) {
+    r = Entry::clock().use_tsc();
+    if (r < 0) {
+      std::cerr << "log_clock: no invariant cycle counter on this cpu, "
+		<< "using the system clock" << std::endl;
+    }
+  }
+  m_tsc_timestamps = tsc && r == 0;
+  if (!m_tsc_timestamps) {
+    if (m_coarse_timestamps)
+      Entry::clock().coarsen();
+    else
+      Entry::clock().refine();
+  }
+  return r;
+}
+
 void Log::set_flush_on_exit()
 {
   std::scoped_lock lock(m_flush_mutex);
@@ -83,134 +371,3121 @@ void Log::set_max_new(std::size_t n)
 {
   std::scoped_lock lock(m_queue_mutex);
   m_max_new = n;
+  _update_shard_max_new();
+#ifdef CEPH_LOG_LOCKFREE
+  m_lockfree_max.store(n, std::memory_order_relaxed);
+  if (n > m_lockfree_capacity) {
+    // nodes are never given back, so the capacity only grows
+    m_lockfree.reserve(n - m_lockfree_capacity);
+    m_lockfree_capacity = n;
+  }
+#endif
+}
+
+void Log::set_max_new_bytes(std::size_t n)
+{
+  std::scoped_lock lock(m_queue_mutex);
+  m_max_new_bytes = n ? n : std::numeric_limits<std::size_t>::max();
+  _update_shard_max_new();
+#ifdef CEPH_LOG_LOCKFREE
+  m_lockfree_max_bytes.store(m_max_new_bytes, std::memory_order_relaxed);
+#endif
+  m_cond_loggers.notify_all(); // blocked submitters re-check the limit
+}
+
+void Log::set_error_lane(bool lane, bool sync)
+{
+  m_error_lane.store(lane, std::memory_order_relaxed);
+  m_error_sync.store(lane && sync, std::memory_order_relaxed);
+}
+
+void Log::set_overflow_policy(OverflowPolicy p)
+{
+  std::scoped_lock lock(m_queue_mutex);
+  m_overflow_policy = p;
+  _index_new();
+  m_cond_loggers.notify_all(); // blocked submitters re-check the policy
+}
+
+void Log::set_flush_batch(std::size_t batch,
+			  std::chrono::microseconds max_delay)
+{
+  std::scoped_lock lock(m_queue_mutex);
+  // without a delay bound a partial batch could sit in m_new forever
+  m_flush_batch = max_delay.count() > 0 ? std::max<std::size_t>(batch, 1) : 1;
+  m_flush_max_delay = max_delay;
+  _notify_flusher(); // pick up the new delay
+}
+
+void Log::set_stop_timeout(std::chrono::milliseconds timeout)
+{
+  std::scoped_lock lock(m_queue_mutex);
+  m_stop_timeout = timeout;
 }
 
 void Log::set_max_recent(std::size_t n)
 {
   std::scoped_lock lock(m_flush_mutex);
-  m_max_recent = n;
+  m_max_recent.store(n, std::memory_order_relaxed);
+  m_recent.set_max_entries(n);
+  for (auto& r : m_subsys_recent) {
+    r->set_max_entries(n);
+  }
+  std::scoped_lock rlock(m_rings_mutex);
+  for (auto& t : m_thread_recent) {
+    std::scoped_lock tlock(t->lock);
+    t->ring.set_max_entries(n);
+  }
 }
 
-void Log::set_log_file(std::string_view fn)
+void Log::set_max_recent_bytes(std::size_t n)
 {
   std::scoped_lock lock(m_flush_mutex);
-  m_log_file = fn;
+  m_recent.set_max_bytes(n);
 }
 
-void Log::set_log_stderr_prefix(std::string_view p)
+int Log::set_subsys_recent(std::string_view spec)
+{
+  auto trim = [](std::string_view s) {
+    const auto b = s.find_first_not_of(" \t");
+    if (b == std::string_view::npos) {
+      return std::string_view();
+    }
+    return s.substr(b, s.find_last_not_of(" \t") - b + 1);
+  };
+  std::vector<std::size_t> budgets;
+  std::vector<int> route;
+  while (!spec.empty()) {
+    auto item = spec.substr(0, spec.find(';'));
+    spec.remove_prefix(std::min(spec.size(), item.size() + 1));
+    if (trim(item).empty()) {
+      continue;
+    }
+    const auto eq = item.find('=');
+    if (eq == std::string_view::npos) {
+      return -EINVAL;
+    }
+    std::string err;
+    const auto bytes = strict_iec_cast<uint64_t>(trim(item.substr(eq + 1)),
+						 &err);
+    if (!err.empty() || bytes == 0) {
+      return -EINVAL;
+    }
+    auto names = item.substr(0, eq);
+    while (!names.empty()) {
+      auto name = names.substr(0, names.find(','));
+      names.remove_prefix(std::min(names.size(), name.size() + 1));
+      name = trim(name);
+      unsigned sub = 0;
+      while (sub < m_subs->get_num() && name != m_subs->get_name(sub)) {
+	++sub;
+      }
+      if (sub == m_subs->get_num()) {
+	return -EINVAL;
+      }
+      if (route.empty()) {
+	route.assign(m_subs->get_num(), -1);
+      }
+      route[sub] = budgets.size();
+    }
+    budgets.push_back(bytes);
+  }
+  if (budgets.size() > MAX_SUBSYS_RECENT) {
+    return -EINVAL;
+  }
+
+  std::scoped_lock lock(m_flush_mutex);
+  m_subsys_recent.clear();
+  for (auto bytes : budgets) {
+    m_subsys_recent.push_back(
+      std::make_unique<RecentRing>(
+	m_max_recent.load(std::memory_order_relaxed), bytes));
+  }
+  m_subsys_recent_route = std::move(route);
+  return 0;
+}
+
+void Log::set_thread_recent_bytes(std::size_t n)
+{
+  // rings that already exist keep their entries and budget for the dump
+  m_thread_recent_bytes.store(n, std::memory_order_relaxed);
+}
+
+void Log::set_recent_file(const std::string& path)
 {
   std::scoped_lock lock(m_flush_mutex);
-  m_log_stderr_prefix = p;
+  int r = m_recent.set_file(path);
+  if (r < 0) {
+    std::cerr << "failed to map " << path << " for recent log entries: "
+	      << cpp_strerror(r) << ", keeping them in memory" << std::endl;
+  }
 }
 
-void Log::reopen_log_file()
+void Log::set_huge_pages(HugePages mode)
+{
+  ceph::logging::set_huge_pages(mode);
+}
+
+void Log::set_shm_ring(const std::string& path, std::size_t size)
 {
   std::scoped_lock lock(m_flush_mutex);
-  if (!is_started()) {
-    return;
+  int r = m_shm_ring.open(path, size);
+  if (r < 0) {
+    std::cerr << "failed to map " << path << " for the log agent: "
+	      << cpp_strerror(r) << std::endl;
   }
-  m_flush_mutex_holder = pthread_self();
-  if (m_fd >= 0)
-    VOID_TEMP_FAILURE_RETRY(::close(m_fd));
-  if (m_log_file.length()) {
-    m_fd = ::open(m_log_file.c_str(), O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0644);
-    if (m_fd >= 0 && (m_uid || m_gid)) {
-      if (::fchown(m_fd, m_uid, m_gid) < 0) {
-	int e = errno;
-	std::cerr << "failed to chown " << m_log_file << ": " << cpp_strerror(e)
-	     << std::endl;
+}
+
+void Log::set_thread_ring_size(std::size_t n)
+{
+  // rings that already exist keep their capacity; they are drained as usual
+  // even after the feature is turned off.
+  m_thread_ring_size.store(n, std::memory_order_relaxed);
+}
+
+void Log::set_queue_shards(std::size_t n)
+{
+  // Entries left in shards beyond the new count are still drained; only
+  // the selection of shards for new entries changes.
+  std::scoped_lock lock(m_queue_mutex);
+  m_queue_shards.store(std::min(n, m_num_cpus), std::memory_order_relaxed);
+  _update_shard_max_new();
+}
+
+/// split m_max_new and m_max_new_bytes between the shards in use
+void Log::_update_shard_max_new()
+{
+  const auto shards = std::max<std::size_t>(
+    m_queue_shards.load(std::memory_order_relaxed), 1);
+  m_shard_max_new.store(std::max<std::size_t>(m_max_new / shards, 1),
+			std::memory_order_relaxed);
+  m_shard_max_new_bytes.store(std::max<std::size_t>(m_max_new_bytes / shards, 1),
+			      std::memory_order_relaxed);
+}
+
+void Log::set_reorder_window(std::chrono::microseconds window,
+			     std::size_t max_bytes)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_reorder_window = window;
+  m_reorder_max_bytes = max_bytes;
+  // anything held is released by the next flush
+}
+
+void Log::set_log_file(std::string_view fn)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_log_file = fn;
+}
+
+int Log::set_subsys_files(std::string_view spec)
+{
+  auto trim = [](std::string_view s) {
+    const auto b = s.find_first_not_of(" \t");
+    if (b == std::string_view::npos) {
+      return std::string_view();
+    }
+    return s.substr(b, s.find_last_not_of(" \t") - b + 1);
+  };
+  std::vector<SubsysFile> files;
+  std::vector<int> route;
+  while (!spec.empty()) {
+    auto item = spec.substr(0, spec.find(';'));
+    spec.remove_prefix(std::min(spec.size(), item.size() + 1));
+    if (trim(item).empty()) {
+      continue;
+    }
+    const auto eq = item.find('=');
+    if (eq == std::string_view::npos) {
+      return -EINVAL;
+    }
+    const auto path = trim(item.substr(eq + 1));
+    if (path.empty()) {
+      return -EINVAL;
+    }
+    // subsystems routed to the same path share its file
+    int index = 0;
+    while (index < (int)files.size() && files[index].path != path) {
+      ++index;
+    }
+    if (index == (int)files.size()) {
+      files.emplace_back().path = path;
+    }
+    auto names = item.substr(0, eq);
+    while (!names.empty()) {
+      auto name = names.substr(0, names.find(','));
+      names.remove_prefix(std::min(names.size(), name.size() + 1));
+      name = trim(name);
+      unsigned sub = 0;
+      while (sub < m_subs->get_num() && name != m_subs->get_name(sub)) {
+	++sub;
+      }
+      if (sub == m_subs->get_num()) {
+	return -EINVAL;
       }
+      if (route.empty()) {
+	route.assign(m_subs->get_num(), -1);
+      }
+      route[sub] = index;
     }
-  } else {
-    m_fd = -1;
   }
-  m_flush_mutex_holder = 0;
+
+  std::scoped_lock lock(m_flush_mutex);
+  // whatever is buffered was routed by the old table
+  _flush_logbuf();
+  _drain_writer();
+  for (auto& f : m_subsys_files) {
+    if (f.writer) {
+      f.writer->stop();
+    }
+    if (f.fd >= 0)
+      VOID_TEMP_FAILURE_RETRY(::close(f.fd));
+  }
+  m_subsys_files = std::move(files);
+  m_subsys_route = std::move(route);
+  if (is_started()) {
+    _open_subsys_files();
+  }
+  // otherwise they are opened by start(), along with the log file
+  return 0;
 }
 
-void Log::chown_log_file(uid_t uid, gid_t gid)
+void Log::set_log_format(LogFormat format)
 {
   std::scoped_lock lock(m_flush_mutex);
-  if (m_fd >= 0) {
-    int r = ::fchown(m_fd, uid, gid);
-    if (r < 0) {
-      r = -errno;
-      std::cerr << "failed to chown " << m_log_file << ": " << cpp_strerror(r)
-	   << std::endl;
+  m_log_format = format;
+}
+
+void Log::set_log_buffer_size(std::size_t n)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  // the buffers are refitted as they are next written out
+  m_log_buf_size = std::max<std::size_t>(n, 4096);
+}
+
+void Log::set_governor_level(int level)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_governor_level = std::min(level, (int)UINT8_MAX - 1);
+  m_governor_counts.assign(level >= 0 ? SubsystemMap::get_num() : 0, 0);
+  // start over at the new level, if any
+  if (m_governor_due.load()) {
+    _release_level_caps();
+    _log_message("--- log_governor_level changed, debug levels restored ---",
+		 false);
+  }
+}
+
+void Log::set_thread_names(bool names)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_thread_names = names;
+}
+
+void Log::set_container_budget(uint32_t elements, uint32_t bytes)
+{
+  MutableEntry::container_budget().store(
+    elements | (static_cast<uint64_t>(bytes) << 32),
+    std::memory_order_relaxed);
+}
+
+void Log::set_async_write(bool async)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_async_write = async;
+  if (!async) {
+    _stop_writer();
+  }
+  // the writer is started lazily by the next _flush_logbuf()
+}
+
+void Log::set_mmap_write(bool mmap)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_mmap_write = mmap;
+  // takes effect on the next reopen_log_file()
+}
+
+int Log::set_compression(std::string_view type, int level)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  // whatever is buffered belongs to the old stream
+  _flush_logbuf();
+  _drain_writer();
+  m_compressor.reset();
+  m_compression_type.clear();
+  // a dictionary is trained afresh for the new stream
+  m_compression_dict.clear();
+  m_compression_dict_tried = false;
+  int r = 0;
+  if (!type.empty() && type != "none") {
+    std::string err;
+    m_compressor = LogCompressor::create(type, level, &err);
+    if (m_compressor) {
+      m_compression_type = type;
+      m_compression_level = level;
+    } else {
+      std::cerr << err << ", writing " << m_log_file << " uncompressed"
+		<< std::endl;
+      r = -EINVAL;
     }
   }
+  _reset_format_workers();
+  return r;
 }
 
-void Log::set_syslog_level(int log, int crash)
+void Log::set_compression_dict_size(uint64_t size)
 {
   std::scoped_lock lock(m_flush_mutex);
-  m_syslog_log = log;
-  m_syslog_crash = crash;
+  m_compression_dict_size = size;
+  m_compression_dict_tried = false;
+  if (!size && !m_compression_dict.empty()) {
+    // what follows is compressed without it
+    _flush_logbuf();
+    _drain_writer();
+    m_compression_dict.clear();
+    _load_compression_dict();
+  }
 }
 
-void Log::set_stderr_level(int log, int crash)
+void Log::set_format_threads(unsigned n)
 {
   std::scoped_lock lock(m_flush_mutex);
-  m_stderr_log = log;
-  m_stderr_crash = crash;
+  if (m_pipeline && m_pipeline->get_workers() != n) {
+    _flush_logbuf();
+    m_pipeline->stop();
+    m_pipeline.reset();
+  }
+  m_format_threads = n;
+  // the pipeline is started lazily by the next _flush_logbuf()
+}
+
+void Log::set_log_stderr_prefix(std::string_view p)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_stderr_sink.set_prefix(p);
+}
+
+void Log::set_stderr_splice(bool splice)
+{
+  m_stderr_sink.set_splice(splice);
+}
+
+void Log::set_traces(std::string_view spec)
+{
+  auto trim = [](std::string_view s) {
+    const auto b = s.find_first_not_of(" \t");
+    if (b == std::string_view::npos) {
+      return std::string_view();
+    }
+    return s.substr(b, s.find_last_not_of(" \t") - b + 1);
+  };
+  TraceRegistry::tag_map tags;
+  while (!spec.empty()) {
+    auto item = spec.substr(0, spec.find(','));
+    spec.remove_prefix(std::min(spec.size(), item.size() + 1));
+    int level = 20;
+    if (auto eq = item.rfind('='); eq != std::string_view::npos) {
+      auto l = std::string(trim(item.substr(eq + 1)));
+      char *end;
+      level = strtol(l.c_str(), &end, 10);
+      if (l.empty() || *end) {
+	continue;
+      }
+      item = item.substr(0, eq);
+    }
+    item = trim(item);
+    if (!item.empty() && level > 0) {
+      tags[std::string(item)] = level;
+    }
+  }
+  m_traces.set(std::move(tags));
+}
+
+void Log::set_trace_sampling(double rate, int level, uint64_t seed)
+{
+  m_trace_sampler.set(rate, level, seed);
+}
+
+void Log::set_suppress_repeats(bool suppress)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  if (!suppress) {
+    _flush_repeats(true);
+    _flush_logbuf();
+    m_repeat.valid = false;
+  }
+  m_suppress_repeats = suppress;
+}
+
+void Log::set_sink_max_pending(std::size_t n)
+{
+  m_stderr_sink.set_max_pending(n);
+  m_syslog_sink.set_max_pending(n);
+  m_network_sink.set_max_pending(n);
+  m_journald_sink.set_max_pending(n);
+}
+
+void Log::set_perf_counters(PerfCounters *pc)
+{
+  std::scoped_lock lock(m_flush_mutex, m_queue_mutex);
+  _drain_writer(); // format workers count bytes written
+  m_perf = pc;
+}
+
+Log::Volume Log::get_subsys_volume(unsigned subsys) const
+{
+  Volume v;
+  if (subsys < m_gathered.size()) {
+    v.gathered = m_gathered[subsys].entries.load(std::memory_order_relaxed);
+    v.gathered_bytes = m_gathered[subsys].bytes.load(std::memory_order_relaxed);
+    v.written = m_written_entries[subsys].load(std::memory_order_relaxed);
+    v.written_bytes = m_written_bytes[subsys].load(std::memory_order_relaxed);
+  }
+  return v;
+}
+
+void Log::reset_volume()
+{
+  for (unsigned i = 0; i < m_gathered.size(); ++i) {
+    m_gathered[i].entries.store(0, std::memory_order_relaxed);
+    m_gathered[i].bytes.store(0, std::memory_order_relaxed);
+    m_written_entries[i].store(0, std::memory_order_relaxed);
+    m_written_bytes[i].store(0, std::memory_order_relaxed);
+  }
+  DoutSiteRegistry::instance().reset_volume();
+}
+
+static void add_queue(const std::vector<ConcreteEntry>& q,
+		      Log::QueueMemory *m)
+{
+  m->entries += q.size();
+  m->slot_bytes += q.capacity() * sizeof(ConcreteEntry);
+  for (const auto& e : q) {
+    m->payload_bytes += e.payload_size();
+    m->heap_bytes += e.footprint() - sizeof(ConcreteEntry);
+  }
+}
+
+static void add_ring(const RecentRing& r, Log::RingMemory *m)
+{
+  ++m->rings;
+  m->entries += r.size();
+  m->used_bytes += r.used_bytes();
+  m->capacity_bytes += r.capacity_bytes();
+}
+
+Log::MemoryUsage Log::get_memory_usage()
+{
+  MemoryUsage m;
+  std::scoped_lock lock1(m_flush_mutex);
+  lock_holder holder1(flush_mutex_holder, this);
+  add_queue(m_flush, &m.flush);
+  add_queue(m_errors_flush, &m.flush);
+  add_queue(m_merged, &m.flush);
+  add_queue(m_pipeline_batch, &m.flush);
+  add_queue(m_reorder, &m.reorder);
+  add_ring(m_recent, &m.recent);
+  for (auto& r : m_subsys_recent) {
+    add_ring(*r, &m.subsys_recent);
+  }
+  m.log_buf_bytes = m_log_buf.size() + m_compress_buf.size();
+  m.log_buf_capacity = m_log_buf.capacity() + m_compress_buf.capacity();
+  for (auto& f : m_subsys_files) {
+    m.log_buf_bytes += f.buf.size();
+    m.log_buf_capacity += f.buf.capacity();
+  }
+  m.recycled_streams = m_recycled.size();
+  {
+    std::scoped_lock lock2(m_queue_mutex);
+    lock_holder holder2(queue_mutex_holder, this);
+    add_queue(m_new, &m.new_entries);
+    add_queue(m_spill, &m.new_entries);
+    add_queue(m_errors, &m.errors);
+    std::scoped_lock lock3(m_rings_mutex);
+    for (auto& r : m_rings) {
+      ++m.submit_rings;
+      m.submit_ring_bytes +=
+	r->capacity() * sizeof(std::optional<ConcreteEntry>);
+    }
+    for (auto& t : m_thread_recent) {
+      std::scoped_lock ring_lock(t->lock);
+      add_ring(t->ring, &m.thread_recent);
+    }
+  }
+  for (std::size_t i = 0; i < m_num_cpus; ++i) {
+    std::scoped_lock lock(m_shards[i].lock);
+    add_queue(m_shards[i].q, &m.new_entries);
+  }
+  return m;
+}
+
+void Log::reopen_log_file()
+{
+  std::scoped_lock lock(m_flush_mutex);
+  if (!is_started()) {
+    return;
+  }
+  lock_holder holder(flush_mutex_holder, this);
+  _reopen_log_file();
+}
+
+/// needs m_flush_mutex
+void Log::_reopen_log_file()
+{
+  _drain_writer();
+  // the chunk being indexed ends with the old file
+  _write_index(m_index_base + m_log_buf.size());
+  _maybe_sync(true);
+  _trim_preallocation();
+  m_mmap.close();
+  if (m_fd >= 0)
+    VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+  m_unsynced = m_unsynced_error = false;
+  if (m_log_file.length()) {
+    m_fd = _open_log_file();
+    if (m_fd >= 0 && m_mmap_write) {
+      int r = m_mmap.open(m_fd);
+      if (r < 0) {
+	std::cerr << "failed to map " << m_log_file << ": " << cpp_strerror(r)
+		  << ", falling back to write(2)" << std::endl;
+      }
+    }
+  } else {
+    m_fd = -1;
+  }
+  // the file may be new, or renamed; its dictionary goes with it
+  if (!m_compression_dict.empty() && _write_compression_dict() < 0) {
+    m_compression_dict.clear();
+    _load_compression_dict();
+  }
+  _open_index();
+  _open_subsys_files();
+  m_rotate_at = ceph::coarse_mono_clock::now() + m_rotate_interval;
+}
+
+/// (re)open the files of m_subsys_files; needs m_flush_mutex and their
+/// writers drained
+void Log::_open_subsys_files()
+{
+  for (auto& f : m_subsys_files) {
+    if (f.fd >= 0)
+      VOID_TEMP_FAILURE_RETRY(::close(f.fd));
+    f.fd = ::open(f.path.c_str(), O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0644);
+    if (f.fd < 0) {
+      int e = errno;
+      std::cerr << "failed to open " << f.path << ": " << cpp_strerror(e)
+		<< ", its subsystems will not be logged" << std::endl;
+      continue;
+    }
+    if ((m_uid || m_gid) && ::fchown(f.fd, m_uid, m_gid) < 0) {
+      int e = errno;
+      std::cerr << "failed to chown " << f.path << ": " << cpp_strerror(e)
+		<< std::endl;
+    }
+    f.buf.reserve(m_log_buf_size);
+  }
+}
+
+/// open m_log_file for appending; returns the fd or -1
+int Log::_open_log_file()
+{
+  // a shared writable mapping needs the fd to be readable too
+  int mode = m_mmap_write ? O_RDWR : O_WRONLY;
+  int fd = ::open(m_log_file.c_str(), O_CREAT|mode|O_APPEND|O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    // what is there already is not ours to drop (or index)
+    m_wb_started = m_wb_dropped = std::max<off_t>(::lseek(fd, 0, SEEK_END), 0);
+    m_index_base = m_wb_started;
+  }
+  if (fd >= 0 && (m_uid || m_gid)) {
+    if (::fchown(fd, m_uid, m_gid) < 0) {
+      int e = errno;
+      std::cerr << "failed to chown " << m_log_file << ": " << cpp_strerror(e)
+	   << std::endl;
+    }
+  }
+  return fd;
+}
+
+void Log::set_index_interval(uint64_t interval)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_index_interval = interval;
+  if (is_started()) {
+    _open_index();
+  }
+  // otherwise it is opened along with the log file
+}
+
+/// (re)open m_log_file.idx for the file behind m_fd, or close it if there
+/// is no index to keep; needs m_flush_mutex
+void Log::_open_index()
+{
+  if (m_index_fd >= 0) {
+    _write_index(m_index_base + m_log_buf.size());
+    VOID_TEMP_FAILURE_RETRY(::close(m_index_fd));
+    m_index_fd = -1;
+  }
+  if (!m_index_interval || m_fd < 0 || m_log_file.empty()) {
+    return;
+  }
+  const std::string path = m_log_file + ".idx";
+  // an index of an empty log file is left over from an earlier one
+  int flags = O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC;
+  if (m_index_base == 0) {
+    flags |= O_TRUNC;
+  }
+  m_index_fd = ::open(path.c_str(), flags, 0644);
+  if (m_index_fd < 0) {
+    int e = errno;
+    std::cerr << "failed to open " << path << ": " << cpp_strerror(e)
+	      << std::endl;
+    return;
+  }
+  if ((m_uid || m_gid) && ::fchown(m_index_fd, m_uid, m_gid) < 0) {
+    int e = errno;
+    std::cerr << "failed to chown " << path << ": " << cpp_strerror(e)
+	      << std::endl;
+  }
+}
+
+/// count e, at file offset at, into the index chunk, first writing out the
+/// chunk if e starts a new one
+void Log::_index_entry(const Entry& e, off_t at)
+{
+  if (m_index_fd < 0 || m_index_base < 0) {
+    return;
+  }
+  auto& c = m_index_chunk;
+  if (c.magic && (uint64_t)(at - c.offset) >= m_index_interval) {
+    _write_index(at);
+  }
+  const uint64_t stamp = e.stamp().time_since_epoch().count().count;
+  if (!c.magic) {
+    c = binary::index_record{};
+    c.magic = binary::INDEX_MAGIC;
+    c.offset = at;
+    c.first = c.last = stamp;
+  }
+  c.first = std::min(c.first, stamp);
+  c.last = std::max(c.last, stamp);
+  c.subsys[e.m_subsys / 64] |= 1ull << (e.m_subsys % 64);
+}
+
+/// write out the index chunk, which ends at file offset end
+void Log::_write_index(off_t end)
+{
+  auto& c = m_index_chunk;
+  if (!c.magic) {
+    return;
+  }
+  c.magic = 0;
+  if (m_index_fd < 0) {
+    return;
+  }
+  binary::index_record r = c;
+  r.magic = binary::INDEX_MAGIC;
+  r.len = std::max<off_t>(end - (off_t)c.offset, 0);
+  int ret = safe_write(m_index_fd, &r, sizeof(r));
+  if (ret < 0) {
+    std::cerr << "problem writing to " << m_log_file << ".idx: "
+	      << cpp_strerror(ret) << std::endl;
+  }
+}
+
+void Log::set_traffic_trace(const std::string& path)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  _close_trace();
+  if (path.empty()) {
+    return;
+  }
+  m_trace_fd = ::open(path.c_str(), O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC, 0644);
+  if (m_trace_fd < 0) {
+    int e = errno;
+    std::cerr << "failed to open " << path << ": " << cpp_strerror(e)
+	      << std::endl;
+    return;
+  }
+  if ((m_uid || m_gid) && ::fchown(m_trace_fd, m_uid, m_gid) < 0) {
+    int e = errno;
+    std::cerr << "failed to chown " << path << ": " << cpp_strerror(e)
+	      << std::endl;
+  }
+  binary::trace_header h;
+  memset(&h, 0, sizeof(h));
+  h.magic = binary::TRACE_MAGIC;
+  h.version = binary::TRACE_VERSION;
+  h.header_size = sizeof(h);
+  h.start = Entry::clock().now().time_since_epoch().count().count;
+  h.pid = getpid();
+  m_trace_stamp = h.start;
+  m_trace_buf.assign(reinterpret_cast<const char*>(&h), sizeof(h));
+  _write_trace();
+}
+
+/// add e's shape to the traffic trace, and whether it was written out
+/// rather than only gathered for the recent entries
+void Log::_trace_entry(const ConcreteEntry& e, bool written)
+{
+  binary::trace_record r;
+  r.stamp = e.stamp().time_since_epoch().count().count;
+  auto [t, added] = m_trace_threads.emplace((uint64_t)e.m_thread,
+					    m_trace_threads.size());
+  r.thread = t->second;
+  r.subsys = e.m_subsys;
+  r.written = written;
+  r.prio = e.m_prio;
+  // a deferred entry is as long as it would be once rendered, which
+  // its encoded arguments can only stand in for
+  r.len = e.get_render() ? e.raw().size() : e.size();
+  const std::size_t used = m_trace_buf.size();
+  m_trace_buf.resize(used + binary::TRACE_RECORD_MAX);
+  char *end = binary::encode_trace(m_trace_buf.data() + used, r,
+				   m_trace_stamp);
+  m_trace_buf.resize(end - m_trace_buf.data());
+  m_trace_stamp = r.stamp;
+}
+
+void Log::_write_trace()
+{
+  if (m_trace_fd < 0 || m_trace_buf.empty()) {
+    return;
+  }
+  int ret = safe_write(m_trace_fd, m_trace_buf.data(), m_trace_buf.size());
+  if (ret < 0) {
+    std::cerr << "problem writing the traffic trace: " << cpp_strerror(ret)
+	      << ", stopping it" << std::endl;
+    VOID_TEMP_FAILURE_RETRY(::close(m_trace_fd));
+    m_trace_fd = -1;
+  }
+  m_trace_buf.clear();
+}
+
+void Log::_close_trace()
+{
+  _write_trace();
+  if (m_trace_fd >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(m_trace_fd));
+    m_trace_fd = -1;
+  }
+  m_trace_threads.clear();
+}
+
+void Log::set_drop_page_cache(bool drop)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_drop_page_cache = drop;
+}
+
+/* Keep the log file out of the page cache: start writeback of what has
+ * been written since the last call, and drop the pages whose writeback
+ * the call before that started, which are clean by now.  Dirty pages
+ * would otherwise pile up until the kernel flushes them all at once,
+ * and clean ones push out data the daemon cares about.
+ */
+void Log::_drop_page_cache()
+{
+  if (!m_drop_page_cache || m_fd < 0 || m_mmap.is_open()) {
+    return;
+  }
+  // the file is O_APPEND, so moving the offset changes nothing
+  const off_t end = ::lseek(m_fd, 0, SEEK_END);
+  if (end < m_wb_started + off_t(WRITEBACK_CHUNK)) {
+    return; // or one of these per line
+  }
+  ::sync_file_range(m_fd, m_wb_started, end - m_wb_started,
+		    SYNC_FILE_RANGE_WRITE);
+  if (m_wb_started > m_wb_dropped) {
+    ::posix_fadvise(m_fd, m_wb_dropped, m_wb_started - m_wb_dropped,
+		    POSIX_FADV_DONTNEED);
+  }
+  m_wb_dropped = m_wb_started;
+  m_wb_started = end;
+}
+
+void Log::set_sync_policy(SyncPolicy policy, std::chrono::milliseconds interval)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_sync_policy = policy;
+  m_sync_interval = interval;
+  // armed again by the next write
+  m_sync_due.store(0);
+}
+
+void Log::set_preallocate(uint64_t chunk)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  lock_holder holder(flush_mutex_holder, this);
+  if (chunk == 0) {
+    _trim_preallocation();
+  }
+  m_prealloc_chunk = chunk;
+}
+
+/* log_sync: fdatasync() the log file once what was written calls for it,
+ * by the policy, writing out what is buffered first; with force, whatever
+ * was written and not yet synced, as it stands, e.g. before the file is
+ * closed.  A sync is counted in l_log_write_lat, since that is what the
+ * writes it covers are waiting for.
+ */
+void Log::_maybe_sync(bool force)
+{
+  if (m_sync_policy == SyncPolicy::NONE || m_fd < 0) {
+    return;
+  }
+  if (!force) {
+    const bool due = m_sync_policy == SyncPolicy::ERRORS ? m_unsynced_error
+							  : _sync_due();
+    if (!due) {
+      return;
+    }
+    _flush_logbuf();
+  }
+  _drain_writer();
+  if (!m_unsynced) {
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  if (::fdatasync(m_fd) < 0) {
+    int e = errno;
+    if (-e != m_fd_last_error) {
+      std::cerr << "problem syncing " << m_log_file << ": " << cpp_strerror(e)
+		<< std::endl;
+      m_fd_last_error = -e;
+    }
+  }
+  if (m_perf) {
+    m_perf->tinc(l_log_write_lat, ceph::timespan(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now() - start).count()));
+  }
+  m_unsynced = m_unsynced_error = false;
+  m_sync_due.store(0);
+}
+
+bool Log::_sync_due() const
+{
+  auto due = m_sync_due.load();
+  return due && std::chrono::steady_clock::now().time_since_epoch() >=
+    std::chrono::nanoseconds(due);
+}
+
+/* log_preallocate: keep the log file allocated a chunk ahead of its end,
+ * so that appends fill blocks that are already there instead of each
+ * allocating its own, which on ext4 and xfs is a metadata update (and a
+ * journal write) per append.  FALLOC_FL_KEEP_SIZE leaves the size alone,
+ * so readers see the file as written.  Not used with log_mmap_write,
+ * which preallocates its own chunks.
+ */
+void Log::_preallocate()
+{
+#ifdef __linux__
+  if (!m_prealloc_chunk || m_fd < 0 || m_mmap.is_open()) {
+    return;
+  }
+  const off_t end = ::lseek(m_fd, 0, SEEK_END);
+  if (end < 0 || end + off_t(m_prealloc_chunk / 2) < m_prealloc_end) {
+    return;
+  }
+  // a filesystem that can't is asked again only a chunk later
+  ::fallocate(m_fd, FALLOC_FL_KEEP_SIZE, end, m_prealloc_chunk);
+  m_prealloc_end = end + m_prealloc_chunk;
+#endif
+}
+
+/// give back what _preallocate() reserved past the end of m_fd, before it
+/// is closed or rotated away from
+void Log::_trim_preallocation()
+{
+  if (m_prealloc_end == 0 || m_fd < 0) {
+    m_prealloc_end = 0;
+    return;
+  }
+  _drain_writer();
+  // truncating to the size it has frees the blocks past it, where punching
+  // a hole there doesn't on ext4; the file is ours alone to append to
+  const off_t end = ::lseek(m_fd, 0, SEEK_END);
+  if (end >= 0 && end < m_prealloc_end) {
+    VOID_TEMP_FAILURE_RETRY(::ftruncate(m_fd, end));
+  }
+  m_prealloc_end = 0;
+}
+
+void Log::set_rotation(uint64_t size, std::chrono::seconds interval,
+		       unsigned keep)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_rotate_size = size;
+  if (interval != m_rotate_interval) {
+    m_rotate_interval = interval;
+    m_rotate_at = ceph::coarse_mono_clock::now() + interval;
+  }
+  m_rotate_keep = std::max(keep, 1u);
+}
+
+/// rotate if the file is due: fstat() once per flush for log_rotate_size,
+/// the clock for log_rotate_interval
+void Log::_maybe_rotate()
+{
+  if ((!m_rotate_size && !m_rotate_interval.count()) ||
+      m_fd < 0 || m_log_file.empty()) {
+    return;
+  }
+  const auto now = ceph::coarse_mono_clock::now();
+  const bool expired = m_rotate_interval.count() && now >= m_rotate_at;
+  if (!expired && !m_rotate_size) {
+    return;
+  }
+  off_t size;
+  if (m_mmap.is_open()) {
+    size = m_mmap.get_size(); // the file itself is preallocated
+  } else {
+    struct stat st;
+    if (::fstat(m_fd, &st) < 0) {
+      return;
+    }
+    size = st.st_size;
+  }
+  if (size == 0) {
+    // an empty file is not worth rotating; start the interval over
+    m_rotate_at = now + m_rotate_interval;
+  } else if (expired || (m_rotate_size && (uint64_t)size >= m_rotate_size)) {
+    _rotate_log_file();
+  }
+}
+
+/// Rename the file out of the way and put a new one in its place behind
+/// the same fd number. dup2() swaps the file atomically, so nothing has to
+/// be drained: the async writer and format workers, which were handed the
+/// fd number, carry on writing, and a buffer still in flight lands at the
+/// start of the new file instead of the end of the old one.  Only an
+/// index, whose offsets would be off by that buffer, waits for it.
+void Log::_rotate_log_file()
+{
+  const bool indexed = m_index_fd >= 0;
+  if (indexed) {
+    _drain_writer();
+    _write_index(m_index_base + m_log_buf.size());
+  }
+  for (unsigned i = m_rotate_keep; i > 0; --i) {
+    const std::string from =
+      i == 1 ? m_log_file : m_log_file + "." + std::to_string(i - 1);
+    const std::string to = m_log_file + "." + std::to_string(i);
+    if (indexed) {
+      // the index goes along with its file, if there is one
+      ::rename((from + ".idx").c_str(), (to + ".idx").c_str());
+    }
+    if (::rename(from.c_str(), to.c_str()) < 0 && errno != ENOENT) {
+      int e = errno;
+      std::cerr << "failed to rotate " << from << ": " << cpp_strerror(e)
+		<< std::endl;
+      if (i == 1) {
+	return;
+      }
+    }
+  }
+  int fd = _open_log_file();
+  if (fd < 0) {
+    int e = errno;
+    // keep writing to the renamed file and try again later
+    std::cerr << "failed to open " << m_log_file << " after rotating it: "
+	      << cpp_strerror(e) << std::endl;
+    return;
+  }
+  // what was written to the old file is as durable as it would have been
+  _maybe_sync(true);
+  _trim_preallocation();
+  // the mapping refers to the old file; trim its preallocated tail first
+  const bool mapped = m_mmap.is_open();
+  m_mmap.close();
+  if (::dup2(fd, m_fd) < 0) {
+    int e = errno;
+    std::cerr << "failed to switch to the new " << m_log_file << ": "
+	      << cpp_strerror(e) << std::endl;
+  }
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  if (mapped) {
+    int r = m_mmap.open(m_fd);
+    if (r < 0) {
+      std::cerr << "failed to map " << m_log_file << ": " << cpp_strerror(r)
+		<< ", falling back to write(2)" << std::endl;
+    }
+  }
+  if (indexed) {
+    _open_index();
+  }
+  m_rotate_at = ceph::coarse_mono_clock::now() + m_rotate_interval;
+  if (m_perf) {
+    m_perf->inc(l_log_rotated);
+  }
+}
+
+void Log::chown_log_file(uid_t uid, gid_t gid)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  if (m_fd >= 0) {
+    int r = ::fchown(m_fd, uid, gid);
+    if (r < 0) {
+      r = -errno;
+      std::cerr << "failed to chown " << m_log_file << ": " << cpp_strerror(r)
+	   << std::endl;
+    }
+  }
+  for (auto& f : m_subsys_files) {
+    if (f.fd >= 0 && ::fchown(f.fd, uid, gid) < 0) {
+      int r = -errno;
+      std::cerr << "failed to chown " << f.path << ": " << cpp_strerror(r)
+	   << std::endl;
+    }
+  }
+}
+
+void Log::set_syslog_level(int log, int crash)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_syslog_log = log;
+  m_syslog_crash = crash;
+}
+
+void Log::set_stderr_level(int log, int crash)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_stderr_log = log;
+  m_stderr_crash = crash;
+}
+
+void Log::set_graylog_level(int log, int crash)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_graylog_log = log;
+  m_graylog_crash = crash;
+}
+
+void Log::set_journald_level(int log, int crash)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  m_journald_log = log;
+  m_journald_crash = crash;
+}
+
+SubmitRing* Log::_get_thread_ring()
+{
+  for (auto& [id, ring] : thread_rings.rings) {
+    if (id == m_id) {
+      return ring.get();
+    }
+  }
+  auto ring = std::make_shared<SubmitRing>(
+    m_thread_ring_size.load(std::memory_order_relaxed));
+  {
+    std::scoped_lock lock(m_rings_mutex);
+    m_rings.push_back(ring);
+  }
+  thread_rings.rings.emplace_back(m_id, ring);
+  return ring.get();
+}
+
+ThreadRecentRing* Log::_get_thread_recent()
+{
+  for (auto& [id, ring] : thread_rings.recent) {
+    if (id == m_id) {
+      return ring.get();
+    }
+  }
+  auto ring = std::make_shared<ThreadRecentRing>(
+    m_max_recent.load(std::memory_order_relaxed),
+    m_thread_recent_bytes.load(std::memory_order_relaxed));
+  {
+    std::scoped_lock lock(m_rings_mutex);
+    // keep the last words of a few exited threads, but not of every one
+    std::size_t detached = std::count_if(
+      m_thread_recent.begin(), m_thread_recent.end(),
+      [](const auto& t) { return t->detached.load(); });
+    for (auto i = m_thread_recent.begin();
+	 detached > MAX_DETACHED_RECENT && i != m_thread_recent.end(); ) {
+      if ((*i)->detached) {
+	i = m_thread_recent.erase(i);
+	--detached;
+      } else {
+	++i;
+      }
+    }
+    m_thread_recent.push_back(ring);
+  }
+  thread_rings.recent.emplace_back(m_id, ring);
+  return ring.get();
+}
+
+/// visit m_recent and the per-thread recent rings merged by stamp, oldest
+/// first, as f(entry, index), where index counts down to -(tail+1); only
+/// the last m_max_recent are visited. begin(skipped) is called first, with
+/// the number of thread rings left out. In a crash, rings whose lock is
+/// held are skipped rather than waited for, as are any past the first
+/// MAX_RECENT_SOURCES, and skipped is -1 if the thread rings couldn't be
+/// looked at at all. Needs m_flush_mutex.
+template<typename F, typename B>
+std::size_t Log::_for_each_recent(F&& f, B&& begin, bool crash, long tail,
+				  char *scratch, std::size_t scratch_len)
+{
+  struct Source {
+    const RecentRing *ring;
+    RecentRing::Cursor c;
+    std::mutex *lock;
+    bool capped; ///< counts towards m_max_recent
+  };
+  // a crash dump can't allocate; anything else sees every thread's ring
+  Source fixed[MAX_RECENT_SOURCES + MAX_SUBSYS_RECENT + 1];
+  std::vector<Source> grown;
+  Source *sources = fixed;
+  std::size_t max_sources = std::size(fixed);
+
+  const bool rings_locked = crash ? m_rings_mutex.try_lock()
+				  : (m_rings_mutex.lock(), true);
+  if (!crash) {
+    grown.resize(1 + m_subsys_recent.size() + m_thread_recent.size());
+    sources = grown.data();
+    max_sources = grown.size();
+  }
+  std::size_t n = 0;
+  sources[n++] = {&m_recent, m_recent.cursor(), nullptr, true};
+  // a subsystem's own ring is bounded by its own budget, not by how busy
+  // the others were
+  for (auto& r : m_subsys_recent) {
+    sources[n++] = {r.get(), r->cursor(), nullptr, false};
+  }
+  long skipped = rings_locked ? 0 : -1;
+  if (rings_locked) {
+    for (auto& t : m_thread_recent) {
+      if (n == max_sources) {
+	++skipped;
+	continue;
+      }
+      if (crash) {
+	if (!t->lock.try_lock()) {
+	  ++skipped;
+	  continue;
+	}
+      } else {
+	t->lock.lock();
+      }
+      sources[n++] = {&t->ring, t->ring.cursor(), &t->lock, true};
+    }
+  }
+  begin(skipped);
+
+  std::size_t total = 0, uncapped = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    (sources[i].capped ? total : uncapped) += sources[i].ring->size();
+  }
+  const std::size_t max_recent = m_max_recent.load(std::memory_order_relaxed);
+  std::size_t skip = total > max_recent ? total - max_recent : 0;
+  long remaining = total - skip + uncapped;
+  std::size_t visited = 0;
+  for (;;) {
+    Source *oldest = nullptr;
+    uint64_t oldest_stamp = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      auto& s = sources[i];
+      if (!s.ring->valid(s.c)) {
+	continue;
+      }
+      const uint64_t stamp = s.ring->stamp(s.c);
+      if (!oldest || stamp < oldest_stamp) {
+	oldest = &s;
+	oldest_stamp = stamp;
+      }
+    }
+    if (!oldest) {
+      break;
+    }
+    if (skip && oldest->capped) {
+      oldest->ring->next(oldest->c);
+      --skip;
+      continue;
+    }
+    const long index = -(remaining-- + tail);
+    oldest->ring->visit(oldest->c, [&](const auto& e) { f(e, index); },
+			scratch, scratch_len);
+    ++visited;
+  }
+
+  for (std::size_t i = 0; i < n; ++i) {
+    if (sources[i].lock) {
+      sources[i].lock->unlock();
+    }
+  }
+  if (rings_locked) {
+    m_rings_mutex.unlock();
+  }
+  return visited;
+}
+
+bool Log::_rings_pending()
+{
+  // pairs with the fence after try_push() in _submit_entry()
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  std::scoped_lock lock(m_rings_mutex);
+  for (auto& ring : m_rings) {
+    if (!ring->empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// rings_lock was taken together with m_new (see flush()) and is released
+/// once the rings are empty
+void Log::_drain_rings(EntryVector& q,
+		       std::unique_lock<std::mutex>& rings_lock)
+{
+  assert(rings_lock.owns_lock());
+  for (auto i = m_rings.begin(); i != m_rings.end(); ) {
+    auto& ring = *i;
+    if (!ring->empty()) {
+      m_merge_runs.push_back(q.size());
+    }
+    ring->drain([&q](ConcreteEntry&& e) {
+      q.emplace_back(std::move(e));
+    });
+    // the owning thread has exited; nothing can be pushed anymore
+    if (ring->is_detached() && ring->empty()) {
+      i = m_rings.erase(i);
+    } else {
+      ++i;
+    }
+  }
+  rings_lock.unlock();
+}
+
+/// queue e on the current cpu's shard; false if sharding is off or the
+/// shard is full and e should go through m_new instead
+bool Log::_try_shard_submit(ConcreteEntry& e)
+{
+  const auto shards = m_queue_shards.load(std::memory_order_relaxed);
+  if (shards == 0) {
+    return false;
+  }
+  int cpu = sched_getcpu();
+  auto& shard = m_shards[(cpu < 0 ? 0 : cpu) % shards];
+  {
+    std::scoped_lock lock(shard.lock);
+    // a full shard falls back to the shared queue, where the overflow
+    // policy applies
+    if (shard.q.size() >= m_shard_max_new.load(std::memory_order_relaxed) ||
+	shard.bytes >= m_shard_max_new_bytes.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    shard.bytes += e.footprint();
+    shard.q.emplace_back(std::move(e));
+    if (!shard.busy.load(std::memory_order_relaxed)) {
+      // seq_cst, so that _flusher_sleep(), which sets m_flusher_idle and
+      // then looks here, can't miss it while _wake_idle_flusher() misses
+      // the flag
+      shard.busy.store(true);
+    }
+  }
+  _wake_idle_flusher();
+  return true;
+}
+
+/// only shards that have something are locked: with sharding off, or a
+/// quiet cpu, checking costs a load rather than a lock per cpu
+bool Log::_shards_pending()
+{
+  for (std::size_t i = 0; i < m_num_cpus; ++i) {
+    if (m_shards[i].busy.load()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Log::_drain_shards(EntryVector& q)
+{
+  for (std::size_t i = 0; i < m_num_cpus; ++i) {
+    auto& shard = m_shards[i];
+    if (!shard.busy.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    std::scoped_lock lock(shard.lock);
+    shard.busy.store(false, std::memory_order_relaxed);
+    if (shard.q.empty()) {
+      continue;
+    }
+    m_merge_runs.push_back(q.size());
+    if (q.empty()) {
+      q.swap(shard.q);
+    } else {
+      std::move(shard.q.begin(), shard.q.end(), std::back_inserter(q));
+      shard.q.clear();
+    }
+    shard.bytes = 0;
+  }
+}
+
+#ifdef CEPH_LOG_LOCKFREE
+/// queue e on m_lockfree; false if it is full and e should go through
+/// m_new instead
+bool Log::_try_lockfree_submit(ConcreteEntry& e)
+{
+  // counted before the push so the flusher never takes the counts below
+  // zero; racing producers can overshoot the limits by one entry each
+  if (m_lockfree_size.fetch_add(1, std::memory_order_relaxed) >=
+      m_lockfree_max.load(std::memory_order_relaxed)) {
+    m_lockfree_size.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  auto p = new ConcreteEntry(std::move(e));
+  const std::size_t bytes = p->footprint();
+  if (m_lockfree_bytes.fetch_add(bytes, std::memory_order_relaxed) >=
+	m_lockfree_max_bytes.load(std::memory_order_relaxed) ||
+      !m_lockfree.bounded_push(p)) {
+    m_lockfree_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    m_lockfree_size.fetch_sub(1, std::memory_order_relaxed);
+    e = std::move(*p);
+    delete p;
+    return false;
+  }
+  // pairs with the fence in _lockfree_pending(): either the flusher sees
+  // the entry or we see it going to sleep
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  _wake_idle_flusher();
+  return true;
+}
+
+void Log::_drain_lockfree(EntryVector& q)
+{
+  const std::size_t start = q.size();
+  std::size_t bytes = 0;
+  ConcreteEntry *p;
+  while (m_lockfree.pop(p)) {
+    bytes += p->footprint();
+    q.emplace_back(std::move(*p));
+    delete p;
+  }
+  if (q.size() == start) {
+    return;
+  }
+  m_merge_runs.push_back(start);
+  m_lockfree_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  m_lockfree_size.fetch_sub(q.size() - start, std::memory_order_relaxed);
+}
+#endif
+
+bool Log::_lockfree_pending()
+{
+#ifdef CEPH_LOG_LOCKFREE
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return !m_lockfree.empty();
+#else
+  return false;
+#endif
+}
+
+/* Collect entries queued outside m_new and put q in time order.
+ *
+ * Every source (m_new, each shard, each ring, the entries held back last
+ * time) is appended to q as a run. The runs are merged on a flat array of
+ * timestamps, so the comparisons never touch the entries themselves, and q
+ * is permuted once at the end.
+ *
+ * With hold set and a reorder window configured, entries younger than the
+ * window stay in m_reorder to be merged with entries from slower sources
+ * on the next pass, up to m_reorder_max_bytes of them.
+ */
+void Log::_drain_pending(EntryVector& q, bool hold,
+			 std::unique_lock<std::mutex>& rings_lock)
+{
+  m_merge_runs.clear();
+  m_merge_runs.push_back(0);
+  if (!m_reorder.empty()) {
+    if (!q.empty()) {
+      m_merge_runs.push_back(q.size());
+    }
+    std::move(m_reorder.begin(), m_reorder.end(), std::back_inserter(q));
+    m_reorder.clear();
+  }
+  _drain_shards(q);
+  _drain_rings(q, rings_lock);
+#ifdef CEPH_LOG_LOCKFREE
+  _drain_lockfree(q);
+#endif
+  m_merge_runs.push_back(q.size());
+  // drop empty runs, e.g. from an empty m_new
+  m_merge_runs.erase(std::unique(m_merge_runs.begin(), m_merge_runs.end()),
+		     m_merge_runs.end());
+  m_reorder_due = 0;
+  hold = hold && m_reorder_window.count() > 0;
+  if (q.empty() || (m_merge_runs.size() == 2 && !hold)) {
+    // a single source is already in submission order
+    return;
+  }
+
+  auto& keys = m_merge_keys;
+  keys.resize(q.size());
+  for (std::size_t i = 0; i < q.size(); ++i) {
+    keys[i] = {q[i].stamp().time_since_epoch().count().count,
+	       static_cast<uint32_t>(i)};
+  }
+  auto by_stamp = [](const merge_key& a, const merge_key& b) {
+    return a.stamp < b.stamp || (a.stamp == b.stamp && a.index < b.index);
+  };
+  // a run is only nearly sorted when producers raced for the queue lock
+  auto& runs = m_merge_runs;
+  for (std::size_t r = 0; r + 1 < runs.size(); ++r) {
+    auto b = keys.begin() + runs[r], e = keys.begin() + runs[r + 1];
+    if (!std::is_sorted(b, e, by_stamp)) {
+      std::sort(b, e, by_stamp);
+    }
+  }
+  // merge neighbouring runs pairwise until one is left: log2(k) passes
+  while (runs.size() > 2) {
+    std::size_t out = 0;
+    std::size_t r = 0;
+    for (; r + 2 < runs.size(); r += 2) {
+      std::inplace_merge(keys.begin() + runs[r], keys.begin() + runs[r + 1],
+			 keys.begin() + runs[r + 2], by_stamp);
+      runs[out++] = runs[r];
+    }
+    if (r + 1 < runs.size()) {
+      runs[out++] = runs[r]; // odd run out
+    }
+    runs[out++] = q.size();
+    runs.resize(out);
+  }
+
+  auto split = keys.end();
+  if (hold) {
+    const uint64_t now =
+      Entry::clock().now().time_since_epoch().count().count;
+    const uint64_t window =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+	m_reorder_window).count();
+    const uint64_t cutoff = now > window ? now - window : 0;
+    split = std::lower_bound(
+      keys.begin(), keys.end(), cutoff,
+      [](const merge_key& k, uint64_t stamp) { return k.stamp < stamp; });
+    // never hold more than the budget; the oldest go out first
+    std::size_t bytes = 0;
+    auto i = keys.end();
+    while (i != split) {
+      bytes += q[(i - 1)->index].payload_size();
+      if (bytes > m_reorder_max_bytes) {
+	break;
+      }
+      --i;
+    }
+    split = i;
+    if (split != keys.end()) {
+      auto wait = std::chrono::nanoseconds(split->stamp - cutoff);
+      m_reorder_due = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	(std::chrono::steady_clock::now() + wait).time_since_epoch()).count();
+    }
+  }
+
+  m_merged.reserve(q.size());
+  for (auto i = keys.begin(); i != split; ++i) {
+    m_merged.emplace_back(std::move(q[i->index]));
+  }
+  for (auto i = split; i != keys.end(); ++i) {
+    m_reorder.emplace_back(std::move(q[i->index]));
+  }
+  q.swap(m_merged);
+  m_merged.clear();
+}
+
+/// held entries have aged out of the reorder window
+bool Log::_reorder_due() const
+{
+  auto due = m_reorder_due.load();
+  return due && std::chrono::steady_clock::now().time_since_epoch() >=
+    std::chrono::nanoseconds(due);
+}
+
+void Log::_wake_idle_flusher()
+{
+  // Only the first producer to find the flusher asleep pays for the
+  // wakeup; everyone else stays off the shared mutex entirely.
+  if (m_flusher_idle.load() && m_flusher_idle.exchange(false)) {
+    std::scoped_lock lock(m_queue_mutex);
+    _notify_flusher();
+  }
+}
+
+void Log::_notify_flusher()
+{
+  if (m_shared.load(std::memory_order_relaxed)) {
+    SharedFlusher::get().wake();
+  } else {
+    m_cond_flusher.notify_one();
+  }
+}
+
+/// on whichever thread flushes this log
+bool Log::_on_flusher() const
+{
+  return am_self() ||
+    (on_shared_flusher && m_shared.load(std::memory_order_relaxed));
+}
+
+void Log::submit_entry(Entry&& e)
+{
+  _submit_entry(ConcreteEntry(e));
+}
+
+void Log::submit_entry(MutableEntry&& e)
+{
+  _submit_entry(ConcreteEntry(std::move(e)));
+}
+
+void Log::submit_entry(ConcreteEntry&& e)
+{
+  // e.g. a deferred entry: queue it as is, without touching its text
+  _submit_entry(std::move(e));
+}
+
+bool Log::try_submit_entry(ConcreteEntry&& e)
+{
+  return _submit_entry(std::move(e), false);
+}
+
+bool Log::try_submit_entry(MutableEntry&& e)
+{
+  if (_submit_entry(ConcreteEntry(std::move(e)), false)) {
+    return true;
+  }
+  m_dropped.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void Log::_count_gathered(const ConcreteEntry& e)
+{
+  // a deferred entry isn't rendered to be counted
+  const std::size_t bytes = e.get_render() ? e.raw().size() : e.size();
+  if (likely(std::size_t(e.m_subsys) < m_gathered.size())) {
+    auto& g = m_gathered[e.m_subsys];
+    g.entries.fetch_add(1, std::memory_order_relaxed);
+    g.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  if (e.m_site) {
+    e.m_site->gathered.fetch_add(1, std::memory_order_relaxed);
+    e.m_site->gathered_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+}
+
+void Log::_count_written(const ConcreteEntry& e, std::size_t bytes)
+{
+  if (likely(std::size_t(e.m_subsys) < m_written_entries.size())) {
+    m_written_entries[e.m_subsys].fetch_add(1, std::memory_order_relaxed);
+    m_written_bytes[e.m_subsys].fetch_add(bytes, std::memory_order_relaxed);
+  }
+  if (e.m_site) {
+    e.m_site->written.fetch_add(1, std::memory_order_relaxed);
+    e.m_site->written_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+}
+
+bool Log::_submit_entry(ConcreteEntry&& e, bool wait)
+{
+  if (unlikely(m_inject_segv))
+    *(volatile int *)(0) = 0xdead;
+  CEPH_LOG_PROBE2(submit, e.m_subsys, e.m_prio);
+  _count_gathered(e);
+
+  if (m_inline.load(std::memory_order_relaxed)) {
+    _submit_inline(std::move(e));
+    return true;
+  }
+
+  if (m_thread_recent_bytes.load(std::memory_order_relaxed)) {
+    // spares the log thread from copying every entry into m_recent
+    // already, if try_submit_entry() is trying it again
+    if (!e.m_recorded) {
+      auto t = _get_thread_recent();
+      {
+	std::scoped_lock lock(t->lock);
+	t->ring.push_back(e);
+      }
+      e.m_recorded = true;
+    }
+    if (!e.m_forced && e.m_prio > m_subs->get_log_level(e.m_subsys)) {
+      // gathered but not logged: the ring is all the flusher would have
+      // done with it, so it goes no further, and a deferred entry is
+      // only ever rendered by a dump
+      return true;
+    }
+  }
+
+  // a synchronous error would wait for the write
+  if (unlikely(e.m_prio <= ERROR_PRIO) &&
+      m_error_lane.load(std::memory_order_relaxed) &&
+      (wait || !m_error_sync.load(std::memory_order_relaxed)) &&
+      _submit_error(e)) {
+    return true;
+  }
+  // this thread's ring, if it is full; e then goes through m_new, after
+  // what is in the ring
+  SubmitRing *full_ring = nullptr;
+  if (m_thread_ring_size.load(std::memory_order_relaxed)) {
+    auto ring = _get_thread_ring();
+    if (ring->try_push(std::move(e))) {
+      // m_head's release store doesn't keep the load of m_flusher_idle
+      // from going ahead of it; pairs with the fence in _rings_pending():
+      // either the flusher sees the entry or we see it going to sleep
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      _wake_idle_flusher();
+      return true;
+    }
+    full_ring = ring;
+  }
+  if (!full_ring && _try_shard_submit(e)) {
+    return true;
+  }
+#ifdef CEPH_LOG_LOCKFREE
+  if (!full_ring && _try_lockfree_submit(e)) {
+    return true;
+  }
+#endif
+
+  std::unique_lock lock(m_queue_mutex);
+  lock_holder holder(queue_mutex_holder, this);
+
+  // wait for flush to catch up
+  while (_threaded() &&
+	 (m_new.size() > m_max_new || m_new_bytes > m_max_new_bytes)) {
+    if (m_stop) break; // force addition
+    auto start = std::chrono::steady_clock::now();
+    m_overflow_at.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      start.time_since_epoch()).count(), std::memory_order_relaxed);
+    if (m_overflow_policy != OverflowPolicy::BLOCK) {
+      if (!_handle_overflow(e)) {
+	return true;
+      }
+      break;
+    }
+    if (!wait) {
+      return false;
+    }
+    // the queue may be full before a batch wakeup was due
+    _notify_flusher();
+    CEPH_LOG_PROBE1(block_start, m_new.size());
+    m_cond_loggers.wait(lock);
+    auto blocked = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start);
+    CEPH_LOG_PROBE1(block_end, blocked.count());
+    m_blocked_ns += blocked.count();
+    if (m_perf) {
+      m_perf->tinc(l_log_blocked, ceph::timespan(blocked.count()));
+    }
+  }
+
+  if (full_ring) {
+    // the ring's entries move ahead of e here rather than come out after
+    // it (stamps can tie); flush() takes m_new and the rings together, so
+    // they can't end up a batch behind what is still in the ring
+    std::scoped_lock rings_lock(m_rings_mutex);
+    full_ring->drain([this](ConcreteEntry&& r) {
+      _queue_new(std::move(r));
+    });
+  }
+  _queue_new(std::move(e));
+  // One wakeup per batch: the flusher drains all of m_new at once, so only
+  // the entry that makes the batch due (by default the first one after a
+  // drain) needs to signal.  Smaller batches are picked up by the timed
+  // wait in entry().
+  if (m_new.size() == m_flush_batch || full_ring) {
+    // (a full ring may have moved m_new past the batch size at once)
+    _notify_flusher();
+  }
+  return true;
+}
+
+/// queue e on the error lane, and write it out now if m_error_sync; false
+/// if the lane is full and e should be queued as usual
+bool Log::_submit_error(ConcreteEntry& e)
+{
+  {
+    std::scoped_lock lock(m_queue_mutex);
+    lock_holder holder(queue_mutex_holder, this);
+    // errors skip the overflow policy, but a flood of them is no reason
+    // to grow without bound
+    if (m_errors.size() > m_max_new) {
+      return false;
+    }
+    m_errors.emplace_back(std::move(e));
+    if (!m_error_sync.load(std::memory_order_relaxed) || !_threaded()) {
+      _notify_flusher();
+      return true;
+    }
+  }
+  if (_on_flusher() || flush_mutex_holder == this) {
+    // the next flush() writes it; don't wait on ourselves
+    return true;
+  }
+  std::scoped_lock lock(m_flush_mutex);
+  lock_holder holder(flush_mutex_holder, this);
+  _flush_errors();
+  _drain_writer();
+  if (m_fd >= 0) {
+    ::fdatasync(m_fd);
+  }
+  _drain_sinks();
+  return true;
+}
+
+/// something (an error, if error) was written for log_sync to sync;
+/// needs m_flush_mutex
+void Log::_note_unsynced(bool error)
+{
+  if (m_sync_policy == SyncPolicy::NONE || m_fd < 0) {
+    return;
+  }
+  m_unsynced = true;
+  m_unsynced_error |= error;
+  if (m_sync_policy == SyncPolicy::PERIODIC && !m_sync_due.load()) {
+    m_sync_due.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      (std::chrono::steady_clock::now() + m_sync_interval)
+      .time_since_epoch()).count());
+  }
+}
+
+/// write the error lane; needs m_flush_mutex
+void Log::_flush_errors()
+{
+  {
+    std::scoped_lock lock(m_queue_mutex);
+    lock_holder holder(queue_mutex_holder, this);
+    assert(m_errors_flush.empty());
+    m_errors_flush.swap(m_errors);
+  }
+  if (m_errors_flush.empty()) {
+    return;
+  }
+  if (m_perf) {
+    m_perf->inc(l_log_submitted, m_errors_flush.size());
+  }
+  _flush(m_errors_flush, true, false);
+}
+
+/// write e from the submitting thread, for a log started inline
+void Log::_submit_inline(ConcreteEntry&& e)
+{
+  std::scoped_lock lock(m_flush_mutex);
+  lock_holder holder(flush_mutex_holder, this);
+  if (_flush_entry(e, false, 0)) {
+    _count_written(e, e.size());
+    _note_unsynced(e.m_prio <= ERROR_PRIO);
+    if (m_perf) {
+      m_perf->inc(l_log_written);
+    }
+  }
+  if (!e.m_recorded) {
+    _recent_for(e).push_back(e);
+  }
+  e.release_stream(m_recycled);
+  CachedStackStringStream::recycle(m_recycled);
+  // buffered, the file is only written when the buffer fills, on flush()
+  // and at exit; errors still go out at once
+  if (!m_inline_buffered || e.m_prio <= ERROR_PRIO) {
+    _flush_repeats(false);
+    _flush_logbuf();
+  }
+  // there is no flusher to come back for a periodic sync
+  _maybe_sync(false);
+}
+
+/// apply a non-blocking overflow policy; false if e was consumed
+bool Log::_handle_overflow(ConcreteEntry& e)
+{
+  switch (m_overflow_policy) {
+  case OverflowPolicy::DROP_LOWEST_PRIORITY:
+    {
+      // larger m_prio is more verbose, i.e. less important: the oldest
+      // entry of the most verbose level queued goes
+      const int level = std::clamp<int>(e.m_prio, 0, DROP_LEVELS - 1);
+      for (int l = DROP_LEVELS; l-- > level; ) {
+	auto& b = m_new_by_prio[l];
+	if (b.head == b.slots.size()) {
+	  continue;
+	}
+	const uint32_t slot = b.slots[b.head];
+	if (m_new[slot].m_prio <= e.m_prio) {
+	  break;
+	}
+	++b.head;
+	// left in place, so that no other slot moves; like the erase it
+	// stands for, it keeps m_new from growing past m_max_new + 1 live
+	// entries
+	m_new_dropped.push_back(slot);
+	++m_dropped;
+	if (m_new_dropped.size() > m_max_new / 4) {
+	  m_new_bytes -= _erase_dropped(m_new, m_new_dropped);
+	  _index_new();
+	}
+	return true;
+      }
+    }
+    break;
+  case OverflowPolicy::RECENT_ONLY:
+    if (m_spill.size() <= m_max_new && m_spill_bytes <= m_max_new_bytes) {
+      m_spill_bytes += e.footprint();
+      m_spill.emplace_back(std::move(e));
+      return false;
+    }
+    break;
+  default:
+    break;
+  }
+  ++m_dropped;
+  return false;
+}
+
+/// append e to m_new; needs m_queue_mutex
+void Log::_queue_new(ConcreteEntry&& e)
+{
+  m_new_bytes += e.footprint();
+  if (m_overflow_policy == OverflowPolicy::DROP_LOWEST_PRIORITY) {
+    const int level = std::clamp<int>(e.m_prio, 0, DROP_LEVELS - 1);
+    m_new_by_prio[level].slots.push_back(m_new.size());
+  }
+  m_new.emplace_back(std::move(e));
+}
+
+/// rebuild m_new_by_prio, or just clear it under another policy; needs
+/// m_queue_mutex
+void Log::_index_new()
+{
+  for (auto& b : m_new_by_prio) {
+    b.slots.clear();
+    b.head = 0;
+  }
+  if (m_overflow_policy != OverflowPolicy::DROP_LOWEST_PRIORITY) {
+    return;
+  }
+  auto dropped = m_new_dropped;
+  std::sort(dropped.begin(), dropped.end());
+  auto d = dropped.begin();
+  for (uint32_t i = 0; i < m_new.size(); ++i) {
+    if (d != dropped.end() && *d == i) {
+      ++d;
+      continue;
+    }
+    const int level = std::clamp<int>(m_new[i].m_prio, 0, DROP_LEVELS - 1);
+    m_new_by_prio[level].slots.push_back(i);
+  }
+}
+
+/// move m_new to m_flush, leaving the dropped slots for the caller to
+/// erase from it with m_flush_dropped; needs m_queue_mutex
+void Log::_take_new()
+{
+  assert(m_flush.empty() && m_flush_dropped.empty());
+  m_flush.swap(m_new);
+  m_flush_dropped.swap(m_new_dropped);
+  m_new_bytes = 0;
+  for (auto& b : m_new_by_prio) {
+    b.slots.clear();
+    b.head = 0;
+  }
+}
+
+/// erase q's dropped slots, keeping the order of the rest; returns their
+/// footprint()
+std::size_t Log::_erase_dropped(EntryVector& q,
+				std::vector<uint32_t>& dropped)
+{
+  if (dropped.empty()) {
+    return 0;
+  }
+  std::sort(dropped.begin(), dropped.end());
+  std::size_t bytes = 0;
+  std::size_t out = 0;
+  auto d = dropped.begin();
+  for (std::size_t i = 0; i < q.size(); ++i) {
+    if (d != dropped.end() && *d == i) {
+      bytes += q[i].footprint();
+      ++d;
+      continue;
+    }
+    if (out != i) {
+      q[out] = std::move(q[i]);
+    }
+    ++out;
+  }
+  q.erase(q.begin() + out, q.end());
+  dropped.clear();
+  return bytes;
+}
+
+void Log::_report_dropped()
+{
+  auto dropped = m_dropped.load(std::memory_order_relaxed);
+  if (dropped != m_dropped_reported) {
+    if (m_perf) {
+      m_perf->inc(l_log_dropped, dropped - m_dropped_reported);
+    }
+    char buf[80];
+    snprintf(buf, sizeof(buf), "--- %" PRIu64 " log entries dropped on overflow ---",
+	     dropped - m_dropped_reported);
+    _log_message(buf, false);
+    m_dropped_reported = dropped;
+  }
+  if (m_stop_dropped) {
+    if (m_perf) {
+      m_perf->inc(l_log_dropped, m_stop_dropped);
+    }
+    char buf[96];
+    snprintf(buf, sizeof(buf),
+	     "--- %" PRIu64 " log entries dropped at shutdown (log_stop_timeout) ---",
+	     m_stop_dropped);
+    _log_message(buf, false);
+    m_stop_dropped = 0;
+  }
+}
+
+void Log::_report_rate_limited()
+{
+  m_rate_limiter.report(
+    [this](unsigned sub) { return m_subs->get_log_rate(sub); },
+    [this](unsigned sub, uint64_t n) {
+      char buf[128];
+      snprintf(buf, sizeof(buf),
+	       "--- %" PRIu64 " log entries from %s suppressed by rate limit ---",
+	       n, m_subs->get_name(sub));
+      _log_message(buf, false);
+    });
+}
+
+/// once a second, hold the noisiest subsystem not yet held to
+/// log_governor_level if the flusher fell behind during the last second (a
+/// submitter found m_new full, or a flush found it nearly so), and let them
+/// all go once it has kept up for ten seconds.  Needs m_flush_mutex.
+void Log::_govern()
+{
+  if (m_governor_level < 0) {
+    return;
+  }
+  const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  if (now < m_governor_at) {
+    return;
+  }
+  constexpr int64_t SECOND = 1000000000;
+  const bool overloaded = m_governor_full ||
+    m_overflow_at.load(std::memory_order_relaxed) > m_governor_at - SECOND;
+  m_governor_at = now + SECOND;
+  m_governor_full = false;
+
+  if (overloaded) {
+    m_governor_overloaded_at = now;
+    unsigned noisiest = m_governor_counts.size();
+    uint64_t most = 0;
+    for (unsigned sub = 0; sub < m_governor_counts.size(); ++sub) {
+      if (m_governor_counts[sub] > most &&
+	  m_level_caps[sub].load(std::memory_order_relaxed) == UINT8_MAX &&
+	  m_subs->get_gather_level(sub) > m_governor_level) {
+	noisiest = sub;
+	most = m_governor_counts[sub];
+      }
+    }
+    if (noisiest < m_governor_counts.size()) {
+      m_level_caps[noisiest].store(m_governor_level, std::memory_order_relaxed);
+      char buf[160];
+      snprintf(buf, sizeof(buf),
+	       "--- log flusher overloaded, holding debug_%s at %d (from %d) "
+	       "until it catches up ---",
+	       m_subs->get_name(noisiest), m_governor_level,
+	       m_subs->get_gather_level(noisiest));
+      _log_message(buf, false);
+    }
+    if (m_governor_due.load(std::memory_order_relaxed) ||
+	noisiest < m_governor_counts.size()) {
+      // the sleeping flusher wakes up for it
+      m_governor_due.store(now + 10 * SECOND);
+    }
+  } else if (auto due = m_governor_due.load(std::memory_order_relaxed);
+	     due && now >= due) {
+    _release_level_caps();
+    _log_message("--- log flusher caught up, debug levels restored ---", false);
+  }
+  std::fill(m_governor_counts.begin(), m_governor_counts.end(), 0);
+}
+
+bool Log::_governor_due() const
+{
+  auto due = m_governor_due.load();
+  return due && std::chrono::steady_clock::now().time_since_epoch() >=
+    std::chrono::nanoseconds(due);
+}
+
+void Log::_release_level_caps()
+{
+  for (auto& cap : m_level_caps) {
+    cap.store(UINT8_MAX, std::memory_order_relaxed);
+  }
+  m_governor_due.store(0);
+}
+
+/// note lines a sink could not keep up with, in the log file only
+void Log::_report_sink_dropped()
+{
+  int i = 0;
+  for (const auto& [sink, name] : {
+	 std::pair<const LogSink&, const char*>{m_stderr_sink, "stderr"},
+	 std::pair<const LogSink&, const char*>{m_syslog_sink, "syslog"},
+	 std::pair<const LogSink&, const char*>{m_network_sink, "graylog"},
+	 std::pair<const LogSink&, const char*>{m_journald_sink, "journald"}}) {
+    auto& reported = m_sink_dropped_reported[i++];
+    const auto dropped = sink.get_dropped();
+    if (dropped != reported) {
+      char buf[80];
+      snprintf(buf, sizeof(buf), "--- %" PRIu64 " log lines not sent to %s ---",
+	       dropped - reported, name);
+      _log_file_message(buf);
+      reported = dropped;
+    }
+  }
+}
+
+/// note the log file being stopped or resumed by update_file_utilization()
+void Log::_report_file_full()
+{
+  const bool full = m_file_full.load(std::memory_order_relaxed);
+  if (full != m_file_full_reported) {
+    _log_message(full ?
+		 "--- log file device is full, log file writes stopped ---" :
+		 "--- log file device has room again, log file writes resumed ---",
+		 false);
+    m_file_full_reported = full;
+  }
+}
+
+void Log::update_file_utilization(double stop_at)
+{
+  std::string path;
+  {
+    std::scoped_lock lock(m_flush_mutex);
+    if (m_fd < 0) {
+      return;
+    }
+    path = m_log_file;
+  }
+  struct statvfs st;
+  if (::statvfs(path.c_str(), &st) < 0 || st.f_blocks == 0) {
+    return; // keep what we had
+  }
+  const double used = 1.0 - double(st.f_bavail) / double(st.f_blocks);
+  m_file_full.store(used >= stop_at, std::memory_order_relaxed);
+}
+
+void Log::flush()
+{
+  // Any flush that takes m_new after this covers everything submitted so
+  // far, so callers that pile up behind one flush are all served by the
+  // next one rather than each taking its turn.
+  const uint64_t want = m_flush_seq.load(std::memory_order_acquire) + 1;
+  std::scoped_lock lock1(m_flush_mutex);
+  lock_holder holder1(flush_mutex_holder, this);
+  const bool on_flusher = _on_flusher();
+  if (!on_flusher && m_flush_drained >= want) {
+    return;
+  }
+  const uint64_t seq = m_flush_seq.load(std::memory_order_relaxed) + 1;
+  m_flush_seq.store(seq, std::memory_order_release);
+
+  // ahead of whatever debug output is queued
+  _flush_errors();
+
+  EntryVector spill;
+  std::vector<std::function<void()>> waiters;
+  // only the log thread holds entries back for reordering; anyone else
+  // calling flush() wants everything written
+  bool hold = on_flusher;
+  // a thread whose ring is full moves the ring into m_new under this lock,
+  // so taking both at once keeps its older lines in this batch
+  std::unique_lock rings_lock(m_rings_mutex, std::defer_lock);
+  {
+    std::scoped_lock lock2(m_queue_mutex);
+    lock_holder holder2(queue_mutex_holder, this);
+    rings_lock.lock();
+    _take_new();
+    m_governor_full |=
+      (m_flush.size() - m_flush_dropped.size()) * 8 >= m_max_new * 7;
+    m_cond_loggers.notify_all();
+    spill.swap(m_spill);
+    m_spill_bytes = 0;
+    // async_flush() callers want everything written
+    waiters.swap(m_flush_waiters);
+    hold = hold && !m_stop && waiters.empty();
+  }
+  _erase_dropped(m_flush, m_flush_dropped);
+  // the batch's stamps become real time with what this takes
+  Entry::clock().calibrate();
+  const auto held = m_reorder.size();
+  _drain_pending(m_flush, hold, rings_lock);
+
+  if (m_perf) {
+    m_perf->inc(l_log_submitted,
+		m_flush.size() + m_reorder.size() - held + spill.size());
+    m_perf->set(l_log_new, m_flush.size());
+  }
+
+  if (m_stop_deadline.load(std::memory_order_relaxed)) {
+    // stop() may not leave time for all of it; the errors and the most
+    // important lines of the backlog come first
+    std::stable_partition(m_flush.begin(), m_flush.end(),
+			  [](const ConcreteEntry& e) {
+			    return e.m_prio <= STOP_PRIO;
+			  });
+  }
+  _flush(m_flush, true, false);
+  // overflowed entries skip the sinks and go straight to m_recent, after
+  // the older ones the batch put there
+  for (auto& e : spill) {
+    if (!e.m_recorded) {
+      _recent_for(e).push_back(e);
+    }
+    e.release_stream(m_recycled);
+  }
+  if (!hold) {
+    _flush_repeats(true);
+    _flush_logbuf();
+  }
+  _report_dropped();
+  _report_rate_limited();
+  _govern();
+  _report_sink_dropped();
+  _report_file_full();
+  _drop_page_cache();
+  _preallocate();
+  _maybe_sync(false);
+  _maybe_rotate();
+  _update_utc_offset();
+  if (m_perf) {
+    std::size_t recent = m_recent.size();
+    std::size_t recent_bytes = m_recent.capacity_bytes();
+    for (auto& r : m_subsys_recent) {
+      recent += r->size();
+      recent_bytes += r->capacity_bytes();
+    }
+    m_perf->set(l_log_recent, recent);
+    m_perf->set(l_log_recent_bytes, recent_bytes);
+    // process wide, kept by the streams themselves
+    m_perf->set(l_log_stream_spills, CachedStackStringStream::get_spills());
+    m_perf->set(l_log_stream_discards,
+		CachedStackStringStream::get_discards());
+    m_perf->set(l_log_pool_misses, EntryPool::get_misses());
+  }
+  if (!on_flusher) {
+    // outside callers (e.g. log_on_exit) expect the data to be on disk;
+    // the log thread itself keeps overlapping formatting and writing
+    _drain_writer();
+    _drain_sinks();
+    m_flush_drained = seq;
+  } else if (!waiters.empty()) {
+    _drain_writer();
+  }
+  for (auto& w : waiters) {
+    w();
+  }
+}
+
+void Log::async_flush(std::function<void()> on_written)
+{
+  {
+    std::scoped_lock lock(m_queue_mutex);
+    lock_holder holder(queue_mutex_holder, this);
+    // once m_stop is set the last flush() may have taken the waiters
+    if (_threaded() && !m_stop) {
+      m_flush_waiters.push_back(std::move(on_written));
+      _notify_flusher();
+      return;
+    }
+  }
+  flush();
+  on_written();
+}
+
+void Log::_log_safe_write(std::string_view sv)
+{
+  if (m_fd < 0)
+    return;
+  CEPH_LOG_PROBE1(write_start, sv.size());
+  int r;
+  if (m_mmap.is_open()) {
+    r = m_mmap.write(sv);
+    if (r < 0) {
+      // the mapping is unusable; carry on with plain writes at its tail
+      m_mmap.close();
+    }
+  } else {
+    auto start = std::chrono::steady_clock::now();
+    r = safe_write(m_fd, sv.data(), sv.size());
+    if (m_perf) {
+      m_perf->tinc(l_log_write_lat, ceph::timespan(
+	std::chrono::duration_cast<std::chrono::nanoseconds>(
+	  std::chrono::steady_clock::now() - start).count()));
+    }
+  }
+  CEPH_LOG_PROBE2(write_end, sv.size(), r);
+  if (r >= 0 && m_perf) {
+    m_perf->inc(l_log_bytes, sv.size());
+  }
+  if (r != m_fd_last_error) {
+    if (r < 0)
+      std::cerr << "problem writing to " << m_log_file
+           << ": " << cpp_strerror(r) << std::endl;
+    m_fd_last_error = r;
+  }
+}
+
+/// whether m_log_buf goes to the file as it is, by write() on this thread
+bool Log::_plain_writes() const
+{
+  return m_fd >= 0 && !m_mmap.is_open() && !m_compressor &&
+    !(m_async_write && _threaded()) && !_use_pipeline();
+}
+
+/// write m_log_buf, then e's pieces and the newline, with as few writev()s
+/// as IOV_MAX allows; for _flush_entry() when _plain_writes()
+void Log::_write_segments(const ConcreteEntry& e)
+{
+  std::vector<struct iovec> iov;
+  std::size_t total = m_log_buf.size() + 1;
+  iov.push_back({m_log_buf.data(), m_log_buf.size()});
+  e.for_each_segment([&iov, &total](std::string_view s) {
+    iov.push_back({const_cast<char*>(s.data()), s.size()});
+    total += s.size();
+  });
+  static char newline = '\n';
+  iov.push_back({&newline, 1});
+
+  CEPH_LOG_PROBE1(write_start, total);
+  const auto start = std::chrono::steady_clock::now();
+  int r = 0;
+  for (auto v = iov.begin(); v != iov.end(); ) {
+    ssize_t w = ::writev(m_fd, &*v, std::min<std::size_t>(iov.end() - v,
+							   IOV_MAX));
+    if (w < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      r = -errno;
+      break;
+    }
+    // skip what was written; a short write leaves a partial iovec
+    while (v != iov.end() && (std::size_t)w >= v->iov_len) {
+      w -= v->iov_len;
+      ++v;
+    }
+    if (w) {
+      v->iov_base = static_cast<char*>(v->iov_base) + w;
+      v->iov_len -= w;
+    }
+  }
+  CEPH_LOG_PROBE2(write_end, total, r);
+  if (m_perf) {
+    m_perf->tinc(l_log_write_lat, ceph::timespan(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now() - start).count()));
+    if (r >= 0) {
+      m_perf->inc(l_log_bytes, total);
+    }
+  }
+  if (r != m_fd_last_error) {
+    if (r < 0)
+      std::cerr << "problem writing to " << m_log_file
+           << ": " << cpp_strerror(r) << std::endl;
+    m_fd_last_error = r;
+  }
+  if (m_index_base >= 0) {
+    m_index_base += total;
+  }
+  m_log_buf.resize(0);
+}
+
+/// compress sv into m_compress_buf as a single frame
+bool Log::_compress(std::string_view sv)
+{
+  if (!m_compressor || m_fd < 0) {
+    return false;
+  }
+  if (m_compressor->compress(sv, m_compress_buf) < 0) {
+    // better an undecodable stretch than lost log lines
+    std::cerr << m_compressor->get_type() << " compression failed, writing "
+	      << sv.size() << " bytes to " << m_log_file << " uncompressed"
+	      << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// train m_compression_dict from m_recent once it holds enough entries;
+/// tried once per stream, as training takes the log thread a while
+void Log::_maybe_train_compression_dict()
+{
+  if (likely(m_compression_dict_tried || !m_compression_dict_size ||
+	     !m_compressor || m_fd < 0 || m_dumping)) {
+    return;
+  }
+  if (m_recent.empty() ||
+      m_recent.size() < std::min(m_max_recent.load(std::memory_order_relaxed),
+				 COMPRESSION_DICT_SAMPLES)) {
+    return;
+  }
+  m_compression_dict_tried = true;
+  if (m_compression_type != "zstd") {
+    // lz4 frames have no dictionary to name
+    return;
+  }
+  // zstd wants about a hundred times the dictionary to train from
+  const std::size_t max_bytes = 100 * m_compression_dict_size;
+  std::string samples;
+  std::vector<std::size_t> sizes;
+  samples.reserve(std::min(max_bytes, m_recent.used_bytes()));
+  sizes.reserve(m_recent.size());
+  m_recent.for_each([&](const auto& e) {
+    const auto sv = e.strv();
+    if (samples.size() + sv.size() + 1 <= max_bytes) {
+      samples.append(sv);
+      samples.push_back('\n');
+      sizes.push_back(sv.size() + 1);
+    }
+  });
+  std::string dict, err;
+  if (LogCompressor::train_dictionary(m_compression_type, samples, sizes,
+				      m_compression_dict_size, &dict,
+				      &err) < 0) {
+    std::cerr << "failed to train a " << m_compression_type
+	      << " dictionary for " << m_log_file << ": " << err
+	      << ", compressing without one" << std::endl;
+    return;
+  }
+  // the pipeline workers' compressors are about to change
+  _drain_writer();
+  m_compression_dict = std::move(dict);
+  if (_write_compression_dict() < 0) {
+    m_compression_dict.clear();
+    return;
+  }
+  _load_compression_dict();
+}
+
+/// write m_compression_dict to <log_file>.<id>.dict, which is where
+/// zstdcat -D and ceph-log-query find what the frames naming id need;
+/// returns 0 or -errno
+int Log::_write_compression_dict()
+{
+  if (m_log_file.empty()) {
+    return -ENOENT;
+  }
+  const std::string path = m_log_file + "." +
+    std::to_string(LogCompressor::get_dictionary_id(m_compression_dict)) +
+    ".dict";
+  // never a torn dictionary under the name frames point at
+  const std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC, 0644);
+  if (fd < 0) {
+    int e = errno;
+    std::cerr << "failed to open " << tmp << ": " << cpp_strerror(e)
+	      << ", compressing without a dictionary" << std::endl;
+    return -e;
+  }
+  if ((m_uid || m_gid) && ::fchown(fd, m_uid, m_gid) < 0) {
+    int e = errno;
+    std::cerr << "failed to chown " << tmp << ": " << cpp_strerror(e)
+	      << std::endl;
+  }
+  int r = safe_write(fd, m_compression_dict.data(), m_compression_dict.size());
+  if (r == 0 && ::fsync(fd) < 0) {
+    r = -errno;
+  }
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  if (r == 0 && ::rename(tmp.c_str(), path.c_str()) < 0) {
+    r = -errno;
+  }
+  if (r < 0) {
+    std::cerr << "failed to write " << path << ": " << cpp_strerror(r)
+	      << ", compressing without a dictionary" << std::endl;
+    ::unlink(tmp.c_str());
+  }
+  return r;
+}
+
+/// have m_compressor and the pipeline workers' compressors, which must be
+/// idle, compress against m_compression_dict (or nothing, if it is empty)
+void Log::_load_compression_dict()
+{
+  if (m_compressor) {
+    m_compressor->set_dictionary(m_compression_dict);
+  }
+  for (auto& w : m_format_workers) {
+    if (w.compressor) {
+      w.compressor->set_dictionary(m_compression_dict);
+    }
+  }
+}
+
+/// the lines buffered for stderr and syslog go out along with the log file
+/// buffer
+void Log::_flush_logbuf()
+{
+  _flush_sinks();
+  for (auto& f : m_subsys_files) {
+    _flush_subsys_file(f);
+  }
+  _maybe_train_compression_dict();
+  if (m_index_base >= 0 && (m_compressor || _use_pipeline())) {
+    // offsets into the file are no longer known here
+    _write_index(m_index_base + m_log_buf.size());
+    m_index_base = -1;
+  }
+  if (_use_pipeline()) {
+    if (m_log_buf.empty() && m_pipeline_batch.empty()) {
+      return;
+    }
+    if (!m_pipeline) {
+      m_pipeline = std::make_unique<FormatPipeline>(
+	m_format_threads, 2 * m_format_threads,
+	[this](FormatPipeline::Batch& b, unsigned worker) {
+	  _format_batch(b, worker);
+	},
+	[this](std::size_t bytes) {
+	  if (m_perf) {
+	    m_perf->inc(l_log_bytes, bytes);
+	  }
+	});
+      _reset_format_workers();
+      m_pipeline->start();
+    }
+    // anything already in m_log_buf precedes the entries
+    m_pipeline->submit(m_fd, m_log_format, m_thread_names, m_pipeline_batch,
+		       m_log_buf);
+    m_pipeline_bytes = 0;
+    return;
+  }
+  if (m_log_buf.size()) {
+    if (m_index_base >= 0) {
+      m_index_base += m_log_buf.size();
+    }
+    if (_compress(std::string_view(m_log_buf.data(), m_log_buf.size()))) {
+      m_log_buf.swap(m_compress_buf);
+    }
+    if (m_async_write && m_fd >= 0 && !m_mmap.is_open() && _threaded()) {
+      if (!m_writer) {
+	m_writer = std::make_unique<AsyncWriter>();
+	m_writer->start();
+      }
+      if (m_perf) {
+	m_perf->inc(l_log_bytes, m_log_buf.size());
+      }
+      // swaps in an empty buffer; formatting continues while this one is
+      // written
+      m_writer->submit(m_fd, m_log_buf);
+      _fit_buf(m_log_buf);
+      return;
+    }
+    _log_safe_write(std::string_view(m_log_buf.data(), m_log_buf.size()));
+    m_log_buf.resize(0);
+    _fit_buf(m_log_buf);
+  }
+}
+
+/// the (empty) buffer b keeps room for log_buffer_size; what a burst or an
+/// oversized entry grew it to is given back rather than held for good
+void Log::_fit_buf(LogBuffer& b)
+{
+  if (b.capacity() > 4 * m_log_buf_size) {
+    LogBuffer().swap(b);
+  }
+  if (b.capacity() < m_log_buf_size) {
+    b.reserve(m_log_buf_size);
+  }
+}
+
+/// write out what is buffered for f, from its own writer when threaded
+void Log::_flush_subsys_file(SubsysFile& f)
+{
+  if (f.buf.empty()) {
+    return;
+  }
+  if (f.fd >= 0 && _threaded()) {
+    if (!f.writer) {
+      f.writer = std::make_unique<AsyncWriter>();
+      f.writer->start();
+    }
+    if (m_perf) {
+      m_perf->inc(l_log_bytes, f.buf.size());
+    }
+    f.writer->submit(f.fd, f.buf);
+    _fit_buf(f.buf);
+    return;
+  }
+  if (f.fd >= 0) {
+    int r = safe_write(f.fd, f.buf.data(), f.buf.size());
+    if (r >= 0 && m_perf) {
+      m_perf->inc(l_log_bytes, f.buf.size());
+    }
+    if (r != f.last_error) {
+      if (r < 0)
+	std::cerr << "problem writing to " << f.path
+		  << ": " << cpp_strerror(r) << std::endl;
+      f.last_error = r;
+    }
+  }
+  f.buf.resize(0);
+  _fit_buf(f.buf);
+}
+
+void Log::_sink_append(uint8_t sinks, const Entry *e, std::string_view line,
+		       std::size_t body, bool prefixed)
+{
+  if (!m_sink_batch) {
+    m_sink_batch = std::make_shared<SinkBatch>();
+  }
+  m_sink_batch->append(sinks, e, line, body, prefixed);
+}
+
+/// hand the current batch to every sink that has lines in it
+void Log::_flush_sinks()
+{
+  if (!m_sink_batch) {
+    return;
+  }
+  SinkBatchRef b = std::move(m_sink_batch);
+  for (LogSink *sink : {static_cast<LogSink*>(&m_stderr_sink),
+			static_cast<LogSink*>(&m_syslog_sink),
+			static_cast<LogSink*>(&m_network_sink),
+			static_cast<LogSink*>(&m_journald_sink)}) {
+    if (!(b->sinks & sink->get_mask())) {
+      continue;
+    }
+    if (m_dumping || !_threaded()) {
+      sink->write_now(*b);
+    } else {
+      sink->submit(b);
+    }
+  }
+}
+
+void Log::_drain_sinks()
+{
+  const auto until = _stop_deadline();
+  m_stderr_sink.drain(until);
+  m_syslog_sink.drain(until);
+  m_network_sink.drain(until);
+  m_journald_sink.drain(until);
+}
+
+std::chrono::steady_clock::time_point Log::_stop_deadline() const
+{
+  auto deadline = m_stop_deadline.load(std::memory_order_relaxed);
+  if (!deadline) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return std::chrono::steady_clock::time_point(
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::nanoseconds(deadline)));
+}
+
+/// wait for queued async writes, e.g. before writing to m_fd directly
+void Log::_drain_writer()
+{
+  if (m_pipeline) {
+    m_pipeline->drain();
+  }
+  if (m_writer) {
+    m_writer->drain();
+  }
+  for (auto& f : m_subsys_files) {
+    if (f.writer) {
+      f.writer->drain();
+    }
+  }
+}
+
+void Log::_stop_writer()
+{
+  if (m_pipeline) {
+    m_pipeline->stop();
+    m_pipeline.reset();
+  }
+  if (m_writer) {
+    m_writer->stop();
+    m_writer.reset();
+  }
+  for (auto& f : m_subsys_files) {
+    if (f.writer) {
+      f.writer->stop();
+      f.writer.reset();
+    }
+  }
+}
+
+/// whether file output is formatted by m_pipeline rather than this thread
+bool Log::_use_pipeline() const
+{
+  // routed lines are split off as they are formatted, on this thread
+  return m_format_threads && m_fd >= 0 && !m_mmap.is_open() && _threaded() &&
+    m_subsys_route.empty();
+}
+
+/// give every pipeline worker its own formatter and compression context;
+/// only while the pipeline is idle
+void Log::_reset_format_workers()
+{
+  m_format_workers.clear();
+  if (!m_pipeline) {
+    return;
+  }
+  m_format_workers.resize(m_pipeline->get_workers());
+  for (auto& w : m_format_workers) {
+    if (m_compressor) {
+      std::string err;
+      w.compressor = LogCompressor::create(m_compression_type,
+					   m_compression_level, &err);
+      if (w.compressor && !m_compression_dict.empty()) {
+	w.compressor->set_dictionary(m_compression_dict);
+      }
+    }
+  }
+}
+
+/// " %lx %2d " without going through snprintf; name, if not empty, is
+/// written in place of the thread's hex
+static std::size_t append_thread_prio(char *out, pthread_t thread, short prio,
+				      std::string_view name = {})
+{
+  static const char hex[] = "0123456789abcdef";
+  char* pos = out;
+  *pos++ = ' ';
+  if (!name.empty()) {
+    memcpy(pos, name.data(), name.size());
+    pos += name.size();
+  } else {
+    unsigned long t = (unsigned long)thread;
+    char digits[2 * sizeof(t)];
+    int n = 0;
+    do {
+      digits[n++] = hex[t & 0xf];
+      t >>= 4;
+    } while (t);
+    while (n) {
+      *pos++ = digits[--n];
+    }
+  }
+  *pos++ = ' ';
+  if (prio >= 0 && prio < 100) {
+    *pos++ = prio < 10 ? ' ' : '0' + prio / 10;
+    *pos++ = '0' + prio % 10;
+  } else if (prio > -10 && prio < 0) {
+    *pos++ = '-';
+    *pos++ = '0' - prio;
+  } else {
+    pos += sprintf(pos, "%2d", prio);
+  }
+  *pos++ = ' ';
+  return pos - out;
+}
+
+/// room format_line() needs beyond the message
+static constexpr std::size_t LINE_OVERHEAD = 80 + ThreadNameCache::MAX_TOKEN;
+
+/// the stamp, thread and level a text line starts with; returns its length
+static std::size_t format_prefix(char *out, std::size_t allocated,
+				 log_time_formatter& tf, const Entry& e,
+				 bool crash, long index, ThreadNameCache *names)
+{
+  std::size_t used = 0;
+  if (crash) {
+    used += (std::size_t)snprintf(out + used, allocated - used, "%6ld> ", index);
+  }
+  used += (std::size_t)tf.append(e.stamp(), out + used, allocated - used);
+  used += append_thread_prio(out + used, e.m_thread, e.m_prio,
+			     names ? names->get(e.m_thread) : std::string_view{});
+  return used;
+}
+
+/// format e as a text line at out, NUL terminated but without the newline;
+/// returns its length.  names, if given, resolves the thread's name.
+static std::size_t format_line(char *out, std::size_t allocated,
+			       log_time_formatter& tf, const Entry& e,
+			       std::string_view str, bool crash, long index,
+			       ThreadNameCache *names)
+{
+  std::size_t used = format_prefix(out, allocated, tf, e, crash, index, names);
+  memcpy(out + used, str.data(), str.size());
+  used += str.size();
+  out[used] = '\0';
+  ceph_assert((used + 1 /* '\n' */) < allocated);
+  return used;
+}
+
+static void append_json_string(LogBuffer& out, std::string_view s)
+{
+  out.push_back('"');
+  ceph::json_escape(s, [&out](const char *p, std::size_t n) {
+    memcpy(grow(out, n), p, n);
+  });
+  out.push_back('"');
+}
+
+/// append f to out as a member of a JSON object, after a comma
+static void append_json_field(LogBuffer& out,
+			      const structured::field& f)
+{
+  namespace st = structured;
+  char buf[32];
+  out.push_back(',');
+  append_json_string(out, f.key);
+  out.push_back(':');
+  int n = 0;
+  switch (f.type) {
+  case st::INT:
+    n = snprintf(buf, sizeof(buf), "%" PRId64, f.i);
+    break;
+  case st::UINT:
+    n = snprintf(buf, sizeof(buf), "%" PRIu64, f.u);
+    break;
+  case st::DOUBLE:
+    if (!std::isfinite(f.d)) {
+      n = snprintf(buf, sizeof(buf), "null"); // JSON has no inf or nan
+      break;
+    }
+    // the shorter form, unless it doesn't read back as the same value
+    n = snprintf(buf, sizeof(buf), "%.15g", f.d);
+    if (strtod(buf, nullptr) != f.d) {
+      n = snprintf(buf, sizeof(buf), "%.17g", f.d);
+    }
+    break;
+  case st::BOOL:
+    n = snprintf(buf, sizeof(buf), "%s", f.b ? "true" : "false");
+    break;
+  case st::STRING:
+    append_json_string(out, f.s);
+    return;
+  }
+  out.insert(out.end(), buf, buf + n);
+}
+
+/// append e to out as a line of log_format=json: an object with the stamp,
+/// thread, priority, subsystem and message, the index of a crash dump entry
+/// and a member for each field of a structured entry
+template<typename E>
+static void append_json_line(LogBuffer& out, log_time_formatter& tf,
+			     const E& e, std::string_view str,
+			     const char *subsys, bool crash, long index,
+			     ThreadNameCache *names)
+{
+  namespace st = structured;
+  auto append = [&out](std::string_view s) {
+    out.insert(out.end(), s.begin(), s.end());
+  };
+  char buf[64];
+  append("{\"stamp\":\"");
+  append(std::string_view(buf, tf.append(e.stamp(), buf, sizeof(buf))));
+  append("\",\"thread\":");
+  if (auto name = names ? names->get(e.m_thread) : std::string_view{};
+      !name.empty()) {
+    append_json_string(out, name);
+  } else {
+    append(std::string_view(buf, snprintf(buf, sizeof(buf), "\"%lx\"",
+					  (unsigned long)e.m_thread)));
+  }
+  append(",\"prio\":");
+  append(std::string_view(buf, snprintf(buf, sizeof(buf), "%d", e.m_prio)));
+  append(",\"subsys\":");
+  append_json_string(out, subsys);
+  if (crash) {
+    append(",\"index\":");
+    append(std::string_view(buf, snprintf(buf, sizeof(buf), "%ld", index)));
+  }
+  append(",\"msg\":");
+  if constexpr (std::is_same_v<E, ConcreteEntry>) {
+    if (e.is_structured()) {
+      const char *p = e.raw().data();
+      append_json_string(out, st::read_message(p));
+      st::for_each_field(e.raw().data(), [&out](const st::field& f) {
+	append_json_field(out, f);
+      });
+      append("}\n");
+      return;
+    }
+  }
+  append_json_string(out, str);
+  append("}\n");
+}
+
+/// called on a pipeline worker; the same output _flush_entry() would have
+/// produced for the file
+void Log::_format_batch(FormatPipeline::Batch& b, unsigned worker)
+{
+  auto& w = m_format_workers[worker];
+  auto& buf = b.buf;
+  for (auto& e : b.entries) {
+    auto str = e.strv();
+    const std::size_t cur = buf.size();
+    if (b.format == LogFormat::BINARY) {
+      auto h = binary::make_header(e, str.size(), false, 0);
+      char *p = grow(buf, sizeof(h) + str.size());
+      memcpy(p, &h, sizeof(h));
+      memcpy(p + sizeof(h), str.data(), str.size());
+    } else if (b.format == LogFormat::JSON) {
+      append_json_line(buf, w.time_formatter, e, str,
+		       m_subs->get_name(e.m_subsys), false, 0,
+		       b.thread_names ? &w.thread_names : nullptr);
+    } else {
+      const std::size_t allocated = str.size() + LINE_OVERHEAD;
+      std::size_t used = format_line(grow(buf, allocated), allocated,
+				     w.time_formatter, e, str, false, 0,
+				     b.thread_names ? &w.thread_names : nullptr);
+      buf[cur + used++] = '\n';
+      buf.resize(cur + used);
+    }
+  }
+  if (w.compressor && !buf.empty()) {
+    if (w.compressor->compress(std::string_view(buf.data(), buf.size()),
+			       w.out) == 0) {
+      buf.swap(w.out);
+    } else {
+      std::cerr << w.compressor->get_type() << " compression failed, writing "
+		<< buf.size() << " bytes uncompressed" << std::endl;
+    }
+  }
+}
+
+void Log::_append_binary(const binary::record_header& h, std::string_view sv)
+{
+  char *p = grow(m_log_buf, sizeof(h) + sv.size());
+  memcpy(p, &h, sizeof(h));
+  memcpy(p + sizeof(h), sv.data(), sv.size());
+  if (m_log_buf.size() > m_log_buf_size) {
+    _flush_logbuf();
+  }
+}
+
+/// whether e's text is in the pieces a large message was written in
+template<typename E>
+static bool is_segmented(const E& e)
+{
+  if constexpr (std::is_same_v<E, ConcreteEntry>) {
+    return e.segmented();
+  } else {
+    return false;
+  }
+}
+
+/// copy e's text to out, piece by piece; returns its length
+template<typename E>
+static std::size_t copy_segments(const E& e, char *out)
+{
+  std::size_t n = 0;
+  if constexpr (std::is_same_v<E, ConcreteEntry>) {
+    e.for_each_segment([out, &n](std::string_view s) {
+      memcpy(out + n, s.data(), s.size());
+      n += s.size();
+    });
+  } else {
+    const auto s = e.strv();
+    memcpy(out, s.data(), s.size());
+    n = s.size();
+  }
+  return n;
 }
 
-void Log::submit_entry(Entry&& e)
+/// returns true if e went to the log file
+///
+/// E is the concrete (final) entry type, so that strv() and size() are
+/// resolved statically and inlined into the flush loop.
+template<typename E>
+bool Log::_flush_entry(const E& e, bool crash, long index)
 {
-  std::unique_lock lock(m_queue_mutex);
-  m_queue_mutex_holder = pthread_self();
+  static_assert(std::is_final_v<E>, "flush a concrete entry type");
 
-  if (unlikely(m_inject_segv))
-    *(volatile int *)(0) = 0xdead;
+  auto prio = e.m_prio;
+  auto sub = e.m_subsys;
+  if (!crash && !e.m_forced && m_subs->get_log_level(sub) < prio) {
+    // gathered for m_recent only; a deferred entry stays unrendered
+    return false;
+  }
+  // a crash dump stays whole in the log file
+  SubsysFile *file = nullptr;
+  if (!crash && sub >= 0 && (std::size_t)sub < m_subsys_route.size() &&
+      m_subsys_route[sub] >= 0) {
+    file = &m_subsys_files[m_subsys_route[sub]];
+  }
+  bool do_fd = file ? file->fd >= 0 :
+    m_fd >= 0 && !m_file_full.load(std::memory_order_relaxed);
+  const bool written = do_fd;
+  if (m_pipelining) {
+    // the caller queues e for a format worker, which renders it
+    do_fd = false;
+  }
+  bool do_syslog = m_syslog_crash >= prio;
+  bool do_stderr = m_stderr_crash >= prio;
+  bool do_graylog2 = m_graylog_crash >= prio;
+  bool do_journald = m_journald_crash >= prio;
+  const bool do_sinks = do_syslog || do_stderr || do_graylog2 || do_journald;
+  const bool repeats = !crash && m_suppress_repeats;
+  if (!do_fd && !do_sinks && !repeats && !m_shm_ring.is_open()) {
+    // nothing here needs the text
+    return written;
+  }
 
-  // wait for flush to catch up
-  while (is_started() &&
-	 m_new.size() > m_max_new) {
-    if (m_stop) break; // force addition
-    m_cond_loggers.wait(lock);
+  // A large message left in segments is only joined if something needs it
+  // in one piece; a text line takes the pieces as they are.
+  const bool pieces = is_segmented(e) && !m_suppress_repeats &&
+    !m_shm_ring.is_open() && m_log_format == LogFormat::TEXT;
+  const std::string_view str = pieces ? std::string_view{} : e.strv();
+  const std::size_t len = pieces ? e.size() : str.size();
+
+  if (repeats && _is_repeat(e, str)) {
+    return false;
+  }
+  if (m_shm_ring.is_open()) {
+    m_shm_ring.append(binary::make_header(e, str.size(), crash, index), str);
   }
 
-  m_new.emplace_back(std::move(e));
-  m_cond_flusher.notify_all();
-  m_queue_mutex_holder = 0;
-}
+  if (do_fd && !file && m_log_format == LogFormat::BINARY) {
+    // the file gets the raw record; text is only rendered for syslog/stderr
+    const off_t at = m_index_base + m_log_buf.size();
+    _append_binary(binary::make_header(e, str.size(), crash, index), str);
+    _index_entry(e, at);
+    do_fd = false;
+  }
+  if (do_fd && !file && m_log_format == LogFormat::JSON) {
+    const off_t at = m_index_base + m_log_buf.size();
+    append_json_line(m_log_buf, m_time_formatter, e, str,
+		     m_subs->get_name(sub), crash, index,
+		     m_thread_names ? &m_thread_name_cache : nullptr);
+    if (m_log_buf.size() > m_log_buf_size) {
+      _flush_logbuf();
+    }
+    _index_entry(e, at);
+    do_fd = false;
+  }
 
-void Log::flush()
-{
-  std::scoped_lock lock1(m_flush_mutex);
-  m_flush_mutex_holder = pthread_self();
+  if (pieces && do_fd && !do_sinks && !file && len >= m_log_buf_size &&
+      _plain_writes()) {
+    // too big to be worth buffering: the pieces go straight to the file,
+    // after what's buffered and the line's prefix
+    const std::size_t cur = m_log_buf.size();
+    const std::size_t used = format_prefix(
+      grow(m_log_buf, LINE_OVERHEAD), LINE_OVERHEAD, m_time_formatter, e,
+      crash, index, m_thread_names ? &m_thread_name_cache : nullptr);
+    m_log_buf.resize(cur + used);
+    _index_entry(e, m_index_base + cur);
+    _write_segments(e);
+    return written;
+  }
 
-  {
-    std::scoped_lock lock2(m_queue_mutex);
-    m_queue_mutex_holder = pthread_self();
-    assert(m_flush.empty());
-    m_flush.swap(m_new);
-    m_cond_loggers.notify_all();
-    m_queue_mutex_holder = 0;
+  if (do_fd || do_sinks) {
+    auto& out = file ? file->buf : m_log_buf;
+    const std::size_t cur = out.size();
+    const std::size_t allocated = len + LINE_OVERHEAD;
+    char* pos = grow(out, allocated);
+    std::size_t used;
+    if (pieces) {
+      used = format_prefix(pos, allocated, m_time_formatter, e, crash, index,
+			   m_thread_names ? &m_thread_name_cache : nullptr);
+      used += copy_segments(e, pos + used);
+      pos[used] = '\0';
+    } else {
+      used = format_line(
+	pos, allocated, m_time_formatter, e, str, crash, index,
+	m_thread_names ? &m_thread_name_cache : nullptr);
+    }
+
+    if (do_sinks) {
+      _sink_append((do_syslog ? m_syslog_sink.get_mask() : 0) |
+		   (do_stderr ? m_stderr_sink.get_mask() : 0) |
+		   (do_graylog2 ? m_network_sink.get_mask() : 0) |
+		   (do_journald ? m_journald_sink.get_mask() : 0),
+		   &e, std::string_view(pos, used), len, true);
+    }
+
+    /* now add newline */
+    pos[used++] = '\n';
+
+    if (do_fd) {
+      out.resize(cur + used);
+      if (!file) {
+	_index_entry(e, m_index_base + cur);
+      }
+    } else {
+      out.resize(cur);
+    }
+
+    if (file && file->buf.size() > m_log_buf_size) {
+      _flush_subsys_file(*file);
+    }
+    if (m_log_buf.size() > m_log_buf_size ||
+	(m_sink_batch && m_sink_batch->text.size() > m_log_buf_size)) {
+      _flush_logbuf();
+    }
   }
 
-  _flush(m_flush, true, false);
-  m_flush_mutex_holder = 0;
+  return written;
 }
 
-void Log::_log_safe_write(std::string_view sv)
+/// true if e repeats the last line written and should only be counted
+bool Log::_is_repeat(const Entry& e, std::string_view str)
 {
-  if (m_fd < 0)
-    return;
-  int r = safe_write(m_fd, sv.data(), sv.size());
-  if (r != m_fd_last_error) {
-    if (r < 0)
-      std::cerr << "problem writing to " << m_log_file
-           << ": " << cpp_strerror(r) << std::endl;
-    m_fd_last_error = r;
+  // hash only the body: the prefix (stamp, thread) differs every time
+  const auto hash = std::hash<std::string_view>{}(str);
+  auto& r = m_repeat;
+  if (r.valid && r.hash == hash && r.body.size() == str.size() &&
+      r.subsys == e.m_subsys &&
+      memcmp(r.body.data(), str.data(), str.size()) == 0) {
+    if (r.count++ == 0) {
+      r.first = e.stamp();
+    }
+    r.last = e.stamp();
+    r.prio = e.m_prio;
+    r.thread = e.m_thread;
+    return true;
   }
+  _flush_repeats(true);
+  r.valid = true;
+  r.hash = hash;
+  r.body.assign(str);
+  r.subsys = e.m_subsys;
+  r.prio = e.m_prio;
+  return false;
 }
 
-void Log::_flush_logbuf()
+/// write "last message repeated N times" for suppressed repeats; unless
+/// forced, only once a run of repeats has lasted a second, so that a storm
+/// still shows up in the log periodically
+void Log::_flush_repeats(bool force)
 {
-  if (m_log_buf.size()) {
-    _log_safe_write(std::string_view(m_log_buf.data(), m_log_buf.size()));
-    m_log_buf.resize(0);
+  auto& r = m_repeat;
+  if (r.count == 0) {
+    return;
   }
+  auto ns = [](const log_time& t) {
+    return t.time_since_epoch().count().count;
+  };
+  if (!force && ns(Entry::clock().now()) - ns(r.first) < 1000000000ull) {
+    return;
+  }
+  ConcreteEntry summary(r.prio, r.subsys);
+  summary.set_stamp(r.last);
+  summary.m_thread = r.thread;
+  char buf[64];
+  int n = snprintf(buf, sizeof(buf), "last message repeated %" PRIu64 " times",
+		   r.count);
+  summary.buffer().assign(buf, buf + n);
+  r.count = 0;
+  // keep comparing against the repeated line, not the summary
+  const bool suppress = m_suppress_repeats;
+  m_suppress_repeats = false;
+  if (_flush_entry(summary, false, 0) && m_pipelining) {
+    m_pipeline_batch.push_back(std::move(summary));
+  }
+  m_suppress_repeats = suppress;
 }
 
 void Log::_flush(EntryVector& t, bool requeue, bool crash)
@@ -222,117 +3497,386 @@ void Log::_flush(EntryVector& t, bool requeue, bool crash)
   if (!requeue && t.empty()) {
     return;
   }
+  uint64_t written = 0, bytes = 0;
+  [[maybe_unused]] const std::size_t batch = t.size();
+  CEPH_LOG_PROBE1(flush_start, batch);
+  m_pipelining = !crash && _use_pipeline();
+  const bool count = m_governor_level >= 0;
+  // past stop()'s deadline, which may come while in here, only errors
+  // are still written
+  bool late = false;
+  std::size_t n = 0;
+  const uint64_t now = crash ? 0 :
+    Entry::clock().now().time_since_epoch().count().count;
+  bool error = false;
+  const bool trace = !crash && m_trace_fd >= 0;
   for (auto& e : t) {
-    auto prio = e.m_prio;
-    auto stamp = e.m_stamp;
-    auto sub = e.m_subsys;
-    auto thread = e.m_thread;
-    auto str = e.strv();
-
-    bool should_log = crash || m_subs->get_log_level(sub) >= prio;
-    bool do_fd = m_fd >= 0 && should_log;
-    bool do_syslog = m_syslog_crash >= prio && should_log;
-    bool do_stderr = m_stderr_crash >= prio && should_log;
-    bool do_graylog2 = m_graylog_crash >= prio && should_log;
-
-    if (do_fd || do_syslog || do_stderr) {
-      const std::size_t cur = m_log_buf.size();
-      std::size_t used = 0;
-      const std::size_t allocated = e.size() + 80;
-      m_log_buf.resize(cur + allocated);
-
-      char* const start = m_log_buf.data();
-      char* pos = start + cur;
-
-      if (crash) {
-        used += (std::size_t)snprintf(pos + used, allocated - used, "%6ld> ", -(--len));
-      }
-      used += (std::size_t)append_time(stamp, pos + used, allocated - used);
-      used += (std::size_t)snprintf(pos + used, allocated - used, " %lx %2d ", (unsigned long)thread, prio);
-      memcpy(pos + used, str.data(), str.size());
-      used += str.size();
-      pos[used] = '\0';
-      ceph_assert((used + 1 /* '\n' */) < allocated);
-
-      if (do_syslog) {
-        syslog(LOG_USER|LOG_INFO, "%s", pos);
-      }
-
-      if (do_stderr) {
-        std::cerr << m_log_stderr_prefix << std::string_view(pos, used) << std::endl;
+    if (!crash && !late && ++n % 64 == 0 &&
+	m_stop_deadline.load(std::memory_order_relaxed)) {
+      late = std::chrono::steady_clock::now() >= _stop_deadline();
+    }
+    if (late && e.m_prio > ERROR_PRIO) {
+      ++m_stop_dropped;
+      if (trace) {
+	_trace_entry(e, false);
       }
-
-      /* now add newline */
-      pos[used++] = '\n';
-
-      if (do_fd) {
-        m_log_buf.resize(cur + used);
-      } else {
-        m_log_buf.resize(0);
+      e.release_stream(m_recycled);
+      continue;
+    }
+    if (count && e.m_subsys >= 0 &&
+	(std::size_t)e.m_subsys < m_governor_counts.size()) {
+      ++m_governor_counts[e.m_subsys];
+    }
+    const bool flushed = _flush_entry(e, crash, crash ? -(--len) : 0);
+    if (trace) {
+      _trace_entry(e, flushed);
+    }
+    if (flushed) {
+      // without rendering an entry a format worker is still to render
+      const std::size_t size = e.payload_size();
+      error |= e.m_prio <= ERROR_PRIO;
+      ++written;
+      bytes += size;
+      _count_written(e, size);
+      if (!crash) {
+	const uint64_t stamp = e.stamp().time_since_epoch().count().count;
+	m_entry_lat.record(now > stamp ? now - stamp : 0);
       }
-
-      if (m_log_buf.size() > MAX_LOG_BUF) {
-        _flush_logbuf();
+      if (m_pipelining) {
+	if (requeue && !e.m_recorded) {
+	  _recent_for(e).push_back(e);
+	}
+	m_pipeline_bytes += size;
+	m_pipeline_batch.push_back(std::move(e));
+	if (m_pipeline_bytes > m_log_buf_size) {
+	  _flush_logbuf();
+	}
+	continue;
       }
     }
 
-    if (do_graylog2 && m_graylog) {
-      m_graylog->log_entry(e);
-    }
-
-    if (requeue) {
-      m_recent.push_back(std::move(e));
+    if (requeue && !e.m_recorded) {
+      _recent_for(e).push_back(e);
     }
+    e.release_stream(m_recycled);
+  }
+  if (m_perf && !t.empty()) {
+    m_perf->inc(l_log_written, written);
+    m_perf->hinc(l_log_flush_batch, t.size(), bytes);
+  }
+  if (written) {
+    _note_unsynced(error);
   }
   t.clear();
+  CachedStackStringStream::recycle(m_recycled);
+  if (trace && m_trace_buf.size() >= TRACE_WRITE_SIZE) {
+    _write_trace();
+  }
 
+  if (!crash) {
+    _flush_repeats(false);
+  }
   _flush_logbuf();
+  m_pipelining = false;
+  CEPH_LOG_PROBE3(flush_end, batch, written, bytes);
 }
 
 void Log::_log_message(const char *s, bool crash)
 {
+  _log_file_message(s);
+  const bool do_syslog = (crash ? m_syslog_crash : m_syslog_log) >= 0;
+  const bool do_stderr = (crash ? m_stderr_crash : m_stderr_log) >= 0;
+  const bool do_graylog2 = (crash ? m_graylog_crash : m_graylog_log) >= 0;
+  const bool do_journald = (crash ? m_journald_crash : m_journald_log) >= 0;
+  if (do_syslog || do_stderr || do_graylog2 || do_journald) {
+    const std::size_t len = strlen(s);
+    _sink_append((do_syslog ? m_syslog_sink.get_mask() : 0) |
+		 (do_stderr ? m_stderr_sink.get_mask() : 0) |
+		 (do_graylog2 ? m_network_sink.get_mask() : 0) |
+		 (do_journald ? m_journald_sink.get_mask() : 0),
+		 nullptr, std::string_view(s, len), len, false);
+    // after anything buffered before it, and without waiting for the next
+    // flush
+    _flush_sinks();
+  }
+}
+
+void Log::_log_file_message(const char *s)
+{
+  if (m_shm_ring.is_open()) {
+    const std::string_view msg(s);
+    m_shm_ring.append(binary::make_message_header(msg), msg);
+  }
   if (m_fd >= 0) {
+    _drain_writer(); // keep ordering with buffered entries
+
     size_t len = strlen(s);
     std::string b;
-    b.reserve(len + 1);
-    b.append(s, len);
-    b += '\n';
-    int r = safe_write(m_fd, b.c_str(), b.size());
-    if (r < 0)
-      std::cerr << "problem writing to " << m_log_file << ": " << cpp_strerror(r) << std::endl;
+    if (m_log_format == LogFormat::BINARY) {
+      auto h = binary::make_message_header(std::string_view(s, len));
+      b.reserve(sizeof(h) + len);
+      b.append(reinterpret_cast<const char*>(&h), sizeof(h));
+      b.append(s, len);
+    } else if (m_log_format == LogFormat::JSON) {
+      LogBuffer line;
+      line.reserve(len + 16);
+      line.insert(line.end(), {'{', '"', 'm', 's', 'g', '"', ':'});
+      append_json_string(line, std::string_view(s, len));
+      line.insert(line.end(), {'}', '\n'});
+      b.assign(line.data(), line.size());
+    } else {
+      b.reserve(len + 1);
+      b.append(s, len);
+      b += '\n';
+    }
+    if (_compress(b)) {
+      _log_safe_write(std::string_view(m_compress_buf.data(),
+				       m_compress_buf.size()));
+    } else {
+      _log_safe_write(b);
+      if (m_index_base >= 0) {
+	m_index_base += b.size();
+      }
+    }
+  }
+}
+
+/// refresh m_utc_offset every hour, to follow DST changes
+void Log::_update_utc_offset()
+{
+  const auto now = ceph::coarse_mono_clock::now();
+  if (now < m_utc_offset_at) {
+    return;
+  }
+  m_utc_offset_at = now + std::chrono::hours(1);
+  time_t t = time(nullptr);
+  std::tm bdt;
+  localtime_r(&t, &bdt);
+  m_utc_offset.store(bdt.tm_gmtoff, std::memory_order_relaxed);
+}
+
+/// "%*ld" into out, without snprintf
+static std::size_t append_number(char *out, long v, int width)
+{
+  char digits[24];
+  int n = 0;
+  unsigned long u = v < 0 ? -(unsigned long)v : v;
+  do {
+    digits[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0) {
+    digits[n++] = '-';
+  }
+  std::size_t used = 0;
+  for (int i = n; i < width; ++i) {
+    out[used++] = ' ';
+  }
+  while (n) {
+    out[used++] = digits[--n];
+  }
+  return used;
+}
+
+static constexpr std::size_t CRASH_BUF = 1 << 16;
+static constexpr std::size_t CRASH_PREFIX = 128; ///< room for index, stamp, ...
+
+/// Unlike dump_recent() this takes no lock it can't get, allocates nothing
+/// and doesn't go through the writer, the pipeline or the sinks: the ring
+/// and the queued entries are read in place and formatted into a static
+/// buffer that is written out with write(2) as it fills. The one exception
+/// is rendering deferred entries, which runs their arguments' operator<<.
+/// Entries still in queue shards or thread rings are not included.
+///
+/// The log file (or its mapping) is the log thread's while it flushes, so
+/// unless the flush lock could be had the dump goes to stderr instead. A
+/// compressed log gets the dump as stored, uncompressed frames, which
+/// leaves the compressor and m_compress_buf alone.
+void Log::dump_recent_crash(int fd, std::string_view note)
+{
+  static std::atomic<bool> dumping{false};
+  static char buf[CRASH_BUF];
+  static char scratch[CRASH_BUF - CRASH_PREFIX];
+  static char frame[CRASH_BUF + LogCompressor::STORE_OVERHEAD];
+  if (dumping.exchange(true)) {
+    // another thread is already crashing
+    return;
+  }
+
+  // give a flush in progress a moment to finish, then read the ring anyway
+  bool flush_locked = false;
+  for (int i = 0; i < 1000 && !(flush_locked = m_flush_mutex.try_lock()); ++i) {
+    struct timespec ts = {0, 1000000};
+    nanosleep(&ts, nullptr);
+  }
+  if (fd < 0 && !flush_locked) {
+    fd = STDERR_FILENO;
+  }
+  if (fd < 0 && m_fd < 0) {
+    m_flush_mutex.unlock();
+    dumping = false;
+    return;
+  }
+  const bool queue_locked = m_queue_mutex.try_lock();
+
+  const bool binary = m_log_format == LogFormat::BINARY;
+  const long utc_offset = m_utc_offset.load(std::memory_order_relaxed);
+  std::size_t len = 0;
+  auto flush_buf = [&] {
+    if (!len) {
+      return;
+    }
+    std::string_view sv(buf, len);
+    len = 0;
+    if (fd >= 0) {
+      (void)safe_write(fd, sv.data(), sv.size());
+      return;
+    }
+    if (m_compressor) {
+      if (auto n = m_compressor->store(sv, frame, sizeof(frame)); n > 0) {
+	sv = std::string_view(frame, n);
+      }
+    }
+    if (m_mmap.is_open() && m_mmap.write(sv) == 0) {
+      return;
+    }
+    (void)safe_write(m_fd, sv.data(), sv.size());
+  };
+  auto message = [&](std::string_view s) {
+    if (len + CRASH_PREFIX + s.size() > CRASH_BUF) {
+      flush_buf();
+    }
+    if (binary) {
+      auto h = binary::make_message_header(s);
+      memcpy(buf + len, &h, sizeof(h));
+      len += sizeof(h);
+    }
+    memcpy(buf + len, s.data(), s.size());
+    len += s.size();
+    if (!binary) {
+      buf[len++] = '\n';
+    }
+  };
+  auto entry = [&](const Entry& e, std::string_view str, long index) {
+    str = str.substr(0, CRASH_BUF - CRASH_PREFIX);
+    if (len + CRASH_PREFIX + str.size() > CRASH_BUF) {
+      flush_buf();
+    }
+    if (binary) {
+      auto h = binary::make_header(e, str.size(), true, index);
+      memcpy(buf + len, &h, sizeof(h));
+      len += sizeof(h);
+    } else {
+      len += append_number(buf + len, index, 6);
+      buf[len++] = '>';
+      buf[len++] = ' ';
+      len += append_time_signal_safe(e.stamp(), utc_offset, buf + len, 40);
+      len += append_thread_prio(buf + len, e.m_thread, e.m_prio);
+    }
+    memcpy(buf + len, str.data(), str.size());
+    len += str.size();
+    if (!binary) {
+      buf[len++] = '\n';
+    }
+  };
+
+  while (!note.empty()) {
+    auto eol = note.find('\n');
+    message(note.substr(0, std::min(eol, CRASH_BUF - CRASH_PREFIX)));
+    note.remove_prefix(eol == note.npos ? note.size() : eol + 1);
+  }
+  message("--- begin dump of recent events ---");
+  long index = queue_locked ?
+    m_errors.size() + m_new.size() - m_new_dropped.size() : 0;
+  _for_each_recent([&](const auto& e, long i) {
+    entry(e, e.strv(), i);
+  }, [&](long skipped) {
+    if (skipped < 0) {
+      message("--- thread rings busy, not included ---");
+    } else if (skipped > 0) {
+      char line[CRASH_PREFIX];
+      std::size_t n = 0;
+      memcpy(line, "--- ", 4);
+      n += 4;
+      n += append_number(line + n, skipped, 0);
+      const std::string_view rest = " thread rings not included ---";
+      memcpy(line + n, rest.data(), rest.size());
+      message(std::string_view(line, n + rest.size()));
+    }
+  }, true, index, scratch, sizeof(scratch));
+  if (queue_locked) {
+    // submitted but never flushed, e.g. the message about the signal
+    for (auto *q : {&m_errors, &m_new}) {
+      for (uint32_t i = 0; i < q->size(); ++i) {
+	if (q == &m_new &&
+	    std::find(m_new_dropped.begin(), m_new_dropped.end(), i) !=
+	      m_new_dropped.end()) {
+	  continue; // dropped by DROP_LOWEST_PRIORITY
+	}
+	auto& e = (*q)[i];
+	entry(e, e.strv_into(scratch, sizeof(scratch)), -(--index));
+      }
+    }
   }
-  if ((crash ? m_syslog_crash : m_syslog_log) >= 0) {
-    syslog(LOG_USER|LOG_INFO, "%s", s);
+
+  message("--- logging levels ---");
+  for (const auto& p : m_subs->m_subsys) {
+    char line[CRASH_PREFIX];
+    std::size_t n = 0;
+    line[n++] = ' ';
+    n += append_number(line + n, p.log_level, 3);
+    line[n++] = '/';
+    n += append_number(line + n, p.gather_level, 2);
+    line[n++] = ' ';
+    std::string_view name(p.name);
+    name = name.substr(0, sizeof(line) - n);
+    memcpy(line + n, name.data(), name.size());
+    message(std::string_view(line, n + name.size()));
   }
+  message("--- end dump of recent events ---");
+  flush_buf();
 
-  if ((crash ? m_stderr_crash : m_stderr_log) >= 0) {
-    std::cerr << s << std::endl;
+  if (queue_locked) {
+    m_queue_mutex.unlock();
+  }
+  if (flush_locked) {
+    m_flush_mutex.unlock();
   }
+  dumping = false;
 }
 
 void Log::dump_recent()
 {
   std::scoped_lock lock1(m_flush_mutex);
-  m_flush_mutex_holder = pthread_self();
+  lock_holder holder1(flush_mutex_holder, this);
 
+  // we may be about to die; write synchronously so nothing is left queued
+  _drain_writer();
+  const bool async_write = m_async_write;
+  m_async_write = false;
+  const unsigned format_threads = m_format_threads;
+  m_format_threads = 0;
+  m_dumping = true;
+
+  _flush_errors();
+  std::unique_lock rings_lock(m_rings_mutex, std::defer_lock);
   {
     std::scoped_lock lock2(m_queue_mutex);
-    m_queue_mutex_holder = pthread_self();
-    assert(m_flush.empty());
-    m_flush.swap(m_new);
-    m_queue_mutex_holder = 0;
+    lock_holder holder2(queue_mutex_holder, this);
+    rings_lock.lock();
+    _take_new();
   }
+  _erase_dropped(m_flush, m_flush_dropped);
+  _drain_pending(m_flush, false, rings_lock);
 
   _flush(m_flush, true, false);
+  _flush_repeats(true);
   _flush_logbuf();
 
   _log_message("--- begin dump of recent events ---", true);
-  {
-    EntryVector t;
-    t.insert(t.end(), std::make_move_iterator(m_recent.begin()), std::make_move_iterator(m_recent.end()));
-    m_recent.clear();
-    _flush(t, true, true);
-  }
+  _for_each_recent([this](const auto& e, long index) {
+    _flush_entry(e, true, index);
+  }, [](long) {}, false, 0, nullptr, 0);
 
   char buf[4096];
   _log_message("--- logging levels ---", true);
@@ -345,41 +3889,432 @@ void Log::dump_recent()
   _log_message(buf, true);
   sprintf(buf, "  %2d/%2d (stderr threshold)", m_stderr_log, m_stderr_crash);
   _log_message(buf, true);
-  sprintf(buf, "  max_recent %9zu", m_max_recent);
+  sprintf(buf, "  %2d/%2d (graylog threshold)", m_graylog_log, m_graylog_crash);
+  _log_message(buf, true);
+  sprintf(buf, "  %2d/%2d (journald threshold)", m_journald_log,
+	  m_journald_crash);
+  _log_message(buf, true);
+  sprintf(buf, "  max_recent %9zu",
+	  m_max_recent.load(std::memory_order_relaxed));
+  _log_message(buf, true);
+  sprintf(buf, "  recent_bytes %7zu", m_recent.capacity_bytes());
+  _log_message(buf, true);
+  for (std::size_t i = 0; i < m_subsys_recent.size(); ++i) {
+    std::size_t len = snprintf(buf, sizeof(buf), "  recent_bytes %7zu (",
+			       m_subsys_recent[i]->capacity_bytes());
+    const char *sep = "";
+    for (unsigned sub = 0; sub < m_subsys_recent_route.size(); ++sub) {
+      if (m_subsys_recent_route[sub] == (int)i && len < sizeof(buf)) {
+	len += snprintf(buf + len, sizeof(buf) - len, "%s%s", sep,
+			m_subs->get_name(sub));
+	sep = ",";
+      }
+    }
+    if (len < sizeof(buf)) {
+      snprintf(buf + len, sizeof(buf) - len, ")");
+    }
+    _log_message(buf, true);
+  }
+  snprintf(buf, sizeof(buf), "  recent_pages %s (log_huge_pages %s)",
+	   m_recent.backing(), huge_pages_name(get_huge_pages()));
   _log_message(buf, true);
   sprintf(buf, "  max_new    %9zu", m_max_new);
   _log_message(buf, true);
+  sprintf(buf, "  max_new_bytes %6zu", m_max_new_bytes);
+  _log_message(buf, true);
+  sprintf(buf, "  dropped    %9" PRIu64, get_dropped());
+  _log_message(buf, true);
   sprintf(buf, "  log_file %s", m_log_file.c_str());
   _log_message(buf, true);
 
   _log_message("--- end dump of recent events ---", true);
 
   _flush_logbuf();
+  m_async_write = async_write;
+  m_format_threads = format_threads;
+  m_dumping = false;
+}
+
+std::size_t Log::for_each_recent(const RecentFilter& filter,
+				 const std::function<bool(const Entry&)>& f)
+{
+  std::vector<std::unique_ptr<RecentRing>> rings;
+  std::size_t max_recent;
+  {
+    // only for as long as the copy takes, not for the whole walk
+    std::scoped_lock lock(m_flush_mutex);
+    lock_holder holder(flush_mutex_holder, this);
+    rings.push_back(std::make_unique<RecentRing>(0, 0));
+    rings.back()->copy_from(m_recent);
+    for (auto& r : m_subsys_recent) {
+      rings.push_back(std::make_unique<RecentRing>(0, 0));
+      rings.back()->copy_from(*r);
+    }
+    max_recent = m_max_recent.load(std::memory_order_relaxed);
+  }
+  // the subsystems' own rings, after m_recent, aren't held to max_recent
+  const std::size_t uncapped_end = rings.size();
+  {
+    std::scoped_lock lock(m_rings_mutex);
+    for (auto& t : m_thread_recent) {
+      auto ring = std::make_unique<RecentRing>(0, 0);
+      std::scoped_lock ring_lock(t->lock);
+      ring->copy_from(t->ring);
+      rings.push_back(std::move(ring));
+    }
+  }
 
-  m_flush_mutex_holder = 0;
+  std::vector<RecentRing::Cursor> cursors;
+  std::size_t total = 0;
+  for (std::size_t i = 0; i < rings.size(); ++i) {
+    cursors.push_back(rings[i]->cursor());
+    if (i == 0 || i >= uncapped_end) {
+      total += rings[i]->size();
+    }
+  }
+  // as dump_recent() would have it
+  std::size_t skip = total > max_recent ? total - max_recent : 0;
+  std::size_t visited = 0;
+  for (bool more = true; more; ) {
+    std::size_t oldest = rings.size();
+    uint64_t oldest_stamp = 0;
+    for (std::size_t i = 0; i < rings.size(); ++i) {
+      if (!rings[i]->valid(cursors[i])) {
+	continue;
+      }
+      const uint64_t stamp = rings[i]->stamp(cursors[i]);
+      if (oldest == rings.size() || stamp < oldest_stamp) {
+	oldest = i;
+	oldest_stamp = stamp;
+      }
+    }
+    if (oldest == rings.size()) {
+      break;
+    }
+    auto& ring = *rings[oldest];
+    auto& c = cursors[oldest];
+    if (skip && (oldest == 0 || oldest >= uncapped_end)) {
+      --skip;
+      ring.next(c);
+    } else if (oldest_stamp > filter.to) {
+      break; // nothing newer can match either
+    } else if (!filter.match(ring.header(c))) {
+      // deferred entries are left unformatted
+      ring.next(c);
+    } else {
+      ring.visit(c, [&](const auto& e) { more = f(e); });
+      ++visited;
+    }
+  }
+  return visited;
 }
 
 void Log::start()
 {
   ceph_assert(!is_started());
+  {
+    std::scoped_lock lock(m_flush_mutex);
+    _update_utc_offset();
+  }
   {
     std::scoped_lock lock(m_queue_mutex);
     m_stop = false;
   }
+  if (m_use_inline) {
+    {
+      // submitters write for themselves from here on, once the file is open
+      std::scoped_lock lock(m_flush_mutex);
+      lock_holder holder(flush_mutex_holder, this);
+      m_inline = true;
+      _reopen_log_file();
+    }
+    flush(); // whatever was queued before
+    if (m_inline_buffered) {
+      set_flush_on_exit(); // or the tail of the buffer is lost
+    }
+    return;
+  }
+  if (m_use_shared) {
+    m_shared = true;
+    reopen_log_file();
+    SharedFlusher::get().add(this);
+    return;
+  }
   create("log");
 }
 
+void Log::set_inline(bool inline_write, bool buffered)
+{
+  // inline_write takes effect at the next start(), buffered at once
+  std::scoped_lock lock(m_flush_mutex);
+  m_use_inline = inline_write;
+  m_inline_buffered = buffered;
+}
+
+void Log::set_shared_flusher(bool shared)
+{
+  // takes effect at the next start()
+  std::scoped_lock lock(m_flush_mutex);
+  m_use_shared = shared;
+}
+
 void Log::stop()
 {
   if (is_started()) {
     {
       std::scoped_lock lock(m_queue_mutex);
+      if (m_stop_timeout.count() > 0) {
+	// also cuts short a flush the log thread is in the middle of
+	m_stop_deadline.store(
+	  std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    (std::chrono::steady_clock::now() + m_stop_timeout)
+	    .time_since_epoch()).count());
+      }
       m_stop = true;
       m_cond_flusher.notify_one();
       m_cond_loggers.notify_all();
     }
-    join();
+    if (m_inline) {
+      m_inline = false;
+      flush();
+    } else if (m_shared) {
+      SharedFlusher::get().remove(this);
+      flush(); // as entry() does on its way out
+      m_shared = false;
+    } else {
+      join();
+    }
+  }
+  std::scoped_lock lock(m_flush_mutex);
+  _stop_writer();
+  _write_trace();
+  const auto until = _stop_deadline();
+  m_stderr_sink.stop(until);
+  m_syslog_sink.stop(until);
+  m_network_sink.stop(until);
+  m_journald_sink.stop(until);
+  m_stop_deadline.store(0);
+}
+
+void Log::prepare_fork()
+{
+  // Nothing is stopped or written out: the locks are only held so that
+  // no thread is part way through a change to what they protect, which
+  // the child would otherwise find half done.  The writers and sinks are
+  // taken last, with the flusher shut out above them.
+  m_fork_held = !is_inside_log_lock() && !_on_flusher();
+  if (!m_fork_held) {
+    // forking from the log's own threads or under its locks, which
+    // nothing here should; leave it be rather than wait on ourselves
+    return;
+  }
+  m_flush_mutex.lock();
+  m_queue_mutex.lock();
+  m_rings_mutex.lock();
+  for (auto& t : m_thread_recent) {
+    t->lock.lock();
+  }
+  for (std::size_t i = 0; i < m_num_cpus; ++i) {
+    m_shards[i].lock.lock();
+  }
+  if (m_pipeline) {
+    m_pipeline->prepare_fork();
+  }
+  if (m_writer) {
+    m_writer->prepare_fork();
+  }
+  for (auto& f : m_subsys_files) {
+    if (f.writer) {
+      f.writer->prepare_fork();
+    }
+  }
+  m_stderr_sink.prepare_fork();
+  m_syslog_sink.prepare_fork();
+  m_network_sink.prepare_fork();
+  m_journald_sink.prepare_fork();
+}
+
+void Log::after_fork(bool child)
+{
+  if (!m_fork_held) {
+    return;
+  }
+  m_journald_sink.after_fork(child);
+  m_network_sink.after_fork(child);
+  m_syslog_sink.after_fork(child);
+  m_stderr_sink.after_fork(child);
+  for (auto& f : m_subsys_files) {
+    if (f.writer) {
+      f.writer->after_fork(child);
+    }
+  }
+  if (m_writer) {
+    m_writer->after_fork(child);
+  }
+  if (m_pipeline) {
+    m_pipeline->after_fork(child);
+  }
+  if (child) {
+    _reset_after_fork();
+  }
+  for (std::size_t i = 0; i < m_num_cpus; ++i) {
+    m_shards[i].lock.unlock();
+  }
+  for (auto& t : m_thread_recent) {
+    t->lock.unlock();
+  }
+  m_rings_mutex.unlock();
+  m_queue_mutex.unlock();
+  m_flush_mutex.unlock();
+  m_fork_held = false;
+}
+
+/// the child's half of after_fork(), with every lock still held.  The
+/// parent's threads aren't here, so the child comes up stopped, and starts
+/// when it calls start(), as global_init_postfork_start() does: threads
+/// started here would be wasted on a child that is about to exec().
+void Log::_reset_after_fork()
+{
+  if (is_started()) {
+    // queued and buffered, they are the parent's to write, which it goes
+    // on to do; a Log stopped before the fork had nobody to write them
+    // but whichever of the two starts it, so keeps them
+    _discard_queued();
+    m_log_buf.clear();
+    m_compress_buf.clear();
+    m_sink_batch.reset();
+    m_pipeline_batch.clear();
+    m_pipeline_bytes = 0;
+    m_pipelining = false;
+    for (auto& f : m_subsys_files) {
+      f.buf.clear();
+    }
+    // no longer where the file ends; found again when it is reopened
+    m_index_base = -1;
+  }
+  if (Thread::is_started()) {
+    forget_after_fork();
+  }
+  // SharedFlusher::after_fork() forgot the log already
+  m_shared = false;
+  m_inline = false;
+  m_stop = true;
+  // made anew over the parent's, which the writer threads' destructors
+  // don't wait for now
+  m_pipeline.reset();
+  m_writer.reset();
+  for (auto& f : m_subsys_files) {
+    f.writer.reset();
+  }
+  // producers may have been waiting in the parent; they aren't here.
+  // Not destroyed first, as that may wait for those very waiters.
+  new (&m_cond_loggers) queue_cond;
+  new (&m_cond_flusher) queue_cond;
+  // the trace is a chain of deltas the two can't both append to; the
+  // parent's buffered records are its own to write
+  if (m_trace_fd >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(m_trace_fd));
+    m_trace_fd = -1;
+    m_trace_buf.clear();
+    m_trace_threads.clear();
+  }
+  // only this thread's rings will be pushed to again
+  for (auto& ring : m_rings) {
+    if (std::none_of(thread_rings.rings.begin(), thread_rings.rings.end(),
+		     [&ring](const auto& r) { return r.second == ring; })) {
+      ring->detach();
+    }
+  }
+  for (auto& t : m_thread_recent) {
+    if (std::none_of(thread_rings.recent.begin(), thread_rings.recent.end(),
+		     [&t](const auto& r) { return r.second == t; })) {
+      t->detached = true;
+    }
+  }
+}
+
+/// drop every queued entry unwritten; needs all the locks prepare_fork()
+/// takes
+void Log::_discard_queued()
+{
+  m_new.clear();
+  m_new_bytes = 0;
+  m_new_dropped.clear();
+  _index_new();
+  m_spill.clear();
+  m_spill_bytes = 0;
+  m_errors.clear();
+  m_flush_waiters.clear();
+  for (std::size_t i = 0; i < m_num_cpus; ++i) {
+    m_shards[i].q.clear();
+    m_shards[i].bytes = 0;
+    m_shards[i].busy.store(false, std::memory_order_relaxed);
+  }
+  for (auto& ring : m_rings) {
+    ring->drain([](ConcreteEntry&&) {});
+  }
+#ifdef CEPH_LOG_LOCKFREE
+  ConcreteEntry *e;
+  while (m_lockfree.pop(e)) {
+    delete e;
+  }
+  m_lockfree_size = 0;
+  m_lockfree_bytes = 0;
+#endif
+  m_reorder.clear();
+  m_reorder_due = 0;
+}
+
+/// whether the flusher has work; needs m_queue_mutex
+bool Log::_flush_pending()
+{
+  return !m_new.empty() || !m_errors.empty() || !m_flush_waiters.empty() ||
+    _rings_pending() ||
+    _shards_pending() || _lockfree_pending() || _reorder_due() ||
+    _governor_due() || _sync_due();
+}
+
+/// announce that the flusher is going to sleep; false if, re-checking the
+/// rings, it turns out it shouldn't.  A producer that pushes after the
+/// re-check is guaranteed to see the flag and wake it under m_queue_mutex.
+bool Log::_flusher_sleep()
+{
+  m_flusher_idle.store(true);
+  if (_rings_pending() || _shards_pending() || _lockfree_pending()) {
+    m_flusher_idle.store(false);
+    return false;
+  }
+  return true;
+}
+
+/// when the sleeping flusher has to look again even if nobody wakes it;
+/// needs m_queue_mutex
+std::chrono::steady_clock::time_point Log::_flusher_due() const
+{
+  auto until = std::chrono::steady_clock::time_point::max();
+  if (auto due = m_reorder_due.load(); due) {
+    // wake up in time to release the held entries
+    until = std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+	std::chrono::nanoseconds(due)));
+  }
+  if (m_flush_batch > 1) {
+    until = std::min(until,
+		     std::chrono::steady_clock::now() + m_flush_max_delay);
+  }
+  if (auto due = m_governor_due.load(); due) {
+    // to restore the levels the governor lowered
+    until = std::min(until, std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+	std::chrono::nanoseconds(due))));
   }
+  if (auto due = m_sync_due.load(); due) {
+    // to sync what was written an interval ago
+    until = std::min(until, std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+	std::chrono::nanoseconds(due))));
+  }
+  return until;
 }
 
 void *Log::entry()
@@ -387,30 +4322,58 @@ void *Log::entry()
   reopen_log_file();
   {
     std::unique_lock lock(m_queue_mutex);
-    m_queue_mutex_holder = pthread_self();
+    queue_mutex_holder = this;
     while (!m_stop) {
-      if (!m_new.empty()) {
-        m_queue_mutex_holder = 0;
+      if (_flush_pending()) {
+        queue_mutex_holder = nullptr;
         lock.unlock();
         flush();
         lock.lock();
-        m_queue_mutex_holder = pthread_self();
+        queue_mutex_holder = this;
         continue;
       }
-
-      m_cond_flusher.wait(lock);
+      if (!_flusher_sleep()) {
+        continue;
+      }
+      if (auto until = _flusher_due(); until != until.max()) {
+	m_cond_flusher.wait_until(lock, until);
+      } else {
+	m_cond_flusher.wait(lock);
+      }
+      m_flusher_idle.store(false);
     }
-    m_queue_mutex_holder = 0;
+    queue_mutex_holder = nullptr;
   }
   flush();
   return NULL;
 }
 
+/// entry()'s loop, once, for the SharedFlusher: flush if there is work,
+/// else go to sleep and move due up to when to look again; true if it
+/// flushed
+bool Log::_shared_flush(std::chrono::steady_clock::time_point& due)
+{
+  {
+    std::scoped_lock lock(m_queue_mutex);
+    lock_holder holder(queue_mutex_holder, this);
+    m_flusher_idle.store(false);
+    if (m_stop) {
+      return false; // stop() flushes the rest itself
+    }
+    if (!_flush_pending()) {
+      if (_flusher_sleep()) {
+	due = std::min(due, _flusher_due());
+	return false;
+      }
+    }
+  }
+  flush();
+  return true;
+}
+
 bool Log::is_inside_log_lock()
 {
-  return
-    pthread_self() == m_queue_mutex_holder ||
-    pthread_self() == m_flush_mutex_holder;
+  return queue_mutex_holder == this || flush_mutex_holder == this;
 }
 
 void Log::inject_segv()
@@ -4,77 +4,545 @@
 #ifndef __CEPH_LOG_LOG_H
 #define __CEPH_LOG_LOG_H
 
-#include <boost/circular_buffer.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
 #include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include "common/utils/Thread.h"
+#include "common/utils/hdr_histogram.h"
+#include "common/utils/mutex_adaptive.h"
+#ifdef CEPH_PROFILE_MUTEX
+#include "common/utils/mutex_profiled.h"
+#endif
+#ifdef CEPH_LOG_LOCKFREE
+#include <boost/lockfree/queue.hpp>
+#endif
 #include "common/utils/likely.h"
+#include "AsyncWriter.h"
+#include "BinaryLog.h"
 #include "Entry.h"
+#include "FormatPipeline.h"
+#include "JournaldSink.h"
+#include "LogCompressor.h"
+#include "LogSink.h"
+#include "MmapFile.h"
+#include "NetworkSink.h"
+#include "RateLimit.h"
+#include "RecentRing.h"
+#include "ShmRing.h"
+#include "SubmitRing.h"
+#include "SubsystemMap.h"
+#include "ThreadNames.h"
+#include "TraceTag.h"
+
+class PerfCounters;
 
 namespace ceph {
 namespace logging {
 
-class SubsystemMap;
+class SharedFlusher;
+
+enum {
+  l_log_first = 67100,
+  l_log_submitted,    ///< entries handed to the flusher (excluding drops)
+  l_log_written,      ///< entries written to the log file
+  l_log_bytes,        ///< bytes written to the log file
+  l_log_dropped,      ///< entries discarded by the overflow policy
+  l_log_flush_batch,  ///< entries x bytes per flush (histogram)
+  l_log_blocked,      ///< time submitters spent waiting for the flusher
+  l_log_write_lat,    ///< latency of synchronous log file writes
+  l_log_new,          ///< entries picked up by the last flush
+  l_log_recent,       ///< entries in the recent ring
+  l_log_recent_bytes, ///< memory held by the recent ring
+  l_log_rotated,      ///< log files rotated by log_rotate_*
+  l_log_stream_spills,   ///< messages that outgrew their stream's buffer
+  l_log_stream_discards, ///< streams freed for holding too much buffer
+  l_log_pool_misses,     ///< entry text blocks EntryPool had to allocate
+  l_log_last,
+};
+
+/// what submit_entry() does when m_new already holds m_max_new entries
+enum class OverflowPolicy {
+  BLOCK,                ///< wait for the flusher to catch up
+  DROP_NEWEST,          ///< discard the entry being submitted
+  DROP_LOWEST_PRIORITY, ///< discard the most verbose queued (or new) entry
+  RECENT_ONLY,          ///< keep the entry for dump_recent() but never write it
+};
+
+/// when the log file is fdatasync()ed; see log_sync
+enum class SyncPolicy {
+  NONE,     ///< when the kernel gets round to it
+  PERIODIC, ///< by the flusher, at most an interval after a write
+  ERRORS,   ///< after each flush that wrote an entry at or below ERROR_PRIO
+};
+
+/// which recent entries Log::for_each_recent() passes on; each field left
+/// as it is matches everything
+struct RecentFilter {
+  int subsys = -1;        ///< the one subsystem
+  int max_prio = INT_MAX; ///< entries at this debug level or below
+  uint64_t thread = 0;    ///< pthread_t of the one thread
+  uint64_t from = 0;      ///< stamps, in nanoseconds since the epoch
+  uint64_t to = UINT64_MAX;
+
+  bool match(const binary::record_header& h) const {
+    return (subsys < 0 || h.subsys == subsys) && h.prio <= max_prio &&
+      (thread == 0 || h.thread == thread) && h.stamp >= from && h.stamp <= to;
+  }
+};
 
 class Log : private Thread
 {
-  using EntryRing = boost::circular_buffer<ConcreteEntry>;
   using EntryVector = std::vector<ConcreteEntry>;
 
   static const std::size_t DEFAULT_MAX_NEW = 100;
+  static const std::size_t DEFAULT_MAX_NEW_BYTES = 8 << 20;
+  /// entries at or below this (lderr and the like) take the error lane
+  static const int ERROR_PRIO = 0;
+  /// entries at or below this go out first when stop() is short of time
+  static const int STOP_PRIO = 1;
+  /// levels DROP_LOWEST_PRIORITY tells apart; more verbose ones share the last
+  static const int DROP_LEVELS = 32;
   static const std::size_t DEFAULT_MAX_RECENT = 10000;
+  static const std::size_t DEFAULT_MAX_RECENT_BYTES = 16 << 20;
+  /// entries in m_recent a compression dictionary is trained from
+  static const std::size_t COMPRESSION_DICT_SAMPLES = 1000;
 
   Log **m_indirect_this;
 
   const SubsystemMap *m_subs;
+  RateLimiter m_rate_limiter; ///< per subsystem; see log_rate_limit_*
+  TraceRegistry m_traces;     ///< see log_trace
+  TraceSampler m_trace_sampler; ///< see log_trace_sample_rate
+
+  // never ceph::mutex, whose lockdep variant logs, but profiled along with
+  // it in a CEPH_PROFILE_MUTEX build.  The queue is only held to move
+  // entries in and out, so contenders spin rather than park.
+#ifdef CEPH_PROFILE_MUTEX
+  using queue_mutex = ceph::mutex_profiled;
+  using queue_cond = ceph::condition_variable_profiled;
+  using flush_mutex = ceph::mutex_profiled;
+#else
+  using queue_mutex = ceph::mutex_adaptive;
+  using queue_cond = ceph::condition_variable_adaptive;
+  using flush_mutex = std::mutex;
+#endif
 
-  std::mutex m_queue_mutex;
-  std::mutex m_flush_mutex;
-  std::condition_variable m_cond_loggers;
-  std::condition_variable m_cond_flusher;
-
-  pthread_t m_queue_mutex_holder;
-  pthread_t m_flush_mutex_holder;
-
+  // What every submit_entry() touches starts a cache line here, and what
+  // the log thread keeps to itself (under m_flush_mutex) starts another
+  // below, so producers and the flusher don't take each other's lines.
+#ifdef CEPH_PROFILE_MUTEX
+  alignas(64) queue_mutex m_queue_mutex{"Log::m_queue_mutex"};
+#else
+  alignas(64) queue_mutex m_queue_mutex;
+#endif
+  queue_cond m_cond_loggers;
+  queue_cond m_cond_flusher;
+  bool m_stop = false;
+  std::size_t m_max_new = DEFAULT_MAX_NEW;
+  std::size_t m_max_new_bytes = DEFAULT_MAX_NEW_BYTES; ///< of footprint()s
+  OverflowPolicy m_overflow_policy = OverflowPolicy::BLOCK;
+  std::size_t m_flush_batch = 1; ///< wake the flusher when m_new reaches this
+  std::atomic<bool> m_flusher_idle{false}; ///< flusher is (about to be) asleep
+  std::atomic<bool> m_shared{false}; ///< started on the SharedFlusher
+  std::atomic<bool> m_inline{false}; ///< started inline; see set_inline()
   EntryVector m_new;    ///< new entries
-  EntryRing m_recent; ///< recent (less new) entries we've already written at low detail
+  std::size_t m_new_bytes = 0; ///< footprint() of m_new
+  EntryVector m_spill; ///< overflowed entries bound for m_recent only
+  std::size_t m_spill_bytes = 0;
+  /// DROP_LOWEST_PRIORITY's index of m_new, so that it needn't scan for a
+  /// victim: the slots of each level's entries, oldest first from head
+  struct PrioSlots {
+    std::vector<uint32_t> slots;
+    std::size_t head = 0;
+  };
+  std::array<PrioSlots, DROP_LEVELS> m_new_by_prio;
+  /// slots of m_new dropped in place, erased once m_new is taken
+  std::vector<uint32_t> m_new_dropped;
+  std::vector<uint32_t> m_flush_dropped; ///< m_new_dropped's, for m_flush
+  EntryVector m_errors; ///< the error lane, written ahead of m_new
+  /// async_flush() callers, for the next flush() to call back
+  std::vector<std::function<void()>> m_flush_waiters;
+#ifdef CEPH_LOG_LOCKFREE
+  // A CEPH_LOG_LOCKFREE build queues entries here, without taking
+  // m_queue_mutex, and only falls back to m_new (and the overflow policy)
+  // once m_max_new entries or m_max_new_bytes are waiting.  The flusher
+  // sleeps on m_cond_flusher only when it finds the queue empty.
+  boost::lockfree::queue<ConcreteEntry*> m_lockfree{DEFAULT_MAX_NEW};
+  std::atomic<std::size_t> m_lockfree_size{0};
+  std::atomic<std::size_t> m_lockfree_bytes{0}; ///< footprint() of the queued
+  std::atomic<std::size_t> m_lockfree_max{DEFAULT_MAX_NEW}; ///< m_max_new
+  std::atomic<std::size_t> m_lockfree_max_bytes{DEFAULT_MAX_NEW_BYTES};
+  std::size_t m_lockfree_capacity = DEFAULT_MAX_NEW; ///< nodes reserved; m_queue_mutex
+#endif
+  std::atomic<bool> m_error_lane{true};
+  std::atomic<bool> m_error_sync{false}; ///< submitters write and sync errors
+  std::atomic<uint64_t> m_dropped{0}; ///< entries discarded on overflow
+  std::atomic<uint64_t> m_blocked_ns{0}; ///< submitters' time waiting on m_cond_loggers
+
+#ifdef CEPH_PROFILE_MUTEX
+  alignas(64) flush_mutex m_flush_mutex{"Log::m_flush_mutex"};
+#else
+  alignas(64) flush_mutex m_flush_mutex;
+#endif
+  RecentRing m_recent; ///< recent (less new) entries we've already written at low detail
+  /// rings of their own for some subsystems' recent entries, so that a
+  /// noisy subsystem can't evict the rest from m_recent
+  std::vector<std::unique_ptr<RecentRing>> m_subsys_recent;
+  /// subsystem -> index into m_subsys_recent, or -1 for m_recent; empty
+  /// while none has a ring of its own
+  std::vector<int> m_subsys_recent_route;
+  ShmRing m_shm_ring; ///< protected by m_flush_mutex
+  EntryVector m_errors_flush; ///< m_errors being written
+  std::atomic<uint64_t> m_flush_seq{0}; ///< flush()es begun; m_flush_mutex to bump
+  uint64_t m_flush_drained = 0; ///< last of them to wait for the writer and sinks
+  /// the log file's device is past log_stop_at_utilization; entries are
+  /// not written to the file, but still to the sinks and m_recent
+  std::atomic<bool> m_file_full{false};
+  bool m_file_full_reported = false;
   EntryVector m_flush; ///< entries to be flushed (here to optimize heap allocations)
+  std::vector<ConcreteEntry::stream_ptr> m_recycled; ///< adopted streams to return
+
+  /// unique for the life of the process; keys the thread-local ring lookup
+  const uint64_t m_id;
+  std::atomic<std::size_t> m_thread_ring_size{0}; ///< 0 disables per-thread rings
+  std::mutex m_rings_mutex; ///< protects m_rings; nests inside m_queue_mutex
+  std::vector<std::shared_ptr<SubmitRing>> m_rings;
+  /// 0 keeps recording recent entries on the log thread
+  std::atomic<std::size_t> m_thread_recent_bytes{0};
+  std::vector<std::shared_ptr<ThreadRecentRing>> m_thread_recent; ///< m_rings_mutex
+
+  /// a slice of the submission queue; see set_queue_shards()
+  struct alignas(64) QueueShard {
+    std::mutex lock;
+    EntryVector q;
+    std::size_t bytes = 0; ///< footprint() of q
+    /// !q.empty(), for the flusher to skip idle shards without the lock
+    std::atomic<bool> busy{false};
+  };
+  std::unique_ptr<QueueShard[]> m_shards; ///< one per cpu, allocated up front
+  std::size_t m_num_cpus;
+  std::atomic<std::size_t> m_queue_shards{0}; ///< shards in use; 0 disables
+  std::atomic<std::size_t> m_shard_max_new{DEFAULT_MAX_NEW}; ///< per shard share of m_max_new
+  std::atomic<std::size_t> m_shard_max_new_bytes{DEFAULT_MAX_NEW_BYTES}; ///< and of m_max_new_bytes
+
+  /// sort key for merging drained entries; see _drain_pending()
+  struct merge_key {
+    uint64_t stamp;
+    uint32_t index;
+  };
+  std::vector<std::size_t> m_merge_runs; ///< start of each drained source
+  std::vector<merge_key> m_merge_keys;
+  EntryVector m_merged;
+  EntryVector m_reorder; ///< entries held back to be merged with later ones
+  std::chrono::microseconds m_reorder_window{0}; ///< 0 disables holding
+  std::size_t m_reorder_max_bytes = 0;
+  /// steady clock ns at which the oldest held entry leaves the window
+  std::atomic<int64_t> m_reorder_due{0};
 
   std::string m_log_file;
+  LogFormat m_log_format = LogFormat::TEXT;
   int m_fd = -1;
   uid_t m_uid = 0;
   gid_t m_gid = 0;
 
   int m_fd_last_error = 0;  ///< last error we say writing to fd (if any)
 
+  /// a file that some subsystems' lines are written to instead of
+  /// m_log_file, through a writer of its own so that a slow device only
+  /// holds up its own subsystems
+  struct SubsysFile {
+    std::string path;
+    int fd = -1;
+    int last_error = 0;
+    LogBuffer buf;
+    std::unique_ptr<AsyncWriter> writer; ///< started on first use
+  };
+  std::vector<SubsysFile> m_subsys_files;
+  /// subsystem -> index into m_subsys_files, or -1 for m_log_file; empty
+  /// while nothing is routed
+  std::vector<int> m_subsys_route;
+
+  uint64_t m_rotate_size = 0;                 ///< 0 disables; log_rotate_size
+  std::chrono::seconds m_rotate_interval{0};  ///< 0 disables
+  unsigned m_rotate_keep = 7;                 ///< rotated files to keep
+  ceph::coarse_mono_time m_rotate_at;         ///< when the interval is up
+
+  bool m_drop_page_cache = false; ///< see _drop_page_cache()
+  off_t m_wb_started = 0; ///< file offset writeback was last started at
+  off_t m_wb_dropped = 0; ///< file offset up to which pages were dropped
+
+  SyncPolicy m_sync_policy = SyncPolicy::NONE; ///< log_sync
+  std::chrono::milliseconds m_sync_interval{1000};
+  bool m_unsynced = false;      ///< written to m_fd since the last sync
+  bool m_unsynced_error = false; ///< and some of it an error
+  /// steady clock ns by which a periodic sync is owed, or 0
+  std::atomic<int64_t> m_sync_due{0};
+  uint64_t m_prealloc_chunk = 0; ///< 0 disables; log_preallocate
+  off_t m_prealloc_end = 0;      ///< m_fd is allocated up to here
+
+  uint64_t m_index_interval = 0; ///< 0 disables; log_index_interval
+  int m_index_fd = -1;           ///< m_log_file.idx
+  /// file offset m_log_buf starts at; -1 once that is unknown (compressed,
+  /// or formatted by the pipeline), until the file is reopened
+  off_t m_index_base = 0;
+  binary::index_record m_index_chunk{}; ///< magic is 0 until an entry
+
+  int m_trace_fd = -1;           ///< log_traffic_trace
+  std::string m_trace_buf;       ///< records not yet written
+  uint64_t m_trace_stamp = 0;    ///< of the last record
+  /// the order threads first appeared in, by pthread_t
+  std::unordered_map<uint64_t, uint32_t> m_trace_threads;
+
+  bool m_mmap_write = false;
+  MmapFile m_mmap; ///< open while m_fd is written through a mapping
+
+  bool m_async_write = false;
+  std::unique_ptr<AsyncWriter> m_writer; ///< set while writes are async
+
+  std::unique_ptr<LogCompressor> m_compressor; ///< set while compressing
+  LogBuffer m_compress_buf;
+  std::string m_compression_type;
+  int m_compression_level = 0;
+  uint64_t m_compression_dict_size = 0; ///< 0 disables; log_compression_dict_size
+  /// the dictionary m_compressor compresses against, once trained and
+  /// written out; empty before
+  std::string m_compression_dict;
+  bool m_compression_dict_tried = false; ///< since compression was set
+
+  /// state private to one FormatPipeline worker
+  struct FormatWorker {
+    log_time_formatter time_formatter;
+    ThreadNameCache thread_names;
+    std::unique_ptr<LogCompressor> compressor;
+    LogBuffer out;
+  };
+  unsigned m_format_threads = 0; ///< 0 formats on the log thread
+  std::unique_ptr<FormatPipeline> m_pipeline; ///< started on first use
+  std::vector<FormatWorker> m_format_workers; ///< only touched by the workers
+					      ///< while m_pipeline is busy
+  bool m_pipelining = false; ///< _flush() is queueing file output below
+  EntryVector m_pipeline_batch;
+  std::size_t m_pipeline_bytes = 0;
+
   int m_syslog_log = -2, m_syslog_crash = -2;
   int m_stderr_log = -1, m_stderr_crash = -1;
-
-  std::string m_log_stderr_prefix;
-
-  std::vector<char> m_log_buf;
-
-  bool m_stop = false;
-
-  std::size_t m_max_new = DEFAULT_MAX_NEW;
-  std::size_t m_max_recent = DEFAULT_MAX_RECENT;
+  int m_graylog_log = -3, m_graylog_crash = -3;
+  int m_journald_log = -2, m_journald_crash = -2;
+
+  /// lines for stderr and syslog are collected in m_sink_batch and handed
+  /// to the sinks' own threads by _flush_logbuf()
+  StderrSink m_stderr_sink{0};
+  SyslogSink m_syslog_sink{1};
+  NetworkSink m_network_sink; ///< ships to log_graylog_host
+  JournaldSink m_journald_sink; ///< journald's native protocol
+  std::shared_ptr<SinkBatch> m_sink_batch;
+  uint64_t m_sink_dropped_reported[4] = {0, 0, 0, 0};
+  bool m_dumping = false; ///< in dump_recent(); sinks are written inline
+
+  LogBuffer m_log_buf;
+  /// bytes buffered before a write, and the room its buffers keep
+  std::size_t m_log_buf_size = 64 << 10; ///< protected by m_flush_mutex
+  log_time_formatter m_time_formatter; ///< protected by m_flush_mutex
+  bool m_thread_names = false;          ///< protected by m_flush_mutex
+  ThreadNameCache m_thread_name_cache;  ///< protected by m_flush_mutex
+  /// tm_gmtoff for dump_recent_crash(), which can't call localtime_r()
+  std::atomic<long> m_utc_offset{0};
+  ceph::coarse_mono_time m_utc_offset_at; ///< when to refresh it
+  bool m_coarse_timestamps = true;  ///< protected by m_flush_mutex
+  bool m_tsc_timestamps = false;    ///< protected by m_flush_mutex
+
+  uint64_t m_dropped_reported = 0;    ///< m_dropped as of the last drop notice
+
+  /// log_stop_timeout, 0 for none; under m_queue_mutex
+  std::chrono::milliseconds m_stop_timeout{0};
+  /// steady clock ns by which stop() wants to be done writing, or 0
+  std::atomic<int64_t> m_stop_deadline{0};
+  uint64_t m_stop_dropped = 0; ///< entries given up on at the deadline
+
+  /// log_governor_level: while the flusher can't keep up, the noisiest
+  /// subsystems are held to it, one more each second, until it has kept up
+  /// for a while.  m_level_caps is read by should_submit() (255 is
+  /// uncapped); the steady clock times are in ns like m_reorder_due; the
+  /// rest belongs to the flusher, under m_flush_mutex.
+  std::array<std::atomic<uint8_t>, ceph_subsys_get_num()> m_level_caps;
+  std::atomic<int64_t> m_overflow_at{0};    ///< last time m_new was found full
+  std::atomic<int64_t> m_governor_due{0};   ///< when to restore the levels
+  int m_governor_level = -1; ///< -1 when off
+  std::vector<uint64_t> m_governor_counts; ///< entries per subsystem, this second
+  bool m_governor_full = false;            ///< a flush found m_new near m_max_new
+  int64_t m_governor_at = 0;               ///< next look
+  int64_t m_governor_overloaded_at = 0;    ///< last look that found overload
+  std::chrono::microseconds m_flush_max_delay{0}; ///< bounds latency when batching
+  /// read by submitters creating their thread's recent ring
+  std::atomic<std::size_t> m_max_recent{DEFAULT_MAX_RECENT};
+
+  /// the last line written, for collapsing repeats of it
+  struct RepeatState {
+    bool valid = false;
+    std::size_t hash = 0;
+    std::string body; ///< of the line, to tell a hash collision from a repeat
+    short subsys = 0;
+    short prio = 0;
+    pthread_t thread = 0;
+    log_time first, last; ///< stamps of the first and latest repeat
+    uint64_t count = 0;   ///< repeats suppressed since the last summary
+  };
+  bool m_suppress_repeats = false;
+  RepeatState m_repeat; ///< protected by m_flush_mutex
+
+  /// not owned; protected by both m_flush_mutex and m_queue_mutex
+  PerfCounters *m_perf = nullptr;
+  /// from each entry's stamp to the flush that wrote it, as finely as the
+  /// stamps are taken (coarse ones only tell milliseconds)
+  ceph::hdr_histogram m_entry_lat;
+
+  /// "log top": what each subsystem has gathered, counted by submitters on
+  /// a line per subsystem, and written, counted by the flusher
+  struct alignas(64) SubsysGathered {
+    std::atomic<uint64_t> entries{0};
+    std::atomic<uint64_t> bytes{0};
+  };
+  std::array<SubsysGathered, ceph_subsys_get_num()> m_gathered;
+  std::array<std::atomic<uint64_t>, ceph_subsys_get_num()> m_written_entries{};
+  std::array<std::atomic<uint64_t>, ceph_subsys_get_num()> m_written_bytes{};
 
   bool m_inject_segv = false;
+  bool m_use_shared = false; ///< for the next start(); m_flush_mutex
+  bool m_use_inline = false;  ///< likewise
+  bool m_inline_buffered = false; ///< m_flush_mutex
+  bool m_fork_held = false;    ///< prepare_fork() holds the locks
+
+  friend class SharedFlusher;
 
   void *entry() override;
 
   void _log_safe_write(std::string_view sv);
+  bool _plain_writes() const;
+  void _write_segments(const ConcreteEntry& e);
   void _flush_logbuf();
+  void _sink_append(uint8_t sinks, const Entry *e, std::string_view line,
+		    std::size_t body, bool prefixed);
+  void _flush_sinks();
+  void _drain_sinks();
+  /// m_stop_deadline, or max() if there is none
+  std::chrono::steady_clock::time_point _stop_deadline() const;
+  bool _compress(std::string_view sv);
+  void _maybe_train_compression_dict();
+  int _write_compression_dict();
+  void _load_compression_dict();
+  void _drain_writer();
+  int _open_log_file();
+  void _maybe_rotate();
+  void _update_utc_offset();
+  ThreadRecentRing* _get_thread_recent();
+  /// the ring e's subsystem keeps its recent entries in
+  RecentRing& _recent_for(const Entry& e) {
+    const unsigned sub = e.m_subsys;
+    if (sub < m_subsys_recent_route.size() && m_subsys_recent_route[sub] >= 0) {
+      return *m_subsys_recent[m_subsys_recent_route[sub]];
+    }
+    return m_recent;
+  }
+  template<typename F, typename B>
+  std::size_t _for_each_recent(F&& f, B&& begin, bool crash, long tail,
+			       char *scratch, std::size_t scratch_len);
+  void _rotate_log_file();
+  void _drop_page_cache();
+  void _maybe_sync(bool force);
+  void _note_unsynced(bool error);
+  bool _sync_due() const;
+  void _preallocate();
+  void _trim_preallocation();
+  void _open_index();
+  void _index_entry(const Entry& e, off_t at);
+  void _write_index(off_t end);
+  void _trace_entry(const ConcreteEntry& e, bool written);
+  void _write_trace();
+  void _close_trace();
+  void _reopen_log_file();
+  void _open_subsys_files();
+  void _flush_subsys_file(SubsysFile& f);
+  void _fit_buf(LogBuffer& b);
+  void _stop_writer();
+  bool _use_pipeline() const;
+  void _reset_format_workers();
+  void _format_batch(FormatPipeline::Batch& b, unsigned worker);
+  void _append_binary(const binary::record_header& h, std::string_view sv);
+  template<typename E>
+  bool _flush_entry(const E& e, bool crash, long index);
   void _flush(EntryVector& q, bool requeue, bool crash);
 
   void _log_message(const char *s, bool crash);
+  void _log_file_message(const char *s);
+
+  /// false, with e untouched, if !wait and the queue is full under
+  /// OverflowPolicy::BLOCK
+  bool _submit_entry(ConcreteEntry&& e, bool wait = true);
+  void _submit_inline(ConcreteEntry&& e);
+  /// count e in its subsystem's and site's "log top" volume
+  void _count_gathered(const ConcreteEntry& e);
+  void _count_written(const ConcreteEntry& e, std::size_t bytes);
+  bool _submit_error(ConcreteEntry& e);
+  void _flush_errors();
+  bool _handle_overflow(ConcreteEntry& e);
+  void _queue_new(ConcreteEntry&& e);
+  void _index_new();
+  void _take_new();
+  static std::size_t _erase_dropped(EntryVector& q,
+				    std::vector<uint32_t>& dropped);
+  void _report_dropped();
+  bool _is_repeat(const Entry& e, std::string_view str);
+  void _flush_repeats(bool force);
+  void _report_rate_limited();
+  void _report_sink_dropped();
+  void _report_file_full();
+  void _govern();
+  void _release_level_caps();
+
+  SubmitRing* _get_thread_ring();
+  bool _rings_pending();
+  void _drain_rings(EntryVector& q, std::unique_lock<std::mutex>& rings_lock);
+  bool _try_shard_submit(ConcreteEntry& e);
+  bool _shards_pending();
+  void _drain_shards(EntryVector& q);
+#ifdef CEPH_LOG_LOCKFREE
+  bool _try_lockfree_submit(ConcreteEntry& e);
+  void _drain_lockfree(EntryVector& q);
+#endif
+  bool _lockfree_pending();
+  void _drain_pending(EntryVector& q, bool hold,
+		      std::unique_lock<std::mutex>& rings_lock);
+  bool _reorder_due() const;
+  bool _governor_due() const;
+  void _wake_idle_flusher();
+  void _notify_flusher();
+  /// flushed by a thread, its own or the shared one
+  bool _threaded() const {
+    return Thread::is_started() || m_shared.load(std::memory_order_relaxed);
+  }
+  bool _on_flusher() const;
+  bool _flush_pending();
+  bool _flusher_sleep();
+  std::chrono::steady_clock::time_point _flusher_due() const;
+  bool _shared_flush(std::chrono::steady_clock::time_point& due);
+  void _update_shard_max_new();
+  void _discard_queued();
+  void _reset_after_fork();
 
 public:
-  using Thread::is_started;
+  /// started, be it flushed by a thread (see _threaded()) or inline
+  bool is_started() const {
+    return _threaded() || m_inline.load(std::memory_order_relaxed);
+  }
 
   Log(const SubsystemMap *s);
   ~Log() override;
@@ -82,26 +550,246 @@ public:
   void set_flush_on_exit();
 
   void set_coarse_timestamps(bool coarse);
+  /// stamp entries from the cpu's cycle counter (see log_clock::use_tsc()),
+  /// or as set_coarse_timestamps() has it
+  int set_tsc_timestamps(bool tsc);
   void set_max_new(std::size_t n);
+  /// bound the queued entries by memory too; 0 leaves only set_max_new()
+  void set_max_new_bytes(std::size_t n);
+  /// queue entries at or below ERROR_PRIO apart, to be written before the
+  /// rest; with sync, the submitter writes them itself and fdatasync()s
+  void set_error_lane(bool lane, bool sync);
+  void set_overflow_policy(OverflowPolicy p);
+  void set_flush_batch(std::size_t batch, std::chrono::microseconds max_delay);
+  /// bound the time stop() spends writing out what is still queued: errors
+  /// and entries at or below STOP_PRIO go first, and what other entries are
+  /// left at the deadline are dropped and counted; 0 writes everything
+  void set_stop_timeout(std::chrono::milliseconds timeout);
   void set_max_recent(std::size_t n);
+  void set_max_recent_bytes(std::size_t n);
+  /// "subsys[,subsys...]=<bytes>;..." to keep those subsystems' recent
+  /// entries out of the shared ring, in one of that many bytes (IEC
+  /// suffixes allowed) per group; -EINVAL (and no change) if malformed.
+  /// Replaces the rings, and what was in them.
+  int set_subsys_recent(std::string_view spec);
+  /// n > 0 has every submitting thread keep its own recent ring of n bytes
+  void set_thread_recent_bytes(std::size_t n);
+  /// keep the recent ring in a shared mapping of path (see RecentRing)
+  void set_recent_file(const std::string& path);
+  /// back the recent ring and large log buffers allocated from now on
+  /// with huge pages (see HugePages.h); process wide
+  void set_huge_pages(HugePages mode);
+  /// also append every logged entry to a shared ring at path for
+  /// ceph-log-agent (see ShmRing); an empty path stops
+  void set_shm_ring(const std::string& path, std::size_t size);
+  void set_thread_ring_size(std::size_t n);
+  void set_queue_shards(std::size_t n);
+  void set_reorder_window(std::chrono::microseconds window,
+			  std::size_t max_bytes);
   void set_log_file(std::string_view fn);
+  /// "subsys[,subsys...]=path;..." to write those subsystems' lines to
+  /// path rather than the log file; -EINVAL (and no change) if malformed
+  int set_subsys_files(std::string_view spec);
+  void set_log_format(LogFormat format);
+  void set_async_write(bool async);
+  void set_mmap_write(bool mmap);
+  int set_compression(std::string_view type, int level);
+  /// with zstd compression, train a dictionary of up to size bytes from
+  /// m_recent (0 to stop)
+  void set_compression_dict_size(uint64_t size);
+  void set_format_threads(unsigned n);
   void reopen_log_file();
+  /// rotate the log file once it reaches size bytes or is interval old,
+  /// keeping keep rotated files (log_file.1 being the newest)
+  void set_rotation(uint64_t size, std::chrono::seconds interval,
+		    unsigned keep);
   void chown_log_file(uid_t uid, gid_t gid);
+  /// have the log file's pages written back and dropped from the page
+  /// cache as the log grows, rather than them crowding out other data
+  void set_drop_page_cache(bool drop);
+  /// when written lines are made durable; interval is for PERIODIC
+  void set_sync_policy(SyncPolicy policy, std::chrono::milliseconds interval);
+  /// fallocate() the log file this many bytes ahead of its end; 0 to stop
+  void set_preallocate(uint64_t chunk);
+  /// keep an index of the log file in log_file.idx, a record per interval
+  /// bytes (see binary::index_record); 0 to stop
+  void set_index_interval(uint64_t interval);
+  /// record the shape of every entry flushed (see binary::trace_header) to
+  /// path, replacing what it held, for log_replay; empty to stop
+  void set_traffic_trace(const std::string& path);
   void set_log_stderr_prefix(std::string_view p);
+  /// vmsplice stderr batches into a stderr pipe rather than write them
+  void set_stderr_splice(bool splice);
+  void set_suppress_repeats(bool suppress);
+  /// "<name>/<tid>" rather than the pthread_t for registered threads
+  void set_thread_names(bool names);
+  /// the level to hold the noisiest subsystems to while the flusher is
+  /// overloaded; -1 to never
+  void set_governor_level(int level);
+  void set_sink_max_pending(std::size_t n);
+  /// write the log file (and each subsystem file) once this much is buffered
+  void set_log_buffer_size(std::size_t n);
+  /// for every log entry's stream in the process; 0 is no limit
+  void set_container_budget(uint32_t elements, uint32_t bytes);
+  /// "tag=level,tag=level,..."; a tag without a level is traced at 20
+  void set_traces(std::string_view spec);
+  /// trace rate (0 to 1) of trace IDs at level, picked by a hash with seed
+  void set_trace_sampling(double rate, int level, uint64_t seed);
+  void set_perf_counters(PerfCounters *pc);
+  /// how long entries waited between being stamped and being written
+  const ceph::hdr_histogram& get_entry_latency() const {
+    return m_entry_lat;
+  }
+  /// what a subsystem's entries have cost since the last reset_volume():
+  /// bytes gathered are of the text, or of a deferred entry's encoded
+  /// arguments, as submitted; bytes written are of the text
+  struct Volume {
+    uint64_t gathered = 0;
+    uint64_t gathered_bytes = 0;
+    uint64_t written = 0;
+    uint64_t written_bytes = 0;
+  };
+  Volume get_subsys_volume(unsigned subsys) const;
+  /// start counting afresh, here and at every DoutSite
+  void reset_volume();
+  /// what one queue of entries holds: payload is the text (or a deferred
+  /// entry's encoded arguments) in it, slots the vector's room, inline
+  /// buffers included, and heap the text kept outside those
+  struct QueueMemory {
+    std::size_t entries = 0;
+    std::size_t payload_bytes = 0;
+    std::size_t slot_bytes = 0;
+    std::size_t heap_bytes = 0;
+  };
+  /// what a recent ring holds, and the buffer it holds it in
+  struct RingMemory {
+    std::size_t rings = 0;
+    std::size_t entries = 0;
+    std::size_t used_bytes = 0;
+    std::size_t capacity_bytes = 0;
+  };
+  /// "memory usage": a snapshot of the memory the log holds, taken under
+  /// its locks, so not something to poll often
+  struct MemoryUsage {
+    QueueMemory new_entries;  ///< m_new, the shards and the spill
+    QueueMemory errors;       ///< the error lane
+    QueueMemory flush;        ///< being written, or kept for reuse
+    QueueMemory reorder;      ///< held back by log_reorder_window
+    RingMemory recent;        ///< m_recent
+    RingMemory subsys_recent; ///< log_subsys_recent rings
+    RingMemory thread_recent; ///< per thread rings
+    std::size_t submit_rings = 0;
+    std::size_t submit_ring_bytes = 0; ///< their slots
+    std::size_t log_buf_bytes = 0;     ///< buffered for the log file
+    std::size_t log_buf_capacity = 0;  ///< and their room, subsys files too
+    std::size_t recycled_streams = 0;  ///< adopted streams to give back
+  };
+  MemoryUsage get_memory_usage();
+  /// statvfs() the log file's device, and stop (or resume) writing the
+  /// file as its utilization is past stop_at or not.  Called periodically
+  /// off the flush path, by the CephContext service thread.
+  void update_file_utilization(double stop_at);
 
   void flush();
+  /* Have the log thread flush, and call on_written once everything
+   * submitted before the call is written to the log file (handed to the
+   * sinks, too, but not necessarily sent).  on_written is called from
+   * whichever thread performs the next flush: normally the log thread, but
+   * a flush() called elsewhere in the meantime runs it on its caller.  It
+   * mustn't block or submit to this log without try_submit_entry(); post
+   * to an executor from it.  Without a log thread this flushes on the
+   * calling thread and calls on_written before returning.
+   */
+  void async_flush(std::function<void()> on_written);
 
   void dump_recent();
+  /// call f on each recent entry that filter matches, oldest first, until
+  /// it returns false; the rings are copied first, so neither the log
+  /// thread nor the submitters wait on f.  Returns the entries f was
+  /// called on.
+  std::size_t for_each_recent(const RecentFilter& filter,
+			      const std::function<bool(const Entry&)>& f);
+  /// dump_recent() for a fatal signal handler: async-signal-safe and
+  /// allocation free, writing to fd, or to the log file if fd is -1 (to
+  /// stderr if a flush holds the log file). The lines of note, if any, go
+  /// first.
+  void dump_recent_crash(int fd = -1, std::string_view note = {});
 
   void set_syslog_level(int log, int crash);
   void set_stderr_level(int log, int crash);
-
-  std::shared_ptr<Graylog> graylog() { return m_graylog; }
+  void set_graylog_level(int log, int crash);
+  void set_journald_level(int log, int crash);
+
+  /// for TraceScope: the tags named by log_trace
+  const TraceRegistry& get_traces() const { return m_traces; }
+  /// for TraceScope: the trace IDs picked by log_trace_sample_rate
+  const TraceSampler& get_trace_sampler() const { return m_trace_sampler; }
+
+  /// destination, transport and metadata for the network sink
+  NetworkSink& graylog() { return m_network_sink; }
+  /// metadata for the journald sink
+  JournaldSink& journald() { return m_journald_sink; }
+
+  /// rate limit check for an entry that passed should_gather(); false if
+  /// its subsystem is over its log_rate_limit_* and it should be dropped
+  bool should_submit(unsigned sub, int prio) {
+    if (unlikely(prio > m_level_caps[sub].load(std::memory_order_relaxed)) &&
+	!trace_gather(prio)) {
+      return false;
+    }
+    const auto rate = m_subs->get_log_rate(sub);
+    if (likely(rate.rate == 0) || prio < 0 || trace_gather(prio)) {
+      return true;
+    }
+    return m_rate_limiter.admit(sub, rate);
+  }
 
   void submit_entry(Entry&& e);
+  void submit_entry(MutableEntry&& e);
+  void submit_entry(ConcreteEntry&& e);
+  /* Submit e unless that means waiting for the flusher, as a full queue
+   * under log_overflow_policy=block does: for code that mustn't block its
+   * thread, such as coroutines on an executor.  On false the ConcreteEntry
+   * is left as it was, to try again later; a MutableEntry, which has
+   * already given up its stream, is dropped and counted with the entries
+   * dropped on overflow.  An error is queued rather than written
+   * synchronously with log_error_sync.
+   */
+  bool try_submit_entry(ConcreteEntry&& e);
+  bool try_submit_entry(MutableEntry&& e);
+
+  /// number of entries discarded by the overflow policy so far
+  uint64_t get_dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+  /// total time submitters have spent blocked waiting for the flusher
+  std::chrono::nanoseconds get_blocked_time() const {
+    return std::chrono::nanoseconds(
+      m_blocked_ns.load(std::memory_order_relaxed));
+  }
 
   void start();
   void stop();
+  /// have start() hand this log to the process' shared flusher thread
+  /// rather than start one of its own
+  void set_shared_flusher(bool shared);
+  /// have start() start no thread at all: each submit_entry() writes its
+  /// entry then and there, for short-lived tools.  Buffered, the file
+  /// (and sinks) are only written once the buffer fills, on flush() and
+  /// on exit, but for errors.
+  void set_inline(bool inline_write, bool buffered);
+  /* The pthread_atfork() handlers, which every Log is registered with.
+   * prepare_fork() holds a Log's locks, and its writers' and sinks',
+   * across the fork, without stopping anything, so a fork costs the
+   * parent no more than the wait for whatever holds them.  The parent
+   * just lets go.  The child gets the Log stopped, its threads forgotten
+   * rather than joined, and without the parent's queued or buffered
+   * output, so each entry is written exactly once; it logs once it calls
+   * start().
+   */
+  void prepare_fork();
+  void after_fork(bool child);
 
   /// true if the log lock is held by our thread
   bool is_inside_log_lock();
@@ -0,0 +1,37 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_LOGBUFFER_H
+#define __CEPH_LOG_LOGBUFFER_H
+
+#include <cstddef>
+
+#include <boost/container/vector.hpp>
+
+#include "HugePages.h"
+
+namespace ceph {
+namespace logging {
+
+/* The bytes on their way to a log file: formatted lines, binary records
+ * and compressed frames.
+ *
+ * Each line is formatted into room made for the longest it could be and
+ * then cut back to what it took, so growing the buffer must not zero the
+ * new bytes the way std::vector::resize() would.  grow() leaves them
+ * uninitialized, like StackStringBuf does with its storage.  A buffer that
+ * grows to a huge page or more is mapped as log_huge_pages says.
+ */
+using LogBuffer = boost::container::vector<char, HugePageAllocator<char>>;
+
+/// make n more bytes at the end of b, uninitialized; returns the first
+inline char* grow(LogBuffer& b, std::size_t n) {
+  const std::size_t cur = b.size();
+  b.resize(cur + n, boost::container::default_init);
+  return b.data() + cur;
+}
+
+}
+}
+
+#endif
@@ -4,10 +4,20 @@
 #ifndef CEPH_LOG_CLOCK_H
 #define CEPH_LOG_CLOCK_H
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <chrono>
 #include <ctime>
 #include <sys/time.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 #include "common/utils/ceph_assert.h"
 #include "common/utils/ceph_time.h"
@@ -80,6 +90,141 @@ inline bool operator >=(const taggedrep& l, const taggedrep& r) {
 inline bool operator >(const taggedrep& l, const taggedrep& r) {
   return l.count > r.count;
 }
+
+/* Wall time from the cpu's cycle counter, for hosts where clock_gettime()
+ * is a system call (a VM whose clocksource isn't the TSC).  The counter is
+ * tied to real_clock by a base point and a rate; calibrate(), run about
+ * once a second by its one writer, remeasures the rate and slews the
+ * conversion so that it meets real_clock again a second later, without
+ * going backwards.  Only a step of the system clock (more than a
+ * millisecond off) is followed by a jump.  Readers take a seqlock.
+ */
+class tsc_converter {
+public:
+  static uint64_t read() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return 0;
+#endif
+  }
+
+  /// whether the counter ticks at a constant rate on every cpu
+  static bool usable() {
+#if defined(__x86_64__)
+    unsigned a, b, c, d;
+    // invariant TSC
+    return __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1u << 8));
+#elif defined(__aarch64__)
+    // the generic timer is constant rate by definition
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  uint64_t to_ns(uint64_t tsc) const {
+    uint32_t s;
+    uint64_t t0, ns0, m;
+    // bounded, for a crash dump interrupting the writer itself
+    int tries = 1000;
+    do {
+      s = seq.load(std::memory_order_acquire);
+      t0 = base_tsc.load(std::memory_order_relaxed);
+      ns0 = base_ns.load(std::memory_order_relaxed);
+      m = mult.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (((s & 1) || s != seq.load(std::memory_order_relaxed)) &&
+	     --tries > 0);
+    // a stamp taken before the last calibration, or on a cpu whose
+    // counter trails a little, is before the base point
+    if (tsc < t0) {
+      return ns0 - uint64_t((unsigned __int128)(t0 - tsc) * m >> 32);
+    }
+    return ns0 + uint64_t((unsigned __int128)(tsc - t0) * m >> 32);
+  }
+
+  /// remeasure if a second has passed or, with reset, start over
+  void calibrate(bool reset) {
+    if (reset) {
+      // a first rate, from a short wait
+      uint64_t t0, ns0, t1, ns1;
+      sample(&t0, &ns0);
+      const timespec wait = {0, 10000000};
+      nanosleep(&wait, nullptr);
+      sample(&t1, &ns1);
+      ticks_per_ns = double(t1 - t0) / double(std::max<uint64_t>(ns1 - ns0, 1));
+      ref_tsc = t1;
+      ref_ns = ns1;
+      publish(t1, ns1, ticks_per_ns);
+      next_tsc = t1 + uint64_t(ticks_per_ns * 1e9);
+      return;
+    }
+    if (read() < next_tsc) {
+      return;
+    }
+    uint64_t t, now;
+    sample(&t, &now);
+    if (now > ref_ns && t > ref_tsc) {
+      // the longer the span, the better the rate
+      ticks_per_ns = double(t - ref_tsc) / double(now - ref_ns);
+    }
+    const uint64_t est = to_ns(t);
+    const int64_t err = int64_t(now - est);
+    if (err > 1000000 || err < -1000000) {
+      // the system clock was stepped; follow it
+      ref_tsc = t;
+      ref_ns = now;
+      publish(t, now, ticks_per_ns);
+    } else {
+      // arrive at real_clock in a second from where we are now
+      publish(t, est, ticks_per_ns * 1e9 / (1e9 + err));
+    }
+    next_tsc = t + uint64_t(ticks_per_ns * 1e9);
+  }
+
+private:
+  /// a counter reading and the system time at once, or as near as
+  /// the tightest of a few tries bracketing the clock read gets
+  static void sample(uint64_t *tsc, uint64_t *ns) {
+    uint64_t best = UINT64_MAX;
+    *tsc = *ns = 0;
+    for (int i = 0; i < 4; ++i) {
+      const uint64_t before = read();
+      const uint64_t now = real_clock::now().time_since_epoch().count();
+      const uint64_t after = read();
+      if (after - before < best) {
+	best = after - before;
+	*tsc = before + (after - before) / 2;
+	*ns = now;
+      }
+    }
+  }
+
+  void publish(uint64_t t, uint64_t ns, double tpns) {
+    const uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    base_tsc.store(t, std::memory_order_relaxed);
+    base_ns.store(ns, std::memory_order_relaxed);
+    mult.store(uint64_t((1ull << 32) / tpns), std::memory_order_relaxed);
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+  std::atomic<uint32_t> seq{0};
+  std::atomic<uint64_t> base_tsc{0};
+  std::atomic<uint64_t> base_ns{0};
+  std::atomic<uint64_t> mult{0};  ///< ns per tick, 32.32 fixed point
+
+  // the writer's own
+  uint64_t ref_tsc = 0, ref_ns = 0;  ///< where the rate is measured from
+  double ticks_per_ns = 1;
+  uint64_t next_tsc = 0;
+};
 }
 class log_clock {
 public:
@@ -91,16 +236,87 @@ public:
   using time_point = std::chrono::time_point<log_clock>;
   static constexpr const bool is_steady = false;
 
+  /* What an Entry keeps: a raw reading of whichever clock is cheapest
+   * for the mode, and where it came from.  Producers only read the
+   * clock; to_time() turns the tick into real_clock time with the
+   * parameters the log thread last took in calibrate(), once per
+   * flush, for the whole batch.
+   */
+  using tick = uint64_t;
+  enum class source : uint8_t {
+    coarse,      ///< coarse_mono_clock
+    fine,        ///< mono_clock
+    tsc,         ///< the cycle counter, see use_tsc()
+    real_coarse, ///< already real_clock time, e.g. read back from a record
+    real_fine,
+  };
+
+  log_clock() {
+    sample_offset();
+  }
+
+  tick now_tick(source *src) const noexcept {
+    *src = m_source.load(std::memory_order_relaxed);
+    switch (*src) {
+    case source::coarse:
+      return coarse_mono_clock::now().time_since_epoch().count();
+    case source::tsc:
+      return _logclock::tsc_converter::read();
+    default:
+      return mono_clock::now().time_since_epoch().count();
+    }
+  }
+
+  /// async-signal-safe
+  time_point to_time(tick t, source src) const noexcept {
+    switch (src) {
+    case source::coarse:
+      return at(t + m_offset.load(std::memory_order_relaxed), true);
+    case source::fine:
+      return at(t + m_offset.load(std::memory_order_relaxed), false);
+    case source::tsc:
+      return at(tsc.to_ns(t), false);
+    case source::real_coarse:
+      return at(t, true);
+    default:
+      return at(t, false);
+    }
+  }
+
   time_point now() noexcept {
-    return appropriate_now();
+    source src;
+    const tick t = now_tick(&src);
+    return to_time(t, src);
   }
 
   void coarsen() {
-    appropriate_now = coarse_now;
+    m_source = source::coarse;
   }
 
   void refine() {
-    appropriate_now = fine_now;
+    m_source = source::fine;
+  }
+
+  /// stamp from the cpu's cycle counter rather than clock_gettime();
+  /// -ENOTSUP where it can't be trusted to tick steadily
+  int use_tsc() {
+    if (!_logclock::tsc_converter::usable()) {
+      return -ENOTSUP;
+    }
+    if (m_source != source::tsc) {
+      tsc.calibrate(true);
+      m_source = source::tsc;
+    }
+    return 0;
+  }
+
+  /// refresh what to_time() converts with; for the log thread, before
+  /// it writes out a batch
+  void calibrate() {
+    sample_offset();
+    if (m_source == source::tsc) {
+      tsc.calibrate(false);
+    }
   }
 
   // Since our formatting is done in microseconds and we're using it
@@ -113,17 +329,22 @@ public:
                ts % std::chrono::seconds(1)).count()) };
   }
 private:
-  static time_point coarse_now() {
-    return time_point(
-      duration(_logclock::taggedrep(coarse_real_clock::now()
-				    .time_since_epoch().count(), true)));
+  static time_point at(uint64_t ns, bool coarse) {
+    return time_point(duration(_logclock::taggedrep(ns, coarse)));
   }
-  static time_point fine_now() {
-    return time_point(
-      duration(_logclock::taggedrep(real_clock::now()
-				    .time_since_epoch().count(), false)));
+
+  /// real_clock less mono_clock, read between two mono_clock reads
+  void sample_offset() {
+    const uint64_t before = mono_clock::now().time_since_epoch().count();
+    const uint64_t real = real_clock::now().time_since_epoch().count();
+    const uint64_t after = mono_clock::now().time_since_epoch().count();
+    m_offset.store(real - (before + (after - before) / 2),
+		   std::memory_order_relaxed);
   }
-  time_point(*appropriate_now)() = coarse_now;
+
+  inline static _logclock::tsc_converter tsc;
+  std::atomic<source> m_source{source::coarse};
+  std::atomic<uint64_t> m_offset{0};
 };
 using log_time = log_clock::time_point;
 inline int append_time(const log_time& t, char *out, int outlen) {
@@ -149,6 +370,105 @@ inline int append_time(const log_time& t, char *out, int outlen) {
   ceph_assert(r >= 0);
   return r;
 }
+
+// Same output as append_time() using only arithmetic, for async-signal-safe
+// callers: local time is UTC shifted by utc_offset seconds (tm_gmtoff).
+// Returns 0 if out is too short.
+inline int append_time_signal_safe(const log_time& t, long utc_offset,
+				   char *out, int outlen) {
+  bool coarse = t.time_since_epoch().count().coarse;
+  auto tv = log_clock::to_timeval(t);
+  const int digits = coarse ? 3 : 6;
+  const int len = 19 + 1 + digits;
+  if (len >= outlen) {
+    return 0;
+  }
+  int64_t secs = tv.tv_sec + utc_offset;
+  int64_t days = secs / 86400;
+  int64_t rem = secs % 86400;
+  if (rem < 0) {
+    rem += 86400;
+    --days;
+  }
+  // civil_from_days() from Howard Hinnant's date algorithms
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const int64_t doe = days - era * 146097;
+  const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const int64_t mp = (5 * doy + 2) / 153;
+  const int64_t mday = doy - (153 * mp + 2) / 5 + 1;
+  const int64_t mon = mp < 10 ? mp + 3 : mp - 9;
+  const int64_t year = std::clamp<int64_t>(yoe + era * 400 + (mon <= 2),
+					   0, 9999);
+
+  auto put = [](char *p, int64_t v, int n) {
+    for (int i = n - 1; i >= 0; --i) {
+      p[i] = '0' + v % 10;
+      v /= 10;
+    }
+  };
+  put(out, year, 4);
+  out[4] = '-';
+  put(out + 5, mon, 2);
+  out[7] = '-';
+  put(out + 8, mday, 2);
+  out[10] = ' ';
+  put(out + 11, rem / 3600, 2);
+  out[13] = ':';
+  put(out + 14, rem / 60 % 60, 2);
+  out[16] = ':';
+  put(out + 17, rem % 60, 2);
+  out[19] = '.';
+  put(out + 20, coarse ? tv.tv_usec / 1000 : tv.tv_usec, digits);
+  out[len] = '\0';
+  return len;
+}
+
+// Same output as append_time(), for callers formatting many stamps in a
+// row. The "YYYY-MM-DD HH:MM:SS" part only changes once a second, so it is
+// kept from the last call and only the fractional digits are rendered.
+// Not thread safe; the log thread owns one.
+class log_time_formatter {
+public:
+  int append(const log_time& t, char *out, int outlen) {
+    bool coarse = t.time_since_epoch().count().coarse;
+    auto tv = log_clock::to_timeval(t);
+    if (tv.tv_sec != m_sec) {
+      std::tm bdt;
+      localtime_r(&tv.tv_sec, &bdt);
+      int r = std::snprintf(m_prefix, sizeof(m_prefix),
+			    "%04d-%02d-%02d %02d:%02d:%02d",
+			    bdt.tm_year + 1900, bdt.tm_mon + 1, bdt.tm_mday,
+			    bdt.tm_hour, bdt.tm_min, bdt.tm_sec);
+      if (r != PREFIX_LEN) {
+	// a year with other than four digits; don't bother caching
+	m_sec = -1;
+	return append_time(t, out, outlen);
+      }
+      m_sec = tv.tv_sec;
+    }
+
+    const int digits = coarse ? 3 : 6;
+    const int len = PREFIX_LEN + 1 + digits;
+    ceph_assert(len < outlen);
+    std::memcpy(out, m_prefix, PREFIX_LEN);
+    out[PREFIX_LEN] = '.';
+    long frac = coarse ? tv.tv_usec / 1000 : tv.tv_usec;
+    for (int i = len - 1; i > PREFIX_LEN; --i) {
+      out[i] = '0' + frac % 10;
+      frac /= 10;
+    }
+    out[len] = '\0';
+    return len;
+  }
+
+private:
+  static constexpr int PREFIX_LEN = 19;
+
+  time_t m_sec = -1;
+  char m_prefix[PREFIX_LEN + 1];
+};
 }
 }
 
@@ -0,0 +1,254 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "LogCompressor.h"
+
+#include "acconfig.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+namespace ceph {
+namespace logging {
+
+namespace {
+
+#ifdef HAVE_ZSTD
+class ZstdCompressor final : public LogCompressor {
+public:
+  explicit ZstdCompressor(int level) : m_cctx(ZSTD_createCCtx()) {
+    if (m_cctx) {
+      ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_compressionLevel, level);
+      // lets zstdcat detect a frame torn by a crash
+      ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_checksumFlag, 1);
+    }
+  }
+  ~ZstdCompressor() override {
+    ZSTD_freeCCtx(m_cctx);
+  }
+
+  bool is_valid() const {
+    return m_cctx != nullptr;
+  }
+
+  const char *get_type() const override {
+    return "zstd";
+  }
+
+  int compress(std::string_view in, LogBuffer& out) override {
+    out.resize(ZSTD_compressBound(in.size()), boost::container::default_init);
+    size_t r = ZSTD_compress2(m_cctx, out.data(), out.size(),
+			      in.data(), in.size());
+    if (ZSTD_isError(r)) {
+      out.resize(0);
+      return -EIO;
+    }
+    out.resize(r);
+    return 0;
+  }
+
+  std::size_t store(std::string_view in, char *out,
+		    std::size_t out_len) const override {
+    // magic, then no checksum, content size or dictionary, and a window of
+    // 128KiB, which is also the largest block
+    static constexpr unsigned char header[] = {0x28, 0xb5, 0x2f, 0xfd,
+					       0x00, 0x38};
+    static constexpr std::size_t max_block = 128 << 10;
+    const std::size_t blocks = std::max<std::size_t>(
+      1, (in.size() + max_block - 1) / max_block);
+    if (out_len < sizeof(header) + 3 * blocks + in.size()) {
+      return 0;
+    }
+    char *p = out;
+    memcpy(p, header, sizeof(header));
+    p += sizeof(header);
+    do {
+      // a raw block: size, type 0, and whether it is the last one
+      const std::size_t n = std::min(in.size(), max_block);
+      const uint32_t h = (n << 3) | (n == in.size() ? 1 : 0);
+      *p++ = h;
+      *p++ = h >> 8;
+      *p++ = h >> 16;
+      memcpy(p, in.data(), n);
+      p += n;
+      in.remove_prefix(n);
+    } while (!in.empty());
+    return p - out;
+  }
+
+  int set_dictionary(std::string_view dict) override {
+    // digested once here, and used for every frame until replaced
+    size_t r = ZSTD_CCtx_loadDictionary(m_cctx, dict.data(), dict.size());
+    return ZSTD_isError(r) ? -EINVAL : 0;
+  }
+
+private:
+  ZSTD_CCtx *m_cctx;
+};
+#endif
+
+#ifdef HAVE_LZ4
+class Lz4Compressor final : public LogCompressor {
+public:
+  explicit Lz4Compressor(int level) {
+    if (LZ4F_isError(LZ4F_createCompressionContext(&m_cctx, LZ4F_VERSION))) {
+      m_cctx = nullptr;
+    }
+    m_prefs.compressionLevel = level;
+    m_prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+  }
+  ~Lz4Compressor() override {
+    LZ4F_freeCompressionContext(m_cctx);
+  }
+
+  bool is_valid() const {
+    return m_cctx != nullptr;
+  }
+
+  const char *get_type() const override {
+    return "lz4";
+  }
+
+  int compress(std::string_view in, LogBuffer& out) override {
+    out.resize(LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(in.size(), &m_prefs),
+	       boost::container::default_init);
+    char *p = out.data();
+    char *const end = p + out.size();
+    size_t r = LZ4F_compressBegin(m_cctx, p, end - p, &m_prefs);
+    if (LZ4F_isError(r)) {
+      goto fail;
+    }
+    p += r;
+    r = LZ4F_compressUpdate(m_cctx, p, end - p, in.data(), in.size(), nullptr);
+    if (LZ4F_isError(r)) {
+      goto fail;
+    }
+    p += r;
+    r = LZ4F_compressEnd(m_cctx, p, end - p, nullptr);
+    if (LZ4F_isError(r)) {
+      goto fail;
+    }
+    p += r;
+    out.resize(p - out.data());
+    return 0;
+
+  fail:
+    out.resize(0);
+    return -EIO;
+  }
+
+  std::size_t store(std::string_view in, char *out,
+		    std::size_t out_len) const override {
+    // magic, then independent 256KiB blocks with no checksums or content
+    // size, and the descriptor's checksum
+    static constexpr unsigned char header[] = {0x04, 0x22, 0x4d, 0x18,
+					       0x60, 0x50, 0xfb};
+    static constexpr std::size_t max_block = 256 << 10;
+    const std::size_t blocks = (in.size() + max_block - 1) / max_block;
+    if (out_len < sizeof(header) + 4 * blocks + in.size() + 4) {
+      return 0;
+    }
+    char *p = out;
+    memcpy(p, header, sizeof(header));
+    p += sizeof(header);
+    auto put32 = [&p](uint32_t v) {
+      for (int i = 0; i < 4; ++i, v >>= 8) {
+	*p++ = v;
+      }
+    };
+    while (!in.empty()) {
+      // the high bit marks the block as stored uncompressed
+      const std::size_t n = std::min(in.size(), max_block);
+      put32(n | 0x80000000u);
+      memcpy(p, in.data(), n);
+      p += n;
+      in.remove_prefix(n);
+    }
+    put32(0); // end mark
+    return p - out;
+  }
+
+private:
+  LZ4F_cctx *m_cctx = nullptr;
+  LZ4F_preferences_t m_prefs = {};
+};
+#endif
+
+}
+
+std::unique_ptr<LogCompressor> LogCompressor::create(std::string_view type,
+						     int level,
+						     std::string *err)
+{
+#ifdef HAVE_ZSTD
+  if (type == "zstd") {
+    auto c = std::make_unique<ZstdCompressor>(level);
+    if (!c->is_valid()) {
+      *err = "failed to create zstd compression context";
+      return nullptr;
+    }
+    return c;
+  }
+#endif
+#ifdef HAVE_LZ4
+  if (type == "lz4") {
+    auto c = std::make_unique<Lz4Compressor>(level);
+    if (!c->is_valid()) {
+      *err = "failed to create lz4 compression context";
+      return nullptr;
+    }
+    return c;
+  }
+#endif
+  *err = "log compression '" + std::string(type) + "' is not supported";
+  return nullptr;
+}
+
+int LogCompressor::train_dictionary(std::string_view type,
+				    std::string_view samples,
+				    const std::vector<std::size_t>& sizes,
+				    std::size_t max_size, std::string *dict,
+				    std::string *err)
+{
+#ifdef HAVE_ZSTD
+  if (type == "zstd") {
+    dict->resize(max_size);
+    size_t r = ZDICT_trainFromBuffer(dict->data(), dict->size(),
+				     samples.data(), sizes.data(),
+				     sizes.size());
+    if (ZDICT_isError(r)) {
+      dict->clear();
+      *err = ZDICT_getErrorName(r);
+      return -EINVAL;
+    }
+    dict->resize(r);
+    return 0;
+  }
+#endif
+  *err = "log compression '" + std::string(type) +
+    "' does not use dictionaries";
+  return -EOPNOTSUPP;
+}
+
+unsigned LogCompressor::get_dictionary_id(std::string_view dict)
+{
+#ifdef HAVE_ZSTD
+  return ZDICT_getDictID(dict.data(), dict.size());
+#else
+  return 0;
+#endif
+}
+
+}
+}
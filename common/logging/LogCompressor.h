@@ -0,0 +1,79 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_LOGCOMPRESSOR_H
+#define __CEPH_LOG_LOGCOMPRESSOR_H
+
+#include <errno.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "LogBuffer.h"
+
+namespace ceph {
+namespace logging {
+
+/* Compresses log file output one buffer at a time.
+ *
+ * Every call to compress() produces a complete, self-contained frame, so a
+ * log file is simply a concatenation of frames: it can be decoded with the
+ * stock tools (zstdcat, lz4cat) while it is still being written, after a
+ * crash, or after rotation cut it at any flush boundary. The compression
+ * context is kept between calls, so only the frames are independent, not
+ * the allocations.
+ *
+ * Small frames compress log text poorly, each starting with no history.
+ * A zstd compressor can be given a dictionary trained from earlier log
+ * lines to start every frame from instead; the frames then carry its ID
+ * and decode only with that dictionary at hand (zstdcat -D).
+ */
+class LogCompressor {
+public:
+  virtual ~LogCompressor() = default;
+
+  /// "zstd" or "lz4"; nullptr with *err set if type is unknown or was not
+  /// built in. level 0 picks the library's default.
+  static std::unique_ptr<LogCompressor> create(std::string_view type,
+					       int level, std::string *err);
+
+  virtual const char *get_type() const = 0;
+
+  /// replace out with one frame holding in; returns 0 or -EIO
+  virtual int compress(std::string_view in, LogBuffer& out) = 0;
+
+  /// the most store() adds to up to 128KiB of input
+  static constexpr std::size_t STORE_OVERHEAD = 32;
+  /// write in to out as one frame that holds it uncompressed; returns the
+  /// frame's size, or 0 if it needs more than out_len bytes. Allocates
+  /// nothing and leaves the compression context alone, so a crash dump can
+  /// call it from a signal handler.
+  virtual std::size_t store(std::string_view in, char *out,
+			    std::size_t out_len) const = 0;
+
+  /// compress the frames that follow against dict, or without one if it is
+  /// empty; returns 0, -EINVAL, or -EOPNOTSUPP if the type has no
+  /// dictionaries
+  virtual int set_dictionary(std::string_view dict) {
+    return dict.empty() ? 0 : -EOPNOTSUPP;
+  }
+
+  /// train a dictionary of at most max_size bytes for type ("zstd") from
+  /// samples, the concatenation of pieces of the given sizes; returns 0 or
+  /// -errno with *err set
+  static int train_dictionary(std::string_view type,
+			      std::string_view samples,
+			      const std::vector<std::size_t>& sizes,
+			      std::size_t max_size, std::string *dict,
+			      std::string *err);
+  /// the ID frames compressed against dict carry, 0 if it has none
+  static unsigned get_dictionary_id(std::string_view dict);
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,43 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_LOGPROBES_H
+#define __CEPH_LOG_LOGPROBES_H
+
+/* Static tracepoints at the boundaries of the logging path, for measuring
+ * its overhead in production with bpftrace, perf or systemtap, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libceph-common.so:ceph_log:flush_start
+ *                { @batch = hist(arg0); }'
+ *
+ * They are USDT probes from <sys/sdt.h>: a nop each, with the arguments
+ * left where they already are, until a tracer attaches.  Build with
+ * CEPH_LOG_NO_PROBES, or without the header, and they compile away.
+ *
+ *   submit(subsys, prio)           an entry is handed to Log::submit_entry()
+ *   block_start(queued), block_end(ns)
+ *                                  a submitter waits for the flusher
+ *   flush_start(entries), flush_end(entries, written, bytes)
+ *                                  a batch in Log::_flush()
+ *   write_start(len), write_end(len, result)
+ *                                  a write of the log file
+ */
+
+#if !defined(CEPH_LOG_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CEPH_LOG_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef CEPH_LOG_HAVE_PROBES
+#define CEPH_LOG_PROBE1(name, a) DTRACE_PROBE1(ceph_log, name, a)
+#define CEPH_LOG_PROBE2(name, a, b) DTRACE_PROBE2(ceph_log, name, a, b)
+#define CEPH_LOG_PROBE3(name, a, b, c) DTRACE_PROBE3(ceph_log, name, a, b, c)
+#else
+#define CEPH_LOG_PROBE1(name, a) do { } while (0)
+#define CEPH_LOG_PROBE2(name, a, b) do { } while (0)
+#define CEPH_LOG_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
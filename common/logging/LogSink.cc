@@ -0,0 +1,295 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "LogSink.h"
+
+#include "common/safe_io.h"
+
+#include "include/ceph_assert.h"
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+
+namespace ceph {
+namespace logging {
+
+LogSink::LogSink(const char *name, unsigned id)
+  : m_name(name), m_id(id)
+{
+  ceph_assert(id < 8);
+}
+
+LogSink::~LogSink()
+{
+  ceph_assert(!is_started());
+}
+
+void LogSink::set_max_pending(std::size_t n)
+{
+  std::scoped_lock lock(m_lock);
+  m_max_pending = std::max<std::size_t>(n, 1);
+}
+
+void LogSink::submit(const SinkBatchRef& b)
+{
+  std::unique_lock lock(m_lock);
+  if (m_pending.size() >= m_max_pending) {
+    count_dropped(count_lines(*b));
+    return;
+  }
+  m_pending.push_back(b);
+  if (!is_started()) {
+    m_stop = false;
+    create(m_name);
+  }
+  m_cond_sink.notify_one();
+}
+
+uint64_t LogSink::count_lines(const SinkBatch& b) const
+{
+  const auto mask = get_mask();
+  return std::count_if(
+    b.lines.begin(), b.lines.end(),
+    [mask](const SinkBatch::Line& l) { return l.sinks & mask; });
+}
+
+void LogSink::write_now(const SinkBatch& b)
+{
+  drain();
+  std::scoped_lock lock(m_write_lock);
+  write(b);
+}
+
+void LogSink::drain(std::chrono::steady_clock::time_point until)
+{
+  std::unique_lock lock(m_lock);
+  _wait_drained(lock, until);
+}
+
+bool LogSink::_wait_drained(std::unique_lock<std::mutex>& lock,
+			    std::chrono::steady_clock::time_point until)
+{
+  while (!m_pending.empty() || m_writing) {
+    if (until == until.max()) {
+      m_cond_drain.wait(lock);
+    } else if (m_cond_drain.wait_until(lock, until) ==
+	       std::cv_status::timeout) {
+      return m_pending.empty() && !m_writing;
+    }
+  }
+  return true;
+}
+
+void LogSink::stop(std::chrono::steady_clock::time_point until)
+{
+  {
+    std::unique_lock lock(m_lock);
+    if (!is_started()) {
+      return;
+    }
+    if (until != until.max() && !_wait_drained(lock, until)) {
+      for (auto& b : m_pending) {
+	count_dropped(count_lines(*b));
+      }
+      m_pending.clear();
+    }
+    m_stop = true;
+    m_cond_sink.notify_one();
+  }
+  join();
+}
+
+void LogSink::prepare_fork()
+{
+  m_lock.lock();
+  m_write_lock.lock();
+}
+
+void LogSink::after_fork(bool child)
+{
+  if (child) {
+    // the parent's sink thread writes these; it isn't here
+    m_pending.clear();
+    m_writing = false;
+    m_stop = false;
+    new (&m_cond_sink) std::condition_variable;
+    new (&m_cond_drain) std::condition_variable;
+    forget_after_fork();
+  }
+  m_write_lock.unlock();
+  m_lock.unlock();
+}
+
+void *LogSink::entry()
+{
+  std::unique_lock lock(m_lock);
+  while (true) {
+    if (m_pending.empty()) {
+      if (m_stop) {
+	break;
+      }
+      m_cond_sink.wait(lock);
+      continue;
+    }
+    auto b = std::move(m_pending.front());
+    m_pending.pop_front();
+    m_writing = true;
+    lock.unlock();
+
+    {
+      std::scoped_lock wlock(m_write_lock);
+      write_queued(b);
+    }
+    b.reset();
+
+    lock.lock();
+    m_writing = false;
+    m_cond_drain.notify_all();
+  }
+  return NULL;
+}
+
+void StderrSink::set_prefix(std::string_view p)
+{
+  std::scoped_lock lock(m_prefix_lock);
+  m_prefix = p;
+}
+
+StderrSink::~StderrSink()
+{
+  if (!m_spliced.empty()) {
+    // whatever the pipe still refers to has to outlive us; the process is
+    // usually on its way out, and a reader may never come to wait for
+    new std::deque<Spliced>(std::move(m_spliced));
+  }
+}
+
+void StderrSink::set_splice(bool splice)
+{
+  struct stat st;
+  m_splice = splice && ::fstat(STDERR_FILENO, &st) == 0 &&
+    S_ISFIFO(st.st_mode);
+}
+
+bool StderrSink::_is_verbatim(const SinkBatch& b) const
+{
+  const auto mask = get_mask();
+  return std::all_of(
+    b.lines.begin(), b.lines.end(),
+    [this, mask](const SinkBatch::Line& l) {
+      return (l.sinks & mask) && (!l.prefixed || m_prefix.empty());
+    });
+}
+
+void StderrSink::write_queued(const SinkBatchRef& b)
+{
+  _release_consumed();
+  if (m_splice.load(std::memory_order_relaxed) && !b->text.empty()) {
+    bool verbatim;
+    {
+      std::scoped_lock lock(m_prefix_lock);
+      verbatim = _is_verbatim(*b);
+    }
+    if (verbatim && _splice(b)) {
+      return;
+    }
+  }
+  write(*b);
+}
+
+/// vmsplice all of b's text into the pipe; false if stderr turns out not
+/// to take it, and nothing was spliced
+bool StderrSink::_splice(const SinkBatchRef& b)
+{
+  struct iovec iov = {const_cast<char*>(b->text.data()), b->text.size()};
+  while (iov.iov_len) {
+    ssize_t r = ::vmsplice(STDERR_FILENO, &iov, 1, 0);
+    if (r < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      if (iov.iov_len == b->text.size()) {
+	// e.g. stderr was redirected to something else
+	m_splice = false;
+	return false;
+      }
+      break; // nowhere to report a failure to write to stderr
+    }
+    iov.iov_base = static_cast<char*>(iov.iov_base) + r;
+    iov.iov_len -= r;
+  }
+  m_spliced_bytes += b->text.size() - iov.iov_len;
+  m_spliced.push_back(Spliced{b, m_spliced_bytes});
+  return true;
+}
+
+/// let go of the batches the pipe's reader is done with.  The pipe may hold
+/// other writers' bytes too, which only makes this err on the side of
+/// keeping a batch.
+void StderrSink::_release_consumed()
+{
+  if (m_spliced.empty()) {
+    return;
+  }
+  int unread = 0;
+  if (::ioctl(STDERR_FILENO, FIONREAD, &unread) < 0) {
+    return;
+  }
+  const uint64_t consumed = m_spliced_bytes - std::min<uint64_t>(
+    unread, m_spliced_bytes);
+  while (!m_spliced.empty() && m_spliced.front().end <= consumed) {
+    m_spliced.pop_front();
+  }
+}
+
+void StderrSink::write(const SinkBatch& b)
+{
+  std::string_view out;
+  {
+    std::scoped_lock lock(m_prefix_lock);
+    const auto mask = get_mask();
+    if (_is_verbatim(b)) {
+      // the common case: the batch is exactly what stderr gets
+      out = std::string_view(b.text.data(), b.text.size());
+    } else {
+      m_out.clear();
+      for (auto& l : b.lines) {
+	if (!(l.sinks & mask)) {
+	  continue;
+	}
+	if (l.prefixed) {
+	  m_out.insert(m_out.end(), m_prefix.begin(), m_prefix.end());
+	}
+	auto line = b.get_line(l);
+	m_out.insert(m_out.end(), line.begin(), line.end());
+	m_out.push_back('\n');
+      }
+      out = std::string_view(m_out.data(), m_out.size());
+    }
+  }
+  if (!out.empty()) {
+    // nowhere to report a failure to write to stderr
+    (void)safe_write(STDERR_FILENO, out.data(), out.size());
+  }
+}
+
+void SyslogSink::write(const SinkBatch& b)
+{
+  const auto mask = get_mask();
+  for (auto& l : b.lines) {
+    if (l.sinks & mask) {
+      m_writer.append(LOG_USER|LOG_INFO, b.get_line(l));
+    }
+  }
+  m_writer.flush();
+}
+
+}
+}
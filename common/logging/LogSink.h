@@ -0,0 +1,215 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_LOGSINK_H
+#define __CEPH_LOG_LOGSINK_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/utils/Thread.h"
+#include "Entry.h"
+#include "SyslogWriter.h"
+
+namespace ceph {
+namespace logging {
+
+/* Formatted log lines on their way to one or more sinks.
+ *
+ * The log thread formats each line once, appends it here tagged with the
+ * sinks that want it, and hands the same batch to every one of them; the
+ * batch is freed once the last sink is done with it.
+ */
+struct SinkBatch {
+  struct Line {
+    uint32_t off;    ///< into text
+    uint32_t len;    ///< excluding the trailing '\n'
+    uint16_t body;   ///< where the message starts after the stamp etc.
+    uint8_t sinks;   ///< LogSink::get_mask() of every sink it is for
+    bool prefixed;   ///< gets log_stderr_prefix on stderr
+    short prio;
+    short subsys;
+    pthread_t thread;
+    log_time stamp;
+  };
+
+  std::vector<char> text; ///< every line followed by '\n'
+  std::vector<Line> lines;
+  uint8_t sinks = 0;      ///< union of the lines' sinks
+
+  /// line is e's formatted text, of which the last body bytes are the
+  /// message itself; without an entry it is a message from the log
+  void append(uint8_t to, const Entry *e, std::string_view line,
+	      std::size_t body, bool prefixed) {
+    Line l;
+    l.off = static_cast<uint32_t>(text.size());
+    l.len = static_cast<uint32_t>(line.size());
+    l.body = static_cast<uint16_t>(line.size() - body);
+    l.sinks = to;
+    l.prefixed = prefixed;
+    if (e) {
+      l.prio = e->m_prio;
+      l.subsys = e->m_subsys;
+      l.thread = e->m_thread;
+      l.stamp = e->stamp();
+    } else {
+      l.prio = -1;
+      l.subsys = 0;
+      l.thread = pthread_self();
+      l.stamp = Entry::clock().now();
+    }
+    lines.push_back(l);
+    text.insert(text.end(), line.begin(), line.end());
+    text.push_back('\n');
+    sinks |= to;
+  }
+
+  std::string_view get_line(const Line& l) const {
+    return std::string_view(text.data() + l.off, l.len);
+  }
+  std::string_view get_body(const Line& l) const {
+    return get_line(l).substr(l.body);
+  }
+};
+using SinkBatchRef = std::shared_ptr<const SinkBatch>;
+
+/* A log destination with its own thread and bounded queue.
+ *
+ * submit() never waits: a sink that can't keep up (a stderr pipe nobody
+ * reads, a stalled syslog daemon) drops whole batches and counts their
+ * lines instead of holding up the log thread and, with it, the log file.
+ */
+class LogSink : private Thread
+{
+public:
+  static constexpr std::size_t DEFAULT_MAX_PENDING = 64;
+
+  LogSink(const char *name, unsigned id);
+  ~LogSink() override;
+
+  uint8_t get_mask() const {
+    return 1 << m_id;
+  }
+
+  void set_max_pending(std::size_t n);
+
+  /// queue b for the sink thread, which is started on first use; if
+  /// max_pending batches are already queued, b is dropped instead
+  void submit(const SinkBatchRef& b);
+  /// write b on the calling thread, after everything queued
+  void write_now(const SinkBatch& b);
+
+  /// wait until everything queued so far has been written, or until
+  void drain(std::chrono::steady_clock::time_point until =
+	       std::chrono::steady_clock::time_point::max());
+  /// write out everything queued, then exit the thread; what is still
+  /// queued at until is dropped (a write already under way is finished)
+  void stop(std::chrono::steady_clock::time_point until =
+	      std::chrono::steady_clock::time_point::max());
+
+  /// hold the locks across a fork(), outside of a write; the child comes
+  /// out of after_fork() with the thread not started and nothing queued
+  void prepare_fork();
+  void after_fork(bool child);
+
+  /// lines dropped on a full queue so far
+  uint64_t get_dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+protected:
+  /// write the lines of b for this sink; only ever called by one thread at
+  /// a time
+  virtual void write(const SinkBatch& b) = 0;
+  /// write() for a queued batch, which a sink may hold on to for longer
+  virtual void write_queued(const SinkBatchRef& b) {
+    write(*b);
+  }
+
+  /// for lines a sink had to give up on itself
+  void count_dropped(uint64_t n) {
+    m_dropped.fetch_add(n, std::memory_order_relaxed);
+  }
+  /// lines of b for this sink
+  uint64_t count_lines(const SinkBatch& b) const;
+
+private:
+  void *entry() override;
+  /// drain() with m_lock held; false if until came first
+  bool _wait_drained(std::unique_lock<std::mutex>& lock,
+		     std::chrono::steady_clock::time_point until);
+
+  const char *m_name;
+  const unsigned m_id;
+
+  std::mutex m_lock;
+  std::condition_variable m_cond_sink;
+  std::condition_variable m_cond_drain;
+  std::deque<SinkBatchRef> m_pending;
+  std::size_t m_max_pending = DEFAULT_MAX_PENDING;
+  bool m_writing = false;
+  bool m_stop = false;
+  std::mutex m_write_lock; ///< serializes write()
+  std::atomic<uint64_t> m_dropped{0};
+};
+
+/// stderr: one write(2) per batch, or with set_splice() and stderr a pipe,
+/// one vmsplice(2) of the batch's own text
+class StderrSink final : public LogSink {
+public:
+  explicit StderrSink(unsigned id) : LogSink("log_stderr", id) {}
+  ~StderrSink() override;
+
+  void set_prefix(std::string_view p);
+  /// splice queued batches into the stderr pipe instead of copying them
+  /// in; ignored unless stderr is a pipe
+  void set_splice(bool splice);
+
+private:
+  void write(const SinkBatch& b) override;
+  void write_queued(const SinkBatchRef& b) override;
+  /// whether b is exactly the text stderr gets; m_prefix_lock
+  bool _is_verbatim(const SinkBatch& b) const;
+  bool _splice(const SinkBatchRef& b);
+  void _release_consumed();
+
+  std::mutex m_prefix_lock;
+  std::string m_prefix;
+  std::vector<char> m_out;
+
+  /// The pipe refers to spliced pages until its reader has read them, so
+  /// each spliced batch is kept until the bytes after it have been
+  /// spliced and the pipe holds fewer than that.  Only the sink thread
+  /// touches these.
+  struct Spliced {
+    SinkBatchRef batch;
+    uint64_t end; ///< m_spliced_bytes once it was in the pipe
+  };
+  std::atomic<bool> m_splice{false};
+  std::deque<Spliced> m_spliced;
+  uint64_t m_spliced_bytes = 0;
+};
+
+/// syslog: one batch of datagrams per batch
+class SyslogSink final : public LogSink {
+public:
+  explicit SyslogSink(unsigned id) : LogSink("log_syslog", id) {}
+
+private:
+  void write(const SinkBatch& b) override;
+
+  SyslogWriter m_writer;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,47 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_LOGTASK_H
+#define __CEPH_LOG_LOGTASK_H
+
+#include <pthread.h>
+#include <cstdint>
+
+namespace ceph {
+namespace logging {
+
+/* For code that runs many tasks (boost fibers, coroutines) on a few
+ * threads, where the thread an entry was made on says little.
+ *
+ * The scheduler calls set_log_task() whenever it switches to a task (in a
+ * boost::fibers algorithm's pick_next(), say), with an id of its choosing
+ * such as the address of the task's context, and set_log_task(0) when it
+ * runs none.  Entries made meanwhile carry the id where the pthread_t
+ * would be, so the log's thread column tells tasks apart; an id should not
+ * be mistaken for one of the process's pthread_ts, which addresses of
+ * heap-allocated contexts are not.
+ *
+ * A reactor thread with many tasks formatting at once, each holding a
+ * stream across a switch, also wants a bigger stream cache than a thread
+ * that formats one entry at a time; see
+ * CachedStackStringStream::set_thread_cache_size().
+ */
+inline thread_local uint64_t t_log_task = 0;
+
+inline void set_log_task(uint64_t id) {
+  t_log_task = id;
+}
+
+inline uint64_t get_log_task() {
+  return t_log_task;
+}
+
+/// what an entry made now records as its thread
+inline pthread_t log_thread_id() {
+  return t_log_task ? static_cast<pthread_t>(t_log_task) : pthread_self();
+}
+
+}
+}
+
+#endif
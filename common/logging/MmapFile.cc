@@ -0,0 +1,155 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "MmapFile.h"
+
+#include "include/compat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace ceph {
+namespace logging {
+
+static const off_t page_size = sysconf(_SC_PAGESIZE);
+
+/// the last bytes of a mapped chunk: where the data ends, as zeros are
+/// no proof of it
+struct Trailer {
+  char magic[8];
+  uint64_t tail;
+};
+static constexpr char trailer_magic[8] = {'\0', 'l', 'o', 'g', 't', 'a', 'i', 'l'};
+
+MmapFile::MmapFile(std::size_t chunk)
+  // past a tail in a chunk's first page there must be room for more than
+  // the trailer
+  : m_chunk((std::max<std::size_t>(chunk, 2 * page_size) + page_size - 1) &
+	    ~(page_size - 1))
+{
+}
+
+MmapFile::~MmapFile()
+{
+  close();
+}
+
+int MmapFile::open(int fd)
+{
+  close();
+
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    return -errno;
+  }
+
+  // A previous instance that died with the file mapped leaves the
+  // preallocated space behind the data, and a trailer saying where the
+  // data ends; a file that was closed (or never mapped) ends with its data.
+  off_t tail = st.st_size;
+  Trailer t;
+  if (st.st_size >= (off_t)sizeof(t) &&
+      ::pread(fd, &t, sizeof(t), st.st_size - sizeof(t)) == sizeof(t) &&
+      memcmp(t.magic, trailer_magic, sizeof(t.magic)) == 0 &&
+      t.tail <= (uint64_t)st.st_size - sizeof(t)) {
+    tail = t.tail;
+    // a chunk mapped from here may end short of the stale trailer
+    if (::ftruncate(fd, tail) < 0) {
+      return -errno;
+    }
+  }
+
+  m_fd = fd;
+  int r = _map(tail);
+  if (r < 0) {
+    m_fd = -1;
+    return r;
+  }
+  return 0;
+}
+
+int MmapFile::_map(off_t tail)
+{
+  _unmap();
+  const off_t off = tail & ~(page_size - 1);
+#ifdef __linux__
+  int r = ::fallocate(m_fd, 0, off, m_chunk);
+#else
+  int r = ::posix_fallocate(m_fd, off, m_chunk);
+  if (r) {
+    errno = r;
+    r = -1;
+  }
+#endif
+  if (r < 0) {
+    return -errno;
+  }
+  void *p = ::mmap(nullptr, m_chunk, PROT_READ|PROT_WRITE, MAP_SHARED,
+		   m_fd, off);
+  if (p == MAP_FAILED) {
+    return -errno;
+  }
+  m_map = static_cast<char*>(p);
+  m_map_off = off;
+  m_tail = tail;
+  _mark_tail();
+  return 0;
+}
+
+void MmapFile::_mark_tail()
+{
+  Trailer t;
+  memcpy(t.magic, trailer_magic, sizeof(t.magic));
+  t.tail = m_tail;
+  memcpy(m_map + m_chunk - sizeof(t), &t, sizeof(t));
+}
+
+void MmapFile::_unmap()
+{
+  if (m_map) {
+    ::munmap(m_map, m_chunk);
+    m_map = nullptr;
+  }
+}
+
+int MmapFile::write(std::string_view sv)
+{
+  // the data stops short of the chunk's trailer
+  const off_t room = m_chunk - sizeof(Trailer);
+  while (!sv.empty()) {
+    if (!m_map || m_tail >= m_map_off + room) {
+      int r = _map(m_tail);
+      if (r < 0) {
+	return r;
+      }
+    }
+    std::size_t n = std::min<std::size_t>(sv.size(),
+					  m_map_off + room - m_tail);
+    memcpy(m_map + (m_tail - m_map_off), sv.data(), n);
+    m_tail += n;
+    sv.remove_prefix(n);
+  }
+  _mark_tail();
+  return 0;
+}
+
+void MmapFile::close()
+{
+  if (m_fd < 0) {
+    return;
+  }
+  _unmap();
+  // drop the preallocated space and the trailer past the data
+  VOID_TEMP_FAILURE_RETRY(::ftruncate(m_fd, m_tail));
+  m_fd = -1;
+}
+
+}
+}
@@ -0,0 +1,64 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_MMAPFILE_H
+#define __CEPH_LOG_MMAPFILE_H
+
+#include <string_view>
+#include <sys/types.h>
+
+namespace ceph {
+namespace logging {
+
+/* Appends to a file through a shared memory mapping instead of write(2).
+ *
+ * The file is extended with fallocate() one chunk at a time and the chunk
+ * is mapped; writes are plain memcpy()s that advance the tail. Whatever has
+ * been copied into the mapping reaches the file even if the process dies
+ * without unmapping. Each write also records the tail in a trailer at the
+ * end of the chunk, so a file that was not closed cleanly ends in zeroed
+ * preallocated space and then that trailer; open() cuts the file back to
+ * the tail it names, and close() trims the space and the trailer.
+ *
+ * The fd stays owned by the caller.
+ */
+class MmapFile {
+public:
+  static constexpr std::size_t DEFAULT_CHUNK = 16 << 20;
+
+  explicit MmapFile(std::size_t chunk = DEFAULT_CHUNK);
+  MmapFile(const MmapFile&) = delete;
+  MmapFile& operator=(const MmapFile&) = delete;
+  ~MmapFile();
+
+  /// start appending to fd; returns 0 or -errno
+  int open(int fd);
+  /// returns 0 or -errno; on error nothing more should be written
+  int write(std::string_view sv);
+  /// unmap and truncate the file to what was actually written
+  void close();
+
+  bool is_open() const {
+    return m_fd >= 0;
+  }
+  /// bytes in the file, not counting the preallocated space
+  off_t get_size() const {
+    return m_tail;
+  }
+
+private:
+  int _map(off_t tail);
+  void _unmap();
+  void _mark_tail();
+
+  const std::size_t m_chunk;
+  int m_fd = -1;
+  char *m_map = nullptr;
+  off_t m_map_off = 0;  ///< file offset of m_map
+  off_t m_tail = 0;     ///< file offset of the next byte to write
+};
+
+}
+}
+
+#endif
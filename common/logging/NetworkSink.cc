@@ -0,0 +1,298 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "NetworkSink.h"
+
+#include "include/compat.h"
+#include "common/str_escape.h"
+
+#include "BinaryLog.h"
+#include "SubsystemMap.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace ceph {
+namespace logging {
+
+static constexpr std::size_t MAX_BATCH = 64;
+
+NetworkSink::NetworkSink(unsigned id, const SubsystemMap *subs)
+  : LogSink("log_network", id), m_subs(subs)
+{
+}
+
+NetworkSink::~NetworkSink()
+{
+  _close();
+}
+
+void NetworkSink::set_destination(std::string_view host, int port)
+{
+  std::scoped_lock lock(m_config_lock);
+  m_host = host;
+  m_port = port;
+  m_changed = true;
+}
+
+void NetworkSink::set_transport(Protocol proto, Format format)
+{
+  std::scoped_lock lock(m_config_lock);
+  m_proto = proto;
+  m_format = format;
+  m_changed = true;
+}
+
+void NetworkSink::set_hostname(std::string_view host)
+{
+  std::scoped_lock lock(m_config_lock);
+  m_hostname = host;
+  m_changed = true;
+}
+
+void NetworkSink::set_fsid(std::string_view fsid)
+{
+  std::scoped_lock lock(m_config_lock);
+  m_fsid = fsid;
+  m_changed = true;
+}
+
+void NetworkSink::write(const SinkBatch& b)
+{
+  {
+    std::scoped_lock lock(m_config_lock);
+    if (m_changed) {
+      _close();
+      m_retry_at = {};
+      m_cur_proto = m_proto;
+      m_cur_format = m_format;
+      m_cur_hostname = m_hostname;
+      m_cur_fsid = m_fsid;
+      m_changed = false;
+    }
+  }
+  const uint64_t lines = count_lines(b);
+  if (m_fd < 0 && !_connect()) {
+    count_dropped(lines);
+    return;
+  }
+
+  m_out.clear();
+  m_records.clear();
+  const auto mask = get_mask();
+  for (auto& l : b.lines) {
+    if (!(l.sinks & mask)) {
+      continue;
+    }
+    const std::size_t start = m_out.size();
+    if (m_cur_format == Format::GELF) {
+      _encode_gelf(b, l);
+    } else {
+      _encode_binary(b, l);
+    }
+    m_records.emplace_back(start, m_out.size() - start);
+  }
+
+  std::size_t sent = m_cur_proto == Protocol::UDP ? _send_udp() : _send_tcp();
+  if (sent < m_records.size()) {
+    count_dropped(m_records.size() - sent);
+  }
+}
+
+bool NetworkSink::_connect()
+{
+  if (ceph::coarse_mono_clock::now() < m_retry_at) {
+    return false;
+  }
+  std::string host;
+  int port;
+  {
+    std::scoped_lock lock(m_config_lock);
+    host = m_host;
+    port = m_port;
+  }
+  // retry at most once a second while the collector is unreachable
+  m_retry_at = ceph::coarse_mono_clock::now() + std::chrono::seconds(1);
+  if (host.empty() || port <= 0) {
+    return false;
+  }
+
+  struct addrinfo hints, *res = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = m_cur_proto == Protocol::UDP ? SOCK_DGRAM : SOCK_STREAM;
+  char service[16];
+  snprintf(service, sizeof(service), "%d", port);
+  if (getaddrinfo(host.c_str(), service, &hints, &res) != 0) {
+    return false;
+  }
+  for (auto ai = res; ai; ai = ai->ai_next) {
+    m_fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+		    ai->ai_protocol);
+    if (m_fd < 0) {
+      continue;
+    }
+    // bounds both connect() and a collector that stops reading
+    struct timeval tv = {1, 0};
+    ::setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (::connect(m_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    _close();
+  }
+  freeaddrinfo(res);
+  return m_fd >= 0;
+}
+
+void NetworkSink::_close()
+{
+  if (m_fd >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+    m_fd = -1;
+  }
+}
+
+static void append_json_string(std::vector<char>& out, std::string_view s)
+{
+  out.push_back('"');
+  ceph::json_escape(s, [&out](const char *p, std::size_t n) {
+    out.insert(out.end(), p, p + n);
+  });
+  out.push_back('"');
+}
+
+/// ceph priorities (lower is more important) to syslog severities
+static int gelf_level(short prio)
+{
+  if (prio < 0) {
+    return 3; // error
+  } else if (prio == 0) {
+    return 5; // notice
+  } else if (prio < 5) {
+    return 6; // info
+  }
+  return 7; // debug
+}
+
+void NetworkSink::_encode_gelf(const SinkBatch& b, const SinkBatch::Line& l)
+{
+  auto body = b.get_body(l);
+  if (m_cur_proto == Protocol::UDP) {
+    // leave room for the other fields in a single datagram
+    body = body.substr(0, MAX_DATAGRAM / 2);
+  }
+  auto append = [this](std::string_view s) {
+    m_out.insert(m_out.end(), s.begin(), s.end());
+  };
+  auto tv = log_clock::to_timeval(l.stamp);
+  char buf[128];
+
+  append("{\"version\":\"1.1\",\"host\":");
+  append_json_string(m_out, m_cur_hostname);
+  append(",\"short_message\":");
+  append_json_string(m_out, body);
+  int n = snprintf(buf, sizeof(buf),
+		   ",\"timestamp\":%ld.%06ld,\"level\":%d,\"_prio\":%d,"
+		   "\"_thread\":\"%lx\",\"_subsys\":",
+		   (long)tv.tv_sec, (long)tv.tv_usec, gelf_level(l.prio), l.prio,
+		   (unsigned long)l.thread);
+  append(std::string_view(buf, n));
+  append_json_string(m_out, m_subs->get_name(l.subsys));
+  if (!m_cur_fsid.empty()) {
+    append(",\"_fsid\":");
+    append_json_string(m_out, m_cur_fsid);
+  }
+  m_out.push_back('}');
+  if (m_cur_proto == Protocol::TCP) {
+    m_out.push_back('\0');
+  }
+}
+
+void NetworkSink::_encode_binary(const SinkBatch& b, const SinkBatch::Line& l)
+{
+  auto body = b.get_body(l);
+  if (m_cur_proto == Protocol::UDP) {
+    body = body.substr(0, MAX_DATAGRAM - sizeof(binary::record_header));
+  }
+  auto count = l.stamp.time_since_epoch().count();
+  binary::record_header h;
+  memset(&h, 0, sizeof(h));
+  h.magic = binary::RECORD_MAGIC;
+  h.len = static_cast<uint32_t>(body.size());
+  h.stamp = count.count;
+  h.thread = (uint64_t)l.thread;
+  h.prio = l.prio;
+  h.subsys = l.subsys;
+  h.flags = count.coarse ? binary::FLAG_COARSE : 0;
+  const char *p = reinterpret_cast<const char*>(&h);
+  m_out.insert(m_out.end(), p, p + sizeof(h));
+  m_out.insert(m_out.end(), body.begin(), body.end());
+}
+
+/// returns the number of records sent
+std::size_t NetworkSink::_send_udp()
+{
+  struct iovec iov[MAX_BATCH];
+  struct mmsghdr msgs[MAX_BATCH];
+  std::size_t sent = 0;
+  while (sent < m_records.size()) {
+    const std::size_t n = std::min(m_records.size() - sent, MAX_BATCH);
+    memset(msgs, 0, sizeof(msgs[0]) * n);
+    for (std::size_t i = 0; i < n; ++i) {
+      iov[i].iov_base = m_out.data() + m_records[sent + i].first;
+      iov[i].iov_len = m_records[sent + i].second;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int r = sendmmsg(m_fd, msgs, n, MSG_NOSIGNAL);
+    if (r < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+	// e.g. ECONNREFUSED from an earlier datagram; resolve again later
+	_close();
+      }
+      break;
+    }
+    sent += r;
+  }
+  return sent;
+}
+
+/// returns the number of records sent completely
+std::size_t NetworkSink::_send_tcp()
+{
+  const char *p = m_out.data();
+  std::size_t left = m_out.size();
+  while (left > 0) {
+    ssize_t r = ::send(m_fd, p, left, MSG_NOSIGNAL);
+    if (r < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      // a partial record would corrupt the stream; start over
+      _close();
+      break;
+    }
+    p += r;
+    left -= r;
+  }
+  const std::size_t done = p - m_out.data();
+  return std::count_if(
+    m_records.begin(), m_records.end(),
+    [done](const std::pair<std::size_t, std::size_t>& rec) {
+      return rec.first + rec.second <= done;
+    });
+}
+
+}
+}
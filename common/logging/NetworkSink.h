@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_NETWORKSINK_H
+#define __CEPH_LOG_NETWORKSINK_H
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/utils/ceph_time.h"
+#include "LogSink.h"
+
+namespace ceph {
+namespace logging {
+
+class SubsystemMap;
+
+/* Ships log lines to a remote collector such as graylog.
+ *
+ * Each line becomes one record, either a GELF (JSON) message or a binary
+ * log record (see BinaryLog.h), sent over UDP (one datagram per record,
+ * many per sendmmsg()) or a persistent TCP connection (GELF records are
+ * NUL terminated, as graylog's GELF TCP input expects). Everything happens
+ * on the sink's thread: a collector that is slow, down or unreachable only
+ * costs the lines that could not be sent, which are counted as dropped.
+ */
+class NetworkSink final : public LogSink {
+public:
+  enum class Protocol {
+    UDP,
+    TCP,
+  };
+  enum class Format {
+    GELF,
+    BINARY,
+  };
+
+  NetworkSink(unsigned id, const SubsystemMap *subs);
+  ~NetworkSink() override;
+
+  /// takes effect with the next batch
+  void set_destination(std::string_view host, int port);
+  void set_transport(Protocol proto, Format format);
+  /// reported as the GELF host and _fsid fields
+  void set_hostname(std::string_view host);
+  void set_fsid(std::string_view fsid);
+
+private:
+  /// GELF UDP datagrams are expected to fit in one chunk
+  static constexpr std::size_t MAX_DATAGRAM = 8192;
+
+  void write(const SinkBatch& b) override;
+
+  bool _connect();
+  void _close();
+  void _encode_gelf(const SinkBatch& b, const SinkBatch::Line& l);
+  void _encode_binary(const SinkBatch& b, const SinkBatch::Line& l);
+  std::size_t _send_udp();
+  std::size_t _send_tcp();
+
+  const SubsystemMap *m_subs;
+
+  std::mutex m_config_lock;
+  std::string m_host;
+  int m_port = 0;
+  Protocol m_proto = Protocol::UDP;
+  Format m_format = Format::GELF;
+  std::string m_hostname;
+  std::string m_fsid;
+  bool m_changed = false; ///< reconnect before the next batch
+
+  // only touched by the sink's thread
+  int m_fd = -1;
+  Protocol m_cur_proto = Protocol::UDP;
+  Format m_cur_format = Format::GELF;
+  std::string m_cur_hostname;
+  std::string m_cur_fsid;
+  ceph::coarse_mono_time m_retry_at; ///< don't reconnect before this
+  std::vector<char> m_out;           ///< encoded records
+  std::vector<std::pair<std::size_t, std::size_t>> m_records; ///< off, len
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,109 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_RATELIMIT_H
+#define __CEPH_LOG_RATELIMIT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "common/utils/ceph_time.h"
+#include "SubsystemMap.h"
+
+namespace ceph {
+namespace logging {
+
+/* Per-subsystem token buckets for gathered log entries.
+ *
+ * The common case is a single relaxed fetch_sub on the subsystem's bucket.
+ * Only once the bucket runs dry does a submitter look at the clock; the
+ * first one to see that a token's worth of time has passed refills it.
+ * Entries that find no token are counted so the log thread can report them
+ * once the subsystem is allowed to log again.
+ */
+class RateLimiter {
+  struct alignas(64) Bucket {
+    std::atomic<int64_t> tokens{0};
+    std::atomic<uint64_t> last{0};       ///< coarse mono ns of the last refill
+    std::atomic<uint64_t> suppressed{0}; ///< entries dropped since last report
+  };
+
+public:
+  explicit RateLimiter(std::size_t n)
+    : m_buckets(std::make_unique<Bucket[]>(n)), m_num(n) {}
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  /// take a token for an entry of subsystem sub; false if it is over rate
+  bool admit(unsigned sub, const log_rate_t& rate) {
+    auto& b = m_buckets[sub < m_num ? sub : 0];
+    if (b.tokens.fetch_sub(1, std::memory_order_relaxed) > 0) {
+      return true;
+    }
+    if (refill(b, rate) && b.tokens.fetch_sub(1, std::memory_order_relaxed) > 0) {
+      return true;
+    }
+    b.suppressed.fetch_add(1, std::memory_order_relaxed);
+    m_any_suppressed.store(true, std::memory_order_relaxed);
+    return false;
+  }
+
+  /// called by the log thread: f(sub, n) for every subsystem whose bucket
+  /// has refilled after suppressing n entries
+  template<typename GetRate, typename F>
+  void report(GetRate&& get_rate, F&& f) {
+    if (!m_any_suppressed.exchange(false, std::memory_order_relaxed)) {
+      return;
+    }
+    for (std::size_t i = 0; i < m_num; ++i) {
+      auto& b = m_buckets[i];
+      if (b.suppressed.load(std::memory_order_relaxed) == 0) {
+	continue;
+      }
+      // nobody may be logging to refill it for us; a lifted limit is
+      // reported right away
+      const log_rate_t rate = get_rate(i);
+      if (rate.rate && b.tokens.load(std::memory_order_relaxed) <= 0 &&
+	  !refill(b, rate)) {
+	m_any_suppressed.store(true, std::memory_order_relaxed);
+	continue;
+      }
+      if (auto n = b.suppressed.exchange(0, std::memory_order_relaxed); n) {
+	f(i, n);
+      }
+    }
+  }
+
+private:
+  static bool refill(Bucket& b, const log_rate_t& rate) {
+    if (rate.rate == 0) {
+      return false;
+    }
+    const uint64_t burst = rate.burst ? rate.burst : rate.rate;
+    const uint64_t per_token = std::max<uint64_t>(1000000000ull / rate.rate, 1);
+    const uint64_t now = coarse_mono_clock::now().time_since_epoch().count();
+    uint64_t last = b.last.load(std::memory_order_relaxed);
+    const uint64_t add = (now - last) / per_token;
+    if (add == 0) {
+      return false;
+    }
+    // a long idle period fills the bucket, it doesn't bank more than burst
+    const uint64_t next = add > burst ? now : last + add * per_token;
+    if (!b.last.compare_exchange_strong(last, next)) {
+      return true; // someone else refilled it
+    }
+    b.tokens.store(std::min(add, burst), std::memory_order_relaxed);
+    return true;
+  }
+
+  std::unique_ptr<Bucket[]> m_buckets;
+  const std::size_t m_num;
+  std::atomic<bool> m_any_suppressed{false};
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,117 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "RecentRing.h"
+
+#include "include/compat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+
+namespace ceph {
+namespace logging {
+
+int RecentRing::set_file(const std::string& path)
+{
+  if (path == m_path) {
+    return 0;
+  }
+  _unmap();
+  clear();
+  m_path = path;
+  if (path.empty()) {
+    return 0;
+  }
+  int r = _map(limit(), true);
+  if (r < 0) {
+    m_path.clear();
+  }
+  return r;
+}
+
+void RecentRing::set_max_bytes(std::size_t n)
+{
+  m_max_bytes = n;
+  if (m_shared) {
+    if (m_capacity != limit()) {
+      _unmap();
+      clear();
+      if (_map(limit(), false) < 0) {
+	m_path.clear();
+      }
+    }
+  } else if (m_capacity > limit()) {
+    clear();
+    m_buf.reset();
+    m_data = nullptr;
+    m_capacity = 0;
+  }
+}
+
+/// map m_path with a ring of size bytes; keep_prev keeps what an earlier
+/// process left there as m_path.prev
+int RecentRing::_map(std::size_t size, bool keep_prev)
+{
+  if (keep_prev) {
+    // what the last run left behind is exactly what this is for
+    const std::string prev = m_path + ".prev";
+    if (::rename(m_path.c_str(), prev.c_str()) < 0 && errno != ENOENT) {
+      return -errno;
+    }
+  }
+  int fd = ::open(m_path.c_str(), O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return -errno;
+  }
+  const std::size_t len = sizeof(binary::recent_header) + size;
+  void *p = MAP_FAILED;
+  int r = 0;
+  if (::ftruncate(fd, len) < 0) {
+    r = -errno;
+  } else {
+    p = ::mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      r = -errno;
+    }
+  }
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  if (r < 0) {
+    ::unlink(m_path.c_str());
+    return r;
+  }
+
+  m_shared = static_cast<binary::recent_header*>(p);
+  memset(m_shared, 0, sizeof(*m_shared));
+  m_shared->version = binary::RECENT_VERSION;
+  m_shared->header_size = sizeof(binary::recent_header);
+  m_shared->ring_size = size;
+  m_shared->pid = getpid();
+  // a reader that sees the magic sees a complete header
+  std::atomic_thread_fence(std::memory_order_release);
+  m_shared->magic = binary::RECENT_MAGIC;
+  m_map_len = len;
+  m_buf.reset();
+  m_data = static_cast<char*>(p) + sizeof(binary::recent_header);
+  m_capacity = size;
+  clear();
+  return 0;
+}
+
+void RecentRing::_unmap()
+{
+  if (!m_shared) {
+    return;
+  }
+  ::munmap(m_shared, m_map_len);
+  m_shared = nullptr;
+  m_map_len = 0;
+  m_data = nullptr;
+  m_capacity = 0;
+}
+
+}
+}
@@ -0,0 +1,511 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_RECENTRING_H
+#define __CEPH_LOG_RECENTRING_H
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "BinaryLog.h"
+#include "Entry.h"
+#include "HugePages.h"
+#include "ThreadNames.h"
+#include "include/ceph_assert.h"
+
+namespace ceph {
+namespace logging {
+
+/* The in-memory crash ring: recent entries packed back to back as a fixed
+ * header plus exactly as many payload bytes as the message needs.
+ *
+ * Records never straddle the end of the buffer. When one doesn't fit in the
+ * space left at the end, writing wraps to the front and the gap is skipped
+ * on read (m_wrap marks where the old data stops). The oldest records are
+ * evicted when either the byte or the entry budget is exhausted. The buffer
+ * itself grows on demand up to the byte budget, so memory tracks actual
+ * log volume.
+ *
+ * In memory, records have a 16-byte Packed header rather than the 40-byte
+ * log_format=binary one, which for the typical short message is most of a
+ * record. With set_file() the ring lives in a shared mapping of a file laid
+ * out as binary::recent_header plus the ring, with binary headers for
+ * ceph-log-decode --recent to read, and the header's positions are kept
+ * current on every push, so the last entries survive even a SIGKILL.
+ */
+class RecentRing {
+  using Header = binary::record_header;
+
+  /// a record header in memory; header() gives it back as a Header
+  struct Packed {
+    uint64_t stamp;  ///< as Header::stamp
+    uint32_t len;    ///< the payload's, under LEN_MASK; the rest are flags
+    uint16_t thread; ///< see ThreadIndex
+    int8_t prio;     ///< clamped to fit
+    uint8_t subsys;
+  };
+  static_assert(sizeof(Packed) == 16);
+  static_assert(alignof(Packed) == alignof(Header));
+  static_assert(ceph_subsys_get_num() <= 256, "Packed::subsys is full");
+
+  static constexpr uint32_t LEN_MASK = (1u << 30) - 1;
+  static constexpr uint32_t PACKED_COARSE = 1u << 30;
+  static constexpr uint32_t PACKED_DEFERRED = 1u << 31;
+
+  static constexpr std::size_t ALIGN = alignof(Header);
+  static constexpr std::size_t MIN_CAPACITY = 64 * 1024;
+
+  /// a record read back out of the ring; only valid during for_each()
+  class View final : public Entry {
+  public:
+    /// with a scratch buffer, deferred records are rendered into it rather
+    /// than into an allocated string
+    View(const Header& h, std::string_view payload, char *scratch = nullptr,
+	 std::size_t scratch_len = 0)
+      : Entry(h.prio, h.subsys), m_payload(payload) {
+      set_stamp(binary::header_stamp(h));
+      m_thread = (pthread_t)h.thread;
+      if (h.flags & binary::FLAG_DEFERRED) {
+	// never written out before; format it now
+	ConcreteEntry::render_fn render;
+	memcpy(&render, payload.data(), sizeof(render));
+	if (scratch) {
+	  FixedStreambuf sb(scratch, scratch_len);
+	  std::ostream out(&sb);
+	  render(payload.data() + sizeof(render), out);
+	  m_payload = sb.strv();
+	} else {
+	  CachedStackStringStream css;
+	  render(payload.data() + sizeof(render), *css);
+	  m_text = css->strv();
+	  m_payload = m_text;
+	}
+      }
+    }
+
+    std::string_view strv() const override {
+      return m_payload;
+    }
+    std::size_t size() const override {
+      return m_payload.size();
+    }
+
+  private:
+    std::string_view m_payload;
+    std::string m_text;
+  };
+
+public:
+  RecentRing(std::size_t max_entries, std::size_t max_bytes)
+    : m_max_entries(max_entries), m_max_bytes(max_bytes) {}
+  RecentRing(const RecentRing&) = delete;
+  RecentRing& operator=(const RecentRing&) = delete;
+  ~RecentRing() {
+    _unmap();
+  }
+
+  /// keep the ring in a shared mapping of path, or on the heap if path is
+  /// empty; drops the current entries. An existing ring file is first
+  /// renamed to path.prev. Returns 0 or -errno.
+  int set_file(const std::string& path);
+
+  void push_back(const Entry& e) {
+    if (m_max_entries == 0) {
+      return;
+    }
+    auto payload = e.strv();
+    // a single oversized message is truncated rather than dropped
+    payload = payload.substr(0, max_payload());
+    _push(e, nullptr, payload);
+  }
+
+  /// keeps deferred entries unformatted until they are dumped, and copies
+  /// a large message's pieces without joining them first
+  void push_back(const ConcreteEntry& e) {
+    auto render = e.get_render();
+    if (!render && e.segmented()) {
+      if (m_max_entries == 0) {
+	return;
+      }
+      std::size_t left = std::min(e.size(), max_payload());
+      char *pos = _begin_push(e, nullptr, left);
+      e.for_each_segment([&pos, &left](std::string_view piece) {
+	const std::size_t n = std::min(left, piece.size());
+	std::memcpy(pos, piece.data(), n);
+	pos += n;
+	left -= n;
+      });
+      _end_push();
+      return;
+    }
+    if (!render) {
+      push_back(static_cast<const Entry&>(e));
+      return;
+    }
+    if (m_max_entries == 0) {
+      return;
+    }
+    if (m_shared) {
+      // a render function means nothing to another process
+      push_back(static_cast<const Entry&>(e));
+      return;
+    }
+    auto raw = e.raw();
+    if (sizeof(render) + raw.size() > max_payload()) {
+      // can't be truncated safely; format it
+      push_back(static_cast<const Entry&>(e));
+      return;
+    }
+    _push(e, render, raw);
+  }
+
+  /// a read position, for walking several rings side by side
+  struct Cursor {
+    std::size_t pos;
+    std::size_t stop;
+    bool wrapped; ///< [0, m_end) is still to come after this segment
+  };
+
+  Cursor cursor() const {
+    Cursor c = m_wrapped ? Cursor{m_begin, m_wrap, true}
+			 : Cursor{m_begin, m_end, false};
+    _settle(c);
+    return c;
+  }
+  bool valid(const Cursor& c) const {
+    return c.pos < c.stop;
+  }
+  /// of the record at c
+  uint64_t stamp(const Cursor& c) const {
+    uint64_t stamp;
+    std::memcpy(&stamp, m_data + c.pos + (m_packed ? offsetof(Packed, stamp)
+					  : offsetof(Header, stamp)),
+		sizeof(stamp));
+    return stamp;
+  }
+  /// the record at c's header, to look at before paying for a visit()
+  Header header(const Cursor& c) const {
+    return _header_at(c.pos);
+  }
+  /// visit the record at c and move c to the next one
+  template<typename F>
+  void visit(Cursor& c, F&& f, char *scratch = nullptr,
+	     std::size_t scratch_len = 0) const {
+    const Header h = _header_at(c.pos);
+    f(View(h, std::string_view(m_data + c.pos + header_size(), h.len),
+	   scratch, scratch_len));
+    next(c);
+  }
+  /// move c to the next record without looking at this one
+  void next(Cursor& c) const {
+    c.pos += record_size(_len_at(c.pos));
+    _settle(c);
+  }
+
+  /// visit every record, oldest first, as an Entry (of a final type);
+  /// with a scratch buffer nothing is allocated (see View)
+  template<typename F>
+  void for_each(F&& f, char *scratch = nullptr,
+		std::size_t scratch_len = 0) const {
+    for (auto c = cursor(); valid(c); ) {
+      visit(c, f, scratch, scratch_len);
+    }
+  }
+
+  std::size_t size() const {
+    return m_count;
+  }
+  bool empty() const {
+    return m_count == 0;
+  }
+  /// bytes currently allocated for the ring
+  std::size_t capacity_bytes() const {
+    return m_capacity;
+  }
+  /// bytes of it its records take, headers and padding included
+  std::size_t used_bytes() const {
+    return m_wrapped ? m_wrap - m_begin + m_end : m_end - m_begin;
+  }
+  /// what the ring is in: "file", or the pages of its buffer (see
+  /// log_huge_pages)
+  const char *backing() const {
+    return m_shared ? "file" : huge_pages_name(m_buf.backing());
+  }
+
+  /// make this ring, which must not be in a file, a copy of from's
+  /// records: two memcpy()s, so from's owner is held up only for those,
+  /// and the copy can then be read at leisure
+  void copy_from(const RecentRing& from) {
+    const std::size_t first =
+      (from.m_wrapped ? from.m_wrap : from.m_end) - from.m_begin;
+    const std::size_t second = from.m_wrapped ? from.m_end : 0;
+    if (m_capacity < first + second) {
+      m_buf = HugeBuffer(first + second);
+      m_data = m_buf.get();
+      m_capacity = first + second;
+    }
+    if (first) {
+      std::memcpy(m_data, from.m_data + from.m_begin, first);
+    }
+    if (second) {
+      std::memcpy(m_data + first, from.m_data, second);
+    }
+    m_begin = m_wrap = 0;
+    m_end = first + second;
+    m_wrapped = false;
+    m_count = from.m_count;
+    m_packed = from.m_packed;
+  }
+
+  void clear() {
+    m_begin = m_end = m_wrap = 0;
+    m_wrapped = false;
+    m_count = 0;
+    m_packed = !m_shared;
+    _publish();
+  }
+
+  void set_max_entries(std::size_t n) {
+    m_max_entries = n;
+    while (m_count > m_max_entries) {
+      pop_front();
+    }
+    _publish();
+  }
+
+  /// takes effect as the ring grows; an already larger buffer is reset, and
+  /// a file is mapped again at the new size
+  void set_max_bytes(std::size_t n);
+
+private:
+  /// the budget, rounded down to ALIGN: records are a multiple of it, and
+  /// one that fits a ragged budget could fit no gap left between others
+  std::size_t limit() const {
+    return std::max(m_max_bytes, MIN_CAPACITY) & ~(ALIGN - 1);
+  }
+  std::size_t header_size() const {
+    return m_packed ? sizeof(Packed) : sizeof(Header);
+  }
+  /// the most payload a record can have
+  std::size_t max_payload() const {
+    return std::min<std::size_t>(limit() - header_size(), LEN_MASK);
+  }
+
+  Header _header_at(std::size_t pos) const {
+    Header h;
+    if (!m_packed) {
+      std::memcpy(&h, m_data + pos, sizeof(h));
+      return h;
+    }
+    Packed p;
+    std::memcpy(&p, m_data + pos, sizeof(p));
+    std::memset(&h, 0, sizeof(h));
+    h.magic = binary::RECORD_MAGIC;
+    h.len = p.len & LEN_MASK;
+    h.stamp = p.stamp;
+    h.thread = ThreadIndex::thread_of(p.thread);
+    h.prio = p.prio;
+    h.subsys = p.subsys;
+    h.flags = (p.len & PACKED_COARSE ? binary::FLAG_COARSE : 0) |
+      (p.len & PACKED_DEFERRED ? binary::FLAG_DEFERRED : 0);
+    return h;
+  }
+  uint32_t _len_at(std::size_t pos) const {
+    uint32_t len;
+    std::memcpy(&len, m_data + pos + (m_packed ? offsetof(Packed, len)
+						 : offsetof(Header, len)),
+		sizeof(len));
+    return m_packed ? len & LEN_MASK : len;
+  }
+  void _put_header(char *pos, const Entry& e, std::size_t len, bool deferred) {
+    if (!m_packed) {
+      auto h = binary::make_header(e, len, false, 0);
+      if (deferred) {
+	h.flags |= binary::FLAG_DEFERRED;
+      }
+      std::memcpy(pos, &h, sizeof(h));
+      return;
+    }
+    auto count = e.stamp().time_since_epoch().count();
+    Packed p;
+    p.stamp = count.count;
+    p.len = static_cast<uint32_t>(len) | (count.coarse ? PACKED_COARSE : 0) |
+      (deferred ? PACKED_DEFERRED : 0);
+    p.thread = ThreadIndex::index_of((uint64_t)e.m_thread);
+    p.prio = static_cast<int8_t>(std::clamp<int>(e.m_prio, INT8_MIN, INT8_MAX));
+    p.subsys = static_cast<uint8_t>(e.m_subsys);
+    std::memcpy(pos, &p, sizeof(p));
+  }
+
+  void _push(const Entry& e, ConcreteEntry::render_fn render,
+	     std::string_view payload) {
+    char *pos = _begin_push(e, render, payload.size());
+    std::memcpy(pos, payload.data(), payload.size());
+    _end_push();
+  }
+
+  /// make room for a record of e with payload_len bytes of payload, and
+  /// write all of it but the payload, whose place is returned
+  char* _begin_push(const Entry& e, ConcreteEntry::render_fn render,
+		    std::size_t payload_len) {
+    const std::size_t len = payload_len + (render ? sizeof(render) : 0);
+    const std::size_t n = record_size(len);
+
+    while (m_count >= m_max_entries) {
+      pop_front();
+    }
+    char* pos = reserve(n);
+    // whatever was evicted is about to be overwritten
+    _publish();
+
+    _put_header(pos, e, len, render != nullptr);
+    pos += header_size();
+    if (render) {
+      std::memcpy(pos, &render, sizeof(render));
+      pos += sizeof(render);
+    }
+    m_pushing = n;
+    return pos;
+  }
+  /// the record _begin_push() began is written
+  void _end_push() {
+    m_end += m_pushing;
+    ++m_count;
+    _publish();
+  }
+
+  /// move c on to the second segment once the first is done, and stop at a
+  /// record torn by a concurrent push (only possible in a crash dump)
+  void _settle(Cursor& c) const {
+    if (c.pos >= c.stop && c.wrapped) {
+      c = Cursor{0, m_end, false};
+    }
+    if (c.pos < c.stop) {
+      if (c.pos + record_size(_len_at(c.pos)) > m_capacity) {
+	c.stop = c.pos;
+      }
+    }
+  }
+
+  /// keep the file header in step for a reader in another process
+  void _publish() {
+    if (!m_shared) {
+      return;
+    }
+    m_shared->begin = m_begin;
+    m_shared->end = m_end;
+    m_shared->wrap = m_wrap;
+    m_shared->wrapped = m_wrapped;
+    m_shared->count = m_count;
+  }
+
+  int _map(std::size_t size, bool keep_prev);
+  void _unmap();
+
+  std::size_t record_size(std::size_t len) const {
+    return (header_size() + len + ALIGN - 1) & ~(ALIGN - 1);
+  }
+
+  /// make n contiguous bytes available at m_end, evicting as needed
+  char* reserve(std::size_t n) {
+    for (;;) {
+      if (!m_wrapped) {
+	if (m_capacity - m_end >= n) {
+	  break;
+	}
+	if (grow(n)) {
+	  continue;
+	}
+	// start writing at the front again
+	m_wrap = m_end;
+	m_wrapped = true;
+	m_end = 0;
+      }
+      if (m_begin - m_end >= n) {
+	break;
+      }
+      // with nothing left to evict, n is more than the whole ring, which
+      // max_payload() rules out; rather than spin
+      ceph_assert(m_count > 0);
+      pop_front();
+    }
+    return m_data + m_end;
+  }
+
+  /// double the buffer (within budget); only possible before wrapping
+  bool grow(std::size_t n) {
+    const std::size_t limit = this->limit();
+    if (m_capacity >= limit || m_shared) {
+      return false;
+    }
+    std::size_t cap = std::max(m_capacity * 2, MIN_CAPACITY);
+    while (cap - (m_end - m_begin) < n) {
+      cap *= 2;
+    }
+    cap = std::min(cap, limit);
+    HugeBuffer buf(cap);
+    if (m_buf) {
+      std::memcpy(buf.get(), m_buf.get() + m_begin, m_end - m_begin);
+    }
+    m_end -= m_begin;
+    m_begin = 0;
+    m_buf = std::move(buf);
+    m_data = m_buf.get();
+    m_capacity = cap;
+    return true;
+  }
+
+  void pop_front() {
+    if (m_count == 0) {
+      return;
+    }
+    m_begin += record_size(_len_at(m_begin));
+    if (--m_count == 0) {
+      clear();
+    } else if (m_wrapped && m_begin == m_wrap) {
+      m_begin = 0;
+      m_wrapped = false;
+    }
+  }
+
+  std::size_t m_max_entries;
+  std::size_t m_max_bytes;
+
+  HugeBuffer m_buf;               ///< the ring, unless it is in a file
+  char *m_data = nullptr;         ///< the ring, either way
+  std::size_t m_capacity = 0;
+  std::string m_path;             ///< set_file()
+  binary::recent_header *m_shared = nullptr; ///< the mapping, if a file
+  std::size_t m_map_len = 0;
+  std::size_t m_begin = 0; ///< oldest record
+  std::size_t m_end = 0;   ///< where the next record goes
+  std::size_t m_wrap = 0;  ///< end of the older segment while wrapped
+  bool m_wrapped = false;
+  std::size_t m_count = 0;
+  std::size_t m_pushing = 0; ///< record_size() of the record being pushed
+  bool m_packed = true;      ///< Packed headers, as always except in a file
+};
+
+/// a RecentRing filled by one producer thread instead of the log thread;
+/// see log_thread_recent_bytes
+struct ThreadRecentRing {
+  ThreadRecentRing(std::size_t max_entries, std::size_t max_bytes)
+    : ring(max_entries, max_bytes) {}
+
+  std::mutex lock; ///< the owner pushes, dumps read
+  RecentRing ring;
+  std::atomic<bool> detached{false}; ///< the owning thread has exited
+};
+
+}
+}
+
+#endif
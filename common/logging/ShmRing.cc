@@ -0,0 +1,132 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "ShmRing.h"
+
+#include "include/compat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+namespace ceph {
+namespace logging {
+
+static constexpr std::size_t MIN_SIZE = 64 * 1024;
+
+ShmRing::~ShmRing()
+{
+  close();
+}
+
+int ShmRing::open(const std::string& path, std::size_t size)
+{
+  std::size_t ring = MIN_SIZE;
+  while (ring < size) {
+    ring <<= 1;
+  }
+  if (path == m_path && ring == m_size) {
+    return 0;
+  }
+  close();
+  if (path.empty()) {
+    return 0;
+  }
+  // an agent still draining the old file keeps its mapping; it notices the
+  // file was replaced once it has caught up
+  if (::unlink(path.c_str()) < 0 && errno != ENOENT) {
+    return -errno;
+  }
+  int fd = ::open(path.c_str(), O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return -errno;
+  }
+  const std::size_t len = sizeof(binary::shm_ring_header) + ring;
+  void *p = MAP_FAILED;
+  int r = 0;
+  if (::ftruncate(fd, len) < 0) {
+    r = -errno;
+  } else {
+    p = ::mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      r = -errno;
+    }
+  }
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  if (r < 0) {
+    ::unlink(path.c_str());
+    return r;
+  }
+
+  // ftruncate() zeroed it; the magic goes in last for an agent scanning
+  // for new rings
+  m_header = new (p) binary::shm_ring_header;
+  m_header->version = binary::SHM_VERSION;
+  m_header->header_size = sizeof(binary::shm_ring_header);
+  m_header->ring_size = ring;
+  m_header->pid = getpid();
+  m_header->head.store(0, std::memory_order_relaxed);
+  m_header->tail.store(0, std::memory_order_relaxed);
+  m_header->dropped.store(0, std::memory_order_relaxed);
+  m_header->closed.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  m_header->magic = binary::SHM_MAGIC;
+  m_data = static_cast<char*>(p) + sizeof(binary::shm_ring_header);
+  m_size = ring;
+  m_head = m_tail = 0;
+  m_path = path;
+  return 0;
+}
+
+void ShmRing::close()
+{
+  if (!m_header) {
+    return;
+  }
+  // the file stays for the agent to drain; the agent removes it after
+  m_header->closed.store(1, std::memory_order_release);
+  ::munmap(m_header, sizeof(binary::shm_ring_header) + m_size);
+  m_header = nullptr;
+  m_data = nullptr;
+  m_size = 0;
+  m_path.clear();
+}
+
+bool ShmRing::append(const binary::record_header& h, std::string_view payload)
+{
+  // a single record may take at most a quarter of the ring
+  const std::size_t max_len = m_size / 4 - sizeof(h);
+  binary::record_header rec = h;
+  if (payload.size() > max_len) {
+    payload = payload.substr(0, max_len);
+    rec.len = static_cast<uint32_t>(payload.size());
+  }
+  const std::size_t need = binary::shm_record_size(payload.size());
+  const std::size_t pos = m_head & (m_size - 1);
+  const std::size_t skip = m_size - pos < need ? m_size - pos : 0;
+  if (m_head + skip + need - m_tail > m_size) {
+    m_tail = m_header->tail.load(std::memory_order_acquire);
+    if (m_head + skip + need - m_tail > m_size) {
+      m_header->dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  if (skip) {
+    memcpy(m_data + pos, &binary::SHM_WRAP_MAGIC,
+	   sizeof(binary::SHM_WRAP_MAGIC));
+    m_head += skip;
+  }
+  char *p = m_data + (m_head & (m_size - 1));
+  memcpy(p, &rec, sizeof(rec));
+  memcpy(p + sizeof(rec), payload.data(), payload.size());
+  m_head += need;
+  m_header->head.store(m_head, std::memory_order_release);
+  return true;
+}
+
+}
+}
@@ -0,0 +1,59 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_SHMRING_H
+#define __CEPH_LOG_SHMRING_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "BinaryLog.h"
+
+namespace ceph {
+namespace logging {
+
+/* The writing end of a log_shm_ring (see binary::shm_ring_header).
+ *
+ * The log thread appends each entry as a binary record and is done with
+ * it; formatting, compression and disk I/O are left to ceph-log-agent,
+ * which maps the same file and drains it.  append() never waits: when the
+ * agent falls behind or isn't running, records that don't fit are dropped
+ * and counted in the header for the agent to report.  Only one thread may
+ * append at a time.
+ */
+class ShmRing {
+public:
+  ShmRing() = default;
+  ShmRing(const ShmRing&) = delete;
+  ShmRing& operator=(const ShmRing&) = delete;
+  ~ShmRing();
+
+  /// map a ring of (rounded up to a power of two) size bytes at path,
+  /// replacing any file there; an empty path unmaps it
+  int open(const std::string& path, std::size_t size);
+  void close();
+
+  bool is_open() const {
+    return m_header != nullptr;
+  }
+  const std::string& get_path() const {
+    return m_path;
+  }
+
+  /// false if the record was dropped for lack of room
+  bool append(const binary::record_header& h, std::string_view payload);
+
+private:
+  std::string m_path;
+  binary::shm_ring_header *m_header = nullptr;
+  char *m_data = nullptr;
+  std::size_t m_size = 0;     ///< of the ring, a power of two
+  uint64_t m_head = 0;        ///< our copy of m_header->head
+  uint64_t m_tail = 0;        ///< the reader's tail as last seen
+};
+
+}
+}
+
+#endif
@@ -18,19 +18,38 @@
 #include <boost/container/small_vector.hpp>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <sstream>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "common/utils/inline_memory.h"
+#include "common/utils/print_budget.h"
+#include "common/utils/sharded_counter.h"
 
+/* A streambuf over an inline buffer of SIZE bytes, or whatever reserve()
+ * made room for.  Text that outgrows it goes on in a chain of SEGMENT byte
+ * blocks, so that a large message (a dump of some structure) is never
+ * reallocated and copied while it is written: for_each_segment() hands
+ * out the pieces, and only strv() joins them, the first time it's called.
+ */
 template<std::size_t SIZE>
 class StackStringBuf : public std::basic_streambuf<char>
 {
 public:
+  static constexpr std::size_t SEGMENT = 16 << 10;
+
   StackStringBuf()
     : vec{SIZE, boost::container::default_init_t{}}
   {
@@ -44,16 +63,89 @@ public:
 
   void clear()
   {
-    vec.resize(SIZE);
-    setp(vec.data(), vec.data() + SIZE);
+    // a buffer grown on the heap is kept, and all of it used, and so are
+    // the segments, for the next large message
+    if (vec.size() != vec.capacity()) {
+      vec.resize(vec.capacity(), boost::container::default_init_t{});
+    }
+    setp(vec.data(), vec.data() + vec.size());
+    used = 0;
+    grew = false;
+  }
+
+  /// make room for n bytes before writing (to an empty buffer)
+  void reserve(std::size_t n)
+  {
+    if (n > vec.capacity()) {
+      vec.reserve(n);
+      clear();
+    }
+  }
+
+  std::size_t capacity() const
+  {
+    return vec.capacity() + segs.size() * SEGMENT;
+  }
+
+  /// whether writes outgrew the buffer since the last clear()
+  bool spilled() const
+  {
+    return grew;
+  }
+
+  /// whether the text is in more than one piece
+  bool segmented() const
+  {
+    return used > 0;
+  }
+
+  std::size_t length() const
+  {
+    if (!used) {
+      return pptr() - pbase();
+    }
+    return head + (used - 1) * SEGMENT + (pptr() - pbase());
+  }
+
+  /// f(std::string_view) for each piece of the text, in order
+  template<typename F>
+  void for_each_segment(F&& f) const
+  {
+    if (!used) {
+      f(std::string_view(pbase(), pptr() - pbase()));
+      return;
+    }
+    f(std::string_view(vec.data(), head));
+    for (std::size_t i = 0; i + 1 < used; ++i) {
+      f(std::string_view(segs[i].get(), SEGMENT));
+    }
+    f(std::string_view(pbase(), pptr() - pbase()));
   }
 
   std::string_view strv() const
   {
+    if (used) {
+      const_cast<StackStringBuf*>(this)->join();
+    }
     return std::string_view(pbase(), pptr() - pbase());
   }
 
+  void append(const char *s, std::size_t n)
+  {
+    StackStringBuf::xsputn(s, n);
+  }
+
 protected:
+  /// tellp(), which ceph::print_elements() uses to keep to a byte budget
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+		   std::ios_base::openmode which) override
+  {
+    if (off == 0 && dir == std::ios_base::cur && (which & std::ios_base::out)) {
+      return pos_type(length());
+    }
+    return pos_type(off_type(-1));
+  }
+
   std::streamsize xsputn(const char *s, std::streamsize n)
   {
     std::streamsize capacity = epptr() - pptr();
@@ -61,22 +153,27 @@ protected:
     if (capacity >= left) {
       maybe_inline_memcpy(pptr(), s, left, 32);
       pbump(left);
-    } else {
+      return n;
+    }
+    for (;;) {
       maybe_inline_memcpy(pptr(), s, capacity, 64);
+      pbump(capacity);
       s += capacity;
       left -= capacity;
-      vec.insert(vec.end(), s, s + left);
-      setp(vec.data(), vec.data() + vec.size());
-      pbump(vec.size());
+      if (!left) {
+	return n;
+      }
+      next_segment();
+      capacity = std::min<std::streamsize>(left, SEGMENT);
     }
-    return n;
   }
 
   int overflow(int c)
   {
     if (traits_type::not_eof(c)) {
-      char str = traits_type::to_char_type(c);
-      vec.push_back(str);
+      next_segment();
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
       return c;
     } else {
       return traits_type::eof();
@@ -84,8 +181,42 @@ protected:
   }
 
 private:
+  /// carry on writing in the next segment, the current piece being full
+  void next_segment()
+  {
+    if (!used) {
+      head = pptr() - pbase();
+    }
+    if (used == segs.size()) {
+      segs.emplace_back(new char[SEGMENT]);
+    }
+    char *p = segs[used++].get();
+    setp(p, p + SEGMENT);
+    grew = true;
+  }
+
+  /// move the segments' text after the head, in vec, to make it whole
+  void join()
+  {
+    const std::size_t len = length();
+    const std::size_t tail = pptr() - pbase();
+    vec.resize(len, boost::container::default_init_t{});
+    char *p = vec.data() + head;
+    for (std::size_t i = 0; i + 1 < used; ++i) {
+      memcpy(p, segs[i].get(), SEGMENT);
+      p += SEGMENT;
+    }
+    memcpy(p, segs[used - 1].get(), tail);
+    used = 0;
+    setp(vec.data(), vec.data() + vec.size());
+    pbump(len);
+  }
 
   boost::container::small_vector<char, SIZE> vec;
+  std::vector<std::unique_ptr<char[]>> segs;
+  std::size_t used = 0; ///< segments holding text
+  std::size_t head = 0; ///< of vec's text, while there are
+  bool grew = false;
 };
 
 template<std::size_t SIZE>
@@ -100,50 +231,296 @@ public:
   ~StackStringStream() override = default;
 
   void reset() {
-    clear(); /* reset state flags */
-    flags(default_fmtflags); /* reset fmtflags to constructor defaults */
+    /* Most messages leave the formatting state as it was, and each of these
+     * setters does more than a store. */
+    if (rdstate() != goodbit) {
+      clear(); /* reset state flags */
+    }
+    if (flags() != default_fmtflags) {
+      flags(default_fmtflags); /* reset fmtflags to constructor defaults */
+    }
+    if (precision() != default_precision) {
+      precision(default_precision);
+    }
+    if (width() != 0) {
+      width(0);
+    }
+    // a log entry's budget isn't for whoever uses the stream next
+    iword(ceph::print_budget_index()) = 0;
     ssb.clear();
   }
 
+  /// the text, joined into one piece if it was written in segments
   std::string_view strv() const {
     return ssb.strv();
   }
+  std::size_t length() const {
+    return ssb.length();
+  }
+  bool segmented() const {
+    return ssb.segmented();
+  }
+  /// f(std::string_view) for each piece of the text, without joining them
+  template<typename F>
+  void for_each_segment(F&& f) const {
+    ssb.for_each_segment(std::forward<F>(f));
+  }
+
+  /// whether insertions can skip the formatting machinery, and if so the
+  /// base integers come out in: 10, 16 after std::hex, 0 if anything else
+  /// about the formatting changed
+  int direct_base() const {
+    if (rdstate() != goodbit || width() != 0) {
+      return 0;
+    }
+    const fmtflags f = flags();
+    if (f == default_fmtflags) {
+      return 10;
+    }
+    return f == ((default_fmtflags & ~basefield) | hex) ? 16 : 0;
+  }
+  /// write s as is, for direct insertions
+  void append(std::string_view s) {
+    ssb.append(s.data(), s.size());
+  }
+
+  /// make room for n bytes, right after reset()
+  void reserve(std::size_t n) {
+    ssb.reserve(n);
+  }
+  std::size_t capacity() const {
+    return ssb.capacity();
+  }
+  bool spilled() const {
+    return ssb.spilled();
+  }
 
 private:
+  static constexpr std::streamsize default_precision = 6;
+
   StackStringBuf<SIZE> ssb;
   fmtflags const default_fmtflags;
 };
 
+/* Insertions of the types log messages are mostly made of go straight into
+ * the buffer rather than through a sentry and the locale's num_put, as long
+ * as the stream's direct_base() allows.  Only these exact types are
+ * affected; anything else, including a type that converts to one of them,
+ * still finds the ostream operator<< it always did.  What comes out is the
+ * same either way: integers in decimal or (unsigned) hex, pointers as
+ * num_put has them, floating point as printf's %g at the stream's
+ * precision.
+ */
+template<typename T>
+struct stack_stream_direct : std::disjunction<
+  std::is_same<T, std::string>, std::is_same<T, std::string_view>,
+  std::is_same<T, const char*>, std::is_same<T, char*>,
+  std::conjunction<std::is_array<T>,
+		   std::is_same<std::remove_cv_t<std::remove_extent_t<T>>, char>>,
+  std::is_same<T, char>, std::is_same<T, bool>,
+  std::is_same<T, short>, std::is_same<T, unsigned short>,
+  std::is_same<T, int>, std::is_same<T, unsigned>,
+  std::is_same<T, long>, std::is_same<T, unsigned long>,
+  std::is_same<T, long long>, std::is_same<T, unsigned long long>,
+  std::is_same<T, void*>, std::is_same<T, const void*>
+#if __cpp_lib_to_chars >= 201611L
+  , std::is_same<T, float>, std::is_same<T, double>
+#endif
+  > {};
+
+template<std::size_t SIZE, typename T,
+	 typename = std::enable_if_t<stack_stream_direct<T>::value>>
+StackStringStream<SIZE>& operator<<(StackStringStream<SIZE>& ss, const T& v)
+{
+  const int base = ss.direct_base();
+  if (base) {
+    if constexpr (std::is_same_v<T, std::string> ||
+		  std::is_same_v<T, std::string_view>) {
+      ss.append(v);
+      return ss;
+    } else if constexpr (std::is_same_v<T, const char*> ||
+			 std::is_same_v<T, char*> || std::is_array_v<T>) {
+      // a null pointer sets badbit, as it would have
+      const char *s = v;
+      if (s) {
+	ss.append(std::string_view(s, strlen(s)));
+	return ss;
+      }
+    } else if constexpr (std::is_same_v<T, char>) {
+      ss.append(std::string_view(&v, 1));
+      return ss;
+    } else if constexpr (std::is_same_v<T, bool>) {
+      ss.append(v ? "1" : "0");
+      return ss;
+    } else if constexpr (std::is_pointer_v<T>) {
+      // hex with showbase, which leaves 0 bare
+      char buf[2 + 16] = {'0', 'x'};
+      const auto u = reinterpret_cast<uintptr_t>(v);
+      auto r = std::to_chars(buf + 2, buf + sizeof(buf), u, 16);
+      ss.append(u ? std::string_view(buf, r.ptr - buf) : "0");
+      return ss;
+    } else if constexpr (std::is_floating_point_v<T>) {
+      char buf[64];
+      auto r = std::to_chars(buf, buf + sizeof(buf), double(v),
+			     std::chars_format::general, ss.precision());
+      // a precision that long it can have the slow way
+      if (r.ec == std::errc()) {
+	ss.append(std::string_view(buf, r.ptr - buf));
+	return ss;
+      }
+    } else {
+      char buf[24];
+      auto r = base == 10 ?
+	std::to_chars(buf, buf + sizeof(buf), v) :
+	std::to_chars(buf, buf + sizeof(buf), std::make_unsigned_t<T>(v), 16);
+      ss.append(std::string_view(buf, r.ptr - buf));
+      return ss;
+    }
+  }
+  static_cast<std::ostream&>(ss) << v;
+  return ss;
+}
+
+/// std::hex and the like, so that a chain goes on past them on the direct
+/// path instead of carrying on as an ostream
+template<std::size_t SIZE>
+StackStringStream<SIZE>& operator<<(StackStringStream<SIZE>& ss,
+				    std::ios_base& (*manip)(std::ios_base&))
+{
+  manip(ss);
+  return ss;
+}
+
 /* In an ideal world, we could use StackStringStream indiscriminately, but alas
  * it's very expensive to construct/destruct. So, we cache them in a
  * thread_local vector. DO NOT share these with other threads. The copy/move
  * constructors are deliberately restrictive to make this more difficult to
  * accidentally do.
+ *
+ * The inline buffer covers the usual message. A thread whose messages run
+ * longer gets streams with that much room on the heap up front, rather than
+ * growing it while formatting, and a stream left with far more than the
+ * thread needs (after a rare huge message) is freed instead of cached.
  */
 class CachedStackStringStream {
 public:
-  using sss = StackStringStream<4096>;
+  static constexpr std::size_t inline_size = 1024;
+  using sss = StackStringStream<inline_size>;
   using osptr = std::unique_ptr<sss>;
 
   CachedStackStringStream() {
+    if (!cache.destructed && cache.c.empty()) {
+      depot.refill(cache.c, cache.max);
+      cache.recount();
+    }
     if (cache.destructed || cache.c.empty()) {
       osp = std::make_unique<sss>();
     } else {
       osp = std::move(cache.c.back());
       cache.c.pop_back();
+      cache.note(-1, -std::ptrdiff_t(footprint(*osp)));
       osp->reset();
     }
+    if (!cache.destructed) {
+      osp->reserve(cache.sizes.target());
+    }
   }
   CachedStackStringStream(const CachedStackStringStream&) = delete;
   CachedStackStringStream& operator=(const CachedStackStringStream&) = delete;
   CachedStackStringStream(CachedStackStringStream&&) = delete;
   CachedStackStringStream& operator=(CachedStackStringStream&&) = delete;
   ~CachedStackStringStream() {
-    if (!cache.destructed && cache.c.size() < max_elems) {
-      cache.c.emplace_back(std::move(osp));
+    if (!osp) {
+      return;
+    }
+    note_use();
+    if (!cache.destructed && cache.c.size() < cache.max) {
+      if (osp->capacity() <= cache.sizes.retain()) {
+	cache.note(1, footprint(*osp));
+	cache.c.emplace_back(std::move(osp));
+      } else {
+	stats.discards.inc();
+      }
+    }
+  }
+
+  /* Give up ownership of the stream, e.g. to hand a formatted log entry to
+   * another thread without copying it. This object must not be used
+   * afterwards. The stream should find its way back through recycle(), on
+   * whichever thread is done with it.
+   */
+  osptr release() {
+    note_use();
+    return std::move(osp);
+  }
+
+  /* Return released streams to the shared depot that thread caches refill
+   * from. Takes the whole batch under a single lock.
+   */
+  static void recycle(std::vector<osptr>& streams) {
+    depot.put(streams);
+    streams.clear();
+  }
+
+  /* Cache up to n streams on this thread rather than max_elems: for a
+   * reactor thread whose tasks each hold a stream across a switch, which
+   * would otherwise find the cache empty and free the streams coming back
+   * to a full one.  See LogTask.h.
+   */
+  static void set_thread_cache_size(std::size_t n) {
+    if (cache.destructed) {
+      return;
+    }
+    cache.max = std::clamp<std::size_t>(n, 1, Depot::max_elems);
+    if (cache.c.size() > cache.max) {
+      cache.c.resize(cache.max);
+      cache.recount();
     }
   }
 
+  /* Keep up to n released streams in the depot that thread caches refill
+   * from, rather than Depot::max_elems; each may hold max_retained of
+   * buffer, so a process with little memory wants fewer.
+   */
+  static void set_depot_size(std::size_t n) {
+    depot.set_max(n);
+  }
+
+  /// what the streams cached on every thread, and in the depot, hold
+  struct Memory {
+    std::size_t threads = 0; ///< with a cache
+    std::size_t thread_streams = 0;
+    std::size_t thread_bytes = 0;
+    std::size_t depot_streams = 0;
+    std::size_t depot_bytes = 0;
+  };
+  static Memory get_memory() {
+    Memory m;
+    {
+      std::lock_guard l(registry.lock);
+      for (auto c : registry.caches) {
+	++m.threads;
+	m.thread_streams += c->streams.load(std::memory_order_relaxed);
+	m.thread_bytes += c->bytes.load(std::memory_order_relaxed);
+      }
+    }
+    std::lock_guard l(depot.lock);
+    m.depot_streams = depot.c.size();
+    for (auto& p : depot.c) {
+      m.depot_bytes += footprint(*p);
+    }
+    return m;
+  }
+
+  /// messages that outgrew their stream's buffer while being formatted
+  static uint64_t get_spills() {
+    return stats.spills.get();
+  }
+  /// streams freed rather than cached for holding too big a buffer
+  static uint64_t get_discards() {
+    return stats.discards.get();
+  }
+
   sss& operator*() {
     return *osp;
   }
@@ -166,6 +543,82 @@ public:
 
 private:
   static constexpr std::size_t max_elems = 8;
+  /// the most buffer a cached stream keeps, whatever a thread's messages
+  static constexpr std::size_t max_retained = 64 << 10;
+
+  /* The sizes of the messages a thread formats: log2 buckets, halved every
+   * decay_interval messages so that they follow what the thread does now.
+   */
+  struct Sizes {
+    static constexpr unsigned recompute_interval = 64;
+    static constexpr unsigned decay_interval = 1024;
+
+    void add(std::size_t len) {
+      unsigned b = len > 1 ? 64 - __builtin_clzll(len - 1) : 0;
+      ++buckets[std::min<std::size_t>(b, buckets.size() - 1)];
+      ++total_seen;
+      // early on every message counts
+      if (++n % recompute_interval == 0 || total_seen < recompute_interval) {
+	recompute();
+      }
+    }
+    /// room to give a stream up front: what 99% of the messages fit in
+    std::size_t target() const {
+      return target_len;
+    }
+    /// the most buffer worth caching a stream with
+    std::size_t retain() const {
+      return std::clamp(2 * target_len, inline_size, max_retained);
+    }
+
+  private:
+    void recompute() {
+      uint64_t total = 0;
+      for (auto c : buckets) {
+	total += c;
+      }
+      const uint64_t want = total - total / 100;
+      uint64_t seen = 0;
+      std::size_t b = 0;
+      while (b + 1 < buckets.size() && (seen += buckets[b]) < want) {
+	++b;
+      }
+      target_len = std::min<std::size_t>(std::size_t(1) << b, max_retained);
+      if (n >= decay_interval) {
+	for (auto& c : buckets) {
+	  c /= 2;
+	}
+	n = 0;
+      }
+    }
+
+    std::array<uint32_t, 24> buckets{};
+    unsigned n = 0;
+    uint64_t total_seen = 0;
+    std::size_t target_len = 0;
+  };
+
+  struct Stats {
+    Stats() {}
+
+    ceph::sharded_counter spills;
+    ceph::sharded_counter discards;
+  };
+
+  /// the memory a cached stream holds
+  static std::size_t footprint(const sss& s) {
+    return sizeof(sss) + (s.capacity() > inline_size ? s.capacity() : 0);
+  }
+
+  /// account for the message in osp, done being written
+  void note_use() {
+    if (osp->spilled()) {
+      stats.spills.inc();
+    }
+    if (!cache.destructed) {
+      cache.sizes.add(osp->length());
+    }
+  }
 
   /* The thread_local cache may be destructed before other static structures.
    * If those destructors try to create a CachedStackStringStream (e.g. for
@@ -175,14 +628,122 @@ private:
   struct Cache {
     using container = std::vector<osptr>;
 
-    Cache() {}
-    ~Cache() { destructed = true; }
+    Cache() {
+      registry.add(this);
+    }
+    ~Cache() {
+      registry.remove(this);
+      destructed = true;
+    }
+
+    /// only the owning thread changes the counts; get_memory() reads them
+    void note(std::ptrdiff_t n, std::ptrdiff_t len) {
+      streams.store(streams.load(std::memory_order_relaxed) + n,
+		    std::memory_order_relaxed);
+      bytes.store(bytes.load(std::memory_order_relaxed) + len,
+		  std::memory_order_relaxed);
+    }
+    void recount() {
+      std::size_t len = 0;
+      for (auto& p : c) {
+	len += footprint(*p);
+      }
+      streams.store(c.size(), std::memory_order_relaxed);
+      bytes.store(len, std::memory_order_relaxed);
+    }
 
     container c;
+    std::size_t max = max_elems; ///< see set_thread_cache_size()
+    Sizes sizes;
+    std::atomic<std::size_t> streams{0}; ///< in c
+    std::atomic<std::size_t> bytes{0};   ///< their footprint()s
+    bool destructed = false;
+  };
+
+  /// every thread's Cache, for get_memory().  Same destruction caveat as
+  /// Cache.
+  struct Registry {
+    Registry() {}
+    ~Registry() { destructed = true; }
+
+    void add(const Cache *c) {
+      std::lock_guard l(lock);
+      if (!destructed) {
+	caches.push_back(c);
+      }
+    }
+    void remove(const Cache *c) {
+      std::lock_guard l(lock);
+      if (destructed) {
+	return;
+      }
+      if (auto i = std::find(caches.begin(), caches.end(), c);
+	  i != caches.end()) {
+	*i = caches.back();
+	caches.pop_back();
+      }
+    }
+
+    std::mutex lock;
+    std::vector<const Cache*> caches;
+    bool destructed = false;
+  };
+
+  /* Streams released to other threads come back here, so that a thread which
+   * keeps handing its streams away doesn't have to allocate a new one for
+   * every entry. Same destruction caveat as Cache.
+   */
+  struct Depot {
+    static constexpr std::size_t max_elems = 1024;
+
+    Depot() {}
+    ~Depot() { destructed = true; }
+
+    void put(std::vector<osptr>& streams) {
+      std::lock_guard l(lock);
+      if (destructed) {
+        return;
+      }
+      for (auto& p : streams) {
+        if (c.size() >= max) {
+          break;
+        }
+        // no thread to size these for, so only the overall cap applies
+        if (p->capacity() > max_retained) {
+          stats.discards.inc();
+          continue;
+        }
+        c.emplace_back(std::move(p));
+      }
+    }
+    void set_max(std::size_t n) {
+      std::lock_guard l(lock);
+      max = std::clamp<std::size_t>(n, 1, max_elems);
+      if (c.size() > max) {
+        c.resize(max);
+      }
+    }
+    void refill(std::vector<osptr>& out, std::size_t n) {
+      std::lock_guard l(lock);
+      if (destructed) {
+        return;
+      }
+      while (!c.empty() && out.size() < n) {
+        out.emplace_back(std::move(c.back()));
+        c.pop_back();
+      }
+    }
+
+    std::mutex lock;
+    std::vector<osptr> c;
+    std::size_t max = max_elems; ///< see set_depot_size()
     bool destructed = false;
   };
 
   inline static thread_local Cache cache;
+  inline static Registry registry;
+  inline static Depot depot;
+  inline static Stats stats;
   osptr osp;
 };
 
@@ -0,0 +1,231 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_STRUCTUREDENTRY_H
+#define __CEPH_LOG_STRUCTUREDENTRY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "Entry.h"
+
+namespace ceph {
+namespace logging {
+
+/* Entries with typed key/value fields alongside the message.
+ *
+ * The blob of a structured entry is the message (a uint32_t length and the
+ * text), a uint16_t count of fields and the fields, each a type byte, a key
+ * length byte, the key and then the value: 8 bytes for the numbers, 1 for a
+ * bool, a uint32_t length and the text for a string.  Like a deferred entry
+ * nothing is formatted by the submitter.  The text layout is the message followed by
+ * " key=value" for each field, with a string value quoted if it holds a
+ * space, '=' or '"'; log_format=json gives each field a member of its own.
+ */
+namespace structured {
+
+enum field_type : uint8_t {
+  INT,
+  UINT,
+  DOUBLE,
+  BOOL,
+  STRING,
+};
+
+/// a field as read back out of the blob
+struct field {
+  field_type type;
+  std::string_view key;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    bool b;
+  };
+  std::string_view s;
+};
+
+/// the message of a structured blob; p is left at the field count
+inline std::string_view read_message(const char*& p) {
+  uint32_t len;
+  memcpy(&len, p, sizeof(len));
+  std::string_view msg(p + sizeof(len), len);
+  p += sizeof(len) + len;
+  return msg;
+}
+
+/// the field at p; returns the next one
+inline const char* read_field(const char* p, field& f) {
+  f.type = static_cast<field_type>(*p++);
+  const uint8_t klen = *p++;
+  f.key = std::string_view(p, klen);
+  p += klen;
+  switch (f.type) {
+  case BOOL:
+    f.b = *p++;
+    break;
+  case STRING: {
+    uint32_t len;
+    memcpy(&len, p, sizeof(len));
+    f.s = std::string_view(p + sizeof(len), len);
+    p += sizeof(len) + len;
+    break;
+  }
+  default:
+    memcpy(&f.u, p, sizeof(f.u));
+    p += sizeof(f.u);
+  }
+  return p;
+}
+
+/// calls fn(field) for each field of blob
+template<typename F>
+void for_each_field(const char* blob, F&& fn) {
+  const char* p = blob;
+  read_message(p);
+  uint16_t n;
+  memcpy(&n, p, sizeof(n));
+  p += sizeof(n);
+  while (n--) {
+    field f;
+    p = read_field(p, f);
+    fn(f);
+  }
+}
+
+/// the entry's render_fn: the text layout
+inline void render(const char* blob, std::ostream& out) {
+  const char* p = blob;
+  out << read_message(p);
+  for_each_field(blob, [&out](const field& f) {
+    out << ' ' << f.key << '=';
+    switch (f.type) {
+    case INT: out << f.i; break;
+    case UINT: out << f.u; break;
+    case DOUBLE: out << f.d; break;
+    case BOOL: out << (f.b ? "true" : "false"); break;
+    case STRING:
+      if (!f.s.empty() &&
+	  f.s.find_first_of(" =\"") == std::string_view::npos) {
+	out << f.s;
+      } else {
+	out << '"';
+	for (char c : f.s) {
+	  if (c == '"' || c == '\\') {
+	    out << '\\';
+	  }
+	  out << c;
+	}
+	out << '"';
+      }
+      break;
+    }
+  });
+}
+
+template<typename T, typename = void>
+struct kv_codec {
+  static_assert(std::is_arithmetic_v<T>,
+		"structured log fields must be numbers, bools or strings");
+  static constexpr field_type type =
+    std::is_same_v<T, bool> ? BOOL :
+    std::is_floating_point_v<T> ? DOUBLE :
+    std::is_signed_v<T> ? INT : UINT;
+
+  static std::size_t size(const T&) {
+    return type == BOOL ? 1 : 8;
+  }
+  static char* encode(char* p, const T& v) {
+    if constexpr (type == BOOL) {
+      *p = v;
+      return p + 1;
+    } else {
+      using wide = std::conditional_t<type == DOUBLE, double,
+		     std::conditional_t<type == INT, int64_t, uint64_t>>;
+      const wide w = v;
+      memcpy(p, &w, sizeof(w));
+      return p + sizeof(w);
+    }
+  }
+};
+
+template<typename T>
+struct kv_codec<T, std::enable_if_t<
+  std::is_convertible_v<const T&, std::string_view>>> {
+  static constexpr field_type type = STRING;
+
+  static std::size_t size(std::string_view v) {
+    return sizeof(uint32_t) + v.size();
+  }
+  static char* encode(char* p, std::string_view v) {
+    const uint32_t len = v.size();
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), v.data(), len);
+    return p + sizeof(len) + len;
+  }
+};
+
+/// strings are held as views until they are encoded
+template<typename T>
+using kv_value_t = std::conditional_t<
+  std::is_convertible_v<const T&, std::string_view>, std::string_view,
+  std::decay_t<T>>;
+
+template<typename T>
+struct kv_field {
+  std::string_view key; ///< at most 255 bytes; longer keys are cut
+  T value;
+
+  std::size_t key_size() const {
+    return std::min<std::size_t>(key.size(), UINT8_MAX);
+  }
+  std::size_t size() const {
+    return 2 + key_size() + kv_codec<T>::size(value);
+  }
+  char* encode(char* p) const {
+    *p++ = kv_codec<T>::type;
+    *p++ = key_size();
+    memcpy(p, key.data(), key_size());
+    return kv_codec<T>::encode(p + key_size(), value);
+  }
+};
+
+} // namespace structured
+
+/// a field for ldout_kv(); the value is copied into the entry
+template<typename T>
+structured::kv_field<structured::kv_value_t<T>> kv(std::string_view key,
+						   const T& value) {
+  return {key, value};
+}
+
+/// encode msg and fields into a structured entry; nothing is formatted here
+template<typename... Fields>
+ConcreteEntry make_structured_entry(short prio, short sub, std::string_view msg,
+				    const Fields&... fields) {
+  static_assert(sizeof...(Fields) <= UINT16_MAX);
+  const std::size_t len = sizeof(uint32_t) + msg.size() + sizeof(uint16_t) +
+    (std::size_t{0} + ... + fields.size());
+  ConcreteEntry e(prio, sub, &structured::render, len);
+  e.set_structured();
+  char* p = e.blob();
+  const uint32_t mlen = msg.size();
+  memcpy(p, &mlen, sizeof(mlen));
+  memcpy(p + sizeof(mlen), msg.data(), mlen);
+  p += sizeof(mlen) + mlen;
+  const uint16_t n = sizeof...(Fields);
+  memcpy(p, &n, sizeof(n));
+  p += sizeof(n);
+  ((p = fields.encode(p)), ...);
+  return e;
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,98 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_SUBMITRING_H
+#define __CEPH_LOG_SUBMITRING_H
+
+#include <atomic>
+#include <memory>
+#include <optional>
+
+#include "Entry.h"
+
+namespace ceph {
+namespace logging {
+
+/* A bounded single-producer/single-consumer ring of entries.
+ *
+ * Each submitting thread owns one ring per Log; it is drained under the
+ * Log's m_rings_mutex, by the flusher or, when the ring is full, by the
+ * owning thread itself into the shared queue, ahead of the entry that did
+ * not fit. The producer never blocks: if the ring is full, try_push() fails
+ * and the caller falls back to the shared queue.
+ */
+class SubmitRing {
+public:
+  explicit SubmitRing(std::size_t capacity)
+    : m_mask(round_up_pow2(capacity) - 1),
+      m_slots(std::make_unique<std::optional<ConcreteEntry>[]>(m_mask + 1))
+  {}
+  SubmitRing(const SubmitRing&) = delete;
+  SubmitRing& operator=(const SubmitRing&) = delete;
+
+  /// producer side; takes e only if there is room
+  bool try_push(ConcreteEntry&& e) {
+    const auto head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) > m_mask) {
+      return false;
+    }
+    m_slots[head & m_mask].emplace(std::move(e));
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// consumer side; hands every queued entry to f, oldest first
+  template<typename F>
+  std::size_t drain(F&& f) {
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    const auto head = m_head.load(std::memory_order_acquire);
+    const std::size_t n = head - tail;
+    for (; tail != head; ++tail) {
+      auto& slot = m_slots[tail & m_mask];
+      f(std::move(*slot));
+      slot.reset();
+      m_tail.store(tail + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+  bool empty() const {
+    return m_head.load(std::memory_order_acquire) ==
+	   m_tail.load(std::memory_order_relaxed);
+  }
+
+  std::size_t capacity() const {
+    return m_mask + 1;
+  }
+
+  /// called by the owning thread on exit; the flusher reaps detached rings
+  /// once they are empty
+  void detach() {
+    m_detached.store(true, std::memory_order_release);
+  }
+  bool is_detached() const {
+    return m_detached.load(std::memory_order_acquire);
+  }
+
+private:
+  static std::size_t round_up_pow2(std::size_t n) {
+    std::size_t p = 1;
+    while (p < n) {
+      p <<= 1;
+    }
+    return p;
+  }
+
+  const std::size_t m_mask;
+  std::unique_ptr<std::optional<ConcreteEntry>[]> m_slots;
+
+  // keep the producer and consumer cursors on separate cache lines
+  alignas(64) std::atomic<std::size_t> m_head{0}; ///< next slot to fill
+  alignas(64) std::atomic<std::size_t> m_tail{0}; ///< next slot to drain
+  std::atomic<bool> m_detached{false};
+};
+
+}
+}
+
+#endif
@@ -4,9 +4,12 @@
 #ifndef CEPH_LOG_SUBSYSTEMS
 #define CEPH_LOG_SUBSYSTEMS
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
-#include <algorithm>
 
 #include "likely.h"
 #include "common/logging/subsys_types.h"
@@ -15,11 +18,37 @@
 namespace ceph {
 namespace logging {
 
+/// token bucket parameters for a subsystem; a rate of 0 means unlimited
+struct log_rate_t {
+  uint32_t rate = 0;  ///< sustained entries per second
+  uint32_t burst = 0; ///< bucket size; 0 means one second's worth
+};
+
 class SubsystemMap {
-  // Access to the current gathering levels must be *FAST* as they are
-  // read over and over from all places in the code (via should_gather()
-  // by i.e. dout).
-  std::array<uint8_t, ceph_subsys_get_num()> m_gather_levels;
+  // Access to the current levels must be *FAST* as they are read over and
+  // over from all places in the code (via should_gather() by i.e. dout)
+  // and by the log thread for every entry.  Each subsystem's levels are
+  // packed into one 16-bit word, the effective gather level (the max of
+  // both) in the low byte and the log level in the high byte, so that the
+  // whole table spans a few cache lines and a level change made at
+  // runtime is published with a single relaxed store.
+  alignas(64) std::array<std::atomic<uint16_t>, ceph_subsys_get_num()> m_levels;
+
+  static constexpr uint16_t pack_levels(uint8_t log, uint8_t gather) {
+    return static_cast<uint16_t>(log) << 8 | std::max(log, gather);
+  }
+  uint8_t load_gather_level(unsigned subsys) const {
+    return m_levels[subsys].load(std::memory_order_relaxed) & 0xff;
+  }
+
+  // log_sample_*: 1-in-N in the upper 24 bits, the lowest level sampled
+  // in the low byte; 0 while a subsystem isn't sampled.  Only read for
+  // entries that passed should_gather().
+  std::array<std::atomic<uint32_t>, ceph_subsys_get_num()> m_samples;
+
+  // log_rate_limit_*: the rate in the upper 32 bits, the burst in the
+  // lower, so that submitters never see one without the other
+  std::array<std::atomic<uint64_t>, ceph_subsys_get_num()> m_rates;
 
   // The rest. Should be as small as possible to not unnecessarily
   // enlarge md_config_t and spread it other elements across cache
@@ -36,9 +65,21 @@ public:
     std::size_t i = 0;
     for (const ceph_subsys_item_t& item : s) {
       m_subsys.emplace_back(item);
-      m_gather_levels[i++] = std::max(item.log_level, item.gather_level);
+      m_samples[i].store(0, std::memory_order_relaxed);
+      m_rates[i].store(0, std::memory_order_relaxed);
+      m_levels[i++].store(pack_levels(item.log_level, item.gather_level),
+			  std::memory_order_relaxed);
     }
   }
+  SubsystemMap(const SubsystemMap& o)
+    : m_subsys(o.m_subsys) {
+    _copy_levels(o);
+  }
+  SubsystemMap& operator=(const SubsystemMap& o) {
+    m_subsys = o.m_subsys;
+    _copy_levels(o);
+    return *this;
+  }
 
   constexpr static std::size_t get_num() {
     return ceph_subsys_get_num();
@@ -51,7 +92,7 @@ public:
   int get_log_level(unsigned subsys) const {
     if (subsys >= get_num())
       subsys = 0;
-    return m_subsys[subsys].log_level;
+    return m_levels[subsys].load(std::memory_order_relaxed) >> 8;
   }
 
   int get_gather_level(unsigned subsys) const {
@@ -60,6 +101,14 @@ public:
     return m_subsys[subsys].gather_level;
   }
 
+  log_rate_t get_log_rate(unsigned subsys) const {
+    if (subsys >= get_num())
+      subsys = 0;
+    const uint64_t r = m_rates[subsys].load(std::memory_order_relaxed);
+    return log_rate_t{static_cast<uint32_t>(r >> 32),
+		      static_cast<uint32_t>(r)};
+  }
+
   // TODO(rzarzynski): move to string_view?
   constexpr const char* get_name(unsigned subsys) const {
     if (subsys >= get_num())
@@ -77,30 +126,95 @@ public:
       // Such debugs are intended to be gathered regardless even
       // of the user configuration.
       return true;
+    } else if constexpr (LvlV > ceph_subsys_get_max_level(SubV)) {
+      // above the build's ceiling (CEPH_LOG_MAX_LEVEL*)
+      return false;
     } else {
       // we expect that setting level different than the default
       // is rather unusual.
-      return expect(LvlV <= static_cast<int>(m_gather_levels[SubV]),
+      return expect(LvlV <= static_cast<int>(load_gather_level(SubV)),
 		    LvlV <= ceph_subsys_get_max_default_level(SubV));
     }
   }
   bool should_gather(const unsigned sub, int level) const {
     ceph_assert(sub < m_subsys.size());
-    return level <= static_cast<int>(m_gather_levels[sub]);
+    return level <= static_cast<int>(load_gather_level(sub));
   }
 
+  // Levels are only ever set by the config code, one thread at a time;
+  // m_subsys keeps the raw values for reporting.
   void set_log_level(unsigned subsys, uint8_t log)
   {
     ceph_assert(subsys < m_subsys.size());
     m_subsys[subsys].log_level = log;
-    m_gather_levels[subsys] = std::max(log, m_subsys[subsys].gather_level);
+    m_levels[subsys].store(pack_levels(log, m_subsys[subsys].gather_level),
+			   std::memory_order_relaxed);
   }
 
   void set_gather_level(unsigned subsys, uint8_t gather)
   {
     ceph_assert(subsys < m_subsys.size());
     m_subsys[subsys].gather_level = gather;
-    m_gather_levels[subsys] = std::max(m_subsys[subsys].log_level, gather);
+    m_levels[subsys].store(pack_levels(m_subsys[subsys].log_level, gather),
+			   std::memory_order_relaxed);
+  }
+
+  void set_log_rate(unsigned subsys, uint32_t rate, uint32_t burst)
+  {
+    ceph_assert(subsys < m_rates.size());
+    m_rates[subsys].store(static_cast<uint64_t>(rate) << 32 | burst,
+			  std::memory_order_relaxed);
+  }
+
+  /// keep one in every entries gathered at level and above; every <= 1
+  /// keeps them all
+  void set_log_sample(unsigned subsys, uint32_t every, uint8_t level)
+  {
+    ceph_assert(subsys < m_samples.size());
+    every = std::min<uint32_t>(every, 0xffffff);
+    const uint32_t s = every << 8 | std::max<uint8_t>(level, 1);
+    m_samples[subsys].store(every > 1 ? s : 0, std::memory_order_relaxed);
+  }
+
+  /// for an entry that passed should_gather(): false if its subsystem is
+  /// sampled and this one is to be dropped
+  template <unsigned SubV, int LvlV>
+  bool should_sample() const {
+    if constexpr (LvlV <= 0) {
+      return true;
+    } else {
+      return should_sample(SubV, LvlV);
+    }
+  }
+  bool should_sample(unsigned sub, int level) const {
+    const uint32_t s = m_samples[sub].load(std::memory_order_relaxed);
+    if (likely(s == 0) || level < static_cast<int>(s & 0xff)) {
+      return true;
+    }
+    return sample_one_in(s >> 8);
+  }
+
+  /// true for one in every calls, at random.  A per-thread xorshift, so
+  /// that sites taking turns in a loop are each sampled evenly.
+  static bool sample_one_in(uint32_t every) {
+    static thread_local uint64_t x =
+      reinterpret_cast<uintptr_t>(&x) * 0x9e3779b97f4a7c15ull | 1;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return ((x >> 32) * every >> 32) == 0;
+  }
+
+private:
+  void _copy_levels(const SubsystemMap& o) {
+    for (std::size_t i = 0; i < m_levels.size(); ++i) {
+      m_levels[i].store(o.m_levels[i].load(std::memory_order_relaxed),
+			std::memory_order_relaxed);
+      m_samples[i].store(o.m_samples[i].load(std::memory_order_relaxed),
+			 std::memory_order_relaxed);
+      m_rates[i].store(o.m_rates[i].load(std::memory_order_relaxed),
+		       std::memory_order_relaxed);
+    }
   }
 };
 
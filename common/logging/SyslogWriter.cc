@@ -0,0 +1,141 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "SyslogWriter.h"
+
+#include "include/compat.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace ceph {
+namespace logging {
+
+static constexpr std::size_t MAX_BATCH = 64;
+
+SyslogWriter::SyslogWriter()
+{
+#ifdef __GLIBC__
+  m_ident = program_invocation_short_name;
+#else
+  m_ident = getprogname();
+#endif
+}
+
+SyslogWriter::~SyslogWriter()
+{
+  flush();
+  _close();
+}
+
+void SyslogWriter::append(int pri, std::string_view msg)
+{
+  const time_t now = time(nullptr);
+  if (now != m_sec) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(m_stamp, sizeof(m_stamp), "%b %e %H:%M:%S", &tm);
+    m_sec = now;
+  }
+  char hdr[48];
+  int n = snprintf(hdr, sizeof(hdr), "<%d>%s ", pri, m_stamp);
+
+  Pending p;
+  p.pri = pri;
+  p.begin = m_buf.size();
+  m_buf.insert(m_buf.end(), hdr, hdr + n);
+  m_buf.insert(m_buf.end(), m_ident.begin(), m_ident.end());
+  m_buf.push_back(':');
+  m_buf.push_back(' ');
+  p.msg = m_buf.size();
+  m_buf.insert(m_buf.end(), msg.begin(), msg.end());
+  p.end = m_buf.size();
+  m_pending.push_back(p);
+}
+
+void SyslogWriter::flush()
+{
+  if (m_pending.empty()) {
+    return;
+  }
+  std::size_t sent = 0;
+  if (m_fd >= 0 || _connect()) {
+    bool reconnected = false;
+    struct iovec iov[MAX_BATCH];
+    struct mmsghdr msgs[MAX_BATCH];
+    while (sent < m_pending.size()) {
+      const std::size_t n = std::min(m_pending.size() - sent, MAX_BATCH);
+      memset(msgs, 0, sizeof(msgs[0]) * n);
+      for (std::size_t i = 0; i < n; ++i) {
+	const auto& p = m_pending[sent + i];
+	iov[i].iov_base = m_buf.data() + p.begin;
+	iov[i].iov_len = p.end - p.begin;
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      int r = sendmmsg(m_fd, msgs, n, MSG_NOSIGNAL);
+      if (r < 0) {
+	if (errno == EINTR) {
+	  continue;
+	}
+	// the daemon may have been restarted under us
+	if (!reconnected && (errno == ECONNREFUSED || errno == ENOTCONN)) {
+	  reconnected = true;
+	  _close();
+	  if (_connect()) {
+	    continue;
+	  }
+	}
+	break;
+      }
+      sent += r;
+    }
+  }
+  _fallback(sent);
+  m_buf.clear();
+  m_pending.clear();
+}
+
+bool SyslogWriter::_connect()
+{
+  m_fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (m_fd < 0) {
+    return false;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, _PATH_LOG, sizeof(addr.sun_path) - 1);
+  if (::connect(m_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    _close();
+    return false;
+  }
+  return true;
+}
+
+void SyslogWriter::_close()
+{
+  if (m_fd >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+    m_fd = -1;
+  }
+}
+
+/// hand whatever could not be sent from the from'th message on to syslog(3)
+void SyslogWriter::_fallback(std::size_t from)
+{
+  for (auto i = m_pending.begin() + from; i != m_pending.end(); ++i) {
+    syslog(i->pri, "%.*s", (int)(i->end - i->msg), m_buf.data() + i->msg);
+  }
+}
+
+}
+}
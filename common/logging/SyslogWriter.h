@@ -0,0 +1,64 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_SYSLOGWRITER_H
+#define __CEPH_LOG_SYSLOGWRITER_H
+
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ceph {
+namespace logging {
+
+/* Sends log lines to the local syslog daemon in batches.
+ *
+ * Lines are queued as complete RFC 3164 datagrams ("<pri>Mmm dd hh:mm:ss
+ * ident: msg", what syslog(3) would send) and flush() hands them to
+ * /dev/log with as few sendmmsg() calls as possible instead of one
+ * syslog() call, and one lock and send, per line. If /dev/log can't be
+ * reached as a datagram socket the queued lines go through syslog(3).
+ */
+class SyslogWriter {
+public:
+  SyslogWriter();
+  SyslogWriter(const SyslogWriter&) = delete;
+  SyslogWriter& operator=(const SyslogWriter&) = delete;
+  ~SyslogWriter();
+
+  /// queue msg at pri (facility | level)
+  void append(int pri, std::string_view msg);
+  /// send everything queued
+  void flush();
+
+  /// bytes queued
+  std::size_t size() const {
+    return m_buf.size();
+  }
+
+private:
+  struct Pending {
+    int pri;
+    std::size_t begin; ///< offset of the header in m_buf
+    std::size_t msg;   ///< offset of the message in m_buf
+    std::size_t end;
+  };
+
+  bool _connect();
+  void _close();
+  void _fallback(std::size_t from);
+
+  int m_fd = -1;
+  std::string m_ident;
+  std::vector<char> m_buf;
+  std::vector<Pending> m_pending;
+
+  time_t m_sec = -1;  ///< second m_stamp was formatted for
+  char m_stamp[16];   ///< "Mmm dd hh:mm:ss"
+};
+
+}
+}
+
+#endif
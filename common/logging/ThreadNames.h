@@ -0,0 +1,124 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_THREADNAMES_H
+#define __CEPH_LOG_THREADNAMES_H
+
+#include <pthread.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "common/utils/Thread.h"
+
+namespace ceph {
+namespace logging {
+
+/* What log_thread_names puts in a line instead of the pthread_t in hex:
+ * "<name>/<tid>" for a thread in the Thread registry (register_thread(),
+ * Thread::create(), make_named_thread()), with the name cut to what
+ * pthread_setname_np() would allow and blanks made '_'.  Each thread is looked up in the
+ * registry once; the tokens are kept until a thread registers or
+ * unregisters, since an exited thread's pthread_t is soon reused.  Not
+ * thread safe: the log thread and each format worker keep their own.
+ */
+class ThreadNameCache {
+public:
+  static constexpr std::size_t MAX_NAME = 15;
+  /// the name, '/' and the tid
+  static constexpr std::size_t MAX_TOKEN = MAX_NAME + 1 + 10;
+
+  /// empty for a thread that isn't registered
+  std::string_view get(pthread_t thread) {
+    const uint64_t generation = get_thread_registry_generation();
+    if (generation != m_generation) {
+      m_tokens.clear();
+      m_last = nullptr;
+      m_generation = generation;
+    }
+    if (m_last && pthread_equal(m_last->first, thread)) {
+      return m_last->second;
+    }
+    auto [i, inserted] = m_tokens.try_emplace(thread);
+    if (inserted) {
+      std::string name;
+      pid_t tid;
+      if (find_registered_thread(thread, &name, &tid)) {
+	char buf[16];
+	i->second.assign(name, 0, MAX_NAME);
+	// the token is a single field of the line
+	for (auto& c : i->second) {
+	  if (c == ' ' || c == '\t' || c == '\n') {
+	    c = '_';
+	  }
+	}
+	i->second.append(buf, snprintf(buf, sizeof(buf), "/%d", (int)tid));
+      }
+    }
+    m_last = &*i;
+    return i->second;
+  }
+
+private:
+  std::unordered_map<pthread_t, std::string> m_tokens;
+  const std::pair<const pthread_t, std::string> *m_last = nullptr;
+  uint64_t m_generation = 0;
+};
+
+/* A 16-bit stand-in for a thread id (a pthread_t, or a LogTask id) in the
+ * recent ring's packed record headers.  One open-addressed table for the
+ * whole process, so an index means the same thread in every ring and
+ * records can be copied between rings as they are; slots are only ever
+ * claimed, never freed, and both ways are lock free and async-signal-safe.
+ * A reused pthread_t gets its old slot back.  Index 0 is thread 0, and what
+ * a thread that doesn't find a free slot in a few probes gets, which is
+ * only likely once a process has seen tens of thousands of distinct task
+ * ids; its records then show thread 0.
+ */
+class ThreadIndex {
+public:
+  static constexpr std::size_t SLOTS = 1 << 16;
+
+  static uint16_t index_of(uint64_t thread) {
+    if (thread == 0) {
+      return 0;
+    }
+    std::size_t i = (thread * 0x9e3779b97f4a7c15ull) >> 48;
+    for (unsigned probe = 0; probe < MAX_PROBES; ++probe, i = (i + 1) % SLOTS) {
+      if (i == 0) {
+	continue;
+      }
+      uint64_t owner = slots()[i].load(std::memory_order_acquire);
+      if (owner == 0 &&
+	  slots()[i].compare_exchange_strong(owner, thread,
+					     std::memory_order_acq_rel)) {
+	return i;
+      }
+      if (owner == thread) {
+	return i;
+      }
+    }
+    return 0;
+  }
+
+  static uint64_t thread_of(uint16_t index) {
+    return slots()[index].load(std::memory_order_acquire);
+  }
+
+private:
+  static constexpr unsigned MAX_PROBES = 64;
+
+  /// zeroed, so only the pages in use are ever touched
+  static std::atomic<uint64_t>* slots() {
+    static std::atomic<uint64_t> s[SLOTS];
+    return s;
+  }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,161 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_LOG_TRACETAG_H
+#define __CEPH_LOG_TRACETAG_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+
+#include "common/utils/likely.h"
+
+namespace ceph {
+namespace logging {
+
+/* Per-thread debug level override for a single unit of work.
+ *
+ * Code that handles a connection, request or PG opens a TraceScope for it
+ * with the tag it is known by ("client.4123", "pg 1.2a", ...). If that tag
+ * is being traced (log_trace), every dout in the scope up to the traced
+ * level is gathered *and* written, whatever the subsystem's debug level,
+ * while the rest of the process keeps logging as configured. Outside of a
+ * traced scope the only cost is one thread-local load, and only for douts
+ * that the static gate has already rejected.
+ */
+inline thread_local int t_trace_level = 0;
+
+/// true if a dout at level v should be gathered because of a trace
+inline bool trace_gather(int v) {
+  return unlikely(t_trace_level >= v);
+}
+
+/// the tags being traced and the level to trace each at
+class TraceRegistry {
+public:
+  using tag_map = std::map<std::string, int, std::less<>>;
+
+  /// level tag is traced at, 0 if it isn't
+  int lookup(std::string_view tag) const {
+    if (likely(!m_any.load(std::memory_order_relaxed))) {
+      return 0;
+    }
+    std::shared_lock lock(m_lock);
+    auto i = m_tags.find(tag);
+    return i == m_tags.end() ? 0 : i->second;
+  }
+
+  void set(tag_map tags) {
+    std::unique_lock lock(m_lock);
+    m_tags = std::move(tags);
+    m_any.store(!m_tags.empty(), std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> m_any{false};
+  mutable std::shared_mutex m_lock;
+  tag_map m_tags;
+};
+
+/// the trace ID of the request this thread is at work on, 0 if none; to
+/// be handed on with the work to whichever thread continues it
+inline thread_local uint64_t t_trace_id = 0;
+
+inline uint64_t get_trace_id() {
+  return t_trace_id;
+}
+
+/* Traces a fraction of requests by their trace ID (log_trace_sample_*).
+ *
+ * Whether an ID is traced depends on nothing but the ID, the seed and the
+ * rate, so every daemon configured alike makes the same decision: a
+ * request picked where it enters the cluster is logged in detail at every
+ * hop it takes, and the rest are not logged in detail anywhere.  The hash
+ * is spelled out rather than std::hash so that hosts built differently
+ * agree; IDs that are strings go through id_of() for the same reason.
+ */
+class TraceSampler {
+public:
+  /// trace rate of all IDs (0 to 1) at level; a level of 0 stops
+  void set(double rate, int level, uint64_t seed) {
+    // the hashes at or below it are traced
+    const uint64_t threshold = rate >= 1 ? UINT64_MAX :
+      static_cast<uint64_t>(std::ldexp(std::max(rate, 0.0), 64));
+    m_level.store(0, std::memory_order_relaxed);
+    m_threshold.store(threshold, std::memory_order_relaxed);
+    m_seed.store(seed, std::memory_order_relaxed);
+    m_level.store(rate > 0 ? level : 0, std::memory_order_release);
+  }
+
+  /// level id is traced at, 0 if it isn't
+  int lookup(uint64_t id) const {
+    const int level = m_level.load(std::memory_order_acquire);
+    if (likely(level <= 0) || id == 0) {
+      return 0;
+    }
+    const uint64_t h = mix(id ^ m_seed.load(std::memory_order_relaxed));
+    return h <= m_threshold.load(std::memory_order_relaxed) ? level : 0;
+  }
+
+  /// the trace ID of a request known by a string, e.g. an osd_reqid_t
+  /// as printed; never 0
+  static uint64_t id_of(std::string_view key) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : key) {
+      h = (h ^ c) * 0x100000001b3ull;
+    }
+    return h ? h : 1;
+  }
+
+private:
+  /// splitmix64's finalizer: IDs handed out in sequence come out uniform
+  static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  std::atomic<int> m_level{0};
+  std::atomic<uint64_t> m_threshold{0};
+  std::atomic<uint64_t> m_seed{0};
+};
+
+/// raises this thread's trace level for its lifetime; nests
+class TraceScope {
+public:
+  explicit TraceScope(int level)
+    : m_saved(t_trace_level), m_saved_id(t_trace_id) {
+    if (level > t_trace_level) {
+      t_trace_level = level;
+    }
+  }
+  TraceScope(const TraceRegistry& traces, std::string_view tag)
+    : TraceScope(traces.lookup(tag)) {}
+  /// the work on request id, traced if the sampler picks it
+  TraceScope(const TraceSampler& sampler, uint64_t id)
+    : TraceScope(sampler.lookup(id)) {
+    t_trace_id = id;
+  }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+  ~TraceScope() {
+    t_trace_level = m_saved;
+    t_trace_id = m_saved_id;
+  }
+
+private:
+  const int m_saved;
+  const uint64_t m_saved_id;
+};
+
+}
+}
+
+#endif
@@ -24,6 +24,13 @@
 
 #define pdout(v, p) lpdout((dout_context), (v), (p))
 
+#define dout_deferred(v, ...) ldout_deferred((dout_context), (v), __VA_ARGS__)
+
+// with dout_fmt.h
+#define dout_fmt(v, format, ...) \
+  ldout_fmt((dout_context), (v), format, ##__VA_ARGS__)
+#define derr_fmt(format, ...) lderr_fmt((dout_context), format, ##__VA_ARGS__)
+
 #define dlog_p(sub, v) ldlog_p1((dout_context), (sub), (v))
 
 #define generic_dout(v) lgeneric_dout((dout_context), (v))
@@ -1,5 +1,8 @@
-
+#include <array>
 #include <iostream>
+#include <string>
+
+#include "dout.h"
 
 void dout_emergency(const char * const str)
 {
@@ -12,3 +15,40 @@ void dout_emergency(const std::string &str)
   std::cerr << str;
   std::cerr.flush();
 }
+
+namespace {
+
+struct cached_prefix {
+  const CachedDoutPrefixProvider *owner = nullptr;
+  uint64_t generation = 0;
+  std::string text;
+};
+
+// a few providers per thread are usually all that log from it for a while;
+// entries for any others simply replace each other
+thread_local std::array<cached_prefix, 16> t_prefixes;
+
+}
+
+uint64_t CachedDoutPrefixProvider::next_generation()
+{
+  static std::atomic<uint64_t> next{1};
+  return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CachedDoutPrefixProvider::append_prefix(
+  CachedStackStringStream::sss& out) const
+{
+  // read before rendering, so the text is at least as new as the generation
+  const uint64_t generation = m_generation.load(std::memory_order_acquire);
+  auto& c = t_prefixes[(reinterpret_cast<uintptr_t>(this) / alignof(void*)) %
+		       t_prefixes.size()];
+  if (c.owner != this || c.generation != generation) {
+    CachedStackStringStream css;
+    gen_prefix(*css);
+    c.text.assign(css->strv());
+    c.owner = this;
+    c.generation = generation;
+  }
+  out.append(c.text);
+}
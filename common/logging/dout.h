@@ -16,6 +16,8 @@
 #ifndef CEPH_DOUT_H
 #define CEPH_DOUT_H
 
+#include <atomic>
+#include <cstdint>
 #include <type_traits>
 
 #include "include/ceph_assert.h"
@@ -25,6 +27,10 @@
 #include "common/likely.h"
 #include "common/Clock.h"
 #include "log/Log.h"
+#include "log/DeferredEntry.h"
+#include "log/DoutSite.h"
+#include "log/StructuredEntry.h"
+#include "log/TraceTag.h"
 
 extern void dout_emergency(const char * const str);
 extern void dout_emergency(const std::string &str);
@@ -43,6 +49,44 @@ public:
   virtual CephContext *get_cct() const = 0;
   virtual unsigned get_subsys() const = 0;
   virtual ~DoutPrefixProvider() {}
+
+  /// what ldpp_dout writes the prefix with; see CachedDoutPrefixProvider
+  virtual void append_prefix(CachedStackStringStream::sss& out) const {
+    gen_prefix(out);
+  }
+};
+
+/* A prefix provider that renders its prefix once and then appends that text
+ * to each line, for prefixes that rarely change, such as a PG's.  Whatever
+ * changes something gen_prefix() prints must call invalidate_prefix()
+ * afterwards.  Each thread keeps its own copy of the text, tagged with the
+ * generation it was rendered at, so lines logged concurrently share
+ * nothing but the generation.  The prefix is rendered into a stream of its
+ * own, so formatting flags it sets don't carry over into the line.
+ */
+class CachedDoutPrefixProvider : public DoutPrefixProvider {
+public:
+  CachedDoutPrefixProvider() : m_generation(next_generation()) {}
+  CachedDoutPrefixProvider(const CachedDoutPrefixProvider&)
+    : m_generation(next_generation()) {}
+  CachedDoutPrefixProvider& operator=(const CachedDoutPrefixProvider&) {
+    invalidate_prefix();
+    return *this;
+  }
+
+  void append_prefix(CachedStackStringStream::sss& out) const override;
+
+protected:
+  void invalidate_prefix() {
+    m_generation.store(next_generation(), std::memory_order_release);
+  }
+
+private:
+  /// unique across all providers, so that a copy cached for a provider
+  /// that is gone is never mistaken for one of a new provider at its address
+  static uint64_t next_generation();
+
+  std::atomic<uint64_t> m_generation;
 };
 
 // a prefix provider with empty prefix
@@ -80,6 +124,10 @@ class DoutPrefixPipe : public DoutPrefixProvider {
     add_prefix(out);
     return out;
   }
+  void append_prefix(CachedStackStringStream::sss& out) const override final {
+    dpp.append_prefix(out);
+    add_prefix(out);
+  }
   CephContext *get_cct() const override { return dpp.get_cct(); }
   unsigned get_subsys() const override { return dpp.get_subsys(); }
 
@@ -111,30 +159,65 @@ struct is_dynamic<dynamic_marker_t<T>> : public std::true_type {};
 // generic macros
 #define dout_prefix *_dout
 
-#define dout_impl(cct, sub, v)						\
-  do {									\
+// Whether a site survives the build's level ceilings (see
+// ceph_subsys_get_max_level()); the dout macros put their whole body under
+// it with if constexpr, so a stripped site leaves no code, no DoutSite and
+// no string literals behind.  A dynamic level is always compiled in, and a
+// dynamic subsystem is held to the highest ceiling of any.
+#define dout_compiled_in(sub, v)					\
+  (ceph::dout::is_dynamic<decltype(v)>::value ||			\
+   (ceph::dout::is_dynamic<decltype(sub)>::value ?			\
+    (v) <= ceph_subsys_get_max_level_any() :				\
+    (v) <= ceph_subsys_get_max_level(sub)))
+
+// The gate every dout variant shares: declares the site and its state,
+// and should_gather, true if the entry is to be made at all, because its
+// level is gathered (and sampled) or the site or a trace forces it, and the
+// log takes it.
+#define dout_gate_(cct, sub, v)						\
+  static ceph::logging::DoutSite _dout_site(__FILE__, __LINE__);	\
+  const auto _dout_site_state = ceph::logging::dout_site_state(_dout_site); \
   const bool should_gather = [&](const auto cctX) {			\
+    if (_dout_site_state == ceph::logging::DoutSite::DISABLED) {	\
+      return false;							\
+    }									\
     if constexpr (ceph::dout::is_dynamic<decltype(sub)>::value ||	\
 		  ceph::dout::is_dynamic<decltype(v)>::value) {		\
-      return cctX->_conf->subsys.should_gather(sub, v);			\
+      return ((cctX->_conf->subsys.should_gather(sub, v) &&		\
+	       cctX->_conf->subsys.should_sample(sub, v)) ||		\
+	      _dout_site_state == ceph::logging::DoutSite::ENABLED ||	\
+	      ceph::logging::trace_gather(v)) &&			\
+	cctX->_log->should_submit(sub, v);				\
     } else {								\
       /* The parentheses are **essential** because commas in angle	\
        * brackets are NOT ignored on macro expansion! A language's	\
        * limitation, sorry. */						\
-      return (cctX->_conf->subsys.template should_gather<sub, v>());	\
+      return ((cctX->_conf->subsys.template should_gather<sub, v>() &&	\
+	       cctX->_conf->subsys.template should_sample<sub, v>()) ||	\
+	      _dout_site_state == ceph::logging::DoutSite::ENABLED ||	\
+	      ceph::logging::trace_gather(v)) &&			\
+	cctX->_log->should_submit(sub, v);				\
     }									\
-  }(cct);								\
-									\
+  }(cct)
+
+#define dout_impl(cct, sub, v)						\
+  do {									\
+  if constexpr (dout_compiled_in(sub, v)) {			\
+  dout_gate_(cct, sub, v);						\
   if (should_gather) {							\
     ceph::logging::MutableEntry _dout_e(v, sub);                        \
+    _dout_e.m_forced |=							\
+      _dout_site_state == ceph::logging::DoutSite::ENABLED;		\
+    _dout_e.m_site = &_dout_site;					\
     static_assert(std::is_convertible<decltype(&*cct), CephContext* >::value,		\
 		  "provided cct must be compatible with CephContext*"); \
     auto _dout_cct = cct;						\
-    std::ostream* _dout = &_dout_e.get_ostream();
+    auto* _dout = &_dout_e.get_ostream();
 
 #define dendl_impl std::flush;                                          \
     _dout_cct->_log->submit_entry(std::move(_dout_e));                  \
   }                                                                     \
+  }									\
   } while (0)
 
 #define lsubdout(cct, sub, v)  dout_impl(cct, ceph_subsys_##sub, v) dout_prefix
@@ -144,12 +227,63 @@ struct is_dynamic<dynamic_marker_t<T>> : public std::true_type {};
 #define ldpp_dout(dpp, v) 						\
   if (decltype(auto) pdpp = (dpp); pdpp) /* workaround -Wnonnull-compare for 'this' */ \
     dout_impl(pdpp->get_cct(), ceph::dout::need_dynamic(pdpp->get_subsys()), v) \
-      pdpp->gen_prefix(*_dout)
+      (pdpp->append_prefix(*_dout), *_dout)
 
 #define lgeneric_subdout(cct, sub, v) dout_impl(cct, ceph_subsys_##sub, v) *_dout
 #define lgeneric_dout(cct, v) dout_impl(cct, ceph_subsys_, v) *_dout
 #define lgeneric_derr(cct) dout_impl(cct, ceph_subsys_, -1) *_dout
 
+// Deferred variants take the whole message as arguments instead of a
+// stream. The arguments are captured raw (see DeferredEntry.h) and only
+// formatted on the log thread if the entry is actually written, or when it
+// is dumped after a crash. There is no stream, so dout_prefix does not apply.
+#define dout_deferred_impl(cct, sub, v, ...)				\
+  do {									\
+  if constexpr (dout_compiled_in(sub, v)) {			\
+  dout_gate_(cct, sub, v);						\
+  if (should_gather) {							\
+    static_assert(std::is_convertible<decltype(&*cct), CephContext* >::value,	\
+		  "provided cct must be compatible with CephContext*"); \
+    auto _dout_e = ceph::logging::make_deferred_entry(v, sub, __VA_ARGS__); \
+    _dout_e.m_forced |=							\
+      _dout_site_state == ceph::logging::DoutSite::ENABLED;		\
+    _dout_e.m_site = &_dout_site;					\
+    (cct)->_log->submit_entry(std::move(_dout_e));			\
+  }									\
+  }									\
+  } while (0)
+
+#define lsubdout_deferred(cct, sub, v, ...) \
+  dout_deferred_impl(cct, ceph_subsys_##sub, v, __VA_ARGS__)
+#define ldout_deferred(cct, v, ...) \
+  dout_deferred_impl(cct, dout_subsys, v, __VA_ARGS__)
+
+// Structured variants: ldout_kv(cct, v, "op done", ceph::logging::kv("pg",
+// pgid), ceph::logging::kv("lat", lat)). The message and fields are encoded
+// like deferred arguments (see StructuredEntry.h) and written either as
+// "op done pg=1.2 lat=0.003" or, with log_format=json, with a member for
+// each field.
+#define dout_kv_impl(cct, sub, v, ...)					\
+  do {									\
+  if constexpr (dout_compiled_in(sub, v)) {			\
+  dout_gate_(cct, sub, v);						\
+  if (should_gather) {							\
+    static_assert(std::is_convertible<decltype(&*cct), CephContext* >::value,	\
+		  "provided cct must be compatible with CephContext*"); \
+    auto _dout_e = ceph::logging::make_structured_entry(v, sub, __VA_ARGS__); \
+    _dout_e.m_forced |=							\
+      _dout_site_state == ceph::logging::DoutSite::ENABLED;		\
+    _dout_e.m_site = &_dout_site;					\
+    (cct)->_log->submit_entry(std::move(_dout_e));			\
+  }									\
+  }									\
+  } while (0)
+
+#define lsubdout_kv(cct, sub, v, ...) \
+  dout_kv_impl(cct, ceph_subsys_##sub, v, __VA_ARGS__)
+#define ldout_kv(cct, v, ...) \
+  dout_kv_impl(cct, dout_subsys, v, __VA_ARGS__)
+
 #define ldlog_p1(cct, sub, lvl) (cct->_conf->subsys.should_gather((sub), (lvl)))
 
 #define dendl dendl_impl
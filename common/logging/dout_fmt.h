@@ -0,0 +1,49 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_DOUT_FMT_H
+#define CEPH_DOUT_FMT_H
+
+// Apart from dout.h so that only the files that use them pull in fmt.
+
+#include "dout.h"
+#include "log/FmtEntry.h"
+
+// fmt variants: ldout_fmt(cct, v, "osd.{} is {}", id, state). The format
+// string is checked at compile time and the text is formatted straight into
+// the entry's buffer with no ostream in between. Like the deferred variants
+// they don't apply dout_prefix.
+#define dout_fmt_impl(cct, sub, v, format, ...)				\
+  do {									\
+  if constexpr (dout_compiled_in(sub, v)) {			\
+  dout_gate_(cct, sub, v);						\
+  if (should_gather) {							\
+    static_assert(std::is_convertible<decltype(&*cct), CephContext* >::value,	\
+		  "provided cct must be compatible with CephContext*"); \
+    auto _dout_e = ceph::logging::make_fmt_entry(v, sub, FMT_STRING(format), \
+						 ##__VA_ARGS__);	\
+    _dout_e.m_forced |=							\
+      _dout_site_state == ceph::logging::DoutSite::ENABLED;		\
+    _dout_e.m_site = &_dout_site;					\
+    (cct)->_log->submit_entry(std::move(_dout_e));			\
+  }									\
+  }									\
+  } while (0)
+
+#define lsubdout_fmt(cct, sub, v, format, ...) \
+  dout_fmt_impl(cct, ceph_subsys_##sub, v, format, ##__VA_ARGS__)
+#define ldout_fmt(cct, v, format, ...) \
+  dout_fmt_impl(cct, dout_subsys, v, format, ##__VA_ARGS__)
+#define lderr_fmt(cct, format, ...) \
+  dout_fmt_impl(cct, ceph_subsys_, -1, format, ##__VA_ARGS__)
+
+#endif
@@ -58,6 +58,64 @@ ceph_subsys_get_max_default_level(const std::size_t subidx) {
   return std::max(item.log_level, item.gather_level);
 }
 
+// Build-time level ceilings, for builds that would rather not carry the
+// most verbose debug output at all: -DCEPH_LOG_MAX_LEVEL=N caps every
+// subsystem and -DCEPH_LOG_MAX_LEVEL_<name>=N (e.g. CEPH_LOG_MAX_LEVEL_osd)
+// one of them.  A dout site with a constant level above its subsystem's
+// ceiling compiles to nothing; no debug_* setting can bring it back.
+// Levels 0 and -1 are never stripped.  The macros are stringized so that
+// one left undefined reads as "not a number" rather than needing an #ifdef
+// per subsystem.
+#define CEPH_LOG_LEVEL_STR_(x) #x
+#define CEPH_LOG_LEVEL_STR(x) CEPH_LOG_LEVEL_STR_(x)
+
+constexpr static int ceph_subsys_parse_ceiling(const char* const s, int dflt) {
+  if (s[0] < '0' || s[0] > '9') {
+    return dflt;
+  }
+  int n = 0;
+  for (std::size_t i = 0; s[i] >= '0' && s[i] <= '9' && n <= 255; ++i) {
+    n = n * 10 + (s[i] - '0');
+  }
+  return n;
+}
+
+constexpr static int ceph_subsys_default_ceiling() {
+  return ceph_subsys_parse_ceiling(CEPH_LOG_LEVEL_STR(CEPH_LOG_MAX_LEVEL), 255);
+}
+
+constexpr static std::array<int, ceph_subsys_get_num()>
+ceph_subsys_get_ceilings() {
+#define SUBSYS(name, log, gather) \
+  ceph_subsys_parse_ceiling(CEPH_LOG_LEVEL_STR(CEPH_LOG_MAX_LEVEL_##name), \
+			    ceph_subsys_default_ceiling()),
+#define DEFAULT_SUBSYS(log, gather) \
+  ceph_subsys_parse_ceiling(CEPH_LOG_LEVEL_STR(CEPH_LOG_MAX_LEVEL_none), \
+			    ceph_subsys_default_ceiling()),
+
+  return {
+#include "common/subsys.h"
+  };
+#undef SUBSYS
+#undef DEFAULT_SUBSYS
+}
+
+/// the highest level compiled in for the subsystem
+constexpr static int ceph_subsys_get_max_level(const std::size_t subidx) {
+  return std::max(ceph_subsys_get_ceilings()[subidx], 0);
+}
+
+/// the highest level compiled in for any subsystem, for sites whose
+/// subsystem is only known at runtime
+constexpr static int ceph_subsys_get_max_level_any() {
+  const auto c = ceph_subsys_get_ceilings();
+  int m = 0;
+  for (int l : c) {
+    m = std::max(m, l);
+  }
+  return m;
+}
+
 // Compile time-capable version of std::strlen. Resorting to own
 // implementation only because C++17 doesn't mandate constexpr
 // on the standard one.
@@ -13,12 +13,19 @@
  */
 
 #include <algorithm>
-#include <map>
 #include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <iostream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <tuple>
 
 #include "include/buffer.h"
+#include "include/compat.h"
 #include "common/errno.h"
 #include "common/utf8.h"
 #include "common/ConfUtils.h"
@@ -29,15 +36,60 @@ using std::string;
 
 #define MAX_CONFIG_FILE_SZ 0x40000000
 
-////////////////////////////// ConfLine //////////////////////////////
-ConfLine::ConfLine(const std::string &key_, const std::string &val_,
-      const std::string &newsection_, const std::string &comment_, int line_no_)
-  : key(key_), val(val_), newsection(newsection_)
+static const char *const KEY_WHITESPACE = " \t\r\n\f\v\xa0";
+
+namespace {
+struct line_scan_t {
+  size_t len;    ///< up to the newline, or everything if there is none
+  bool newline;
+  bool nul;      ///< has a '\0'
+  bool high;     ///< has a byte >= 0x80, so may not be valid UTF8
+};
+
+/// look through the text at b for the end of its first line, noting the
+/// bytes load_from_buffer() has to reject or check more closely
+line_scan_t scan_line(const char *b, size_t rem)
 {
-  // If you want to implement writable ConfFile support, you'll need to save
-  // the comment and line_no arguments here.
+  line_scan_t r{0, false, false, false};
+  size_t i = 0;
+#ifdef __SSE2__
+  // 16 bytes at a time; SSE2 is always there on x86_64
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= rem; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    unsigned nls = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    unsigned nuls = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+    unsigned highs = _mm_movemask_epi8(v);
+    if (nls) {
+      // only what comes before the newline is part of the line
+      const unsigned n = __builtin_ctz(nls);
+      const unsigned before = (1u << n) - 1;
+      r.len = i + n;
+      r.newline = true;
+      r.nul |= (nuls & before) != 0;
+      r.high |= (highs & before) != 0;
+      return r;
+    }
+    r.nul |= nuls != 0;
+    r.high |= highs != 0;
+  }
+#endif
+  for (; i < rem; ++i) {
+    const unsigned char c = b[i];
+    if (c == '\n') {
+      r.newline = true;
+      break;
+    }
+    r.nul |= c == '\0';
+    r.high |= c >= 0x80;
+  }
+  r.len = i;
+  return r;
+}
 }
 
+////////////////////////////// ConfLine //////////////////////////////
 bool ConfLine::operator<(const ConfLine &rhs) const
 {
   // We only compare keys.
@@ -51,94 +103,99 @@ bool ConfLine::operator<(const ConfLine &rhs) const
 
 std::ostream &operator<<(std::ostream& oss, const ConfLine &l)
 {
-  oss << "ConfLine(key = '" << l.key << "', val='"
-      << l.val << "', newsection='" << l.newsection << "')";
+  oss << "ConfLine(key = '" << l.key << "', val='" << l.val << "')";
   return oss;
 }
 ///////////////////////// ConfFile //////////////////////////
 ConfFile::ConfFile() {}
 
-ConfFile::~ConfFile() {}
+ConfFile::~ConfFile()
+{
+}
 
 void ConfFile::clear()
 {
+  index.clear();
   sections.clear();
+  owned.clear();
+}
+
+void ConfFile::swap(ConfFile& o) noexcept
+{
+  index.swap(o.index);
+  sections.swap(o.sections);
+  owned.swap(o.owned);
 }
 
-/* We load the whole file into memory and then parse it.  Although this is not
- * the optimal approach, it does mean that most of this code can be shared with
- * the bufferlist loading function. Since bufferlists are always in-memory, the
- * load_from_buffer interface works well for them.
- * In general, configuration files should be a few kilobytes at maximum, so
- * loading the whole configuration into memory shouldn't be a problem.
+/* We map the whole file and parse it in place, then move what the lines
+ * point to off the mapping with a single copy and unmap it: the parsed
+ * file is read long after (md_config_t keeps it), and a mapping faults
+ * once the file is truncated underneath it.
  */
 int ConfFile::parse_file(const std::string &fname, std::deque<std::string> *errors,
 	   std::ostream *warnings)
 {
   clear();
 
-  int ret = 0;
-  size_t sz;
-  char *buf = NULL;
-  FILE *fp = fopen(fname.c_str(), "r");
-  if (!fp) {
+  int fd = ::open(fname.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    int ret = -errno;
     ostringstream oss;
-    oss << __func__ << ": cannot open " << fname << ": " << cpp_strerror(errno);
+    oss << __func__ << ": cannot open " << fname << ": " << cpp_strerror(ret);
     errors->push_back(oss.str());
-    ret = -errno;
     return ret;
   }
 
+  int ret = 0;
+  size_t sz = 0;
+  void *p = nullptr;
   struct stat st_buf;
-  if (fstat(fileno(fp), &st_buf)) {
+  if (::fstat(fd, &st_buf)) {
     ret = -errno;
     ostringstream oss;
     oss << __func__ << ": failed to fstat '" << fname << "': " << cpp_strerror(ret);
     errors->push_back(oss.str());
-    goto done;
-  }
-
-  if (st_buf.st_size > MAX_CONFIG_FILE_SZ) {
+  } else if (st_buf.st_size > MAX_CONFIG_FILE_SZ) {
     ostringstream oss;
     oss << __func__ << ": config file '" << fname << "' is " << st_buf.st_size
 	<< " bytes, but the maximum is " << MAX_CONFIG_FILE_SZ;
     errors->push_back(oss.str());
     ret = -EINVAL;
-    goto done;
-  }
-
-  sz = (size_t)st_buf.st_size;
-  buf = (char*)malloc(sz);
-  if (!buf) {
-    ret = -ENOMEM;
-    goto done;
-  }
-
-  if (fread(buf, 1, sz, fp) != sz) {
-    if (ferror(fp)) {
+  } else if ((sz = (size_t)st_buf.st_size) > 0) {
+    // (a pipe or a /proc file says it is empty, and reads as such)
+    p = ::mmap(nullptr, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
       ret = -errno;
       ostringstream oss;
-      oss << __func__ << ": fread error while reading '" << fname << "': " << cpp_strerror(ret);
-      errors->push_back(oss.str());
-      goto done;
-    }
-    else {
-      ostringstream oss;
-      oss << __func__ << ": unexpected EOF while reading '" << fname << "': "
-          << "possible concurrent modification?";
+      oss << __func__ << ": failed to map '" << fname << "': " << cpp_strerror(ret);
       errors->push_back(oss.str());
-      ret = -EIO;
-      goto done;
+      p = nullptr;
     }
   }
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  if (ret < 0) {
+    return ret;
+  }
 
-  load_from_buffer(buf, sz, errors, warnings);
-  ret = 0;
-
-done:
-  free(buf);
-  fclose(fp);
-  return ret;
+  const char *base = static_cast<const char*>(p);
+  load_from_buffer(base, sz, errors, warnings);
+  if (p) {
+    const std::string& copy = owned.emplace_back(base, sz);
+    auto rebase = [base, sz, &copy](std::string_view& v) {
+      if (v.data() >= base && v.data() <= base + sz) {
+	v = std::string_view(copy.data() + (v.data() - base), v.size());
+      }
+    };
+    for (auto& [name, section] : sections) {
+      for (auto& l : section.lines) {
+	rebase(l.key);
+	rebase(l.val);
+      }
+    }
+    ::munmap(p, sz);
+  }
+  build_index();
+  return 0;
 }
 
 int ConfFile::parse_bufferlist(ceph::bufferlist *bl, std::deque<std::string> *errors,
@@ -146,25 +203,37 @@ int ConfFile::parse_bufferlist(ceph::bufferlist *bl, std::deque<std::string> *er
 {
   clear();
 
-  load_from_buffer(bl->c_str(), bl->length(), errors, warnings);
+  // the lines point into what they were parsed from, which bl may not outlive
+  const std::string& buf = owned.emplace_back(bl->c_str(), bl->length());
+  load_from_buffer(buf.data(), buf.size(), errors, warnings);
+  build_index();
   return 0;
 }
 
-int ConfFile::read(const std::string &section, const std::string &key, std::string &val) const
+int ConfFile::read(std::string_view section, std::string_view key, std::string &val) const
 {
-  string k(normalize_key_name(key));
+  string normalized;
+  if (key.find_first_of(KEY_WHITESPACE) != std::string_view::npos) {
+    normalized = normalize_key_name(std::string(key));
+    key = normalized;
+  }
 
-  const_section_iter_t s = sections.find(section);
-  if (s == sections.end())
+  auto l = index.find({section, key});
+  if (l == index.end())
     return -ENOENT;
-  ConfLine exemplar(k, "", "", "", 0);
-  ConfSection::const_line_iter_t l = s->second.lines.find(exemplar);
-  if (l == s->second.lines.end())
-    return -ENOENT;
-  val = l->val;
+  val.assign(l->second);
   return 0;
 }
 
+size_t ConfFile::index_hash_t::operator()(
+  const std::pair<std::string_view, std::string_view>& k) const
+{
+  std::hash<std::string_view> h;
+  size_t seed = h(k.first);
+  // as boost::hash_combine
+  return seed ^ (h(k.second) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
 ConfFile::const_section_iter_t ConfFile::sections_begin() const
 {
   return sections.begin();
@@ -236,7 +305,7 @@ void ConfFile::trim_whitespace(std::string &str, bool strip_internal)
 std::string ConfFile::
 normalize_key_name(const std::string &key)
 {
-  if (key.find_first_of(" \t\r\n\f\v\xa0") == string::npos) {
+  if (key.find_first_of(KEY_WHITESPACE) == string::npos) {
     return key;
   }
 
@@ -253,9 +322,7 @@ std::ostream &operator<<(std::ostream &oss, const ConfFile &cf)
     oss << "[" << s->first << "]\n";
     for (ConfSection::const_line_iter_t l = s->second.lines.begin();
 	 l != s->second.lines.end(); ++l) {
-      if (!l->key.empty()) {
-	oss << "\t" << l->key << " = \"" << l->val << "\"\n";
-      }
+      oss << "\t" << l->key << " = \"" << l->val << "\"\n";
     }
   }
   return oss;
@@ -267,10 +334,10 @@ load_from_buffer(const char *buf, size_t sz, std::deque<std::string> *errors,
 {
   errors->clear();
 
-  section_iter_t::value_type vt("global", ConfSection());
-  pair < section_iter_t, bool > vr(sections.insert(vt));
-  ceph_assert(vr.second);
-  section_iter_t cur_section = vr.first;
+  // everything is gathered first and sorted into sections at the end
+  std::vector<std::string_view> section_names = {"global"};
+  std::vector<parsed_line_t> parsed;
+  std::string_view cur_section = section_names.back();
   std::string acc;
 
   const char *b = buf;
@@ -286,27 +353,18 @@ load_from_buffer(const char *buf, size_t sz, std::deque<std::string> *errors,
       break;
     line_no++;
 
-    // look for the next newline
-    const char *end = (const char*)memchr(b, '\n', rem);
-    if (!end) {
+    // find the next newline, and what the line has in it, in one pass
+    const line_scan_t scan = scan_line(b, rem);
+    if (!scan.newline) {
       ostringstream oss;
       oss << "read_conf: ignoring line " << line_no << " because it doesn't "
 	  << "end with a newline! Please end the config file with a newline.";
       errors->push_back(oss.str());
       break;
     }
+    line_len = scan.len;
 
-    // find length of line, and search for NULLs
-    line_len = 0;
-    bool found_null = false;
-    for (const char *tmp = b; tmp != end; ++tmp) {
-      line_len++;
-      if (*tmp == '\0') {
-	found_null = true;
-      }
-    }
-
-    if (found_null) {
+    if (scan.nul) {
       ostringstream oss;
       oss << "read_conf: ignoring line " << line_no << " because it has "
 	  << "an embedded null.";
@@ -315,7 +373,8 @@ load_from_buffer(const char *buf, size_t sz, std::deque<std::string> *errors,
       continue;
     }
 
-    if (check_utf8(b, line_len)) {
+    // plain ASCII is valid UTF8
+    if (scan.high && check_utf8(b, line_len)) {
       ostringstream oss;
       oss << "read_conf: ignoring line " << line_no << " because it is not "
 	  << "valid UTF8.";
@@ -332,36 +391,24 @@ load_from_buffer(const char *buf, size_t sz, std::deque<std::string> *errors,
       continue;
     }
 
-    acc.append(b, line_len);
+    std::string_view line(b, line_len);
+    if (!acc.empty()) {
+      // a continued line; parse where it was put together
+      acc.append(b, line_len);
+      line = owned.emplace_back(std::move(acc));
+      acc.clear();
+    }
 
-    //cerr << "acc = '" << acc << "'" << std::endl;
-    ConfLine *cline = process_line(line_no, acc.c_str(), errors);
-    acc.clear();
-    if (!cline)
+    std::string_view newsection;
+    ConfLine cline({}, {});
+    if (!process_line(line_no, line, errors, &newsection, &cline))
       continue;
-    const std::string &csection(cline->newsection);
-    if (!csection.empty()) {
-      std::map <std::string, ConfSection>::value_type nt(csection, ConfSection());
-      pair < section_iter_t, bool > nr(sections.insert(nt));
-      cur_section = nr.first;
+    if (!newsection.empty()) {
+      section_names.push_back(newsection);
+      cur_section = newsection;
+    } else if (!cline.key.empty()) {
+      parsed.push_back({cur_section, cline, line_no});
     }
-    else {
-      if (cur_section->second.lines.count(*cline)) {
-	// replace an existing key/line in this section, so that
-	//  [mysection]
-	//    foo = 1
-	//    foo = 2
-	// will result in foo = 2.
-	cur_section->second.lines.erase(*cline);
-	if (cline->key.length() && warnings)
-	  *warnings << "warning: line " << line_no << ": '" << cline->key << "' in section '"
-		    << cur_section->first << "' redefined " << std::endl;
-      }
-      // add line to current section
-      //std::cerr << "cur_section = " << cur_section->first << ", " << *cline << std::endl;
-      cur_section->second.lines.insert(*cline);
-    }
-    delete cline;
   }
 
   if (!acc.empty()) {
@@ -369,15 +416,128 @@ load_from_buffer(const char *buf, size_t sz, std::deque<std::string> *errors,
     oss << "read_conf: don't end with lines that end in backslashes!";
     errors->push_back(oss.str());
   }
+
+  std::sort(section_names.begin(), section_names.end());
+  section_names.erase(std::unique(section_names.begin(), section_names.end()),
+		      section_names.end());
+  section_map_t::sequence_type seq;
+  seq.reserve(section_names.size());
+  for (auto name : section_names) {
+    seq.emplace_back(std::string(name), ConfSection());
+  }
+  sections.adopt_sequence(boost::container::ordered_unique_range,
+			  std::move(seq));
+
+  // sort by section and key, keeping the file's order within a key, so
+  // that the last line for each wins:
+  //  [mysection]
+  //    foo = 1
+  //    foo = 2
+  // will result in foo = 2.
+  auto by_key = [](const parsed_line_t& a, const parsed_line_t& b) {
+    return std::tie(a.section, a.line.key) < std::tie(b.section, b.line.key);
+  };
+  std::stable_sort(parsed.begin(), parsed.end(), by_key);
+  section_iter_t s = sections.end();
+  for (auto i = parsed.begin(); i != parsed.end(); ++i) {
+    if (s == sections.end() || s->first != i->section) {
+      s = sections.find(i->section);
+    }
+    auto& lines = s->second.lines;
+    if (!lines.empty() && lines.back().key == i->line.key) {
+      if (warnings)
+	*warnings << "warning: line " << i->line_no << ": '" << i->line.key
+		  << "' in section '" << s->first << "' redefined " << std::endl;
+      lines.back() = i->line;
+    } else {
+      lines.push_back(i->line);
+    }
+  }
+}
+
+void ConfFile::build_index()
+{
+  std::size_t n = 0;
+  for (auto& [name, section] : sections) {
+    n += section.lines.size();
+  }
+  index.reserve(n);
+  for (auto& [name, section] : sections) {
+    for (auto& l : section.lines) {
+      index.emplace(std::make_pair(std::string_view(name), l.key), l.val);
+    }
+  }
 }
 
+class ConfFile::token_t {
+public:
+  explicit token_t(std::deque<std::string> *owned) : owned(owned) {}
+
+  /// append the character at p, in the line being parsed
+  void add(const char *p) {
+    if (str) {
+      str->push_back(*p);
+    } else if (len == 0) {
+      begin = p;
+      len = 1;
+    } else if (begin + len == p) {
+      ++len;
+    } else {
+      // something in between was skipped; no longer a slice
+      str = &owned->emplace_back(begin, len);
+      str->push_back(*p);
+    }
+  }
+  std::string_view view() const {
+    return str ? std::string_view(*str) : std::string_view(begin, len);
+  }
+  /// as trim_whitespace(s, false)
+  std::string_view trimmed() const {
+    auto v = view();
+    while (!v.empty() && isspace((unsigned char)v.front()))
+      v.remove_prefix(1);
+    while (!v.empty() && isspace((unsigned char)v.back()))
+      v.remove_suffix(1);
+    return v;
+  }
+  /// as normalize_key_name()
+  std::string_view key() {
+    // "key = val" is the usual spelling; that space is no reason to copy
+    if (auto v = trimmed();
+	v.find_first_of(KEY_WHITESPACE) == std::string_view::npos)
+      return v;
+    auto v = view();
+    str = &owned->emplace_back(normalize_key_name(std::string(v)));
+    return *str;
+  }
+  /// as trim_whitespace(s, true)
+  std::string_view section() {
+    str = &owned->emplace_back(view());
+    trim_whitespace(*str, true);
+    return *str;
+  }
+
+private:
+  std::deque<std::string> *owned;
+  const char *begin = nullptr;
+  size_t len = 0;
+  std::string *str = nullptr;
+};
+
 /*
  * A simple state-machine based parser.
  * This probably could/should be rewritten with something like boost::spirit
  * or yacc if the grammar ever gets more complex.
+ *
+ * Parses line (with no newline), which must outlive this ConfFile.  Returns
+ * false if there is nothing to keep: a blank line, or an error (which is
+ * added to errors).  Otherwise sets either *newsection, to the name of the
+ * section it starts, or *cline, whose key is empty for a line with only a
+ * comment.
  */
-ConfLine* ConfFile::
-process_line(int line_no, const char *line, std::deque<std::string> *errors)
+bool ConfFile::
+process_line(int line_no, std::string_view line, std::deque<std::string> *errors,
+	     std::string_view *newsection_out, ConfLine *cline)
 {
   enum acceptor_state_t {
     ACCEPT_INIT,
@@ -389,26 +549,31 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
     ACCEPT_COMMENT_START,
     ACCEPT_COMMENT_TEXT,
   };
-  const char *l = line;
+  const char *const start = line.data();
+  const char *const line_end = start + line.size();
+  const char *l = start;
   acceptor_state_t state = ACCEPT_INIT;
-  string key, val, newsection, comment;
+  token_t key(&owned), val(&owned), newsection(&owned);
+  std::string_view k, v;
   bool escaping = false;
   while (true) {
-    char c = *l++;
+    const char *at = l++;
+    // the end of the line reads as the NUL that used to terminate it
+    char c = at < line_end ? *at : '\0';
     switch (state) {
       case ACCEPT_INIT:
 	if (c == '\0')
-	  return NULL; // blank line. Not an error, but not interesting either.
+	  return false; // blank line. Not an error, but not interesting either.
 	else if (c == '[')
 	  state = ACCEPT_SECTION_NAME;
 	else if ((c == '#') || (c == ';'))
 	  state = ACCEPT_COMMENT_TEXT;
 	else if (c == ']') {
 	  ostringstream oss;
-	  oss << "unexpected right bracket at char " << (l - line)
+	  oss << "unexpected right bracket at char " << (l - start)
 	      << ", line " << line_no;
 	  errors->push_back(oss.str());
-	  return NULL;
+	  return false;
 	}
 	else if (isspace(c)) {
 	  // ignore whitespace here
@@ -423,34 +588,34 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
 	if (c == '\0') {
 	  ostringstream oss;
 	  oss << "error parsing new section name: expected right bracket "
-	      << "at char " << (l - line) << ", line " << line_no;
+	      << "at char " << (l - start) << ", line " << line_no;
 	  errors->push_back(oss.str());
-	  return NULL;
+	  return false;
 	}
 	else if ((c == ']') && (!escaping)) {
-	  trim_whitespace(newsection, true);
-	  if (newsection.empty()) {
+	  *newsection_out = newsection.section();
+	  if (newsection_out->empty()) {
 	    ostringstream oss;
 	    oss << "error parsing new section name: no section name found? "
-	        << "at char " << (l - line) << ", line " << line_no;
+	        << "at char " << (l - start) << ", line " << line_no;
 	    errors->push_back(oss.str());
-	    return NULL;
+	    return false;
 	  }
 	  state = ACCEPT_COMMENT_START;
 	}
 	else if (((c == '#') || (c == ';')) && (!escaping)) {
 	  ostringstream oss;
 	  oss << "unexpected comment marker while parsing new section name, at "
-	      << "char " << (l - line) << ", line " << line_no;
+	      << "char " << (l - start) << ", line " << line_no;
 	  errors->push_back(oss.str());
-	  return NULL;
+	  return false;
 	}
 	else if ((c == '\\') && (!escaping)) {
 	  escaping = true;
 	}
 	else {
 	  escaping = false;
-	  newsection += c;
+	  newsection.add(at);
 	}
 	break;
       case ACCEPT_KEY:
@@ -461,19 +626,19 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
 	        << " reached, no \"=val\" found...missing =?";
 	  } else {
 	    oss << "unexpected character while parsing putative key value, "
-		<< "at char " << (l - line) << ", line " << line_no;
+		<< "at char " << (l - start) << ", line " << line_no;
 	  }
 	  errors->push_back(oss.str());
-	  return NULL;
+	  return false;
 	}
 	else if ((c == '=') && (!escaping)) {
-	  key = normalize_key_name(key);
-	  if (key.empty()) {
+	  k = key.key();
+	  if (k.empty()) {
 	    ostringstream oss;
 	    oss << "error parsing key name: no key name found? "
-	        << "at char " << (l - line) << ", line " << line_no;
+	        << "at char " << (l - start) << ", line " << line_no;
 	    errors->push_back(oss.str());
-	    return NULL;
+	    return false;
 	  }
 	  state = ACCEPT_VAL_START;
 	}
@@ -482,12 +647,14 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
 	}
 	else {
 	  escaping = false;
-	  key += c;
+	  key.add(at);
 	}
 	break;
       case ACCEPT_VAL_START:
-	if (c == '\0')
-	  return new ConfLine(key, val, newsection, comment, line_no);
+	if (c == '\0') {
+	  *cline = ConfLine(k, v);
+	  return true;
+	}
 	else if ((c == '#') || (c == ';'))
 	  state = ACCEPT_COMMENT_TEXT;
 	else if (c == '"')
@@ -506,15 +673,15 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
 	  if (escaping) {
 	    ostringstream oss;
 	    oss << "error parsing value name: unterminated escape sequence "
-	        << "at char " << (l - line) << ", line " << line_no;
+	        << "at char " << (l - start) << ", line " << line_no;
 	    errors->push_back(oss.str());
-	    return NULL;
+	    return false;
 	  }
-	  trim_whitespace(val, false);
-	  return new ConfLine(key, val, newsection, comment, line_no);
+	  *cline = ConfLine(k, val.trimmed());
+	  return true;
 	}
 	else if (((c == '#') || (c == ';')) && (!escaping)) {
-	  trim_whitespace(val, false);
+	  v = val.trimmed();
 	  state = ACCEPT_COMMENT_TEXT;
 	}
 	else if ((c == '\\') && (!escaping)) {
@@ -522,7 +689,7 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
 	}
 	else {
 	  escaping = false;
-	  val += c;
+	  val.add(at);
 	}
 	break;
       case ACCEPT_QUOTED_VAL:
@@ -531,9 +698,10 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
 	  oss << "found opening quote for value, but not the closing quote. "
 	      << "line " << line_no;
 	  errors->push_back(oss.str());
-	  return NULL;
+	  return false;
 	}
 	else if ((c == '"') && (!escaping)) {
+	  v = val.view();
 	  state = ACCEPT_COMMENT_START;
 	}
 	else if ((c == '\\') && (!escaping)) {
@@ -542,12 +710,13 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
 	else {
 	  escaping = false;
 	  // Add anything, including whitespace.
-	  val += c;
+	  val.add(at);
 	}
 	break;
       case ACCEPT_COMMENT_START:
 	if (c == '\0') {
-	  return new ConfLine(key, val, newsection, comment, line_no);
+	  *cline = ConfLine(k, v);
+	  return true;
 	}
 	else if ((c == '#') || (c == ';')) {
 	  state = ACCEPT_COMMENT_TEXT;
@@ -557,17 +726,17 @@ process_line(int line_no, const char *line, std::deque<std::string> *errors)
 	}
 	else {
 	  ostringstream oss;
-	  oss << "unexpected character at char " << (l - line) << " of line "
+	  oss << "unexpected character at char " << (l - start) << " of line "
 	      << line_no;
 	  errors->push_back(oss.str());
-	  return NULL;
+	  return false;
 	}
 	break;
       case ACCEPT_COMMENT_TEXT:
-	if (c == '\0')
-	  return new ConfLine(key, val, newsection, comment, line_no);
-	else
-	  comment += c;
+	if (c == '\0') {
+	  *cline = ConfLine(k, v);
+	  return true;
+	}
 	break;
       default:
 	ceph_abort();
@@ -16,9 +16,12 @@
 #define CEPH_CONFUTILS_H
 
 #include <deque>
-#include <map>
-#include <set>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/container/flat_map.hpp>
 
 #include "include/buffer_fwd.h"
 
@@ -33,38 +36,52 @@
  * You can get information out of ConfFile by calling get_key or by examining
  * individual sections.
  *
+ * A file is mapped rather than read and parsed in place; those keys and
+ * values that had to be rewritten (escapes, continued lines, whitespace in
+ * keys) are copied, and the rest are moved off the mapping with one copy
+ * of the whole file once parsing is done.  Each section's lines are a
+ * vector sorted by key, and read() goes through a hash of every (section,
+ * key) built once the whole file is parsed.
+ *
  * This class could be extended to support modifying configuration files and
  * writing them back out without too much difficulty. Currently, this is not
  * implemented, and the file is read-only.
  */
 class ConfLine {
 public:
-  ConfLine(const std::string &key_, const std::string &val_,
-	   const std::string &newsection_, const std::string &comment_, int line_no_);
+  ConfLine(std::string_view key_, std::string_view val_)
+    : key(key_), val(val_) {}
   bool operator<(const ConfLine &rhs) const;
   friend std::ostream &operator<<(std::ostream& oss, const ConfLine &l);
 
-  std::string key, val, newsection;
+  /// into the ConfFile they came from; valid for as long as it is
+  std::string_view key, val;
 };
 
 class ConfSection {
 public:
-  typedef std::set <ConfLine>::const_iterator const_line_iter_t;
+  typedef std::vector<ConfLine>::const_iterator const_line_iter_t;
 
-  std::set <ConfLine> lines;
+  /// sorted by key, one line per key
+  std::vector<ConfLine> lines;
 };
 
 class ConfFile {
 public:
-  typedef std::map <std::string, ConfSection>::iterator section_iter_t;
-  typedef std::map <std::string, ConfSection>::const_iterator const_section_iter_t;
+  typedef boost::container::flat_map<std::string, ConfSection, std::less<>> section_map_t;
+  typedef section_map_t::iterator section_iter_t;
+  typedef section_map_t::const_iterator const_section_iter_t;
 
   ConfFile();
+  ConfFile(const ConfFile&) = delete;
+  ConfFile& operator=(const ConfFile&) = delete;
   ~ConfFile();
   void clear();
+  /// what the lines point into moves along with them
+  void swap(ConfFile& o) noexcept;
   int parse_file(const std::string &fname, std::deque<std::string> *errors, std::ostream *warnings);
   int parse_bufferlist(ceph::bufferlist *bl, std::deque<std::string> *errors, std::ostream *warnings);
-  int read(const std::string &section, const std::string &key, std::string &val) const;
+  int read(std::string_view section, std::string_view key, std::string &val) const;
 
   const_section_iter_t sections_begin() const;
   const_section_iter_t sections_end() const;
@@ -74,12 +91,32 @@ public:
   friend std::ostream &operator<<(std::ostream &oss, const ConfFile &cf);
 
 private:
+  /// a key, value or section name being parsed: a slice of the line
+  /// until something (an escape, say) makes it differ from one
+  class token_t;
+  struct parsed_line_t {
+    std::string_view section;
+    ConfLine line;
+    int line_no;
+  };
+
   void load_from_buffer(const char *buf, size_t sz,
 			std::deque<std::string> *errors, std::ostream *warnings);
-  static ConfLine* process_line(int line_no, const char *line,
-			        std::deque<std::string> *errors);
+  bool process_line(int line_no, std::string_view line,
+		    std::deque<std::string> *errors,
+		    std::string_view *newsection, ConfLine *cline);
+  void build_index();
 
-  std::map <std::string, ConfSection> sections;
+  section_map_t sections;
+  struct index_hash_t {
+    size_t operator()(const std::pair<std::string_view, std::string_view>& k) const;
+  };
+  /// every line's value by (section, key), built once parsing is done, so
+  /// that read() is one hash lookup; points into sections and lines
+  std::unordered_map<std::pair<std::string_view, std::string_view>,
+		     std::string_view, index_hash_t> index;
+  /// whatever lines' keys and values point to
+  std::deque<std::string> owned;
 };
 
 #endif
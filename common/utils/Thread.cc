@@ -12,21 +12,38 @@
  *
  */
 
+#include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #ifdef __linux__
 #include <sys/syscall.h>   /* For SYS_xxx definitions */
 #endif
 
+#include <atomic>
+#include <map>
+#include <mutex>
+
 #include "common/Thread.h"
 #include "common/code_environment.h"
 #include "common/debug.h"
+#include "common/rcu_ptr.h"
 #include "common/signal.h"
+#include "common/strtol.h"
 
 #ifdef HAVE_SCHED
 #include <sched.h>
 #endif
 
+#if defined(__linux__) && !defined(MPOL_BIND)
+// from <numaif.h>, without needing libnuma for it
+#define MPOL_PREFERRED 1
+#define MPOL_BIND 2
+#endif
+
 
 pid_t ceph_gettid(void)
 {
@@ -37,28 +54,434 @@ pid_t ceph_gettid(void)
 #endif
 }
 
-static int _set_affinity(int id)
+namespace {
+
+ceph::rcu_ptr<ThreadPlacementPolicy> placement_policy;
+ceph::rcu_ptr<ThreadStackPolicy> stack_policy;
+
+struct registered_thread {
+  ThreadInfo info;
+  pthread_t pthread;
+  bool by_name;  ///< placed by the policy, so moved when it changes
+  std::chrono::steady_clock::time_point sampled;
+};
+/// serializes set_thread_placement(), and protects registry
+std::mutex registry_lock;
+std::map<pid_t, registered_thread> registry;
+std::atomic<uint64_t> registry_generation{0};
+
+/// whether tid is still the thread called name: one that exited without
+/// unregistering may have left its tid to another
+bool task_is(pid_t tid, std::string_view name)
 {
-#ifdef HAVE_SCHED
-  if (id >= 0 && id < CPU_SETSIZE) {
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
+  char fn[64], comm[17] = {};
+  snprintf(fn, sizeof(fn), "/proc/self/task/%d/comm", tid);
+  int fd = ::open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  ssize_t n = ::read(fd, comm, sizeof(comm) - 1);
+  ::close(fd);
+  if (n > 0 && comm[n - 1] == '\n') {
+    --n;
+  }
+  // the kernel keeps 15 characters of it
+  return n > 0 && std::string_view(comm, n) == name.substr(0, 15);
+}
 
-    CPU_SET(id, &cpuset);
+/// tid's time on a cpu and waiting for one
+int read_task_times(pid_t tid, std::chrono::nanoseconds *cpu,
+		    std::chrono::nanoseconds *wait)
+{
+  char fn[64], buf[1024];
+  snprintf(fn, sizeof(fn), "/proc/self/task/%d/schedstat", tid);
+  int fd = ::open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd >= 0) {
+    ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+    ::close(fd);
+    unsigned long long run, delay;
+    if (n > 0 && (buf[n] = 0, sscanf(buf, "%llu %llu", &run, &delay) == 2)) {
+      *cpu = std::chrono::nanoseconds(run);
+      *wait = std::chrono::nanoseconds(delay);
+      return 0;
+    }
+  }
+  // no schedstat; stat has the cpu time at least, in clock ticks
+  snprintf(fn, sizeof(fn), "/proc/self/task/%d/stat", tid);
+  fd = ::open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    return -errno;
+  }
+  ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+  ::close(fd);
+  if (n <= 0) {
+    return -EIO;
+  }
+  buf[n] = 0;
+  // the name may have spaces and parentheses of its own
+  const char *p = strrchr(buf, ')');
+  unsigned long long utime, stime;
+  if (!p || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+		   "%llu %llu", &utime, &stime) != 2) {
+    return -EIO;
+  }
+  const long hz = sysconf(_SC_CLK_TCK);
+  *cpu = std::chrono::nanoseconds((utime + stime) * (1000000000 / hz));
+  *wait = std::chrono::nanoseconds(0);
+  return 0;
+}
 
-    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0)
-      return -errno;
-    /* guaranteed to take effect immediately */
-    sched_yield();
+/// "0-3,8" into cpus
+int parse_cpu_list(std::string_view s, std::vector<int> *cpus)
+{
+  while (!s.empty()) {
+    auto comma = s.find(',');
+    std::string_view range = s.substr(0, comma);
+    s.remove_prefix(comma == s.npos ? s.size() : comma + 1);
+    auto dash = range.find('-');
+    int first, last;
+    if (strict_parse(range.substr(0, dash), &first) != strict_errc::ok) {
+      return -EINVAL;
+    }
+    if (dash == range.npos) {
+      last = first;
+    } else if (strict_parse(range.substr(dash + 1), &last) !=
+	       strict_errc::ok) {
+      return -EINVAL;
+    }
+    if (first < 0 || last < first) {
+      return -EINVAL;
+    }
+    for (int c = first; c <= last; ++c) {
+      cpus->push_back(c);
+    }
+  }
+  return 0;
+}
+
+std::vector<int> node_cpus(int node)
+{
+  std::vector<int> cpus;
+  char fn[64];
+  snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%d/cpulist", node);
+  int fd = ::open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd >= 0) {
+    char buf[4096];
+    ssize_t r = ::read(fd, buf, sizeof(buf));
+    ::close(fd);
+    if (r > 0) {
+      std::string_view list(buf, r);
+      while (!list.empty() && isspace(list.back())) {
+	list.remove_suffix(1);
+      }
+      parse_cpu_list(list, &cpus);
+    }
+  }
+  return cpus;
+}
+
+/// n up to a multiple of align, a power of two
+template<typename T>
+T round_up(T n, T align)
+{
+  return (n + align - 1) & ~(align - 1);
+}
+
+/// the next whitespace or ';' separated entry of spec, or "" at the end
+std::string_view next_policy_entry(std::string_view *spec)
+{
+  auto start = spec->find_first_not_of(" \t\n;");
+  if (start == spec->npos) {
+    spec->remove_prefix(spec->size());
+    return {};
+  }
+  spec->remove_prefix(start);
+  auto end = spec->find_first_of(" \t\n;");
+  std::string_view entry = spec->substr(0, end);
+  spec->remove_prefix(end == spec->npos ? spec->size() : end);
+  return entry;
+}
+
+template<typename T>
+const T *find_by_name(const std::vector<std::pair<std::string, T>>& policy,
+		      std::string_view name)
+{
+  for (const auto& [pattern, p] : policy) {
+    std::string_view pat(pattern);
+    if (!pat.empty() && pat.back() == '*') {
+      pat.remove_suffix(1);
+      if (name.substr(0, pat.size()) == pat) {
+	return &p;
+      }
+    } else if (name == pat) {
+      return &p;
+    }
+  }
+  return nullptr;
+}
+
+/// run thread tid (0 for the caller) on p's cpus; with memory, which only
+/// the thread itself can set, allocate from p's node too
+int _set_placement(pid_t tid, const ThreadPlacement& p, bool memory)
+{
+  int r = 0;
+#ifdef HAVE_SCHED
+  const std::vector<int>& cpus = p.cpus.empty() && p.node >= 0 ?
+    node_cpus(p.node) : p.cpus;
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  bool any = false;
+  for (int c : cpus) {
+    if (c >= 0 && c < CPU_SETSIZE) {
+      CPU_SET(c, &cpuset);
+      any = true;
+    }
+  }
+  if (any) {
+    if (sched_setaffinity(tid, sizeof(cpuset), &cpuset) < 0) {
+      r = -errno;
+    } else if (tid == 0) {
+      /* guaranteed to take effect immediately */
+      sched_yield();
+    }
+  }
+#endif
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  if (memory && p.node >= 0 && p.node < 1024) {
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {};
+    mask[p.node / (8 * sizeof(unsigned long))] |=
+      1ul << (p.node % (8 * sizeof(unsigned long)));
+    // the kernel reads one bit less than maxnode
+    if (syscall(SYS_set_mempolicy, p.strict ? MPOL_BIND : MPOL_PREFERRED,
+		mask, sizeof(mask) * 8 + 1) < 0 && r == 0) {
+      r = -errno;
+    }
   }
 #endif
+  return r;
+}
+
+}
+
+int parse_thread_placement(std::string_view spec,
+			   ThreadPlacementPolicy *policy, std::string *err)
+{
+  policy->clear();
+  while (!spec.empty()) {
+    std::string_view entry = next_policy_entry(&spec);
+    if (entry.empty()) {
+      break;
+    }
+    auto eq = entry.find('=');
+    if (eq == 0 || eq == entry.npos) {
+      *err = "expected <thread name>=<placement>, not '" +
+	std::string(entry) + "'";
+      return -EINVAL;
+    }
+    ThreadPlacement p;
+    std::string_view where = entry.substr(eq + 1);
+    auto at = where.find('@');
+    if (at != where.npos) {
+      std::string_view node = where.substr(at + 1);
+      if (!node.empty() && node.back() == '!') {
+	p.strict = true;
+	node.remove_suffix(1);
+      }
+      if (strict_parse(node, &p.node) != strict_errc::ok || p.node < 0) {
+	*err = "bad NUMA node in '" + std::string(entry) + "'";
+	return -EINVAL;
+      }
+      where = where.substr(0, at);
+    }
+    if (parse_cpu_list(where, &p.cpus) < 0) {
+      *err = "bad cpu list in '" + std::string(entry) + "'";
+      return -EINVAL;
+    }
+    if (p.empty()) {
+      *err = "no cpus or node in '" + std::string(entry) + "'";
+      return -EINVAL;
+    }
+    policy->emplace_back(std::string(entry.substr(0, eq)), std::move(p));
+  }
+  return 0;
+}
+
+int set_thread_placement(std::string_view spec, std::string *err)
+{
+  auto policy = std::make_unique<ThreadPlacementPolicy>();
+  int r = parse_thread_placement(spec, policy.get(), err);
+  if (r < 0) {
+    return r;
+  }
+  std::lock_guard l(registry_lock);
+  for (const auto& [tid, t] : registry) {
+    if (!t.by_name) {
+      continue;
+    }
+    if (auto p = find_by_name(*policy, t.info.name);
+	p && task_is(tid, t.info.name)) {
+      _set_placement(tid, *p, false);
+    }
+  }
+  placement_policy.update(std::move(policy));
   return 0;
 }
 
+int parse_thread_stack(std::string_view spec, ThreadStackPolicy *policy,
+		       std::string *err)
+{
+  policy->clear();
+  const size_t page = sysconf(_SC_PAGESIZE);
+  while (!spec.empty()) {
+    std::string_view entry = next_policy_entry(&spec);
+    if (entry.empty()) {
+      break;
+    }
+    auto eq = entry.find('=');
+    if (eq == 0 || eq == entry.npos) {
+      *err = "expected <thread name>=<stack>, not '" +
+	std::string(entry) + "'";
+      return -EINVAL;
+    }
+    ThreadStack st;
+    std::string_view what = entry.substr(eq + 1);
+    // nothing after the '=' leaves the name with the defaults
+    for (bool first = true; !what.empty(); first = false) {
+      auto comma = what.find(',');
+      std::string_view item = what.substr(0, comma);
+      what.remove_prefix(comma == what.npos ? what.size() : comma + 1);
+      std::string e;
+      if (item == "huge") {
+	st.huge = true;
+      } else if (item.substr(0, 6) == "guard=") {
+	st.guard = round_up<size_t>(strict_iecstrtoll(item.substr(6), &e), page);
+	st.has_guard = true;
+      } else if (first) {
+	st.size = round_up<size_t>(strict_iecstrtoll(item, &e), page);
+	if (e.empty() && st.size < (size_t)PTHREAD_STACK_MIN) {
+	  e = "smaller than PTHREAD_STACK_MIN";
+	}
+      } else {
+	e = "expected guard=<size> or huge";
+      }
+      if (!e.empty()) {
+	*err = "bad '" + std::string(item) + "' in '" +
+	  std::string(entry) + "': " + e;
+	return -EINVAL;
+      }
+    }
+    policy->emplace_back(std::string(entry.substr(0, eq)), st);
+  }
+  return 0;
+}
+
+int set_thread_stack(std::string_view spec, std::string *err)
+{
+  auto policy = std::make_unique<ThreadStackPolicy>();
+  int r = parse_thread_stack(spec, policy.get(), err);
+  if (r < 0) {
+    return r;
+  }
+  stack_policy.update(std::move(policy));
+  return 0;
+}
+
+void register_thread(const char *name, bool place)
+{
+  const pid_t tid = ceph_gettid();
+  if (!name || tid <= 0) {
+    return;
+  }
+  {
+    std::lock_guard l(registry_lock);
+    auto& t = registry[tid];
+    t.info = ThreadInfo();
+    t.info.name = name;
+    t.info.tid = tid;
+    t.info.started = std::chrono::system_clock::now();
+    t.pthread = pthread_self();
+    t.by_name = place;
+    t.sampled = std::chrono::steady_clock::now();
+    registry_generation.fetch_add(1, std::memory_order_release);
+  }
+  if (!place) {
+    return;
+  }
+  ceph::rcu_ptr<ThreadPlacementPolicy>::reader policy(placement_policy);
+  if (policy.get()) {
+    if (auto p = find_by_name(*policy, name); p) {
+      _set_placement(0, *p, true);
+    }
+  }
+}
+
+void unregister_thread()
+{
+  std::lock_guard l(registry_lock);
+  registry.erase(ceph_gettid());
+  registry_generation.fetch_add(1, std::memory_order_release);
+}
+
+void sample_threads()
+{
+  std::lock_guard l(registry_lock);
+  const auto now = std::chrono::steady_clock::now();
+  for (auto i = registry.begin(); i != registry.end(); ) {
+    auto& t = i->second;
+    std::chrono::nanoseconds cpu, wait;
+    if (read_task_times(i->first, &cpu, &wait) < 0) {
+      // gone without unregistering
+      i = registry.erase(i);
+      registry_generation.fetch_add(1, std::memory_order_release);
+      continue;
+    }
+    const double elapsed =
+      std::chrono::duration<double>(now - t.sampled).count();
+    if (elapsed > 0) {
+      t.info.cpu_util = std::chrono::duration<double>(
+	cpu - t.info.cpu).count() / elapsed;
+      t.info.wait_util = std::chrono::duration<double>(
+	wait - t.info.wait).count() / elapsed;
+    }
+    t.info.cpu = cpu;
+    t.info.wait = wait;
+    t.sampled = now;
+    ++i;
+  }
+}
+
+std::vector<ThreadInfo> get_threads()
+{
+  std::lock_guard l(registry_lock);
+  std::vector<ThreadInfo> threads;
+  threads.reserve(registry.size());
+  for (const auto& [tid, t] : registry) {
+    threads.push_back(t.info);
+  }
+  return threads;
+}
+
+bool find_registered_thread(pthread_t thread, std::string *name, pid_t *tid)
+{
+  std::lock_guard l(registry_lock);
+  for (const auto& [id, t] : registry) {
+    if (pthread_equal(t.pthread, thread)) {
+      *name = t.info.name;
+      *tid = id;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t get_thread_registry_generation()
+{
+  return registry_generation.load(std::memory_order_acquire);
+}
+
 Thread::Thread()
   : thread_id(0),
     pid(0),
-    cpuid(-1),
     thread_name(NULL)
 {
 }
@@ -77,11 +500,39 @@ void *Thread::entry_wrapper()
   int p = ceph_gettid(); // may return -ENOSYS on other platforms
   if (p > 0)
     pid = p;
-  if (pid && cpuid >= 0)
-    _set_affinity(cpuid);
-
   ceph_pthread_setname(pthread_self(), thread_name);
-  return entry();
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (huge_stack) {
+    // glibc mapped the stack, so only the thread knows where it is; the
+    // kernel can only use huge pages for the aligned part of it
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+      void *addr;
+      size_t size;
+      if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+	const uintptr_t huge = 2 << 20;
+	uintptr_t start = round_up<uintptr_t>((uintptr_t)addr, huge);
+	uintptr_t end = ((uintptr_t)addr + size) & ~(huge - 1);
+	if (start < end) {
+	  madvise((void*)start, end - start, MADV_HUGEPAGE);
+	}
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+#endif
+  const bool by_name = placement.empty();
+  if (!by_name) {
+    _set_placement(0, placement, true);
+  }
+  if (pid) {
+    register_thread(thread_name, by_name);
+  }
+  void *r = entry();
+  if (pid) {
+    unregister_thread();
+  }
+  return r;
 }
 
 const pthread_t &Thread::get_thread_id() const
@@ -111,12 +562,29 @@ int Thread::try_create(size_t stacksize)
 {
   pthread_attr_t *thread_attr = NULL;
   pthread_attr_t thread_attr_loc;
-  
-  stacksize &= CEPH_PAGE_MASK;  // must be multiple of page
-  if (stacksize) {
+  ThreadStack st;
+  if (stacksize == 0 && thread_name) {
+    ceph::rcu_ptr<ThreadStackPolicy>::reader policy(stack_policy);
+    if (policy.get()) {
+      if (auto p = find_by_name(*policy, thread_name); p) {
+	st = *p;
+      }
+    }
+  } else {
+    st.size = stacksize;
+  }
+  huge_stack = st.huge;
+
+  st.size &= CEPH_PAGE_MASK;  // must be multiple of page
+  if (st.size || st.has_guard) {
     thread_attr = &thread_attr_loc;
     pthread_attr_init(thread_attr);
-    pthread_attr_setstacksize(thread_attr, stacksize);
+    if (st.size) {
+      pthread_attr_setstacksize(thread_attr, st.size);
+    }
+    if (st.has_guard) {
+      pthread_attr_setguardsize(thread_attr, st.guard);
+    }
   }
 
   int r;
@@ -183,12 +651,27 @@ int Thread::detach()
   return pthread_detach(thread_id);
 }
 
+void Thread::forget_after_fork()
+{
+  thread_id = 0;
+  pid = 0;
+}
+
 int Thread::set_affinity(int id)
+{
+  ThreadPlacement p;
+  if (id >= 0) {
+    p.cpus.push_back(id);
+  }
+  return set_placement(p);
+}
+
+int Thread::set_placement(const ThreadPlacement& p)
 {
   int r = 0;
-  cpuid = id;
+  placement = p;
   if (pid && ceph_gettid() == pid)
-    r = _set_affinity(id);
+    r = _set_placement(0, p, true);
   return r;
 }
 
@@ -16,10 +16,14 @@
 #ifndef CEPH_THREAD_H
 #define CEPH_THREAD_H
 
+#include <chrono>
 #include <functional>
+#include <string>
 #include <string_view>
 #include <system_error>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <pthread.h>
 #include <sys/types.h>
@@ -28,12 +32,92 @@
 
 extern pid_t ceph_gettid();
 
+/// where a thread runs and allocates memory
+struct ThreadPlacement {
+  std::vector<int> cpus;  ///< empty for any, or with a node, the node's
+  int node = -1;          ///< NUMA node to allocate memory on, -1 for any
+  bool strict = false;    ///< only allocate on node, rather than prefer it
+
+  bool empty() const {
+    return cpus.empty() && node < 0;
+  }
+};
+
+/// thread name (or name prefix, ending in '*') to placement, first match
+/// wins
+using ThreadPlacementPolicy =
+  std::vector<std::pair<std::string, ThreadPlacement>>;
+
+/**
+ * parse a thread_placement spec
+ *
+ * Whitespace or ';' separated <name>=[<cpu list>][@<node>[!]], e.g.
+ * "log=0-1 admin_socket*=0-1 tp_osd_tp=@1".  The cpu list is as in
+ * /sys (0-3,8); @<node> prefers that NUMA node's memory, and its cpus
+ * if none are listed; a '!' binds the memory to the node instead.
+ */
+int parse_thread_placement(std::string_view spec,
+			   ThreadPlacementPolicy *policy, std::string *err);
+/// place threads started from now on by name, and move the cpus of the
+/// running ones this applies to (their memory policy is left as it is)
+int set_thread_placement(std::string_view spec, std::string *err);
+
+/// a thread in the registry, as of the last sample_threads()
+struct ThreadInfo {
+  std::string name;
+  pid_t tid = 0;
+  std::chrono::system_clock::time_point started;
+  std::chrono::nanoseconds cpu{0};   ///< on a cpu, all told
+  std::chrono::nanoseconds wait{0};  ///< runnable, waiting for a cpu
+  double cpu_util = 0;   ///< cpu per wall time between the last two samples
+  double wait_util = 0;  ///< likewise for wait
+};
+
+/// how a thread's stack is laid out
+struct ThreadStack {
+  size_t size = 0;         ///< 0 for the default
+  size_t guard = 0;        ///< bytes of guard below it, with has_guard
+  bool has_guard = false;  ///< otherwise the default guard
+  bool huge = false;       ///< ask for transparent huge pages to back it
+};
+
+/// thread name (or name prefix, ending in '*') to stack, first match wins
+using ThreadStackPolicy = std::vector<std::pair<std::string, ThreadStack>>;
+
+/**
+ * parse a thread_stack spec
+ *
+ * Whitespace or ';' separated <name>=[<size>][,guard=<size>][,huge], e.g.
+ * "log=256K tp_osd_tp*=2M,huge *=1M,guard=64K".  Sizes may have IEC
+ * suffixes (K, M, ...) and are rounded up to whole pages.
+ */
+int parse_thread_stack(std::string_view spec, ThreadStackPolicy *policy,
+		       std::string *err);
+/// lay out the stacks of Threads created from now on by name
+int set_thread_stack(std::string_view spec, std::string *err);
+
+/// add the calling thread to the registry and, with place, apply the
+/// placement policy for name to it
+void register_thread(const char *name, bool place = true);
+/// the calling thread is exiting
+void unregister_thread();
+/// read the cpu times of the registered threads
+void sample_threads();
+/// the registered threads, by tid
+std::vector<ThreadInfo> get_threads();
+/// the name and tid thread registered with; false if it isn't registered
+bool find_registered_thread(pthread_t thread, std::string *name, pid_t *tid);
+/// moves on whenever a thread registers or unregisters, so that what was
+/// looked up with find_registered_thread() can be cached until it does
+uint64_t get_thread_registry_generation();
+
 class Thread {
  private:
   pthread_t thread_id;
   pid_t pid;
-  int cpuid;
+  ThreadPlacement placement;  ///< if empty, by thread_name
   const char *thread_name;
+  bool huge_stack = false;    ///< madvise the stack once running
 
   void *entry_wrapper();
 
@@ -56,11 +140,19 @@ class Thread {
   bool is_started() const;
   bool am_self() const;
   int kill(int signal);
+  /// with stacksize 0, the thread_stack policy for the name lays out the
+  /// stack
   int try_create(size_t stacksize);
   void create(const char *name, size_t stacksize = 0);
   int join(void **prval = 0);
   int detach();
+  /// in the child of a fork(), which has only the thread that forked:
+  /// forget the parent's thread, so that it is neither taken for running
+  /// nor joined, and create() may start one anew
+  void forget_after_fork();
   int set_affinity(int cpuid);
+  /// run and allocate as p has it, rather than as the policy for the name
+  int set_placement(const ThreadPlacement& p);
 };
 
 // Functions for with std::thread
@@ -76,8 +168,10 @@ std::thread make_named_thread(std::string_view n,
 
   return std::thread([n = std::string(n)](auto&& fun, auto&& ...args) {
 		       ceph_pthread_setname(pthread_self(), n.data());
+		       register_thread(n.data());
 		       std::invoke(std::forward<Fun>(fun),
 				   std::forward<Args>(args)...);
+		       unregister_thread();
 		     }, std::forward<Fun>(fun), std::forward<Args>(args)...);
 }
 #endif
@@ -11,6 +11,7 @@
  * Foundation.  See file COPYING.
  *
  */
+#include <fcntl.h>
 #include <poll.h>
 #include <sys/un.h>
 
@@ -95,9 +96,13 @@ AdminSocket::~AdminSocket()
 }
 
 /*
- * This thread listens on the UNIX domain socket for incoming connections.
- * It only handles one connection at a time at the moment. All I/O is nonblocking,
- * so that we can implement sensible timeouts. [TODO: make all I/O nonblocking]
+ * This thread listens on the UNIX domain socket for incoming connections,
+ * and on the connections that are waiting for their next request, and
+ * queues each one that has something to read for the admin_socket_threads
+ * workers, which read the requests, run them and write the replies. A
+ * client that is too slow to send a request or take its reply is dropped
+ * after admin_socket_timeout, and one that sends nothing more after
+ * admin_socket_idle_timeout.
  *
  * This thread also listens to m_shutdown_rd_fd. If there is any data sent to this
  * pipe, the thread terminates itself gracefully, allowing the
@@ -218,16 +223,43 @@ std::string AdminSocket::bind_and_listen(const std::string &sock_path, int *fd)
 void AdminSocket::entry() noexcept
 {
   ldout(m_cct, 5) << "entry start" << dendl;
+  // connections that are open but have no request pending
+  std::vector<std::unique_ptr<connection>> idle;
+  std::vector<struct pollfd> fds;
   while (true) {
-    struct pollfd fds[2];
+    {
+      std::scoped_lock l(work_lock);
+      for (auto& c : work_done) {
+	idle.push_back(std::move(c));
+      }
+      work_done.clear();
+    }
+
+    fds.resize(3 + idle.size());
     // FIPS zeroization audit 20191115: this memset is fine.
-    memset(fds, 0, sizeof(fds));
+    memset(fds.data(), 0, sizeof(fds[0]) * fds.size());
     fds[0].fd = m_sock_fd;
     fds[0].events = POLLIN | POLLRDBAND;
     fds[1].fd = m_shutdown_rd_fd;
     fds[1].events = POLLIN | POLLRDBAND;
+    fds[2].fd = m_wake_rd_fd;
+    fds[2].events = POLLIN;
+    int timeout = -1;
+    const auto now = ceph::coarse_mono_clock::now();
+    for (size_t i = 0; i < idle.size(); ++i) {
+      fds[3 + i].fd = idle[i]->fd;
+      fds[3 + i].events = POLLIN;
+      if (m_idle_timeout > 0) {
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+	  idle[i]->idle_since + std::chrono::seconds(m_idle_timeout) - now);
+	int ms = std::max<int>(left.count(), 0);
+	if (timeout < 0 || ms < timeout) {
+	  timeout = ms;
+	}
+      }
+    }
 
-    int ret = poll(fds, 2, -1);
+    int ret = poll(fds.data(), fds.size(), timeout);
     if (ret < 0) {
       int err = errno;
       if (err == EINTR) {
@@ -238,13 +270,32 @@ void AdminSocket::entry() noexcept
       return;
     }
 
+    if (fds[1].revents & POLLIN) {
+      // Parent wants us to shut down
+      return;
+    }
+    if (fds[2].revents & POLLIN) {
+      char buf[64];
+      while (::read(m_wake_rd_fd, buf, sizeof(buf)) > 0) ;
+    }
     if (fds[0].revents & POLLIN) {
       // Send out some data
       do_accept();
     }
-    if (fds[1].revents & POLLIN) {
-      // Parent wants us to shut down
-      return;
+    const auto expired = ceph::coarse_mono_clock::now() -
+      std::chrono::seconds(m_idle_timeout);
+    for (size_t i = idle.size(); i-- > 0; ) {
+      if (fds[3 + i].revents) {
+	// a request, or the client going away
+	queue_connection(std::move(idle[i]));
+      } else if (m_idle_timeout > 0 && idle[i]->idle_since <= expired) {
+	ldout(m_cct, 20) << "AdminSocket: closing idle connection" << dendl;
+	idle[i].reset();
+      } else {
+	continue;
+      }
+      idle[i] = std::move(idle.back());
+      idle.pop_back();
     }
   }
   ldout(m_cct, 5) << "entry exit" << dendl;
@@ -274,6 +325,47 @@ void AdminSocket::chmod(mode_t mode)
   }
 }
 
+bool AdminSocketStream::flush(bufferlist& bl)
+{
+  if (!m_streaming) {
+    m_gathered.claim_append(bl);
+    return true;
+  }
+  if (m_error == 0 && bl.length()) {
+    // an empty chunk would end the reply
+    m_error = send_chunk(bl);
+  }
+  bl.clear();
+  return m_error == 0;
+}
+
+/// the length and the data in one write
+int AdminSocketStream::send_chunk(bufferlist& bl)
+{
+  uint32_t len = htonl(bl.length());
+  bufferlist chunk;
+  chunk.append(reinterpret_cast<const char*>(&len), sizeof(len));
+  chunk.claim_append(bl);
+  return chunk.write_fd(m_fd);
+}
+
+int AdminSocketStream::finish()
+{
+  if (!m_streaming) {
+    return send_chunk(m_gathered);
+  }
+  if (m_error < 0) {
+    return m_error;
+  }
+  bufferlist end;
+  return send_chunk(end);
+}
+
+AdminSocket::connection::~connection()
+{
+  retry_sys_call(::close, fd);
+}
+
 bool AdminSocket::do_accept()
 {
   struct sockaddr_un address;
@@ -289,77 +381,221 @@ bool AdminSocket::do_accept()
   }
   ldout(m_cct, 30) << "AdminSocket: finished accept" << dendl;
 
-  char cmd[1024];
-  unsigned pos = 0;
-  string c;
-  while (1) {
-    int ret = safe_read(connection_fd, &cmd[pos], 1);
-    if (ret <= 0) {
-      if (ret < 0) {
-        lderr(m_cct) << "AdminSocket: error reading request code: "
-		     << cpp_strerror(ret) << dendl;
-      }
-      retry_sys_call(::close, connection_fd);
+  if (m_timeout > 0) {
+    struct timeval tv = { m_timeout, 0 };
+    if (::setsockopt(connection_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+	::setsockopt(connection_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
+      int err = errno;
+      lderr(m_cct) << "AdminSocket: failed to set timeout: "
+		   << cpp_strerror(err) << dendl;
+    }
+  }
+  queue_connection(std::make_unique<connection>(connection_fd));
+  return true;
+}
+
+void AdminSocket::queue_connection(std::unique_ptr<connection> c)
+{
+  std::unique_lock l(work_lock);
+  if (work_stop) {
+    return;
+  }
+  work_queue.push_back(std::move(c));
+  l.unlock();
+  work_cond.notify_one();
+}
+
+void AdminSocket::worker() noexcept
+{
+  std::unique_lock l(work_lock);
+  while (true) {
+    work_cond.wait(l, [this] { return work_stop || !work_queue.empty(); });
+    if (work_stop) {
+      return;
+    }
+    auto c = std::move(work_queue.front());
+    work_queue.pop_front();
+    l.unlock();
+    if (!handle_connection(*c)) {
+      c.reset();
+      l.lock();
+      continue;
+    }
+    // hand it back to entry() to wait for the next request
+    c->idle_since = ceph::coarse_mono_clock::now();
+    l.lock();
+    work_done.push_back(std::move(c));
+    l.unlock();
+    char b = 0;
+    if (::write(m_wake_wr_fd, &b, 1) < 0 && errno != EAGAIN) {
+      int err = errno;
+      lderr(m_cct) << "AdminSocket: error waking listener: "
+		   << cpp_strerror(err) << dendl;
+    }
+    l.lock();
+  }
+}
+
+void AdminSocket::stop_workers()
+{
+  {
+    std::scoped_lock l(work_lock);
+    work_stop = true;
+  }
+  work_cond.notify_all();
+  for (auto& t : workers) {
+    t.join();
+  }
+  workers.clear();
+  work_queue.clear();
+  work_done.clear();
+}
+
+/// take the next complete request off the front of c.buf, if there is one
+bool AdminSocket::next_request(connection& c, std::string *cmd)
+{
+  if (c.after_json && !c.buf.empty()) {
+    // the terminator a client sent after a request we ended at its brace
+    if (c.buf[0] == '\n' || c.buf[0] == '\0') {
+      c.buf.erase(0, 1);
+    }
+    c.after_json = false;
+  }
+  if (c.buf.empty()) {
+    return false;
+  }
+  if (c.buf[0] == '\0') {
+    // old protocol: __be32
+    if (c.buf.size() < 4) {
       return false;
     }
-    if (cmd[0] == '\0') {
-      // old protocol: __be32
-      if (pos == 3 && cmd[0] == '\0') {
-	switch (cmd[3]) {
-	case 0:
-	  c = "0";
-	  break;
-	case 1:
-	  c = "perfcounters_dump";
-	  break;
-	case 2:
-	  c = "perfcounters_schema";
-	  break;
-	default:
-	  c = "foo";
-	  break;
+    switch (c.buf[3]) {
+    case 0:
+      *cmd = "0";
+      break;
+    case 1:
+      *cmd = "perfcounters_dump";
+      break;
+    case 2:
+      *cmd = "perfcounters_schema";
+      break;
+    default:
+      *cmd = "foo";
+      break;
+    }
+    //wrap command with new protocol
+    *cmd = "{\"prefix\": \"" + *cmd + "\"}";
+    c.buf.erase(0, 4);
+    return true;
+  }
+  // new protocol: null or \n terminated string, or a JSON object that
+  // ends at its closing brace and may span lines
+  size_t end = std::string::npos;
+  bool json = false;
+  if (c.buf[0] == '{') {
+    int depth = 0;
+    bool in_string = false, escaped = false;
+    for (size_t i = 0; i < c.buf.size() && end == std::string::npos; ++i) {
+      const char ch = c.buf[i];
+      if (ch == '\0') {
+	end = i;
+      } else if (in_string) {
+	if (escaped) {
+	  escaped = false;
+	} else if (ch == '\\') {
+	  escaped = true;
+	} else if (ch == '"') {
+	  in_string = false;
 	}
-	//wrap command with new protocol
-	c = "{\"prefix\": \"" + c + "\"}";
-	break;
+      } else if (ch == '"') {
+	in_string = true;
+      } else if (ch == '{') {
+	++depth;
+      } else if (ch == '}' && --depth == 0) {
+	end = i + 1;
+	json = true;
       }
-    } else {
-      // new protocol: null or \n terminated string
-      if (cmd[pos] == '\n' || cmd[pos] == '\0') {
-	cmd[pos] = '\0';
-	c = cmd;
-	break;
+    }
+  } else {
+    end = c.buf.find_first_of("\n\0"sv);
+  }
+  if (end == std::string::npos) {
+    return false;
+  }
+  cmd->assign(c.buf, 0, end);
+  c.buf.erase(0, json ? end : end + 1);
+  c.after_json = json;
+  return true;
+}
+
+/*
+ * Run the requests a client has sent, several if it pipelines them, and
+ * reply to each.  Returns true if the connection should be kept open for
+ * more, false once it is closed or broken.
+ */
+bool AdminSocket::handle_connection(connection& c)
+{
+  bool got_data = false;
+  while (true) {
+    std::string cmd;
+    if (!next_request(c, &cmd)) {
+      if (got_data && c.buf.empty()) {
+	return true;
+      }
+      if (c.buf.size() >= MAX_REQUEST) {
+	lderr(m_cct) << "AdminSocket: error reading request too long" << dendl;
+	return false;
       }
+      char buf[4096];
+      ssize_t r;
+      do {
+	r = ::read(c.fd, buf, sizeof(buf));
+      } while (r < 0 && errno == EINTR);
+      if (r <= 0) {
+	if (r < 0) {
+	  int err = errno;
+	  lderr(m_cct) << "AdminSocket: error reading request code: "
+		       << cpp_strerror(err) << dendl;
+	}
+	return false;
+      }
+      c.buf.append(buf, r);
+      got_data = true;
+      continue;
     }
-    if (++pos >= sizeof(cmd)) {
-      lderr(m_cct) << "AdminSocket: error reading request too long" << dendl;
-      retry_sys_call(::close, connection_fd);
+    got_data = true;
+
+    bufferlist out;
+    AdminSocketStream s(c.fd);
+    if (!execute_command(cmd, out, s)) {
       return false;
     }
-  }
-
-  bool rval;
-  bufferlist out;
-  rval = execute_command(c, out);
-  if (rval) {
-    uint32_t len = htonl(out.length());
-    int ret = safe_write(connection_fd, &len, sizeof(len));
+    s.flush(out);
+    int ret = s.finish();
     if (ret < 0) {
-      lderr(m_cct) << "AdminSocket: error writing response length "
-          << cpp_strerror(ret) << dendl;
-      rval = false;
-    } else {
-      if (out.write_fd(connection_fd) >= 0)
-        rval = true;
+      lderr(m_cct) << "AdminSocket: error writing response "
+		   << cpp_strerror(ret) << dendl;
+      return false;
     }
   }
-
-  retry_sys_call(::close, connection_fd);
-  return rval;
 }
 
 int AdminSocket::execute_command(const std::string& cmd, ceph::bufferlist& out)
 {
+  AdminSocketStream s(-1);
+  if (!execute_command(cmd, out, s)) {
+    return false;
+  }
+  s.flush(out);
+  out.swap(s.m_gathered);
+  return true;
+}
+
+bool AdminSocket::execute_command(const std::string& cmd,
+				  ceph::bufferlist& out,
+				  AdminSocketStream& s)
+{
+  const auto start = ceph::mono_clock::now();
   cmdmap_t cmdmap;
   string format;
   vector<string> cmdvec;
@@ -373,6 +609,9 @@ int AdminSocket::execute_command(const std::string& cmd, ceph::bufferlist& out)
   try {
     cmd_getval(m_cct, cmdmap, "format", format);
     cmd_getval(m_cct, cmdmap, "prefix", match);
+    bool stream = false;
+    cmd_getval(m_cct, cmdmap, "stream", stream);
+    s.m_streaming = stream && s.m_fd >= 0;
   } catch (const bad_cmd_get& e) {
     return false;
   }
@@ -381,43 +620,47 @@ int AdminSocket::execute_command(const std::string& cmd, ceph::bufferlist& out)
     format = "json-pretty";
 
   std::unique_lock l(lock);
-  decltype(hooks)::iterator p;
-  while (match.size()) {
-    p = hooks.find(match);
-    if (p != hooks.cend())
-      break;
-
-    // drop right-most word
-    size_t pos = match.rfind(' ');
-    if (pos == std::string::npos) {
-      match.clear();  // we fail
-      break;
-    } else {
-      match.resize(pos);
-    }
-  }
-
-  if (p == hooks.cend()) {
+  auto found = find_command(match);
+  if (!found) {
     lderr(m_cct) << "AdminSocket: request '" << cmd << "' not defined" << dendl;
     return false;
   }
+  match.resize(found->first.size());
   string args;
   if (match != cmd) {
     args = cmd.substr(match.length() + 1);
   }
 
-  // Drop lock to avoid cycles in cases where the hook takes
-  // the same lock that was held during calls to register/unregister,
-  // and set in_hook to allow unregister to wait for us before
-  // removing this hook.
-  in_hook = true;
-  auto match_hook = p->second.hook;
-  l.unlock();
-  bool success = (validate(match, cmdmap, out) &&
-      match_hook->call(match, cmdmap, format, out));
-  l.lock();
-  in_hook = false;
-  in_hook_cond.notify_all();
+  // Wait for the hook to be free, unless it runs this command alongside
+  // others, then drop the lock to avoid cycles in cases where the hook
+  // takes the same lock that was held during calls to register/unregister.
+  // in_hook lets unregister wait for us before removing this hook.
+  auto match_hook = found->second.hook;
+  const bool exclusive = !(found->second.flags & FLAG_CONCURRENT);
+  in_hook_cond.wait(l, [&] {
+    auto c = in_hook.find(match_hook);
+    return c == in_hook.end() || (!exclusive && !c->second.exclusive);
+  });
+  // it may have been unregistered while we waited
+  auto p = hooks.find(match);
+  if (p == hooks.cend() || p->second.hook != match_hook) {
+    lderr(m_cct) << "AdminSocket: request '" << cmd << "' not defined" << dendl;
+    return false;
+  }
+  bool success = validate(p->second, cmdmap, out);
+  if (success) {
+    auto& calls = in_hook[match_hook];
+    ++calls.running;
+    calls.exclusive = exclusive;
+    l.unlock();
+    success = match_hook->call_stream(match, cmdmap, format, out, s);
+    l.lock();
+    if (auto c = in_hook.find(match_hook); --c->second.running == 0) {
+      in_hook.erase(c);
+    }
+    in_hook_cond.notify_all();
+    m_command_lat.record(ceph::mono_clock::now() - start);
+  }
   if (!success) {
     ldout(m_cct, 0) << "AdminSocket: request '" << match << "' args '" << args
         << "' to " << match_hook << " failed" << dendl;
@@ -432,12 +675,67 @@ int AdminSocket::execute_command(const std::string& cmd, ceph::bufferlist& out)
 
 
 
-bool AdminSocket::validate(const std::string& command,
+AdminSocket::hook_entry*
+AdminSocket::find_command(std::string_view prefix) const
+{
+  hook_entry *found = nullptr;
+  const command_node *n = &commands;
+  while (true) {
+    auto space = prefix.find(' ');
+    auto i = n->next.find(prefix.substr(0, space));
+    if (i == n->next.end()) {
+      break;
+    }
+    n = &i->second;
+    if (n->cmd) {
+      found = n->cmd;
+    }
+    if (space == prefix.npos) {
+      break;
+    }
+    prefix.remove_prefix(space + 1);
+  }
+  return found;
+}
+
+/// drop command from `commands`, and the nodes only it needed
+void AdminSocket::remove_command(std::string_view command)
+{
+  std::vector<std::pair<command_node*, decltype(command_node::next)::iterator>> path;
+  command_node *n = &commands;
+  while (true) {
+    auto space = command.find(' ');
+    auto i = n->next.find(command.substr(0, space));
+    if (i == n->next.end()) {
+      return;
+    }
+    path.emplace_back(n, i);
+    n = &i->second;
+    if (space == command.npos) {
+      break;
+    }
+    command.remove_prefix(space + 1);
+  }
+  n->cmd = nullptr;
+  for (auto j = path.rbegin(); j != path.rend(); ++j) {
+    auto& [parent, i] = *j;
+    if (i->second.cmd || !i->second.next.empty()) {
+      break;
+    }
+    parent->next.erase(i);
+  }
+}
+
+bool AdminSocket::validate(const hook_info& info,
 			   const cmdmap_t& cmdmap,
 			   bufferlist& out) const
 {
+  if (!info.has_args) {
+    // nothing in cmdmap that validate_cmd() would look at
+    return true;
+  }
   stringstream os;
-  if (validate_cmd(m_cct, hooks.at(command).desc, cmdmap, os)) {
+  if (validate_cmd(m_cct, info.desc, cmdmap, os)) {
     return true;
   } else {
     out.append(os);
@@ -448,7 +746,8 @@ bool AdminSocket::validate(const std::string& command,
 int AdminSocket::register_command(std::string_view command,
 				  std::string_view cmddesc,
 				  AdminSocketHook *hook,
-				  std::string_view help)
+				  std::string_view help,
+				  unsigned flags)
 {
   int ret;
   std::unique_lock l(lock);
@@ -460,10 +759,20 @@ int AdminSocket::register_command(std::string_view command,
   } else {
     ldout(m_cct, 5) << "register_command " << command << " hook " << hook
 		    << dendl;
-    hooks.emplace_hint(i,
-		       std::piecewise_construct,
-		       std::forward_as_tuple(command),
-		       std::forward_as_tuple(hook, cmddesc, help));
+    i = hooks.emplace_hint(i,
+			   std::piecewise_construct,
+			   std::forward_as_tuple(command),
+			   std::forward_as_tuple(hook, cmddesc, help, flags));
+    command_node *n = &commands;
+    for (std::string_view rest = command;; ) {
+      auto space = rest.find(' ');
+      n = &n->next[std::string(rest.substr(0, space))];
+      if (space == rest.npos) {
+	break;
+      }
+      rest.remove_prefix(space + 1);
+    }
+    n->cmd = &*i;
     ret = 0;
   }
   return ret;
@@ -480,11 +789,15 @@ int AdminSocket::unregister_command(std::string_view command)
     // If we are currently processing a command, wait for it to
     // complete in case it referenced the hook that we are
     // unregistering.
-    in_hook_cond.wait(l, [this]() { return !in_hook; });
-
-    hooks.erase(i);
-
-
+    const AdminSocketHook *hook = i->second.hook;
+    in_hook_cond.wait(l, [this, hook]() { return !in_hook.count(hook); });
+
+    // the wait dropped the lock
+    i = hooks.find(command);
+    if (i != hooks.cend()) {
+      remove_command(command);
+      hooks.erase(i);
+    }
     ret = 0;
   } else {
     ldout(m_cct, 5) << "unregister_command " << command << " ENOENT" << dendl;
@@ -496,15 +809,15 @@ int AdminSocket::unregister_command(std::string_view command)
 void AdminSocket::unregister_commands(const AdminSocketHook *hook)
 {
   std::unique_lock l(lock);
+  // If we are currently processing a command, wait for it to
+  // complete in case it referenced the hook that we are
+  // unregistering.
+  in_hook_cond.wait(l, [this, hook]() { return !in_hook.count(hook); });
   auto i = hooks.begin();
   while (i != hooks.end()) {
     if (i->second.hook == hook) {
       ldout(m_cct, 5) << __func__ << " " << i->first << dendl;
-
-      // If we are currently processing a command, wait for it to
-      // complete in case it referenced the hook that we are
-      // unregistering.
-      in_hook_cond.wait(l, [this]() { return !in_hook; });
+      remove_command(i->first);
       hooks.erase(i++);
     } else {
       i++;
@@ -611,18 +924,42 @@ bool AdminSocket::init(const std::string& path)
     close(pipe_wr);
     return false;
   }
+  int wake_rd = -1, wake_wr = -1;
+  err = create_shutdown_pipe(&wake_rd, &wake_wr);
+  if (err.empty() &&
+      (fcntl(wake_rd, F_SETFL, O_NONBLOCK) < 0 ||
+       fcntl(wake_wr, F_SETFL, O_NONBLOCK) < 0)) {
+    err = cpp_strerror(errno);
+    close(wake_rd);
+    close(wake_wr);
+  }
+  if (!err.empty()) {
+    lderr(m_cct) << "AdminSocketConfigObs::init: error: " << err << dendl;
+    close(pipe_rd);
+    close(pipe_wr);
+    close(sock_fd);
+    retry_sys_call(::unlink, path.c_str());
+    return false;
+  }
 
   /* Create new thread */
   m_sock_fd = sock_fd;
   m_shutdown_rd_fd = pipe_rd;
   m_shutdown_wr_fd = pipe_wr;
+  m_wake_rd_fd = wake_rd;
+  m_wake_wr_fd = wake_wr;
   m_path = path;
+  m_timeout = m_cct->_conf.get_val<std::chrono::seconds>(
+    "admin_socket_timeout").count();
+  m_idle_timeout = m_cct->_conf.get_val<std::chrono::seconds>(
+    "admin_socket_idle_timeout").count();
 
   version_hook = std::make_unique<VersionHook>();
-  register_command("0", "0", version_hook.get(), "");
-  register_command("version", "version", version_hook.get(), "get ceph version");
+  register_command("0", "0", version_hook.get(), "", FLAG_CONCURRENT);
+  register_command("version", "version", version_hook.get(), "get ceph version",
+		   FLAG_CONCURRENT);
   register_command("git_version", "git_version", version_hook.get(),
-		   "get git sha1");
+		   "get git sha1", FLAG_CONCURRENT);
   help_hook = std::make_unique<HelpHook>(this);
   register_command("help", "help", help_hook.get(),
 		   "list available commands");
@@ -630,6 +967,12 @@ bool AdminSocket::init(const std::string& path)
   register_command("get_command_descriptions", "get_command_descriptions",
 		   getdescs_hook.get(), "list available commands");
 
+  work_stop = false;
+  const auto nworkers = m_cct->_conf.get_val<uint64_t>("admin_socket_threads");
+  for (uint64_t i = 0; i < nworkers; ++i) {
+    workers.push_back(make_named_thread("admin_socket_w",
+					&AdminSocket::worker, this));
+  }
   th = make_named_thread("admin_socket", &AdminSocket::entry, this);
   add_cleanup_file(m_path.c_str());
   return true;
@@ -651,6 +994,10 @@ void AdminSocket::shutdown()
   }
 
   retry_sys_call(::close, m_sock_fd);
+  stop_workers();
+  retry_sys_call(::close, m_wake_rd_fd);
+  retry_sys_call(::close, m_wake_wr_fd);
+  m_wake_rd_fd = m_wake_wr_fd = -1;
 
   unregister_commands(version_hook.get());
   version_hook.reset();
@@ -16,13 +16,19 @@
 #define CEPH_COMMON_ADMIN_SOCKET_H
 
 #include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <vector>
 
 #include "include/buffer.h"
+#include "common/ceph_time.h"
 #include "common/cmdparse.h"
+#include "common/hdr_histogram.h"
 
 class AdminSocket;
 class CephContext;
@@ -31,10 +37,53 @@ using namespace std::literals;
 
 inline constexpr auto CEPH_ADMIN_SOCK_VERSION = "2"sv;
 
+/**
+ * where a hook sends its reply
+ *
+ * A client that asks for a streamed reply ("stream": true) gets it as a
+ * series of chunks, each a __be32 length followed by that many bytes, and
+ * then a zero length chunk, so a hook can send what it has so far with
+ * flush() and not build the whole reply in memory.  Otherwise the pieces
+ * are gathered here and sent as one reply at the end, as usual.
+ */
+class AdminSocketStream {
+public:
+  AdminSocketStream(const AdminSocketStream&) = delete;
+  AdminSocketStream& operator=(const AdminSocketStream&) = delete;
+
+  /// send or gather what bl holds, leaving it empty; false if the client
+  /// is gone and the rest of the reply need not be built
+  bool flush(ceph::bufferlist& bl);
+
+  bool streaming() const {
+    return m_streaming;
+  }
+
+private:
+  friend class AdminSocket;
+
+  explicit AdminSocketStream(int fd) : m_fd(fd) {}
+  int send_chunk(ceph::bufferlist& bl);
+  /// end the reply
+  int finish();
+
+  const int m_fd;  ///< -1 if the reply is not sent to a client
+  bool m_streaming = false;
+  int m_error = 0;
+  ceph::bufferlist m_gathered;
+};
+
 class AdminSocketHook {
 public:
   virtual bool call(std::string_view command, const cmdmap_t& cmdmap,
 		    std::string_view format, bufferlist& out) = 0;
+  /// like call(), but may flush() parts of the reply to s as it goes;
+  /// what is left in out is sent after them
+  virtual bool call_stream(std::string_view command, const cmdmap_t& cmdmap,
+			   std::string_view format, bufferlist& out,
+			   AdminSocketStream& s) {
+    return call(command, cmdmap, format, out);
+  }
   virtual ~AdminSocketHook() {}
 };
 
@@ -49,6 +98,13 @@ public:
   AdminSocket(AdminSocket&&) = delete;
   AdminSocket& operator =(AdminSocket&&) = delete;
 
+  /// flags for register_command()
+  enum {
+    /// the hook may run this command while it runs others; otherwise a
+    /// hook runs one command at a time
+    FLAG_CONCURRENT = 1 << 0,
+  };
+
   /**
    * register an admin socket command
    *
@@ -65,13 +121,15 @@ public:
    * @param cmddesc command syntax descriptor
    * @param hook implementation
    * @param help help text.  if empty, command will not be included in 'help' output.
+   * @param flags FLAG_*
    *
    * @return 0 for success, -EEXIST if command already registered.
    */
   int register_command(std::string_view command,
 		       std::string_view cmddesc,
 		       AdminSocketHook *hook,
-		       std::string_view help);
+		       std::string_view help,
+		       unsigned flags = 0);
 
   /**
    * unregister an admin socket command.
@@ -96,6 +154,12 @@ public:
   void chmod(mode_t mode);
   int execute_command(const std::string& cmd, ceph::bufferlist& out);
 
+  /// how long the commands that were run took, waiting for a busy hook
+  /// included
+  const ceph::hdr_histogram& get_command_latency() const {
+    return m_command_lat;
+  }
+
 private:
 
   void shutdown();
@@ -104,20 +168,61 @@ private:
   std::string destroy_shutdown_pipe();
   std::string bind_and_listen(const std::string &sock_path, int *fd);
 
+  /// longest request we wait for the end of
+  static constexpr size_t MAX_REQUEST = 1024;
+
+  /// a client connection, which may send any number of requests
+  struct connection {
+    const int fd;
+    std::string buf;          ///< read but not handled yet
+    bool after_json = false;  ///< the last request ended at its '}'
+    ceph::coarse_mono_time idle_since;
+
+    explicit connection(int fd) : fd(fd) {}
+    connection(const connection&) = delete;
+    connection& operator=(const connection&) = delete;
+    ~connection();
+  };
+
   std::thread th;
   void entry() noexcept;
   bool do_accept();
-  bool validate(const std::string& command, const cmdmap_t& cmdmap, bufferlist& out) const;
+  bool next_request(connection& c, std::string *cmd);
+  bool handle_connection(connection& c);
+  bool execute_command(const std::string& cmd, ceph::bufferlist& out,
+		       AdminSocketStream& s);
+
+  // connections with a request to handle go to the workers, which hand
+  // them back through work_done to wait for the next one
+  std::vector<std::thread> workers;
+  std::mutex work_lock;
+  std::condition_variable work_cond;
+  std::deque<std::unique_ptr<connection>> work_queue;
+  std::vector<std::unique_ptr<connection>> work_done;
+  bool work_stop = false;
+  void queue_connection(std::unique_ptr<connection> c);
+  void worker() noexcept;
+  void stop_workers();
 
   CephContext *m_cct;
   std::string m_path;
   int m_sock_fd = -1;
   int m_shutdown_rd_fd = -1;
   int m_shutdown_wr_fd = -1;
+  int m_wake_rd_fd = -1;  ///< a worker handed back a connection
+  int m_wake_wr_fd = -1;
+  int m_timeout = 0;  ///< admin_socket_timeout, in seconds
+  int m_idle_timeout = 0;  ///< admin_socket_idle_timeout, in seconds
+  ceph::hdr_histogram m_command_lat;
 
-  bool in_hook = false;
+  /// calls in progress on one hook
+  struct hook_calls {
+    unsigned running = 0;
+    bool exclusive = false;  ///< one of them is not FLAG_CONCURRENT
+  };
+  std::map<const AdminSocketHook*, hook_calls> in_hook;
   std::condition_variable in_hook_cond;
-  std::mutex lock;  // protects `hooks`
+  std::mutex lock;  // protects `hooks` and `in_hook`
   std::unique_ptr<AdminSocketHook> version_hook;
   std::unique_ptr<AdminSocketHook> help_hook;
   std::unique_ptr<AdminSocketHook> getdescs_hook;
@@ -126,13 +231,29 @@ private:
     AdminSocketHook* hook;
     std::string desc;
     std::string help;
+    unsigned flags;
+    bool has_args;  ///< desc has arguments for validate() to check
 
     hook_info(AdminSocketHook* hook, std::string_view desc,
-	      std::string_view help)
-      : hook(hook), desc(desc), help(help) {}
+	      std::string_view help, unsigned flags)
+      : hook(hook), desc(desc), help(help), flags(flags),
+	has_args(desc.find('=') != desc.npos) {}
   };
 
   std::map<std::string, hook_info, std::less<>> hooks;
+  using hook_entry = decltype(hooks)::value_type;
+
+  /// `hooks` by word, to find the longest registered prefix of a command
+  struct command_node {
+    std::map<std::string, command_node, std::less<>> next;
+    hook_entry *cmd = nullptr;
+  };
+  command_node commands;
+  hook_entry *find_command(std::string_view prefix) const;
+  void remove_command(std::string_view command);
+
+  bool validate(const hook_info& info, const cmdmap_t& cmdmap,
+		bufferlist& out) const;
 
   friend class AdminSocketTest;
   friend class HelpHook;
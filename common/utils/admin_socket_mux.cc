@@ -0,0 +1,360 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "admin_socket_mux.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace ceph {
+
+admin_socket_mux::admin_socket_mux(std::chrono::milliseconds timeout)
+  : m_timeout(timeout),
+    m_epfd(::epoll_create1(EPOLL_CLOEXEC))
+{
+}
+
+admin_socket_mux::~admin_socket_mux()
+{
+  for (auto& [path, c] : m_conns) {
+    _disconnect(*c);
+  }
+  if (m_epfd >= 0) {
+    ::close(m_epfd);
+  }
+}
+
+void admin_socket_mux::send(const std::string& path, std::string request,
+			    callback_t cb, bool stream)
+{
+  auto& c = m_conns[path];
+  if (!c) {
+    c = std::make_unique<conn_t>();
+    c->path = path;
+  }
+  // the daemon takes a request up to a NUL, or to the brace closing a
+  // JSON object, after which it drops the NUL
+  request.push_back('\0');
+  c->queue.push_back(request_t{std::move(request), std::move(cb), stream});
+  ++m_pending;
+  m_ready.push_back(c.get());
+}
+
+std::size_t admin_socket_mux::connected() const
+{
+  return std::count_if(m_conns.begin(), m_conns.end(),
+		       [](const auto& p) { return p.second->fd >= 0; });
+}
+
+void admin_socket_mux::close(const std::string& path)
+{
+  auto p = m_conns.find(path);
+  if (p == m_conns.end()) {
+    return;
+  }
+  conn_t *c = p->second.get();
+  _disconnect(*c);
+  _fail_all(*c, -ECANCELED);
+  m_ready.erase(std::remove(m_ready.begin(), m_ready.end(), c),
+		m_ready.end());
+  m_conns.erase(p);
+}
+
+int admin_socket_mux::_connect(conn_t& c)
+{
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (c.path.size() >= sizeof(addr.sun_path)) {
+    return -ENAMETOOLONG;
+  }
+  memcpy(addr.sun_path, c.path.c_str(), c.path.size() + 1);
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -errno;
+  }
+  // a unix socket connects at once or not at all: EAGAIN if the backlog
+  // is full, ECONNREFUSED or ENOENT if the daemon is gone
+  if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    int r = -errno;
+    ::close(fd);
+    return r;
+  }
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.ptr = &c;
+  if (::epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    int r = -errno;
+    ::close(fd);
+    return r;
+  }
+  c.fd = fd;
+  c.events = EPOLLIN;
+  c.reused = false;
+  return 0;
+}
+
+void admin_socket_mux::_disconnect(conn_t& c)
+{
+  if (c.fd >= 0) {
+    // closing it takes it out of the epoll set
+    ::close(c.fd);
+    c.fd = -1;
+  }
+  c.events = 0;
+  c.busy = false;
+  c.in.clear();
+  c.reply.clear();
+}
+
+void admin_socket_mux::_start(conn_t& c, clock::time_point now)
+{
+  if (c.busy || c.queue.empty()) {
+    return;
+  }
+  if (c.fd < 0) {
+    if (int r = _connect(c); r < 0) {
+      _fail_all(c, r);
+      return;
+    }
+  }
+  c.busy = true;
+  c.sent = 0;
+  c.got_reply = false;
+  c.in.clear();
+  c.reply.clear();
+  c.deadline = now + m_timeout;
+  if (_write(c)) {
+    _update_events(c);
+  }
+}
+
+void admin_socket_mux::_start_ready(clock::time_point now)
+{
+  std::vector<conn_t*> ready;
+  ready.swap(m_ready);
+  for (auto c : ready) {
+    _start(*c, now);
+  }
+}
+
+/// send what is left of the request in flight, as far as the socket takes
+/// it; false if the connection broke
+bool admin_socket_mux::_write(conn_t& c)
+{
+  const std::string& data = c.queue.front().data;
+  while (c.sent < data.size()) {
+    ssize_t n = ::send(c.fd, data.data() + c.sent, data.size() - c.sent,
+		       MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      if (errno == EAGAIN) {
+	break;
+      }
+      _broken(c, -errno);
+      return false;
+    }
+    c.sent += n;
+  }
+  return true;
+}
+
+/// read what the daemon sent and finish the requests it completes; false
+/// if the connection broke
+bool admin_socket_mux::_read(conn_t& c)
+{
+  char buf[65536];
+  while (true) {
+    ssize_t n = ::read(c.fd, buf, sizeof(buf));
+    if (n == 0) {
+      _broken(c, -ECONNRESET);
+      return false;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      if (errno == EAGAIN) {
+	break;
+      }
+      _broken(c, -errno);
+      return false;
+    }
+    c.in.append(buf, n);
+    c.got_reply = true;
+    if ((std::size_t)n < sizeof(buf)) {
+      break;
+    }
+  }
+  // a reply is a __be32 length and that many bytes; a streamed one is a
+  // series of them ending with an empty one
+  std::size_t pos = 0;
+  while (c.busy && c.in.size() - pos >= sizeof(uint32_t)) {
+    uint32_t len;
+    memcpy(&len, c.in.data() + pos, sizeof(len));
+    len = ntohl(len);
+    if (c.in.size() - pos - sizeof(len) < len) {
+      break;
+    }
+    const char *payload = c.in.data() + pos + sizeof(len);
+    pos += sizeof(len) + len;
+    if (!c.queue.front().stream) {
+      _finish(c, 0, std::string(payload, len));
+    } else if (len == 0) {
+      _finish(c, 0, std::move(c.reply));
+      c.reply.clear();
+    } else {
+      c.reply.append(payload, len);
+    }
+  }
+  c.in.erase(0, pos);
+  if (!c.busy && !c.in.empty()) {
+    // nothing was asked for this
+    _disconnect(c);
+    m_ready.push_back(&c);
+    return false;
+  }
+  return true;
+}
+
+void admin_socket_mux::_update_events(conn_t& c)
+{
+  uint32_t events = EPOLLIN;
+  if (c.busy && c.sent < c.queue.front().data.size()) {
+    events |= EPOLLOUT;
+  }
+  if (events == c.events) {
+    return;
+  }
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = &c;
+  if (::epoll_ctl(m_epfd, EPOLL_CTL_MOD, c.fd, &ev) < 0) {
+    _broken(c, -errno);
+    return;
+  }
+  c.events = events;
+}
+
+void admin_socket_mux::_broken(conn_t& c, int r)
+{
+  const bool busy = c.busy;
+  // a daemon drops a connection that was idle too long without reading
+  // what came after; that request is safe to send again
+  const bool retry = busy && !c.got_reply && c.reused &&
+    !c.queue.front().retried;
+  _disconnect(c);
+  if (retry) {
+    c.queue.front().retried = true;
+  } else if (busy) {
+    c.busy = true;
+    _finish(c, r, {});
+  }
+  m_ready.push_back(&c);
+}
+
+void admin_socket_mux::_finish(conn_t& c, int r, std::string reply)
+{
+  m_done.push_back(done_t{std::move(c.queue.front().cb), r,
+			  std::move(reply)});
+  c.queue.pop_front();
+  --m_pending;
+  c.busy = false;
+  if (r == 0) {
+    c.reused = true;
+  }
+  m_ready.push_back(&c);
+}
+
+void admin_socket_mux::_fail_all(conn_t& c, int r)
+{
+  for (auto& q : c.queue) {
+    m_done.push_back(done_t{std::move(q.cb), r, {}});
+    --m_pending;
+  }
+  c.queue.clear();
+  c.busy = false;
+}
+
+int admin_socket_mux::poll(std::chrono::milliseconds timeout)
+{
+  if (m_epfd < 0) {
+    return -EBADF;
+  }
+  auto now = clock::now();
+  _start_ready(now);
+
+  auto until = now + timeout;
+  if (!m_done.empty()) {
+    // don't keep the ones that failed to start waiting
+    until = now;
+  }
+  for (auto& [path, c] : m_conns) {
+    if (c->busy) {
+      until = std::min(until, c->deadline);
+    }
+  }
+  const int ms = std::max<int64_t>(
+    0, std::chrono::ceil<std::chrono::milliseconds>(until - now).count());
+  struct epoll_event events[64];
+  int n = ::epoll_wait(m_epfd, events, std::size(events), ms);
+  if (n < 0) {
+    if (errno != EINTR) {
+      return -errno;
+    }
+    n = 0;
+  }
+  for (int i = 0; i < n; ++i) {
+    auto c = static_cast<conn_t*>(events[i].data.ptr);
+    if (c->fd < 0) {
+      continue;
+    }
+    if ((events[i].events & EPOLLOUT) && c->busy) {
+      if (!_write(*c)) {
+	continue;
+      }
+      _update_events(*c);
+    }
+    if (c->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+      _read(*c);
+    }
+  }
+
+  now = clock::now();
+  for (auto& [path, c] : m_conns) {
+    if (c->busy && c->deadline <= now) {
+      // what it sends now would be taken for the next reply
+      _disconnect(*c);
+      c->busy = true;
+      _finish(*c, -ETIMEDOUT, {});
+    }
+  }
+  _start_ready(now);
+
+  std::vector<done_t> done;
+  done.swap(m_done);
+  for (auto& d : done) {
+    d.cb(d.r, std::move(d.reply));
+  }
+  return m_pending;
+}
+
+int admin_socket_mux::run()
+{
+  int r;
+  do {
+    r = poll(m_timeout);
+  } while (r > 0);
+  return r;
+}
+
+}
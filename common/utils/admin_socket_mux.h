@@ -0,0 +1,144 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_ADMIN_SOCKET_MUX_H
+#define CEPH_COMMON_ADMIN_SOCKET_MUX_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ceph {
+
+/**
+ * a client of many admin sockets at once, from one thread
+ *
+ * For scraping every daemon on a host: a connection to each socket is made
+ * on its first request and kept, as the daemons keep it until
+ * admin_socket_idle_timeout, so a scrape costs a write and a read per
+ * daemon rather than a connect, and an exec of the CLI.  Requests to one
+ * socket are sent one after another, in order; those to different sockets
+ * are all in flight together, and poll() waits on all of them with one
+ * epoll_wait().
+ *
+ * A daemon that closed a connection while it was idle (or restarted) is
+ * reconnected to and the request sent again, once.  One that has not
+ * replied in time has that connection closed, since a late reply would be
+ * taken for the next one, and the requests after it are sent on a new one.
+ * Connecting to a unix socket does not wait, so a daemon whose backlog is
+ * full fails its requests with -EAGAIN rather than holding up the rest.
+ */
+class admin_socket_mux {
+public:
+  using clock = std::chrono::steady_clock;
+  /// called with 0 and the reply, or a negative error and nothing
+  using callback_t = std::function<void(int r, std::string reply)>;
+
+  /// how long a daemon has to reply to each request
+  explicit admin_socket_mux(std::chrono::milliseconds timeout =
+			      std::chrono::seconds(10));
+  admin_socket_mux(const admin_socket_mux&) = delete;
+  admin_socket_mux& operator=(const admin_socket_mux&) = delete;
+  ~admin_socket_mux();
+
+  /// false if the epoll instance could not be made
+  bool is_valid() const {
+    return m_epfd >= 0;
+  }
+
+  /**
+   * queue request for the socket at path
+   *
+   * request is a command as the daemon takes it, a JSON object such as
+   * {"prefix": "perf dump"} or a plain string.  With stream, it asked for
+   * a streamed reply ("stream": true), which is put back together before
+   * it is handed to cb.  cb is called from poll(), never from here, and may
+   * queue more requests.
+   */
+  void send(const std::string& path, std::string request, callback_t cb,
+	    bool stream = false);
+
+  /// send what is queued, wait up to timeout for replies and call back for
+  /// the requests that are done; returns how many are still outstanding,
+  /// or a negative error if epoll failed
+  int poll(std::chrono::milliseconds timeout);
+  /// poll() until every request has been answered or has failed
+  int run();
+
+  /// requests queued or in flight
+  std::size_t pending() const {
+    return m_pending;
+  }
+  /// sockets with a connection open
+  std::size_t connected() const;
+
+  /// close the connection to path, failing its requests with -ECANCELED;
+  /// for a daemon that is gone for good
+  void close(const std::string& path);
+
+private:
+  struct request_t {
+    std::string data;  ///< as sent, terminated
+    callback_t cb;
+    bool stream;
+    bool retried = false;
+  };
+  struct conn_t {
+    std::string path;
+    int fd = -1;
+    uint32_t events = 0;       ///< registered with epoll
+    bool reused = false;       ///< a request has been answered on it
+    std::deque<request_t> queue;  ///< front is in flight once sent
+    bool busy = false;         ///< front is sent, or being sent
+    std::size_t sent = 0;      ///< of front.data
+    std::string in;            ///< read, not yet part of a reply
+    std::string reply;         ///< the chunks of a streamed reply so far
+    bool got_reply = false;    ///< some of the reply to front has come
+    clock::time_point deadline;
+  };
+  struct done_t {
+    callback_t cb;
+    int r;
+    std::string reply;
+  };
+
+  int _connect(conn_t& c);
+  void _disconnect(conn_t& c);
+  void _start(conn_t& c, clock::time_point now);
+  void _start_ready(clock::time_point now);
+  bool _write(conn_t& c);
+  bool _read(conn_t& c);
+  void _update_events(conn_t& c);
+  /// the connection broke: retry the request in flight if it may be,
+  /// otherwise fail it
+  void _broken(conn_t& c, int r);
+  /// done with the request in flight
+  void _finish(conn_t& c, int r, std::string reply);
+  void _fail_all(conn_t& c, int r);
+
+  const std::chrono::milliseconds m_timeout;
+  int m_epfd = -1;
+  std::map<std::string, std::unique_ptr<conn_t>> m_conns;
+  std::vector<conn_t*> m_ready;  ///< with requests queued to start
+  std::vector<done_t> m_done;    ///< to call back, outside of the loop
+  std::size_t m_pending = 0;
+};
+
+}
+
+#endif
@@ -54,36 +54,23 @@ struct strict_str_convert {
 
 void string_to_vec(std::vector<std::string>& args, std::string argstr)
 {
-  istringstream iss(argstr);
-  while(iss) {
-    string sub;
-    iss >> sub;
-    if (sub == "") break;
-    args.push_back(sub);
+  // what operator>> takes for whitespace
+  for (std::string_view sub : ceph::split(argstr, " \t\n\v\f\r")) {
+    args.emplace_back(sub);
   }
 }
 
-std::pair<std::vector<const char*>, std::vector<const char*>>
-split_dashdash(const std::vector<const char*>& args) {
-  auto dashdash = std::find_if(args.begin(), args.end(),
-			       [](const char* arg) {
-				 return strcmp(arg, "--") == 0;
-			       });
-  std::vector<const char*> options{args.begin(), dashdash};
-  if (dashdash != args.end()) {
-    ++dashdash;
-  }
-  std::vector<const char*> arguments{dashdash, args.end()};
-  return {std::move(options), std::move(arguments)};
-}
-
 static std::mutex g_str_vec_lock;
-static vector<string> g_str_vec;
+// CEPH_ARGS, split in place: the tokens are NUL-terminated in one copy of
+// the variable and g_str_vec points into it
+static std::string g_str_arena;
+static std::vector<const char*> g_str_vec;
 
 void clear_g_str_vec()
 {
   g_str_vec_lock.lock();
   g_str_vec.clear();
+  g_str_arena.clear();
   g_str_vec_lock.unlock();
 }
 
@@ -92,38 +79,49 @@ void env_to_vec(std::vector<const char*>& args, const char *name)
   if (!name)
     name = "CEPH_ARGS";
 
-  auto [options, arguments] = split_dashdash(args);
-
   /*
    * We can only populate str_vec once. Other threads could hold pointers into
    * it, so clearing it out and replacing it is not currently safe.
    */
-  g_str_vec_lock.lock();
+  std::lock_guard l(g_str_vec_lock);
   if (g_str_vec.empty()) {
     char *p = getenv(name);
     if (!p) {
-      g_str_vec_lock.unlock();
       return;
     }
-    get_str_vec(p, " ", g_str_vec);
+    // never resized after this, so the pointers stay good
+    g_str_arena = p;
+    for (std::string_view arg : ceph::split(p, " ")) {
+      const size_t off = arg.data() - p;
+      g_str_arena[off + arg.size()] = '\0';
+      g_str_vec.push_back(g_str_arena.data() + off);
+    }
   }
-  g_str_vec_lock.unlock();
 
-  std::vector<const char*> env;
-  for (const auto& s : g_str_vec) {
-    env.push_back(s.c_str());
+  // the environment's options, then ours, and likewise the arguments
+  // after any "--"
+  auto is_dashdash = [](const char* arg) {
+    return strcmp(arg, "--") == 0;
+  };
+  const auto& env = g_str_vec;
+  auto dashdash = std::find_if(args.begin(), args.end(), is_dashdash);
+  auto env_dashdash = std::find_if(env.begin(), env.end(), is_dashdash);
+  std::vector<const char*> merged;
+  merged.reserve(env.size() + args.size() + 1);
+  merged.insert(merged.end(), env.begin(), env_dashdash);
+  merged.insert(merged.end(), args.begin(), dashdash);
+  if (env_dashdash != env.end()) {
+    ++env_dashdash;
   }
-  auto [env_options, env_arguments] = split_dashdash(env);
-
-  args.clear();
-  args.insert(args.end(), env_options.begin(), env_options.end());
-  args.insert(args.end(), options.begin(), options.end());
-  if (arguments.empty() && env_arguments.empty()) {
-    return;
+  if (dashdash != args.end()) {
+    ++dashdash;
+  }
+  if (env_dashdash != env.end() || dashdash != args.end()) {
+    merged.push_back("--");
+    merged.insert(merged.end(), env_dashdash, env.end());
+    merged.insert(merged.end(), dashdash, args.end());
   }
-  args.push_back("--");
-  args.insert(args.end(), env_arguments.begin(), env_arguments.end());
-  args.insert(args.end(), arguments.begin(), arguments.end());
+  args.swap(merged);
 }
 
 void argv_to_vec(int argc, const char **argv,
@@ -234,29 +232,106 @@ CephInitParameters::CephInitParameters(uint32_t module_type_)
   name.set(module_type, "admin");
 }
 
-static void dashes_to_underscores(const char *input, char *output)
+/// how much of arg is the option's name: up to an '=' for its value, which
+/// isn't looked for in the leading two characters
+static size_t arg_name_len(const char *arg)
 {
-  char c = 0;
-  char *o = output;
-  const char *i = input;
-  // first two characters are copied as-is
-  *o = *i++;
-  if (*o++ == '\0')
-    return;
-  *o = *i++;
-  if (*o++ == '\0')
-    return;
-  for (; ((c = *i)); ++i) {
-    if (c == '=') {
-      strcpy(o, i);
-      return;
+  size_t n = 0;
+  while (n < 2 && arg[n])
+    ++n;
+  while (arg[n] && arg[n] != '=')
+    ++n;
+  return n;
+}
+
+/// copy the name's len characters to out with the dashes, past the leading
+/// two, turned into underscores, so --foo-bar and --foo_bar are the same
+static std::string_view normalize_arg(const char *arg, size_t len, char *out)
+{
+  for (size_t n = 0; n < len; ++n)
+    out[n] = (n >= 2 && arg[n] == '-') ? '_' : arg[n];
+  return std::string_view(out, len);
+}
+
+/// whether spelling, normalized as it is read, is the normalized name
+static bool arg_is(const char *spelling, std::string_view name)
+{
+  size_t n = 0;
+  for (; spelling[n]; ++n) {
+    char c = (n >= 2 && spelling[n] == '-') ? '_' : spelling[n];
+    if (n == name.size() || c != name[n])
+      return false;
+  }
+  return n == name.size();
+}
+
+ceph::arg_table::arg_table(std::initializer_list<spec> specs)
+{
+  for (const auto& s : specs) {
+    m_kinds.emplace(s.id, s.kind);
+    for (const char *a : s.names) {
+      auto& name = m_names.emplace_back(arg_name_len(a), '\0');
+      normalize_arg(a, name.size(), name.data());
+      m_ids.emplace(name, s.id);
+    }
+  }
+}
+
+int ceph::arg_table::find(const char *arg) const
+{
+  const size_t len = arg_name_len(arg);
+  char tmp[len + 1];
+  auto p = m_ids.find(normalize_arg(arg, len, tmp));
+  if (p == m_ids.end())
+    return NONE;
+  // a flag takes no value
+  if (arg[len] != '\0' && m_kinds.at(p->second) == FLAG)
+    return NONE;
+  return p->second;
+}
+
+ceph::arg_table::match ceph::arg_table::take(std::vector<const char*> &args,
+	std::vector<const char*>::iterator &i, int id, std::ostream &oss) const
+{
+  match m;
+  if (id == NONE)
+    return m;
+  m.id = id;
+  const char *arg = *i;
+  const size_t len = arg_name_len(arg);
+  const char *val = arg[len] == '=' ? arg + len + 1 : nullptr;
+  switch (m_kinds.at(id)) {
+  case FLAG:
+    i = args.erase(i);
+    break;
+  case BINARY_FLAG:
+    i = args.erase(i);
+    if (!val || (strcmp(val, "true") == 0) || (strcmp(val, "1") == 0)) {
+      m.val = "true";
+    } else if ((strcmp(val, "false") == 0) || (strcmp(val, "0") == 0)) {
+      m.val = "false";
+    } else {
+      oss << "Parse error parsing binary flag  " << std::string_view(arg, len)
+	  << ". Expected true or false, but got '" << val << "'\n";
+      m.r = -EINVAL;
+    }
+    break;
+  case WITHARG:
+    if (val) {
+      m.val = val;
+      i = args.erase(i);
+    } else if (i+1 == args.end()) {
+      oss << "Option " << arg << " requires an argument." << std::endl;
+      i = args.erase(i);
+      m.r = -EINVAL;
+    } else {
+      i = args.erase(i);
+      m.val = *i;
+      i = args.erase(i);
     }
-    if (c == '-')
-      *o++ = '_';
-    else
-      *o++ = c;
+    break;
   }
-  *o++ = '\0';
+  return m;
 }
 
 /** Once we see a standalone double dash, '--', we should remove it and stop
@@ -275,9 +350,12 @@ bool ceph_argparse_flag(std::vector<const char*> &args,
 	std::vector<const char*>::iterator &i, ...)
 {
   const char *first = *i;
-  char tmp[strlen(first)+1];
-  dashes_to_underscores(first, tmp);
-  first = tmp;
+  const size_t len = arg_name_len(first);
+  // a flag takes no value
+  if (first[len] != '\0')
+    return false;
+  char tmp[len+1];
+  std::string_view name = normalize_arg(first, len, tmp);
   va_list ap;
 
   va_start(ap, i);
@@ -287,9 +365,7 @@ bool ceph_argparse_flag(std::vector<const char*> &args,
       va_end(ap);
       return false;
     }
-    char a2[strlen(a)+1];
-    dashes_to_underscores(a, a2);
-    if (strcmp(a2, first) == 0) {
+    if (arg_is(a, name)) {
       i = args.erase(i);
       va_end(ap);
       return true;
@@ -302,22 +378,19 @@ static bool va_ceph_argparse_binary_flag(std::vector<const char*> &args,
 	std::ostream *oss, va_list ap)
 {
   const char *first = *i;
-  char tmp[strlen(first)+1];
-  dashes_to_underscores(first, tmp);
-  first = tmp;
+  const size_t len = arg_name_len(first);
+  char tmp[len+1];
+  std::string_view name = normalize_arg(first, len, tmp);
 
   // does this argument match any of the possibilities?
   while (1) {
     const char *a = va_arg(ap, char*);
     if (a == NULL)
       return false;
-    int strlen_a = strlen(a);
-    char a2[strlen_a+1];
-    dashes_to_underscores(a, a2);
-    if (strncmp(a2, first, strlen(a2)) == 0) {
-      if (first[strlen_a] == '=') {
+    if (arg_is(a, name)) {
+      if (first[len] == '=') {
 	i = args.erase(i);
-	const char *val = first + strlen_a + 1;
+	const char *val = first + len + 1;
 	if ((strcmp(val, "true") == 0) || (strcmp(val, "1") == 0)) {
 	  *ret = 1;
 	  return true;
@@ -333,7 +406,7 @@ static bool va_ceph_argparse_binary_flag(std::vector<const char*> &args,
 	*ret = -EINVAL;
 	return true;
       }
-      else if (first[strlen_a] == '\0') {
+      else {
 	i = args.erase(i);
 	*ret = 1;
 	return true;
@@ -359,25 +432,22 @@ static int va_ceph_argparse_witharg(std::vector<const char*> &args,
 	std::ostream &oss, va_list ap)
 {
   const char *first = *i;
-  char tmp[strlen(first)+1];
-  dashes_to_underscores(first, tmp);
-  first = tmp;
+  const size_t len = arg_name_len(first);
+  char tmp[len+1];
+  std::string_view name = normalize_arg(first, len, tmp);
 
   // does this argument match any of the possibilities?
   while (1) {
     const char *a = va_arg(ap, char*);
     if (a == NULL)
       return 0;
-    int strlen_a = strlen(a);
-    char a2[strlen_a+1];
-    dashes_to_underscores(a, a2);
-    if (strncmp(a2, first, strlen(a2)) == 0) {
-      if (first[strlen_a] == '=') {
-	*ret = first + strlen_a + 1;
+    if (arg_is(a, name)) {
+      if (first[len] == '=') {
+	*ret = first + len + 1;
 	i = args.erase(i);
 	return 1;
       }
-      else if (first[strlen_a] == '\0') {
+      else {
 	// find second part (or not)
 	if (i+1 == args.end()) {
 	  oss << "Option " << *i << " requires an argument." << std::endl;
@@ -473,8 +543,20 @@ CephInitParameters ceph_argparse_early_args
 	  (std::vector<const char*>& args, uint32_t module_type,
 	   std::string *cluster, std::string *conf_file_list)
 {
+  enum {
+    EARLY_VERSION, EARLY_CONF, EARLY_CLUSTER, EARLY_I, EARLY_ID, EARLY_NAME,
+    EARLY_SHOW_ARGS,
+  };
+  static const ceph::arg_table early_args{
+    {EARLY_VERSION, ceph::arg_table::FLAG, {"--version", "-v"}},
+    {EARLY_CONF, ceph::arg_table::WITHARG, {"--conf", "-c"}},
+    {EARLY_CLUSTER, ceph::arg_table::WITHARG, {"--cluster"}},
+    {EARLY_I, ceph::arg_table::WITHARG, {"-i"}},
+    {EARLY_ID, ceph::arg_table::WITHARG, {"--id", "--user"}},
+    {EARLY_NAME, ceph::arg_table::WITHARG, {"--name", "-n"}},
+    {EARLY_SHOW_ARGS, ceph::arg_table::FLAG, {"--show_args"}},
+  };
   CephInitParameters iparams(module_type);
-  std::string val;
 
   vector<const char *> orig_args = args;
 
@@ -485,30 +567,36 @@ CephInitParameters ceph_argparse_early_args
        * argument parses will still need to see it. */
       break;
     }
-    else if (ceph_argparse_flag(args, i, "--version", "-v", (char*)NULL)) {
-      cout << pretty_version_to_str() << std::endl;
-      _exit(0);
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--conf", "-c", (char*)NULL)) {
-      *conf_file_list = val;
+    int id = early_args.find(*i);
+    if (id == EARLY_I && module_type == CEPH_ENTITY_TYPE_CLIENT) {
+      id = ceph::arg_table::NONE;
     }
-    else if (ceph_argparse_witharg(args, i, &val, "--cluster", (char*)NULL)) {
-      *cluster = val;
+    auto m = early_args.take(args, i, id, cerr);
+    if (m.r < 0) {
+      _exit(1);
     }
-    else if ((module_type != CEPH_ENTITY_TYPE_CLIENT) && (ceph_argparse_witharg(args, i, &val, "-i", (char*)NULL))) {
-      iparams.name.set_id(val);
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--id", "--user", (char*)NULL)) {
-      iparams.name.set_id(val);
-    }
-    else if (ceph_argparse_witharg(args, i, &val, "--name", "-n", (char*)NULL)) {
-      if (!iparams.name.from_str(val)) {
-	      cerr << "error parsing '" << val << "': expected string of the form TYPE.ID, "
+    switch (m.id) {
+    case EARLY_VERSION:
+      cout << pretty_version_to_str() << std::endl;
+      _exit(0);
+    case EARLY_CONF:
+      *conf_file_list = m.val;
+      break;
+    case EARLY_CLUSTER:
+      *cluster = m.val;
+      break;
+    case EARLY_I:
+    case EARLY_ID:
+      iparams.name.set_id(m.val);
+      break;
+    case EARLY_NAME:
+      if (!iparams.name.from_str(m.val)) {
+	      cerr << "error parsing '" << m.val << "': expected string of the form TYPE.ID, "
 	          << "valid types are: " << EntityName::get_valid_types_as_str() << std::endl;
 	      _exit(1);
       }
-    }
-    else if (ceph_argparse_flag(args, i, "--show_args", (char*)NULL)) {
+      break;
+    case EARLY_SHOW_ARGS:
       cout << "args: ";
       for (std::vector<const char *>::iterator ci = orig_args.begin(); ci != orig_args.end(); ++ci) {
         if (ci != orig_args.begin())
@@ -516,8 +604,8 @@ CephInitParameters ceph_argparse_early_args
         cout << *ci;
       }
       cout << std::endl;
-    }
-    else {
+      break;
+    default:
       // ignore
       ++i;
     }
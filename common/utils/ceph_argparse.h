@@ -23,7 +23,12 @@
  * stuff to live.
  */
 
+#include <deque>
+#include <initializer_list>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "common/entity_name.h"
@@ -39,6 +44,71 @@ public:
   EntityName name;
 };
 
+namespace ceph {
+
+/* The options a parser knows, declared once and matched with one hash
+ * lookup per argv entry rather than a string compare per spelling:
+ *
+ *   enum { ARG_CONF, ARG_CLUSTER };
+ *   static const ceph::arg_table table{
+ *     {ARG_CONF, ceph::arg_table::WITHARG, {"--conf", "-c"}},
+ *     {ARG_CLUSTER, ceph::arg_table::WITHARG, {"--cluster"}},
+ *   };
+ *   for (auto i = args.begin(); i != args.end(); ) {
+ *     auto m = table.parse(args, i, cerr);
+ *     switch (m.id) {
+ *     case ARG_CONF: ...
+ *     default: ++i;
+ *     }
+ *   }
+ *
+ * Spellings match as they do for ceph_argparse_flag() and friends: '-'
+ * and '_' are the same after the leading two characters, and a value may
+ * follow an '=' or be the next entry.
+ */
+class arg_table {
+public:
+  enum kind_t {
+    FLAG,        ///< --foo
+    BINARY_FLAG, ///< --foo, --foo=true|false|1|0
+    WITHARG,     ///< --foo=bar, --foo bar
+  };
+  struct spec {
+    int id;
+    kind_t kind;
+    std::initializer_list<const char*> names;
+  };
+  static constexpr int NONE = -1;
+
+  struct match {
+    int id = NONE; ///< of the spec matched
+    int r = 0;     ///< -EINVAL if its value was missing or bad, said in oss
+    std::string val; ///< WITHARG: the value; BINARY_FLAG: "true" or "false"
+  };
+
+  explicit arg_table(std::initializer_list<spec> specs);
+
+  /// the id of the spec arg is a spelling of, or NONE
+  int find(const char *arg) const;
+  /// consume *i, which find() said is a spelling of spec id, and its value,
+  /// from args; NONE leaves them all be
+  match take(std::vector<const char*> &args,
+	     std::vector<const char*>::iterator &i, int id,
+	     std::ostream &oss) const;
+  match parse(std::vector<const char*> &args,
+	      std::vector<const char*>::iterator &i,
+	      std::ostream &oss) const {
+    return take(args, i, find(*i), oss);
+  }
+
+private:
+  std::deque<std::string> m_names; ///< normalized; m_ids' keys view them
+  std::unordered_map<std::string_view, int> m_ids;
+  std::unordered_map<int, kind_t> m_kinds;
+};
+
+}
+
 /////////////////////// Functions ///////////////////////
 extern void string_to_vec(std::vector<std::string>& args, std::string argstr);
 extern void clear_g_str_vec();
@@ -43,6 +43,20 @@ struct BackTrace;
 
 extern void register_assert_context(CephContext *cct);
 
+/*
+ * The failure functions are cold and never inlined, so the compiler moves
+ * the calls to them, and the argument set-up, out of line (to
+ * .text.unlikely) and an assertion costs its caller a compare and a
+ * not-taken branch.  _CEPH_ASSERT_LIKELY says which way it goes.
+ */
+#if defined(__GNUC__)
+# define _CEPH_ASSERT_COLD __attribute__ ((__cold__, __noinline__))
+# define _CEPH_ASSERT_LIKELY(expr) __builtin_expect(!!(expr), 1)
+#else
+# define _CEPH_ASSERT_COLD
+# define _CEPH_ASSERT_LIKELY(expr) (expr)
+#endif
+
 struct assert_data {
   const char *assertion;
   const char *file;
@@ -51,22 +65,25 @@ struct assert_data {
 };
 
 extern void __ceph_assert_fail(const char *assertion, const char *file, int line, const char *function)
-  __attribute__ ((__noreturn__));
+  __attribute__ ((__noreturn__)) _CEPH_ASSERT_COLD;
 extern void __ceph_assert_fail(const assert_data &ctx)
-  __attribute__ ((__noreturn__));
+  __attribute__ ((__noreturn__)) _CEPH_ASSERT_COLD;
 
 extern void __ceph_assertf_fail(const char *assertion, const char *file, int line, const char *function, const char* msg, ...)
-  __attribute__ ((__noreturn__));
-extern void __ceph_assert_warn(const char *assertion, const char *file, int line, const char *function);
+  __attribute__ ((__noreturn__)) _CEPH_ASSERT_COLD;
+extern void __ceph_assert_warn(const char *assertion, const char *file, int line, const char *function)
+  _CEPH_ASSERT_COLD;
 
-[[noreturn]] void __ceph_abort(const char *file, int line, const char *func, const std::string& msg);
+[[noreturn]] void __ceph_abort(const char *file, int line, const char *func, const std::string& msg)
+  _CEPH_ASSERT_COLD;
 
-[[noreturn]] void __ceph_abortf(const char *file, int line, const char *func, const char* msg, ...);
+[[noreturn]] void __ceph_abortf(const char *file, int line, const char *func, const char* msg, ...)
+  _CEPH_ASSERT_COLD;
 
 #define _CEPH_ASSERT_VOID_CAST static_cast<void>
 
 #define assert_warn(expr)							\
-  ((expr)								\
+  (_CEPH_ASSERT_LIKELY(expr)						\
    ? _CEPH_ASSERT_VOID_CAST (0)					\
    : __ceph_assert_warn (__STRING(expr), __FILE__, __LINE__, __CEPH_ASSERT_FUNCTION))
 
@@ -93,7 +110,7 @@ using namespace ceph;
 #ifdef __SANITIZE_ADDRESS__
 #define ceph_assert(expr)                           \
   do {                                              \
-    ((expr))                                        \
+    _CEPH_ASSERT_LIKELY(expr)                       \
     ? _CEPH_ASSERT_VOID_CAST (0)                    \
     : __ceph_assert_fail(__STRING(expr), __FILE__, __LINE__, __CEPH_ASSERT_FUNCTION); \
   } while (false)
@@ -101,7 +118,7 @@ using namespace ceph;
 #define ceph_assert(expr)							\
   do { static const ceph::assert_data assert_data_ctx = \
    {__STRING(expr), __FILE__, __LINE__, __CEPH_ASSERT_FUNCTION}; \
-   ((expr) \
+   (_CEPH_ASSERT_LIKELY(expr) \
    ? _CEPH_ASSERT_VOID_CAST (0) \
    : __ceph_assert_fail(assert_data_ctx)); } while(false)
 #endif
@@ -111,7 +128,7 @@ using namespace ceph;
 #ifdef __SANITIZE_ADDRESS__
 #define ceph_assert_always(expr)                    \
   do {                                              \
-    ((expr))                                        \
+    _CEPH_ASSERT_LIKELY(expr)                       \
     ? _CEPH_ASSERT_VOID_CAST (0)                    \
     : __ceph_assert_fail(__STRING(expr), __FILE__, __LINE__, __CEPH_ASSERT_FUNCTION); \
   } while(false)
@@ -119,26 +136,26 @@ using namespace ceph;
 #define ceph_assert_always(expr)							\
   do { static const ceph::assert_data assert_data_ctx = \
     {__STRING(expr), __FILE__, __LINE__, __CEPH_ASSERT_FUNCTION}; \
-      ((expr) ? _CEPH_ASSERT_VOID_CAST (0) : __ceph_assert_fail(assert_data_ctx)); \
+      (_CEPH_ASSERT_LIKELY(expr) ? _CEPH_ASSERT_VOID_CAST (0) : __ceph_assert_fail(assert_data_ctx)); \
   } while(false)
 #endif
 
 // Named by analogy with printf.  Along with an expression, takes a format
 // string and parameters which are printed if the assertion fails.
 #define assertf(expr, ...)                  \
-  ((expr)								\
+  (_CEPH_ASSERT_LIKELY(expr)						\
    ? _CEPH_ASSERT_VOID_CAST (0)					\
    : __ceph_assertf_fail (__STRING(expr), __FILE__, __LINE__, __CEPH_ASSERT_FUNCTION, __VA_ARGS__))
 
 #define ceph_assertf(expr, ...)                  \
-  ((expr)								\
+  (_CEPH_ASSERT_LIKELY(expr)						\
    ? _CEPH_ASSERT_VOID_CAST (0)					\
    : __ceph_assertf_fail (__STRING(expr), __FILE__, __LINE__, __CEPH_ASSERT_FUNCTION, __VA_ARGS__))
 
 // this variant will *never* get compiled out to NDEBUG in the future.
 // (ceph_assertf currently doesn't either, but in the future it might.)
 #define ceph_assertf_always(expr, ...)                  \
-  ((expr)								\
+  (_CEPH_ASSERT_LIKELY(expr)						\
    ? _CEPH_ASSERT_VOID_CAST (0)					\
    : __ceph_assertf_fail (__STRING(expr), __FILE__, __LINE__, __CEPH_ASSERT_FUNCTION, __VA_ARGS__))
 
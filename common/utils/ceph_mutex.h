@@ -10,6 +10,13 @@
 // The key requirement is that you make use of the ceph::make_mutex()
 // and make_recursive_mutex() factory methods, which take a string
 // naming the mutex for the purposes of the lockdep debug variant.
+// Building with CEPH_PROFILE_MUTEX instead keeps the release behaviour
+// but counts, by that name, how often and how long lock() waited.
+//
+// A mutex held only briefly and contended for on hot paths can be made
+// with ceph::make_adaptive_mutex() instead: in release builds it spins a
+// little before sleeping (see mutex_adaptive.h).  Wait on it with a
+// ceph::adaptive_condition_variable.
 //
 // For legacy Mutex users that passed recursive=true, use
 // ceph::make_recursive_mutex.  For legacy Mutex users that passed
@@ -30,6 +37,8 @@ namespace ceph {
   typedef ceph::mutex_recursive_debug recursive_mutex;
   typedef ceph::condition_variable_debug condition_variable;
   typedef ceph::shared_mutex_debug shared_mutex;
+  typedef ceph::mutex_debug adaptive_mutex;
+  typedef ceph::condition_variable_debug adaptive_condition_variable;
 
   // pass arguments to mutex_debug ctor
   template <typename ...Args>
@@ -37,6 +46,12 @@ namespace ceph {
     return {std::forward<Args>(args)...};
   }
 
+  // lockdep sees it as any other mutex
+  template <typename ...Args>
+  adaptive_mutex make_adaptive_mutex(Args&& ...args) {
+    return {std::forward<Args>(args)...};
+  }
+
   // pass arguments to recursive_mutex_debug ctor
   template <typename ...Args>
   recursive_mutex make_recursive_mutex(Args&& ...args) {
@@ -58,6 +73,57 @@ namespace ceph {
   #define ceph_mutex_is_not_locked_by_me(m) (!(m).is_locked_by_me())
 }
 
+#elif defined(CEPH_PROFILE_MUTEX)
+
+// ============================================================================
+// profiled (release, plus contention statistics by mutex name; see
+// get_mutex_contention() and the "mutex contention" admin command)
+// ============================================================================
+
+#include <shared_mutex>
+#include <string_view>
+
+#include "common/mutex_profiled.h"
+
+namespace ceph {
+
+  typedef ceph::mutex_profiled mutex;
+  typedef ceph::recursive_mutex_profiled recursive_mutex;
+  typedef ceph::condition_variable_profiled condition_variable;
+  typedef std::shared_mutex shared_mutex;
+  typedef ceph::mutex_profiled adaptive_mutex;
+  typedef ceph::condition_variable_profiled adaptive_condition_variable;
+
+  // the name is what contention is reported under; discard the rest
+  template <typename ...Args>
+  mutex make_mutex(std::string_view name, Args&& ...args) {
+    return {name};
+  }
+  // profiled as blocking, to show what would need it
+  template <typename ...Args>
+  adaptive_mutex make_adaptive_mutex(std::string_view name, Args&& ...args) {
+    return {name};
+  }
+  template <typename ...Args>
+  recursive_mutex make_recursive_mutex(std::string_view name,
+				       Args&& ...args) {
+    return {name};
+  }
+  template <typename ...Args>
+  std::shared_mutex make_shared_mutex(Args&& ...args) {
+    return {};
+  }
+
+  // as for release
+  #define ceph_mutex_is_locked(m) true
+  #define ceph_mutex_is_not_locked(m) true
+  #define ceph_mutex_is_rlocked(m) true
+  #define ceph_mutex_is_wlocked(m) true
+  #define ceph_mutex_is_locked_by_me(m) true
+  #define ceph_mutex_is_not_locked_by_me(m) true
+
+}
+
 #else
 
 // ============================================================================
@@ -68,6 +134,7 @@ namespace ceph {
 #include <mutex>
 #include <shared_mutex>
 
+#include "common/mutex_adaptive.h"
 
 namespace ceph {
 
@@ -75,6 +142,8 @@ namespace ceph {
   typedef std::recursive_mutex recursive_mutex;
   typedef std::condition_variable condition_variable;
   typedef std::shared_mutex shared_mutex;
+  typedef ceph::mutex_adaptive adaptive_mutex;
+  typedef ceph::condition_variable_adaptive adaptive_condition_variable;
 
   // discard arguments to make_mutex (they are for debugging only)
   template <typename ...Args>
@@ -82,6 +151,10 @@ namespace ceph {
     return {};
   }
   template <typename ...Args>
+  adaptive_mutex make_adaptive_mutex(Args&& ...args) {
+    return {};
+  }
+  template <typename ...Args>
   std::recursive_mutex make_recursive_mutex(Args&& ...args) {
     return {};
   }
@@ -102,4 +175,4 @@ namespace ceph {
 
 }
 
-#endif	// CEPH_DEBUG_MUTEX
+#endif	// CEPH_DEBUG_MUTEX / CEPH_PROFILE_MUTEX
@@ -17,6 +17,14 @@
 #include "log/LogClock.h"
 #include "config.h"
 #include "strtol.h"
+#include "include/compat.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <mutex>
+#include <system_error>
+#include <thread>
 
 #if defined(__APPLE__)
 #include <mach/mach.h>
@@ -85,6 +93,116 @@ namespace ceph {
       return time_point(seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec));
     }
 
+    coarse_page_t coarse_page;
+  }
+
+  /* The page holds the fine clocks rather than the coarse ones: they are
+   * never behind them, so turning the page on can't make coarse_mono_clock
+   * go back, and a page refreshed every millisecond is finer than the
+   * kernel's tick.  Turning it off waits for the kernel's coarse clock to
+   * pass the page before clearing it, for the same reason.
+   *
+   * The thread doesn't survive fork(), so the child goes back to the
+   * system's clocks; a daemon's child starts the page again with the rest
+   * of its threads (see global_init_postfork_start()).
+   */
+  namespace {
+    using time_detail::coarse_page;
+
+    std::mutex page_lock;
+    std::thread *page_thread = nullptr; // leaked by a child of fork()
+    std::atomic<bool> page_stopping{false};
+
+    uint64_t read_ns(clockid_t clock) {
+      struct timespec ts;
+      clock_gettime(clock, &ts);
+      return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    void page_refresh() {
+      coarse_page.real.store(read_ns(CLOCK_REALTIME),
+			     std::memory_order_relaxed);
+      coarse_page.mono.store(read_ns(CLOCK_MONOTONIC),
+			     std::memory_order_relaxed);
+    }
+
+    void page_run() {
+      struct timespec next;
+      clock_gettime(CLOCK_MONOTONIC, &next);
+      while (!page_stopping.load(std::memory_order_relaxed)) {
+	next.tv_nsec += 1000000;
+	if (next.tv_nsec >= 1000000000) {
+	  next.tv_nsec -= 1000000000;
+	  ++next.tv_sec;
+	}
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+	page_refresh();
+      }
+    }
+
+    /// async-signal-safe, for the child of fork()
+    void page_clear() {
+      const auto last = coarse_mono_clock::time_point(
+	timespan(coarse_page.mono.load(std::memory_order_relaxed)));
+      while (coarse_mono_clock::system_now() < last) {
+	struct timespec ts = {0, 100000};
+	nanosleep(&ts, nullptr);
+      }
+      coarse_page.real.store(0, std::memory_order_relaxed);
+      coarse_page.mono.store(0, std::memory_order_relaxed);
+    }
+
+    void page_prepare_fork() {
+      page_lock.lock();
+    }
+    void page_parent_fork() {
+      page_lock.unlock();
+    }
+    void page_child_fork() {
+      if (page_thread) {
+	page_thread = nullptr;
+	page_clear();
+      }
+      page_lock.unlock();
+    }
+  }
+
+  int start_coarse_clock_page() {
+    static std::once_flag atfork;
+    std::call_once(atfork, [] {
+      pthread_atfork(page_prepare_fork, page_parent_fork, page_child_fork);
+    });
+    std::lock_guard l{page_lock};
+    if (page_thread) {
+      return 0;
+    }
+    page_refresh();
+    page_stopping = false;
+    try {
+      page_thread = new std::thread(page_run);
+    } catch (const std::system_error& e) {
+      page_clear();
+      return -e.code().value();
+    }
+    ceph_pthread_setname(page_thread->native_handle(), "ceph_clock");
+    return 0;
+  }
+
+  void stop_coarse_clock_page() {
+    std::lock_guard l{page_lock};
+    if (!page_thread) {
+      return;
+    }
+    page_stopping = true;
+    page_thread->join();
+    delete page_thread;
+    page_thread = nullptr;
+    page_clear();
+  }
+
+  bool coarse_clock_page_running() {
+    std::lock_guard l{page_lock};
+    return page_thread != nullptr;
   }
 
   using std::chrono::duration_cast;
@@ -282,9 +400,9 @@ namespace ceph {
       if (val_start == pos) {
 	throw invalid_argument("expected digit");
       }
-      string n = s.substr(val_start, pos - val_start);
       string err;
-      auto val = strict_strtoll(n.c_str(), 10, &err);
+      auto val = strict_strtoll(
+	std::string_view(s).substr(val_start, pos - val_start), 10, &err);
       if (err.size()) {
 	throw invalid_argument(err);
       }
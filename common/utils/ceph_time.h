@@ -15,7 +15,9 @@
 #ifndef COMMON_CEPH_TIME_H
 #define COMMON_CEPH_TIME_H
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <sys/time.h>
@@ -154,6 +156,18 @@ namespace ceph {
       }
     };
 
+    /* What coarse_real_clock and coarse_mono_clock read, while it is on,
+     * in place of the system's coarse clocks: real_clock and mono_clock as
+     * of at most a millisecond ago, stored by a thread of its own (see
+     * start_coarse_clock_page()), so that reading one is a load rather
+     * than a clock_gettime().  0 while it is off.
+     */
+    struct alignas(64) coarse_page_t {
+      std::atomic<uint64_t> real{0};
+      std::atomic<uint64_t> mono{0};
+    };
+    extern coarse_page_t coarse_page;
+
     class coarse_real_clock {
     public:
       typedef timespan duration;
@@ -165,6 +179,21 @@ namespace ceph {
       static constexpr const bool is_steady = false;
 
       static time_point now() noexcept {
+	if (const uint64_t ns = coarse_page.real.load(std::memory_order_relaxed);
+	    ns) {
+	  return time_point(nanoseconds(ns));
+	}
+	const time_point t = system_now();
+	// had the page come on meanwhile, t may be ahead of what it says:
+	// what the next read will see is the page's
+	if (const uint64_t ns = coarse_page.real.load(std::memory_order_acquire);
+	    ns) {
+	  return time_point(nanoseconds(ns));
+	}
+	return t;
+      }
+      /// the system's coarse clock, whether or not the page is on
+      static time_point system_now() noexcept {
 	struct timespec ts;
 #if defined(CLOCK_REALTIME_COARSE)
 	// Linux systems have _COARSE clocks.
@@ -273,6 +302,21 @@ namespace ceph {
       static constexpr const bool is_steady = true;
 
       static time_point now() noexcept {
+	if (const uint64_t ns = coarse_page.mono.load(std::memory_order_relaxed);
+	    ns) {
+	  return time_point(nanoseconds(ns));
+	}
+	const time_point t = system_now();
+	// had the page come on meanwhile, t may be ahead of what it says:
+	// what the next read will see is the page's
+	if (const uint64_t ns = coarse_page.mono.load(std::memory_order_acquire);
+	    ns) {
+	  return time_point(nanoseconds(ns));
+	}
+	return t;
+      }
+      /// the system's coarse clock, whether or not the page is on
+      static time_point system_now() noexcept {
 	struct timespec ts;
 #if defined(CLOCK_MONOTONIC_COARSE)
 	// Linux systems have _COARSE clocks.
@@ -387,6 +431,16 @@ namespace ceph {
   typedef mono_clock::time_point mono_time;
   typedef coarse_mono_clock::time_point coarse_mono_time;
 
+  /// read the coarse clocks from a page a thread refreshes every
+  /// millisecond, rather than from the system; for the whole process, and
+  /// off again in a child of fork().  0, or -errno if the thread can't
+  /// start
+  int start_coarse_clock_page();
+  /// read the system's coarse clocks again, once coarse_mono_clock has
+  /// caught up with the page (a tick or so), so that it never goes back
+  void stop_coarse_clock_page();
+  bool coarse_clock_page_running();
+
   template<typename Rep1, typename Ratio1, typename Rep2, typename Ratio2>
   auto floor(const std::chrono::duration<Rep1, Ratio1>& duration,
 	     const std::chrono::duration<Rep2, Ratio2>& precision) ->
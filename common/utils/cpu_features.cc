@@ -0,0 +1,135 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "cpu_features.h"
+
+#include <stdlib.h>
+
+#include <string_view>
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+// from <asm/hwcap.h>, for older headers
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1 << 4)
+#endif
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1 << 22)
+#endif
+#ifndef HWCAP2_SVE2
+#define HWCAP2_SVE2 (1 << 1)
+#endif
+#endif
+
+namespace ceph {
+
+namespace {
+
+constexpr struct {
+  cpu_feature feature;
+  const char *name;
+} feature_names[] = {
+  {CPU_SSE42, "sse4.2"},
+  {CPU_PCLMUL, "pclmul"},
+  {CPU_AVX2, "avx2"},
+  {CPU_BMI2, "bmi2"},
+  {CPU_AVX512F, "avx512f"},
+  {CPU_AVX512BW, "avx512bw"},
+  {CPU_ARM_CRC32, "crc32"},
+  {CPU_ARM_PMULL, "pmull"},
+  {CPU_ARM_SVE, "sve"},
+  {CPU_ARM_SVE2, "sve2"},
+};
+
+uint64_t probe()
+{
+  uint64_t f = 0;
+#if defined(__GNUC__) && defined(__x86_64__)
+  // these check that the OS saves the wider registers too
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    f |= CPU_SSE42;
+  }
+  if (__builtin_cpu_supports("pclmul")) {
+    f |= CPU_PCLMUL;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    f |= CPU_AVX2;
+  }
+  if (__builtin_cpu_supports("bmi2")) {
+    f |= CPU_BMI2;
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    f |= CPU_AVX512F;
+  }
+  if (__builtin_cpu_supports("avx512bw")) {
+    f |= CPU_AVX512BW;
+  }
+#elif defined(__aarch64__) && defined(__linux__)
+  const unsigned long hwcap = getauxval(AT_HWCAP);
+  const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+  if (hwcap & HWCAP_CRC32) {
+    f |= CPU_ARM_CRC32;
+  }
+  if (hwcap & HWCAP_PMULL) {
+    f |= CPU_ARM_PMULL;
+  }
+  if (hwcap & HWCAP_SVE) {
+    f |= CPU_ARM_SVE;
+  }
+  if (hwcap2 & HWCAP2_SVE2) {
+    f |= CPU_ARM_SVE2;
+  }
+#endif
+  if (const char *disable = getenv("CEPH_CPU_DISABLE"); disable) {
+    std::string_view s(disable);
+    while (!s.empty()) {
+      auto comma = s.find(',');
+      std::string_view name = s.substr(0, comma);
+      s.remove_prefix(comma == s.npos ? s.size() : comma + 1);
+      for (const auto& [feature, n] : feature_names) {
+	if (name == n) {
+	  f &= ~uint64_t(feature);
+	}
+      }
+    }
+  }
+  return f;
+}
+
+}
+
+uint64_t cpu_features()
+{
+  static const uint64_t features = probe();
+  return features;
+}
+
+std::string cpu_features_str()
+{
+  std::string s;
+  const uint64_t f = cpu_features();
+  for (const auto& [feature, name] : feature_names) {
+    if (f & feature) {
+      if (!s.empty()) {
+	s += ',';
+      }
+      s += name;
+    }
+  }
+  return s;
+}
+
+}
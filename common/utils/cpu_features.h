@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_CPU_FEATURES_H
+#define CEPH_CPU_FEATURES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* What the host cpu can do, as opposed to what the build targeted, for
+ * kernels that carry variants for several instruction sets and pick one at
+ * run time.
+ *
+ * The features are probed once, on first use.  Any named in the
+ * CEPH_CPU_DISABLE environment variable (comma separated, as
+ * cpu_features_str() prints them) are left out, to exercise or benchmark
+ * the fallbacks on a host that doesn't need them.
+ */
+namespace ceph {
+
+enum cpu_feature : uint64_t {
+  // x86-64; sse2 is the baseline there
+  CPU_SSE42    = 1ull << 0,
+  CPU_PCLMUL   = 1ull << 1,
+  CPU_AVX2     = 1ull << 2,
+  CPU_BMI2     = 1ull << 3,
+  CPU_AVX512F  = 1ull << 4,
+  CPU_AVX512BW = 1ull << 5,
+  // aarch64; asimd (neon) is the baseline there
+  CPU_ARM_CRC32 = 1ull << 32,
+  CPU_ARM_PMULL = 1ull << 33,
+  CPU_ARM_SVE   = 1ull << 34,
+  CPU_ARM_SVE2  = 1ull << 35,
+};
+
+/// the features of the host, less those disabled by CEPH_CPU_DISABLE
+uint64_t cpu_features();
+
+/// whether the host has every feature in mask
+inline bool cpu_has(uint64_t mask) {
+  return (cpu_features() & mask) == mask;
+}
+
+/// the host's features as a comma separated list, e.g. "sse4.2,avx2"
+std::string cpu_features_str();
+
+/// one implementation of a kernel, and what it needs of the cpu
+template<typename Fn>
+struct cpu_variant {
+  const char *name;
+  uint64_t needs;  ///< cpu_feature mask, 0 for anything
+  Fn *fn;
+};
+
+/**
+ * the first of variants the host can run
+ *
+ * Listed best first; the last should require nothing.  Keep the table
+ * constexpr so that it is usable from other static initializers, and the
+ * result in a function local static so that the choice is made once:
+ *
+ *   static const auto& v = ceph::pick_cpu_variant(variants);
+ */
+template<typename Fn, std::size_t N>
+const cpu_variant<Fn>& pick_cpu_variant(const cpu_variant<Fn> (&variants)[N])
+{
+  static_assert(N > 0);
+  for (const auto& v : variants) {
+    if (cpu_has(v.needs)) {
+      return v;
+    }
+  }
+  return variants[N - 1];
+}
+
+}
+
+#endif
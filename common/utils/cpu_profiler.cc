@@ -0,0 +1,220 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "cpu_profiler.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ceph::cpu_profiler {
+
+namespace {
+
+/// frames of the handler and the signal trampoline, above the one the
+/// signal interrupted
+constexpr int HANDLER_FRAMES = 2;
+
+struct sample {
+  int depth;
+  void *pcs[MAX_FRAMES];
+};
+
+struct session {
+  explicit session(std::size_t n) : samples(new sample[n]), capacity(n) {}
+  std::unique_ptr<sample[]> samples;
+  const std::size_t capacity;
+  std::atomic<std::size_t> next{0};
+  std::atomic<uint64_t> dropped{0};
+};
+
+std::mutex profile_lock;  ///< one profile at a time
+std::atomic<session*> active{nullptr};
+std::atomic<int> in_handler{0};
+
+void handle_sigprof(int, siginfo_t*, void*)
+{
+  const int saved_errno = errno;
+  // counted before looking at active, so that once profile() has cleared
+  // it and seen no handler running, none is touching the session
+  in_handler.fetch_add(1);
+  if (session *s = active.load()) {
+    const std::size_t i = s->next.fetch_add(1, std::memory_order_relaxed);
+    if (i < s->capacity) {
+      s->samples[i].depth = backtrace(s->samples[i].pcs, MAX_FRAMES);
+    } else {
+      s->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  in_handler.fetch_sub(1);
+  errno = saved_errno;
+}
+
+/// install our handler for good; a late SIGPROF, after the timer is off,
+/// would kill the process with the default action
+int install_handler()
+{
+  static bool installed = false;
+  if (installed) {
+    return 0;
+  }
+  struct sigaction old;
+  if (::sigaction(SIGPROF, nullptr, &old) < 0) {
+    return -errno;
+  }
+  const bool has_handler = (old.sa_flags & SA_SIGINFO) ?
+    old.sa_sigaction != nullptr :
+    (old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN);
+  if (has_handler) {
+    return -EBUSY;
+  }
+  struct sigaction sa = {};
+  sa.sa_sigaction = handle_sigprof;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (::sigaction(SIGPROF, &sa, nullptr) < 0) {
+    return -errno;
+  }
+  installed = true;
+  return 0;
+}
+
+int set_timer(unsigned hz)
+{
+  struct itimerval t = {};
+  if (hz) {
+    t.it_interval.tv_usec = 1000000 / hz;
+    t.it_value = t.it_interval;
+  }
+  return ::setitimer(ITIMER_PROF, &t, nullptr) < 0 ? -errno : 0;
+}
+
+/// pc's function, demangled, else its module and offset
+std::string symbolize(void *pc)
+{
+  Dl_info info;
+  if (!::dladdr(pc, &info) || !info.dli_fname) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "[%p]", pc);
+    return buf;
+  }
+  std::string name;
+  if (info.dli_sname) {
+    int status;
+    char *d = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    name = status == 0 ? d : info.dli_sname;
+    free(d);
+  } else {
+    const char *module = strrchr(info.dli_fname, '/');
+    char buf[32];
+    snprintf(buf, sizeof(buf), "+0x%" PRIxPTR,
+	     (uintptr_t)pc - (uintptr_t)info.dli_fbase);
+    name = std::string("[") + (module ? module + 1 : info.dli_fname) + buf +
+      "]";
+  }
+  // ';' separates frames
+  for (auto& c : name) {
+    if (c == ';') {
+      c = ':';
+    }
+  }
+  return name;
+}
+
+void fold(const session& s, std::size_t n, std::string *folded)
+{
+  std::unordered_map<void*, std::string> names;
+  std::map<std::string, uint64_t> stacks;
+  std::string stack;
+  for (std::size_t i = 0; i < n; ++i) {
+    const sample& smp = s.samples[i];
+    stack.clear();
+    for (int f = smp.depth - 1; f >= HANDLER_FRAMES; --f) {
+      // a return address is past its call; the interrupted pc isn't
+      void *pc = smp.pcs[f];
+      if (f > HANDLER_FRAMES) {
+	pc = static_cast<char*>(pc) - 1;
+      }
+      auto [name, added] = names.try_emplace(pc);
+      if (added) {
+	name->second = symbolize(pc);
+      }
+      if (!stack.empty()) {
+	stack.push_back(';');
+      }
+      stack += name->second;
+    }
+    if (!stack.empty()) {
+      ++stacks[stack];
+    }
+  }
+  for (const auto& [stack, count] : stacks) {
+    *folded += stack;
+    *folded += ' ';
+    *folded += std::to_string(count);
+    *folded += '\n';
+  }
+}
+
+}
+
+int profile(std::chrono::milliseconds d, unsigned hz, std::string *folded,
+	    cpu_profile_stats *stats)
+{
+  if (hz == 0 || hz > MAX_HZ) {
+    return -EINVAL;
+  }
+  std::unique_lock l(profile_lock, std::try_to_lock);
+  if (!l.owns_lock()) {
+    return -EBUSY;
+  }
+  if (int r = install_handler(); r < 0) {
+    return r;
+  }
+  // the first backtrace() loads libgcc, which isn't safe in a handler
+  void *pcs[1];
+  (void)backtrace(pcs, 1);
+
+  // room for every CPU to be busy all of d, or MAX_SAMPLES
+  const uint64_t ticks = (uint64_t(d.count()) * hz + 999) / 1000;
+  const unsigned cpus = std::max(std::thread::hardware_concurrency(), 1u);
+  auto s = std::make_unique<session>(
+    std::clamp<uint64_t>(ticks * cpus, 1, MAX_SAMPLES));
+  active.store(s.get());
+  if (int r = set_timer(hz); r < 0) {
+    active.store(nullptr);
+    return r;
+  }
+  std::this_thread::sleep_for(d);
+  (void)set_timer(0);
+  active.store(nullptr);
+  while (in_handler.load() != 0) {
+    std::this_thread::yield();
+  }
+
+  const std::size_t n = std::min(s->next.load(), s->capacity);
+  fold(*s, n, folded);
+  if (stats) {
+    stats->samples = n;
+    stats->dropped = s->dropped.load();
+  }
+  return 0;
+}
+
+}
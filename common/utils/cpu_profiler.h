@@ -0,0 +1,62 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_CPU_PROFILER_H
+#define CEPH_COMMON_CPU_PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/* A sampling CPU profiler for hosts without perf, run from the admin
+ * socket ("profile cpu").
+ *
+ * For the length of a profile an ITIMER_PROF timer sends SIGPROF every
+ * 1/hz seconds of the process's CPU time, to whichever thread is using
+ * it, and the handler unwinds that thread's stack with backtrace() into a
+ * buffer allocated up front, big enough for every CPU to be busy all the
+ * while (up to MAX_SAMPLES); it takes no locks and allocates nothing.
+ * When the time is up the stacks are symbolized with dladdr(), so
+ * functions that aren't exported (in a binary not linked with -rdynamic,
+ * say) show as module+offset.
+ */
+namespace ceph {
+
+struct cpu_profile_stats {
+  uint64_t samples = 0;  ///< stacks in the profile
+  uint64_t dropped = 0;  ///< ticks after the buffer filled
+};
+
+namespace cpu_profiler {
+
+static constexpr unsigned MAX_FRAMES = 64;
+static constexpr std::size_t MAX_SAMPLES = 1 << 16;
+static constexpr unsigned MAX_HZ = 1000;
+
+/**
+ * profile the whole process for d, blocking until done
+ *
+ * Appends the stacks to folded as flamegraph.pl takes them, a line per
+ * distinct stack, outermost frame first:
+ *
+ *   main;OSD::tick;Log::flush 17
+ *
+ * @return 0, -EBUSY if a profile is already running or something else
+ * handles SIGPROF, -EINVAL for a bad hz, or -errno
+ */
+int profile(std::chrono::milliseconds d, unsigned hz, std::string *folded,
+	    cpu_profile_stats *stats = nullptr);
+
+}
+}
+
+#endif
@@ -0,0 +1,95 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "file_watcher.h"
+
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace ceph {
+
+file_watcher::~file_watcher()
+{
+  if (m_fd >= 0) {
+    ::close(m_fd);
+  }
+}
+
+int file_watcher::watch(const std::string& path)
+{
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_path = path;
+  const auto slash = path.rfind('/');
+  const std::string dir = slash == std::string::npos ? "." :
+    slash == 0 ? "/" : path.substr(0, slash);
+  m_name = slash == std::string::npos ? path : path.substr(slash + 1);
+  _stat_changed();
+
+  int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    // fall back to stat(), if the directory is there to look in
+    struct stat st;
+    return ::stat(dir.c_str(), &st) < 0 ? -errno : 0;
+  }
+  if (::inotify_add_watch(fd, dir.c_str(),
+			  IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO |
+			  IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+    int r = -errno;
+    ::close(fd);
+    return r;
+  }
+  m_fd = fd;
+  return 0;
+}
+
+bool file_watcher::changed()
+{
+  if (m_fd < 0) {
+    return _stat_changed();
+  }
+  bool hit = false;
+  alignas(struct inotify_event) char buf[4096];
+  while (true) {
+    ssize_t n = ::read(m_fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    for (char *p = buf; p < buf + n; ) {
+      auto *ev = reinterpret_cast<struct inotify_event*>(p);
+      if (ev->mask & IN_Q_OVERFLOW) {
+	hit = true;
+      } else if (ev->len && m_name == ev->name) {
+	hit = true;
+      }
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+  if (hit) {
+    _stat_changed();
+  }
+  return hit;
+}
+
+bool file_watcher::_stat_changed()
+{
+  struct stat st;
+  const bool exists = ::stat(m_path.c_str(), &st) == 0;
+  bool changed = exists != m_exists;
+  if (exists && m_exists) {
+    changed = st.st_ino != m_st.st_ino || st.st_dev != m_st.st_dev ||
+      st.st_size != m_st.st_size ||
+      st.st_mtim.tv_sec != m_st.st_mtim.tv_sec ||
+      st.st_mtim.tv_nsec != m_st.st_mtim.tv_nsec;
+  }
+  m_exists = exists;
+  if (exists) {
+    m_st = st;
+  }
+  return changed;
+}
+
+}
@@ -0,0 +1,63 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_FILE_WATCHER_H
+#define CEPH_COMMON_FILE_WATCHER_H
+
+#include <sys/stat.h>
+
+#include <string>
+
+namespace ceph {
+
+/**
+ * tells whether a file has changed since it was last asked, without
+ * blocking, so that something polling now and then can skip rereading it
+ *
+ * The file's directory is watched with inotify rather than the file, so
+ * that a file replaced by a rename, as editors and config management do,
+ * is seen, and so is one that is removed and comes back.  Where inotify
+ * can't be had, changed() compares the file's inode, size and mtime.
+ */
+class file_watcher {
+public:
+  file_watcher() = default;
+  file_watcher(const file_watcher&) = delete;
+  file_watcher& operator=(const file_watcher&) = delete;
+  ~file_watcher();
+
+  /// start watching path; negative error if its directory can't be
+  int watch(const std::string& path);
+
+  /// the file was written, replaced or removed since watch() or the last
+  /// call
+  bool changed();
+
+  /// inotify is watching, rather than stat()
+  bool is_notified() const {
+    return m_fd >= 0;
+  }
+
+private:
+  /// what stat() said last, for the fallback
+  bool _stat_changed();
+
+  std::string m_path;
+  std::string m_name;  ///< m_path's last component
+  int m_fd = -1;
+  struct stat m_st = {};
+  bool m_exists = false;
+};
+
+}
+
+#endif
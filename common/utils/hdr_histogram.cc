@@ -0,0 +1,83 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "hdr_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "common/Formatter.h"
+
+namespace ceph {
+
+void hdr_histogram::merge(const hdr_histogram& o)
+{
+  for (unsigned i = 0; i < BUCKETS; ++i) {
+    if (uint64_t n = o.get(i)) {
+      m_counts[i].fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+  m_count.fetch_add(o.count(), std::memory_order_relaxed);
+  m_sum.fetch_add(o.sum(), std::memory_order_relaxed);
+  const uint64_t omax = o.max();
+  uint64_t max = m_max.load(std::memory_order_relaxed);
+  while (omax > max &&
+	 !m_max.compare_exchange_weak(max, omax, std::memory_order_relaxed)) {
+  }
+}
+
+void hdr_histogram::reset()
+{
+  for (auto& c : m_counts) {
+    c.store(0, std::memory_order_relaxed);
+  }
+  m_count.store(0, std::memory_order_relaxed);
+  m_sum.store(0, std::memory_order_relaxed);
+  m_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t hdr_histogram::quantile(double q) const
+{
+  // the buckets, not count(), so that a record() in progress can't leave
+  // the rank past the last bucket
+  uint64_t total = 0;
+  for (auto& c : m_counts) {
+    total += c.load(std::memory_order_relaxed);
+  }
+  if (total == 0) {
+    return 0;
+  }
+  const uint64_t rank = std::clamp<uint64_t>(std::ceil(q * total), 1, total);
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < BUCKETS; ++i) {
+    seen += get(i);
+    if (seen >= rank) {
+      return std::min(highest_of(i), max());
+    }
+  }
+  return max();
+}
+
+void hdr_histogram::dump(Formatter *f) const
+{
+  f->dump_unsigned("count", count());
+  f->dump_unsigned("sum_ns", sum());
+  f->dump_unsigned("max_ns", max());
+  f->dump_unsigned("p50_ns", quantile(0.5));
+  f->dump_unsigned("p90_ns", quantile(0.9));
+  f->dump_unsigned("p99_ns", quantile(0.99));
+  f->dump_unsigned("p999_ns", quantile(0.999));
+  f->open_array_section("buckets");
+  for (unsigned i = 0; i < BUCKETS; ++i) {
+    if (uint64_t n = get(i)) {
+      f->open_array_section("bucket");
+      f->dump_unsigned("lowest", lowest_of(i));
+      f->dump_unsigned("highest", highest_of(i));
+      f->dump_unsigned("count", n);
+      f->close_section();
+    }
+  }
+  f->close_section();
+}
+
+}
@@ -0,0 +1,110 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace ceph {
+class Formatter;
+
+/* A high dynamic range histogram of latencies in nanoseconds.
+ *
+ * Buckets are log-linear: every power of two is split into SUB_BUCKETS
+ * equal buckets, so a value is known to within 1/SUB_BUCKETS of itself
+ * whether it is 100ns or 100s, in a fixed BUCKETS counters.  record() is
+ * a couple of relaxed atomic adds, so any number of threads may record
+ * into one histogram while another reads it; histograms, say one per
+ * thread or one from each of several processes' dump(), add up with
+ * merge() because they all share the same buckets.
+ */
+class hdr_histogram {
+public:
+  static constexpr unsigned SUB_BITS = 4;
+  static constexpr unsigned SUB_BUCKETS = 1u << SUB_BITS;
+  /// values of 2^MAX_BITS ns (about 39 hours) or more count in the last
+  /// bucket
+  static constexpr unsigned MAX_BITS = 47;
+  static constexpr unsigned BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+  hdr_histogram() {}
+  hdr_histogram(const hdr_histogram&) = delete;
+  hdr_histogram& operator=(const hdr_histogram&) = delete;
+
+  void record(uint64_t ns) {
+    m_counts[index_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (ns > max &&
+	   !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+  }
+  template<typename Rep, typename Period>
+  void record(std::chrono::duration<Rep, Period> d) {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d);
+    record(ns.count() > 0 ? uint64_t(ns.count()) : 0);
+  }
+
+  /// add o's values to ours
+  void merge(const hdr_histogram& o);
+  void reset();
+
+  uint64_t count() const {
+    return m_count.load(std::memory_order_relaxed);
+  }
+  uint64_t sum() const {
+    return m_sum.load(std::memory_order_relaxed);
+  }
+  uint64_t max() const {
+    return m_max.load(std::memory_order_relaxed);
+  }
+  uint64_t get(unsigned bucket) const {
+    return m_counts[bucket].load(std::memory_order_relaxed);
+  }
+  /// the highest value the bucket of the q'th quantile (0 < q <= 1) may
+  /// hold, but no more than max(); 0 if nothing was recorded
+  uint64_t quantile(double q) const;
+
+  /// count, sum, max and the usual percentiles, then every bucket that
+  /// isn't empty as [lowest, highest, count], which is enough to merge
+  /// histograms dumped by other processes
+  void dump(Formatter *f) const;
+
+  static unsigned index_of(uint64_t ns) {
+    if (ns < SUB_BUCKETS) {
+      return ns;
+    }
+    const unsigned msb = 63 - __builtin_clzll(ns);
+    if (msb >= MAX_BITS) {
+      return BUCKETS - 1;
+    }
+    const unsigned shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((ns >> shift) - SUB_BUCKETS);
+  }
+  static uint64_t lowest_of(unsigned bucket) {
+    if (bucket < SUB_BUCKETS) {
+      return bucket;
+    }
+    const unsigned shift = bucket / SUB_BUCKETS - 1;
+    return uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  }
+  static uint64_t highest_of(unsigned bucket) {
+    if (bucket < SUB_BUCKETS) {
+      return bucket;
+    }
+    const unsigned shift = bucket / SUB_BUCKETS - 1;
+    return lowest_of(bucket) + (uint64_t(1) << shift) - 1;
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, BUCKETS> m_counts{};
+  std::atomic<uint64_t> m_count{0};
+  std::atomic<uint64_t> m_sum{0};
+  std::atomic<uint64_t> m_max{0};
+};
+
+}
@@ -16,45 +16,58 @@
 
 #if defined(__GNUC__)
 
+namespace ceph::inline_memcpy_detail {
+
+/// l bytes, N <= l <= 2N, as N from the start and N up to the end; the two
+/// may overlap, which is cheaper than working out the remainder
+template<size_t N>
+static inline void copy_overlapping(char *dest, const char *src, size_t l)
+  __attribute__((always_inline));
+
+template<size_t N>
+void copy_overlapping(char *dest, const char *src, size_t l)
+{
+  __builtin_memcpy(dest, src, N);
+  __builtin_memcpy(dest + l - N, src + l - N, N);
+}
+
+}
+
 // optimize for the common case, which is very small copies
 static inline void *maybe_inline_memcpy(void *dest, const void *src, size_t l, size_t inline_len)
   __attribute__((always_inline));
 
 void *maybe_inline_memcpy(void *dest, const void *src, size_t l, size_t inline_len)
 {
+  using namespace ceph::inline_memcpy_detail;
   if (l > inline_len) {
     return memcpy(dest, src, l);
   }
-  switch (l) {
-  case 8:
-    return __builtin_memcpy(dest, src, 8);
-  case 4:
-    return __builtin_memcpy(dest, src, 4);
-  case 3:
-    return __builtin_memcpy(dest, src, 3);
-  case 2:
-    return __builtin_memcpy(dest, src, 2);
-  case 1:
-    return __builtin_memcpy(dest, src, 1);
-  default:
-    int cursor = 0;
-    while (l >= sizeof(uint64_t)) {
-      __builtin_memcpy((char*)dest + cursor, (char*)src + cursor,
-		       sizeof(uint64_t));
-      cursor += sizeof(uint64_t);
-      l -= sizeof(uint64_t);
+  char *d = static_cast<char*>(dest);
+  const char *s = static_cast<const char*>(src);
+  // by size class, each with a fixed size (so unaligned register or vector
+  // moves) pair covering it rather than loops over the remainder
+  if (l <= 16) {
+    if (l >= 8) {
+      copy_overlapping<8>(d, s, l);
+    } else if (l >= 4) {
+      copy_overlapping<4>(d, s, l);
+    } else if (l >= 2) {
+      copy_overlapping<2>(d, s, l);
+    } else if (l == 1) {
+      *d = *s;
     }
-    while (l >= sizeof(uint32_t)) {
-      __builtin_memcpy((char*)dest + cursor, (char*)src + cursor,
-		       sizeof(uint32_t));
-      cursor += sizeof(uint32_t);
-      l -= sizeof(uint32_t);
-    }
-    while (l > 0) {
-      *((char*)dest + cursor) = *((char*)src + cursor);
-      cursor++;
-      l--;
+  } else if (l <= 32) {
+    copy_overlapping<16>(d, s, l);
+  } else if (l <= 64) {
+    copy_overlapping<32>(d, s, l);
+  } else {
+    // only for an inline_len over 64
+    size_t cursor = 0;
+    for (; l - cursor > 32; cursor += 32) {
+      __builtin_memcpy(d + cursor, s + cursor, 32);
     }
+    __builtin_memcpy(d + l - 32, s + l - 32, 32);
   }
   return dest;
 }
@@ -73,76 +86,44 @@ typedef unsigned uint128_t __attribute__ ((mode (TI)));
 }
 using ceph::uint128_t;
 
-static inline bool mem_is_zero(const char *data, size_t len)
-  __attribute__((always_inline));
-
-bool mem_is_zero(const char *data, size_t len)
-{
-  // we do have XMM registers in x86-64, so if we need to check at least
-  // 16 bytes, make use of them
-  if (len / sizeof(uint128_t) > 0) {
-    // align data pointer to 16 bytes, otherwise it'll segfault due to bug
-    // in (at least some) GCC versions (using MOVAPS instead of MOVUPS).
-    // check up to 15 first bytes while at it.
-    while (((unsigned long long)data) & 15) {
-      if (*(uint8_t*)data != 0) {
-	return false;
-      }
-      data += sizeof(uint8_t);
-      --len;
-    }
-
-    const char* data_start = data;
-    const char* max128 = data + (len / sizeof(uint128_t))*sizeof(uint128_t);
-
-    while (data < max128) {
-      if (*(uint128_t*)data != 0) {
-	return false;
-      }
-      data += sizeof(uint128_t);
-    }
-    len -= (data - data_start);
-  }
+#endif
 
-  const char* max = data + len;
-  const char* max32 = data + (len / sizeof(uint32_t))*sizeof(uint32_t);
-  while (data < max32) {
-    if (*(uint32_t*)data != 0) {
-      return false;
-    }
-    data += sizeof(uint32_t);
-  }
-  while (data < max) {
-    if (*(uint8_t*)data != 0) {
-      return false;
-    }
-    data += sizeof(uint8_t);
-  }
-  return true;
+namespace ceph {
+/// mem_is_zero() for 64 bytes or more, with the widest vector loads the cpu
+/// has; see mem_is_zero.cc
+bool mem_is_zero_vector(const char *data, size_t len);
+/// which of those it uses, e.g. "avx2"
+const char *mem_is_zero_vector_name();
+/// the first occurrence of needle (n bytes) in [hay, hay + len), or
+/// nullptr; vectorized for scanning mostly non-matching text, see
+/// mem_find.cc
+const char *mem_find(const char *hay, size_t len, const char *needle,
+		     size_t n);
+/// which variant mem_find() uses, e.g. "avx2"
+const char *mem_find_name();
 }
 
-#else  // gcc and x86_64
-
-static inline bool mem_is_zero(const char *data, size_t len) {
-  const char *end = data + len;
-  const char* end64 = data + (len / sizeof(uint64_t))*sizeof(uint64_t);
-
-  while (data < end64) {
-    if (*(uint64_t*)data != 0) {
-      return false;
-    }
-    data += sizeof(uint64_t);
+static inline bool mem_is_zero(const char *data, size_t len)
+{
+  if (len >= 64) {
+    return ceph::mem_is_zero_vector(data, len);
   }
-
-  while (data < end) {
-    if (*data != 0) {
-      return false;
+  // unaligned loads are fine everywhere this runs; the last one may overlap
+  // the one before it rather than going byte by byte
+  if (len >= sizeof(uint64_t)) {
+    uint64_t acc = 0, v;
+    for (size_t i = 0; i + sizeof(v) <= len; i += sizeof(v)) {
+      memcpy(&v, data + i, sizeof(v));
+      acc |= v;
     }
-    ++data;
+    memcpy(&v, data + len - sizeof(v), sizeof(v));
+    return (acc | v) == 0;
   }
-  return true;
+  uint8_t acc = 0;
+  for (size_t i = 0; i < len; ++i) {
+    acc |= data[i];
+  }
+  return acc == 0;
 }
 
-#endif  // !x86_64
-
 #endif
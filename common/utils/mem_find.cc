@@ -0,0 +1,173 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common/cpu_features.h"
+#include "common/inline_memory.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* Substring search for log scanning, where most of the haystack doesn't
+ * match.  Each step compares a vector of positions against the needle's
+ * first byte and, at the needle's length less one further on, its last
+ * byte; only positions where both agree are compared in full.  Text rarely
+ * has both at the right distance, so this runs at close to load bandwidth
+ * for needles of two bytes or more.  Whatever is left over at the end,
+ * under a vector's worth, goes to memmem().  The callers handle needles of
+ * less than two bytes.
+ */
+
+namespace {
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+const char *find_sse2(const char *hay, size_t len, const char *needle,
+		      size_t n)
+{
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[n - 1]);
+  auto load = [](const char *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  };
+  size_t i = 0;
+  for (; i + n - 1 + 16 <= len; i += 16) {
+    unsigned mask = _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(load(hay + i), first),
+		    _mm_cmpeq_epi8(load(hay + i + n - 1), last)));
+    while (mask) {
+      const unsigned bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, n - 2) == 0) {
+	return hay + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return static_cast<const char*>(memmem(hay + i, len - i, needle, n));
+}
+
+__attribute__((target("avx2"), always_inline))
+inline __m256i load256(const char *p)
+{
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+__attribute__((target("avx2")))
+const char *find_avx2(const char *hay, size_t len, const char *needle,
+		      size_t n)
+{
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[n - 1]);
+  size_t i = 0;
+  for (; i + n - 1 + 32 <= len; i += 32) {
+    uint32_t mask = _mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpeq_epi8(load256(hay + i), first),
+		       _mm256_cmpeq_epi8(load256(hay + i + n - 1), last)));
+    while (mask) {
+      const unsigned bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, n - 2) == 0) {
+	return hay + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return static_cast<const char*>(memmem(hay + i, len - i, needle, n));
+}
+
+#elif defined(__aarch64__)
+
+const char *find_neon(const char *hay, size_t len, const char *needle,
+		      size_t n)
+{
+  const uint8x16_t first = vdupq_n_u8(needle[0]);
+  const uint8x16_t last = vdupq_n_u8(needle[n - 1]);
+  auto load = [](const char *p) {
+    return vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+  };
+  size_t i = 0;
+  for (; i + n - 1 + 16 <= len; i += 16) {
+    const uint8x16_t eq = vandq_u8(vceqq_u8(load(hay + i), first),
+				   vceqq_u8(load(hay + i + n - 1), last));
+    // narrow to four bits per position; there is no movemask
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+      vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    while (mask) {
+      const unsigned bit = __builtin_ctzll(mask) / 4;
+      if (memcmp(hay + i + bit + 1, needle + 1, n - 2) == 0) {
+	return hay + i + bit;
+      }
+      mask &= ~(0xfull << (bit * 4));
+    }
+  }
+  return static_cast<const char*>(memmem(hay + i, len - i, needle, n));
+}
+
+#else
+
+const char *find_generic(const char *hay, size_t len, const char *needle,
+			 size_t n)
+{
+  return static_cast<const char*>(memmem(hay, len, needle, n));
+}
+
+#endif
+
+using variant = ceph::cpu_variant<const char *(const char *hay, size_t len,
+					       const char *needle, size_t n)>;
+
+constexpr variant variants[] = {
+#if defined(__GNUC__) && defined(__x86_64__)
+  {"avx2", ceph::CPU_AVX2, find_avx2},
+  {"sse2", 0, find_sse2},
+#elif defined(__aarch64__)
+  {"neon", 0, find_neon},
+#else
+  {"generic", 0, find_generic},
+#endif
+};
+
+const variant& chosen()
+{
+  static const variant& v = ceph::pick_cpu_variant(variants);
+  return v;
+}
+
+}
+
+namespace ceph {
+
+const char *mem_find(const char *hay, size_t len, const char *needle,
+		     size_t n)
+{
+  if (n > len) {
+    return nullptr;
+  }
+  if (n == 0) {
+    return hay;
+  }
+  if (n == 1) {
+    return static_cast<const char*>(memchr(hay, needle[0], len));
+  }
+  return chosen().fn(hay, len, needle, n);
+}
+
+const char *mem_find_name()
+{
+  return chosen().name;
+}
+
+}
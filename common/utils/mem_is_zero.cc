@@ -0,0 +1,194 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common/cpu_features.h"
+#include "common/inline_memory.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* Zero detection over large buffers is bound by memory bandwidth, so each
+ * variant keeps several loads in flight per iteration and ORs them
+ * together, testing once per iteration.  All loads are unaligned, with no
+ * byte loop to reach an alignment first; the last partial vector is covered
+ * by a load ending at the end of the buffer, overlapping what was already
+ * checked.  Callers guarantee at least 64 bytes.
+ */
+
+namespace {
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+bool is_zero_sse2(const char *data, size_t len)
+{
+  const char *end = data + len;
+  const __m128i zero = _mm_setzero_si128();
+  auto load = [](const char *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  };
+  auto is_zero = [&](__m128i v) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) == 0xffff;
+  };
+  for (; end - data >= 64; data += 64) {
+    __m128i v = _mm_or_si128(_mm_or_si128(load(data), load(data + 16)),
+			     _mm_or_si128(load(data + 32), load(data + 48)));
+    if (!is_zero(v)) {
+      return false;
+    }
+  }
+  __m128i v = _mm_or_si128(_mm_or_si128(load(end - 64), load(end - 48)),
+			   _mm_or_si128(load(end - 32), load(end - 16)));
+  return is_zero(v);
+}
+
+__attribute__((target("avx2"), always_inline))
+inline __m256i load256(const char *p)
+{
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+__attribute__((target("avx2")))
+bool is_zero_avx2(const char *data, size_t len)
+{
+  const char *end = data + len;
+  auto load = load256;
+  for (; end - data >= 128; data += 128) {
+    __m256i v = _mm256_or_si256(
+      _mm256_or_si256(load(data), load(data + 32)),
+      _mm256_or_si256(load(data + 64), load(data + 96)));
+    if (!_mm256_testz_si256(v, v)) {
+      return false;
+    }
+  }
+  // under 128 bytes left, but at least 64 were there to begin with
+  for (; end - data >= 32; data += 32) {
+    __m256i v = load(data);
+    if (!_mm256_testz_si256(v, v)) {
+      return false;
+    }
+  }
+  __m256i v = load(end - 32);
+  return _mm256_testz_si256(v, v);
+}
+
+__attribute__((target("avx512f"), always_inline))
+inline __m512i load512(const char *p)
+{
+  return _mm512_loadu_si512(p);
+}
+
+__attribute__((target("avx512f")))
+bool is_zero_avx512(const char *data, size_t len)
+{
+  const char *end = data + len;
+  auto load = load512;
+  for (; end - data >= 256; data += 256) {
+    __m512i v = _mm512_or_si512(
+      _mm512_or_si512(load(data), load(data + 64)),
+      _mm512_or_si512(load(data + 128), load(data + 192)));
+    if (_mm512_test_epi64_mask(v, v)) {
+      return false;
+    }
+  }
+  for (; end - data >= 64; data += 64) {
+    __m512i v = load(data);
+    if (_mm512_test_epi64_mask(v, v)) {
+      return false;
+    }
+  }
+  __m512i v = load(end - 64);
+  return _mm512_test_epi64_mask(v, v) == 0;
+}
+
+#elif defined(__aarch64__)
+
+bool is_zero_neon(const char *data, size_t len)
+{
+  const char *end = data + len;
+  auto load = [](const char *p) {
+    return vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+  };
+  auto is_zero = [](uint8x16_t v) {
+    return vmaxvq_u32(vreinterpretq_u32_u8(v)) == 0;
+  };
+  for (; end - data >= 64; data += 64) {
+    uint8x16_t v = vorrq_u8(vorrq_u8(load(data), load(data + 16)),
+			    vorrq_u8(load(data + 32), load(data + 48)));
+    if (!is_zero(v)) {
+      return false;
+    }
+  }
+  uint8x16_t v = vorrq_u8(vorrq_u8(load(end - 64), load(end - 48)),
+			  vorrq_u8(load(end - 32), load(end - 16)));
+  return is_zero(v);
+}
+
+#else
+
+bool is_zero_generic(const char *data, size_t len)
+{
+  const char *end = data + len;
+  uint64_t v[4];
+  for (; end - data >= 32; data += 32) {
+    memcpy(v, data, sizeof(v));
+    if (v[0] | v[1] | v[2] | v[3]) {
+      return false;
+    }
+  }
+  memcpy(v, end - 32, sizeof(v));
+  return (v[0] | v[1] | v[2] | v[3]) == 0;
+}
+
+#endif
+
+using variant = ceph::cpu_variant<bool (const char *data, size_t len)>;
+
+constexpr variant variants[] = {
+#if defined(__GNUC__) && defined(__x86_64__)
+  {"avx512", ceph::CPU_AVX512F, is_zero_avx512},
+  {"avx2", ceph::CPU_AVX2, is_zero_avx2},
+  {"sse2", 0, is_zero_sse2},
+#elif defined(__aarch64__)
+  {"neon", 0, is_zero_neon},
+#else
+  {"generic", 0, is_zero_generic},
+#endif
+};
+
+/// picked on first use, which may come from another static initializer
+const variant& chosen()
+{
+  static const variant& v = ceph::pick_cpu_variant(variants);
+  return v;
+}
+
+}
+
+namespace ceph {
+
+bool mem_is_zero_vector(const char *data, size_t len)
+{
+  return chosen().fn(data, len);
+}
+
+const char *mem_is_zero_vector_name()
+{
+  return chosen().name;
+}
+
+}
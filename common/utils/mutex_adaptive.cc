@@ -0,0 +1,120 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "mutex_adaptive.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace ceph {
+
+namespace {
+
+/// in pauses, a few microseconds
+constexpr int32_t MAX_SPINS = 2000;
+/// pauses between looks at the lock word, so as not to bounce its line
+constexpr int32_t MAX_BACKOFF = 32;
+
+void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#else
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+bool smp()
+{
+  static const bool smp = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+  return smp;
+}
+
+long futex_wait(std::atomic<uint32_t> *word, uint32_t val,
+		const timespec *timeout = nullptr)
+{
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word),
+		 FUTEX_WAIT_PRIVATE, val, timeout, nullptr, 0);
+}
+
+void futex_wake(std::atomic<uint32_t> *word, int32_t n)
+{
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word),
+	  FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+
+}
+
+void mutex_adaptive::lock_slow()
+{
+  if (smp()) {
+    const int32_t spins = m_spins.load(std::memory_order_relaxed);
+    const int32_t limit = std::min(MAX_SPINS, spins * 2 + 10);
+    int32_t spent = 0;
+    for (int32_t backoff = 1; spent < limit;
+	 backoff = std::min(backoff * 2, MAX_BACKOFF)) {
+      for (int32_t i = 0; i < backoff; ++i) {
+	cpu_relax();
+      }
+      spent += backoff;
+      if (m_state.load(std::memory_order_relaxed) == UNLOCKED && try_lock()) {
+	// toward what it took, and at most double next time
+	m_spins.store(spins + (spent - spins) / 8, std::memory_order_relaxed);
+	return;
+      }
+    }
+    // held for longer than is worth spinning: spin less
+    m_spins.store(spins - spins / 8, std::memory_order_relaxed);
+  }
+  // whoever unlocks from here on has to wake somebody
+  while (m_state.exchange(PARKED, std::memory_order_acquire) != UNLOCKED) {
+    futex_wait(&m_state, PARKED);
+  }
+}
+
+void mutex_adaptive::wake()
+{
+  futex_wake(&m_state, 1);
+}
+
+void condition_variable_adaptive::wait_ns(lock_type& l, int64_t ns)
+{
+  // counted, and the sequence read, before the lock is given up: a
+  // notify after that either sees the waiter or changes the sequence
+  m_waiters.fetch_add(1);
+  const uint32_t seq = m_seq.load();
+  l.unlock();
+  if (ns < 0) {
+    futex_wait(&m_seq, seq);
+  } else {
+    const timespec ts = {time_t(ns / 1000000000), long(ns % 1000000000)};
+    futex_wait(&m_seq, seq, &ts);
+  }
+  l.lock();
+  m_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void condition_variable_adaptive::notify(int32_t n) noexcept
+{
+  m_seq.fetch_add(1);
+  if (m_waiters.load()) {
+    futex_wake(&m_seq, n);
+  }
+}
+
+}
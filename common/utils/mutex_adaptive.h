@@ -0,0 +1,155 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_MUTEX_ADAPTIVE_H
+#define CEPH_COMMON_MUTEX_ADAPTIVE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/* A mutex for critical sections of a few hundred cycles, where parking a
+ * contended thread in the kernel (and waking it again) costs more than
+ * the section itself.  A lock() that finds it held spins for a while,
+ * with pause (yield on arm64) backoff, before sleeping on a futex.
+ *
+ * How long is learned per mutex, as glibc's PTHREAD_MUTEX_ADAPTIVE_NP
+ * does: the budget follows, as a moving average, the spins it took to
+ * get the lock, up to a limit, so a mutex usually held for long stops
+ * spinning at all.  On a single cpu nothing is gained by spinning and
+ * lock() parks straight away.
+ *
+ * Use ceph::make_adaptive_mutex() (ceph_mutex.h), which is the lockdep
+ * or profiled mutex in those builds; use this directly only where those
+ * can't be used, as in the log.
+ */
+namespace ceph {
+
+class mutex_adaptive {
+public:
+  mutex_adaptive() = default;
+  mutex_adaptive(const mutex_adaptive&) = delete;
+  mutex_adaptive& operator=(const mutex_adaptive&) = delete;
+
+  void lock() {
+    uint32_t unlocked = UNLOCKED;
+    if (!m_state.compare_exchange_strong(unlocked, LOCKED,
+					 std::memory_order_acquire,
+					 std::memory_order_relaxed)) {
+      lock_slow();
+    }
+  }
+  /// async-signal-safe
+  bool try_lock() {
+    uint32_t unlocked = UNLOCKED;
+    return m_state.compare_exchange_strong(unlocked, LOCKED,
+					   std::memory_order_acquire,
+					   std::memory_order_relaxed);
+  }
+  /// async-signal-safe
+  void unlock() {
+    if (m_state.exchange(UNLOCKED, std::memory_order_release) == PARKED) {
+      wake();
+    }
+  }
+
+private:
+  friend class condition_variable_adaptive;
+
+  static constexpr uint32_t UNLOCKED = 0;
+  static constexpr uint32_t LOCKED = 1; ///< and nobody parked
+  static constexpr uint32_t PARKED = 2; ///< locked, and maybe somebody parked
+
+  void lock_slow();
+  void wake();
+
+  std::atomic<uint32_t> m_state{UNLOCKED};
+  std::atomic<int32_t> m_spins{0}; ///< the learned budget, in pauses
+};
+
+/// a condition variable for std::unique_lock<mutex_adaptive>, itself a
+/// futex; notifying costs no system call while nobody waits
+class condition_variable_adaptive {
+  using lock_type = std::unique_lock<mutex_adaptive>;
+
+public:
+  condition_variable_adaptive() = default;
+  condition_variable_adaptive(const condition_variable_adaptive&) = delete;
+  condition_variable_adaptive& operator=(
+    const condition_variable_adaptive&) = delete;
+
+  void notify_one() noexcept {
+    notify(1);
+  }
+  void notify_all() noexcept {
+    notify(INT32_MAX);
+  }
+
+  void wait(lock_type& l) {
+    wait_ns(l, -1);
+  }
+  template<typename Predicate>
+  void wait(lock_type& l, Predicate pred) {
+    while (!pred()) {
+      wait(l);
+    }
+  }
+
+  template<typename Clock, typename Duration>
+  std::cv_status wait_until(
+    lock_type& l, const std::chrono::time_point<Clock, Duration>& t) {
+    const auto left = t - Clock::now();
+    if (left > left.zero()) {
+      wait_ns(l, std::chrono::duration_cast<std::chrono::nanoseconds>(
+		   left).count());
+    }
+    return Clock::now() < t ? std::cv_status::no_timeout :
+			      std::cv_status::timeout;
+  }
+  template<typename Clock, typename Duration, typename Predicate>
+  bool wait_until(lock_type& l,
+		  const std::chrono::time_point<Clock, Duration>& t,
+		  Predicate pred) {
+    while (!pred()) {
+      if (wait_until(l, t) == std::cv_status::timeout) {
+	return pred();
+      }
+    }
+    return true;
+  }
+
+  template<typename Rep, typename Period>
+  std::cv_status wait_for(lock_type& l,
+			  const std::chrono::duration<Rep, Period>& d) {
+    return wait_until(l, std::chrono::steady_clock::now() + d);
+  }
+  template<typename Rep, typename Period, typename Predicate>
+  bool wait_for(lock_type& l, const std::chrono::duration<Rep, Period>& d,
+		Predicate pred) {
+    return wait_until(l, std::chrono::steady_clock::now() + d,
+		      std::move(pred));
+  }
+
+private:
+  /// unlock l and sleep until notified or ns (-1: forever) have passed
+  void wait_ns(lock_type& l, int64_t ns);
+  void notify(int32_t n) noexcept;
+
+  std::atomic<uint32_t> m_seq{0};     ///< bumped by every notify
+  std::atomic<uint32_t> m_waiters{0};
+};
+
+}
+
+#endif
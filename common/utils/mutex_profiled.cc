@@ -0,0 +1,130 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "mutex_profiled.h"
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+namespace ceph {
+
+namespace {
+
+/// the sites, by name; a plain std::mutex, as it is what the others use
+struct registry {
+  std::mutex lock;
+  std::map<std::string, _mutex_profile::site, std::less<>> sites;
+};
+
+registry& get_registry()
+{
+  // leaked: mutexes in other static objects outlive any destructor order
+  static registry *r = new registry;
+  return *r;
+}
+
+}
+
+namespace _mutex_profile {
+
+site *get_site(std::string_view name)
+{
+  if (name.empty()) {
+    name = "(unnamed)";
+  }
+  auto& r = get_registry();
+  std::scoped_lock l(r.lock);
+  auto i = r.sites.find(name);
+  if (i == r.sites.end()) {
+    i = r.sites.emplace(std::piecewise_construct,
+			std::forward_as_tuple(name),
+			std::forward_as_tuple()).first;
+  }
+  return &i->second;
+}
+
+pid_t self()
+{
+  static thread_local pid_t tid = 0;
+  if (!tid) {
+    tid = syscall(SYS_gettid);
+  }
+  return tid;
+}
+
+uint64_t wait_begin()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void wait_end(site *s, uint64_t begin, pid_t holder)
+{
+  const uint64_t waited = wait_begin() - begin;
+  s->contended.fetch_add(1, std::memory_order_relaxed);
+  s->wait_ns.fetch_add(waited, std::memory_order_relaxed);
+  uint64_t max = s->max_wait_ns.load(std::memory_order_relaxed);
+  while (waited > max &&
+	 !s->max_wait_ns.compare_exchange_weak(max, waited,
+					       std::memory_order_relaxed)) {
+  }
+  s->last_holder.store(holder, std::memory_order_relaxed);
+}
+
+}
+
+std::vector<mutex_contention> get_mutex_contention()
+{
+  std::vector<mutex_contention> v;
+  auto& r = get_registry();
+  {
+    std::scoped_lock l(r.lock);
+    for (const auto& [name, s] : r.sites) {
+      mutex_contention c;
+      c.contended = s.contended.load(std::memory_order_relaxed);
+      if (!c.contended) {
+	continue;
+      }
+      c.name = name;
+      c.wait = std::chrono::nanoseconds(
+	s.wait_ns.load(std::memory_order_relaxed));
+      c.max_wait = std::chrono::nanoseconds(
+	s.max_wait_ns.load(std::memory_order_relaxed));
+      c.last_holder = s.last_holder.load(std::memory_order_relaxed);
+      v.push_back(std::move(c));
+    }
+  }
+  std::sort(v.begin(), v.end(), [](const auto& a, const auto& b) {
+    return a.wait > b.wait;
+  });
+  return v;
+}
+
+void reset_mutex_contention()
+{
+  auto& r = get_registry();
+  std::scoped_lock l(r.lock);
+  for (auto& [name, s] : r.sites) {
+    s.contended.store(0, std::memory_order_relaxed);
+    s.wait_ns.store(0, std::memory_order_relaxed);
+    s.max_wait_ns.store(0, std::memory_order_relaxed);
+    s.last_holder.store(0, std::memory_order_relaxed);
+  }
+}
+
+}
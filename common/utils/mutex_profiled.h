@@ -0,0 +1,189 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_MUTEX_PROFILED_H
+#define CEPH_COMMON_MUTEX_PROFILED_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Mutexes that keep contention statistics, for finding lock hotspots in a
+ * release build (see CEPH_PROFILE_MUTEX in ceph_mutex.h).
+ *
+ * An uncontended lock() costs a try_lock() and a store of the caller's tid.
+ * Only when the try fails does it read the clock around the blocking
+ * lock() and add the wait to the statistics of the mutex's name, so that
+ * every mutex made under one name (every instance of a class member, say)
+ * is counted together.  Reacquiring the mutex when a condition variable
+ * wait returns isn't counted.
+ */
+namespace ceph {
+
+/// what the mutexes made under a name have waited, as of the call
+struct mutex_contention {
+  std::string name;
+  uint64_t contended = 0; ///< lock() calls that had to wait
+  std::chrono::nanoseconds wait{0};     ///< in all of them
+  std::chrono::nanoseconds max_wait{0}; ///< in the longest
+  pid_t last_holder = 0;  ///< tid that held it the last time one waited
+};
+
+/// the names any mutex has waited under, most waited first
+std::vector<mutex_contention> get_mutex_contention();
+/// start counting afresh
+void reset_mutex_contention();
+
+namespace _mutex_profile {
+
+struct site {
+  std::atomic<uint64_t> contended{0};
+  std::atomic<uint64_t> wait_ns{0};
+  std::atomic<uint64_t> max_wait_ns{0};
+  std::atomic<pid_t> last_holder{0};
+};
+
+/// the statistics for name, made on first use and never freed
+site *get_site(std::string_view name);
+/// the calling thread's tid, cached after the first call
+pid_t self();
+uint64_t wait_begin();
+void wait_end(site *s, uint64_t begin, pid_t holder);
+
+template<typename Mutex>
+class profiled {
+public:
+  profiled() : profiled("") {}
+  profiled(std::string_view name) : m_site(get_site(name)) {}
+  profiled(const profiled&) = delete;
+  profiled& operator=(const profiled&) = delete;
+
+  void lock() {
+    if (!m_mutex.try_lock()) {
+      const pid_t holder = m_holder.load(std::memory_order_relaxed);
+      const uint64_t begin = wait_begin();
+      m_mutex.lock();
+      wait_end(m_site, begin, holder);
+    }
+    m_holder.store(self(), std::memory_order_relaxed);
+  }
+  bool try_lock() {
+    if (!m_mutex.try_lock()) {
+      return false;
+    }
+    m_holder.store(self(), std::memory_order_relaxed);
+    return true;
+  }
+  void unlock() {
+    m_mutex.unlock();
+  }
+
+  /// for condition_variable_profiled, which waits on it directly
+  Mutex& native() {
+    return m_mutex;
+  }
+  void relocked() {
+    m_holder.store(self(), std::memory_order_relaxed);
+  }
+
+private:
+  Mutex m_mutex;
+  std::atomic<pid_t> m_holder{0}; ///< the latest to lock it, for reports
+  site *m_site;
+};
+
+}
+
+using mutex_profiled = _mutex_profile::profiled<std::mutex>;
+using recursive_mutex_profiled =
+  _mutex_profile::profiled<std::recursive_mutex>;
+
+/// a std::condition_variable for std::unique_lock<mutex_profiled>
+class condition_variable_profiled {
+  using lock_type = std::unique_lock<mutex_profiled>;
+
+  /// run wait with the lock handed to it as a std::unique_lock<std::mutex>
+  template<typename Wait>
+  auto with_native(lock_type& l, Wait&& wait) {
+    std::unique_lock<std::mutex> native(l.mutex()->native(), std::adopt_lock);
+    struct give_back {
+      lock_type& l;
+      std::unique_lock<std::mutex>& native;
+      ~give_back() {
+	native.release();
+	l.mutex()->relocked();
+      }
+    } g{l, native};
+    return wait(native);
+  }
+
+public:
+  void notify_one() noexcept {
+    m_cond.notify_one();
+  }
+  void notify_all() noexcept {
+    m_cond.notify_all();
+  }
+
+  void wait(lock_type& l) {
+    with_native(l, [this](auto& n) { m_cond.wait(n); });
+  }
+  template<typename Predicate>
+  void wait(lock_type& l, Predicate pred) {
+    while (!pred()) {
+      wait(l);
+    }
+  }
+
+  template<typename Clock, typename Duration>
+  std::cv_status wait_until(
+    lock_type& l, const std::chrono::time_point<Clock, Duration>& t) {
+    return with_native(l, [&](auto& n) { return m_cond.wait_until(n, t); });
+  }
+  template<typename Clock, typename Duration, typename Predicate>
+  bool wait_until(lock_type& l,
+		  const std::chrono::time_point<Clock, Duration>& t,
+		  Predicate pred) {
+    while (!pred()) {
+      if (wait_until(l, t) == std::cv_status::timeout) {
+	return pred();
+      }
+    }
+    return true;
+  }
+
+  template<typename Rep, typename Period>
+  std::cv_status wait_for(lock_type& l,
+			  const std::chrono::duration<Rep, Period>& d) {
+    return with_native(l, [&](auto& n) { return m_cond.wait_for(n, d); });
+  }
+  template<typename Rep, typename Period, typename Predicate>
+  bool wait_for(lock_type& l, const std::chrono::duration<Rep, Period>& d,
+		Predicate pred) {
+    return wait_until(l, std::chrono::steady_clock::now() + d,
+		      std::move(pred));
+  }
+
+private:
+  std::condition_variable m_cond;
+};
+
+}
+
+#endif
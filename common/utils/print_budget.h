@@ -0,0 +1,64 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_PRINT_BUDGET_H
+#define CEPH_PRINT_BUDGET_H
+
+#include <cstdint>
+#include <iterator>
+#include <ostream>
+
+namespace ceph {
+
+/* How much of a container the operator<< overloads in types.h print.
+ *
+ * A stream may carry a budget of elements and bytes per container, set with
+ * set_print_budget(); the streams log entries are formatted into do (see
+ * log_max_container_elements).  Once either is spent the rest of the
+ * container is summed up as "... N more", so that one stray << of a huge
+ * map makes a long line rather than a megabyte one.  Streams without a
+ * budget print everything, as before.
+ */
+inline int print_budget_index() {
+  static const int index = std::ios_base::xalloc();
+  return index;
+}
+
+/// 0 for either means no limit
+inline void set_print_budget(std::ios_base& s, uint32_t elements,
+			     uint32_t bytes) {
+  s.iword(print_budget_index()) =
+    static_cast<long>(elements) | (static_cast<long>(bytes) << 32);
+}
+
+/// print c's elements separated by sep, each with print(out, element),
+/// within out's budget
+template<typename C, typename F>
+void print_elements(std::ostream& out, const C& c, const char *sep, F&& print) {
+  const long budget = out.iword(print_budget_index());
+  auto it = c.begin();
+  if (budget == 0) {
+    for (; it != c.end(); ++it) {
+      if (it != c.begin()) out << sep;
+      print(out, *it);
+    }
+    return;
+  }
+  const uint32_t max_elements = budget & UINT32_MAX;
+  const uint32_t max_bytes = budget >> 32;
+  // -1 if the stream can't tell, which leaves only the element budget
+  const std::streamoff start = max_bytes ? std::streamoff(out.tellp()) : -1;
+  for (uint32_t n = 0; it != c.end(); ++it, ++n) {
+    if (n && ((max_elements && n >= max_elements) ||
+	      (start >= 0 && std::streamoff(out.tellp()) - start >= max_bytes))) {
+      out << sep << "... " << std::distance(it, c.end()) << " more";
+      return;
+    }
+    if (n) out << sep;
+    print(out, *it);
+  }
+}
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace ceph {
+
+/* A pointer to an immutable T that readers follow without taking a lock.
+ *
+ * A reader holds an rcu_ptr::reader for as long as it looks at the value:
+ * one increment, one load and one decrement, none of which ever waits.
+ * Writers, serialized by the caller, publish a new value with update(),
+ * which deletes the old one once no reader can still see it.
+ *
+ * Readers count themselves in one of two counters, picked by a phase bit
+ * that every update flips twice, waiting each time for the counter it
+ * left to drain (as userspace RCU does), so a reader that stalls between
+ * picking its counter and incrementing it is never missed.
+ */
+template<typename T>
+class rcu_ptr {
+public:
+  class reader {
+  public:
+    explicit reader(const rcu_ptr& p)
+      : m_p(p), m_phase(p.m_phase.load() & 1) {
+      m_p.m_readers[m_phase].fetch_add(1);
+      m_value = m_p.m_value.load();
+    }
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+    ~reader() {
+      m_p.m_readers[m_phase].fetch_sub(1);
+    }
+
+    const T* get() const {
+      return m_value;
+    }
+    const T& operator*() const {
+      return *m_value;
+    }
+    const T* operator->() const {
+      return m_value;
+    }
+
+  private:
+    const rcu_ptr& m_p;
+    const unsigned m_phase;
+    const T *m_value;
+  };
+
+  explicit rcu_ptr(std::unique_ptr<const T> v = nullptr)
+    : m_value(v.release()) {}
+  rcu_ptr(const rcu_ptr&) = delete;
+  rcu_ptr& operator=(const rcu_ptr&) = delete;
+  ~rcu_ptr() {
+    delete m_value.load();
+  }
+
+  /// publish v and free the old value once no reader holds it
+  void update(std::unique_ptr<const T> v) {
+    const T *old = m_value.exchange(v.release());
+    for (int i = 0; i < 2; ++i) {
+      const unsigned phase = m_phase.fetch_xor(1) & 1;
+      while (m_readers[phase].load() != 0) {
+	std::this_thread::yield();
+      }
+    }
+    delete old;
+  }
+
+private:
+  std::atomic<const T*> m_value;
+  std::atomic<unsigned> m_phase{0};
+  mutable std::atomic<uint64_t> m_readers[2] = {{0}, {0}};
+};
+
+}
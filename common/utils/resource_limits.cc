@@ -0,0 +1,138 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "resource_limits.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace ceph {
+
+namespace {
+
+/// the first line of path, without the newline
+bool read_line(const std::string& path, std::string *line)
+{
+  FILE *f = fopen(path.c_str(), "re");
+  if (!f) {
+    return false;
+  }
+  char buf[256];
+  const bool ok = fgets(buf, sizeof(buf), f) != nullptr;
+  fclose(f);
+  if (!ok) {
+    return false;
+  }
+  *line = buf;
+  if (!line->empty() && line->back() == '\n') {
+    line->pop_back();
+  }
+  return true;
+}
+
+/// the process's cgroup in the unified hierarchy, e.g. "/system.slice/x"
+bool own_cgroup(std::string *path)
+{
+  FILE *f = fopen("/proc/self/cgroup", "re");
+  if (!f) {
+    return false;
+  }
+  char buf[4096];
+  bool found = false;
+  while (fgets(buf, sizeof(buf), f)) {
+    // v2 is hierarchy 0 with no controllers: "0::/path"
+    if (strncmp(buf, "0::", 3) == 0) {
+      *path = buf + 3;
+      if (!path->empty() && path->back() == '\n') {
+	path->pop_back();
+      }
+      found = true;
+      break;
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+/// a memory.max or memory.high; "max" is no limit
+uint64_t parse_memory(const std::string& s)
+{
+  if (s.empty() || s == "max") {
+    return 0;
+  }
+  return strtoull(s.c_str(), nullptr, 10);
+}
+
+/// a cpu.max: "<quota> <period>" or "max <period>"
+double parse_cpus(const std::string& s)
+{
+  if (s.empty() || s.compare(0, 3, "max") == 0) {
+    return 0;
+  }
+  char *end;
+  const double quota = strtod(s.c_str(), &end);
+  const double period = strtod(end, nullptr);
+  return quota > 0 && period > 0 ? quota / period : 0;
+}
+
+}
+
+resource_limits get_resource_limits(const std::string& cgroup_root)
+{
+  resource_limits r;
+  std::string path;
+  if (own_cgroup(&path)) {
+    // a limit anywhere above us applies to us too
+    while (true) {
+      const std::string dir = cgroup_root + path;
+      std::string line;
+      for (const char *f : {"/memory.max", "/memory.high"}) {
+	if (read_line(dir + f, &line)) {
+	  if (uint64_t m = parse_memory(line);
+	      m && (!r.memory || m < r.memory)) {
+	    r.memory = m;
+	    r.memory_from_cgroup = true;
+	  }
+	}
+      }
+      if (read_line(dir + "/cpu.max", &line)) {
+	if (double c = parse_cpus(line); c > 0 && (!r.cpus || c < r.cpus)) {
+	  r.cpus = c;
+	  r.cpus_from_cgroup = true;
+	}
+      }
+      if (path.empty() || path == "/") {
+	break;
+      }
+      const auto slash = path.rfind('/');
+      path.resize(slash == std::string::npos ? 0 : slash);
+    }
+  }
+
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long page_size = sysconf(_SC_PAGESIZE);
+  if (pages > 0 && page_size > 0) {
+    const uint64_t phys = uint64_t(pages) * page_size;
+    if (!r.memory || phys < r.memory) {
+      r.memory = phys;
+      r.memory_from_cgroup = false;
+    }
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    const double n = CPU_COUNT(&set);
+    if (n > 0 && (!r.cpus || n < r.cpus)) {
+      r.cpus = n;
+      r.cpus_from_cgroup = false;
+    }
+  }
+  return r;
+}
+
+}
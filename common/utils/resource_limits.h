@@ -0,0 +1,44 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_RESOURCE_LIMITS_H
+#define CEPH_COMMON_RESOURCE_LIMITS_H
+
+#include <cstdint>
+#include <string>
+
+namespace ceph {
+
+/// the memory and cpu the process can count on
+struct resource_limits {
+  uint64_t memory = 0;  ///< bytes, 0 if unknown
+  double cpus = 0;      ///< 0 if unknown
+  bool memory_from_cgroup = false;  ///< memory is a cgroup's limit
+  bool cpus_from_cgroup = false;    ///< cpus is a cgroup's quota
+};
+
+/**
+ * the limits of the process's cgroup and the host
+ *
+ * memory is the lowest memory.max or memory.high of the process's cgroup
+ * (v2) and those above it, else physical memory; cpus the lowest cpu.max
+ * quota over period, else the cpus the process may run on.  A v1-only
+ * hierarchy counts as no cgroup.
+ *
+ * @param cgroup_root where the unified hierarchy is mounted
+ */
+resource_limits get_resource_limits(
+  const std::string& cgroup_root = "/sys/fs/cgroup");
+
+}
+
+#endif
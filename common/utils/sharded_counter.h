@@ -0,0 +1,61 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace ceph {
+
+/* A counter that many threads bump and few read, such as the process wide
+ * statistics the log keeps on its submit path.
+ *
+ * Each thread adds to one of SHARDS slots, each on its own cache line, so
+ * threads incrementing at once don't bounce a line between them; get()
+ * sums the slots when the value is reported, e.g. into the log's
+ * PerfCounters by Log::flush().  Threads are given slots round robin as
+ * they first use any sharded_counter, and more threads than SHARDS share
+ * them, so an increment is still an atomic add, just one that rarely has
+ * to wait for the line.
+ *
+ * A value is meant to be read now and then, not used to make decisions:
+ * get() can miss increments made while it sums.
+ */
+class sharded_counter {
+public:
+  static constexpr std::size_t SHARDS = 16;
+
+  sharded_counter() {}
+  sharded_counter(const sharded_counter&) = delete;
+  sharded_counter& operator=(const sharded_counter&) = delete;
+
+  void inc(uint64_t n = 1) {
+    m_shards[shard()].v.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t get() const {
+    uint64_t sum = 0;
+    for (auto& s : m_shards) {
+      sum += s.v.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+private:
+  struct alignas(64) shard_t {
+    std::atomic<uint64_t> v{0};
+  };
+  std::array<shard_t, SHARDS> m_shards;
+
+  static std::size_t shard() {
+    static std::atomic<std::size_t> next{0};
+    thread_local const std::size_t mine =
+      next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return mine;
+  }
+};
+
+}
@@ -0,0 +1,141 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "startup_trace.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+
+namespace ceph::startup_trace {
+
+namespace {
+
+struct registry {
+  std::mutex lock;
+  std::vector<phase_record> phases;
+};
+
+registry& get_registry()
+{
+  // leaked: phases end in static destructors too
+  static registry *r = new registry;
+  return *r;
+}
+
+thread_local unsigned depth = 0;
+
+pid_t self()
+{
+  static thread_local pid_t tid = 0;
+  if (!tid) {
+    tid = syscall(SYS_gettid);
+  }
+  return tid;
+}
+
+void record(const char *name, unsigned d, ceph::mono_time begin,
+	    ceph::mono_time end)
+{
+  auto& r = get_registry();
+  std::scoped_lock l(r.lock);
+  if (r.phases.size() < MAX_PHASES) {
+    r.phases.push_back({name, self(), d, begin, end - begin});
+  }
+}
+
+/// name, which is an identifier more or less, as a JSON string's insides
+void write_escaped(FILE *f, const char *name)
+{
+  for (const char *p = name; *p; ++p) {
+    if (*p == '"' || *p == '\\') {
+      fputc('\\', f);
+    }
+    if (static_cast<unsigned char>(*p) >= 0x20) {
+      fputc(*p, f);
+    }
+  }
+}
+
+}
+
+phase::phase(const char *name)
+  : m_name(name),
+    m_depth(depth++),
+    m_begin(ceph::mono_clock::now())
+{}
+
+phase::~phase()
+{
+  --depth;
+  record(m_name, m_depth, m_begin, ceph::mono_clock::now());
+}
+
+void add(const char *name, ceph::mono_time begin, ceph::mono_time end)
+{
+  record(name, depth, begin, end);
+}
+
+std::vector<phase_record> get()
+{
+  std::vector<phase_record> v;
+  {
+    auto& r = get_registry();
+    std::scoped_lock l(r.lock);
+    v = r.phases;
+  }
+  // recorded as they end; an enclosing phase begins first, or along with
+  std::stable_sort(v.begin(), v.end(), [](const auto& a, const auto& b) {
+    return a.begin < b.begin || (a.begin == b.begin && a.depth < b.depth);
+  });
+  return v;
+}
+
+int write_chrome_trace(const std::string& path)
+{
+  const auto phases = get();
+  FILE *f = fopen(path.c_str(), "we");
+  if (!f) {
+    return -errno;
+  }
+  const auto origin = phases.empty() ? ceph::mono_time() : phases[0].begin;
+  auto us = [](ceph::timespan t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t).count();
+  };
+  const pid_t pid = getpid();
+  fputs("{\"traceEvents\":[", f);
+  for (std::size_t i = 0; i < phases.size(); ++i) {
+    const auto& p = phases[i];
+    fputs(i ? ",\n{\"name\":\"" : "\n{\"name\":\"", f);
+    write_escaped(f, p.name);
+    fprintf(f, "\",\"cat\":\"startup\",\"ph\":\"X\",\"ts\":%" PRId64
+	    ",\"dur\":%" PRId64 ",\"pid\":%d,\"tid\":%d}",
+	    int64_t(us(p.begin - origin)), int64_t(us(p.took)),
+	    int(pid), int(p.tid));
+  }
+  fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f);
+  int r = 0;
+  if (ferror(f)) {
+    r = -EIO;
+  }
+  if (fclose(f) != 0 && !r) {
+    r = -errno;
+  }
+  return r;
+}
+
+}
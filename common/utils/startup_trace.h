@@ -0,0 +1,71 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_STARTUP_TRACE_H
+#define CEPH_COMMON_STARTUP_TRACE_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "common/ceph_time.h"
+
+/* Where process startup spends its time: the phases of global_init(),
+ * CephContext construction and the like time themselves with a
+ * startup_trace::phase, and the phases are kept, nested per thread, for
+ * the "startup trace" admin socket command and for startup_trace_file.
+ *
+ * A phase costs two clock reads and, when it ends, a locked append; it is
+ * meant for the once-per-process steps, and past MAX_PHASES (a library
+ * making a CephContext per connection, say) further phases are dropped.
+ */
+namespace ceph::startup_trace {
+
+static constexpr std::size_t MAX_PHASES = 4096;
+
+struct phase_record {
+  const char *name;
+  pid_t tid;
+  unsigned depth;  ///< of the phases it is within, on its thread
+  ceph::mono_time begin;
+  ceph::timespan took;
+};
+
+/// times the scope it is declared in
+class phase {
+public:
+  /// name must outlive the process: a literal
+  explicit phase(const char *name);
+  ~phase();
+  phase(const phase&) = delete;
+  phase& operator=(const phase&) = delete;
+
+private:
+  const char *m_name;
+  unsigned m_depth;
+  ceph::mono_time m_begin;
+};
+
+/// record a phase timed by other means, within the current scope's
+void add(const char *name, ceph::mono_time begin, ceph::mono_time end);
+
+/// the phases so far, in the order they began
+std::vector<phase_record> get();
+
+/// write the phases as Chrome trace events (chrome://tracing, Perfetto)
+/// to path; 0 or -errno
+int write_chrome_trace(const std::string& path);
+
+}
+
+#endif
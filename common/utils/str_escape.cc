@@ -0,0 +1,369 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <ostream>
+
+#include "common/cpu_features.h"
+#include "common/str_escape.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* JSON escaping and hex encoding for log lines, crash dumps and dumps of
+ * binary fields, where the text is mostly plain and long runs of it are
+ * common.
+ *
+ * json_plain_prefix() compares a vector of bytes at a time against '"',
+ * '\\' and 0x1f (unsigned max, then compare, since there is no unsigned
+ * less-than before AVX-512) and returns at the first hit; the caller then
+ * copies the run in one go.  hex_encode() splits each byte into nibbles,
+ * turns them into digits with an add and a compare, and interleaves the
+ * high and low digits with an unpack.  Both leave what is under a vector
+ * to the scalar code, which short inputs (keys, small fields) go straight
+ * to without the indirect call.
+ */
+
+namespace {
+
+inline bool json_plain(unsigned char c)
+{
+  return c >= 0x20 && c != '"' && c != '\\';
+}
+
+std::size_t plain_scalar(const char *s, std::size_t len)
+{
+  std::size_t i = 0;
+  while (i < len && json_plain(s[i])) {
+    ++i;
+  }
+  return i;
+}
+
+/// "000102...feff"
+struct hex_pairs {
+  char d[512];
+  constexpr hex_pairs() : d() {
+    constexpr char hex[] = "0123456789abcdef";
+    for (int i = 0; i < 256; ++i) {
+      d[2 * i] = hex[i >> 4];
+      d[2 * i + 1] = hex[i & 0xf];
+    }
+  }
+};
+constexpr hex_pairs pairs;
+
+char *hex_scalar(char *out, const unsigned char *in, std::size_t len)
+{
+  for (std::size_t i = 0; i < len; ++i) {
+    memcpy(out, pairs.d + 2 * in[i], 2);
+    out += 2;
+  }
+  return out;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+std::size_t plain_sse2(const char *s, std::size_t len)
+{
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i ctl = _mm_set1_epi8(0x1f);
+  std::size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    const unsigned mask = _mm_movemask_epi8(
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+				_mm_cmpeq_epi8(v, bslash)),
+		   _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl)));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + plain_scalar(s + i, len - i);
+}
+
+/// the digits for each nibble of v, which holds values 0 to 15
+inline __m128i digits_sse2(__m128i v)
+{
+  return _mm_add_epi8(_mm_add_epi8(v, _mm_set1_epi8('0')),
+		      _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(9)),
+				    _mm_set1_epi8('a' - '0' - 10)));
+}
+
+char *hex_sse2(char *out, const unsigned char *in, std::size_t len)
+{
+  const __m128i low = _mm_set1_epi8(0x0f);
+  std::size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i hi = digits_sse2(_mm_and_si128(_mm_srli_epi16(v, 4), low));
+    const __m128i lo = digits_sse2(_mm_and_si128(v, low));
+    __m128i *o = reinterpret_cast<__m128i*>(out);
+    _mm_storeu_si128(o, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(o + 1, _mm_unpackhi_epi8(hi, lo));
+    out += 32;
+  }
+  return hex_scalar(out, in + i, len - i);
+}
+
+__attribute__((target("avx2")))
+std::size_t plain_avx2(const char *s, std::size_t len)
+{
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i bslash = _mm256_set1_epi8('\\');
+  const __m256i ctl = _mm256_set1_epi8(0x1f);
+  std::size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m256i v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+    const uint32_t mask = _mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+				      _mm256_cmpeq_epi8(v, bslash)),
+		      _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctl), ctl)));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + plain_scalar(s + i, len - i);
+}
+
+__attribute__((target("avx2"), always_inline))
+inline __m256i digits_avx2(__m256i v)
+{
+  return _mm256_add_epi8(
+    _mm256_add_epi8(v, _mm256_set1_epi8('0')),
+    _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(9)),
+		     _mm256_set1_epi8('a' - '0' - 10)));
+}
+
+__attribute__((target("avx2")))
+char *hex_avx2(char *out, const unsigned char *in, std::size_t len)
+{
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  std::size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m256i v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    const __m256i hi =
+      digits_avx2(_mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+    const __m256i lo = digits_avx2(_mm256_and_si256(v, low));
+    // the unpacks work within each 128 bit lane: a has the digits of bytes
+    // 0-7 and 16-23, b those of 8-15 and 24-31
+    const __m256i a = _mm256_unpacklo_epi8(hi, lo);
+    const __m256i b = _mm256_unpackhi_epi8(hi, lo);
+    __m256i *o = reinterpret_cast<__m256i*>(out);
+    _mm256_storeu_si256(o, _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256(o + 1, _mm256_permute2x128_si256(a, b, 0x31));
+    out += 64;
+  }
+  return hex_sse2(out, in + i, len - i);
+}
+
+#elif defined(__aarch64__)
+
+std::size_t plain_neon(const char *s, std::size_t len)
+{
+  const uint8x16_t quote = vdupq_n_u8('"');
+  const uint8x16_t bslash = vdupq_n_u8('\\');
+  const uint8x16_t ctl = vdupq_n_u8(0x1f);
+  std::size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(s + i));
+    const uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, quote),
+					     vceqq_u8(v, bslash)),
+				    vcleq_u8(v, ctl));
+    // narrow to four bits per position; there is no movemask
+    const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+      vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+    if (mask) {
+      return i + __builtin_ctzll(mask) / 4;
+    }
+  }
+  return i + plain_scalar(s + i, len - i);
+}
+
+inline uint8x16_t digits_neon(uint8x16_t v)
+{
+  return vaddq_u8(vaddq_u8(v, vdupq_n_u8('0')),
+		  vandq_u8(vcgtq_u8(v, vdupq_n_u8(9)),
+			   vdupq_n_u8('a' - '0' - 10)));
+}
+
+char *hex_neon(char *out, const unsigned char *in, std::size_t len)
+{
+  std::size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const uint8x16_t v = vld1q_u8(in + i);
+    uint8x16x2_t d;
+    d.val[0] = digits_neon(vshrq_n_u8(v, 4));
+    d.val[1] = digits_neon(vandq_u8(v, vdupq_n_u8(0x0f)));
+    // stores the two interleaved, high digit first
+    vst2q_u8(reinterpret_cast<uint8_t*>(out), d);
+    out += 32;
+  }
+  return hex_scalar(out, in + i, len - i);
+}
+
+#endif
+
+using plain_variant = ceph::cpu_variant<std::size_t(const char *s,
+						    std::size_t len)>;
+using hex_variant = ceph::cpu_variant<char *(char *out, const unsigned char *in,
+					     std::size_t len)>;
+
+constexpr plain_variant plain_variants[] = {
+#if defined(__GNUC__) && defined(__x86_64__)
+  {"avx2", ceph::CPU_AVX2, plain_avx2},
+  {"sse2", 0, plain_sse2},
+#elif defined(__aarch64__)
+  {"neon", 0, plain_neon},
+#else
+  {"generic", 0, plain_scalar},
+#endif
+};
+
+constexpr hex_variant hex_variants[] = {
+#if defined(__GNUC__) && defined(__x86_64__)
+  {"avx2", ceph::CPU_AVX2, hex_avx2},
+  {"sse2", 0, hex_sse2},
+#elif defined(__aarch64__)
+  {"neon", 0, hex_neon},
+#else
+  {"generic", 0, hex_scalar},
+#endif
+};
+
+const plain_variant& chosen_plain()
+{
+  static const plain_variant& v = ceph::pick_cpu_variant(plain_variants);
+  return v;
+}
+
+const hex_variant& chosen_hex()
+{
+  static const hex_variant& v = ceph::pick_cpu_variant(hex_variants);
+  return v;
+}
+
+/// what operator<< encodes at a time
+constexpr std::size_t STREAM_CHUNK = 768;
+
+}
+
+namespace ceph {
+
+std::size_t json_plain_prefix(const char *s, std::size_t len)
+{
+  if (len < 16) {
+    return plain_scalar(s, len);
+  }
+  return chosen_plain().fn(s, len);
+}
+
+const char *json_plain_prefix_name()
+{
+  return chosen_plain().name;
+}
+
+char *hex_encode(char *out, const void *in, std::size_t len)
+{
+  auto p = static_cast<const unsigned char*>(in);
+  if (len < 16) {
+    return hex_scalar(out, p, len);
+  }
+  return chosen_hex().fn(out, p, len);
+}
+
+const char *hex_encode_name()
+{
+  return chosen_hex().name;
+}
+
+/* Three bytes to four characters at a time, with the alphabet in a table.
+ * The vector encoders need a shuffle per step to regroup 6 bit fields;
+ * what gets base64 encoded here (keys, small blobs in dumps) is too short
+ * for that to pay for itself.
+ */
+char *base64_encode(char *out, const void *in, std::size_t len)
+{
+  static constexpr char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  auto p = static_cast<const unsigned char*>(in);
+  std::size_t i = 0;
+  for (; i + 3 <= len; i += 3) {
+    const uint32_t v = (uint32_t(p[i]) << 16) | (uint32_t(p[i + 1]) << 8) |
+      p[i + 2];
+    out[0] = alphabet[v >> 18];
+    out[1] = alphabet[(v >> 12) & 0x3f];
+    out[2] = alphabet[(v >> 6) & 0x3f];
+    out[3] = alphabet[v & 0x3f];
+    out += 4;
+  }
+  if (i < len) {
+    const uint32_t v = (uint32_t(p[i]) << 16) |
+      (i + 1 < len ? uint32_t(p[i + 1]) << 8 : 0);
+    out[0] = alphabet[v >> 18];
+    out[1] = alphabet[(v >> 12) & 0x3f];
+    out[2] = i + 1 < len ? alphabet[(v >> 6) & 0x3f] : '=';
+    out[3] = '=';
+    out += 4;
+  }
+  return out;
+}
+
+std::ostream& operator<<(std::ostream& out, const hex_span& h)
+{
+  char buf[2 * STREAM_CHUNK];
+  auto p = static_cast<const char*>(h.data);
+  for (std::size_t left = h.len; left; ) {
+    const std::size_t n = std::min(left, STREAM_CHUNK);
+    out.rdbuf()->sputn(buf, hex_encode(buf, p, n) - buf);
+    p += n;
+    left -= n;
+  }
+  return out;
+}
+
+std::ostream& operator<<(std::ostream& out, const base64_span& b)
+{
+  // a multiple of three, so that only the last chunk is padded
+  static_assert(STREAM_CHUNK % 3 == 0);
+  char buf[base64_size(STREAM_CHUNK)];
+  auto p = static_cast<const char*>(b.data);
+  for (std::size_t left = b.len; left; ) {
+    const std::size_t n = std::min(left, STREAM_CHUNK);
+    out.rdbuf()->sputn(buf, base64_encode(buf, p, n) - buf);
+    p += n;
+    left -= n;
+  }
+  return out;
+}
+
+std::ostream& operator<<(std::ostream& out, const json_quoted& j)
+{
+  auto *sb = out.rdbuf();
+  sb->sputc('"');
+  json_escape(j.s, [sb](const char *p, std::size_t n) {
+    sb->sputn(p, n);
+  });
+  sb->sputc('"');
+  return out;
+}
+
+}
@@ -0,0 +1,116 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_STR_ESCAPE_H
+#define CEPH_STR_ESCAPE_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <string_view>
+
+namespace ceph {
+
+/// the number of bytes at the front of [s, s + len) that go into a JSON
+/// string as they are, i.e. before the first '"', '\\' or control
+/// character; vectorized, see str_escape.cc
+std::size_t json_plain_prefix(const char *s, std::size_t len);
+/// which variant json_plain_prefix() uses, e.g. "avx2"
+const char *json_plain_prefix_name();
+
+/**
+ * s escaped for the inside of a JSON string, as calls to
+ * append(const char *p, std::size_t n)
+ *
+ * Runs that need no escaping are passed on whole, so a sink that copies
+ * with memcpy() does one copy per run rather than one push per byte.
+ * Bytes of 0x80 and up are passed on unchanged: UTF-8 is valid JSON, and
+ * anything else is no worse than it was.  Allocates nothing, and is
+ * async-signal-safe once json_plain_prefix() has been called once.
+ */
+template<typename Append>
+void json_escape(std::string_view s, Append&& append)
+{
+  static constexpr char hex[] = "0123456789abcdef";
+  while (!s.empty()) {
+    const std::size_t n = json_plain_prefix(s.data(), s.size());
+    if (n) {
+      append(s.data(), n);
+      if (n == s.size()) {
+	return;
+      }
+    }
+    const unsigned char c = s[n];
+    char esc[6] = {'\\', char(c), 0, 0, 0, 0};
+    std::size_t len = 2;
+    if (c == '\n') {
+      esc[1] = 'n';
+    } else if (c == '\t') {
+      esc[1] = 't';
+    } else if (c < 0x20) {
+      esc[1] = 'u';
+      esc[2] = '0';
+      esc[3] = '0';
+      esc[4] = hex[c >> 4];
+      esc[5] = hex[c & 0xf];
+      len = 6;
+    }
+    append(esc, len);
+    s.remove_prefix(n + 1);
+  }
+}
+
+/// the 2 * len lowercase hex digits of [in, in + len) at out, not NUL
+/// terminated; returns the end of them
+char *hex_encode(char *out, const void *in, std::size_t len);
+/// which variant hex_encode() uses, e.g. "avx2"
+const char *hex_encode_name();
+
+/// what base64_encode() writes for len bytes
+constexpr std::size_t base64_size(std::size_t len)
+{
+  return (len + 2) / 3 * 4;
+}
+/// [in, in + len) as padded base64 (RFC 4648) at out, which has room for
+/// base64_size(len); returns the end of it, not NUL terminated
+char *base64_encode(char *out, const void *in, std::size_t len);
+
+/**
+ * For streams, StackStringStream and ldout among them.  Each encodes into
+ * a buffer on the stack and passes it to the streambuf a chunk at a time,
+ * so that large inputs neither allocate nor go through operator<< per byte:
+ *
+ *   ldout(cct, 20) << "digest " << ceph::hex_span(d, sizeof(d)) << dendl;
+ */
+struct hex_span {
+  const void *data;
+  std::size_t len;
+  hex_span(const void *data, std::size_t len) : data(data), len(len) {}
+};
+std::ostream& operator<<(std::ostream& out, const hex_span& h);
+
+struct base64_span {
+  const void *data;
+  std::size_t len;
+  base64_span(const void *data, std::size_t len) : data(data), len(len) {}
+};
+std::ostream& operator<<(std::ostream& out, const base64_span& b);
+
+/// s as a JSON string, quotes and all
+struct json_quoted {
+  std::string_view s;
+  explicit json_quoted(std::string_view s) : s(s) {}
+};
+std::ostream& operator<<(std::ostream& out, const json_quoted& j);
+
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef CEPH_STRLIST_H
 #define CEPH_STRLIST_H
 
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <list>
 #include <set>
 #include <string>
@@ -9,17 +12,125 @@
 
 namespace ceph {
 
+/// A set of delimiter characters, tested with a bit lookup rather than a
+/// scan of the delimiter string for every character split.
+class delim_set {
+public:
+  constexpr delim_set(std::string_view delims) {
+    for (char c : delims) {
+      const auto u = static_cast<unsigned char>(c);
+      bits[u / 64] |= uint64_t(1) << (u % 64);
+    }
+  }
+  constexpr delim_set(const char *delims)
+    : delim_set(std::string_view(delims)) {}
+
+  constexpr bool operator()(char c) const {
+    const auto u = static_cast<unsigned char>(c);
+    return bits[u / 64] & (uint64_t(1) << (u % 64));
+  }
+
+private:
+  uint64_t bits[4] = {};
+};
+
+/// what get_str_list() and friends split on by default
+inline constexpr delim_set default_delims{";,= \t"};
+
+/**
+ * The pieces of a string between runs of delimiters, as (non-null-
+ * terminated) std::string_views into it, found as the range is walked:
+ *
+ *   for (std::string_view name : ceph::split(names, ",")) ...
+ *
+ * Nothing is allocated. The string must outlive the range, and iterators
+ * are only valid while the split they came from is.
+ */
+class split {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view*;
+    using reference = const std::string_view&;
+
+    iterator() = default;
+
+    reference operator*() const {
+      return cur;
+    }
+    pointer operator->() const {
+      return &cur;
+    }
+    iterator& operator++() {
+      next();
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator i = *this;
+      next();
+      return i;
+    }
+    friend bool operator==(const iterator& a, const iterator& b) {
+      return a.cur.data() == b.cur.data();
+    }
+    friend bool operator!=(const iterator& a, const iterator& b) {
+      return !(a == b);
+    }
+
+  private:
+    friend class split;
+    iterator(std::string_view s, const delim_set *d) : rest(s), delims(d) {
+      next();
+    }
+
+    void next() {
+      const char *p = rest.data(), *end = p + rest.size();
+      while (p != end && (*delims)(*p)) {
+	++p;
+      }
+      if (p == end) {
+	cur = {};  // the end: no data pointer
+	rest = {};
+	return;
+      }
+      const char *t = p;
+      while (p != end && !(*delims)(*p)) {
+	++p;
+      }
+      cur = std::string_view(t, p - t);
+      rest = std::string_view(p, end - p);
+    }
+
+    std::string_view cur;  ///< the current piece
+    std::string_view rest; ///< what follows it
+    const delim_set *delims = nullptr;
+  };
+
+  explicit split(std::string_view s, delim_set delims = default_delims)
+    : s(s), delims(delims) {}
+
+  iterator begin() const {
+    return iterator(s, &delims);
+  }
+  iterator end() const {
+    return iterator();
+  }
+
+private:
+  std::string_view s;
+  delim_set delims;
+};
+
 /// Split a string using the given delimiters, passing each piece as a
 /// (non-null-terminated) std::string_view to the callback.
 template <typename Func> // where Func(std::string_view) is a valid call
 void for_each_substr(std::string_view s, const char *delims, Func&& f)
 {
-  auto pos = s.find_first_not_of(delims);
-  while (pos != s.npos) {
-    s.remove_prefix(pos); // trim delims from the front
-    auto end = s.find_first_of(delims);
-    f(s.substr(0, end));
-    pos = s.find_first_not_of(delims, end);
+  for (std::string_view piece : split(s, delims)) {
+    f(piece);
   }
 }
 
@@ -91,7 +202,7 @@ void get_str_set(const std::string& str,
                  std::set<std::string, Compare>& str_list)
 {
   str_list.clear();
-  for_each_substr(str, delims, [&str_list] (auto token) {
+  ceph::for_each_substr(str, delims, [&str_list] (auto token) {
                   str_list.emplace(token.begin(), token.end());
                   });
 }
@@ -116,8 +227,15 @@ inline std::string str_join(const std::vector<std::string>& v, const std::string
 {
   if (v.empty())
     return std::string();
+  // sized up front, for one allocation
+  std::size_t len = sep.size() * (v.size() - 1);
+  for (const auto& s : v) {
+    len += s.size();
+  }
   std::vector<std::string>::const_iterator i = v.begin();
-  std::string r = *i;
+  std::string r;
+  r.reserve(len);
+  r += *i;
   for (++i; i != v.end(); ++i) {
     r += sep;
     r += *i;
@@ -14,27 +14,258 @@
 
 #include "strtol.h"
 
+#include <cctype>
+#include <charconv>
 #include <climits>
+#include <cstdlib>
 #include <limits>
-#include <cmath>
-#include <sstream>
 #include <string_view>
 
-using std::ostringstream;
+namespace {
 
-long long strict_strtoll(std::string_view str, int base, std::string *err)
+std::string_view skip_space(std::string_view s)
 {
-  char *endptr;
-  errno = 0; /* To distinguish success/failure after call (see man page) */
-  long long ret = strtoll(str.data(), &endptr, base);
-  if (endptr == str.data() || endptr != str.data() + str.size()) {
-    *err = (std::string{"Expected option value to be integer, got '"} +
-	    std::string{str} + "'");
-    return 0;
+  while (!s.empty() && isspace((unsigned char)s.front())) {
+    s.remove_prefix(1);
+  }
+  return s;
+}
+
+/// a leading sign, as strtoll() takes it: at most one
+bool take_sign(std::string_view *s, bool *neg)
+{
+  *neg = false;
+  if (!s->empty() && (s->front() == '+' || s->front() == '-')) {
+    *neg = s->front() == '-';
+    s->remove_prefix(1);
+  }
+  return s->empty() || (s->front() != '+' && s->front() != '-');
+}
+
+bool hex_prefix(std::string_view s)
+{
+  return s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X') &&
+    isxdigit((unsigned char)s[2]);
+}
+
+template<typename T>
+strict_errc parse_integer(std::string_view str, T *out, int base)
+{
+  std::string_view s = skip_space(str);
+  if (s.empty()) {
+    return strict_errc::empty;
+  }
+  bool neg;
+  if (!take_sign(&s, &neg)) {
+    return strict_errc::invalid;
+  }
+  if ((base == 16 || base == 0) && hex_prefix(s)) {
+    s.remove_prefix(2);
+    base = 16;
+  } else if (base == 0) {
+    base = s.size() > 1 && s[0] == '0' ? 8 : 10;
+  }
+  unsigned long long mag;
+  auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), mag, base);
+  if (ec == std::errc::invalid_argument) {
+    return strict_errc::invalid;
+  }
+  if (ec == std::errc::result_out_of_range) {
+    return strict_errc::out_of_range;
+  }
+  if (p != s.data() + s.size()) {
+    return strict_errc::trailing;
+  }
+  using U = std::make_unsigned_t<T>;
+  if constexpr (std::is_signed_v<T>) {
+    const U limit = neg ? U(std::numeric_limits<T>::max()) + 1 :
+			  U(std::numeric_limits<T>::max());
+    if (mag > limit) {
+      return strict_errc::out_of_range;
+    }
+    *out = neg ? T(U(0) - U(mag)) : T(mag);
+  } else {
+    if (neg && mag != 0) {
+      return strict_errc::negative;
+    }
+    if (mag > std::numeric_limits<T>::max()) {
+      return strict_errc::out_of_range;
+    }
+    *out = T(mag);
+  }
+  return strict_errc::ok;
+}
+
+template<typename T>
+strict_errc parse_floating(std::string_view str, T *out)
+{
+  std::string_view s = skip_space(str);
+  if (s.empty()) {
+    return strict_errc::empty;
   }
-  if (errno) {
-    *err = (std::string{"The option value '"} + std::string{str} +
+  bool neg;
+  if (!take_sign(&s, &neg)) {
+    return strict_errc::invalid;
+  }
+  T v;
+#if defined(__cpp_lib_to_chars)
+  auto fmt = std::chars_format::general;
+  if (hex_prefix(s) || (s.size() > 2 && s[0] == '0' &&
+			(s[1] == 'x' || s[1] == 'X') && s[2] == '.')) {
+    s.remove_prefix(2);
+    fmt = std::chars_format::hex;
+  }
+  auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), v, fmt);
+  if (ec == std::errc::invalid_argument) {
+    return strict_errc::invalid;
+  }
+  if (ec == std::errc::result_out_of_range) {
+    return strict_errc::out_of_range;
+  }
+  const bool rest = p != s.data() + s.size();
+#else
+  // strtod() needs the terminator; short values are copied to the stack
+  char buf[128];
+  std::string big;
+  const char *c;
+  if (s.size() < sizeof(buf)) {
+    s.copy(buf, s.size());
+    buf[s.size()] = '\0';
+    c = buf;
+  } else {
+    big.assign(s);
+    c = big.c_str();
+  }
+  if (*c == '+' || *c == '-' || isspace((unsigned char)*c)) {
+    return strict_errc::invalid;
+  }
+  char *end;
+  errno = 0;
+  if constexpr (std::is_same_v<T, float>) {
+    v = strtof(c, &end);
+  } else {
+    v = strtod(c, &end);
+  }
+  if (errno == ERANGE) {
+    return strict_errc::out_of_range;
+  }
+  if (end == c) {
+    return strict_errc::invalid;
+  }
+  const bool rest = *end != '\0';
+#endif
+  if (rest) {
+    return strict_errc::trailing;
+  }
+  *out = neg ? -v : v;
+  return strict_errc::ok;
+}
+
+/// the number in front of an IEC unit prefix
+std::string_view number_part(std::string_view str)
+{
+  return str.substr(0, str.find_first_not_of("0123456789-+"));
+}
+
+/// an SI unit is only ever the last letter, and B is left on
+std::string_view si_number_part(std::string_view str)
+{
+  if (str.find_first_not_of("0123456789+-") != std::string_view::npos &&
+      std::string_view("KMGTPE").find(str.back()) != std::string_view::npos) {
+    str.remove_suffix(1);
+  }
+  return str;
+}
+
+/// the message the std::string *err variants have always given for a
+/// number that doesn't parse
+std::string integer_message(strict_errc e, std::string_view str)
+{
+  if (e == strict_errc::out_of_range) {
+    return (std::string{"The option value '"} + std::string{str} +
 	    "' seems to be invalid");
+  }
+  return (std::string{"Expected option value to be integer, got '"} +
+	  std::string{str} + "'");
+}
+
+std::string floating_message(const char *func, const char *type,
+			     strict_errc e, std::string_view str)
+{
+  std::string m{func};
+  switch (e) {
+  case strict_errc::out_of_range:
+    m += ": floating point overflow or underflow parsing '";
+    break;
+  case strict_errc::trailing:
+    m += ": garbage at end of string. got: '";
+    break;
+  default:
+    m += ": expected ";
+    m += type;
+    m += ", got: '";
+  }
+  m += str;
+  m += "'";
+  return m;
+}
+
+/// the messages of strict_iec_cast() and strict_si_cast(); an error in
+/// the number itself quotes just that
+std::string unit_message(const char *func, const char *prefix_func,
+			 strict_errc e, std::string_view number)
+{
+  std::string m{func};
+  switch (e) {
+  case strict_errc::empty:
+    return m + ": value not specified";
+  case strict_errc::unit_bi:
+    return m + ": illegal prefix \"Bi\"";
+  case strict_errc::unit_too_long:
+    return m + ": illegal prefix (length > 2)";
+  case strict_errc::unit_unknown:
+    return std::string{prefix_func} + ": unit prefix not recognized";
+  case strict_errc::negative:
+    return m + ": value should not be negative";
+  case strict_errc::unit_too_large:
+    return m + ": the IEC prefix is too large for the designated type";
+  case strict_errc::too_small:
+    return m + ": value seems to be too small";
+  case strict_errc::too_large:
+    return m + ": value seems to be too large";
+  default:
+    return integer_message(e, number);
+  }
+}
+
+}
+
+template<typename T>
+strict_errc strict_parse(std::string_view str, T *out, int base)
+{
+  if constexpr (std::is_floating_point_v<T>) {
+    return parse_floating(str, out);
+  } else {
+    return parse_integer(str, out, base);
+  }
+}
+
+template strict_errc strict_parse<int>(std::string_view, int*, int);
+template strict_errc strict_parse<long>(std::string_view, long*, int);
+template strict_errc strict_parse<long long>(std::string_view, long long*, int);
+template strict_errc strict_parse<unsigned>(std::string_view, unsigned*, int);
+template strict_errc strict_parse<unsigned long>(std::string_view,
+						 unsigned long*, int);
+template strict_errc strict_parse<unsigned long long>(std::string_view,
+						      unsigned long long*, int);
+template strict_errc strict_parse<float>(std::string_view, float*, int);
+template strict_errc strict_parse<double>(std::string_view, double*, int);
+
+long long strict_strtoll(std::string_view str, int base, std::string *err)
+{
+  long long ret;
+  if (auto e = strict_parse(str, &ret, base); e != strict_errc::ok) {
+    *err = integer_message(e, str);
     return 0;
   }
   *err = "";
@@ -48,16 +279,13 @@ long long strict_strtoll(const char *str, int base, std::string *err)
 
 int strict_strtol(std::string_view str, int base, std::string *err)
 {
-  long long ret = strict_strtoll(str, base, err);
-  if (!err->empty())
-    return 0;
-  if ((ret < INT_MIN) || (ret > INT_MAX)) {
-    ostringstream errStr;
-    errStr << "The option value '" << str << "' seems to be invalid";
-    *err = errStr.str();
+  int ret;
+  if (auto e = strict_parse(str, &ret, base); e != strict_errc::ok) {
+    *err = integer_message(e, str);
     return 0;
   }
-  return static_cast<int>(ret);
+  *err = "";
+  return ret;
 }
 
 int strict_strtol(const char *str, int base, std::string *err)
@@ -67,28 +295,11 @@ int strict_strtol(const char *str, int base, std::string *err)
 
 double strict_strtod(std::string_view str, std::string *err)
 {
-  char *endptr;
-  errno = 0; /* To distinguish success/failure after call (see man page) */
-  double ret = strtod(str.data(), &endptr);
-  if (errno == ERANGE) {
-    ostringstream oss;
-    oss << "strict_strtod: floating point overflow or underflow parsing '"
-	<< str << "'";
-    *err = oss.str();
+  double ret;
+  if (auto e = strict_parse(str, &ret); e != strict_errc::ok) {
+    *err = floating_message("strict_strtod", "double", e, str);
     return 0.0;
   }
-  if (endptr == str) {
-    ostringstream oss;
-    oss << "strict_strtod: expected double, got: '" << str << "'";
-    *err = oss.str();
-    return 0;
-  }
-  if (*endptr != '\0') {
-    ostringstream oss;
-    oss << "strict_strtod: garbage at end of string. got: '" << str << "'";
-    *err = oss.str();
-    return 0;
-  }
   *err = "";
   return ret;
 }
@@ -100,28 +311,11 @@ double strict_strtod(const char *str, std::string *err)
 
 float strict_strtof(std::string_view str, std::string *err)
 {
-  char *endptr;
-  errno = 0; /* To distinguish success/failure after call (see man page) */
-  float ret = strtof(str.data(), &endptr);
-  if (errno == ERANGE) {
-    ostringstream oss;
-    oss << "strict_strtof: floating point overflow or underflow parsing '"
-	<< str << "'";
-    *err = oss.str();
+  float ret;
+  if (auto e = strict_parse(str, &ret); e != strict_errc::ok) {
+    *err = floating_message("strict_strtof", "float", e, str);
     return 0.0;
   }
-  if (endptr == str) {
-    ostringstream oss;
-    oss << "strict_strtof: expected float, got: '" << str << "'";
-    *err = oss.str();
-    return 0;
-  }
-  if (*endptr != '\0') {
-    ostringstream oss;
-    oss << "strict_strtof: garbage at end of string. got: '" << str << "'";
-    *err = oss.str();
-    return 0;
-  }
   *err = "";
   return ret;
 }
@@ -132,32 +326,24 @@ float strict_strtof(const char *str, std::string *err)
 }
 
 template<typename T>
-T strict_iec_cast(std::string_view str, std::string *err)
+strict_errc strict_iec_parse(std::string_view str, T *out)
 {
   if (str.empty()) {
-    *err = "strict_iecstrtoll: value not specified";
-    return 0;
+    return strict_errc::empty;
   }
   // get a view of the unit and of the value
-  std::string_view unit;
-  std::string_view n = str;
-  size_t u = str.find_first_not_of("0123456789-+");
+  std::string_view n = number_part(str);
+  std::string_view unit = str.substr(n.size());
   int m = 0;
   // deal with unit prefix is there is one
-  if (u != std::string_view::npos) {
-    n = str.substr(0, u);
-    unit = str.substr(u, str.length() - u);
+  if (!unit.empty()) {
     // we accept both old si prefixes as well as the proper iec prefixes
     // i.e. K, M, ... and Ki, Mi, ...
-    if (unit.back() == 'i') {
-      if (unit.front() == 'B') {
-        *err = "strict_iecstrtoll: illegal prefix \"Bi\"";
-        return 0;
-      }
+    if (unit.back() == 'i' && unit.front() == 'B') {
+      return strict_errc::unit_bi;
     }
     if (unit.length() > 2) {
-      *err = "strict_iecstrtoll: illegal prefix (length > 2)";
-      return 0;
+      return strict_errc::unit_too_long;
     }
     switch(unit.front()) {
       case 'K':
@@ -181,33 +367,50 @@ T strict_iec_cast(std::string_view str, std::string *err)
       case 'B':
         break;
       default:
-        *err = "strict_iecstrtoll: unit prefix not recognized";
-        return 0;
+        return strict_errc::unit_unknown;
     }
   }
 
-  long long ll = strict_strtoll(n, 10, err);
+  long long ll;
+  if (auto e = strict_parse(n, &ll, 10); e != strict_errc::ok) {
+    // a unit without a number
+    return e == strict_errc::empty ? strict_errc::invalid : e;
+  }
   if (ll < 0 && !std::numeric_limits<T>::is_signed) {
-    *err = "strict_iecstrtoll: value should not be negative";
-    return 0;
+    return strict_errc::negative;
   }
   if (static_cast<unsigned>(m) >= sizeof(T) * CHAR_BIT) {
-    *err = ("strict_iecstrtoll: the IEC prefix is too large for the designated "
-        "type");
-    return 0;
+    return strict_errc::unit_too_large;
   }
   using promoted_t = typename std::common_type<decltype(ll), T>::type;
   if (static_cast<promoted_t>(ll) <
       static_cast<promoted_t>(std::numeric_limits<T>::min()) >> m) {
-    *err = "strict_iecstrtoll: value seems to be too small";
-    return 0;
+    return strict_errc::too_small;
   }
   if (static_cast<promoted_t>(ll) >
       static_cast<promoted_t>(std::numeric_limits<T>::max()) >> m) {
-    *err = "strict_iecstrtoll: value seems to be too large";
+    return strict_errc::too_large;
+  }
+  *out = static_cast<promoted_t>(ll) * (promoted_t(1) << m);
+  return strict_errc::ok;
+}
+
+template strict_errc strict_iec_parse<int>(std::string_view, int*);
+template strict_errc strict_iec_parse<long>(std::string_view, long*);
+template strict_errc strict_iec_parse<long long>(std::string_view, long long*);
+template strict_errc strict_iec_parse<uint64_t>(std::string_view, uint64_t*);
+template strict_errc strict_iec_parse<uint32_t>(std::string_view, uint32_t*);
+
+template<typename T>
+T strict_iec_cast(std::string_view str, std::string *err)
+{
+  T ret;
+  if (auto e = strict_iec_parse(str, &ret); e != strict_errc::ok) {
+    *err = unit_message("strict_iecstrtoll", "strict_iecstrtoll", e,
+			number_part(str));
     return 0;
   }
-  return (ll << m);
+  return ret;
 }
 
 template int strict_iec_cast<int>(std::string_view str, std::string *err);
@@ -239,13 +442,12 @@ template uint64_t strict_iec_cast<uint64_t>(const char *str, std::string *err);
 template uint32_t strict_iec_cast<uint32_t>(const char *str, std::string *err);
 
 template<typename T>
-T strict_si_cast(std::string_view str, std::string *err)
+strict_errc strict_si_parse(std::string_view str, T *out)
 {
   if (str.empty()) {
-    *err = "strict_sistrtoll: value not specified";
-    return 0;
+    return strict_errc::empty;
   }
-  std::string_view n = str;
+  std::string_view n = si_number_part(str);
   int m = 0;
   // deal with unit prefix is there is one
   if (str.find_first_not_of("0123456789+-") != std::string_view::npos) {
@@ -263,31 +465,51 @@ T strict_si_cast(std::string_view str, std::string *err)
     else if (u == 'E')
       m = 18;
     else if (u != 'B') {
-      *err = "strict_si_cast: unit prefix not recognized";
-      return 0;
+      return strict_errc::unit_unknown;
     }
-
-    if (m >= 3)
-      n = str.substr(0, str.length() -1);
   }
 
-  long long ll = strict_strtoll(n, 10, err);
+  long long ll;
+  if (auto e = strict_parse(n, &ll, 10); e != strict_errc::ok) {
+    // a unit without a number
+    return e == strict_errc::empty ? strict_errc::invalid : e;
+  }
   if (ll < 0 && !std::numeric_limits<T>::is_signed) {
-    *err = "strict_sistrtoll: value should not be negative";
-    return 0;
+    return strict_errc::negative;
   }
   using promoted_t = typename std::common_type<decltype(ll), T>::type;
+  promoted_t scale = 1;
+  for (int i = 0; i < m; ++i) {
+    scale *= 10;
+  }
   if (static_cast<promoted_t>(ll) <
-      static_cast<promoted_t>(std::numeric_limits<T>::min()) / pow (10, m)) {
-    *err = "strict_sistrtoll: value seems to be too small";
-    return 0;
+      static_cast<promoted_t>(std::numeric_limits<T>::min()) / scale) {
+    return strict_errc::too_small;
   }
   if (static_cast<promoted_t>(ll) >
-      static_cast<promoted_t>(std::numeric_limits<T>::max()) / pow (10, m)) {
-    *err = "strict_sistrtoll: value seems to be too large";
+      static_cast<promoted_t>(std::numeric_limits<T>::max()) / scale) {
+    return strict_errc::too_large;
+  }
+  *out = static_cast<promoted_t>(ll) * scale;
+  return strict_errc::ok;
+}
+
+template strict_errc strict_si_parse<int>(std::string_view, int*);
+template strict_errc strict_si_parse<long>(std::string_view, long*);
+template strict_errc strict_si_parse<long long>(std::string_view, long long*);
+template strict_errc strict_si_parse<uint64_t>(std::string_view, uint64_t*);
+template strict_errc strict_si_parse<uint32_t>(std::string_view, uint32_t*);
+
+template<typename T>
+T strict_si_cast(std::string_view str, std::string *err)
+{
+  T ret;
+  if (auto e = strict_si_parse(str, &ret); e != strict_errc::ok) {
+    *err = unit_message("strict_sistrtoll", "strict_si_cast", e,
+			si_number_part(str));
     return 0;
   }
-  return (ll * pow (10,  m));
+  return ret;
 }
 
 template int strict_si_cast<int>(std::string_view str, std::string *err);
@@ -16,25 +16,76 @@
 #define CEPH_COMMON_STRTOL_H
 
 #include <string>
+#include <string_view>
+#include <type_traits>
 extern "C" {
 #include <stdint.h>
 }
 
+/* Why a strict parse failed.  The strict_*parse() functions return it
+ * and never allocate; the older ones below, which report a message
+ * through a std::string *err, are wrappers around them.
+ */
+enum class strict_errc : uint8_t {
+  ok = 0,
+  empty,          ///< nothing (but whitespace) to parse
+  invalid,        ///< not a number
+  trailing,       ///< a number with something after it
+  out_of_range,   ///< too large or small for the type
+  too_small,      ///< too small once scaled by its unit
+  too_large,      ///< too large once scaled by its unit
+  negative,       ///< below zero for an unsigned type
+  unit_unknown,   ///< not a unit prefix
+  unit_bi,        ///< "Bi"
+  unit_too_long,  ///< more than two letters
+  unit_too_large, ///< e.g. 'E' for a 32 bit type
+};
+
+/**
+ * parse all of str as a T, into *out only on success
+ *
+ * As strtoll() and strtod() would, leading whitespace and a '+' are
+ * accepted, and for integers in base 16 a "0x" prefix; base 0 picks 8,
+ * 10 or 16 from the prefix.  Floating point values may also be hex
+ * ("0x1p-3"), "inf" or "nan"; base is ignored for them.
+ */
+template<typename T>
+strict_errc strict_parse(std::string_view str, T *out, int base = 10);
+
+/// an integer with an optional IEC unit (K or Ki, M or Mi, ... E or Ei, or
+/// B for bytes), scaled by it
+template<typename T>
+strict_errc strict_iec_parse(std::string_view str, T *out);
+
+/// an integer with an optional SI unit (K, M, ... E, or B), scaled by it
+template<typename T>
+strict_errc strict_si_parse(std::string_view str, T *out);
+
+long long strict_strtoll(std::string_view str, int base, std::string *err);
 long long strict_strtoll(const char *str, int base, std::string *err);
 
+int strict_strtol(std::string_view str, int base, std::string *err);
 int strict_strtol(const char *str, int base, std::string *err);
 
+double strict_strtod(std::string_view str, std::string *err);
 double strict_strtod(const char *str, std::string *err);
 
+float strict_strtof(std::string_view str, std::string *err);
 float strict_strtof(const char *str, std::string *err);
 
+uint64_t strict_iecstrtoll(std::string_view str, std::string *err);
 uint64_t strict_iecstrtoll(const char *str, std::string *err);
 
+template<typename T>
+T strict_iec_cast(std::string_view str, std::string *err);
 template<typename T>
 T strict_iec_cast(const char *str, std::string *err);
 
+uint64_t strict_sistrtoll(std::string_view str, std::string *err);
 uint64_t strict_sistrtoll(const char *str, std::string *err);
 
+template<typename T>
+T strict_si_cast(std::string_view str, std::string *err);
 template<typename T>
 T strict_si_cast(const char *str, std::string *err);
 
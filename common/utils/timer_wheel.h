@@ -0,0 +1,122 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "common/ceph_time.h"
+
+namespace ceph {
+
+/* A hashed timer wheel, for a thread that runs things at times of its own
+ * choosing and would rather sleep than poll.
+ *
+ * Time is cut into ticks of a fixed length and each value waits in the
+ * slot of the first tick at or after its deadline, so values due within
+ * the same tick come out of one advance() together: a thread that sleeps
+ * until next() wakes once for all of them.  Deadlines further away than
+ * SLOTS ticks share slots with nearer ones and are passed over until their
+ * tick comes round.  add() is constant time; next() looks at each slot at
+ * most once.
+ *
+ * Not thread safe; the owner locks around it.
+ */
+template<typename T, typename Clock = ceph::mono_clock>
+class timer_wheel {
+public:
+  using time_point = typename Clock::time_point;
+  using duration = typename Clock::duration;
+  static constexpr std::size_t SLOTS = 256;
+
+  timer_wheel(duration tick, time_point origin)
+    : m_tick(tick), m_origin(origin) {}
+
+  /// queue v for the first tick at or after when
+  void add(time_point when, T v) {
+    uint64_t t = 0;
+    if (when > m_origin) {
+      t = (when - m_origin + m_tick - duration(1)) / m_tick;
+    }
+    if (t < m_now) {
+      t = m_now;
+    }
+    m_slots[t % SLOTS].push_back({t, std::move(v)});
+    ++m_size;
+  }
+
+  /// the start of the first tick anything waits for, if anything does
+  std::optional<time_point> next() const {
+    if (m_size == 0) {
+      return std::nullopt;
+    }
+    std::optional<uint64_t> first;
+    for (std::size_t i = 0; i < SLOTS; ++i) {
+      const uint64_t t = m_now + i;
+      for (const auto& e : m_slots[t % SLOTS]) {
+	if (e.tick == t) {
+	  return at(t);
+	}
+	if (!first || e.tick < *first) {
+	  first = e.tick;
+	}
+      }
+    }
+    return at(*first);
+  }
+
+  /// pass every value whose tick has started by now to f, in no
+  /// particular order; f must not add()
+  template<typename F>
+  void advance(time_point now, F&& f) {
+    if (now < at(m_now)) {
+      return;
+    }
+    const uint64_t last = (now - m_origin) / m_tick;
+    const uint64_t n = std::min<uint64_t>(last - m_now + 1, SLOTS);
+    for (uint64_t i = 0; i < n; ++i) {
+      auto& slot = m_slots[(m_now + i) % SLOTS];
+      for (std::size_t j = 0; j < slot.size(); ) {
+	if (slot[j].tick <= last) {
+	  T v = std::move(slot[j].value);
+	  slot[j] = std::move(slot.back());
+	  slot.pop_back();
+	  --m_size;
+	  f(std::move(v));
+	} else {
+	  ++j;
+	}
+      }
+    }
+    m_now = last + 1;
+  }
+
+  std::size_t size() const {
+    return m_size;
+  }
+  bool empty() const {
+    return m_size == 0;
+  }
+
+private:
+  struct entry {
+    uint64_t tick;
+    T value;
+  };
+
+  time_point at(uint64_t tick) const {
+    return m_origin + tick * m_tick;
+  }
+
+  const duration m_tick;
+  const time_point m_origin;
+  uint64_t m_now = 0;   ///< the first tick not yet advanced past
+  std::size_t m_size = 0;
+  std::array<std::vector<entry>, SLOTS> m_slots;
+};
+
+}
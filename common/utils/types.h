@@ -53,6 +53,7 @@ extern "C" {
 
 
 #include "include/unordered_map.h"
+#include "common/utils/print_budget.h"
 
 #include "object.h"
 #include "intarith.h"
@@ -133,26 +134,20 @@ inline std::ostream& operator<<(std::ostream& out, const std::pair<A,B>& v) {
 
 template<class A, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const std::vector<A,Alloc>& v) {
-  bool first = true;
   out << "[";
-  for (const auto& p : v) {
-    if (!first) out << ",";
-    out << p;
-    first = false;
-  }
+  ceph::print_elements(out, v, ",", [](std::ostream& o, const auto& p) {
+    o << p;
+  });
   out << "]";
   return out;
 }
 
 template<class A, std::size_t N, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const boost::container::small_vector<A,N,Alloc>& v) {
-  bool first = true;
   out << "[";
-  for (const auto& p : v) {
-    if (!first) out << ",";
-    out << p;
-    first = false;
-  }
+  ceph::print_elements(out, v, ",", [](std::ostream& o, const auto& p) {
+    o << p;
+  });
   out << "]";
   return out;
 }
@@ -160,10 +155,9 @@ inline std::ostream& operator<<(std::ostream& out, const boost::container::small
 template<class A, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const std::deque<A,Alloc>& v) {
   out << "<";
-  for (auto p = v.begin(); p != v.end(); ++p) {
-    if (p != v.begin()) out << ",";
-    out << *p;
-  }
+  ceph::print_elements(out, v, ",", [](std::ostream& o, const auto& p) {
+    o << p;
+  });
   out << ">";
   return out;
 }
@@ -181,34 +175,25 @@ inline std::ostream& operator<<(std::ostream& out, const std::tuple<Ts...> &t) {
 
 template<class A, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const std::list<A,Alloc>& ilist) {
-  for (auto it = ilist.begin();
-       it != ilist.end();
-       ++it) {
-    if (it != ilist.begin()) out << ",";
-    out << *it;
-  }
+  ceph::print_elements(out, ilist, ",", [](std::ostream& o, const auto& p) {
+    o << p;
+  });
   return out;
 }
 
 template<class A, class Comp, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const std::set<A, Comp, Alloc>& iset) {
-  for (auto it = iset.begin();
-       it != iset.end();
-       ++it) {
-    if (it != iset.begin()) out << ",";
-    out << *it;
-  }
+  ceph::print_elements(out, iset, ",", [](std::ostream& o, const auto& p) {
+    o << p;
+  });
   return out;
 }
 
 template<class A, class Comp, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const std::multiset<A,Comp,Alloc>& iset) {
-  for (auto it = iset.begin();
-       it != iset.end();
-       ++it) {
-    if (it != iset.begin()) out << ",";
-    out << *it;
-  }
+  ceph::print_elements(out, iset, ",", [](std::ostream& o, const auto& p) {
+    o << p;
+  });
   return out;
 }
 
@@ -216,12 +201,9 @@ template<class A, class B, class Comp, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const std::map<A,B,Comp,Alloc>& m)
 {
   out << "{";
-  for (auto it = m.begin();
-       it != m.end();
-       ++it) {
-    if (it != m.begin()) out << ",";
-    out << it->first << "=" << it->second;
-  }
+  ceph::print_elements(out, m, ",", [](std::ostream& o, const auto& p) {
+    o << p.first << "=" << p.second;
+  });
   out << "}";
   return out;
 }
@@ -230,12 +212,9 @@ template<class A, class B, class Comp, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const std::multimap<A,B,Comp,Alloc>& m)
 {
   out << "{{";
-  for (auto it = m.begin();
-       it != m.end();
-       ++it) {
-    if (it != m.begin()) out << ",";
-    out << it->first << "=" << it->second;
-  }
+  ceph::print_elements(out, m, ",", [](std::ostream& o, const auto& p) {
+    o << p.first << "=" << p.second;
+  });
   out << "}}";
   return out;
 }
@@ -254,23 +233,17 @@ inline std::ostream& operator<<(std::ostream& out, const boost::tuples::tuple<A,
 namespace container {
 template<class A, class Comp, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const boost::container::flat_set<A, Comp, Alloc>& iset) {
-  for (auto it = iset.begin();
-       it != iset.end();
-       ++it) {
-    if (it != iset.begin()) out << ",";
-    out << *it;
-  }
+  ceph::print_elements(out, iset, ",", [](std::ostream& o, const auto& p) {
+    o << p;
+  });
   return out;
 }
 
 template<class A, class B, class Comp, class Alloc>
 inline std::ostream& operator<<(std::ostream& out, const boost::container::flat_map<A, B, Comp, Alloc>& m) {
-  for (auto it = m.begin();
-       it != m.end();
-       ++it) {
-    if (it != m.begin()) out << ",";
-    out << it->first << "=" << it->second;
-  }
+  ceph::print_elements(out, m, ",", [](std::ostream& o, const auto& p) {
+    o << p.first << "=" << p.second;
+  });
   return out;
 }
 }
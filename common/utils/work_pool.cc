@@ -0,0 +1,204 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "work_pool.h"
+
+#include "common/ceph_assert.h"
+#include "common/perf_counters.h"
+
+namespace ceph {
+
+class work_pool::worker final : public Thread {
+public:
+  worker(work_pool *pool, unsigned id, std::string name)
+    : pool(pool), id(id), name(std::move(name)) {}
+
+  work_pool *const pool;
+  const unsigned id;
+  const std::string name;  ///< Thread::create() keeps the pointer
+
+  std::mutex lock;  ///< protects tasks, for thieves
+  std::deque<task> tasks;
+
+  std::atomic<uint64_t> run{0};
+  std::atomic<uint64_t> stolen{0};
+  std::atomic<uint64_t> idle{0};
+
+private:
+  void *entry() override {
+    pool->_run(*this);
+    return nullptr;
+  }
+};
+
+thread_local work_pool::worker *work_pool::t_worker = nullptr;
+
+work_pool::work_pool(std::string name, unsigned workers,
+		     ThreadPlacement placement)
+  : m_name(std::move(name))
+{
+  ceph_assert(workers > 0);
+  m_workers.reserve(workers);
+  for (unsigned i = 0; i < workers; ++i) {
+    auto& w = m_workers.emplace_back(
+      std::make_unique<worker>(this, i, m_name + std::to_string(i)));
+    if (!placement.empty()) {
+      w->set_placement(placement);
+    }
+  }
+}
+
+work_pool::~work_pool()
+{
+  stop();
+}
+
+void work_pool::start()
+{
+  for (auto& w : m_workers) {
+    if (!w->is_started()) {
+      w->create(w->name.c_str());
+    }
+  }
+}
+
+void work_pool::stop()
+{
+  {
+    std::lock_guard l(m_lock);
+    m_stop = true;
+    m_cond.notify_all();
+  }
+  for (auto& w : m_workers) {
+    if (w->is_started()) {
+      w->join();
+    }
+  }
+}
+
+void work_pool::submit(task t)
+{
+  worker *w = t_worker;
+  if (!w || w->pool != this) {
+    ceph_assert(!m_stop);
+    w = m_workers[m_next++ % m_workers.size()].get();
+  }
+  m_outstanding++;
+  {
+    // counted under the deque's lock, as taking a task uncounts it
+    std::lock_guard l(w->lock);
+    w->tasks.push_back(std::move(t));
+    m_queued++;
+  }
+  m_submitted.fetch_add(1, std::memory_order_relaxed);
+  if (m_perf) {
+    m_perf->inc(l_work_pool_submitted);
+  }
+  // a worker adds itself to m_sleepers before it looks at m_queued one
+  // last time, so either it sees the task or we see it
+  if (m_sleepers.load() > 0) {
+    std::lock_guard l(m_lock);
+    m_cond.notify_one();
+  }
+}
+
+void work_pool::drain()
+{
+  ceph_assert(!is_worker());
+  std::unique_lock l(m_lock);
+  m_cond_drained.wait(l, [this] { return m_outstanding.load() == 0; });
+}
+
+bool work_pool::is_worker() const
+{
+  return t_worker && t_worker->pool == this;
+}
+
+work_pool::stats work_pool::get_stats() const
+{
+  stats s;
+  s.submitted = m_submitted.load(std::memory_order_relaxed);
+  s.queued = m_queued.load(std::memory_order_relaxed);
+  for (auto& w : m_workers) {
+    s.run += w->run.load(std::memory_order_relaxed);
+    s.stolen += w->stolen.load(std::memory_order_relaxed);
+    s.idle += w->idle.load(std::memory_order_relaxed);
+  }
+  return s;
+}
+
+bool work_pool::_take(worker& w, task *t, bool *stolen)
+{
+  {
+    std::lock_guard l(w.lock);
+    if (!w.tasks.empty()) {
+      *t = std::move(w.tasks.back());
+      w.tasks.pop_back();
+      *stolen = false;
+      m_queued--;
+      return true;
+    }
+  }
+  const unsigned n = m_workers.size();
+  for (unsigned i = 1; i < n; ++i) {
+    worker& v = *m_workers[(w.id + i) % n];
+    std::lock_guard l(v.lock);
+    if (!v.tasks.empty()) {
+      *t = std::move(v.tasks.front());
+      v.tasks.pop_front();
+      *stolen = true;
+      m_queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void work_pool::_finish()
+{
+  if (--m_outstanding == 0) {
+    std::lock_guard l(m_lock);
+    m_cond_drained.notify_all();
+  }
+}
+
+void work_pool::_run(worker& w)
+{
+  t_worker = &w;
+  task t;
+  bool stolen;
+  while (true) {
+    if (_take(w, &t, &stolen)) {
+      t();
+      t = nullptr;
+      w.run.fetch_add(1, std::memory_order_relaxed);
+      if (stolen) {
+	w.stolen.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (m_perf) {
+	m_perf->inc(l_work_pool_run);
+	if (stolen) {
+	  m_perf->inc(l_work_pool_stolen);
+	}
+      }
+      _finish();
+      continue;
+    }
+    std::unique_lock l(m_lock);
+    m_sleepers++;
+    while (m_queued.load() == 0 && !m_stop) {
+      w.idle.fetch_add(1, std::memory_order_relaxed);
+      if (m_perf) {
+	m_perf->inc(l_work_pool_idle);
+      }
+      m_cond.wait(l);
+    }
+    m_sleepers--;
+    if (m_queued.load() == 0) {
+      break;
+    }
+  }
+  t_worker = nullptr;
+}
+
+}
@@ -0,0 +1,180 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_WORK_POOL_H
+#define CEPH_COMMON_WORK_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/Thread.h"
+
+class PerfCounters;
+
+enum {
+  l_work_pool_first = 67300,
+  l_work_pool_submitted,
+  l_work_pool_run,
+  l_work_pool_stolen,
+  l_work_pool_idle,
+  l_work_pool_last
+};
+
+namespace ceph {
+
+/* A pool of named worker threads for short tasks, each worker with a
+ * deque of its own.
+ *
+ * A task submitted from one of the workers goes on the back of that
+ * worker's deque, and a worker takes its own tasks from the back, newest
+ * first, while what they touch is still in its cache; tasks submitted
+ * from other threads are dealt to the workers in turn.  A worker with
+ * nothing of its own steals the oldest task from the front of another's
+ * deque before it sleeps, so a burst of tasks spawned by one spreads over
+ * the pool.
+ *
+ * Worker n is named <name><n>, so the thread_placement and thread_stack
+ * policies for "<name>*" apply to the workers, unless the pool is given a
+ * placement of its own.
+ *
+ * Tasks shouldn't block for long: a worker waiting on I/O or a lock is one
+ * fewer to run the rest.
+ */
+class work_pool {
+public:
+  using task = std::function<void()>;
+
+  struct stats {
+    uint64_t submitted = 0;
+    uint64_t run = 0;
+    uint64_t stolen = 0;  ///< run by another worker than the one queued on
+    uint64_t idle = 0;    ///< times a worker found nothing to do and slept
+    uint64_t queued = 0;  ///< waiting to run
+  };
+
+  /// with an empty placement, the thread_placement policy places workers
+  work_pool(std::string name, unsigned workers,
+	    ThreadPlacement placement = {});
+  work_pool(const work_pool&) = delete;
+  work_pool& operator=(const work_pool&) = delete;
+  ~work_pool();
+
+  void start();
+  /// run everything queued, including what that queues, then exit the
+  /// workers; nothing but the tasks may submit() once this is called
+  void stop();
+
+  void submit(task t);
+
+  /// wait until everything submitted so far, and whatever that submitted,
+  /// has run; not from a worker
+  void drain();
+
+  /**
+   * run f(i) for every i in [0, n) and return once all have
+   *
+   * The calling thread takes indexes along with the workers, so this may
+   * be called from a task, and it returns as soon as the indexes are done
+   * even if some workers never got round to helping.
+   */
+  template<typename F>
+  void parallel_for(std::size_t n, F&& f) {
+    if (n == 0) {
+      return;
+    }
+    auto s = std::make_shared<for_state>(n, std::function<void(std::size_t)>(
+					   std::forward<F>(f)));
+    const std::size_t helpers = std::min<std::size_t>(n - 1, get_workers());
+    for (std::size_t i = 0; i < helpers; ++i) {
+      submit([s] { s->run(); });
+    }
+    s->run();
+    std::unique_lock l(s->lock);
+    s->cond.wait(l, [&s] { return s->done == s->n; });
+  }
+
+  unsigned get_workers() const {
+    return m_workers.size();
+  }
+  /// the calling thread is one of this pool's workers
+  bool is_worker() const;
+
+  stats get_stats() const;
+
+  /// count into pc (l_work_pool_*); before start()
+  void set_perf_counters(PerfCounters *pc) {
+    m_perf = pc;
+  }
+
+private:
+  class worker;
+
+  struct for_state {
+    for_state(std::size_t n, std::function<void(std::size_t)> f)
+      : n(n), f(std::move(f)) {}
+    /// take indexes until there are none left
+    void run() {
+      std::size_t ran = 0;
+      for (std::size_t i = next++; i < n; i = next++) {
+	f(i);
+	++ran;
+      }
+      if (ran) {
+	std::lock_guard l(lock);
+	done += ran;
+	if (done == n) {
+	  cond.notify_all();
+	}
+      }
+    }
+    const std::size_t n;
+    const std::function<void(std::size_t)> f;
+    std::atomic<std::size_t> next{0};
+    std::mutex lock;
+    std::condition_variable cond;
+    std::size_t done = 0;
+  };
+
+  void _run(worker& w);
+  /// take a task, from the back of w's deque or the front of another's
+  bool _take(worker& w, task *t, bool *stolen);
+  void _finish();
+
+  static thread_local worker *t_worker;
+
+  const std::string m_name;
+  std::vector<std::unique_ptr<worker>> m_workers;
+  PerfCounters *m_perf = nullptr;
+
+  std::atomic<uint64_t> m_submitted{0};
+  std::atomic<uint64_t> m_queued{0};       ///< in the deques
+  std::atomic<uint64_t> m_outstanding{0};  ///< submitted and not yet run
+  std::atomic<unsigned> m_sleepers{0};
+  std::atomic<unsigned> m_next{0};         ///< deals outside submissions
+
+  std::mutex m_lock;  ///< sleeping workers and drain() wait on this
+  std::condition_variable m_cond;
+  std::condition_variable m_cond_drained;
+  std::atomic<bool> m_stop{false};
+};
+
+}
+
+#endif
@@ -0,0 +1,200 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * ceph-asok-scrape: send the same admin socket commands to every daemon on
+ * the host, once or every --interval, and print each reply as a line of
+ * JSON.  Sockets are found by scanning a directory (/var/run/ceph by
+ * default) for *.asok, each scrape, so daemons that start are picked up
+ * and ones that are gone dropped.  One process keeps a connection to each
+ * daemon (see admin_socket_idle_timeout) and has every daemon's command in
+ * flight at once, rather than a CLI exec, a connect and a wait per daemon
+ * per command.
+ */
+
+#include <dirent.h>
+#include <signal.h>
+#include <string.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "common/admin_socket_mux.h"
+#include "common/str_escape.h"
+
+static void usage()
+{
+  std::cout <<
+    "usage: ceph-asok-scrape [options] <command> [<command> ...]\n"
+    "  --dir <dir>         where the daemons' *.asok are\n"
+    "                      (default /var/run/ceph)\n"
+    "  --socket <path>     scrape this socket rather than --dir's; may be\n"
+    "                      given more than once\n"
+    "  --interval <secs>   scrape this often until killed (default once)\n"
+    "  --timeout <ms>      how long a daemon has to reply (default 10000)\n"
+    "  A command is a JSON object, sent as it is, or a command prefix\n"
+    "  such as 'perf dump', sent as {\"prefix\": \"perf dump\"}.  Each\n"
+    "  reply is printed as {\"socket\": ..., \"command\": ..., \"reply\": ...},\n"
+    "  or with \"error\" (a negative errno) in place of \"reply\".\n";
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handle_stop(int)
+{
+  stopping = 1;
+}
+
+/// the *.asok in dir
+static std::set<std::string> find_sockets(const std::string& dir)
+{
+  std::set<std::string> found;
+  DIR *d = ::opendir(dir.c_str());
+  if (!d) {
+    return found;
+  }
+  while (auto de = ::readdir(d)) {
+    std::string_view name(de->d_name);
+    if (name.size() > 5 && name.substr(name.size() - 5) == ".asok") {
+      found.insert(dir + "/" + de->d_name);
+    }
+  }
+  ::closedir(d);
+  return found;
+}
+
+static std::string quoted(std::string_view s)
+{
+  std::ostringstream ss;
+  ss << ceph::json_quoted(s);
+  return ss.str();
+}
+
+int main(int argc, const char **argv)
+{
+  std::string dir = "/var/run/ceph";
+  std::vector<std::string> sockets;
+  std::vector<std::string> commands;
+  std::chrono::seconds interval{0};
+  std::chrono::milliseconds timeout{10000};
+  for (int i = 1; i < argc; ++i) {
+    std::string_view a(argv[i]);
+    if (a == "-h" || a == "--help") {
+      usage();
+      return 0;
+    } else if (a == "--dir" && i + 1 < argc) {
+      dir = argv[++i];
+    } else if (a == "--socket" && i + 1 < argc) {
+      sockets.push_back(argv[++i]);
+    } else if (a == "--interval" && i + 1 < argc) {
+      interval = std::chrono::seconds(atoi(argv[++i]));
+    } else if (a == "--timeout" && i + 1 < argc) {
+      timeout = std::chrono::milliseconds(atoi(argv[++i]));
+    } else if (!a.empty() && a[0] != '-') {
+      commands.push_back(argv[i]);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (commands.empty()) {
+    usage();
+    return 1;
+  }
+
+  ceph::admin_socket_mux mux(timeout);
+  if (!mux.is_valid()) {
+    std::cerr << "ceph-asok-scrape: epoll_create1: " << strerror(errno)
+	      << std::endl;
+    return 1;
+  }
+  std::vector<std::pair<std::string, std::string>> requests; // as sent, shown
+  for (auto& c : commands) {
+    if (c[0] == '{') {
+      requests.emplace_back(c, quoted(c));
+    } else {
+      requests.emplace_back("{\"prefix\": " + quoted(c) + "}", quoted(c));
+    }
+  }
+
+  signal(SIGINT, handle_stop);
+  signal(SIGTERM, handle_stop);
+  std::set<std::string> scraped;
+  std::string line;
+  while (!stopping) {
+    const auto start = std::chrono::steady_clock::now();
+    std::set<std::string> now;
+    if (sockets.empty()) {
+      now = find_sockets(dir);
+    } else {
+      now.insert(sockets.begin(), sockets.end());
+    }
+    for (auto& s : scraped) {
+      if (!now.count(s)) {
+	mux.close(s);
+      }
+    }
+    scraped = std::move(now);
+    for (auto& s : scraped) {
+      const std::string shown = quoted(s);
+      for (auto& [request, command] : requests) {
+	mux.send(s, request,
+		 [&line, shown, command=command](int r, std::string reply) {
+	  line = "{\"socket\": " + shown + ", \"command\": " + command;
+	  if (r < 0) {
+	    line += ", \"error\": " + std::to_string(r) + "}\n";
+	  } else if (!reply.empty() && (reply[0] == '{' || reply[0] == '[')) {
+	    line += ", \"reply\": ";
+	    // one line each, for jq and the like
+	    for (char c : reply) {
+	      if (c != '\n') {
+		line.push_back(c);
+	      }
+	    }
+	    line += "}\n";
+	  } else {
+	    // a message rather than JSON
+	    line += ", \"reply\": " + quoted(reply) + "}\n";
+	  }
+	  fwrite(line.data(), 1, line.size(), stdout);
+	});
+      }
+    }
+    while (!stopping && mux.pending()) {
+      if (int r = mux.poll(std::chrono::milliseconds(100)); r < 0) {
+	std::cerr << "ceph-asok-scrape: epoll_wait: " << strerror(-r)
+		  << std::endl;
+	return 1;
+      }
+    }
+    fflush(stdout);
+    if (interval.count() == 0) {
+      break;
+    }
+    const auto next = start + interval;
+    while (!stopping && std::chrono::steady_clock::now() < next) {
+      std::this_thread::sleep_for(std::min<std::chrono::milliseconds>(
+	std::chrono::duration_cast<std::chrono::milliseconds>(
+	  next - std::chrono::steady_clock::now()),
+	std::chrono::milliseconds(100)));
+    }
+  }
+  return 0;
+}
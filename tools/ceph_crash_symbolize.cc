@@ -0,0 +1,436 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * ceph-crash-symbolize: turn the raw dump a daemon left in a crash_dir
+ * entry (crash_dump_raw = true) into the meta file the signal handler would
+ * otherwise have written, resolving the backtrace with addr2line against
+ * the modules that were mapped, and mark the entry done.  With --print,
+ * show what the dump holds instead.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/global/crash_dump.h"
+
+using namespace ceph::crash_dump;
+
+static void usage()
+{
+  std::cout << "usage: ceph-crash-symbolize [--print] <crash dir entry>...\n"
+	    << "  Write the meta file for a crash_dir entry from the raw dump\n"
+	    << "  left there with crash_dump_raw = true, and mark it done.\n"
+	    << "  Run it on the host that crashed, with the same binaries\n"
+	    << "  installed.  With --print, show the dump on stdout instead.\n";
+}
+
+struct mapping {
+  uint64_t start, end, offset;
+  bool exec;
+  std::string path;
+};
+
+struct dump {
+  header h;
+  std::string meta;
+  std::vector<uint64_t> frames;
+  std::string registers;
+  uint64_t stack_start = 0;
+  std::string stack;
+  std::vector<int32_t> threads;
+  std::vector<mapping> maps;
+  std::string recent_file;
+};
+
+static std::vector<mapping> parse_maps(std::string_view s)
+{
+  std::vector<mapping> maps;
+  while (!s.empty()) {
+    auto eol = s.find('\n');
+    std::string line(s.substr(0, eol));
+    s.remove_prefix(eol == s.npos ? s.size() : eol + 1);
+    mapping m;
+    char perms[8];
+    int path_at = 0;
+    if (sscanf(line.c_str(), "%" SCNx64 "-%" SCNx64 " %7s %" SCNx64
+	       " %*s %*s %n", &m.start, &m.end, perms, &m.offset,
+	       &path_at) < 4) {
+      continue;
+    }
+    m.exec = perms[2] == 'x';
+    if (path_at > 0) {
+      m.path = line.substr(path_at);
+    }
+    maps.push_back(std::move(m));
+  }
+  return maps;
+}
+
+static int read_dump(const std::string& fn, dump *d)
+{
+  int fd = ::open(fn.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    return -errno;
+  }
+  std::string buf;
+  char chunk[65536];
+  ssize_t r;
+  while ((r = ::read(fd, chunk, sizeof(chunk))) > 0) {
+    buf.append(chunk, r);
+  }
+  int err = r < 0 ? -errno : 0;
+  ::close(fd);
+  if (err < 0) {
+    return err;
+  }
+  if (buf.size() < sizeof(header)) {
+    return -EINVAL;
+  }
+  memcpy(&d->h, buf.data(), sizeof(header));
+  if (d->h.magic != MAGIC || d->h.header_size < sizeof(header) ||
+      d->h.header_size > buf.size()) {
+    return -EINVAL;
+  }
+  // a dump cut short by a second fault is still worth what it has
+  std::string_view p(buf);
+  p.remove_prefix(d->h.header_size);
+  while (p.size() >= sizeof(section)) {
+    section s;
+    memcpy(&s, p.data(), sizeof(s));
+    p.remove_prefix(sizeof(s));
+    std::string_view payload = p.substr(0, s.len);
+    p.remove_prefix(std::min<uint64_t>(p.size(), (s.len + 7) & ~7ull));
+    switch (s.type) {
+    case SECTION_META:
+      d->meta = payload;
+      break;
+    case SECTION_FRAMES:
+      d->frames.resize(payload.size() / sizeof(uint64_t));
+      memcpy(d->frames.data(), payload.data(),
+	     d->frames.size() * sizeof(uint64_t));
+      break;
+    case SECTION_REGISTERS:
+      d->registers = payload;
+      break;
+    case SECTION_STACK:
+      if (payload.size() >= sizeof(uint64_t)) {
+	memcpy(&d->stack_start, payload.data(), sizeof(uint64_t));
+	d->stack = payload.substr(sizeof(uint64_t));
+      }
+      break;
+    case SECTION_THREADS:
+      d->threads.resize(payload.size() / sizeof(int32_t));
+      memcpy(d->threads.data(), payload.data(),
+	     d->threads.size() * sizeof(int32_t));
+      break;
+    case SECTION_MAPS:
+      d->maps = parse_maps(payload);
+      break;
+    case SECTION_RECENT_FILE:
+      d->recent_file = payload;
+      break;
+    }
+  }
+  return d->meta.empty() ? -EINVAL : 0;
+}
+
+static const mapping *find_mapping(const dump& d, uint64_t addr)
+{
+  for (const auto& m : d.maps) {
+    if (addr >= m.start && addr < m.end) {
+      return &m;
+    }
+  }
+  return nullptr;
+}
+
+/// addr, as addr2line wants it for the module it is in
+static uint64_t module_address(const dump& d, const mapping& m, uint64_t addr)
+{
+  // a non-PIE executable is linked at the addresses it runs at
+  int fd = ::open(m.path.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd >= 0) {
+    uint16_t e_type = 0;
+    bool exec = ::pread(fd, &e_type, sizeof(e_type), 16) == sizeof(e_type) &&
+      e_type == 2;  // ET_EXEC
+    ::close(fd);
+    if (exec) {
+      return addr;
+    }
+  }
+  // otherwise relative to where its first segment was mapped
+  uint64_t base = m.start - m.offset;
+  for (const auto& o : d.maps) {
+    if (o.path == m.path && o.offset == 0) {
+      base = o.start;
+      break;
+    }
+  }
+  return addr - base;
+}
+
+static std::string shell_quote(const std::string& s)
+{
+  std::string q = "'";
+  for (char c : s) {
+    if (c == '\'') {
+      q += "'\\''";
+    } else {
+      q += c;
+    }
+  }
+  return q + "'";
+}
+
+/// a line per frame, as backtrace_symbols() has them, plus the source line
+/// where addr2line knows it
+static std::vector<std::string> symbolize(const dump& d)
+{
+  std::vector<std::string> lines(d.frames.size());
+  // frame indices by module, to run addr2line once per module
+  std::map<std::string, std::vector<std::pair<size_t, uint64_t>>> by_module;
+  for (size_t i = 0; i < d.frames.size(); ++i) {
+    char addr[32];
+    snprintf(addr, sizeof(addr), "[0x%" PRIx64 "]", d.frames[i]);
+    lines[i] = addr;
+    const mapping *m = find_mapping(d, d.frames[i]);
+    if (!m || m->path.empty() || m->path[0] != '/') {
+      continue;
+    }
+    lines[i] = m->path + "() " + addr;
+    // a return address is just past the call
+    by_module[m->path].emplace_back(
+      i, module_address(d, *m, d.frames[i]) - (i ? 1 : 0));
+  }
+  for (const auto& [path, frames] : by_module) {
+    std::string cmd = "addr2line -C -f -e " + shell_quote(path);
+    for (const auto& [i, addr] : frames) {
+      char a[32];
+      snprintf(a, sizeof(a), " 0x%" PRIx64, addr);
+      cmd += a;
+    }
+    FILE *f = popen(cmd.c_str(), "r");
+    if (!f) {
+      continue;
+    }
+    char func[4096], where[4096];
+    for (const auto& [i, addr] : frames) {
+      if (!fgets(func, sizeof(func), f) || !fgets(where, sizeof(where), f)) {
+	break;
+      }
+      func[strcspn(func, "\n")] = 0;
+      where[strcspn(where, "\n")] = 0;
+      char a[32];
+      snprintf(a, sizeof(a), "[0x%" PRIx64 "]", d.frames[i]);
+      lines[i] = path + "(" + (strcmp(func, "??") ? func : "") + ") " + a;
+      if (strncmp(where, "??", 2) != 0) {
+	lines[i] += std::string(" at ") + where;
+      }
+    }
+    pclose(f);
+  }
+  return lines;
+}
+
+static std::string json_string(std::string_view s)
+{
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char u[8];
+      snprintf(u, sizeof(u), "\\u%04x", (unsigned char)c);
+      out += u;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static int write_meta(const std::string& dir, const dump& d)
+{
+  std::string meta = "{" + d.meta + ",\n    \"backtrace\": [";
+  const char *sep = "\n        ";
+  for (const auto& line : symbolize(d)) {
+    meta += sep + json_string(line);
+    sep = ",\n        ";
+  }
+  meta += "\n    ]\n}\n";
+
+  const std::string tmp = dir + "/meta.tmp";
+  int fd = ::open(tmp.c_str(), O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return -errno;
+  }
+  ssize_t r = ::write(fd, meta.data(), meta.size());
+  int err = r < 0 ? -errno : ((size_t)r < meta.size() ? -EIO : 0);
+  if (::close(fd) < 0 && !err) {
+    err = -errno;
+  }
+  if (!err && ::rename(tmp.c_str(), (dir + "/meta").c_str()) < 0) {
+    err = -errno;
+  }
+  if (err) {
+    ::unlink(tmp.c_str());
+    return err;
+  }
+  fd = ::creat((dir + "/done").c_str(), 0444);
+  if (fd < 0) {
+    return -errno;
+  }
+  ::close(fd);
+  return 0;
+}
+
+static void print_registers(const dump& d)
+{
+  struct utsname u;
+  if (uname(&u) < 0 || strncmp(u.machine, d.h.machine, sizeof(d.h.machine)) ||
+      d.registers.size() < sizeof(mcontext_t)) {
+    std::cout << "registers: " << d.registers.size() << " bytes from "
+	      << std::string_view(d.h.machine, strnlen(d.h.machine,
+						       sizeof(d.h.machine)))
+	      << ", not decoded here\n";
+    return;
+  }
+  mcontext_t mc;
+  memcpy(&mc, d.registers.data(), sizeof(mc));
+  std::cout << "registers:\n";
+  auto reg = [](const char *name, uint64_t v) {
+    printf("  %-6s 0x%016" PRIx64 "\n", name, v);
+  };
+  std::cout.flush();
+#if defined(__linux__) && defined(__x86_64__)
+  static const char *names[] = {
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rdi", "rsi",
+    "rbp", "rbx", "rdx", "rax", "rcx", "rsp", "rip", "eflags", "csgsfs",
+    "err", "trapno", "oldmask", "cr2"
+  };
+  for (size_t i = 0; i < std::size(names) && i < NGREG; ++i) {
+    reg(names[i], mc.gregs[i]);
+  }
+#elif defined(__linux__) && defined(__aarch64__)
+  for (int i = 0; i < 31; ++i) {
+    char name[8];
+    snprintf(name, sizeof(name), "x%d", i);
+    reg(name, mc.regs[i]);
+  }
+  reg("sp", mc.sp);
+  reg("pc", mc.pc);
+  reg("pstate", mc.pstate);
+#else
+  (void)reg;
+  (void)mc;
+#endif
+  fflush(stdout);
+}
+
+static void print_dump(const std::string& dir, const dump& d)
+{
+  std::cout << dir << ":\n"
+	    << "pid " << d.h.pid << " thread " << d.h.tid << " signal "
+	    << d.h.signum << " (" << strsignal(d.h.signum) << ") code "
+	    << d.h.si_code << " address 0x" << std::hex << d.h.fault_addr
+	    << std::dec << "\n";
+  std::cout << "backtrace:\n";
+  auto lines = symbolize(d);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    std::cout << " " << i + 1 << ": " << lines[i] << "\n";
+  }
+  if (!d.registers.empty()) {
+    print_registers(d);
+  }
+  std::cout << "threads:";
+  for (auto tid : d.threads) {
+    std::cout << " " << tid;
+  }
+  std::cout << "\nstack from 0x" << std::hex << d.stack_start << std::dec
+	    << " (" << d.stack.size() << " bytes):\n";
+  std::cout.flush();
+  for (size_t off = 0; off + 8 <= d.stack.size(); off += 8) {
+    uint64_t v;
+    memcpy(&v, d.stack.data() + off, sizeof(v));
+    printf("  0x%016" PRIx64 ": 0x%016" PRIx64, d.stack_start + off, v);
+    // code addresses are what is interesting on a stack
+    const mapping *m = find_mapping(d, v);
+    if (m && m->exec) {
+      printf("  %s+0x%" PRIx64, m->path.c_str(), module_address(d, *m, v));
+    }
+    printf("\n");
+  }
+  fflush(stdout);
+  if (!d.recent_file.empty()) {
+    std::cout << "recent log ring: " << d.recent_file
+	      << " (ceph-log-decode --recent)\n";
+  }
+}
+
+int main(int argc, const char **argv)
+{
+  bool print = false;
+  std::vector<std::string> dirs;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--print")) {
+      print = true;
+    } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+      usage();
+      return 0;
+    } else {
+      dirs.push_back(argv[i]);
+    }
+  }
+  if (dirs.empty()) {
+    usage();
+    return 1;
+  }
+  int ret = 0;
+  for (const auto& dir : dirs) {
+    dump d;
+    int r = read_dump(dir + "/dump", &d);
+    if (r < 0) {
+      std::cerr << "ceph-crash-symbolize: " << dir << "/dump: "
+		<< (r == -EINVAL ? "not a crash dump" : strerror(-r))
+		<< std::endl;
+      ret = 1;
+      continue;
+    }
+    if (print) {
+      print_dump(dir, d);
+      continue;
+    }
+    r = write_meta(dir, d);
+    if (r < 0) {
+      std::cerr << "ceph-crash-symbolize: " << dir << "/meta: "
+		<< strerror(-r) << std::endl;
+      ret = 1;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,337 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * ceph-log-agent: drain the log_shm_ring of every daemon on the host into
+ * a log_format=binary file per daemon, optionally compressed, so that the
+ * daemons' log threads only copy entries into shared memory.  Rings are
+ * found by scanning a directory (/dev/shm by default) for *.logring files;
+ * a ring whose daemon closed it or is gone is drained one last time and
+ * removed.  Render the output with ceph-log-decode (after zstdcat or
+ * lz4cat if compressed).
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "common/logging/BinaryLog.h"
+#include "common/logging/LogCompressor.h"
+
+using namespace ceph::logging;
+
+static void usage()
+{
+  std::cout <<
+    "usage: ceph-log-agent [options]\n"
+    "  --rings <dir>        where the daemons' log_shm_ring files are\n"
+    "                       (default /dev/shm)\n"
+    "  --out <dir>          write <ring name>.log here (default .)\n"
+    "  --compression <type> zstd or lz4 frames, like log_compression\n"
+    "                       (default none)\n"
+    "  --level <n>          compression level (default 0, the library's)\n"
+    "  --interval <ms>      how often to drain the rings (default 100)\n"
+    "  --once               drain what is there and exit\n";
+}
+
+static constexpr std::string_view RING_SUFFIX = ".logring";
+/// output buffered per ring before a write (and a compressed frame)
+static constexpr std::size_t OUT_BUF = 1 << 20;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handle_stop(int)
+{
+  stopping = 1;
+}
+
+struct Options {
+  std::string rings = "/dev/shm";
+  std::string out = ".";
+  std::string compression;
+  int level = 0;
+  std::chrono::milliseconds interval{100};
+};
+
+class Ring {
+public:
+  Ring(std::string path, std::string name, ino_t ino)
+    : path(std::move(path)), name(std::move(name)), ino(ino) {}
+  ~Ring() {
+    _write();
+    if (header) {
+      ::munmap(header, map_len);
+    }
+    if (out_fd >= 0) {
+      ::close(out_fd);
+    }
+  }
+
+  std::string path;
+  std::string name; ///< of the ring file, without RING_SUFFIX
+  ino_t ino;
+
+  /// map the ring; false if it isn't one (yet)
+  bool open(const Options& opts) {
+    int fd = ::open(path.c_str(), O_RDWR|O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 &&
+	(std::size_t)st.st_size > sizeof(binary::shm_ring_header)) {
+      p = ::mmap(nullptr, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    auto h = static_cast<binary::shm_ring_header*>(p);
+    if (h->magic != binary::SHM_MAGIC || h->version != binary::SHM_VERSION ||
+	h->header_size + h->ring_size != (uint64_t)st.st_size ||
+	(h->ring_size & (h->ring_size - 1))) {
+      // not a ring, or one still being set up
+      ::munmap(p, st.st_size);
+      return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    header = h;
+    data = static_cast<char*>(p) + h->header_size;
+    map_len = st.st_size;
+
+    const std::string out_path = opts.out + "/" + name + ".log";
+    out_fd = ::open(out_path.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+      std::cerr << "ceph-log-agent: " << out_path << ": " << strerror(errno)
+		<< std::endl;
+      return false;
+    }
+    if (!opts.compression.empty()) {
+      std::string err;
+      compressor = LogCompressor::create(opts.compression, opts.level, &err);
+    }
+    return true;
+  }
+
+  /// copy out every complete record; returns those copied
+  uint64_t drain() {
+    const uint64_t size = header->ring_size;
+    const uint64_t head = header->head.load(std::memory_order_acquire);
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    uint64_t n = 0;
+    while (tail < head) {
+      const char *p = data + (tail & (size - 1));
+      uint32_t magic;
+      memcpy(&magic, p, sizeof(magic));
+      if (magic == binary::SHM_WRAP_MAGIC) {
+	tail += size - (tail & (size - 1));
+	continue;
+      }
+      binary::record_header h;
+      memcpy(&h, p, sizeof(h));
+      if (h.magic != binary::RECORD_MAGIC ||
+	  binary::shm_record_size(h.len) > head - tail) {
+	// nothing the writer would leave; give up on what is there
+	std::cerr << "ceph-log-agent: " << path << ": corrupt record"
+		  << std::endl;
+	tail = head;
+	break;
+      }
+      buf.append(p, sizeof(h) + h.len);
+      tail += binary::shm_record_size(h.len);
+      ++n;
+      if (buf.size() >= OUT_BUF) {
+	// let the writer reuse the space while this is written
+	header->tail.store(tail, std::memory_order_release);
+	_write();
+      }
+    }
+    header->tail.store(tail, std::memory_order_release);
+
+    const uint64_t dropped = header->dropped.load(std::memory_order_relaxed);
+    if (dropped != dropped_reported) {
+      char msg[96];
+      snprintf(msg, sizeof(msg),
+	       "--- %" PRIu64 " log entries dropped while the agent was behind ---",
+	       dropped - dropped_reported);
+      auto h = binary::make_message_header(msg);
+      buf.append(reinterpret_cast<const char*>(&h), sizeof(h));
+      buf.append(msg);
+      dropped_reported = dropped;
+    }
+    _write();
+    return n;
+  }
+
+  /// the writer closed the ring or exited
+  bool done() const {
+    if (header->closed.load(std::memory_order_acquire)) {
+      return true;
+    }
+    return ::kill(header->pid, 0) < 0 && errno == ESRCH;
+  }
+
+private:
+  void _write() {
+    if (buf.empty() || out_fd < 0) {
+      buf.clear();
+      return;
+    }
+    std::string_view out = buf;
+    if (compressor && compressor->compress(buf, cbuf) == 0) {
+      out = std::string_view(cbuf.data(), cbuf.size());
+    }
+    while (!out.empty()) {
+      ssize_t r = ::write(out_fd, out.data(), out.size());
+      if (r < 0) {
+	if (errno == EINTR) {
+	  continue;
+	}
+	std::cerr << "ceph-log-agent: " << name << ": write: "
+		  << strerror(errno) << std::endl;
+	break;
+      }
+      out.remove_prefix(r);
+    }
+    buf.clear();
+  }
+
+  binary::shm_ring_header *header = nullptr;
+  char *data = nullptr;
+  std::size_t map_len = 0;
+  int out_fd = -1;
+  std::unique_ptr<LogCompressor> compressor;
+  std::string buf;
+  LogBuffer cbuf;
+  uint64_t dropped_reported = 0;
+};
+
+/// map any ring in opts.rings not mapped yet; rings are keyed by inode, as
+/// a restarted daemon replaces its file with a new one
+static void scan(const Options& opts, std::map<ino_t, std::unique_ptr<Ring>>& rings)
+{
+  DIR *dir = ::opendir(opts.rings.c_str());
+  if (!dir) {
+    return;
+  }
+  while (struct dirent *de = ::readdir(dir)) {
+    std::string_view fn = de->d_name;
+    if (fn.size() <= RING_SUFFIX.size() ||
+	fn.substr(fn.size() - RING_SUFFIX.size()) != RING_SUFFIX) {
+      continue;
+    }
+    if (rings.count(de->d_ino)) {
+      continue;
+    }
+    auto r = std::make_unique<Ring>(
+      opts.rings + "/" + std::string(fn),
+      std::string(fn.substr(0, fn.size() - RING_SUFFIX.size())), de->d_ino);
+    if (r->open(opts)) {
+      rings.emplace(de->d_ino, std::move(r));
+    }
+  }
+  ::closedir(dir);
+}
+
+int main(int argc, const char **argv)
+{
+  Options opts;
+  bool once = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> const char* {
+      if (i + 1 >= argc) {
+	std::cerr << "missing value for " << arg << std::endl;
+	exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--rings") {
+      opts.rings = next();
+    } else if (arg == "--out") {
+      opts.out = next();
+    } else if (arg == "--compression") {
+      opts.compression = next();
+      if (opts.compression == "none") {
+	opts.compression.clear();
+      }
+    } else if (arg == "--level") {
+      opts.level = atoi(next());
+    } else if (arg == "--interval") {
+      opts.interval = std::chrono::milliseconds(std::max(atoi(next()), 1));
+    } else if (arg == "--once") {
+      once = true;
+    } else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      usage();
+      return 1;
+    }
+  }
+  if (!opts.compression.empty()) {
+    std::string err;
+    if (!LogCompressor::create(opts.compression, opts.level, &err)) {
+      std::cerr << "ceph-log-agent: " << err << std::endl;
+      return 1;
+    }
+  }
+
+  signal(SIGINT, handle_stop);
+  signal(SIGTERM, handle_stop);
+
+  std::map<ino_t, std::unique_ptr<Ring>> rings;
+  while (true) {
+    scan(opts, rings);
+    for (auto i = rings.begin(); i != rings.end(); ) {
+      auto& r = *i->second;
+      // checked first: whatever it wrote before closing is drained below
+      const bool done = r.done();
+      r.drain();
+      struct stat st;
+      const bool replaced = ::stat(r.path.c_str(), &st) < 0 ||
+	st.st_ino != r.ino;
+      if (done || replaced) {
+	if (!replaced) {
+	  ::unlink(r.path.c_str());
+	}
+	i = rings.erase(i);
+      } else {
+	++i;
+      }
+    }
+    if (once || stopping) {
+      break;
+    }
+    std::this_thread::sleep_for(opts.interval);
+  }
+  return 0;
+}
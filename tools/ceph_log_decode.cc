@@ -0,0 +1,902 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * ceph-log-decode: render a log_format=binary log file in the same text
+ * layout the log would have written with log_format=text, or, with
+ * --recent, the entries in a log_recent_file as dump_recent() would have.
+ *
+ * A log file given by name is mapped and cut into chunks, at the records
+ * its log_file.idx points to if there is one, which a pool of threads
+ * decodes and formats at once; the chunks are written out in file order,
+ * so the output is what a single pass would have made.  Several files are
+ * merged into one stream in timestamp order.  The filters are applied
+ * before an entry is formatted, and with an index whole chunks they rule
+ * out are never read.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "common/inline_memory.h"
+#include "common/logging/BinaryLog.h"
+#include "log_file_util.h"
+
+using namespace ceph::logging;
+
+static void usage()
+{
+  std::cout << "usage: ceph-log-decode [options] [<file>...|-]\n"
+	    << "       ceph-log-decode --recent <file>\n"
+	    << "  Decode binary Ceph log files (log_format = binary) to text\n"
+	    << "  on stdout.  Reads stdin if no file or '-' is given.  The\n"
+	    << "  entries of several files are merged in timestamp order.\n"
+	    << "  With --recent, dump the entries kept in a log_recent_file,\n"
+	    << "  e.g. one left behind by a process that was killed.\n"
+	    << "  --threads <n>         decode with n threads (default: one\n"
+	    << "                        per cpu)\n"
+	    << "  --from <time>         entries at or after time\n"
+	    << "  --to <time>           entries at or before time\n"
+	    << "  --subsys <name>[,..]  entries of these subsystems\n"
+	    << "  --thread <hex>        entries of this thread\n"
+	    << "  --level <n>           entries at debug level n or below\n"
+	    << "  --index <file>        index to use (default <file>.idx)\n"
+	    << "  Times are 'YYYY-MM-DD HH:MM:SS[.frac]' in local time, as\n"
+	    << "  the log writes them.  The log's own lines go with the\n"
+	    << "  entry before them.  A compressed log (log_compression) is\n"
+	    << "  read from stdin, e.g. 'zstdcat <file> | ceph-log-decode'.\n";
+}
+
+/// --from, --to, --subsys, --thread and --level
+struct Filter {
+  uint64_t from = 0;
+  uint64_t to = UINT64_MAX;
+  bool any_subsys = true;
+  uint64_t subsys[2] = {0, 0};
+  bool any_thread = true;
+  uint64_t thread = 0;
+  int max_prio = INT_MAX;
+
+  bool want(const binary::record_header& h) const {
+    return h.stamp >= from && h.stamp <= to &&
+      (any_subsys ||
+       (h.subsys < 128 && (subsys[h.subsys / 64] >> (h.subsys % 64)) & 1)) &&
+      (any_thread || h.thread == thread) && h.prio <= max_prio;
+  }
+  bool want_chunk(const binary::index_record& r) const {
+    return r.last >= from && r.first <= to &&
+      (any_subsys || (r.subsys[0] & subsys[0]) || (r.subsys[1] & subsys[1]));
+  }
+};
+
+/// a record a tracking Decoder has rendered, so that its text can be
+/// placed after the fact
+struct Item {
+  uint64_t stamp;   ///< of the entry, or of the one before a message; 0 if none
+  uint32_t at;      ///< of the record, from the decoder's base
+  uint32_t end;     ///< of its text in out
+  uint32_t after;   ///< a message's entry before it, from base, or NONE
+  bool message;
+  bool after_kept;  ///< that entry passed the filter
+};
+
+class Decoder {
+public:
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  /// with a base, every record rendered gets an Item, and messages are
+  /// rendered whatever the filter made of the entry before them, for the
+  /// caller to sort out; without one they go or stay with that entry
+  explicit Decoder(const Filter& filter, const char *base = nullptr)
+    : filter(filter), base(base) {}
+
+  /// consume as many complete records starting before until, and in
+  /// [p, end), as possible
+  const char *decode(const char *p, const char *until, const char *end) {
+    while (p < until && end - p >= (ssize_t)sizeof(binary::record_header)) {
+      binary::record_header h;
+      memcpy(&h, p, sizeof(h));
+      if (h.magic != binary::RECORD_MAGIC) {
+	// torn record or preallocated space; find the next record
+	++p;
+	++skipped;
+	continue;
+      }
+      if ((std::size_t)(end - p) < sizeof(h) + h.len) {
+	break;
+      }
+      record(h, std::string_view(p + sizeof(h), h.len), p);
+      p += sizeof(h) + h.len;
+    }
+    return p;
+  }
+  const char *decode(const char *p, const char *end) {
+    return decode(p, end, end);
+  }
+
+  /// the records of a recent ring, oldest first, numbered as in a dump
+  void decode_recent(const binary::recent_header& rh, const char *ring) {
+    auto walk = [&](uint64_t from, uint64_t to, auto&& f) {
+      while (from + sizeof(binary::record_header) <= to) {
+	binary::record_header h;
+	memcpy(&h, ring + from, sizeof(h));
+	if (h.magic != binary::RECORD_MAGIC ||
+	    from + sizeof(h) + h.len > to) {
+	  // overwritten as the process died
+	  from += 8;
+	  skipped += 8;
+	  continue;
+	}
+	f(h, std::string_view(ring + from + sizeof(h), h.len));
+	from += (sizeof(h) + h.len + 7) & ~7ull;
+      }
+    };
+    auto each = [&](auto&& f) {
+      if (rh.wrapped) {
+	walk(rh.begin, rh.wrap, f);
+	walk(0, rh.end, f);
+      } else {
+	walk(rh.begin, rh.end, f);
+      }
+    };
+    long n = 0;
+    each([&n](const binary::record_header&, std::string_view) { ++n; });
+    out.append("--- begin dump of recent events ---\n");
+    each([this, &n](binary::record_header h, std::string_view msg) {
+      if (h.flags & binary::FLAG_DEFERRED) {
+	msg = "<deferred entry, never formatted>";
+      }
+      h.flags |= binary::FLAG_CRASH;
+      h.index = -(--n);
+      render(h, msg);
+    });
+    out.append("--- end dump of recent events ---\n");
+  }
+
+  std::string out;
+  std::vector<Item> items;  ///< with a base
+  uint64_t skipped = 0; ///< bytes that were not part of any record
+  bool keep = true;     ///< the last entry passed the filter
+  uint32_t last_entry = NONE; ///< with a base, where the last entry was
+
+private:
+  void record(const binary::record_header& h, std::string_view msg,
+	      const char *at) {
+    const bool message = h.flags & binary::FLAG_MESSAGE;
+    if (!message) {
+      keep = filter.want(h);
+      last_stamp = h.stamp;
+      if (base) {
+	last_entry = at - base;
+      }
+    }
+    if (!keep && (!message || !base)) {
+      return;
+    }
+    render(h, msg);
+    if (base) {
+      items.push_back(Item{
+	  message ? (last_entry == NONE ? 0 : last_stamp) : h.stamp,
+	  static_cast<uint32_t>(at - base),
+	  static_cast<uint32_t>(out.size()),
+	  message ? last_entry : NONE, message, keep});
+    }
+  }
+
+  void render(const binary::record_header& h, std::string_view msg) {
+    if (h.flags & binary::FLAG_MESSAGE) {
+      out.append(msg);
+      out.push_back('\n');
+      return;
+    }
+    char buf[128];
+    int used = 0;
+    if (h.flags & binary::FLAG_CRASH) {
+      used += snprintf(buf + used, sizeof(buf) - used, "%6ld> ", (long)h.index);
+    }
+    used += time_formatter.append(binary::header_stamp(h), buf + used,
+				  sizeof(buf) - used);
+    used += snprintf(buf + used, sizeof(buf) - used, " %lx %2d ",
+		     (unsigned long)h.thread, h.prio);
+    out.append(buf, used);
+    out.append(msg);
+    out.push_back('\n');
+  }
+
+  const Filter& filter;
+  const char *const base;
+  uint64_t last_stamp = 0;
+  log_time_formatter time_formatter;
+};
+
+/// writes runs of text, as one fwrite() while they are contiguous
+class Emitter {
+public:
+  explicit Emitter(FILE *out) : out(out) {}
+  ~Emitter() {
+    flush();
+  }
+  void put(const char *p, std::size_t n) {
+    if (p != pending + pending_len) {
+      flush();
+      pending = p;
+    }
+    pending_len += n;
+  }
+  void flush() {
+    fwrite(pending, 1, pending_len, out);
+    pending_len = 0;
+  }
+private:
+  FILE *out;
+  const char *pending = nullptr;
+  std::size_t pending_len = 0;
+};
+
+/* Decodes mapped log files a chunk at a time on a pool of threads.
+ *
+ * A chunk that starts where the index says an entry does is decoded from
+ * its start; one cut at an arbitrary offset first looks for a record whose
+ * header is sane and is followed by another.  Either way a chunk decodes
+ * the records starting in it, reading on into the next chunk for the last
+ * one.  As the chunks are taken in order, settle() checks each against
+ * where the one before it actually stopped, which is normally just where
+ * this one started: if the one before stopped short of it (a record the
+ * resync passed over), the gap is decoded there and then; if it stopped
+ * further in, the records this chunk found before that are dropped, once
+ * it is clear that this chunk's walk comes to the same place; and if that
+ * fails (the resync was fooled by a message) the chunk is decoded again
+ * from there.  So the output is record for record what one sequential
+ * pass over the file prints.
+ *
+ * Only a window of chunks ahead of the one being written is decoded, so
+ * the memory taken is bounded however big the files are.
+ */
+class ParallelDecoder {
+public:
+  ParallelDecoder(const Filter& filter, unsigned threads)
+    : filter(filter), threads(std::max(threads, 1u)) {}
+  ~ParallelDecoder() {
+    {
+      std::lock_guard l{lock};
+      stopping = true;
+    }
+    cond.notify_all();
+    for (auto& t : workers) {
+      t.join();
+    }
+  }
+
+  void add_file(const std::string& name, const char *base, uint64_t size,
+		const std::vector<binary::index_record>& index) {
+    auto f = std::make_unique<File>();
+    f->name = name;
+    f->base = base;
+    f->size = size;
+    plan(*f, index);
+    files.push_back(std::move(f));
+  }
+
+  /// decode everything, writing it to out
+  void run(FILE *out) {
+    ahead = std::max<std::size_t>(2, 2 * threads / std::max<std::size_t>(
+				       files.size(), 1));
+    for (unsigned i = 0; i < threads; ++i) {
+      workers.emplace_back([this] { work(); });
+    }
+    Emitter e(out);
+    emitter = &e;
+    if (files.size() == 1) {
+      File& f = *files.front();
+      while (peek(f)) {
+	emit(f);
+      }
+      return;
+    }
+    // by the stamp of each file's next entry; messages and lines the log
+    // wrote itself go straight after what came before them
+    using head_t = std::pair<uint64_t, std::size_t>;
+    std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> q;
+    auto push = [&](std::size_t n) {
+      File& f = *files[n];
+      if (const Item *i = peek(f)) {
+	q.emplace(i->stamp ? i->stamp : f.last_stamp, n);
+      }
+    };
+    for (std::size_t n = 0; n < files.size(); ++n) {
+      push(n);
+    }
+    while (!q.empty()) {
+      const std::size_t n = q.top().second;
+      q.pop();
+      emit(*files[n]);
+      push(n);
+    }
+  }
+
+  uint64_t skipped() const {
+    uint64_t n = 0;
+    for (auto& f : files) {
+      n += f->skipped;
+    }
+    return n;
+  }
+
+private:
+  /// the text of this much of a file is decoded at a time
+  static constexpr uint64_t CHUNK_SIZE = 4 << 20;
+
+  struct File;
+
+  struct Chunk {
+    File *file;
+    uint64_t b, e;       ///< the records starting in [b, e)
+    bool exact = false;  ///< b is the start of a record, or of the file
+    bool wanted = true;  ///< the index can't rule it out
+    enum { QUEUED, RUNNING, DONE } state = QUEUED;
+    // set by decode_chunk()
+    std::unique_ptr<Decoder> dec; ///< based at b
+    uint64_t s = 0;      ///< the first record decoded
+    uint64_t t = 0;      ///< where decoding stopped
+  };
+
+  /// a settled run of a decoder's items, the ones from item on to go out
+  struct Piece {
+    std::unique_ptr<Decoder> dec;
+    std::size_t item;
+    uint32_t from;       ///< items at or after this, from the decoder's base
+    bool start_keep;     ///< what the filter made of the entry before
+  };
+
+  struct File {
+    std::string name;
+    const char *base;
+    uint64_t size;
+    std::vector<Chunk> chunks;
+    std::size_t queued = 0;   ///< of chunks
+    std::size_t settled = 0;
+    std::deque<Piece> pieces;
+    uint64_t pos = 0;         ///< where a sequential pass would be
+    bool keep = true;         ///< as of pos
+    uint64_t skipped = 0;
+    uint64_t last_stamp = 0;  ///< of the last entry written
+  };
+
+  /// cut f into chunks: the stretches the index describes, in as few
+  /// chunks of up to CHUNK_SIZE as they fit, and the rest every
+  /// CHUNK_SIZE
+  void plan(File& f, const std::vector<binary::index_record>& index) {
+    std::vector<Chunk> stretches;
+    auto add = [&](uint64_t b, uint64_t e, bool wanted) {
+      e = std::min(e, f.size);
+      if (b < e) {
+	stretches.push_back(Chunk{&f, b, e, true, wanted});
+      }
+    };
+    uint64_t pos = 0;
+    for (const auto& r : index) {
+      if (r.offset < pos || r.offset >= f.size) {
+	// out of order, or of an earlier file of the same name
+	continue;
+      }
+      add(pos, r.offset, true);
+      add(r.offset, r.offset + r.len, filter.want_chunk(r));
+      pos = r.offset + r.len;
+    }
+    add(pos, f.size, true);
+
+    for (auto& c : stretches) {
+      if (!f.chunks.empty()) {
+	auto& last = f.chunks.back();
+	if (last.e == c.b && last.wanted == c.wanted &&
+	    (!c.wanted || c.e - last.b <= CHUNK_SIZE)) {
+	  last.e = c.e;
+	  continue;
+	}
+      }
+      if (!c.wanted) {
+	f.chunks.push_back(std::move(c));
+	continue;
+      }
+      for (uint64_t b = c.b; b < c.e; b += CHUNK_SIZE) {
+	f.chunks.push_back(Chunk{&f, b, std::min(c.e, b + CHUNK_SIZE),
+				 b == c.b, true});
+      }
+    }
+  }
+
+  /// a record at p that looks like one, and is followed by another, the
+  /// end of the file, or preallocated space
+  static bool plausible(const char *p, const char *end) {
+    binary::record_header h;
+    if (end - p < (ssize_t)sizeof(h)) {
+      return false;
+    }
+    memcpy(&h, p, sizeof(h));
+    if (h.magic != binary::RECORD_MAGIC ||
+	(h.flags & ~(binary::FLAG_COARSE | binary::FLAG_CRASH |
+		     binary::FLAG_MESSAGE)) ||
+	std::any_of(std::begin(h.reserved), std::end(h.reserved),
+		    [](uint8_t b) { return b != 0; }) ||
+	(std::size_t)(end - p) < sizeof(h) + h.len) {
+      return false;
+    }
+    const char *next = p + sizeof(h) + h.len;
+    uint32_t magic;
+    if (end - next < (ssize_t)sizeof(magic)) {
+      return true;
+    }
+    memcpy(&magic, next, sizeof(magic));
+    return magic == binary::RECORD_MAGIC || magic == 0;
+  }
+
+  /// the first plausible record starting in [p, e), else e
+  static const char *resync(const char *p, const char *e, const char *end) {
+    const uint32_t magic = binary::RECORD_MAGIC;
+    while (p < e && end - p >= (ssize_t)sizeof(binary::record_header)) {
+      // a match must start before e
+      auto hit = ceph::mem_find(
+	p, std::min<std::size_t>(end - p, e - p + sizeof(magic) - 1),
+	reinterpret_cast<const char*>(&magic), sizeof(magic));
+      if (!hit) {
+	break;
+      }
+      if (plausible(hit, end)) {
+	return hit;
+      }
+      p = hit + 1;
+    }
+    return e;
+  }
+
+  void decode_chunk(Chunk& c) {
+    const char *base = c.file->base;
+    const char *end = base + c.file->size;
+    const char *p = base + c.b;
+    if (!c.exact) {
+      p = resync(p, base + c.e, end);
+    }
+    c.dec = std::make_unique<Decoder>(filter, base + c.b);
+    c.s = p - base;
+    c.t = c.dec->decode(p, base + c.e, end) - base;
+  }
+
+  void work() {
+    std::unique_lock l{lock};
+    while (true) {
+      cond.wait(l, [this] { return stopping || !queue.empty(); });
+      if (stopping) {
+	return;
+      }
+      Chunk *c = queue.front();
+      queue.pop_front();
+      if (c->state != Chunk::QUEUED) {
+	continue;
+      }
+      c->state = Chunk::RUNNING;
+      l.unlock();
+      decode_chunk(*c);
+      l.lock();
+      c->state = Chunk::DONE;
+      cond.notify_all();
+    }
+  }
+
+  /// wait for chunk n of f, decoding it here if no worker has got to it
+  void wait(File& f, std::size_t n) {
+    while (f.queued < std::min(f.chunks.size(), n + ahead)) {
+      Chunk& c = f.chunks[f.queued++];
+      std::lock_guard l{lock};
+      if (c.wanted) {
+	queue.push_back(&c);
+	cond.notify_one();
+      } else {
+	c.state = Chunk::DONE;
+      }
+    }
+    Chunk& c = f.chunks[n];
+    std::unique_lock l{lock};
+    if (c.state == Chunk::QUEUED) {
+      c.state = Chunk::RUNNING;
+      l.unlock();
+      decode_chunk(c);
+      l.lock();
+      c.state = Chunk::DONE;
+      return;
+    }
+    cond.wait(l, [&c] { return c.state == Chunk::DONE; });
+  }
+
+  /// whether decoding from s, as decode() does, comes to pos; counts the
+  /// bytes skipped on the way
+  static bool reaches(const char *base, uint64_t s, uint64_t pos,
+		      uint64_t size, uint64_t *skipped) {
+    while (s < pos && size - s >= sizeof(binary::record_header)) {
+      binary::record_header h;
+      memcpy(&h, base + s, sizeof(h));
+      if (h.magic != binary::RECORD_MAGIC) {
+	++s;
+	++*skipped;
+	continue;
+      }
+      if (size - s < sizeof(h) + h.len) {
+	break;
+      }
+      s += sizeof(h) + h.len;
+    }
+    return s == pos;
+  }
+
+  void add_piece(File& f, std::unique_ptr<Decoder> dec, uint32_t from) {
+    auto& items = dec->items;
+    const std::size_t first = std::lower_bound(
+      items.begin(), items.end(), from,
+      [](const Item& i, uint32_t at) { return i.at < at; }) - items.begin();
+    const bool start_keep = f.keep;
+    if (dec->last_entry != Decoder::NONE && dec->last_entry >= from) {
+      f.keep = dec->keep;
+    }
+    f.pieces.push_back(Piece{std::move(dec), first, from, start_keep});
+  }
+
+  /// line chunk c up with where the chunks before it left off
+  void settle(File& f, Chunk& c) {
+    if (!c.wanted) {
+      // the next chunk starts at an entry the index points to
+      f.pos = std::max(f.pos, c.e);
+      return;
+    }
+    const char *base = f.base;
+    const char *end = base + f.size;
+    if (f.pos < c.s) {
+      auto gap = std::make_unique<Decoder>(filter, base + f.pos);
+      f.pos = gap->decode(base + f.pos, base + c.s, end) - base;
+      f.skipped += gap->skipped;
+      add_piece(f, std::move(gap), 0);
+    }
+    if (f.pos >= c.t) {
+      // all of it is within records that started before it
+      c.dec.reset();
+      return;
+    }
+    uint64_t skipped = 0;
+    if (reaches(base, c.s, f.pos, f.size, &skipped)) {
+      f.skipped += c.dec->skipped - skipped;
+      const uint32_t from = f.pos - c.b;
+      f.pos = c.t;
+      add_piece(f, std::move(c.dec), from);
+      return;
+    }
+    c.dec.reset();
+    auto again = std::make_unique<Decoder>(filter, base + f.pos);
+    f.pos = again->decode(base + f.pos, base + c.e, end) - base;
+    f.skipped += again->skipped;
+    add_piece(f, std::move(again), 0);
+  }
+
+  /// f's next item to write, if any
+  const Item *peek(File& f) {
+    while (true) {
+      while (f.pieces.empty()) {
+	if (f.settled == f.chunks.size()) {
+	  if (f.pos < f.size) {
+	    // a record cut off by the end of the file
+	    f.skipped += f.size - f.pos;
+	    f.pos = f.size;
+	  }
+	  return nullptr;
+	}
+	wait(f, f.settled);
+	settle(f, f.chunks[f.settled++]);
+      }
+      Piece& p = f.pieces.front();
+      const auto& items = p.dec->items;
+      for (; p.item < items.size(); ++p.item) {
+	const Item& i = items[p.item];
+	if (!i.message) {
+	  return &i;
+	}
+	// the entry before a message may be one this decoder had to drop
+	if ((i.after != Decoder::NONE && i.after >= p.from) ? i.after_kept :
+	    p.start_keep) {
+	  return &i;
+	}
+      }
+      // what's written of its text may not be out yet
+      emitter->flush();
+      f.pieces.pop_front();
+    }
+  }
+
+  /// write out the item peek(f) found
+  void emit(File& f) {
+    Piece& p = f.pieces.front();
+    const auto& items = p.dec->items;
+    const Item& i = items[p.item];
+    const uint32_t from = p.item ? items[p.item - 1].end : 0;
+    emitter->put(p.dec->out.data() + from, i.end - from);
+    if (!i.message) {
+      f.last_stamp = i.stamp;
+    }
+    ++p.item;
+  }
+
+  const Filter& filter;
+  const unsigned threads;
+  std::size_t ahead = 2;  ///< chunks of a file decoded ahead of the next
+  Emitter *emitter = nullptr;
+  std::vector<std::unique_ptr<File>> files;
+  std::vector<std::thread> workers;
+
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<Chunk*> queue;
+  bool stopping = false;
+};
+
+static int decode_recent(const char *fn)
+{
+  int fd = ::open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "ceph-log-decode: " << fn << ": " << strerror(errno)
+	      << std::endl;
+    return 1;
+  }
+  std::vector<char> buf;
+  std::size_t have = 0;
+  while (true) {
+    buf.resize(have + (1 << 20));
+    ssize_t r = ::read(fd, buf.data() + have, buf.size() - have);
+    if (r < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      std::cerr << "ceph-log-decode: read: " << strerror(errno) << std::endl;
+      ::close(fd);
+      return 1;
+    }
+    if (r == 0) {
+      break;
+    }
+    have += r;
+  }
+  ::close(fd);
+
+  binary::recent_header rh;
+  if (have < sizeof(rh)) {
+    std::cerr << "ceph-log-decode: " << fn << ": too short" << std::endl;
+    return 1;
+  }
+  memcpy(&rh, buf.data(), sizeof(rh));
+  if (rh.magic != binary::RECENT_MAGIC ||
+      rh.version != binary::RECENT_VERSION ||
+      rh.header_size < sizeof(rh) ||
+      have < rh.header_size + rh.ring_size ||
+      rh.begin > rh.ring_size || rh.end > rh.ring_size ||
+      rh.wrap > rh.ring_size) {
+    std::cerr << "ceph-log-decode: " << fn << ": not a recent log file"
+	      << std::endl;
+    return 1;
+  }
+  std::cerr << "ceph-log-decode: " << rh.count << " entries from pid "
+	    << rh.pid << std::endl;
+  Filter all;
+  Decoder decoder(all);
+  decoder.decode_recent(rh, buf.data() + rh.header_size);
+  fwrite(decoder.out.data(), 1, decoder.out.size(), stdout);
+  if (decoder.skipped) {
+    std::cerr << "ceph-log-decode: skipped " << decoder.skipped
+	      << " bytes of damaged records" << std::endl;
+  }
+  return 0;
+}
+
+/// decode what can only be read once, e.g. stdin
+static int decode_stream(int fd, const Filter& filter)
+{
+  Decoder decoder(filter);
+  std::vector<char> buf;
+  std::size_t have = 0;
+  while (true) {
+    if (buf.size() - have < 65536) {
+      buf.resize(have + 65536);
+    }
+    ssize_t r = ::read(fd, buf.data() + have, buf.size() - have);
+    if (r < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      std::cerr << "ceph-log-decode: read: " << strerror(errno) << std::endl;
+      return 1;
+    }
+    if (r == 0) {
+      break;
+    }
+    have += r;
+    const char *rest = decoder.decode(buf.data(), buf.data() + have);
+    have -= rest - buf.data();
+    memmove(buf.data(), rest, have);
+    fwrite(decoder.out.data(), 1, decoder.out.size(), stdout);
+    decoder.out.clear();
+  }
+  if (have) {
+    decoder.skipped += have;
+  }
+  if (decoder.skipped) {
+    std::cerr << "ceph-log-decode: skipped " << decoder.skipped
+	      << " bytes of unrecognized or truncated data" << std::endl;
+  }
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  Filter filter;
+  std::vector<const char*> fns;
+  std::string index_fn;
+  unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+  StampParser parser;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view a(argv[i]);
+    if (a == "-h" || a == "--help") {
+      usage();
+      return 0;
+    } else if (a == "--recent" && i + 1 < argc && argc == 3) {
+      return decode_recent(argv[++i]);
+    } else if (a == "--threads" && i + 1 < argc) {
+      threads = std::max(atoi(argv[++i]), 1);
+    } else if ((a == "--from" || a == "--to") && i + 1 < argc) {
+      const char *t = argv[++i];
+      uint64_t ns, unit;
+      if (!parser.parse(t, t + strlen(t), &ns, &unit)) {
+	std::cerr << "ceph-log-decode: can't parse time '" << t << "'"
+		  << std::endl;
+	return 1;
+      }
+      if (a == "--from") {
+	filter.from = ns;
+      } else {
+	// up to the end of the last digit given
+	filter.to = ns + unit - 1;
+      }
+    } else if (a == "--subsys" && i + 1 < argc) {
+      std::string_view names(argv[++i]);
+      const auto subs = ceph_subsys_get_as_array();
+      filter.any_subsys = false;
+      while (!names.empty()) {
+	auto name = names.substr(0, names.find(','));
+	names.remove_prefix(std::min(names.size(), name.size() + 1));
+	unsigned sub = 0;
+	while (sub < subs.size() && name != subs[sub].name) {
+	  ++sub;
+	}
+	if (sub == subs.size()) {
+	  std::cerr << "ceph-log-decode: unknown subsystem '" << name << "'"
+		    << std::endl;
+	  return 1;
+	}
+	filter.subsys[sub / 64] |= 1ull << (sub % 64);
+      }
+    } else if (a == "--thread" && i + 1 < argc) {
+      char *end;
+      filter.thread = strtoull(argv[++i], &end, 16);
+      if (*end || end == argv[i]) {
+	std::cerr << "ceph-log-decode: --thread takes a thread id in hex"
+		  << std::endl;
+	return 1;
+      }
+      filter.any_thread = false;
+    } else if (a == "--level" && i + 1 < argc) {
+      filter.max_prio = atoi(argv[++i]);
+    } else if (a == "--index" && i + 1 < argc) {
+      index_fn = argv[++i];
+    } else if (a == "-" || (!a.empty() && a[0] != '-')) {
+      fns.push_back(argv[i]);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  const bool has_stdin = std::any_of(fns.begin(), fns.end(), [](auto fn) {
+    return !strcmp(fn, "-");
+  });
+  if (fns.empty() || (fns.size() == 1 && has_stdin)) {
+    return decode_stream(STDIN_FILENO, filter);
+  }
+  if (has_stdin || (!index_fn.empty() && fns.size() > 1)) {
+    usage();
+    return 1;
+  }
+
+  ParallelDecoder decoder(filter, threads);
+  std::vector<std::pair<void*, uint64_t>> maps;
+  for (auto fn : fns) {
+    int fd = ::open(fn, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+      std::cerr << "ceph-log-decode: " << fn << ": " << strerror(errno)
+		<< std::endl;
+      return 1;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+      std::cerr << "ceph-log-decode: " << fn << ": " << strerror(errno)
+		<< std::endl;
+      return 1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+      // e.g. a pipe; it can only be read through
+      if (fns.size() > 1) {
+	std::cerr << "ceph-log-decode: " << fn << " is not a file, "
+		  << "and can only be decoded on its own" << std::endl;
+	return 1;
+      }
+      int r = decode_stream(fd, filter);
+      ::close(fd);
+      return r;
+    }
+    const uint64_t size = st.st_size;
+    if (size == 0) {
+      ::close(fd);
+      continue;
+    }
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+      std::cerr << "ceph-log-decode: mmap " << fn << ": " << strerror(errno)
+		<< std::endl;
+      return 1;
+    }
+    maps.emplace_back(map, size);
+    uint32_t magic = 0;
+    if (size >= sizeof(magic)) {
+      memcpy(&magic, map, sizeof(magic));
+    }
+    if (magic == 0xfd2fb528 || magic == 0x184d2204) {
+      std::cerr << "ceph-log-decode: " << fn << " is compressed; pipe it "
+		<< "through " << (magic == 0xfd2fb528 ? "zstdcat" : "lz4cat")
+		<< " instead" << std::endl;
+      return 1;
+    }
+    decoder.add_file(fn, static_cast<const char*>(map), size,
+		     binary::read_index(index_fn.empty() ?
+					std::string(fn) + ".idx" : index_fn));
+  }
+  decoder.run(stdout);
+  fflush(stdout);
+  if (decoder.skipped()) {
+    std::cerr << "ceph-log-decode: skipped " << decoder.skipped()
+	      << " bytes of unrecognized or truncated data" << std::endl;
+  }
+  for (auto& [map, size] : maps) {
+    ::munmap(map, size);
+  }
+  return 0;
+}
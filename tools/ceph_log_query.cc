@@ -0,0 +1,725 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * ceph-log-query: print the entries of a log file that fall in a time
+ * range, belong to some subsystems or threads, are up to a debug level,
+ * and/or hold a string or match a regex.  The file is mapped, and with
+ * the log_file.idx written by log_index_interval only the stretches whose
+ * index records can match are read; the rest of the file is skipped.
+ * Compressed logs (log_compression) are decompressed as they are read,
+ * with the dictionaries of log_compression_dict_size from beside them.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <regex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "acconfig.h"
+#include "common/inline_memory.h"
+#include "common/logging/BinaryLog.h"
+#include "log_file_util.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+using namespace ceph::logging;
+
+static void usage()
+{
+  std::cout << "usage: ceph-log-query [options] <file>\n"
+	    << "  --from <time>         entries at or after time\n"
+	    << "  --to <time>           entries at or before time\n"
+	    << "  --subsys <name>[,..]  entries of these subsystems\n"
+	    << "  --thread <hex>        entries of this thread\n"
+	    << "  --thread <name>[/tid] entries of threads so named (log_thread_names)\n"
+	    << "  --level <n>           entries at debug level n or below\n"
+	    << "  --grep <string>       lines holding string\n"
+	    << "  --regex <ere>         lines matching the extended regex\n"
+	    << "  --index <file>        index to use (default <file>.idx)\n"
+	    << "  --dict <file>         a zstd dictionary the frames may name\n"
+	    << "                        (default <file>.<id>.dict)\n"
+	    << "  --stats               report how much of the file was read\n"
+	    << "  Times are 'YYYY-MM-DD HH:MM:SS[.frac]' in local time, as\n"
+	    << "  the log writes them.  Text lines do not name their\n"
+	    << "  subsystem, so in a text log --subsys only skips the chunks\n"
+	    << "  of the index without any of them; in a binary log\n"
+	    << "  (log_format = binary) it selects entries exactly, and\n"
+	    << "  they are printed as ceph-log-decode would.  --grep and\n"
+	    << "  --regex select lines: a continuation line of a multi-line\n"
+	    << "  entry is printed if it matches and the entry's header\n"
+	    << "  passes the other filters.  Give --grep with --regex when\n"
+	    << "  the regex has a fixed part; it is far faster, and the\n"
+	    << "  regex is only tried on the lines --grep found.\n";
+}
+
+/// what a text line starts with, or a binary record holds
+struct EntryHeader {
+  uint64_t stamp = 0;
+  uint64_t thread = 0;
+  std::string_view name; ///< a log_thread_names "<name>/<tid>" or empty
+  int prio = 0;
+};
+
+struct Query {
+  uint64_t from = 0;
+  uint64_t to = UINT64_MAX;
+  bool any_subsys = true;
+  uint64_t subsys[2] = {0, 0};
+  bool any_thread = true;
+  uint64_t thread = 0;
+  std::string thread_name;     ///< --thread name[/tid], else thread
+  int max_prio = INT_MAX;
+  std::string needle;          ///< --grep
+  bool use_regex = false;      ///< --regex
+  regex_t regex;
+
+  bool want_subsys(unsigned sub) const {
+    return any_subsys || (sub < 128 && (subsys[sub / 64] >> (sub % 64)) & 1);
+  }
+  bool want_chunk(const binary::index_record& r) const {
+    return r.last >= from && r.first <= to &&
+      (any_subsys || (r.subsys[0] & subsys[0]) || (r.subsys[1] & subsys[1]));
+  }
+  bool want(const EntryHeader& h) const {
+    return h.stamp >= from && h.stamp <= to &&
+      (any_thread || want_thread(h)) && h.prio <= max_prio;
+  }
+  bool want_thread(const EntryHeader& h) const {
+    if (thread_name.empty()) {
+      return h.name.empty() && h.thread == thread;
+    }
+    if (thread_name.find('/') != std::string::npos) {
+      // "name/tid", or "name/" for any tid
+      return thread_name.back() == '/' ?
+	h.name.substr(0, thread_name.size()) == thread_name :
+	h.name == thread_name;
+    }
+    return h.name.substr(0, h.name.rfind('/')) == thread_name;
+  }
+  /// --grep and --regex, for a line without its newline
+  bool want_text(const char *b, const char *e) const {
+    if (!needle.empty() &&
+	!ceph::mem_find(b, e - b, needle.data(), needle.size())) {
+      return false;
+    }
+    if (use_regex) {
+      regmatch_t m;
+      m.rm_so = 0;
+      m.rm_eo = e - b;
+      return regexec(&regex, b, 1, &m, REG_STARTEND) == 0;
+    }
+    return true;
+  }
+};
+
+/* Prints the matching entries of a log, a stretch at a time.  The log may
+ * be all there (mapped), or be decompressed a window at a time, in which
+ * case scan() leaves the last, incomplete line or record to be passed
+ * again with what follows it.
+ *
+ * With --grep, text is not split into lines: mem_find() runs over the
+ * whole stretch and only the lines it lands in are looked at, along with
+ * the header of the entry such a line belongs to.
+ */
+class Scanner {
+public:
+  Scanner(const Query& q, const char *base, bool binary)
+    : q(q), base(base), binary(binary) {}
+
+  /// print the matching entries that start in [b, e), with the data
+  /// running on to end; unless final, a line or record cut off by end is
+  /// left alone.  Returns where scanning stopped.
+  const char *scan(const char *b, const char *e, const char *end,
+		   bool final) {
+    if (binary) {
+      return scan_binary(b, e, end, final);
+    }
+    return scan_text(b, e, end, final);
+  }
+
+  void set_base(const char *b) {
+    base = b;
+  }
+
+private:
+  const char *scan_text(const char *b, const char *e, const char *end,
+			bool final) {
+    if (b > base && b[-1] != '\n') {
+      // not at a line start; the line belongs to the stretch before
+      auto nl = static_cast<const char*>(memchr(b, '\n', end - b));
+      b = nl ? nl + 1 : end;
+    }
+    const char *p = b;
+    while (p < e) {
+      const char *ls = p;
+      if (!q.needle.empty()) {
+	auto hit = ceph::mem_find(p, end - p, q.needle.data(),
+				  q.needle.size());
+	if (!hit) {
+	  const char *stop = final ? e : line_start(p, end);
+	  recall_header(p, stop);
+	  return stop;
+	}
+	ls = line_start(p, hit);
+	if (ls >= e) {
+	  recall_header(p, e);
+	  return e;
+	}
+	recall_header(p, ls);
+      }
+      auto nl = static_cast<const char*>(memchr(ls, '\n', end - ls));
+      if (!nl && !final) {
+	return ls;
+      }
+      const char *le = nl ? nl + 1 : end;
+      EntryHeader h;
+      if (parse_header(ls, le, &h)) {
+	header = h;
+	have_header = true;
+      }
+      // lines without a header continue the entry before them
+      if (have_header && q.want(header) &&
+	  q.want_text(ls, nl ? nl : end)) {
+	fwrite(ls, 1, le - ls, stdout);
+      }
+      p = le;
+    }
+    return p;
+  }
+
+  /// the start of the line holding p, no earlier than b
+  static const char *line_start(const char *b, const char *p) {
+    auto nl = static_cast<const char*>(memrchr(b, '\n', p - b));
+    return nl ? nl + 1 : b;
+  }
+
+  /// take the header of the last entry starting in [b, e), if any, for
+  /// the lines that follow without one
+  void recall_header(const char *b, const char *e) {
+    while (e > b) {
+      const char *ls = line_start(b, e - 1);
+      EntryHeader h;
+      if (parse_header(ls, e, &h)) {
+	header = h;
+	have_header = true;
+	return;
+      }
+      e = ls;
+    }
+  }
+
+  /// "[%6ld> ]<stamp> %lx %2d ", or with "<name>/<tid>" for the %lx
+  bool parse_header(const char *b, const char *e, EntryHeader *h) {
+    const char *s = b;
+    // skip a crash dump's numbering
+    while (s < e && (*s == ' ' || *s == '-' || (*s >= '0' && *s <= '9'))) {
+      ++s;
+    }
+    if (s + 1 < e && s[0] == '>' && s[1] == ' ') {
+      s += 2;
+    } else {
+      s = b;
+    }
+    if (!parser.parse(s, e, &h->stamp)) {
+      return false;
+    }
+    s = static_cast<const char*>(memchr(s + 19, ' ', e - s - 19));
+    if (!s) {
+      return false;
+    }
+    // by hand: the last line of a mapped file need not be terminated
+    const char *t = s + 1;
+    h->thread = 0;
+    for (; t < e && isxdigit(*t); ++t) {
+      h->thread = h->thread * 16 + (isdigit(*t) ? *t - '0' :
+				    tolower(*t) - 'a' + 10);
+    }
+    h->name = {};
+    if (t < e && *t != ' ') {
+      // log_thread_names; the token runs to the next blank
+      for (; t < e && *t != ' '; ++t) ;
+      h->name = std::string_view(s + 1, t - s - 1);
+      h->thread = 0;
+    }
+    if (t == s + 1) {
+      return false;
+    }
+    for (; t < e && *t == ' '; ++t) ;
+    bool neg = t < e && *t == '-';
+    t += neg;
+    const char *digits = t;
+    h->prio = 0;
+    for (; t < e && isdigit(*t); ++t) {
+      h->prio = h->prio * 10 + (*t - '0');
+    }
+    if (neg) {
+      h->prio = -h->prio;
+    }
+    return t > digits && t < e && *t == ' ';
+  }
+
+  const char *scan_binary(const char *b, const char *e, const char *end,
+			  bool final) {
+    while (b < e && end - b >= (ssize_t)sizeof(binary::record_header)) {
+      binary::record_header h;
+      memcpy(&h, b, sizeof(h));
+      if (h.magic != binary::RECORD_MAGIC) {
+	// torn record, preallocated space or a stale index
+	++b;
+	continue;
+      }
+      if ((std::size_t)(end - b) < sizeof(h) + h.len) {
+	return final ? end : b;
+      }
+      const std::string_view msg(b + sizeof(h), h.len);
+      b += sizeof(h) + h.len;
+      if (h.flags & binary::FLAG_MESSAGE) {
+	// the log's own lines go with the entries around them
+	if (keep && q.want_text(msg.data(), msg.data() + msg.size())) {
+	  fwrite(msg.data(), 1, msg.size(), stdout);
+	  fputc('\n', stdout);
+	}
+	continue;
+      }
+      EntryHeader eh;
+      eh.stamp = h.stamp;
+      eh.thread = h.thread;
+      eh.prio = h.prio;
+      keep = q.want(eh) && q.want_subsys(h.subsys);
+      if (keep && q.want_text(msg.data(), msg.data() + msg.size())) {
+	render(h, msg);
+      }
+    }
+    return final ? end : b;
+  }
+
+  void render(const binary::record_header& h, std::string_view msg) {
+    char buf[128];
+    int used = 0;
+    if (h.flags & binary::FLAG_CRASH) {
+      used += snprintf(buf + used, sizeof(buf) - used, "%6ld> ", (long)h.index);
+    }
+    used += time_formatter.append(binary::header_stamp(h), buf + used,
+				  sizeof(buf) - used);
+    used += snprintf(buf + used, sizeof(buf) - used, " %lx %2d ",
+		     (unsigned long)h.thread, h.prio);
+    fwrite(buf, 1, used, stdout);
+    fwrite(msg.data(), 1, msg.size(), stdout);
+    fputc('\n', stdout);
+  }
+
+  const Query& q;
+  const char *base;
+  const bool binary;
+  StampParser parser;
+  log_time_formatter time_formatter;
+  EntryHeader header; ///< of the last text entry seen
+  bool have_header = false;
+  bool keep = false;  ///< the last binary entry was printed
+};
+
+/// feeds a zstd or lz4 compressed log, a frame at a time
+class Decompressor {
+public:
+  virtual ~Decompressor() = default;
+  /// decompress some of [*in, in_end) into out, advancing *in; -1 on
+  /// error
+  virtual ssize_t read(const char **in, const char *in_end, char *out,
+		       std::size_t out_len) = 0;
+  /// why read() failed, if not damage
+  virtual std::string error() const {
+    return {};
+  }
+};
+
+#ifdef HAVE_ZSTD
+class ZstdDecompressor final : public Decompressor {
+public:
+  /// find_dict(id) is the dictionary a frame names, or empty if there is
+  /// none to be found
+  using find_dict_t = std::function<std::string(unsigned id)>;
+  explicit ZstdDecompressor(find_dict_t find_dict)
+    : ds(ZSTD_createDStream()), find_dict(std::move(find_dict)) {}
+  ~ZstdDecompressor() override {
+    ZSTD_freeDStream(ds);
+  }
+  ssize_t read(const char **in, const char *in_end, char *out,
+	       std::size_t out_len) override {
+    if (at_frame) {
+      // frames before the dictionary was trained name none, and decode
+      // as well with whichever is loaded
+      const unsigned id = ZSTD_getDictID_fromFrame(*in, in_end - *in);
+      if (id && id != dict_id) {
+	const std::string dict = find_dict(id);
+	if (dict.empty()) {
+	  missing = id;
+	  return -1;
+	}
+	ZSTD_DCtx_reset(ds, ZSTD_reset_session_only);
+	if (ZSTD_isError(ZSTD_DCtx_loadDictionary(ds, dict.data(),
+						  dict.size()))) {
+	  return -1;
+	}
+	dict_id = id;
+      }
+    }
+    ZSTD_inBuffer ib = {*in, (std::size_t)(in_end - *in), 0};
+    ZSTD_outBuffer ob = {out, out_len, 0};
+    std::size_t r = ZSTD_decompressStream(ds, &ob, &ib);
+    *in += ib.pos;
+    at_frame = r == 0;
+    return ZSTD_isError(r) ? -1 : (ssize_t)ob.pos;
+  }
+  std::string error() const override {
+    if (!missing) {
+      return {};
+    }
+    return "no zstd dictionary " + std::to_string(missing) +
+      " (see --dict)";
+  }
+private:
+  ZSTD_DStream *ds;
+  find_dict_t find_dict;
+  bool at_frame = true;
+  unsigned dict_id = 0;  ///< loaded
+  unsigned missing = 0;
+};
+#endif
+
+#ifdef HAVE_LZ4
+class Lz4Decompressor final : public Decompressor {
+public:
+  Lz4Decompressor() {
+    LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+  }
+  ~Lz4Decompressor() override {
+    LZ4F_freeDecompressionContext(dctx);
+  }
+  ssize_t read(const char **in, const char *in_end, char *out,
+	       std::size_t out_len) override {
+    std::size_t in_len = in_end - *in;
+    std::size_t r = LZ4F_decompress(dctx, out, &out_len, *in, &in_len,
+				    nullptr);
+    *in += in_len;
+    return LZ4F_isError(r) ? -1 : (ssize_t)out_len;
+  }
+private:
+  LZ4F_dctx *dctx = nullptr;
+};
+#endif
+
+/// scan a compressed log, decompressing it a window at a time
+/// the contents of fn, or empty if it can't be read
+static std::string read_file(const std::string& fn)
+{
+  std::ifstream f(fn, std::ios::binary);
+  std::ostringstream ss;
+  ss << f.rdbuf();
+  return f ? ss.str() : std::string();
+}
+
+static int scan_compressed(const Query& q, Decompressor& d, const char *in,
+			   const char *in_end, uint64_t *out_bytes)
+{
+  std::vector<char> buf(4 << 20);
+  std::size_t have = 0;
+  std::unique_ptr<Scanner> scanner;
+  bool binary = false;
+  while (true) {
+    if (buf.size() - have < (1 << 20)) {
+      // a line or record as big as the window
+      buf.resize(buf.size() * 2);
+    }
+    ssize_t r = d.read(&in, in_end, buf.data() + have, buf.size() - have);
+    if (r < 0) {
+      if (auto e = d.error(); !e.empty()) {
+	std::cerr << "ceph-log-query: " << e << std::endl;
+      } else {
+	std::cerr << "ceph-log-query: damaged compressed data, "
+		  << in_end - in << " bytes before the end" << std::endl;
+      }
+      return 1;
+    }
+    have += r;
+    *out_bytes += r;
+    const bool final = in == in_end && r == 0;
+    if (!scanner) {
+      if (have < sizeof(uint32_t) && !final) {
+	continue;
+      }
+      uint32_t magic = 0;
+      if (have >= sizeof(magic)) {
+	memcpy(&magic, buf.data(), sizeof(magic));
+      }
+      binary = magic == binary::RECORD_MAGIC;
+      scanner = std::make_unique<Scanner>(q, buf.data(), binary);
+    }
+    scanner->set_base(buf.data());
+    const char *rest = scanner->scan(buf.data(), buf.data() + have,
+				     buf.data() + have, final);
+    have -= rest - buf.data();
+    memmove(buf.data(), rest, have);
+    if (final) {
+      return 0;
+    }
+  }
+}
+
+int main(int argc, const char **argv)
+{
+  Query q;
+  const char *fn = nullptr;
+  std::string index_fn;
+  std::vector<std::string> dict_fns;
+  bool stats = false;
+  StampParser parser;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view a(argv[i]);
+    if (a == "-h" || a == "--help") {
+      usage();
+      return 0;
+    } else if (a == "--stats") {
+      stats = true;
+    } else if ((a == "--from" || a == "--to") && i + 1 < argc) {
+      const char *t = argv[++i];
+      uint64_t ns, unit;
+      if (!parser.parse(t, t + strlen(t), &ns, &unit)) {
+	std::cerr << "ceph-log-query: can't parse time '" << t << "'"
+		  << std::endl;
+	return 1;
+      }
+      if (a == "--from") {
+	q.from = ns;
+      } else {
+	// up to the end of the last digit given: "--to 12:00:05" takes in
+	// all of that second
+	q.to = ns + unit - 1;
+      }
+    } else if (a == "--subsys" && i + 1 < argc) {
+      std::string_view names(argv[++i]);
+      const auto subs = ceph_subsys_get_as_array();
+      q.any_subsys = false;
+      while (!names.empty()) {
+	auto name = names.substr(0, names.find(','));
+	names.remove_prefix(std::min(names.size(), name.size() + 1));
+	unsigned sub = 0;
+	while (sub < subs.size() && name != subs[sub].name) {
+	  ++sub;
+	}
+	if (sub == subs.size()) {
+	  std::cerr << "ceph-log-query: unknown subsystem '" << name << "'"
+		    << std::endl;
+	  return 1;
+	}
+	q.subsys[sub / 64] |= 1ull << (sub % 64);
+      }
+    } else if (a == "--thread" && i + 1 < argc) {
+      char *end;
+      q.thread = strtoull(argv[++i], &end, 16);
+      if (*end || end == argv[i]) {
+	// a name from log_thread_names
+	q.thread_name = argv[i];
+      }
+      q.any_thread = false;
+    } else if (a == "--level" && i + 1 < argc) {
+      q.max_prio = atoi(argv[++i]);
+    } else if (a == "--grep" && i + 1 < argc) {
+      q.needle = argv[++i];
+    } else if (a == "--regex" && i + 1 < argc) {
+      int r = regcomp(&q.regex, argv[++i], REG_EXTENDED|REG_NOSUB);
+      if (r != 0) {
+	char err[256];
+	regerror(r, &q.regex, err, sizeof(err));
+	std::cerr << "ceph-log-query: --regex: " << err << std::endl;
+	return 1;
+      }
+      q.use_regex = true;
+    } else if (a == "--index" && i + 1 < argc) {
+      index_fn = argv[++i];
+    } else if (a == "--dict" && i + 1 < argc) {
+      dict_fns.push_back(argv[++i]);
+    } else if (!fn && !a.empty() && a[0] != '-') {
+      fn = argv[i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (!fn) {
+    usage();
+    return 1;
+  }
+  if (index_fn.empty()) {
+    index_fn = std::string(fn) + ".idx";
+  }
+
+  int fd = ::open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "ceph-log-query: " << fn << ": " << strerror(errno)
+	      << std::endl;
+    return 1;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    std::cerr << "ceph-log-query: " << fn << ": " << strerror(errno)
+	      << std::endl;
+    return 1;
+  }
+  const uint64_t size = st.st_size;
+  if (size == 0) {
+    return 0;
+  }
+  void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    std::cerr << "ceph-log-query: mmap " << fn << ": " << strerror(errno)
+	      << std::endl;
+    return 1;
+  }
+  const char *base = static_cast<const char*>(map);
+  uint32_t magic = 0;
+  if (size >= sizeof(magic)) {
+    memcpy(&magic, base, sizeof(magic));
+  }
+
+  // log_compression: no index is kept, so all of it is decompressed
+  std::unique_ptr<Decompressor> decompressor;
+  const char *compression = nullptr;
+  if (magic == 0xfd2fb528) {
+    compression = "zstd";
+#ifdef HAVE_ZSTD
+    std::map<unsigned, std::string> dicts;
+    for (auto& d : dict_fns) {
+      std::string dict = read_file(d);
+      const unsigned id = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+      if (!id) {
+	std::cerr << "ceph-log-query: " << d << " is not a zstd dictionary"
+		  << std::endl;
+	return 1;
+      }
+      dicts[id] = std::move(dict);
+    }
+    decompressor = std::make_unique<ZstdDecompressor>(
+      [&dicts, fn](unsigned id) {
+	if (auto p = dicts.find(id); p != dicts.end()) {
+	  return p->second;
+	}
+	// written next to the log, which may since have been rotated to
+	// <log_file>.1 and so on
+	const std::string suffix = "." + std::to_string(id) + ".dict";
+	std::string stem = fn;
+	std::string dict = read_file(stem + suffix);
+	if (auto dot = stem.rfind('.'); dict.empty() &&
+	    dot != std::string::npos && dot + 1 < stem.size() &&
+	    stem.find_first_not_of("0123456789", dot + 1) == std::string::npos) {
+	  stem.resize(dot);
+	  dict = read_file(stem + suffix);
+	}
+	return dict;
+      });
+#endif
+  } else if (magic == 0x184d2204) {
+    compression = "lz4";
+#ifdef HAVE_LZ4
+    decompressor = std::make_unique<Lz4Decompressor>();
+#endif
+  }
+  if (compression) {
+    if (!decompressor) {
+      std::cerr << "ceph-log-query: " << fn << " is " << compression
+		<< " compressed, which this build can't read" << std::endl;
+      return 1;
+    }
+    ::madvise(map, size, MADV_SEQUENTIAL);
+    uint64_t out_bytes = 0;
+    int r = scan_compressed(q, *decompressor, base, base + size, &out_bytes);
+    fflush(stdout);
+    if (stats) {
+      std::cerr << "ceph-log-query: decompressed " << size << " bytes to "
+		<< out_bytes << std::endl;
+    }
+    ::munmap(map, size);
+    return r;
+  }
+
+  // the stretches to read: those the index can't rule out, including any
+  // it doesn't cover (written before it was enabled, or since its last
+  // record)
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  auto add = [&ranges, size](uint64_t b, uint64_t e) {
+    e = std::min(e, size);
+    if (b >= e) {
+      return;
+    }
+    if (!ranges.empty() && ranges.back().second == b) {
+      ranges.back().second = e;
+    } else {
+      ranges.emplace_back(b, e);
+    }
+  };
+  uint64_t pos = 0;
+  const auto index = binary::read_index(index_fn);
+  for (const auto& r : index) {
+    if (r.offset < pos || r.offset >= size) {
+      // out of order, or of an earlier file of the same name
+      continue;
+    }
+    add(pos, r.offset);
+    if (q.want_chunk(r)) {
+      add(r.offset, r.offset + r.len);
+    }
+    pos = r.offset + r.len;
+  }
+  add(pos, size);
+
+  Scanner scanner(q, base, magic == binary::RECORD_MAGIC);
+  uint64_t read = 0;
+  for (const auto& [b, e] : ranges) {
+    ::madvise(const_cast<char*>(base) + (b & ~4095ull), e - (b & ~4095ull),
+	      MADV_WILLNEED);
+    scanner.scan(base + b, base + e, base + size, true);
+    read += e - b;
+  }
+  fflush(stdout);
+  if (stats) {
+    std::cerr << "ceph-log-query: read " << read << " of " << size
+	      << " bytes in " << ranges.size() << " stretches, "
+	      << index.size() << " index records, search: "
+	      << ceph::mem_find_name() << std::endl;
+  }
+  ::munmap(map, size);
+  return 0;
+}
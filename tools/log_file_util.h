@@ -0,0 +1,128 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/* What ceph-log-query and ceph-log-decode both need to read a log file:
+ * its time stamps, as given on the command line, and its sidecar index.
+ */
+
+#ifndef CEPH_TOOLS_LOG_FILE_UTIL_H
+#define CEPH_TOOLS_LOG_FILE_UTIL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "common/logging/BinaryLog.h"
+
+/// turns "YYYY-MM-DD HH:MM:SS[.frac]" into nanoseconds since the epoch;
+/// mktime() is only called when the hour changes.  *unit, if given, is
+/// what the last digit stands for, e.g. 1000000 for milliseconds.
+class StampParser {
+public:
+  bool parse(const char *p, const char *end, uint64_t *ns,
+	     uint64_t *unit = nullptr) {
+    if (end - p < 19 || p[4] != '-' || p[7] != '-' || p[10] != ' ' ||
+	p[13] != ':' || p[16] != ':') {
+      return false;
+    }
+    int v[6];
+    static const int at[6] = {0, 5, 8, 11, 14, 17};
+    static const int width[6] = {4, 2, 2, 2, 2, 2};
+    for (int f = 0; f < 6; ++f) {
+      v[f] = 0;
+      for (int i = 0; i < width[f]; ++i) {
+	const char c = p[at[f] + i];
+	if (c < '0' || c > '9') {
+	  return false;
+	}
+	v[f] = v[f] * 10 + (c - '0');
+      }
+    }
+    if (memcmp(p, hour, sizeof(hour)) != 0) {
+      std::tm tm{};
+      tm.tm_year = v[0] - 1900;
+      tm.tm_mon = v[1] - 1;
+      tm.tm_mday = v[2];
+      tm.tm_hour = v[3];
+      tm.tm_isdst = -1;
+      hour_start = mktime(&tm);
+      memcpy(hour, p, sizeof(hour));
+    }
+    uint64_t frac = 0;
+    int digits = 0;
+    if (end - p > 19 && p[19] == '.') {
+      for (const char *f = p + 20; f < end && *f >= '0' && *f <= '9'; ++f) {
+	if (digits < 9) {
+	  frac = frac * 10 + (*f - '0');
+	  ++digits;
+	}
+      }
+    }
+    uint64_t u = 1;
+    for (; digits < 9; ++digits) {
+      frac *= 10;
+      u *= 10;
+    }
+    if (unit) {
+      *unit = u;
+    }
+    const int64_t sec = hour_start + v[4] * 60 + v[5];
+    *ns = sec * 1000000000ull + frac;
+    return true;
+  }
+
+private:
+  char hour[13] = {}; ///< "YYYY-MM-DD HH" of hour_start
+  time_t hour_start = 0;
+};
+
+namespace ceph {
+namespace logging {
+namespace binary {
+
+/// the records of a log_file.idx, skipping any torn or foreign ones
+inline std::vector<index_record> read_index(const std::string& fn)
+{
+  std::vector<index_record> index;
+  int fd = ::open(fn.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd < 0) {
+    return index;
+  }
+  index_record r;
+  while (true) {
+    ssize_t n = ::read(fd, &r, sizeof(r));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n != (ssize_t)sizeof(r)) {
+      // a short read is a record torn by a crash
+      break;
+    }
+    if (r.magic == INDEX_MAGIC) {
+      index.push_back(r);
+    }
+  }
+  ::close(fd);
+  return index;
+}
+
+} // namespace binary
+}
+}
+
+#endif